@@ -1220,6 +1220,60 @@ dds_get_topic_filter_and_arg (
   dds_topic_filter_arg_fn *fn,
   void **arg);
 
+/**
+ * @brief Sets a content filter expression on a topic.
+ *
+ * The expression is in the SQL subset of the DDS specification, e.g.,
+ * "x > %0 AND id = 'a'", where fields are referenced by name (nested fields
+ * using '.'), and %n refers to the n-th parameter.  It is evaluated on the
+ * serialized data by readers using this topic, which drop samples that don't
+ * match before deserializing them or allocating any resources for them.
+ *
+ * Only supported for topics of types generated by the IDL compiler, for
+ * which the type description is available.  A filter expression is
+ * evaluated before a filter function set with dds_set_topic_filter_and_arg.
+ * It is safe to change the expression while data is being received.
+ *
+ * @param[in]  topic       The topic on which the content filter is set.
+ * @param[in]  expression  The filter expression, or NULL to remove it.
+ * @param[in]  nparams     Number of parameters.
+ * @param[in]  params      Parameters (strings interpreted as literals).
+ *
+ * @returns A dds_return_t indicating success or failure.
+ *
+ * @retval DDS_RETCODE_OK  Filter expression set successfully
+ * @retval DDS_RETCODE_BAD_PARAMETER  The topic handle is invalid, the expression
+ *             is invalid or references more parameters than provided
+ * @retval DDS_RETCODE_UNSUPPORTED  Filter expressions are not supported for
+ *             the type of the topic, or the expression is too complex
+ */
+DDS_EXPORT dds_return_t
+dds_set_topic_filter_expression (
+  dds_entity_t topic,
+  const char *expression,
+  uint32_t nparams,
+  const char * const *params);
+
+/**
+ * @brief Replaces the parameters of the content filter expression of a topic.
+ *
+ * @param[in]  topic    The topic on which the content filter is set.
+ * @param[in]  nparams  Number of parameters.
+ * @param[in]  params   Parameters (strings interpreted as literals).
+ *
+ * @returns A dds_return_t indicating success or failure.
+ *
+ * @retval DDS_RETCODE_OK  Filter parameters set successfully
+ * @retval DDS_RETCODE_BAD_PARAMETER  The topic handle is invalid or fewer
+ *             parameters are provided than the expression references
+ * @retval DDS_RETCODE_PRECONDITION_NOT_MET  The topic has no filter expression
+ */
+DDS_EXPORT dds_return_t
+dds_set_topic_filter_parameters (
+  dds_entity_t topic,
+  uint32_t nparams,
+  const char * const *params);
+
 /**
  * @brief Creates a new instance of a DDS subscriber
  *
@@ -1832,6 +1886,74 @@ dds_dispose_ih_ts(
 DDS_EXPORT dds_return_t
 dds_write(dds_entity_t writer, const void *data);
 
+/**
+ * @brief Write the values of a number of data instances in one operation
+ *
+ * This is equivalent to calling dds_write_ts for each of the samples in turn,
+ * but the per-call overhead is paid only once: the writer is locked once, the
+ * samples are added to the writer history together and packed into as few
+ * RTPS messages as possible, which are sent with a single flush at the end.
+ *
+ * The samples are written in order. If an error occurs, the samples preceding
+ * the failing one have been written and the remaining ones are dropped.
+ * Loaned samples are always consumed.
+ *
+ * @param[in]  writer The writer entity.
+ * @param[in]  data Array of n pointers to the values to be written.
+ * @param[in]  n Number of samples to write.
+ * @param[in]  timestamps Array of n source timestamps, or NULL to use the current time for all samples.
+ *
+ * @returns A dds_return_t indicating success or failure.
+ *
+ * @retval DDS_RETCODE_OK
+ *             The writer successfully wrote all samples.
+ * @retval DDS_RETCODE_ERROR
+ *             An internal error has occurred.
+ * @retval DDS_RETCODE_BAD_PARAMETER
+ *             One of the given arguments is not valid.
+ * @retval DDS_RETCODE_ILLEGAL_OPERATION
+ *             The operation is invoked on an inappropriate object.
+ * @retval DDS_RETCODE_ALREADY_DELETED
+ *             The entity has already been deleted.
+ * @retval DDS_RETCODE_TIMEOUT
+ *             The writer failed to write all samples reliably within the specified max_blocking_time.
+ */
+DDS_EXPORT dds_return_t
+dds_write_batch(dds_entity_t writer, const void * const *data, uint32_t n, const dds_time_t *timestamps);
+
+/**
+ * @brief Borrow a sample from the shared memory pool of a writer's domain
+ *
+ * The application fills in the sample and then passes it to dds_write (or
+ * dds_writedispose), which consumes the loan. If all readers of the writer are
+ * on the same host and have shared memory enabled, only a reference to the
+ * sample is sent to them, and they can access it through a loan obtained by
+ * calling dds_take or dds_read with buf[0] set to NULL. Otherwise the sample is
+ * copied as usual. A loan that is not written must be returned using
+ * dds_return_loan on the writer.
+ *
+ * This is only available if shared memory is enabled in the configuration and
+ * the type has no pointers and is at most SharedMemory/ChunkSize bytes.
+ *
+ * @param[in]  writer The writer entity.
+ * @param[out] sample Pointer to the borrowed sample.
+ *
+ * @returns A dds_return_t indicating success or failure.
+ *
+ * @retval DDS_RETCODE_OK
+ *             The sample was borrowed successfully.
+ * @retval DDS_RETCODE_BAD_PARAMETER
+ *             One of the given arguments is not valid.
+ * @retval DDS_RETCODE_ILLEGAL_OPERATION
+ *             The operation is invoked on an inappropriate object.
+ * @retval DDS_RETCODE_UNSUPPORTED
+ *             Shared memory is not enabled or the type is not suitable.
+ * @retval DDS_RETCODE_OUT_OF_RESOURCES
+ *             All chunks of the shared memory pool are in use.
+ */
+DDS_EXPORT dds_return_t
+dds_loan_sample(dds_entity_t writer, void **sample);
+
 /*TODO: What is it for and is it really needed? */
 DDS_EXPORT void
 dds_write_flush(dds_entity_t writer);
@@ -1863,6 +1985,35 @@ dds_write_flush(dds_entity_t writer);
 DDS_EXPORT dds_return_t
 dds_writecdr(dds_entity_t writer, struct ddsi_serdata *serdata);
 
+/**
+ * @brief Write a number of serialized values in one operation
+ *
+ * This is to dds_writecdr what dds_write_batch is to dds_write. The writer
+ * takes over the references to all serdata, also those that end up not being
+ * written because of an error.
+ *
+ * @param[in]  writer The writer entity.
+ * @param[in]  serdata Array of n serialized values to be written.
+ * @param[in]  n Number of serialized values to write.
+ *
+ * @returns A dds_return_t indicating success or failure.
+ *
+ * @retval DDS_RETCODE_OK
+ *             The writer successfully wrote all serialized values.
+ * @retval DDS_RETCODE_ERROR
+ *             An internal error has occurred.
+ * @retval DDS_RETCODE_BAD_PARAMETER
+ *             One of the given arguments is not valid.
+ * @retval DDS_RETCODE_ILLEGAL_OPERATION
+ *             The operation is invoked on an inappropriate object.
+ * @retval DDS_RETCODE_ALREADY_DELETED
+ *             The entity has already been deleted.
+ * @retval DDS_RETCODE_TIMEOUT
+ *             The writer failed to write all serialized values reliably within the specified max_blocking_time.
+ */
+DDS_EXPORT dds_return_t
+dds_writecdr_batch(dds_entity_t writer, struct ddsi_serdata **serdata, uint32_t n);
+
 /**
  * @brief Write the value of a data instance along with the source timestamp passed.
  *
@@ -1969,6 +2120,40 @@ dds_create_querycondition(
   uint32_t mask,
   dds_querycondition_filter_fn filter);
 
+/**
+ * @brief Creates a querycondition with a filter that only depends on the key fields.
+ *
+ * This is equivalent to @ref dds_create_querycondition, except that the reader
+ * may assume the filter only looks at the key fields of the sample.  The filter
+ * is then evaluated once for each instance (on a sample of which only the key
+ * fields are set), rather than on every sample that is received.  Filters that
+ * do look at other fields give unspecified results.
+ *
+ * Query conditions on a reader that use the same filter function share the
+ * result of evaluating it, regardless of their masks.  A reader supports an
+ * unlimited number of query conditions, using at most 64 distinct filters.
+ *
+ * @param[in]  reader  Reader to associate the condition to.
+ * @param[in]  mask    Interest (dds_sample_state_t|dds_view_state_t|dds_instance_state_t).
+ * @param[in]  filter  Callback that the application can use to filter specific instances.
+ *
+ * @returns A valid condition handle or an error code
+ *
+ * @retval >=0
+ *             A valid condition handle.
+ * @retval DDS_RETCODE_ERROR
+ *             An internal error has occurred.
+ * @retval DDS_RETCODE_ILLEGAL_OPERATION
+ *             The operation is invoked on an inappropriate object.
+ * @retval DDS_RETCODE_ALREADY_DELETED
+ *             The entity has already been deleted.
+ */
+DDS_EXPORT dds_entity_t
+dds_create_querycondition_key(
+  dds_entity_t reader,
+  uint32_t mask,
+  dds_querycondition_filter_fn filter);
+
 /**
  * @brief Creates a guardcondition.
  *
@@ -2212,6 +2397,80 @@ dds_waitset_set_trigger(
   dds_entity_t waitset,
   bool trigger);
 
+/**
+ * @brief Selects edge-triggered or level-triggered (the default) behaviour
+ *        of a waitset.
+ *
+ * A level-triggered waitset returns all attached entities that are
+ * triggered at the time of the wait. An edge-triggered waitset instead
+ * returns the entities that signalled a status change or trigger since
+ * they were last returned, whether or not they are still triggered, and
+ * each such event is returned only once. If there are more of these
+ * entities than fit in the list passed to dds_waitset_wait, the remaining
+ * ones are returned by the next call, and the return value is the number
+ * of entries filled in.
+ *
+ * Calling dds_waitset_wait on an edge-triggered waitset with an empty list
+ * returns the number of pending entities without consuming them.
+ *
+ * @param[in]  waitset         The waitset to set the mode of.
+ * @param[in]  edge_triggered  Whether the waitset is edge-triggered.
+ *
+ * @returns A dds_return_t indicating success or failure.
+ *
+ * @retval DDS_RETCODE_OK
+ *             Mode set.
+ * @retval DDS_RETCODE_BAD_PARAMETER
+ *             The given waitset is not valid.
+ * @retval DDS_RETCODE_ILLEGAL_OPERATION
+ *             The operation is invoked on an inappropriate object.
+ * @retval DDS_RETCODE_ALREADY_DELETED
+ *             The waitset has already been deleted.
+ */
+DDS_EXPORT dds_return_t
+dds_waitset_set_edge_triggered(
+  dds_entity_t waitset,
+  bool edge_triggered);
+
+/**
+ * @brief Get a file descriptor that becomes readable when the waitset triggers.
+ *
+ * This allows multiplexing a waitset with other file descriptors in an
+ * application's event loop (select, poll, epoll, &c.) instead of blocking in
+ * dds_waitset_wait on a separate thread. The descriptor becomes readable when
+ * an attached entity triggers, and remains readable until a call to
+ * dds_waitset_wait (typically with a 0 timeout) finds that no attached
+ * entities are triggered. The application must not read from, write to or
+ * close the descriptor; it remains valid until the waitset is deleted.
+ *
+ * With a level-triggered waitset, an entity remains triggered until the
+ * application has, e.g., taken the data, so the descriptor is only reset by
+ * the next wait. An edge-triggered waitset (see dds_waitset_set_edge_triggered)
+ * avoids this extra wake-up.
+ *
+ * @param[in]  waitset  The waitset to get the file descriptor of.
+ * @param[out] fd       The file descriptor.
+ *
+ * @returns A dds_return_t indicating success or failure.
+ *
+ * @retval DDS_RETCODE_OK
+ *             The file descriptor was returned.
+ * @retval DDS_RETCODE_BAD_PARAMETER
+ *             The given waitset is not valid or fd is NULL.
+ * @retval DDS_RETCODE_ILLEGAL_OPERATION
+ *             The operation is invoked on an inappropriate object.
+ * @retval DDS_RETCODE_ALREADY_DELETED
+ *             The waitset has already been deleted.
+ * @retval DDS_RETCODE_UNSUPPORTED
+ *             The platform does not support this.
+ * @retval DDS_RETCODE_OUT_OF_RESOURCES
+ *             The file descriptor could not be created.
+ */
+DDS_EXPORT dds_return_t
+dds_waitset_get_fd(
+  dds_entity_t waitset,
+  int *fd);
+
 /**
  * @brief This operation allows an application thread to wait for the a status
  *        change or other trigger on (one of) the entities that are attached to
@@ -2240,7 +2499,8 @@ dds_waitset_set_trigger(
  * untouched. When more entities are triggered, then only 'size' number of
  * entries are inserted into the list, but still the complete count of the
  * triggered entities is returned. Which "xs" blobs are returned in the
- * latter case is undefined.
+ * latter case is undefined. An edge-triggered waitset (see
+ * dds_waitset_set_edge_triggered) behaves differently in this respect.
  *
  * In case of a time out, the return value is 0.
  *
@@ -2312,7 +2572,8 @@ dds_waitset_wait(
  * untouched. When more entities are triggered, then only 'size' number of
  * entries are inserted into the list, but still the complete count of the
  * triggered entities is returned. Which "xs" blobs are returned in the
- * latter case is undefined.
+ * latter case is undefined. An edge-triggered waitset (see
+ * dds_waitset_set_edge_triggered) behaves differently in this respect.
  *
  * In case of a time out, the return value is 0.
  *
@@ -3187,8 +3448,10 @@ dds_read_next_wl(
  * provides an empty buffer, memory is allocated and managed by DDS. By calling dds_return_loan,
  * the memory is released so that the buffer can be reused during a successive read/take operation.
  * When a condition is provided, the reader to which the condition belongs is looked up.
+ * When a writer is provided, the samples must have been obtained using dds_loan_sample
+ * and not have been written.
  *
- * @param[in] reader_or_condition Reader or condition that belongs to a reader.
+ * @param[in] reader_or_condition Reader, writer or condition that belongs to a reader.
  * @param[in] buf An array of (pointers to) samples.
  * @param[in] bufsz The number of (pointers to) samples stored in buf.
  *
@@ -3257,6 +3520,17 @@ dds_instance_get_key(
  * Invoking on a Writer or Reader behaves as if dds_begin_coherent was invoked on its parent
  * Publisher or Subscriber respectively.
  *
+ * On a Publisher, all samples subsequently written by each of its writers until the matching
+ * dds_end_coherent form a coherent set: readers receive none of them before all of them
+ * have arrived, and then insert them all at once, triggering a single DATA_AVAILABLE.
+ * Coherent sets may be nested, only the outermost dds_end_coherent ends the set. The
+ * Publisher must have the PRESENTATION QoS with coherent_access set and access scope
+ * INSTANCE or TOPIC; sets span the writes of a single writer only. Historical data sent
+ * to late-joining readers is delivered sample by sample.
+ *
+ * On a Subscriber, received coherent sets are always made available atomically and the
+ * operation has no further effect.
+ *
  * @param[in]  entity The entity that is prepared for coherent access.
  *
  * @returns A dds_return_t indicating success or failure.
@@ -3267,6 +3541,12 @@ dds_instance_get_key(
  *             An internal error has occurred.
  * @retval DDS_RETCODE_BAD_PARAMETER
  *             The provided entity is invalid or not supported.
+ * @retval DDS_RETCODE_ILLEGAL_OPERATION
+ *             The entity is not a Publisher, Subscriber, Writer or Reader.
+ * @retval DDS_RETCODE_PRECONDITION_NOT_MET
+ *             The Publisher does not have coherent_access set in its PRESENTATION QoS.
+ * @retval DDS_RETCODE_UNSUPPORTED
+ *             The Publisher's PRESENTATION QoS has access scope GROUP.
  */
 DDS_EXPORT dds_return_t
 dds_begin_coherent(dds_entity_t entity);
@@ -3277,6 +3557,8 @@ dds_begin_coherent(dds_entity_t entity);
  * Invoking on a Writer or Reader behaves as if dds_end_coherent was invoked on its parent
  * Publisher or Subscriber respectively.
  *
+ * Ending the outermost coherent set of a Publisher publishes the set of each of its writers.
+ *
  * @param[in] entity The entity on which coherent access is finished.
  *
  * @returns A dds_return_t indicating success or failure.
@@ -3285,6 +3567,12 @@ dds_begin_coherent(dds_entity_t entity);
  *             The operation was successful.
  * @retval DDS_RETCODE_BAD_PARAMETER
  *             The provided entity is invalid or not supported.
+ * @retval DDS_RETCODE_ILLEGAL_OPERATION
+ *             The entity is not a Publisher, Subscriber, Writer or Reader.
+ * @retval DDS_RETCODE_PRECONDITION_NOT_MET
+ *             The Publisher is not in a coherent set.
+ * @retval DDS_RETCODE_UNSUPPORTED
+ *             A writer's topic type cannot represent the end of a coherent set.
  */
 DDS_EXPORT dds_return_t
 dds_end_coherent(dds_entity_t entity);
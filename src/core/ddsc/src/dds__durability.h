@@ -0,0 +1,71 @@
+/*
+ * Copyright(c) 2020 ADLINK Technology Limited and others
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License v. 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0, or the Eclipse Distribution License
+ * v. 1.0 which is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+ */
+#ifndef DDS__DURABILITY_H
+#define DDS__DURABILITY_H
+
+#include "dds__types.h"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+struct writer;
+struct reader;
+struct ddsi_serdata;
+struct ddsi_tkmap_instance;
+struct dds_durability_store;
+struct dds_durability_writer;
+
+/* The built-in durability service keeps, per topic, the samples written by
+   local TRANSIENT and PERSISTENT writers in an append-only log, indexed by
+   instance and trimmed according to the durability service QoS of the first
+   writer or reader of the topic.
+   New TRANSIENT and PERSISTENT readers get the stored samples inserted
+   directly into their reader history cache when they are created, even if
+   the writers have since been deleted.  With a directory configured the
+   logs are memory-mapped files and PERSISTENT data survives a restart.
+
+   A new reader gets every sample exactly once because it catches up with
+   the store locked and only after the deliveries to the local readers of
+   the samples already in the store have completed.  Writers store samples
+   with the store locked but deliver them after unlocking it, so a reader
+   that blocks them doesn't hold up all other writers of the topic. */
+
+/* Sets dom->m_durability, which is NULL if the service is disabled */
+void dds_durability_init (struct dds_domain *dom);
+/* Frees all stores, must be called before the tkmap is freed */
+void dds_durability_fini (struct dds_domain *dom);
+
+/* Returns NULL if wr is not a TRANSIENT or PERSISTENT writer or if the
+   durability service is disabled */
+struct dds_durability_writer *dds_durability_writer_new (struct dds_domain *dom, struct dds_topic *tp, const struct writer *wr);
+void dds_durability_writer_free (struct dds_durability_writer *dwr);
+void dds_durability_writer_lock (struct dds_durability_writer *dwr);
+/* Stores the sample, requires the writer to be locked */
+void dds_durability_writer_store (struct dds_durability_writer *dwr, struct ddsi_serdata *sample, struct ddsi_tkmap_instance *tk);
+/* Unlocks the writer before delivering the stored samples locally, after
+   which dds_durability_writer_delivered must be called */
+void dds_durability_writer_unlock_delivering (struct dds_durability_writer *dwr);
+void dds_durability_writer_delivered (struct dds_durability_writer *dwr);
+
+/* Returns the locked store for a new reader with the given QoS, or NULL if
+   the reader is not a TRANSIENT or PERSISTENT reader or if the durability
+   service is disabled */
+struct dds_durability_store *dds_durability_reader_begin (struct dds_domain *dom, struct dds_topic *tp, const dds_qos_t *qos);
+/* Delivers the stored samples to "rd" and unlocks the store */
+void dds_durability_reader_end (struct dds_durability_store *st, struct reader *rd);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif /* DDS__DURABILITY_H */
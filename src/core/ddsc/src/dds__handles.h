@@ -47,8 +47,10 @@ struct dds_entity;
  * handle. This will not remove any information within the handleserver, it just prevents
  * new claims. The delete will actually free handleserver internal memory.
  *
- * There's currently a global lock in the handle server that is used with every API call.
- * Maybe the internals can be improved to circumvent the need for that...
+ * Claiming and releasing a handle does not involve a global lock: the handle directly
+ * indexes a table, and deleting a handle waits for concurrent lookups in its slot to
+ * complete.  The lock in the handle server is only used for creating and deleting
+ * handles and for waiting until all claims have been released.
  */
 
 
@@ -23,7 +23,8 @@ dds_create_readcond(
   dds_reader *rd,
   dds_entity_kind_t kind,
   uint32_t mask,
-  dds_querycondition_filter_fn filter);
+  dds_querycondition_filter_fn filter,
+  bool keyonly);
 
 #if defined (__cplusplus)
 }
@@ -41,6 +41,9 @@ struct dds_statuscond;
 
 struct ddsi_sertopic;
 struct ddsi_rhc;
+struct ddsrt_hh;
+struct dds_durability;
+struct dds_durability_writer;
 
 typedef uint16_t status_mask_t;
 typedef ddsrt_atomic_uint32_t status_and_enabled_t;
@@ -237,6 +240,7 @@ typedef struct dds_domain {
   struct local_orphan_writer *builtintopic_writer_subscriptions;
 
   struct ddsi_builtin_topic_interface btif;
+  struct dds_durability *m_durability; /* NULL if durability service disabled */
   struct ddsi_domaingv gv;
 } dds_domain;
 
@@ -246,6 +250,7 @@ typedef struct dds_subscriber {
 
 typedef struct dds_publisher {
   struct dds_entity m_entity;
+  uint32_t m_coherent_depth; /* [m_entity.m_mutex] nesting depth of begin_coherent, writers are in a coherent set iff > 0 */
 } dds_publisher;
 
 typedef struct dds_ktopic {
@@ -279,6 +284,10 @@ typedef struct dds_reader {
   bool m_loan_out;
   void *m_loan;
   uint32_t m_loan_size;
+  /* Zero-copy loans (shared memory): the samples in the loan are kept
+     referenced until it is returned, m_loan_serdata has m_loan_size entries */
+  struct ddsi_serdata **m_loan_serdata;
+  uint32_t m_loan_nserdata;
 
   /* Status metrics */
 
@@ -297,6 +306,12 @@ typedef struct dds_writer {
   struct writer *m_wr;
   struct whc *m_whc; /* FIXME: ownership still with underlying DDSI writer (cos of DDSI built-in writers )*/
   bool whc_batch; /* FIXME: channels + latency budget */
+  struct dds_durability_writer *m_durability; /* non-NULL if data is kept by the durability service */
+  struct dds_writer_coherent_set *m_coherent; /* non-NULL iff in a coherent set, holds the samples for the local readers */
+  struct xevent *m_flush_xev; /* non-NULL iff flushing m_xp may be deferred by up to m_flush_delay */
+  dds_duration_t m_flush_delay; /* latency budget or write batching delay, constant */
+  ddsrt_mtime_t m_flush_deadline; /* when packet m_flush_packetid of m_xp must be sent, NEVER if nothing is pending */
+  unsigned m_flush_packetid;
 
   /* Status metrics */
 
@@ -313,13 +328,14 @@ typedef struct dds_topic {
 
   dds_topic_filter_arg_fn filter_fn;
   void *filter_ctx;
+  ddsrt_atomic_voidp_t m_filter; /* struct ddsi_filter *: filter expression, created on first use */
 
   /* Status metrics */
 
   dds_inconsistent_topic_status_t m_inconsistent_topic_status;
 } dds_topic;
 
-typedef uint32_t dds_querycond_mask_t;
+typedef uint64_t dds_querycond_mask_t;
 
 typedef struct dds_readcond {
   dds_entity m_entity;
@@ -330,7 +346,8 @@ typedef struct dds_readcond {
   struct dds_readcond *m_next;
   struct {
     dds_querycondition_filter_fn m_filter;
-    dds_querycond_mask_t m_qcmask; /* condition mask in RHC*/
+    dds_querycond_mask_t m_qcmask; /* condition mask in RHC, shared by conditions with the same filter */
+    bool m_keyonly; /* filter only depends on the key fields */
   } m_query;
 } dds_readcond;
 
@@ -342,6 +359,7 @@ typedef struct dds_attachment {
   dds_entity *entity;
   dds_entity_t handle;
   dds_attach_t arg;
+  size_t pos; /* index in waitset's entities array */
 } dds_attachment;
 
 typedef struct dds_waitset {
@@ -352,9 +370,16 @@ typedef struct dds_waitset {
      events on its parent */
   ddsrt_mutex_t wait_lock;
   ddsrt_cond_t wait_cond;
-  size_t nentities;         /* [wait_lock] */
-  size_t ntriggered;        /* [wait_lock] */
-  dds_attachment *entities; /* [wait_lock] 0 .. ntriggered are triggred, ntriggred .. nentities are not */
+  size_t nentities;              /* [wait_lock] */
+  size_t ntriggered;             /* [wait_lock] */
+  dds_attachment **entities;     /* [wait_lock] 0 .. ntriggered are on the ready list, ntriggered .. nentities are not */
+  struct ddsrt_hh *attachments;  /* [wait_lock] attachments indexed on handle */
+  bool edge_triggered;           /* [wait_lock] */
+
+  /* File descriptor that is readable while the ready list is (or may be) non-empty, created on
+     demand for integrating with an application's event loop; pollfd[0] = -1 if not created */
+  int pollfd[2];                 /* [wait_lock] read, write end (same fd for an eventfd) */
+  bool pollfd_signalled;         /* [wait_lock] */
 } dds_waitset;
 
 DDS_EXPORT extern dds_cyclonedds_entity dds_global;
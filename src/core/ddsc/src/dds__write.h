@@ -33,6 +33,20 @@ dds_return_t dds_write_impl (dds_writer *wr, const void *data, dds_time_t tstamp
 dds_return_t dds_writecdr_impl (dds_writer *wr, struct ddsi_serdata *d, dds_time_t tstamp, dds_write_action action);
 dds_return_t dds_writecdr_impl_lowlevel (struct writer *ddsi_wr, struct nn_xpack *xp, struct ddsi_serdata *d, bool flush);
 
+/* Coherent sets (writer locked): while in a coherent set, writes are not flushed and
+   the samples are delivered to the local readers only when the set ends, all at once
+   (remote readers do the same based on the coherent set information in the messages).
+   If the end of the set can't be written, the set is discarded rather than delivered
+   locally, unless the writer is being deleted. */
+void dds_write_begin_coherent (dds_writer *wr);
+dds_return_t dds_write_end_coherent (dds_writer *wr, bool deleting);
+
+/* Flushes the writer's xpack at the end of a write (writer locked, thread awake), or,
+   with a latency budget (if priority scheduling is enabled) or adaptive write batching,
+   schedules the flush for when the first sample in it has waited long enough so that
+   subsequent writes can be coalesced */
+void dds_write_flush_after_write (dds_writer *wr);
+
 #if defined (__cplusplus)
 }
 #endif
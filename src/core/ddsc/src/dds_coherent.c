@@ -16,14 +16,48 @@
 #include "dds__subscriber.h"
 #include "dds__publisher.h"
 
+static dds_return_t dds_coherent (dds_entity_t entity, bool begin)
+{
+  dds_entity *e;
+  dds_entity_t pubsub;
+  dds_entity_kind_t kind;
+  dds_return_t ret;
+  if ((ret = dds_entity_pin (entity, &e)) != DDS_RETCODE_OK)
+    return ret;
+  switch ((kind = dds_entity_kind (e)))
+  {
+    case DDS_KIND_READER:
+      kind = DDS_KIND_SUBSCRIBER;
+      pubsub = e->m_parent->m_hdllink.hdl;
+      break;
+    case DDS_KIND_WRITER:
+      kind = DDS_KIND_PUBLISHER;
+      pubsub = e->m_parent->m_hdllink.hdl;
+      break;
+    case DDS_KIND_PUBLISHER:
+    case DDS_KIND_SUBSCRIBER:
+      pubsub = entity;
+      break;
+    default:
+      pubsub = 0;
+      ret = DDS_RETCODE_ILLEGAL_OPERATION;
+      break;
+  }
+  dds_entity_unpin (e);
+  if (ret != DDS_RETCODE_OK)
+    return ret;
+  else if (kind == DDS_KIND_PUBLISHER)
+    return begin ? dds_publisher_begin_coherent (pubsub) : dds_publisher_end_coherent (pubsub);
+  else
+    return begin ? dds_subscriber_begin_coherent (pubsub) : dds_subscriber_end_coherent (pubsub);
+}
+
 dds_return_t dds_begin_coherent (dds_entity_t entity)
 {
-  static const dds_entity_kind_t kinds[] = { DDS_KIND_READER, DDS_KIND_WRITER, DDS_KIND_PUBLISHER, DDS_KIND_SUBSCRIBER };
-  return dds_generic_unimplemented_operation_manykinds (entity, sizeof (kinds) / sizeof (kinds[0]), kinds);
+  return dds_coherent (entity, true);
 }
 
 dds_return_t dds_end_coherent (dds_entity_t entity)
 {
-  static const dds_entity_kind_t kinds[] = { DDS_KIND_READER, DDS_KIND_WRITER, DDS_KIND_PUBLISHER, DDS_KIND_SUBSCRIBER };
-  return dds_generic_unimplemented_operation_manykinds (entity, sizeof (kinds) / sizeof (kinds[0]), kinds);
+  return dds_coherent (entity, false);
 }
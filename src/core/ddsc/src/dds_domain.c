@@ -19,7 +19,9 @@
 #include "dds__domain.h"
 #include "dds__builtin.h"
 #include "dds__whc_builtintopic.h"
+#include "dds__durability.h"
 #include "dds__entity.h"
+#include "dds__statistics.h"
 #include "dds/ddsi/ddsi_iid.h"
 #include "dds/ddsi/ddsi_tkmap.h"
 #include "dds/ddsi/ddsi_serdata.h"
@@ -28,17 +30,43 @@
 #include "dds/ddsi/q_config.h"
 #include "dds/ddsi/q_gc.h"
 #include "dds/ddsi/ddsi_domaingv.h"
+#include "dds/ddsi/ddsi_statistics.h"
 
 static dds_return_t dds_domain_free (dds_entity *vdomain);
 
+static const struct dds_stat_keyvalue_descriptor dds_domain_statistics_kv[] = {
+  { "rbuf_count", DDS_STAT_KIND_UINT32 },
+  { "rbuf_bytes", DDS_STAT_KIND_UINT64 },
+  { "rbuf_retained_bytes", DDS_STAT_KIND_UINT64 }
+};
+
+static const struct dds_stat_descriptor dds_domain_statistics_desc = {
+  .count = sizeof (dds_domain_statistics_kv) / sizeof (dds_domain_statistics_kv[0]),
+  .kv = dds_domain_statistics_kv
+};
+
+static struct dds_statistics *dds_domain_create_statistics (const struct dds_entity *entity)
+{
+  return dds_alloc_statistics (entity, &dds_domain_statistics_desc);
+}
+
+static void dds_domain_refresh_statistics (const struct dds_entity *entity, struct dds_statistics *stat)
+{
+  /* Receive buffer usage: number of buffers allocated (including those kept
+     alive by samples in reader caches), the memory used by them and the amount
+     of data in them retained by samples */
+  struct dds_domain *dom = (struct dds_domain *) entity;
+  ddsi_get_rbuf_stats (&dom->gv, &stat->kv[0].u.u32, &stat->kv[1].u.u64, &stat->kv[2].u.u64);
+}
+
 const struct dds_entity_deriver dds_entity_deriver_domain = {
   .interrupt = dds_entity_deriver_dummy_interrupt,
   .close = dds_entity_deriver_dummy_close,
   .delete = dds_domain_free,
   .set_qos = dds_entity_deriver_dummy_set_qos,
   .validate_status = dds_entity_deriver_dummy_validate_status,
-  .create_statistics = dds_entity_deriver_dummy_create_statistics,
-  .refresh_statistics = dds_entity_deriver_dummy_refresh_statistics
+  .create_statistics = dds_domain_create_statistics,
+  .refresh_statistics = dds_domain_refresh_statistics
 };
 
 static int dds_domain_compare (const void *va, const void *vb)
@@ -152,6 +180,8 @@ static dds_entity_t dds_domain_init (dds_domain *domain, dds_domainid_t domain_i
     goto fail_rtps_start;
   }
 
+  dds_durability_init (domain);
+
   if (domain->gv.config.liveliness_monitoring)
     ddsi_threadmon_register_domain (dds_global.threadmon, &domain->gv);
   dds_entity_init_complete (&domain->m_entity);
@@ -264,6 +294,7 @@ static dds_return_t dds_domain_free (dds_entity *vdomain)
   struct dds_domain *domain = (struct dds_domain *) vdomain;
   rtps_stop (&domain->gv);
   dds__builtin_fini (domain);
+  dds_durability_fini (domain);
 
   if (domain->gv.config.liveliness_monitoring)
     ddsi_threadmon_unregister_domain (dds_global.threadmon, &domain->gv);
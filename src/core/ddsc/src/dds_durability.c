@@ -0,0 +1,1065 @@
+/*
+ * Copyright(c) 2020 ADLINK Technology Limited and others
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License v. 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0, or the Eclipse Distribution License
+ * v. 1.0 which is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+ */
+#include <assert.h>
+#include <string.h>
+
+#include "dds/ddsrt/avl.h"
+#include "dds/ddsrt/heap.h"
+#include "dds/ddsrt/hopscotch.h"
+#include "dds/ddsrt/io.h"
+#include "dds/ddsrt/mh3.h"
+#include "dds/ddsrt/string.h"
+#include "dds/ddsrt/sync.h"
+#include "dds/ddsrt/time.h"
+#include "dds/ddsi/q_config.h"
+#include "dds/ddsi/q_entity.h"
+#include "dds/ddsi/q_protocol.h"
+#include "dds/ddsi/q_qosmatch.h"
+#include "dds/ddsi/q_thread.h"
+#include "dds/ddsi/ddsi_iid.h"
+#include "dds/ddsi/ddsi_rhc.h"
+#include "dds/ddsi/ddsi_serdata.h"
+#include "dds/ddsi/ddsi_sertopic.h"
+#include "dds/ddsi/ddsi_tkmap.h"
+#include "dds/ddsi/ddsi_domaingv.h"
+#include "dds__durability.h"
+
+#if (defined __linux || defined __APPLE__) && !LWIP_SOCKET
+#define DUR_HAVE_MMAP 1
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#define DUR_HAVE_MMAP 0
+#endif
+
+#define DUR_LOG_MAGIC "CDDSDUR1"
+#define DUR_LOG_INITIAL_SIZE 65536
+#define DUR_COMPACT_THRESHOLD 65536
+
+/* A log starts with a header that says how much of it is valid, followed by
+   records, each a multiple of 8 bytes.  Writer records describe a writer
+   and are referenced by the samples it wrote.  Records are never changed:
+   samples that are pushed out of the history become garbage, which is
+   reclaimed by rewriting the log once it accounts for half of it. */
+struct dur_log_header {
+  char magic[8];
+  uint64_t end;
+};
+
+enum dur_rec_type {
+  DUR_REC_WRITER = 1,
+  DUR_REC_SAMPLE = 2
+};
+
+/* writer record flags */
+#define DUR_WRFLAG_PERSISTENT  1u
+#define DUR_WRFLAG_AUTODISPOSE 2u
+/* sample record flags: statusinfo in the low bits */
+#define DUR_SMFLAG_KEY         0x100u
+
+struct dur_rec {
+  uint32_t size;     /* of record, including header and padding */
+  uint32_t datasize; /* of payload */
+  uint32_t wrid;
+  uint16_t type;
+  uint16_t flags;
+  int64_t timestamp;
+};
+
+/* payload of a writer record, followed by npartitions 0-terminated strings */
+struct dur_rec_writer {
+  ddsi_guid_t guid;
+  int32_t ownership_strength;
+  uint32_t npartitions;
+};
+
+struct dur_log {
+  char *path; /* NULL if in memory */
+  int fd;
+  unsigned char *base;
+  size_t size;
+  size_t end;
+};
+
+struct dur_writer {
+  ddsi_guid_t guid;
+  uint64_t iid;
+  int32_t ownership_strength;
+  bool persistent;
+  bool autodispose;
+  bool alive;
+  uint32_t nsamples;
+  size_t off;
+  dds_qos_t *qos; /* partition only, for matching readers */
+  struct dds_durability_writer *dwr; /* NULL once the DDS writer is gone */
+};
+
+struct dur_sample {
+  struct dur_sample *next;
+  size_t off;
+};
+
+struct dur_instance {
+  struct ddsi_tkmap_instance *tk;
+  struct dur_sample *oldest, *latest;
+  uint32_t nsamples;
+  bool disposed;
+  ddsrt_mtime_t disposed_at;
+  struct dur_instance *disposed_prev, *disposed_next;
+};
+
+struct dur_store_key {
+  char *topic_name;
+  char *type_name;
+};
+
+struct dds_durability_store {
+  ddsrt_avl_node_t avlnode;
+  struct dur_store_key key;
+  struct dds_durability *dur;
+  struct ddsi_sertopic *tp;
+  ddsrt_mutex_t lock;
+  ddsrt_cond_t cond;
+  /* samples stored but possibly not yet delivered by writers, and new
+     readers waiting for those deliveries to complete */
+  uint32_t ndelivering;
+  uint32_t nreaders_waiting;
+  struct dur_log log;
+  size_t garbage;
+  struct ddsrt_hh *instances;
+  uint32_t ninstances;
+  uint32_t nsamples;
+  uint32_t nwriters;
+  struct dur_writer **writers;
+  /* disposed instances in order of disposal, for service_cleanup_delay */
+  struct dur_instance *disposed_first, *disposed_last;
+  /* from the durability service QoS, 0 means unlimited */
+  bool keep_all;
+  uint32_t depth;
+  uint32_t max_samples;
+  uint32_t max_instances;
+  uint32_t max_samples_per_instance;
+  dds_duration_t cleanup_delay;
+};
+
+struct dds_durability_writer {
+  struct dds_durability_store *st;
+  uint32_t wrid;
+};
+
+struct dds_durability {
+  struct ddsi_domaingv *gv;
+  char *directory; /* NULL if logs are kept in memory */
+  ddsrt_mutex_t lock;
+  ddsrt_avl_tree_t stores;
+};
+
+static int compare_store_key (const void *va, const void *vb)
+{
+  const struct dur_store_key *a = va;
+  const struct dur_store_key *b = vb;
+  int c;
+  if ((c = strcmp (a->topic_name, b->topic_name)) != 0)
+    return c;
+  return strcmp (a->type_name, b->type_name);
+}
+
+static const ddsrt_avl_treedef_t dur_stores_td = DDSRT_AVL_TREEDEF_INITIALIZER (offsetof (struct dds_durability_store, avlnode), offsetof (struct dds_durability_store, key), compare_store_key, 0);
+
+static uint32_t dur_instance_hash (const void *va)
+{
+  const struct dur_instance *a = va;
+  return (uint32_t) a->tk->m_iid;
+}
+
+static int dur_instance_eq (const void *va, const void *vb)
+{
+  const struct dur_instance *a = va;
+  const struct dur_instance *b = vb;
+  return a->tk == b->tk;
+}
+
+/* LOG ------------------------------------------------------------------ */
+
+static void dur_log_set_end (struct dur_log *log, size_t end)
+{
+  log->end = end;
+  ((struct dur_log_header *) log->base)->end = end;
+}
+
+static void dur_log_init_mem (struct dur_log *log)
+{
+  log->path = NULL;
+  log->fd = -1;
+  log->size = DUR_LOG_INITIAL_SIZE;
+  log->base = ddsrt_malloc (log->size);
+  memcpy (log->base, DUR_LOG_MAGIC, sizeof (((struct dur_log_header *) 0)->magic));
+  dur_log_set_end (log, sizeof (struct dur_log_header));
+}
+
+#if DUR_HAVE_MMAP
+static bool dur_log_map (struct dur_log *log, size_t size)
+{
+  void *p;
+  if (ftruncate (log->fd, (off_t) size) != 0)
+    return false;
+  if ((p = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, log->fd, 0)) == MAP_FAILED)
+    return false;
+  if (log->base)
+    (void) munmap (log->base, log->size);
+  log->base = p;
+  log->size = size;
+  return true;
+}
+
+static bool dur_log_init_file (struct dur_log *log, const char *path, bool truncate)
+{
+  const struct dur_log_header *hdr;
+  struct stat st;
+  size_t size;
+  if ((log->fd = open (path, O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0), 0600)) == -1)
+    return false;
+  log->base = NULL;
+  log->size = 0;
+  if (fstat (log->fd, &st) != 0)
+    goto err;
+  size = ((size_t) st.st_size < DUR_LOG_INITIAL_SIZE) ? DUR_LOG_INITIAL_SIZE : (size_t) st.st_size;
+  if (!dur_log_map (log, size))
+    goto err;
+  hdr = (const struct dur_log_header *) log->base;
+  if (memcmp (hdr->magic, DUR_LOG_MAGIC, sizeof (hdr->magic)) == 0 && hdr->end >= sizeof (*hdr) && hdr->end <= log->size)
+    log->end = (size_t) hdr->end;
+  else
+  {
+    memcpy (log->base, DUR_LOG_MAGIC, sizeof (hdr->magic));
+    dur_log_set_end (log, sizeof (*hdr));
+  }
+  log->path = ddsrt_strdup (path);
+  return true;
+err:
+  if (log->base)
+    (void) munmap (log->base, log->size);
+  (void) close (log->fd);
+  return false;
+}
+#endif
+
+static void dur_log_fini (struct dur_log *log)
+{
+#if DUR_HAVE_MMAP
+  if (log->path)
+  {
+    (void) munmap (log->base, log->size);
+    (void) close (log->fd);
+    ddsrt_free (log->path);
+    return;
+  }
+#endif
+  ddsrt_free (log->base);
+}
+
+static bool dur_log_reserve (struct dur_log *log, size_t n)
+{
+  size_t size = log->size;
+  if (log->end + n <= size)
+    return true;
+  while (log->end + n > size)
+    size *= 2;
+#if DUR_HAVE_MMAP
+  if (log->path)
+    return dur_log_map (log, size);
+#endif
+  log->base = ddsrt_realloc (log->base, size);
+  log->size = size;
+  return true;
+}
+
+static size_t dur_rec_size (size_t datasize)
+{
+  return (sizeof (struct dur_rec) + datasize + 7) & ~(size_t) 7;
+}
+
+static struct dur_rec *dur_log_rec (const struct dur_log *log, size_t off)
+{
+  return (struct dur_rec *) (log->base + off);
+}
+
+/* Returns a zero-initialized record at the end of the log of sufficient size
+   for datasize bytes of payload; it becomes part of the log once committed */
+static struct dur_rec *dur_log_new_rec (struct dur_log *log, enum dur_rec_type type, size_t datasize)
+{
+  const size_t size = dur_rec_size (datasize);
+  struct dur_rec *rec;
+  if (datasize > UINT32_MAX - sizeof (*rec) - 7 || !dur_log_reserve (log, size))
+    return NULL;
+  rec = dur_log_rec (log, log->end);
+  memset (rec, 0, size);
+  rec->size = (uint32_t) size;
+  rec->datasize = (uint32_t) datasize;
+  rec->type = (uint16_t) type;
+  return rec;
+}
+
+static size_t dur_log_commit_rec (struct dur_log *log, const struct dur_rec *rec)
+{
+  const size_t off = log->end;
+  assert ((const unsigned char *) rec == log->base + off);
+  dur_log_set_end (log, off + rec->size);
+  return off;
+}
+
+static bool dur_log_copy_rec (struct dur_log *dst, const struct dur_log *src, size_t off)
+{
+  const struct dur_rec *rec = dur_log_rec (src, off);
+  if (!dur_log_reserve (dst, rec->size))
+    return false;
+  memcpy (dst->base + dst->end, rec, rec->size);
+  (void) dur_log_commit_rec (dst, dur_log_rec (dst, dst->end));
+  return true;
+}
+
+/* STORE ---------------------------------------------------------------- */
+
+static void dur_store_drop_writer (struct dds_durability_store *st, uint32_t wrid)
+{
+  struct dur_writer * const w = st->writers[wrid];
+  assert (!w->alive && w->nsamples == 0);
+  st->garbage += dur_log_rec (&st->log, w->off)->size;
+  st->writers[wrid] = NULL;
+  dds_delete_qos (w->qos);
+  ddsrt_free (w);
+}
+
+static void dur_store_drop_oldest (struct dds_durability_store *st, struct dur_instance *inst)
+{
+  struct dur_sample * const s = inst->oldest;
+  const struct dur_rec *rec = dur_log_rec (&st->log, s->off);
+  struct dur_writer * const w = st->writers[rec->wrid];
+  st->garbage += rec->size;
+  if ((inst->oldest = s->next) == NULL)
+    inst->latest = NULL;
+  inst->nsamples--;
+  st->nsamples--;
+  if (--w->nsamples == 0 && !w->alive)
+    dur_store_drop_writer (st, rec->wrid);
+  ddsrt_free (s);
+}
+
+static void dur_store_unlink_disposed (struct dds_durability_store *st, struct dur_instance *inst)
+{
+  assert (inst->disposed);
+  if (inst->disposed_prev)
+    inst->disposed_prev->disposed_next = inst->disposed_next;
+  else
+    st->disposed_first = inst->disposed_next;
+  if (inst->disposed_next)
+    inst->disposed_next->disposed_prev = inst->disposed_prev;
+  else
+    st->disposed_last = inst->disposed_prev;
+  inst->disposed = false;
+}
+
+static void dur_store_drop_instance (struct dds_durability_store *st, struct dur_instance *inst)
+{
+  while (inst->oldest)
+    dur_store_drop_oldest (st, inst);
+  if (inst->disposed)
+    dur_store_unlink_disposed (st, inst);
+  (void) ddsrt_hh_remove (st->instances, inst);
+  st->ninstances--;
+  ddsi_tkmap_instance_unref (st->dur->gv->m_tkmap, inst->tk);
+  ddsrt_free (inst);
+}
+
+static void dur_store_purge_disposed (struct dds_durability_store *st, ddsrt_mtime_t tnow)
+{
+  if (st->cleanup_delay == DDS_INFINITY)
+    return;
+  while (st->disposed_first && ddsrt_mtime_add_duration (st->disposed_first->disposed_at, st->cleanup_delay).v <= tnow.v)
+    dur_store_drop_instance (st, st->disposed_first);
+}
+
+/* Looks up or creates the instance for a new sample and makes room for it
+   in accordance with the history and resource limits; returns NULL if the
+   sample must be rejected */
+static struct dur_instance *dur_store_admit (struct dds_durability_store *st, struct ddsi_tkmap_instance *tk)
+{
+  struct dur_instance template, *inst;
+  template.tk = tk;
+  if ((inst = ddsrt_hh_lookup (st->instances, &template)) == NULL)
+  {
+    if (st->max_instances && st->ninstances >= st->max_instances)
+      return NULL;
+    inst = ddsrt_malloc (sizeof (*inst));
+    inst->tk = tk;
+    ddsi_tkmap_instance_ref (tk);
+    inst->oldest = inst->latest = NULL;
+    inst->nsamples = 0;
+    inst->disposed = false;
+    inst->disposed_prev = inst->disposed_next = NULL;
+    (void) ddsrt_hh_add (st->instances, inst);
+    st->ninstances++;
+  }
+  if (!st->keep_all && inst->nsamples >= st->depth)
+    dur_store_drop_oldest (st, inst);
+  if ((st->max_samples_per_instance && inst->nsamples >= st->max_samples_per_instance) ||
+      (st->max_samples && st->nsamples >= st->max_samples))
+  {
+    if (inst->nsamples == 0)
+      dur_store_drop_instance (st, inst);
+    return NULL;
+  }
+  return inst;
+}
+
+static void dur_store_link (struct dds_durability_store *st, struct dur_instance *inst, size_t off, ddsrt_mtime_t tnow)
+{
+  const struct dur_rec *rec = dur_log_rec (&st->log, off);
+  struct dur_sample *s = ddsrt_malloc (sizeof (*s));
+  s->off = off;
+  s->next = NULL;
+  if (inst->latest)
+    inst->latest->next = s;
+  else
+    inst->oldest = s;
+  inst->latest = s;
+  inst->nsamples++;
+  st->nsamples++;
+  st->writers[rec->wrid]->nsamples++;
+  if (inst->disposed)
+    dur_store_unlink_disposed (st, inst);
+  if (rec->flags & NN_STATUSINFO_DISPOSE)
+  {
+    inst->disposed = true;
+    inst->disposed_at = tnow;
+    inst->disposed_next = NULL;
+    if ((inst->disposed_prev = st->disposed_last) != NULL)
+      st->disposed_last->disposed_next = inst;
+    else
+      st->disposed_first = inst;
+    st->disposed_last = inst;
+  }
+}
+
+static uint32_t dur_store_new_wrid (struct dds_durability_store *st, uint32_t wrid)
+{
+  if (wrid >= st->nwriters)
+  {
+    st->writers = ddsrt_realloc (st->writers, (wrid + 1) * sizeof (*st->writers));
+    while (st->nwriters <= wrid)
+      st->writers[st->nwriters++] = NULL;
+  }
+  return wrid;
+}
+
+static struct dur_writer *dur_writer_from_rec (const struct dur_rec *rec, size_t off)
+{
+  const struct dur_rec_writer *rw = (const struct dur_rec_writer *) (rec + 1);
+  const char *strs = (const char *) (rw + 1), *strs_end = (const char *) (rec + 1) + rec->datasize;
+  struct dur_writer *w;
+  char **ps;
+  if (rec->datasize < sizeof (*rw) || rw->npartitions > rec->datasize)
+    return NULL;
+  ps = ddsrt_malloc ((rw->npartitions + 1) * sizeof (*ps));
+  for (uint32_t i = 0; i < rw->npartitions; i++)
+  {
+    const char *nul = memchr (strs, 0, (size_t) (strs_end - strs));
+    if (nul == NULL)
+    {
+      ddsrt_free (ps);
+      return NULL;
+    }
+    ps[i] = (char *) strs;
+    strs = nul + 1;
+  }
+  w = ddsrt_malloc (sizeof (*w));
+  w->guid = rw->guid;
+  w->iid = ddsi_iid_gen ();
+  w->ownership_strength = rw->ownership_strength;
+  w->persistent = (rec->flags & DUR_WRFLAG_PERSISTENT) != 0;
+  w->autodispose = (rec->flags & DUR_WRFLAG_AUTODISPOSE) != 0;
+  w->alive = false;
+  w->nsamples = 0;
+  w->off = off;
+  w->qos = dds_create_qos ();
+  w->dwr = NULL;
+  dds_qset_partition (w->qos, rw->npartitions, (const char **) ps);
+  ddsrt_free (ps);
+  return w;
+}
+
+static void dur_store_replay (struct dds_durability_store *st)
+{
+  struct ddsi_domaingv * const gv = st->dur->gv;
+  const ddsrt_mtime_t tnow = ddsrt_time_monotonic ();
+  size_t off = sizeof (struct dur_log_header);
+  while (off + sizeof (struct dur_rec) <= st->log.end)
+  {
+    const struct dur_rec *rec = dur_log_rec (&st->log, off);
+    if (rec->size < sizeof (*rec) || (rec->size % 8) != 0 || rec->size > st->log.end - off || rec->datasize > rec->size - sizeof (*rec))
+      break;
+    bool keep = false;
+    if (rec->type == DUR_REC_WRITER)
+    {
+      /* writer ids are assigned in order of the writer records, anything
+         else means the file is corrupt and the rest of it can't be trusted */
+      if (rec->wrid != st->nwriters)
+        break;
+      (void) dur_store_new_wrid (st, rec->wrid);
+      /* only PERSISTENT data outlives the process that wrote it */
+      struct dur_writer *w;
+      if ((rec->flags & DUR_WRFLAG_PERSISTENT) && (w = dur_writer_from_rec (rec, off)) != NULL)
+      {
+        st->writers[rec->wrid] = w;
+        keep = true;
+      }
+    }
+    else if (rec->type == DUR_REC_SAMPLE && rec->wrid < st->nwriters && st->writers[rec->wrid] != NULL)
+    {
+      ddsrt_iovec_t iov;
+      struct ddsi_serdata *sd;
+      iov.iov_base = (void *) (rec + 1);
+      iov.iov_len = (ddsrt_iov_len_t) rec->datasize;
+      if ((sd = ddsi_serdata_from_ser_iov (st->tp, (rec->flags & DUR_SMFLAG_KEY) ? SDK_KEY : SDK_DATA, 1, &iov, rec->datasize)) != NULL)
+      {
+        struct ddsi_tkmap_instance *tk = ddsi_tkmap_lookup_instance_ref (gv->m_tkmap, sd);
+        struct dur_instance *inst;
+        if ((inst = dur_store_admit (st, tk)) != NULL)
+        {
+          dur_store_link (st, inst, off, tnow);
+          keep = true;
+        }
+        ddsi_tkmap_instance_unref (gv->m_tkmap, tk);
+        ddsi_serdata_unref (sd);
+      }
+    }
+    if (!keep)
+      st->garbage += rec->size;
+    off += rec->size;
+  }
+  if (off != st->log.end)
+  {
+    DDS_CWARNING (&gv->logconfig, "durability: %s: ignoring %"PRIuSIZE" bytes of corrupt or trailing garbage\n", st->log.path, st->log.end - off);
+    dur_log_set_end (&st->log, off);
+  }
+  /* writers are never alive at this point, so writers without samples are garbage */
+  for (uint32_t i = 0; i < st->nwriters; i++)
+    if (st->writers[i] && st->writers[i]->nsamples == 0)
+      dur_store_drop_writer (st, i);
+  DDS_CLOG (DDS_LC_DISCOVERY, &gv->logconfig, "durability: %s: %"PRIu32" samples, %"PRIu32" instances from %s\n",
+            st->key.topic_name, st->nsamples, st->ninstances, st->log.path);
+}
+
+static void dur_store_compact (struct dds_durability_store *st)
+{
+  struct dur_log nlog;
+#if DUR_HAVE_MMAP
+  char *tmppath = NULL;
+  if (st->log.path)
+  {
+    (void) ddsrt_asprintf (&tmppath, "%s.tmp", st->log.path);
+    if (!dur_log_init_file (&nlog, tmppath, true))
+    {
+      DDS_CWARNING (&st->dur->gv->logconfig, "durability: %s: can't create, not compacting\n", tmppath);
+      ddsrt_free (tmppath);
+      return;
+    }
+  }
+  else
+#endif
+  {
+    dur_log_init_mem (&nlog);
+  }
+
+  /* copy all live records into the new log, offsets are updated only once
+     everything has been copied successfully */
+  struct ddsrt_hh_iter it;
+  bool ok = true;
+  size_t off;
+  for (uint32_t i = 0; ok && i < st->nwriters; i++)
+    if (st->writers[i])
+      ok = dur_log_copy_rec (&nlog, &st->log, st->writers[i]->off);
+  for (struct dur_instance *inst = ddsrt_hh_iter_first (st->instances, &it); ok && inst; inst = ddsrt_hh_iter_next (&it))
+    for (struct dur_sample *s = inst->oldest; ok && s; s = s->next)
+      ok = dur_log_copy_rec (&nlog, &st->log, s->off);
+#if DUR_HAVE_MMAP
+  if (ok && tmppath && rename (tmppath, st->log.path) != 0)
+    ok = false;
+#endif
+  if (!ok)
+  {
+    DDS_CWARNING (&st->dur->gv->logconfig, "durability: %s: compacting failed\n", st->key.topic_name);
+    dur_log_fini (&nlog);
+#if DUR_HAVE_MMAP
+    if (tmppath)
+    {
+      (void) remove (tmppath);
+      ddsrt_free (tmppath);
+    }
+#endif
+    return;
+  }
+
+  /* records were copied in the same order, so walk the new log in step;
+     the writers get renumbered densely in the process to maintain the
+     invariant that the writer ids follow the order of the writer records */
+  uint32_t * const wrmap = ddsrt_malloc ((st->nwriters + 1) * sizeof (*wrmap));
+  uint32_t nwriters = 0;
+  off = sizeof (struct dur_log_header);
+  for (uint32_t i = 0; i < st->nwriters; i++)
+    if (st->writers[i])
+    {
+      struct dur_writer * const w = st->writers[i];
+      struct dur_rec * const rec = dur_log_rec (&nlog, off);
+      wrmap[i] = nwriters;
+      rec->wrid = nwriters;
+      w->off = off;
+      if (w->dwr)
+        w->dwr->wrid = nwriters;
+      st->writers[nwriters++] = w;
+      off += rec->size;
+    }
+  for (struct dur_instance *inst = ddsrt_hh_iter_first (st->instances, &it); inst; inst = ddsrt_hh_iter_next (&it))
+    for (struct dur_sample *s = inst->oldest; s; s = s->next)
+    {
+      struct dur_rec * const rec = dur_log_rec (&nlog, off);
+      rec->wrid = wrmap[rec->wrid];
+      s->off = off;
+      off += rec->size;
+    }
+  assert (off == nlog.end);
+  ddsrt_free (wrmap);
+  st->nwriters = nwriters;
+#if DUR_HAVE_MMAP
+  if (tmppath)
+  {
+    /* the new log now lives under the old name */
+    ddsrt_free (nlog.path);
+    nlog.path = ddsrt_strdup (st->log.path);
+    ddsrt_free (tmppath);
+  }
+#endif
+  DDS_CLOG (DDS_LC_DISCOVERY, &st->dur->gv->logconfig, "durability: %s: compacted log from %"PRIuSIZE" to %"PRIuSIZE" bytes\n",
+            st->key.topic_name, st->log.end, nlog.end);
+  dur_log_fini (&st->log);
+  st->log = nlog;
+  st->garbage = 0;
+}
+
+static void dur_store_maybe_compact (struct dds_durability_store *st)
+{
+  if (st->garbage > DUR_COMPACT_THRESHOLD && st->garbage > (st->log.end - sizeof (struct dur_log_header)) / 2)
+    dur_store_compact (st);
+}
+
+#if DUR_HAVE_MMAP
+static char *dur_store_path (const struct dds_durability *dur, const struct ddsi_sertopic *tp)
+{
+  /* topic and type names needn't be valid file names, so use the topic name
+     with anything questionable replaced, and a hash of the full names to
+     make it unique */
+  const size_t nlen = strlen (tp->name) + 1, tlen = strlen (tp->type_name) + 1;
+  char *buf = ddsrt_malloc (nlen + tlen), *path;
+  memcpy (buf, tp->name, nlen);
+  memcpy (buf + nlen, tp->type_name, tlen);
+  const uint32_t hash = ddsrt_mh3 (buf, nlen + tlen, 0);
+  for (size_t i = 0; i < nlen - 1; i++)
+  {
+    const char c = buf[i];
+    if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-'))
+      buf[i] = '_';
+  }
+  (void) ddsrt_asprintf (&path, "%s/%s.%08"PRIx32".dlog", dur->directory, buf, hash);
+  ddsrt_free (buf);
+  return path;
+}
+#endif
+
+static struct dds_durability_store *dur_store_new (struct dds_durability *dur, const struct ddsi_sertopic *tp, const dds_qos_t *qos)
+{
+  const dds_durability_service_qospolicy_t *ds =
+    (qos->present & QP_DURABILITY_SERVICE) ? &qos->durability_service : &dur->gv->default_xqos_tp.durability_service;
+  struct dds_durability_store *st = ddsrt_malloc (sizeof (*st));
+  st->key.topic_name = ddsrt_strdup (tp->name);
+  st->key.type_name = ddsrt_strdup (tp->type_name);
+  st->dur = dur;
+  st->tp = ddsi_sertopic_ref (tp);
+  ddsrt_mutex_init (&st->lock);
+  ddsrt_cond_init (&st->cond);
+  st->ndelivering = 0;
+  st->nreaders_waiting = 0;
+  st->garbage = 0;
+  st->instances = ddsrt_hh_new (1, dur_instance_hash, dur_instance_eq);
+  st->ninstances = 0;
+  st->nsamples = 0;
+  st->nwriters = 0;
+  st->writers = NULL;
+  st->disposed_first = st->disposed_last = NULL;
+  st->keep_all = (ds->history.kind == DDS_HISTORY_KEEP_ALL);
+  st->depth = (ds->history.depth > 0) ? (uint32_t) ds->history.depth : 1;
+  st->max_samples = (ds->resource_limits.max_samples > 0) ? (uint32_t) ds->resource_limits.max_samples : 0;
+  st->max_instances = (ds->resource_limits.max_instances > 0) ? (uint32_t) ds->resource_limits.max_instances : 0;
+  st->max_samples_per_instance = (ds->resource_limits.max_samples_per_instance > 0) ? (uint32_t) ds->resource_limits.max_samples_per_instance : 0;
+  st->cleanup_delay = ds->service_cleanup_delay;
+
+#if DUR_HAVE_MMAP
+  if (dur->directory)
+  {
+    char *path = dur_store_path (dur, tp);
+    if (dur_log_init_file (&st->log, path, false))
+    {
+      ddsrt_free (path);
+      dur_store_replay (st);
+      dur_store_maybe_compact (st);
+      return st;
+    }
+    DDS_CWARNING (&dur->gv->logconfig, "durability: %s: can't open, keeping %s in memory\n", path, tp->name);
+    ddsrt_free (path);
+  }
+#endif
+  dur_log_init_mem (&st->log);
+  return st;
+}
+
+static void dur_store_free (struct dds_durability_store *st)
+{
+  struct ddsrt_hh_iter it;
+  for (struct dur_instance *inst = ddsrt_hh_iter_first (st->instances, &it); inst; inst = ddsrt_hh_iter_next (&it))
+  {
+    struct dur_sample *s;
+    while ((s = inst->oldest) != NULL)
+    {
+      inst->oldest = s->next;
+      ddsrt_free (s);
+    }
+    ddsi_tkmap_instance_unref (st->dur->gv->m_tkmap, inst->tk);
+    ddsrt_free (inst);
+  }
+  ddsrt_hh_free (st->instances);
+  for (uint32_t i = 0; i < st->nwriters; i++)
+  {
+    if (st->writers[i])
+    {
+      dds_delete_qos (st->writers[i]->qos);
+      ddsrt_free (st->writers[i]);
+    }
+  }
+  ddsrt_free (st->writers);
+  dur_log_fini (&st->log);
+  assert (st->ndelivering == 0 && st->nreaders_waiting == 0);
+  ddsrt_cond_destroy (&st->cond);
+  ddsrt_mutex_destroy (&st->lock);
+  ddsi_sertopic_unref (st->tp);
+  ddsrt_free (st->key.topic_name);
+  ddsrt_free (st->key.type_name);
+  ddsrt_free (st);
+}
+
+static struct dds_durability_store *dur_store_lookup (struct dds_durability *dur, const struct ddsi_sertopic *tp, const dds_qos_t *qos)
+{
+  struct dds_durability_store *st;
+  ddsrt_avl_ipath_t path;
+  struct dur_store_key key;
+  key.topic_name = tp->name;
+  key.type_name = tp->type_name;
+  ddsrt_mutex_lock (&dur->lock);
+  if ((st = ddsrt_avl_lookup_ipath (&dur_stores_td, &dur->stores, &key, &path)) == NULL)
+  {
+    st = dur_store_new (dur, tp, qos);
+    ddsrt_avl_insert_ipath (&dur_stores_td, &dur->stores, st, &path);
+  }
+  ddsrt_mutex_unlock (&dur->lock);
+  return st;
+}
+
+static bool is_durable_kind (const dds_qos_t *qos)
+{
+  assert (qos->present & QP_DURABILITY);
+  return qos->durability.kind == DDS_DURABILITY_TRANSIENT || qos->durability.kind == DDS_DURABILITY_PERSISTENT;
+}
+
+/* SERVICE -------------------------------------------------------------- */
+
+void dds_durability_init (struct dds_domain *dom)
+{
+  struct dds_durability *dur;
+  if (!dom->gv.config.durability_enable)
+  {
+    dom->m_durability = NULL;
+    return;
+  }
+  dur = ddsrt_malloc (sizeof (*dur));
+  dur->gv = &dom->gv;
+  dur->directory = NULL;
+  if (dom->gv.config.durability_directory && *dom->gv.config.durability_directory)
+  {
+#if DUR_HAVE_MMAP
+    dur->directory = ddsrt_strdup (dom->gv.config.durability_directory);
+#else
+    DDS_CWARNING (&dom->gv.logconfig, "durability: memory-mapped logs not supported, ignoring Durability/Directory\n");
+#endif
+  }
+  ddsrt_mutex_init (&dur->lock);
+  ddsrt_avl_init (&dur_stores_td, &dur->stores);
+  dom->m_durability = dur;
+}
+
+static void dur_store_free_wrap (void *vst)
+{
+  dur_store_free (vst);
+}
+
+void dds_durability_fini (struct dds_domain *dom)
+{
+  struct dds_durability * const dur = dom->m_durability;
+  if (dur == NULL)
+    return;
+  thread_state_awake (lookup_thread_state (), &dom->gv);
+  ddsrt_avl_free (&dur_stores_td, &dur->stores, dur_store_free_wrap);
+  thread_state_asleep (lookup_thread_state ());
+  ddsrt_mutex_destroy (&dur->lock);
+  ddsrt_free (dur->directory);
+  ddsrt_free (dur);
+  dom->m_durability = NULL;
+}
+
+struct dds_durability_writer *dds_durability_writer_new (struct dds_domain *dom, struct dds_topic *tp, const struct writer *wr)
+{
+  struct dds_durability * const dur = dom->m_durability;
+  struct dds_durability_store *st;
+  struct dds_durability_writer *dwr;
+  struct dur_writer *w;
+  struct dur_rec *rec;
+  if (dur == NULL || !is_durable_kind (wr->xqos))
+    return NULL;
+
+  st = dur_store_lookup (dur, tp->m_stopic, wr->xqos);
+  const uint32_t npartitions = (wr->xqos->present & QP_PARTITION) ? wr->xqos->partition.n : 0;
+  size_t datasize = sizeof (struct dur_rec_writer);
+  for (uint32_t i = 0; i < npartitions; i++)
+    datasize += strlen (wr->xqos->partition.strs[i]) + 1;
+
+  ddsrt_mutex_lock (&st->lock);
+  if ((rec = dur_log_new_rec (&st->log, DUR_REC_WRITER, datasize)) == NULL)
+  {
+    ddsrt_mutex_unlock (&st->lock);
+    DDS_CWARNING (&dur->gv->logconfig, "durability: %s: out of space, not storing data of writer "PGUIDFMT"\n", st->key.topic_name, PGUID (wr->e.guid));
+    return NULL;
+  }
+  w = ddsrt_malloc (sizeof (*w));
+  w->guid = wr->e.guid;
+  w->iid = wr->e.iid;
+  w->ownership_strength = wr->xqos->ownership_strength.value;
+  w->persistent = (wr->xqos->durability.kind == DDS_DURABILITY_PERSISTENT);
+  w->autodispose = wr->xqos->writer_data_lifecycle.autodispose_unregistered_instances;
+  w->alive = true;
+  w->nsamples = 0;
+  w->qos = dds_create_qos ();
+  if (npartitions > 0)
+    dds_qset_partition (w->qos, npartitions, (const char **) wr->xqos->partition.strs);
+  else
+    dds_qset_partition (w->qos, 0, NULL);
+
+  struct dur_rec_writer *rw = (struct dur_rec_writer *) (rec + 1);
+  char *strs = (char *) (rw + 1);
+  rec->wrid = dur_store_new_wrid (st, st->nwriters);
+  rec->flags = (uint16_t) ((w->persistent ? DUR_WRFLAG_PERSISTENT : 0) | (w->autodispose ? DUR_WRFLAG_AUTODISPOSE : 0));
+  rw->guid = w->guid;
+  rw->ownership_strength = w->ownership_strength;
+  rw->npartitions = npartitions;
+  for (uint32_t i = 0; i < npartitions; i++)
+  {
+    const size_t n = strlen (wr->xqos->partition.strs[i]) + 1;
+    memcpy (strs, wr->xqos->partition.strs[i], n);
+    strs += n;
+  }
+  w->off = dur_log_commit_rec (&st->log, rec);
+  st->writers[rec->wrid] = w;
+
+  dwr = ddsrt_malloc (sizeof (*dwr));
+  dwr->st = st;
+  dwr->wrid = rec->wrid;
+  w->dwr = dwr;
+  ddsrt_mutex_unlock (&st->lock);
+  return dwr;
+}
+
+void dds_durability_writer_free (struct dds_durability_writer *dwr)
+{
+  struct dds_durability_store * const st = dwr->st;
+  ddsrt_mutex_lock (&st->lock);
+  st->writers[dwr->wrid]->dwr = NULL;
+  st->writers[dwr->wrid]->alive = false;
+  if (st->writers[dwr->wrid]->nsamples == 0)
+    dur_store_drop_writer (st, dwr->wrid);
+  ddsrt_mutex_unlock (&st->lock);
+  ddsrt_free (dwr);
+}
+
+void dds_durability_writer_lock (struct dds_durability_writer *dwr)
+{
+  struct dds_durability_store * const st = dwr->st;
+  ddsrt_mutex_lock (&st->lock);
+  /* new readers go first, else a steady stream of writes could keep them
+     waiting forever */
+  while (st->nreaders_waiting > 0)
+    ddsrt_cond_wait (&st->cond, &st->lock);
+}
+
+void dds_durability_writer_unlock_delivering (struct dds_durability_writer *dwr)
+{
+  struct dds_durability_store * const st = dwr->st;
+  st->ndelivering++;
+  ddsrt_mutex_unlock (&st->lock);
+}
+
+void dds_durability_writer_delivered (struct dds_durability_writer *dwr)
+{
+  struct dds_durability_store * const st = dwr->st;
+  ddsrt_mutex_lock (&st->lock);
+  assert (st->ndelivering > 0);
+  if (--st->ndelivering == 0 && st->nreaders_waiting > 0)
+    ddsrt_cond_broadcast (&st->cond);
+  ddsrt_mutex_unlock (&st->lock);
+}
+
+void dds_durability_writer_store (struct dds_durability_writer *dwr, struct ddsi_serdata *sample, struct ddsi_tkmap_instance *tk)
+{
+  struct dds_durability_store * const st = dwr->st;
+  const ddsrt_mtime_t tnow = ddsrt_time_monotonic ();
+  struct dur_instance *inst;
+  struct dur_rec *rec;
+
+  /* unregistering doesn't affect the stored data */
+  if ((sample->statusinfo & (NN_STATUSINFO_DISPOSE | NN_STATUSINFO_UNREGISTER)) == NN_STATUSINFO_UNREGISTER)
+    return;
+  dur_store_purge_disposed (st, tnow);
+  if ((inst = dur_store_admit (st, tk)) == NULL)
+    return;
+
+  const uint32_t size = ddsi_serdata_size (sample);
+  if ((rec = dur_log_new_rec (&st->log, DUR_REC_SAMPLE, size)) == NULL)
+  {
+    DDS_CWARNING (&st->dur->gv->logconfig, "durability: %s: out of space, sample not stored\n", st->key.topic_name);
+    if (inst->nsamples == 0)
+      dur_store_drop_instance (st, inst);
+    return;
+  }
+  rec->wrid = dwr->wrid;
+  rec->flags = (uint16_t) ((sample->statusinfo & (NN_STATUSINFO_DISPOSE | NN_STATUSINFO_UNREGISTER)) | (sample->kind == SDK_KEY ? DUR_SMFLAG_KEY : 0));
+  rec->timestamp = sample->timestamp.v;
+  ddsi_serdata_to_ser (sample, 0, size, rec + 1);
+  dur_store_link (st, inst, dur_log_commit_rec (&st->log, rec), tnow);
+  dur_store_maybe_compact (st);
+}
+
+struct dds_durability_store *dds_durability_reader_begin (struct dds_domain *dom, struct dds_topic *tp, const dds_qos_t *qos)
+{
+  struct dds_durability_store *st;
+  if (dom->m_durability == NULL || !is_durable_kind (qos))
+    return NULL;
+  st = dur_store_lookup (dom->m_durability, tp->m_stopic, qos);
+  ddsrt_mutex_lock (&st->lock);
+  /* samples in the store that are still being delivered by their writers
+     may or may not reach this reader depending on when it gets matched,
+     so wait for those deliveries to complete */
+  st->nreaders_waiting++;
+  while (st->ndelivering > 0)
+    ddsrt_cond_wait (&st->cond, &st->lock);
+  st->nreaders_waiting--;
+  return st;
+}
+
+static void make_writer_info (struct ddsi_writer_info *wrinfo, const struct dur_writer *w)
+{
+  wrinfo->guid = w->guid;
+  wrinfo->auto_dispose = w->autodispose;
+  wrinfo->ownership_strength = w->ownership_strength;
+  wrinfo->iid = w->iid;
+#ifdef DDSI_INCLUDE_LIFESPAN
+  wrinfo->lifespan_exp = DDSRT_MTIME_NEVER;
+#endif
+}
+
+enum dur_catchup_state {
+  DCS_SKIP,
+  DCS_MATCH,
+  DCS_DELIVERED
+};
+
+void dds_durability_reader_end (struct dds_durability_store *st, struct reader *rd)
+{
+  /* Historical data goes straight from the log into the reader's history
+     cache: no writer or retransmit is involved, so the writers needn't exist
+     anymore and it takes no time beyond deserializing the samples */
+  struct ddsi_domaingv * const gv = st->dur->gv;
+  const bool persistent_only = (rd->xqos->durability.kind == DDS_DURABILITY_PERSISTENT);
+  struct ddsi_writer_info wrinfo;
+  struct ddsrt_hh_iter it;
+  uint32_t ndelivered = 0;
+
+  dur_store_purge_disposed (st, ddsrt_time_monotonic ());
+  enum dur_catchup_state *state = ddsrt_malloc ((st->nwriters + 1) * sizeof (*state));
+  for (uint32_t i = 0; i < st->nwriters; i++)
+  {
+    const struct dur_writer *w = st->writers[i];
+    if (w && (!persistent_only || w->persistent) && partitions_match_p (rd->xqos, w->qos))
+      state[i] = DCS_MATCH;
+    else
+      state[i] = DCS_SKIP;
+  }
+
+  for (struct dur_instance *inst = ddsrt_hh_iter_first (st->instances, &it); inst; inst = ddsrt_hh_iter_next (&it))
+  {
+    for (const struct dur_sample *s = inst->oldest; s; s = s->next)
+    {
+      const struct dur_rec *rec = dur_log_rec (&st->log, s->off);
+      struct ddsi_tkmap_instance *tk;
+      struct ddsi_serdata *sd;
+      ddsrt_iovec_t iov;
+      if (state[rec->wrid] == DCS_SKIP)
+        continue;
+      iov.iov_base = (void *) (rec + 1);
+      iov.iov_len = (ddsrt_iov_len_t) rec->datasize;
+      if ((sd = ddsi_serdata_from_ser_iov (rd->topic, (rec->flags & DUR_SMFLAG_KEY) ? SDK_KEY : SDK_DATA, 1, &iov, rec->datasize)) == NULL)
+        continue;
+      sd->statusinfo = rec->flags & (NN_STATUSINFO_DISPOSE | NN_STATUSINFO_UNREGISTER);
+      sd->timestamp.v = rec->timestamp;
+      tk = ddsi_tkmap_lookup_instance_ref (gv->m_tkmap, sd);
+      make_writer_info (&wrinfo, st->writers[rec->wrid]);
+      (void) ddsi_rhc_store (rd->rhc, &wrinfo, sd, tk);
+      ddsi_tkmap_instance_unref (gv->m_tkmap, tk);
+      ddsi_serdata_unref (sd);
+      state[rec->wrid] = DCS_DELIVERED;
+      ndelivered++;
+    }
+  }
+
+  /* writers that no longer exist won't ever unregister their instances */
+  for (uint32_t i = 0; i < st->nwriters; i++)
+  {
+    if (state[i] == DCS_DELIVERED && !st->writers[i]->alive)
+    {
+      make_writer_info (&wrinfo, st->writers[i]);
+      ddsi_rhc_unregister_wr (rd->rhc, &wrinfo);
+    }
+  }
+  ddsrt_free (state);
+  DDS_CLOG (DDS_LC_DISCOVERY, &gv->logconfig, "durability: reader "PGUIDFMT": %"PRIu32" historical samples for %s\n",
+            PGUID (rd->e.guid), ndelivered, st->key.topic_name);
+  if (st->nreaders_waiting == 0)
+    ddsrt_cond_broadcast (&st->cond);
+  ddsrt_mutex_unlock (&st->lock);
+}
@@ -15,7 +15,6 @@
 #include "dds/ddsrt/sync.h"
 #include "dds/ddsrt/heap.h"
 #include "dds/ddsrt/random.h"
-#include "dds/ddsrt/hopscotch.h"
 #include "dds/ddsi/q_thread.h"
 #include "dds__handles.h"
 #include "dds__types.h"
@@ -50,83 +49,213 @@ built-in topics:
   - implicit variant of a topic
 */
 
-/* Maximum number of handles is INT32_MAX - 1, but as the allocator relies on a
-   random generator for finding a free one, the time spent in the dds_handle_create
-   increases with an increasing number of handles.  16M handles seems likely to be
-   enough and makes the likely cost of allocating a new handle somewhat more
-   reasonable */
-#define MAX_HANDLES (INT32_MAX / 128)
+/* Handles index directly into a table of slots: the low HDL_INDEX_BITS give
+   the slot, the remaining bits a generation that is incremented each time the
+   slot is reused, so that a stale handle is unlikely to refer to a new entity.
+   Slots are allocated in chunks that once allocated remain in place until the
+   handle server is finalized, so that looking up a handle requires no lock.
+
+   Freed slots are reused in FIFO order to maximise the time until a handle
+   value recurs.  A handle is never 0 (the generation starts at 1) and never
+   in the range of the pseudo handles, so the maximum number of handles is
+   determined by the number of index bits.
+
+   The special handles (i.e., DDS_CYCLONEDDS_HANDLE) are in the pseudo handle
+   range and live in a separate, small table. */
+#define HDL_INDEX_BITS 22
+#define HDL_INDEX_MASK ((1u << HDL_INDEX_BITS) - 1u)
+#define HDL_GEN_MAX ((uint32_t) INT32_MAX >> HDL_INDEX_BITS)
+#define HDL_CHUNK_BITS 12
+#define HDL_CHUNK_SIZE (1u << HDL_CHUNK_BITS)
+#define HDL_NCHUNKS (1u << (HDL_INDEX_BITS - HDL_CHUNK_BITS))
+#define HDL_NSPECIAL ((uint32_t) (DDS_CYCLONEDDS_HANDLE - DDS_MIN_PSEUDO_HANDLE) + 1u)
+#define MAX_HANDLES (HDL_INDEX_MASK + 1u)
+
+#define HDL_FREELIST_END UINT32_MAX
+
+struct dds_handle_slot {
+  /* link is NULL if the slot is unused, users counts the number of threads
+     that may be dereferencing link (see dds_handle_lookup_enter) */
+  ddsrt_atomic_voidp_t link;
+  ddsrt_atomic_uint32_t users;
+  /* both protected by handles.lock */
+  uint32_t gen;
+  uint32_t next_free;
+};
 
 struct dds_handle_server {
-  struct ddsrt_hh *ht;
-  size_t count;
+  bool initialized;
+  ddsrt_atomic_voidp_t chunks[HDL_NCHUNKS];
+  struct dds_handle_slot special[HDL_NSPECIAL];
+  /* lock protects allocation and freeing of slots, and is the lock associated
+     with cond, used for waiting until an entity is no longer pinned */
   ddsrt_mutex_t lock;
   ddsrt_cond_t cond;
+  uint32_t count;
+  uint32_t nslots_used;
+  uint32_t free_head, free_tail;
 };
 
 static struct dds_handle_server handles;
 
-static uint32_t handle_hash (const void *va)
+static struct dds_handle_slot *slot_from_index (uint32_t idx)
+{
+  struct dds_handle_slot *chunk = ddsrt_atomic_ldvoidp (&handles.chunks[idx >> HDL_CHUNK_BITS]);
+  return (chunk == NULL) ? NULL : &chunk[idx & (HDL_CHUNK_SIZE - 1)];
+}
+
+static struct dds_handle_slot *slot_from_handle (dds_handle_t hdl)
+{
+  if (hdl <= 0)
+    return NULL;
+  else if (hdl >= DDS_MIN_PSEUDO_HANDLE)
+  {
+    const uint32_t i = (uint32_t) (hdl - DDS_MIN_PSEUDO_HANDLE);
+    return (i < HDL_NSPECIAL) ? &handles.special[i] : NULL;
+  }
+  else
+  {
+    return slot_from_index ((uint32_t) hdl & HDL_INDEX_MASK);
+  }
+}
+
+/* Looks up the entity for a handle, the returned link remains valid until
+   dds_handle_lookup_leave is called on the slot, even if the handle is being
+   deleted concurrently, because dds_handle_delete waits for users to become
+   0 after clearing the slot.  The fence is needed because the combination of
+   incrementing users and loading link must be ordered with respect to the
+   combination of clearing link and loading users in dds_handle_delete. */
+static struct dds_handle_link *dds_handle_lookup_enter (struct dds_handle_slot *slot, dds_handle_t hdl)
 {
-  /* handles are already pseudo-random numbers, so not much point in hashing it again */
-  const struct dds_handle_link *a = va;
-  return (uint32_t) a->hdl;
+  struct dds_handle_link *link;
+  ddsrt_atomic_inc32 (&slot->users);
+  ddsrt_atomic_fence ();
+  link = ddsrt_atomic_ldvoidp (&slot->link);
+  return (link != NULL && link->hdl == hdl) ? link : NULL;
 }
 
-static int handle_equal (const void *va, const void *vb)
+static void dds_handle_lookup_leave (struct dds_handle_slot *slot)
 {
-  const struct dds_handle_link *a = va;
-  const struct dds_handle_link *b = vb;
-  return a->hdl == b->hdl;
+  ddsrt_atomic_fence_rel ();
+  ddsrt_atomic_dec32 (&slot->users);
 }
 
 dds_return_t dds_handle_server_init (void)
 {
   /* called with ddsrt's singleton mutex held (see dds_init/fini) */
-  if (handles.ht == NULL)
+  if (!handles.initialized)
   {
-    handles.ht = ddsrt_hh_new (128, handle_hash, handle_equal);
+    for (uint32_t i = 0; i < HDL_NCHUNKS; i++)
+      ddsrt_atomic_stvoidp (&handles.chunks[i], NULL);
+    memset (handles.special, 0, sizeof (handles.special));
     handles.count = 0;
+    handles.nslots_used = 0;
+    handles.free_head = handles.free_tail = HDL_FREELIST_END;
     ddsrt_mutex_init (&handles.lock);
     ddsrt_cond_init (&handles.cond);
+    ddsrt_atomic_fence ();
+    handles.initialized = true;
   }
   return DDS_RETCODE_OK;
 }
 
+#ifndef NDEBUG
+static void report_leaked_handle (const struct dds_handle_slot *slot)
+{
+  const struct dds_handle_link *link = ddsrt_atomic_ldvoidp (&slot->link);
+  if (link != NULL)
+  {
+    uint32_t cf = ddsrt_atomic_ld32 (&link->cnt_flags);
+    DDS_ERROR ("handle %"PRId32" pin %"PRIu32" refc %"PRIu32"%s%s%s\n", link->hdl,
+               cf & HDL_PINCOUNT_MASK, (cf & HDL_REFCOUNT_MASK) >> HDL_REFCOUNT_SHIFT,
+               cf & HDL_FLAG_PENDING ? " pending" : "",
+               cf & HDL_FLAG_CLOSING ? " closing" : "",
+               cf & HDL_FLAG_DELETE_DEFERRED ? " delete-deferred" : "");
+  }
+}
+#endif
+
 void dds_handle_server_fini (void)
 {
   /* called with ddsrt's singleton mutex held (see dds_init/fini) */
-  if (handles.ht != NULL)
+  if (handles.initialized)
   {
 #ifndef NDEBUG
-    struct ddsrt_hh_iter it;
-    for (struct dds_handle_link *link = ddsrt_hh_iter_first (handles.ht, &it); link != NULL; link = ddsrt_hh_iter_next (&it))
+    for (uint32_t i = 0; i < HDL_NSPECIAL; i++)
+      report_leaked_handle (&handles.special[i]);
+    for (uint32_t i = 0; i < handles.nslots_used; i++)
+      report_leaked_handle (slot_from_index (i));
+    assert (handles.count == 0);
+#endif
+    handles.initialized = false;
+    for (uint32_t i = 0; i < HDL_NCHUNKS; i++)
     {
-      uint32_t cf = ddsrt_atomic_ld32 (&link->cnt_flags);
-      DDS_ERROR ("handle %"PRId32" pin %"PRIu32" refc %"PRIu32"%s%s%s\n", link->hdl,
-                 cf & HDL_PINCOUNT_MASK, (cf & HDL_REFCOUNT_MASK) >> HDL_REFCOUNT_SHIFT,
-                 cf & HDL_FLAG_PENDING ? " pending" : "",
-                 cf & HDL_FLAG_CLOSING ? " closing" : "",
-                 cf & HDL_FLAG_DELETE_DEFERRED ? " delete-deferred" : "");
+      ddsrt_free (ddsrt_atomic_ldvoidp (&handles.chunks[i]));
+      ddsrt_atomic_stvoidp (&handles.chunks[i], NULL);
     }
-    assert (ddsrt_hh_iter_first (handles.ht, &it) == NULL);
-#endif
-    ddsrt_hh_free (handles.ht);
     ddsrt_cond_destroy (&handles.cond);
     ddsrt_mutex_destroy (&handles.lock);
-    handles.ht = NULL;
   }
 }
 
-static bool hhadd (struct ddsrt_hh *ht, void *elem) { return ddsrt_hh_add (ht, elem); }
+static void init_cnt_flags (struct dds_handle_link *link, bool implicit, bool allow_children)
+{
+  ddsrt_atomic_st32 (&link->cnt_flags, HDL_FLAG_PENDING | (implicit ? HDL_FLAG_IMPLICIT : HDL_REFCOUNT_UNIT) | (allow_children ? HDL_FLAG_ALLOW_CHILDREN : 0) | 1u);
+}
+
+static void publish_link (struct dds_handle_slot *slot, struct dds_handle_link *link)
+{
+  /* link contents must be visible before the pointer */
+  ddsrt_atomic_fence_rel ();
+  ddsrt_atomic_stvoidp (&slot->link, link);
+}
+
+static uint32_t alloc_slot_index (void)
+{
+  /* called with handles.lock held and handles.count < MAX_HANDLES */
+  const bool need_chunk = (handles.nslots_used & (HDL_CHUNK_SIZE - 1)) == 0;
+  uint32_t idx;
+  if (handles.free_head != HDL_FREELIST_END && (handles.nslots_used == MAX_HANDLES || (need_chunk && handles.count < handles.nslots_used / 2)))
+  {
+    /* all allocated slots have been used at least once: reuse one if many are
+       free, rather than using ever more memory */
+    idx = handles.free_head;
+    handles.free_head = slot_from_index (idx)->next_free;
+    if (handles.free_head == HDL_FREELIST_END)
+      handles.free_tail = HDL_FREELIST_END;
+  }
+  else
+  {
+    idx = handles.nslots_used++;
+    if (need_chunk)
+    {
+      /* random initial generations make it unlikely that a handle from before
+         the library was deinitialized refers to a new entity after it has been
+         reinitialized */
+      struct dds_handle_slot *chunk = ddsrt_malloc (HDL_CHUNK_SIZE * sizeof (*chunk));
+      memset (chunk, 0, HDL_CHUNK_SIZE * sizeof (*chunk));
+      for (uint32_t i = 0; i < HDL_CHUNK_SIZE; i++)
+        chunk[i].gen = ddsrt_random () % HDL_GEN_MAX;
+      ddsrt_atomic_fence_rel ();
+      ddsrt_atomic_stvoidp (&handles.chunks[idx >> HDL_CHUNK_BITS], chunk);
+    }
+  }
+  return idx;
+}
+
 static dds_handle_t dds_handle_create_int (struct dds_handle_link *link, bool implicit, bool refc_counts_children)
 {
-  ddsrt_atomic_st32 (&link->cnt_flags, HDL_FLAG_PENDING | (implicit ? HDL_FLAG_IMPLICIT : HDL_REFCOUNT_UNIT) | (refc_counts_children ? HDL_FLAG_ALLOW_CHILDREN : 0) | 1u);
+  const uint32_t idx = alloc_slot_index ();
+  struct dds_handle_slot *slot = slot_from_index (idx);
+  assert (ddsrt_atomic_ldvoidp (&slot->link) == NULL);
+  /* generation 0 is never used, so that handles are > 0, and handles must not
+     fall in the pseudo handle range */
   do {
-    do {
-      link->hdl = (int32_t) (ddsrt_random () & INT32_MAX);
-    } while (link->hdl == 0 || link->hdl >= DDS_MIN_PSEUDO_HANDLE);
-  } while (!hhadd (handles.ht, link));
+    slot->gen = (slot->gen >= HDL_GEN_MAX) ? 1 : slot->gen + 1;
+  } while (((slot->gen << HDL_INDEX_BITS) | idx) >= (uint32_t) DDS_MIN_PSEUDO_HANDLE);
+  init_cnt_flags (link, implicit, refc_counts_children);
+  link->hdl = (dds_handle_t) ((slot->gen << HDL_INDEX_BITS) | idx);
+  publish_link (slot, link);
   return link->hdl;
 }
 
@@ -151,27 +280,22 @@ dds_handle_t dds_handle_create (struct dds_handle_link *link, bool implicit, boo
 
 dds_return_t dds_handle_register_special (struct dds_handle_link *link, bool implicit, bool allow_children, dds_handle_t handle)
 {
+  struct dds_handle_slot *slot;
   dds_return_t ret;
-  if (handle <= 0)
+  if (handle < DDS_MIN_PSEUDO_HANDLE || (slot = slot_from_handle (handle)) == NULL)
     return DDS_RETCODE_BAD_PARAMETER;
   ddsrt_mutex_lock (&handles.lock);
-  if (handles.count == MAX_HANDLES)
-  {
-    ddsrt_mutex_unlock (&handles.lock);
-    ret = DDS_RETCODE_OUT_OF_RESOURCES;
-  }
+  if (ddsrt_atomic_ldvoidp (&slot->link) != NULL)
+    ret = DDS_RETCODE_BAD_PARAMETER;
   else
   {
     handles.count++;
-    ddsrt_atomic_st32 (&link->cnt_flags, HDL_FLAG_PENDING | (implicit ? HDL_FLAG_IMPLICIT : HDL_REFCOUNT_UNIT) | (allow_children ? HDL_FLAG_ALLOW_CHILDREN : 0) | 1u);
+    init_cnt_flags (link, implicit, allow_children);
     link->hdl = handle;
-    if (hhadd (handles.ht, link))
-      ret = handle;
-    else
-      ret = DDS_RETCODE_BAD_PARAMETER;
-    ddsrt_mutex_unlock (&handles.lock);
-    assert (ret > 0);
+    publish_link (slot, link);
+    ret = handle;
   }
+  ddsrt_mutex_unlock (&handles.lock);
   return ret;
 }
 
@@ -200,10 +324,28 @@ int32_t dds_handle_delete (struct dds_handle_link *link)
   }
   assert ((cf & HDL_PINCOUNT_MASK) == 1u);
 #endif
+  struct dds_handle_slot * const slot = slot_from_handle (link->hdl);
+  assert (slot != NULL && ddsrt_atomic_ldvoidp (&slot->link) == link);
+
+  /* Once the slot has been cleared, new lookups can no longer find link, but
+     lookups that started earlier may still be dereferencing it.  Those take
+     only a few instructions, so waiting for them is cheap. */
+  ddsrt_atomic_stvoidp (&slot->link, NULL);
+  ddsrt_atomic_fence ();
+  while (ddsrt_atomic_ld32 (&slot->users) > 0)
+    dds_sleepfor (DDS_USECS (10));
+
   ddsrt_mutex_lock (&handles.lock);
-  int x = ddsrt_hh_remove (handles.ht, link);
-  assert(x);
-  (void)x;
+  if (link->hdl < DDS_MIN_PSEUDO_HANDLE)
+  {
+    const uint32_t idx = (uint32_t) link->hdl & HDL_INDEX_MASK;
+    slot->next_free = HDL_FREELIST_END;
+    if (handles.free_tail == HDL_FREELIST_END)
+      handles.free_head = idx;
+    else
+      slot_from_index (handles.free_tail)->next_free = idx;
+    handles.free_tail = idx;
+  }
   assert (handles.count > 0);
   handles.count--;
   ddsrt_mutex_unlock (&handles.lock);
@@ -212,7 +354,7 @@ int32_t dds_handle_delete (struct dds_handle_link *link)
 
 static int32_t dds_handle_pin_int (dds_handle_t hdl, uint32_t delta, struct dds_handle_link **link)
 {
-  struct dds_handle_link dummy = { .hdl = hdl };
+  struct dds_handle_slot *slot;
   int32_t rc;
   /* it makes sense to check here for initialization: the first thing any operation
      (other than create_participant) does is to call dds_handle_pin on the supplied
@@ -222,12 +364,12 @@ static int32_t dds_handle_pin_int (dds_handle_t hdl, uint32_t delta, struct dds_
 
      One could check that the handle is > 0, but that would catch fewer errors
      without any advantages. */
-  if (handles.ht == NULL)
+  if (!handles.initialized)
     return DDS_RETCODE_PRECONDITION_NOT_MET;
 
-  ddsrt_mutex_lock (&handles.lock);
-  *link = ddsrt_hh_lookup (handles.ht, &dummy);
-  if (*link == NULL)
+  if ((slot = slot_from_handle (hdl)) == NULL)
+    return DDS_RETCODE_BAD_PARAMETER;
+  if ((*link = dds_handle_lookup_enter (slot, hdl)) == NULL)
     rc = DDS_RETCODE_BAD_PARAMETER;
   else
   {
@@ -244,7 +386,7 @@ static int32_t dds_handle_pin_int (dds_handle_t hdl, uint32_t delta, struct dds_
       }
     } while (!ddsrt_atomic_cas32 (&(*link)->cnt_flags, cf, cf + delta));
   }
-  ddsrt_mutex_unlock (&handles.lock);
+  dds_handle_lookup_leave (slot);
   return rc;
 }
 
@@ -255,7 +397,7 @@ int32_t dds_handle_pin (dds_handle_t hdl, struct dds_handle_link **link)
 
 int32_t dds_handle_pin_for_delete (dds_handle_t hdl, bool explicit, struct dds_handle_link **link)
 {
-  struct dds_handle_link dummy = { .hdl = hdl };
+  struct dds_handle_slot *slot;
   int32_t rc;
   /* it makes sense to check here for initialization: the first thing any operation
      (other than create_participant) does is to call dds_handle_pin on the supplied
@@ -265,12 +407,12 @@ int32_t dds_handle_pin_for_delete (dds_handle_t hdl, bool explicit, struct dds_h
 
      One could check that the handle is > 0, but that would catch fewer errors
      without any advantages. */
-  if (handles.ht == NULL)
+  if (!handles.initialized)
     return DDS_RETCODE_PRECONDITION_NOT_MET;
 
-  ddsrt_mutex_lock (&handles.lock);
-  *link = ddsrt_hh_lookup (handles.ht, &dummy);
-  if (*link == NULL)
+  if ((slot = slot_from_handle (hdl)) == NULL)
+    return DDS_RETCODE_BAD_PARAMETER;
+  if ((*link = dds_handle_lookup_enter (slot, hdl)) == NULL)
     rc = DDS_RETCODE_BAD_PARAMETER;
   else
   {
@@ -367,14 +509,13 @@ int32_t dds_handle_pin_for_delete (dds_handle_t hdl, bool explicit, struct dds_h
       rc = ((cf1 & HDL_REFCOUNT_MASK) == 0 || (cf1 & HDL_FLAG_ALLOW_CHILDREN)) ? DDS_RETCODE_OK : DDS_RETCODE_TRY_AGAIN;
     } while (!ddsrt_atomic_cas32 (&(*link)->cnt_flags, cf, cf1));
   }
-  ddsrt_mutex_unlock (&handles.lock);
+  dds_handle_lookup_leave (slot);
   return rc;
 }
 
 bool dds_handle_drop_childref_and_pin (struct dds_handle_link *link, bool may_delete_parent)
 {
   bool del_parent = false;
-  ddsrt_mutex_lock (&handles.lock);
   uint32_t cf, cf1;
   do {
     cf = ddsrt_atomic_ld32 (&link->cnt_flags);
@@ -412,7 +553,6 @@ bool dds_handle_drop_childref_and_pin (struct dds_handle_link *link, bool may_de
       }
     }
   } while (!ddsrt_atomic_cas32 (&link->cnt_flags, cf, cf1));
-  ddsrt_mutex_unlock (&handles.lock);
   return del_parent;
 }
 
@@ -421,6 +561,15 @@ int32_t dds_handle_pin_and_ref (dds_handle_t hdl, struct dds_handle_link **link)
   return dds_handle_pin_int (hdl, HDL_REFCOUNT_UNIT + 1u, link);
 }
 
+static void wakeup_close_wait (void)
+{
+  /* The pin count has already been decremented and close_wait checks it while
+     holding the lock, so taking the lock here suffices to avoid a lost wakeup */
+  ddsrt_mutex_lock (&handles.lock);
+  ddsrt_cond_broadcast (&handles.cond);
+  ddsrt_mutex_unlock (&handles.lock);
+}
+
 void dds_handle_repin (struct dds_handle_link *link)
 {
   uint32_t x = ddsrt_atomic_inc32_nv (&link->cnt_flags);
@@ -436,12 +585,8 @@ void dds_handle_unpin (struct dds_handle_link *link)
   else
     assert ((cf & HDL_PINCOUNT_MASK) >= 1u);
 #endif
-  ddsrt_mutex_lock (&handles.lock);
   if ((ddsrt_atomic_dec32_nv (&link->cnt_flags) & (HDL_FLAG_CLOSING | HDL_PINCOUNT_MASK)) == (HDL_FLAG_CLOSING | 1u))
-  {
-    ddsrt_cond_broadcast (&handles.cond);
-  }
-  ddsrt_mutex_unlock (&handles.lock);
+    wakeup_close_wait ();
 }
 
 void dds_handle_add_ref (struct dds_handle_link *link)
@@ -457,12 +602,8 @@ bool dds_handle_drop_ref (struct dds_handle_link *link)
     assert ((old & HDL_REFCOUNT_MASK) > 0);
     new = old - HDL_REFCOUNT_UNIT;
   } while (!ddsrt_atomic_cas32 (&link->cnt_flags, old, new));
-  ddsrt_mutex_lock (&handles.lock);
   if ((new & (HDL_FLAG_CLOSING | HDL_PINCOUNT_MASK)) == (HDL_FLAG_CLOSING | 1u))
-  {
-    ddsrt_cond_broadcast (&handles.cond);
-  }
-  ddsrt_mutex_unlock (&handles.lock);
+    wakeup_close_wait ();
   return ((new & HDL_REFCOUNT_MASK) == 0);
 }
 
@@ -475,12 +616,8 @@ bool dds_handle_unpin_and_drop_ref (struct dds_handle_link *link)
     assert ((old & HDL_PINCOUNT_MASK) > 0);
     new = old - HDL_REFCOUNT_UNIT - 1u;
   } while (!ddsrt_atomic_cas32 (&link->cnt_flags, old, new));
-  ddsrt_mutex_lock (&handles.lock);
   if ((new & (HDL_FLAG_CLOSING | HDL_PINCOUNT_MASK)) == (HDL_FLAG_CLOSING | 1u))
-  {
-    ddsrt_cond_broadcast (&handles.cond);
-  }
-  ddsrt_mutex_unlock (&handles.lock);
+    wakeup_close_wait ();
   return ((new & HDL_REFCOUNT_MASK) == 0);
 }
 
@@ -16,6 +16,7 @@
 #include "dds__participant.h"
 #include "dds__publisher.h"
 #include "dds__writer.h"
+#include "dds__write.h"
 #include "dds__qos.h"
 #include "dds/ddsi/ddsi_iid.h"
 #include "dds/ddsi/q_entity.h"
@@ -66,6 +67,7 @@ dds_entity_t dds__create_publisher_l (dds_participant *par, bool implicit, const
   }
 
   pub = dds_alloc (sizeof (*pub));
+  pub->m_coherent_depth = 0;
   hdl = dds_entity_init (&pub->m_entity, &par->m_entity, DDS_KIND_PUBLISHER, implicit, new_qos, listener, DDS_PUBLISHER_STATUS_MASK);
   pub->m_entity.m_iid = ddsi_iid_gen ();
   dds_entity_register_child (&par->m_entity, &pub->m_entity);
@@ -126,12 +128,68 @@ dds_return_t dds_wait_for_acks (dds_entity_t publisher_or_writer, dds_duration_t
   }
 }
 
+static dds_return_t pushdown_coherent (dds_publisher *pub, bool begin)
+{
+  /* pub pinned and locked */
+  dds_return_t ret = DDS_RETCODE_OK;
+  dds_instance_handle_t last_iid = 0;
+  struct dds_entity *c;
+  while ((c = ddsrt_avl_lookup_succ (&dds_entity_children_td, &pub->m_entity.m_children, &last_iid)) != NULL)
+  {
+    struct dds_entity *x;
+    last_iid = c->m_iid;
+    if (dds_entity_pin (c->m_hdllink.hdl, &x) != DDS_RETCODE_OK)
+      continue;
+    assert (x == c);
+    assert (dds_entity_kind (c) == DDS_KIND_WRITER);
+    /* see pushdown_pubsub_qos for the locking */
+    ddsrt_mutex_unlock (&pub->m_entity.m_mutex);
+    ddsrt_mutex_lock (&c->m_mutex);
+    if (begin)
+      dds_write_begin_coherent ((dds_writer *) c);
+    else
+    {
+      dds_return_t rc = dds_write_end_coherent ((dds_writer *) c, false);
+      if (rc != DDS_RETCODE_OK && ret == DDS_RETCODE_OK)
+        ret = rc;
+    }
+    ddsrt_mutex_unlock (&c->m_mutex);
+    ddsrt_mutex_lock (&pub->m_entity.m_mutex);
+    dds_entity_unpin (c);
+  }
+  return ret;
+}
+
 dds_return_t dds_publisher_begin_coherent (dds_entity_t publisher)
 {
-  return dds_generic_unimplemented_operation (publisher, DDS_KIND_PUBLISHER);
+  /* Coherent sets are per writer: the writes of each writer of the publisher
+     become visible to the readers at once when the (outermost) coherent set
+     ends, but there is no coherence across writers */
+  dds_publisher *pub;
+  dds_return_t ret;
+  if ((ret = dds_publisher_lock (publisher, &pub)) != DDS_RETCODE_OK)
+    return ret;
+  const dds_qos_t *qos = pub->m_entity.m_qos;
+  if (!(qos->present & QP_PRESENTATION) || !qos->presentation.coherent_access)
+    ret = DDS_RETCODE_PRECONDITION_NOT_MET;
+  else if (qos->presentation.access_scope == DDS_PRESENTATION_GROUP)
+    ret = DDS_RETCODE_UNSUPPORTED;
+  else if (pub->m_coherent_depth++ == 0)
+    ret = pushdown_coherent (pub, true);
+  dds_publisher_unlock (pub);
+  return ret;
 }
 
 dds_return_t dds_publisher_end_coherent (dds_entity_t publisher)
 {
-  return dds_generic_unimplemented_operation (publisher, DDS_KIND_PUBLISHER);
+  dds_publisher *pub;
+  dds_return_t ret;
+  if ((ret = dds_publisher_lock (publisher, &pub)) != DDS_RETCODE_OK)
+    return ret;
+  if (pub->m_coherent_depth == 0)
+    ret = DDS_RETCODE_PRECONDITION_NOT_MET;
+  else if (--pub->m_coherent_depth == 0)
+    ret = pushdown_coherent (pub, false);
+  dds_publisher_unlock (pub);
+  return ret;
 }
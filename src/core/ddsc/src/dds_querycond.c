@@ -21,7 +21,7 @@
 #include "dds/ddsi/ddsi_serdata.h"
 #include "dds/ddsi/ddsi_sertopic.h"
 
-dds_entity_t dds_create_querycondition (dds_entity_t reader, uint32_t mask, dds_querycondition_filter_fn filter)
+static dds_entity_t create_querycondition (dds_entity_t reader, uint32_t mask, dds_querycondition_filter_fn filter, bool keyonly)
 {
   dds_return_t rc;
   dds_reader *r;
@@ -31,7 +31,7 @@ dds_entity_t dds_create_querycondition (dds_entity_t reader, uint32_t mask, dds_
   else
   {
     dds_entity_t hdl;
-    dds_readcond *cond = dds_create_readcond (r, DDS_KIND_COND_QUERY, mask, filter);
+    dds_readcond *cond = dds_create_readcond (r, DDS_KIND_COND_QUERY, mask, filter, keyonly);
     assert (cond);
     hdl = cond->m_entity.m_hdllink.hdl;
     dds_entity_init_complete (&cond->m_entity);
@@ -39,3 +39,13 @@ dds_entity_t dds_create_querycondition (dds_entity_t reader, uint32_t mask, dds_
     return hdl;
   }
 }
+
+dds_entity_t dds_create_querycondition (dds_entity_t reader, uint32_t mask, dds_querycondition_filter_fn filter)
+{
+  return create_querycondition (reader, mask, filter, false);
+}
+
+dds_entity_t dds_create_querycondition_key (dds_entity_t reader, uint32_t mask, dds_querycondition_filter_fn filter)
+{
+  return create_querycondition (reader, mask, filter, true);
+}
@@ -20,6 +20,41 @@
 #include "dds/ddsi/q_entity.h"
 #include "dds/ddsi/ddsi_domaingv.h"
 #include "dds/ddsi/ddsi_sertopic.h"
+#include "dds/ddsi/ddsi_serdata_default.h"
+#include "dds/ddsi/ddsi_shm.h"
+
+/* Reads/takes into a loan of the reader, lending out samples that were received as
+   references to shared memory directly from that shared memory and deserializing
+   the others into the reader's loan buffer.  All serdatas are kept referenced until
+   the loan is returned. */
+static int32_t dds_read_zerocopy (bool take, struct dds_reader *rd, bool lock, void **buf, dds_sample_info_t *si, uint32_t maxs, uint32_t mask, dds_instance_handle_t hand)
+{
+  const struct ddsi_sertopic *st = rd->m_topic->m_stopic;
+  struct ddsi_serdata ** const refs = rd->m_loan_serdata;
+  int32_t n;
+  assert (rd->m_loan_out && rd->m_loan_nserdata == 0 && maxs <= rd->m_loan_size);
+  if (take)
+    n = dds_rhc_takecdr (rd->m_rhc, lock, refs, si, maxs, mask & DDS_ANY_SAMPLE_STATE, mask & DDS_ANY_VIEW_STATE, mask & DDS_ANY_INSTANCE_STATE, hand);
+  else
+    n = dds_rhc_readcdr (rd->m_rhc, lock, refs, si, maxs, mask & DDS_ANY_SAMPLE_STATE, mask & DDS_ANY_VIEW_STATE, mask & DDS_ANY_INSTANCE_STATE, hand);
+  for (int32_t i = 0; i < n; i++)
+  {
+    const void *payload;
+    if (!si[i].valid_data)
+      (void) ddsi_serdata_topicless_to_sample (st, refs[i], buf[i], NULL, NULL);
+    else if ((payload = ddsi_serdata_default_shm_payload (refs[i])) != NULL)
+      buf[i] = (void *) payload;
+    else
+      (void) ddsi_serdata_to_sample (refs[i], buf[i], NULL, NULL);
+  }
+  rd->m_loan_nserdata = (n > 0) ? (uint32_t) n : 0;
+  return n;
+}
+
+static bool is_zerocopy_loan (const struct dds_reader *rd, void * const *buf)
+{
+  return rd->m_loan_nserdata > 0 && (buf[0] == rd->m_loan || buf[0] == ddsi_serdata_default_shm_payload (rd->m_loan_serdata[0]));
+}
 
 /*
   dds_read_impl: Core read/take function. Usually maxs is size of buf and si
@@ -36,6 +71,7 @@ static dds_return_t dds_read_impl (bool take, dds_entity_t reader_or_condition,
   struct dds_reader *rd;
   struct dds_readcond *cond;
   unsigned nodata_cleanups = 0;
+  bool zerocopy = false;
 #define NC_CLEAR_LOAN_OUT 1u
 #define NC_FREE_BUF 2u
 #define NC_RESET_BUF 4u
@@ -95,6 +131,13 @@ static dds_return_t dds_read_impl (bool take, dds_entity_t reader_or_condition,
       }
       rd->m_loan_out = true;
       nodata_cleanups = NC_RESET_BUF | NC_CLEAR_LOAN_OUT;
+
+      /* The (unlocked) readcdr interface doesn't support conditions */
+      if (cond == NULL && ddsi_sertopic_default_supports_shm_loans (rd->m_topic->m_stopic))
+      {
+        rd->m_loan_serdata = dds_realloc (rd->m_loan_serdata, rd->m_loan_size * sizeof (*rd->m_loan_serdata));
+        zerocopy = true;
+      }
     }
     ddsrt_mutex_unlock (&rd->m_entity.m_mutex);
   }
@@ -107,7 +150,9 @@ static dds_return_t dds_read_impl (bool take, dds_entity_t reader_or_condition,
   assert (dds_entity_kind (rd->m_entity.m_parent) == DDS_KIND_SUBSCRIBER);
   dds_entity_status_reset (rd->m_entity.m_parent, DDS_DATA_ON_READERS_STATUS);
 
-  if (take)
+  if (zerocopy)
+    ret = dds_read_zerocopy (take, rd, lock, buf, si, maxs, mask, hand);
+  else if (take)
     ret = dds_rhc_take (rd->m_rhc, lock, buf, si, maxs, mask, hand, cond);
   else
     ret = dds_rhc_read (rd->m_rhc, lock, buf, si, maxs, mask, hand, cond);
@@ -456,6 +501,20 @@ dds_return_t dds_take_next_wl (dds_entity_t reader, void **buf, dds_sample_info_
   return dds_read_impl (true, reader, buf, 1u, 1u, si, mask, DDS_HANDLE_NIL, true, true);
 }
 
+static dds_return_t dds_return_writer_loan (dds_writer *wr, void **buf, int32_t bufsz)
+{
+  /* Samples borrowed using dds_loan_sample that the application decided not to write */
+  const struct ddsi_domaingv * const gv = &wr->m_entity.m_domain->gv;
+  for (int32_t i = 0; i < bufsz; i++)
+    if (!ddsi_shm_chunk_is_local (gv, buf[i]))
+      return DDS_RETCODE_BAD_PARAMETER;
+  for (int32_t i = 0; i < bufsz; i++)
+    ddsi_shm_chunk_unref (buf[i]);
+  if (bufsz > 0)
+    buf[0] = NULL;
+  return DDS_RETCODE_OK;
+}
+
 dds_return_t dds_return_loan (dds_entity_t reader_or_condition, void **buf, int32_t bufsz)
 {
   dds_reader *rd;
@@ -469,6 +528,10 @@ dds_return_t dds_return_loan (dds_entity_t reader_or_condition, void **buf, int3
     return ret;
   } else if (dds_entity_kind (entity) == DDS_KIND_READER) {
     rd = (dds_reader *) entity;
+  } else if (dds_entity_kind (entity) == DDS_KIND_WRITER) {
+    ret = dds_return_writer_loan ((dds_writer *) entity, buf, bufsz);
+    dds_entity_unpin (entity);
+    return ret;
   } else if (dds_entity_kind (entity) != DDS_KIND_COND_READ && dds_entity_kind (entity) != DDS_KIND_COND_QUERY) {
     dds_entity_unpin (entity);
     return DDS_RETCODE_ILLEGAL_OPERATION;
@@ -494,7 +557,19 @@ dds_return_t dds_return_loan (dds_entity_t reader_or_condition, void **buf, int3
      the observer_lock), so holding it for a bit longer in return for simpler
      code is a fair trade-off. */
   ddsrt_mutex_lock (&rd->m_entity.m_mutex);
-  if (buf[0] != rd->m_loan)
+  if (is_zerocopy_loan (rd, buf))
+  {
+    /* Samples in shared memory are released by dropping the references, the others
+       are in the loan buffer and of types that don't reference any other memory */
+    assert (rd->m_loan_out);
+    for (uint32_t i = 0; i < rd->m_loan_nserdata; i++)
+      ddsi_serdata_unref (rd->m_loan_serdata[i]);
+    rd->m_loan_nserdata = 0;
+    ddsi_sertopic_zero_samples (st, rd->m_loan, rd->m_loan_size);
+    rd->m_loan_out = false;
+    buf[0] = NULL;
+  }
+  else if (buf[0] != rd->m_loan)
   {
     /* Not so much a loan as a buffer allocated by the middleware on behalf of the
        application.  So it really is no more than a sophisticated variant of "free". */
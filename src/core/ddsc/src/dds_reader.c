@@ -28,8 +28,10 @@
 #include "dds/ddsi/q_thread.h"
 #include "dds/ddsi/ddsi_domaingv.h"
 #include "dds__builtin.h"
+#include "dds__durability.h"
 #include "dds__statistics.h"
 #include "dds/ddsi/ddsi_sertopic.h"
+#include "dds/ddsi/ddsi_filter.h"
 #include "dds/ddsi/ddsi_entity_index.h"
 #include "dds/ddsi/ddsi_security_omg.h"
 #include "dds/ddsi/ddsi_statistics.h"
@@ -68,6 +70,9 @@ static dds_return_t dds_reader_delete (dds_entity *e)
 {
   dds_reader * const rd = (dds_reader *) e;
   dds_free (rd->m_loan);
+  for (uint32_t i = 0; i < rd->m_loan_nserdata; i++)
+    ddsi_serdata_unref (rd->m_loan_serdata[i]);
+  dds_free (rd->m_loan_serdata);
   thread_state_awake (lookup_thread_state (), &e->m_domain->gv);
   dds_rhc_free (rd->m_rhc);
   thread_state_asleep (lookup_thread_state ());
@@ -537,8 +542,23 @@ static dds_entity_t dds_create_reader_int (dds_entity_t participant_or_subscribe
      it; and then invoke those listeners that are in the pending set */
   dds_entity_init_complete (&rd->m_entity);
 
+  /* Historical data kept by the durability service must be delivered exactly
+     once, so writes to the store are held off until the reader has been
+     matched with its writers and has caught up */
+  struct dds_durability_store * const durability_store = dds_durability_reader_begin (rd->m_entity.m_domain, tp, rqos);
   rc = new_reader (&rd->m_rd, &rd->m_entity.m_guid, NULL, pp, tp->m_stopic, rqos, &rd->m_rhc->common.rhc, dds_reader_status_cb, rd);
   assert (rc == DDS_RETCODE_OK); /* FIXME: can be out-of-resources at the very least */
+  {
+    struct ddsi_filter * const filter = ddsrt_atomic_ldvoidp (&tp->m_filter);
+    nn_content_filter_property_t *content_filter;
+    if (filter && (content_filter = ddsi_filter_get_property (filter)) != NULL)
+    {
+      update_reader_content_filter (rd->m_rd, content_filter);
+      ddsi_content_filter_property_free (content_filter);
+    }
+  }
+  if (durability_store)
+    dds_durability_reader_end (durability_store, rd->m_rd);
   thread_state_asleep (lookup_thread_state ());
 
   rd->m_entity.m_iid = get_entity_instance_id (&rd->m_entity.m_domain->gv, &rd->m_entity.m_guid);
@@ -654,6 +674,8 @@ dds_return_t dds_reader_wait_for_historical_data (dds_entity_t reader, dds_durat
       break;
     case DDS_DURABILITY_TRANSIENT:
     case DDS_DURABILITY_PERSISTENT:
+      /* data kept by the durability service is delivered when the reader is
+         created, there is nothing left to wait for */
       break;
   }
   dds_reader_unlock(rd);
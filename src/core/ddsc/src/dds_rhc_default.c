@@ -40,6 +40,7 @@
 #include "dds/ddsi/q_entity.h" /* proxy_writer_info */
 #include "dds/ddsi/ddsi_serdata.h"
 #include "dds/ddsi/ddsi_serdata_default.h"
+#include "dds/ddsi/ddsi_filter.h"
 #ifdef DDSI_INCLUDE_LIFESPAN
 #include "dds/ddsi/ddsi_lifespan.h"
 #endif
@@ -160,6 +161,8 @@
    even when generating an invalid sample for an unregister message using
    the tkmap data. */
 
+/* Query conditions with the same filter share a bit in the masks, so this limits the number
+   of distinct filters, not the number of query conditions */
 #define MAX_ATTACHED_QUERYCONDS (CHAR_BIT * sizeof (dds_querycond_mask_t))
 #define MAX_FAST_TRIGGERS 32
 
@@ -329,6 +332,8 @@ struct dds_rhc_default {
   uint32_t nconds;                   /* Number of associated read conditions */
   uint32_t nqconds;                  /* Number of associated query conditions */
   dds_querycond_mask_t qconds_samplest;  /* Mask of associated query conditions that check the sample state */
+  dds_querycond_mask_t qconds_keyonly;   /* Mask of associated query conditions that only depend on the key */
+  dds_querycond_mask_t qconds_inuse;     /* Mask of all bits allocated to query conditions */
   void *qcond_eval_samplebuf;        /* Temporary storage for evaluating query conditions, NULL if no qconds */
 #ifdef DDSI_INCLUDE_LIFESPAN
   struct lifespan_adm lifespan;      /* Lifespan administration */
@@ -633,6 +638,25 @@ static bool eval_predicate_invsample (const struct dds_rhc_default *rhc, const s
   return ret;
 }
 
+static dds_querycond_mask_t eval_qconds (const struct dds_rhc_default *rhc, dds_querycond_mask_t skip)
+{
+  /* Evaluates the filters of all query conditions on the sample in qcond_eval_samplebuf,
+     except for those in "skip".  Conditions sharing a filter share a bit, so each filter
+     is called only once. */
+  dds_querycond_mask_t done = skip, conds = 0;
+  for (dds_readcond *rc = rhc->conds; rc != NULL; rc = rc->m_next)
+  {
+    const dds_querycond_mask_t qcmask = rc->m_query.m_qcmask;
+    if (rc->m_query.m_filter != 0 && !(done & qcmask))
+    {
+      done |= qcmask;
+      if (rc->m_query.m_filter (rhc->qcond_eval_samplebuf))
+        conds |= qcmask;
+    }
+  }
+  return conds;
+}
+
 static struct rhc_sample *alloc_sample (struct rhc_instance *inst)
 {
   if (inst->a_sample_free)
@@ -929,9 +953,13 @@ static bool add_sample (struct dds_rhc_default *rhc, struct rhc_instance *inst,
   s->conds = 0;
   if (rhc->nqconds != 0)
   {
-    for (dds_readcond *rc = rhc->conds; rc != NULL; rc = rc->m_next)
-      if (rc->m_query.m_filter != 0 && eval_predicate_sample (rhc, s->sample, rc->m_query.m_filter))
-        s->conds |= rc->m_query.m_qcmask;
+    /* filters that only depend on the key were evaluated when the instance was created */
+    s->conds = inst->conds & rhc->qconds_keyonly;
+    if (rhc->qconds_inuse != rhc->qconds_keyonly)
+    {
+      ddsi_serdata_to_sample (s->sample, rhc->qcond_eval_samplebuf, NULL, NULL);
+      s->conds |= eval_qconds (rhc, rhc->qconds_keyonly);
+    }
   }
 
   trig_qc->inc_conds_sample = s->conds;
@@ -946,7 +974,12 @@ static bool content_filter_accepts (const dds_reader *reader, const struct ddsi_
   if (reader)
   {
     const struct dds_topic *tp = reader->m_topic;
-    if (tp->filter_fn)
+    struct ddsi_filter * const filter = ddsrt_atomic_ldvoidp (&tp->m_filter);
+    /* filter expressions are evaluated on the serialized data, so samples
+       are rejected before any deserialization or instance allocation */
+    if (filter && !ddsi_filter_accepts (filter, sample))
+      ret = false;
+    else if (tp->filter_fn)
     {
       char *tmp = ddsi_sertopic_alloc_sample (tp->m_stopic);
       ddsi_serdata_to_sample (sample, tmp, NULL, NULL);
@@ -1348,13 +1381,8 @@ static struct rhc_instance *alloc_new_instance (struct dds_rhc_default *rhc, con
 
   if (rhc->nqconds != 0)
   {
-    for (dds_readcond *c = rhc->conds; c != NULL; c = c->m_next)
-    {
-      assert ((dds_entity_kind (&c->m_entity) == DDS_KIND_COND_READ && c->m_query.m_filter == 0) ||
-              (dds_entity_kind (&c->m_entity) == DDS_KIND_COND_QUERY && c->m_query.m_filter != 0));
-      if (c->m_query.m_filter && eval_predicate_invsample (rhc, inst, c->m_query.m_filter))
-        inst->conds |= c->m_query.m_qcmask;
-    }
+    topicless_to_clean_invsample (rhc->topic, inst->tk->m_sample, rhc->qcond_eval_samplebuf, NULL, NULL);
+    inst->conds = eval_qconds (rhc, 0);
   }
   return inst;
 }
@@ -1500,9 +1528,11 @@ static void update_viewstate_and_disposedness (struct dds_rhc_default * __restri
   delivered (true unless a reliable sample rejected).
 */
 
-static bool dds_rhc_default_store (struct ddsi_rhc * __restrict rhc_common, const struct ddsi_writer_info * __restrict wrinfo, struct ddsi_serdata * __restrict sample, struct ddsi_tkmap_instance * __restrict tk)
+/* Stores a sample with the lock held, the data available notification, the status callback
+   and signalling the conditions in "triggers" are left to the caller (notify_data_available
+   is only ever set to true, so it can be accumulated over multiple samples) */
+static rhc_store_result_t dds_rhc_default_store_locked (struct dds_rhc_default * __restrict rhc, const struct ddsi_writer_info * __restrict wrinfo, struct ddsi_serdata * __restrict sample, struct ddsi_tkmap_instance * __restrict tk, status_cb_data_t * __restrict cb_data, bool * __restrict nda, dds_entity *triggers[], size_t * __restrict ntriggers)
 {
-  struct dds_rhc_default * const __restrict rhc = (struct dds_rhc_default * __restrict) rhc_common;
   const uint64_t wr_iid = wrinfo->iid;
   const uint32_t statusinfo = sample->statusinfo;
   const bool has_data = (sample->kind == SDK_DATA);
@@ -1513,11 +1543,9 @@ static bool dds_rhc_default_store (struct ddsi_rhc * __restrict rhc_common, cons
   struct trigger_info_post post;
   struct trigger_info_qcond trig_qc;
   rhc_store_result_t stored;
-  status_cb_data_t cb_data;   /* Callback data for reader status callback */
   bool notify_data_available;
-  dds_entity *triggers[MAX_FAST_TRIGGERS];
-  size_t ntriggers;
 
+  cb_data->raw_status_id = -1;
   TRACE ("rhc_store %"PRIx64",%"PRIx64" si %x has_data %d:", tk->m_iid, wr_iid, statusinfo, has_data);
   if (!has_data && statusinfo == 0)
   {
@@ -1525,19 +1553,15 @@ static bool dds_rhc_default_store (struct ddsi_rhc * __restrict rhc_common, cons
        register, which we do implicitly. (Currently DDSI2 won't allow
        it through anyway.) */
     TRACE (" ignore explicit register\n");
-    return true;
+    return RHC_FILTERED;
   }
 
   notify_data_available = false;
   dummy_instance.iid = tk->m_iid;
   stored = RHC_FILTERED;
-  cb_data.raw_status_id = -1;
-  ntriggers = 0;
 
   init_trigger_info_qcond (&trig_qc);
 
-  ddsrt_mutex_lock (&rhc->lock);
-
   inst = ddsrt_hh_lookup (rhc->instances, &dummy_instance);
   if (inst == NULL)
   {
@@ -1553,7 +1577,7 @@ static bool dds_rhc_default_store (struct ddsi_rhc * __restrict rhc_common, cons
     else
     {
       TRACE (" new instance\n");
-      stored = rhc_store_new_instance (&inst, rhc, wrinfo, sample, tk, has_data, &cb_data, &trig_qc, &notify_data_available);
+      stored = rhc_store_new_instance (&inst, rhc, wrinfo, sample, tk, has_data, cb_data, &trig_qc, &notify_data_available);
       if (stored != RHC_STORED)
         goto error_or_nochange;
 
@@ -1586,10 +1610,10 @@ static bool dds_rhc_default_store (struct ddsi_rhc * __restrict rhc_common, cons
     }
 
     /* notify sample lost */
-    cb_data.raw_status_id = (int) DDS_SAMPLE_LOST_STATUS_ID;
-    cb_data.extra = 0;
-    cb_data.handle = 0;
-    cb_data.add = true;
+    cb_data->raw_status_id = (int) DDS_SAMPLE_LOST_STATUS_ID;
+    cb_data->extra = 0;
+    cb_data->handle = 0;
+    cb_data->add = true;
   }
   else
   {
@@ -1624,7 +1648,7 @@ static bool dds_rhc_default_store (struct ddsi_rhc * __restrict rhc_common, cons
       if (has_data)
       {
         TRACE (" add_sample");
-        if (!add_sample (rhc, inst, wrinfo, sample, &cb_data, &trig_qc, &notify_data_available))
+        if (!add_sample (rhc, inst, wrinfo, sample, cb_data, &trig_qc, &notify_data_available))
         {
           TRACE ("(reject)\n");
           stored = RHC_REJECTED;
@@ -1689,23 +1713,91 @@ static bool dds_rhc_default_store (struct ddsi_rhc * __restrict rhc_common, cons
     get_trigger_info_cmn (&post.c, inst);
   }
 
-  postprocess_instance_update (rhc, &inst, &pre, &post, &trig_qc, triggers, &ntriggers);
+  postprocess_instance_update (rhc, &inst, &pre, &post, &trig_qc, triggers, ntriggers);
 
 error_or_nochange:
-  ddsrt_mutex_unlock (&rhc->lock);
+  if (notify_data_available)
+    *nda = true;
+  return stored;
+}
 
+static void dds_rhc_default_store_notify (struct dds_rhc_default * __restrict rhc, const status_cb_data_t *cb_data, bool nda, dds_entity *triggers[], size_t ntriggers)
+{
   if (rhc->reader)
   {
-    if (notify_data_available)
+    if (nda)
       dds_reader_data_available_cb (rhc->reader);
     for (size_t i = 0; i < ntriggers; i++)
       dds_entity_status_signal (triggers[i], 0);
-    if (cb_data.raw_status_id >= 0)
-      dds_reader_status_cb (&rhc->reader->m_entity, &cb_data);
+    if (cb_data->raw_status_id >= 0)
+      dds_reader_status_cb (&rhc->reader->m_entity, cb_data);
   }
+}
+
+static bool dds_rhc_default_store (struct ddsi_rhc * __restrict rhc_common, const struct ddsi_writer_info * __restrict wrinfo, struct ddsi_serdata * __restrict sample, struct ddsi_tkmap_instance * __restrict tk)
+{
+  struct dds_rhc_default * const __restrict rhc = (struct dds_rhc_default * __restrict) rhc_common;
+  status_cb_data_t cb_data;   /* Callback data for reader status callback */
+  bool notify_data_available = false;
+  dds_entity *triggers[MAX_FAST_TRIGGERS];
+  size_t ntriggers = 0;
+  rhc_store_result_t stored;
+
+  ddsrt_mutex_lock (&rhc->lock);
+  stored = dds_rhc_default_store_locked (rhc, wrinfo, sample, tk, &cb_data, &notify_data_available, triggers, &ntriggers);
+  ddsrt_mutex_unlock (&rhc->lock);
+  dds_rhc_default_store_notify (rhc, &cb_data, notify_data_available, triggers, ntriggers);
   return !(rhc->reliable && stored == RHC_REJECTED);
 }
 
+static uint32_t dds_rhc_default_store_batch (struct ddsi_rhc * __restrict rhc_common, uint32_t n, const struct ddsi_rhc_batch_sample * __restrict samples)
+{
+  /* Historical data for a new reader or a coherent set: all samples are stored under a
+     single lock and the notifications are done once at the end, except that the rare
+     status callbacks for lost and rejected samples force the accumulated notifications
+     out early because those callbacks are made without holding the lock */
+  struct dds_rhc_default * const __restrict rhc = (struct dds_rhc_default * __restrict) rhc_common;
+  status_cb_data_t cb_data;
+  bool notify_data_available = false;
+  dds_entity *triggers[MAX_FAST_TRIGGERS];
+  size_t ntriggers = 0;
+  uint32_t i;
+
+  ddsrt_mutex_lock (&rhc->lock);
+  for (i = 0; i < n; i++)
+  {
+    const size_t ntriggers_before = ntriggers;
+    const rhc_store_result_t stored = dds_rhc_default_store_locked (rhc, &samples[i].wrinfo, samples[i].sample, samples[i].tk, &cb_data, &notify_data_available, triggers, &ntriggers);
+    /* Every sample of the batch tends to trigger the same conditions, keeping each only
+       once avoids overflowing the array (which results in signalling under the lock) */
+    for (size_t j = ntriggers_before; j < ntriggers; )
+    {
+      size_t k;
+      for (k = 0; k < ntriggers_before && triggers[k] != triggers[j]; k++)
+        ;
+      if (k < ntriggers_before)
+        triggers[j] = triggers[--ntriggers];
+      else
+        j++;
+    }
+    if (cb_data.raw_status_id >= 0)
+    {
+      ddsrt_mutex_unlock (&rhc->lock);
+      dds_rhc_default_store_notify (rhc, &cb_data, notify_data_available, triggers, ntriggers);
+      notify_data_available = false;
+      ntriggers = 0;
+      ddsrt_mutex_lock (&rhc->lock);
+    }
+    /* the caller retries from the rejected sample onwards, like it would for store */
+    if (rhc->reliable && stored == RHC_REJECTED)
+      break;
+  }
+  ddsrt_mutex_unlock (&rhc->lock);
+  cb_data.raw_status_id = -1;
+  dds_rhc_default_store_notify (rhc, &cb_data, notify_data_available, triggers, ntriggers);
+  return i;
+}
+
 static void dds_rhc_default_unregister_wr (struct ddsi_rhc * __restrict rhc_common, const struct ddsi_writer_info * __restrict wrinfo)
 {
   /* Only to be called when writer with ID WR_IID has died.
@@ -1964,6 +2056,8 @@ static bool read_take_to_invsample (const struct ddsi_sertopic * __restrict topi
 static bool read_take_to_sample_ref (const struct ddsi_serdata * __restrict d, void * __restrict * __restrict sample, void * __restrict * __restrict bufptr, void * __restrict buflim)
 {
   (void) bufptr; (void) buflim;
+  /* the application accesses the data without any protection from the garbage collector */
+  ddsi_serdata_default_keep_rmsg ((struct ddsi_serdata *) d);
   *sample = ddsi_serdata_ref (d);
   return true;
 }
@@ -1971,6 +2065,7 @@ static bool read_take_to_sample_ref (const struct ddsi_serdata * __restrict d, v
 static bool read_take_to_invsample_ref (const struct ddsi_sertopic * __restrict topic, const struct ddsi_serdata * __restrict d, void * __restrict * __restrict sample, void * __restrict * __restrict bufptr, void * __restrict buflim)
 {
   (void) topic; (void) bufptr; (void) buflim;
+  ddsi_serdata_default_keep_rmsg ((struct ddsi_serdata *) d);
   *sample = ddsi_serdata_ref (d);
   return true;
 }
@@ -2326,24 +2421,33 @@ static bool dds_rhc_default_add_readcondition (struct dds_rhc *rhc_common, dds_r
 
   ddsrt_mutex_lock (&rhc->lock);
 
-  /* Allocate a slot in the condition bitmasks; return an error no more slots are available */
+  /* Allocate a slot in the condition bitmasks, sharing it with an existing query condition
+     that uses the same filter; return an error no more slots are available */
+  bool shared_qcmask = false;
   if (cond->m_query.m_filter != 0)
   {
-    dds_querycond_mask_t avail_qcmask = ~(dds_querycond_mask_t)0;
-    for (dds_readcond *rc = rhc->conds; rc != NULL; rc = rc->m_next)
+    for (dds_readcond *rc = rhc->conds; rc != NULL && !shared_qcmask; rc = rc->m_next)
     {
       assert ((rc->m_query.m_filter == 0 && rc->m_query.m_qcmask == 0) || (rc->m_query.m_filter != 0 && rc->m_query.m_qcmask != 0));
-      avail_qcmask &= ~rc->m_query.m_qcmask;
+      if (rc->m_query.m_filter == cond->m_query.m_filter && rc->m_query.m_keyonly == cond->m_query.m_keyonly)
+      {
+        cond->m_query.m_qcmask = rc->m_query.m_qcmask;
+        shared_qcmask = true;
+      }
     }
-    if (avail_qcmask == 0)
+    if (!shared_qcmask)
     {
-      /* no available indices */
-      ddsrt_mutex_unlock (&rhc->lock);
-      return false;
-    }
+      const dds_querycond_mask_t avail_qcmask = ~rhc->qconds_inuse;
+      if (avail_qcmask == 0)
+      {
+        /* no available indices */
+        ddsrt_mutex_unlock (&rhc->lock);
+        return false;
+      }
 
-    /* use the least significant bit set */
-    cond->m_query.m_qcmask = avail_qcmask & (~avail_qcmask + 1);
+      /* use the least significant bit set */
+      cond->m_query.m_qcmask = avail_qcmask & (~avail_qcmask + 1);
+    }
   }
 
   rhc->nconds++;
@@ -2369,34 +2473,49 @@ static bool dds_rhc_default_add_readcondition (struct dds_rhc *rhc_common, dds_r
   {
     if (cond_is_sample_state_dependent (cond))
       rhc->qconds_samplest |= cond->m_query.m_qcmask;
+    if (cond->m_query.m_keyonly)
+      rhc->qconds_keyonly |= cond->m_query.m_qcmask;
+    rhc->qconds_inuse |= cond->m_query.m_qcmask;
     if (rhc->nqconds++ == 0)
     {
       assert (rhc->qcond_eval_samplebuf == NULL);
       rhc->qcond_eval_samplebuf = ddsi_sertopic_alloc_sample (rhc->topic);
     }
 
-    /* Attaching a query condition means clearing the allocated bit in all instances and
-       samples, except for those that match the predicate. */
+    /* Attaching a query condition with a new filter means clearing the allocated bit in all
+       instances and samples, except for those that match the predicate.  If the bit is shared
+       with an existing condition, it is already up-to-date. */
     const dds_querycond_mask_t qcmask = cond->m_query.m_qcmask;
     for (struct rhc_instance *inst = ddsrt_hh_iter_first (rhc->instances, &it); inst != NULL; inst = ddsrt_hh_iter_next (&it))
     {
-      const bool instmatch = eval_predicate_invsample (rhc, inst, cond->m_query.m_filter);;
-      uint32_t matches = 0;
-
-      inst->conds = (inst->conds & ~qcmask) | (instmatch ? qcmask : 0);
-      if (inst->latest)
+      if (!shared_qcmask)
       {
-        struct rhc_sample *sample = inst->latest->next, * const end = sample;
-        do {
-          const bool m = eval_predicate_sample (rhc, sample->sample, cond->m_query.m_filter);
-          sample->conds = (sample->conds & ~qcmask) | (m ? qcmask : 0);
-          matches += m;
-          sample = sample->next;
-        } while (sample != end);
+        const bool instmatch = eval_predicate_invsample (rhc, inst, cond->m_query.m_filter);
+        inst->conds = (inst->conds & ~qcmask) | (instmatch ? qcmask : 0);
+        if (inst->latest)
+        {
+          struct rhc_sample *sample = inst->latest->next, * const end = sample;
+          do {
+            const bool m = cond->m_query.m_keyonly ? instmatch : eval_predicate_sample (rhc, sample->sample, cond->m_query.m_filter);
+            sample->conds = (sample->conds & ~qcmask) | (m ? qcmask : 0);
+            sample = sample->next;
+          } while (sample != end);
+        }
       }
 
       if (!inst_is_empty (inst) && rhc_get_cond_trigger (inst, cond))
-        trigger += (inst->inv_exists ? instmatch : 0) + matches;
+      {
+        if (inst->inv_exists)
+          trigger += (qmask_of_invsample (inst) & cond->m_qminv) == 0 && (inst->conds & qcmask) != 0;
+        if (inst->latest)
+        {
+          struct rhc_sample *sample = inst->latest->next, * const end = sample;
+          do {
+            trigger += (qmask_of_sample (sample) & cond->m_qminv) == 0 && (sample->conds & qcmask) != 0;
+            sample = sample->next;
+          } while (sample != end);
+        }
+      }
     }
   }
 
@@ -2426,8 +2545,19 @@ static void dds_rhc_default_remove_readcondition (struct dds_rhc *rhc_common, dd
   rhc->nconds--;
   if (cond->m_query.m_filter)
   {
+    /* the bit remains in use as long as another condition with the same filter exists */
     rhc->nqconds--;
-    rhc->qconds_samplest &= ~cond->m_query.m_qcmask;
+    rhc->qconds_samplest = rhc->qconds_keyonly = rhc->qconds_inuse = 0;
+    for (dds_readcond *rc = rhc->conds; rc != NULL; rc = rc->m_next)
+    {
+      if (rc->m_query.m_filter == 0)
+        continue;
+      if (cond_is_sample_state_dependent (rc))
+        rhc->qconds_samplest |= rc->m_query.m_qcmask;
+      if (rc->m_query.m_keyonly)
+        rhc->qconds_keyonly |= rc->m_query.m_qcmask;
+      rhc->qconds_inuse |= rc->m_query.m_qcmask;
+    }
     cond->m_query.m_qcmask = 0;
     if (rhc->nqconds == 0)
     {
@@ -2449,7 +2579,7 @@ static bool update_conditions_locked (struct dds_rhc_default *rhc, bool called_f
   TRACE ("update_conditions_locked(%p %p) - inst %"PRIu32" nonempty %"PRIu32" disp %"PRIu32" nowr %"PRIu32" new %"PRIu32" samples %"PRIu32" read %"PRIu32"\n",
          (void *) rhc, (void *) inst, rhc->n_instances, rhc->n_nonempty_instances, rhc->n_not_alive_disposed,
          rhc->n_not_alive_no_writers, rhc->n_new, rhc->n_vsamples, rhc->n_vread);
-  TRACE ("  pre (%"PRIx32",%d,%d) post (%"PRIx32",%d,%d) read -[%d,%d]+[%d,%d] qcmask -[%"PRIx32",%"PRIx32"]+[%"PRIx32",%"PRIx32"]\n",
+  TRACE ("  pre (%"PRIx32",%d,%d) post (%"PRIx32",%d,%d) read -[%d,%d]+[%d,%d] qcmask -[%"PRIx64",%"PRIx64"]+[%"PRIx64",%"PRIx64"]\n",
          pre->c.qminst, pre->c.has_read, pre->c.has_not_read,
          post->c.qminst, post->c.has_read, post->c.has_not_read,
          trig_qc->dec_invsample_read, trig_qc->dec_sample_read, trig_qc->inc_invsample_read, trig_qc->inc_sample_read,
@@ -2497,7 +2627,7 @@ static bool update_conditions_locked (struct dds_rhc_default *rhc, bool called_f
         DDS_FATAL ("update_readconditions: sample_states invalid: %"PRIx32"\n", iter->m_sample_states);
     }
 
-    TRACE ("  cond %p %08"PRIx32": ", (void *) iter, iter->m_query.m_qcmask);
+    TRACE ("  cond %p %016"PRIx64": ", (void *) iter, iter->m_query.m_qcmask);
     if (iter->m_query.m_filter == 0)
     {
       assert (dds_entity_kind (&iter->m_entity) == DDS_KIND_COND_READ);
@@ -2708,7 +2838,9 @@ static int rhc_check_counts_locked (struct dds_rhc_default *rhc, bool check_cond
     assert ((dds_entity_kind (&rciter->m_entity) == DDS_KIND_COND_READ && rciter->m_query.m_filter == 0) ||
             (dds_entity_kind (&rciter->m_entity) == DDS_KIND_COND_QUERY && rciter->m_query.m_filter != 0));
     assert ((rciter->m_query.m_filter != 0) == (rciter->m_query.m_qcmask != 0));
-    assert (!(enabled_qcmask & rciter->m_query.m_qcmask));
+    for (dds_readcond *rc = rhc->conds; rc != rciter; rc = rc->m_next)
+      assert (!(rc->m_query.m_qcmask & rciter->m_query.m_qcmask) ||
+              (rc->m_query.m_filter == rciter->m_query.m_filter && rc->m_query.m_keyonly == rciter->m_query.m_keyonly));
     enabled_qcmask |= rciter->m_query.m_qcmask;
   }
 
@@ -2854,6 +2986,7 @@ static int rhc_check_counts_locked (struct dds_rhc_default *rhc, bool check_cond
 static const struct dds_rhc_ops dds_rhc_default_ops = {
   .rhc_ops = {
     .store = dds_rhc_default_store,
+    .store_batch = dds_rhc_default_store_batch,
     .unregister_wr = dds_rhc_default_unregister_wr,
     .relinquish_ownership = dds_rhc_default_relinquish_ownership,
     .set_qos = dds_rhc_default_set_qos,
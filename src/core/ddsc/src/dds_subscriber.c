@@ -95,13 +95,26 @@ dds_return_t dds_notify_readers (dds_entity_t subscriber)
   return DDS_RETCODE_UNSUPPORTED;
 }
 
+static dds_return_t subscriber_coherent_access (dds_entity_t subscriber)
+{
+  /* Coherent sets are inserted in the reader history caches atomically on
+     receipt of the end of the set, so there is nothing to be done on the
+     subscriber side beyond checking the handle */
+  dds_subscriber *sub;
+  dds_return_t ret;
+  if ((ret = dds_subscriber_lock (subscriber, &sub)) != DDS_RETCODE_OK)
+    return ret;
+  dds_subscriber_unlock (sub);
+  return DDS_RETCODE_OK;
+}
+
 dds_return_t dds_subscriber_begin_coherent (dds_entity_t e)
 {
-  return dds_generic_unimplemented_operation (e, DDS_KIND_SUBSCRIBER);
+  return subscriber_coherent_access (e);
 }
 
 dds_return_t dds_subscriber_end_coherent (dds_entity_t e)
 {
-  return dds_generic_unimplemented_operation (e, DDS_KIND_SUBSCRIBER);
+  return subscriber_coherent_access (e);
 }
 
@@ -33,6 +33,7 @@
 #include "dds/ddsi/ddsi_plist.h"
 #include "dds/ddsi/ddsi_domaingv.h"
 #include "dds/ddsi/ddsi_cdrstream.h"
+#include "dds/ddsi/ddsi_filter.h"
 #include "dds/ddsi/ddsi_security_omg.h"
 #include "dds__serdata_builtintopic.h"
 
@@ -153,6 +154,9 @@ static dds_return_t dds_topic_delete (dds_entity *e)
   struct dds_ktopic * const ktp = tp->m_ktopic;
   assert (dds_entity_kind (e->m_parent) == DDS_KIND_PARTICIPANT);
   dds_participant * const pp = (dds_participant *) e->m_parent;
+  struct ddsi_filter * const filter = ddsrt_atomic_ldvoidp (&tp->m_filter);
+  if (filter)
+    ddsi_filter_free (filter);
   ddsi_sertopic_unref (tp->m_stopic);
 
   ddsrt_mutex_lock (&pp->m_entity.m_mutex);
@@ -258,6 +262,7 @@ static dds_entity_t create_topic_pp_locked (struct dds_participant *pp, struct d
   dds_entity_register_child (&pp->m_entity, &tp->m_entity);
   tp->m_ktopic = ktp;
   tp->m_stopic = sertopic_registered;
+  ddsrt_atomic_stvoidp (&tp->m_filter, NULL);
   dds_entity_init_complete (&tp->m_entity);
   return hdl;
 }
@@ -424,6 +429,8 @@ dds_entity_t dds_create_topic (dds_entity_t participant, const dds_topic_descrip
     st->type.m_keys[i] = desc->m_keys[i].m_index;
   st->type.m_nops = dds_stream_countops (desc->m_ops);
   st->type.m_ops = ddsrt_memdup (desc->m_ops, st->type.m_nops * sizeof (*st->type.m_ops));
+  st->cdr_align = dds_stream_max_align (desc->m_ops);
+  st->type_description = (desc->m_meta && *desc->m_meta) ? ddsrt_strdup (desc->m_meta) : NULL;
 
   /* Check if topic cannot be optimised (memcpy marshal) */
   if (!(st->type.m_flagset & DDS_TOPIC_NO_OPTIMIZE)) {
@@ -584,6 +591,94 @@ dds_topic_filter_fn dds_topic_get_filter (dds_entity_t topic)
   return dds_get_topic_filter_deprecated (topic);
 }
 
+static void pushdown_content_filter (struct dds_entity *e, const struct dds_topic *tp, const nn_content_filter_property_t *content_filter)
+{
+  /* e is pinned, no locks held */
+  dds_instance_handle_t last_iid = 0;
+  struct dds_entity *c;
+  ddsrt_mutex_lock (&e->m_mutex);
+  while ((c = ddsrt_avl_lookup_succ (&dds_entity_children_td, &e->m_children, &last_iid)) != NULL)
+  {
+    struct dds_entity *x;
+    last_iid = c->m_iid;
+    if (dds_entity_pin (c->m_hdllink.hdl, &x) < 0)
+      continue;
+    assert (x == c);
+    ddsrt_mutex_unlock (&e->m_mutex);
+    if (c->m_kind == DDS_KIND_SUBSCRIBER)
+      pushdown_content_filter (c, tp, content_filter);
+    else if (c->m_kind == DDS_KIND_READER && ((struct dds_reader *) c)->m_topic == tp)
+    {
+      struct reader *rd;
+      thread_state_awake (lookup_thread_state (), &c->m_domain->gv);
+      if ((rd = entidx_lookup_reader_guid (c->m_domain->gv.entity_index, &c->m_guid)) != NULL)
+        update_reader_content_filter (rd, content_filter);
+      thread_state_asleep (lookup_thread_state ());
+    }
+    ddsrt_mutex_lock (&e->m_mutex);
+    dds_entity_unpin (c);
+  }
+  ddsrt_mutex_unlock (&e->m_mutex);
+}
+
+static void topic_pushdown_content_filter (struct dds_topic *t, struct ddsi_filter *filter)
+{
+  /* t is pinned, no locks held; advertise the filter of the topic's readers
+     in discovery so that remote writers can filter at the source */
+  nn_content_filter_property_t *content_filter = filter ? ddsi_filter_get_property (filter) : NULL;
+  pushdown_content_filter (t->m_entity.m_parent, t, content_filter);
+  ddsi_content_filter_property_free (content_filter);
+}
+
+dds_return_t dds_set_topic_filter_expression (dds_entity_t topic, const char *expression, uint32_t nparams, const char * const *params)
+{
+  struct ddsi_filter *filter;
+  dds_topic *t;
+  dds_return_t rc;
+  if ((rc = dds_topic_pin (topic, &t)) != DDS_RETCODE_OK)
+    return rc;
+  ddsrt_mutex_lock (&t->m_entity.m_mutex);
+  if ((filter = ddsrt_atomic_ldvoidp (&t->m_filter)) != NULL)
+    rc = ddsi_filter_set_expression (filter, expression, nparams, params);
+  else if (expression != NULL)
+  {
+    /* readers access the filter without locking the topic, so it must be fully
+       initialized before it is published; it remains until the topic is deleted */
+    filter = ddsi_filter_new (t->m_stopic);
+    if ((rc = ddsi_filter_set_expression (filter, expression, nparams, params)) == DDS_RETCODE_OK)
+      ddsrt_atomic_stvoidp (&t->m_filter, filter);
+    else
+    {
+      ddsi_filter_free (filter);
+      filter = NULL;
+    }
+  }
+  ddsrt_mutex_unlock (&t->m_entity.m_mutex);
+  if (rc == DDS_RETCODE_OK)
+    topic_pushdown_content_filter (t, filter);
+  dds_topic_unpin (t);
+  return rc;
+}
+
+dds_return_t dds_set_topic_filter_parameters (dds_entity_t topic, uint32_t nparams, const char * const *params)
+{
+  struct ddsi_filter *filter;
+  dds_topic *t;
+  dds_return_t rc;
+  if ((rc = dds_topic_pin (topic, &t)) != DDS_RETCODE_OK)
+    return rc;
+  ddsrt_mutex_lock (&t->m_entity.m_mutex);
+  if ((filter = ddsrt_atomic_ldvoidp (&t->m_filter)) == NULL || !ddsi_filter_has_expression (filter))
+    rc = DDS_RETCODE_PRECONDITION_NOT_MET;
+  else
+    rc = ddsi_filter_set_parameters (filter, nparams, params);
+  ddsrt_mutex_unlock (&t->m_entity.m_mutex);
+  if (rc == DDS_RETCODE_OK)
+    topic_pushdown_content_filter (t, filter);
+  dds_topic_unpin (t);
+  return rc;
+}
+
 dds_return_t dds_get_name (dds_entity_t topic, char *name, size_t size)
 {
   dds_topic *t;
@@ -13,6 +13,7 @@
 
 #include "dds/ddsrt/heap.h"
 #include "dds/ddsrt/log.h"
+#include "dds/ddsrt/hopscotch.h"
 #include "dds__entity.h"
 #include "dds__participant.h"
 #include "dds__querycond.h"
@@ -21,6 +22,18 @@
 #include "dds/ddsc/dds_rhc.h"
 #include "dds/ddsi/ddsi_iid.h"
 
+#if !defined _WIN32 && !DDSRT_WITH_LWIP
+#define WAITSET_HAVE_POLLFD 1
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined __linux
+#include <sys/eventfd.h>
+#endif
+#else
+#define WAITSET_HAVE_POLLFD 0
+#endif
+
 static bool is_triggered (struct dds_entity *e)
 {
   bool t;
@@ -39,6 +52,116 @@ static bool is_triggered (struct dds_entity *e)
   return t;
 }
 
+/* The attached entities are kept in an array, with those on the "ready list"
+   at the front.  An entity is only ever put on the ready list when it is
+   attached or when it signals a status change, so the cost of a wait is
+   proportional to the number of triggered entities rather than to the
+   number of attached ones. */
+
+static uint32_t attachment_hash (const void *va)
+{
+  const dds_attachment *a = va;
+  return (uint32_t) (((uint32_t) a->handle * UINT64_C (16292676669999574021)) >> 32);
+}
+
+static int attachment_equals (const void *va, const void *vb)
+{
+  const dds_attachment *a = va;
+  const dds_attachment *b = vb;
+  return a->handle == b->handle;
+}
+
+static dds_attachment *lookup_attachment (const dds_waitset *ws, dds_entity_t handle)
+{
+  dds_attachment template = { .handle = handle };
+  return ddsrt_hh_lookup (ws->attachments, &template);
+}
+
+static void swap_attachments (dds_waitset *ws, size_t i, size_t j)
+{
+  dds_attachment *tmp = ws->entities[i];
+  ws->entities[i] = ws->entities[j];
+  ws->entities[i]->pos = i;
+  ws->entities[j] = tmp;
+  tmp->pos = j;
+}
+
+#if WAITSET_HAVE_POLLFD
+static dds_return_t pollfd_create (dds_waitset *ws)
+{
+#if defined __linux
+  if ((ws->pollfd[0] = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+    return DDS_RETCODE_OUT_OF_RESOURCES;
+  ws->pollfd[1] = ws->pollfd[0];
+#else
+  if (pipe (ws->pollfd) < 0)
+  {
+    ws->pollfd[0] = -1;
+    return DDS_RETCODE_OUT_OF_RESOURCES;
+  }
+  for (int i = 0; i < 2; i++)
+  {
+    (void) fcntl (ws->pollfd[i], F_SETFD, fcntl (ws->pollfd[i], F_GETFD) | FD_CLOEXEC);
+    (void) fcntl (ws->pollfd[i], F_SETFL, fcntl (ws->pollfd[i], F_GETFL) | O_NONBLOCK);
+  }
+#endif
+  return DDS_RETCODE_OK;
+}
+
+static void pollfd_destroy (dds_waitset *ws)
+{
+  if (ws->pollfd[0] < 0)
+    return;
+  close (ws->pollfd[0]);
+  if (ws->pollfd[1] != ws->pollfd[0])
+    close (ws->pollfd[1]);
+}
+
+static void pollfd_signal (dds_waitset *ws)
+{
+  /* Writing only on a transition of the ready list from empty to non-empty
+     means a burst of status changes costs a single wake-up */
+  const uint64_t one = 1;
+  if (ws->pollfd[0] < 0 || ws->pollfd_signalled)
+    return;
+  if (write (ws->pollfd[1], &one, (ws->pollfd[1] == ws->pollfd[0]) ? sizeof (one) : 1) < 0 && errno != EAGAIN)
+    DDS_ERROR ("dds_waitset: write failed on poll fd, errno = %d\n", errno);
+  ws->pollfd_signalled = true;
+}
+
+static void pollfd_reset (dds_waitset *ws)
+{
+  uint64_t buf;
+  ssize_t n;
+  if (!ws->pollfd_signalled)
+    return;
+  do {
+    n = read (ws->pollfd[0], &buf, sizeof (buf));
+  } while (n > 0 || (n < 0 && errno == EINTR));
+  ws->pollfd_signalled = false;
+}
+#else
+static void pollfd_destroy (dds_waitset *ws) { (void) ws; }
+static void pollfd_signal (dds_waitset *ws) { (void) ws; }
+static void pollfd_reset (dds_waitset *ws) { (void) ws; }
+#endif
+
+static void make_ready (dds_waitset *ws, dds_attachment *a)
+{
+  if (a->pos >= ws->ntriggered)
+  {
+    swap_attachments (ws, a->pos, ws->ntriggered++);
+    if (ws->ntriggered == 1)
+      pollfd_signal (ws);
+  }
+}
+
+static void make_idle (dds_waitset *ws, dds_attachment *a)
+{
+  if (a->pos < ws->ntriggered)
+    swap_attachments (ws, a->pos, --ws->ntriggered);
+}
+
 static dds_return_t dds_waitset_wait_impl (dds_entity_t waitset, dds_attach_t *xs, size_t nxs, dds_time_t abstimeout)
 {
   dds_waitset *ws;
@@ -61,16 +184,18 @@ static dds_return_t dds_waitset_wait_impl (dds_entity_t waitset, dds_attach_t *x
     ws = (dds_waitset *) ent;
   }
 
-  /* Move any previously but no longer triggering entities back to the observed list */
+  /* Move any previously but no longer triggering entities back to the observed list;
+     in edge-triggered mode they stay on the ready list until they have been reported */
   ddsrt_mutex_lock (&ws->wait_lock);
-  ws->ntriggered = 0;
-  for (size_t i = 0; i < ws->nentities; i++)
+  if (!ws->edge_triggered)
   {
-    if (is_triggered (ws->entities[i].entity))
+    size_t i = 0;
+    while (i < ws->ntriggered)
     {
-      dds_attachment tmp = ws->entities[i];
-      ws->entities[i] = ws->entities[ws->ntriggered];
-      ws->entities[ws->ntriggered++] = tmp;
+      if (is_triggered (ws->entities[i]->entity))
+        i++;
+      else
+        make_idle (ws, ws->entities[i]);
     }
   }
 
@@ -79,9 +204,28 @@ static dds_return_t dds_waitset_wait_impl (dds_entity_t waitset, dds_attach_t *x
     if (!ddsrt_cond_waituntil (&ws->wait_cond, &ws->wait_lock, abstimeout))
       break;
 
-  ret = (int32_t) ws->ntriggered;
-  for (size_t i = 0; i < ws->ntriggered && i < nxs; i++)
-    xs[i] = ws->entities[i].arg;
+  if (!ws->edge_triggered || nxs == 0)
+  {
+    ret = (int32_t) ws->ntriggered;
+    for (size_t i = 0; i < ws->ntriggered && i < nxs; i++)
+      xs[i] = ws->entities[i]->arg;
+  }
+  else
+  {
+    /* Reported entities leave the ready list until they signal again, those
+       that didn't fit in xs will be returned by the next call */
+    size_t n = 0;
+    while (n < nxs && ws->ntriggered > 0)
+    {
+      xs[n++] = ws->entities[0]->arg;
+      make_idle (ws, ws->entities[0]);
+    }
+    ret = (int32_t) n;
+  }
+  /* The ready list may still contain entities that no longer trigger, so the
+     poll fd can only be reset once a wait finds it empty */
+  if (ws->ntriggered == 0)
+    pollfd_reset (ws);
   ddsrt_mutex_unlock (&ws->wait_lock);
   dds_entity_unpin (&ws->m_entity);
   return ret;
@@ -103,7 +247,7 @@ static void dds_waitset_close (struct dds_entity *e)
   while (ws->nentities > 0)
   {
     dds_entity *observed;
-    if (dds_entity_pin (ws->entities[0].handle, &observed) < 0)
+    if (dds_entity_pin (ws->entities[0]->handle, &observed) < 0)
     {
       /* can't be pinned => being deleted => will be removed from wait set soon enough
        and go through delete_observer (which will trigger the condition variable) */
@@ -115,7 +259,7 @@ static void dds_waitset_close (struct dds_entity *e)
       ddsrt_mutex_unlock (&ws->wait_lock);
       (void) dds_entity_observer_unregister (observed, ws, true);
       ddsrt_mutex_lock (&ws->wait_lock);
-      assert (ws->nentities == 0 || ws->entities[0].entity != observed);
+      assert (ws->nentities == 0 || ws->entities[0]->entity != observed);
       dds_entity_unpin (observed);
     }
   }
@@ -127,7 +271,10 @@ static dds_return_t dds_waitset_delete (struct dds_entity *e)
   dds_waitset *ws = (dds_waitset *) e;
   ddsrt_mutex_destroy (&ws->wait_lock);
   ddsrt_cond_destroy (&ws->wait_cond);
+  assert (ws->nentities == 0);
+  ddsrt_hh_free (ws->attachments);
   ddsrt_free (ws->entities);
+  pollfd_destroy (ws);
   return DDS_RETCODE_OK;
 }
 
@@ -176,6 +323,10 @@ dds_entity_t dds_create_waitset (dds_entity_t owner)
   waitset->nentities = 0;
   waitset->ntriggered = 0;
   waitset->entities = NULL;
+  waitset->attachments = ddsrt_hh_new (1, attachment_hash, attachment_equals);
+  waitset->edge_triggered = false;
+  waitset->pollfd[0] = waitset->pollfd[1] = -1;
+  waitset->pollfd_signalled = false;
   dds_entity_init_complete (&waitset->m_entity);
   dds_entity_unlock (e);
   dds_entity_unpin_and_drop_ref (&dds_global.m_entity);
@@ -206,7 +357,7 @@ dds_return_t dds_waitset_get_entities (dds_entity_t waitset, dds_entity_t *entit
     if (entities != NULL)
     {
       for (size_t i = 0; i < ws->nentities && i < size; i++)
-        entities[i] = ws->entities[i].handle;
+        entities[i] = ws->entities[i]->handle;
     }
     ret = (int32_t) ws->nentities;
     ddsrt_mutex_unlock (&ws->wait_lock);
@@ -222,16 +373,9 @@ static void dds_waitset_observer (struct dds_waitset *ws, dds_entity_t observed,
 
   ddsrt_mutex_lock (&ws->wait_lock);
   /* Move observed entity to triggered list. */
-  size_t i;
-  for (i = 0; i < ws->nentities; i++)
-    if (ws->entities[i].handle == observed)
-      break;
-  if (i < ws->nentities && i >= ws->ntriggered)
-  {
-    dds_attachment tmp = ws->entities[i];
-    ws->entities[i] = ws->entities[ws->ntriggered];
-    ws->entities[ws->ntriggered++] = tmp;
-  }
+  dds_attachment *a;
+  if ((a = lookup_attachment (ws, observed)) != NULL)
+    make_ready (ws, a);
   /* Trigger waitset to wake up. */
   ddsrt_cond_broadcast (&ws->wait_cond);
   ddsrt_mutex_unlock (&ws->wait_lock);
@@ -244,19 +388,17 @@ struct dds_waitset_attach_observer_arg {
 static bool dds_waitset_attach_observer (struct dds_waitset *ws, struct dds_entity *observed, void *varg)
 {
   struct dds_waitset_attach_observer_arg *arg = varg;
+  dds_attachment *a = ddsrt_malloc (sizeof (*a));
+  a->arg = arg->x;
+  a->entity = observed;
+  a->handle = observed->m_hdllink.hdl;
   ddsrt_mutex_lock (&ws->wait_lock);
   ws->entities = ddsrt_realloc (ws->entities, (ws->nentities + 1) * sizeof (*ws->entities));
-  ws->entities[ws->nentities].arg = arg->x;
-  ws->entities[ws->nentities].entity = observed;
-  ws->entities[ws->nentities].handle = observed->m_hdllink.hdl;
-  ws->nentities++;
+  a->pos = ws->nentities;
+  ws->entities[ws->nentities++] = a;
+  ddsrt_hh_add (ws->attachments, a);
   if (is_triggered (observed))
-  {
-    const size_t i = ws->nentities - 1;
-    dds_attachment tmp = ws->entities[i];
-    ws->entities[i] = ws->entities[ws->ntriggered];
-    ws->entities[ws->ntriggered++] = tmp;
-  }
+    make_ready (ws, a);
   ddsrt_cond_broadcast (&ws->wait_cond);
   ddsrt_mutex_unlock (&ws->wait_lock);
   return true;
@@ -264,22 +406,14 @@ static bool dds_waitset_attach_observer (struct dds_waitset *ws, struct dds_enti
 
 static void dds_waitset_delete_observer (struct dds_waitset *ws, dds_entity_t observed)
 {
-  size_t i;
+  dds_attachment *a;
   ddsrt_mutex_lock (&ws->wait_lock);
-  for (i = 0; i < ws->nentities; i++)
-    if (ws->entities[i].handle == observed)
-      break;
-  if (i < ws->nentities)
+  if ((a = lookup_attachment (ws, observed)) != NULL)
   {
-    if (i < ws->ntriggered)
-    {
-      ws->entities[i] = ws->entities[--ws->ntriggered];
-      ws->entities[ws->ntriggered] = ws->entities[--ws->nentities];
-    }
-    else
-    {
-      ws->entities[i] = ws->entities[--ws->nentities];
-    }
+    make_idle (ws, a);
+    swap_attachments (ws, a->pos, --ws->nentities);
+    ddsrt_hh_remove (ws->attachments, a);
+    ddsrt_free (a);
   }
   ddsrt_cond_broadcast (&ws->wait_cond);
   ddsrt_mutex_unlock (&ws->wait_lock);
@@ -375,6 +509,66 @@ dds_return_t dds_waitset_wait (dds_entity_t waitset, dds_attach_t *xs, size_t nx
   return dds_waitset_wait_impl (waitset, xs, nxs, abstimeout);
 }
 
+dds_return_t dds_waitset_set_edge_triggered (dds_entity_t waitset, bool edge_triggered)
+{
+  dds_entity *ent;
+  dds_return_t rc;
+  if ((rc = dds_entity_pin (waitset, &ent)) != DDS_RETCODE_OK)
+    return rc;
+  else if (dds_entity_kind (ent) != DDS_KIND_WAITSET)
+  {
+    dds_entity_unpin (ent);
+    return DDS_RETCODE_ILLEGAL_OPERATION;
+  }
+  else
+  {
+    dds_waitset *ws = (dds_waitset *) ent;
+    ddsrt_mutex_lock (&ws->wait_lock);
+    if (ws->edge_triggered && !edge_triggered)
+    {
+      /* entities that were reported while edge-triggered may still be triggered */
+      for (size_t i = ws->ntriggered; i < ws->nentities; i++)
+        if (is_triggered (ws->entities[i]->entity))
+          make_ready (ws, ws->entities[i]);
+      ddsrt_cond_broadcast (&ws->wait_cond);
+    }
+    ws->edge_triggered = edge_triggered;
+    ddsrt_mutex_unlock (&ws->wait_lock);
+    dds_entity_unpin (ent);
+    return DDS_RETCODE_OK;
+  }
+}
+
+dds_return_t dds_waitset_get_fd (dds_entity_t waitset, int *fd)
+{
+  dds_entity *ent;
+  dds_return_t rc;
+  if (fd == NULL)
+    return DDS_RETCODE_BAD_PARAMETER;
+  if ((rc = dds_entity_pin (waitset, &ent)) != DDS_RETCODE_OK)
+    return rc;
+  else if (dds_entity_kind (ent) != DDS_KIND_WAITSET)
+  {
+    dds_entity_unpin (ent);
+    return DDS_RETCODE_ILLEGAL_OPERATION;
+  }
+  else
+  {
+#if WAITSET_HAVE_POLLFD
+    dds_waitset *ws = (dds_waitset *) ent;
+    ddsrt_mutex_lock (&ws->wait_lock);
+    if (ws->pollfd[0] < 0 && (rc = pollfd_create (ws)) == DDS_RETCODE_OK && ws->ntriggered > 0)
+      pollfd_signal (ws);
+    *fd = ws->pollfd[0];
+    ddsrt_mutex_unlock (&ws->wait_lock);
+#else
+    rc = DDS_RETCODE_UNSUPPORTED;
+#endif
+    dds_entity_unpin (ent);
+    return rc;
+  }
+}
+
 dds_return_t dds_waitset_set_trigger (dds_entity_t waitset, bool trigger)
 {
   dds_entity *ent;
@@ -11,11 +11,14 @@
  */
 #include <assert.h>
 #include <string.h>
+#include "dds/ddsrt/heap.h"
 #include "dds__writer.h"
 #include "dds__write.h"
+#include "dds__durability.h"
 #include "dds/ddsi/ddsi_tkmap.h"
 #include "dds/ddsi/q_thread.h"
 #include "dds/ddsi/q_xmsg.h"
+#include "dds/ddsi/q_xevent.h"
 #include "dds/ddsi/ddsi_rhc.h"
 #include "dds/ddsi/ddsi_serdata.h"
 #include "dds/ddsi/ddsi_cdrstream.h"
@@ -26,6 +29,9 @@
 #include "dds/ddsi/q_radmin.h"
 #include "dds/ddsi/ddsi_domaingv.h"
 #include "dds/ddsi/ddsi_deliver_locally.h"
+#include "dds/ddsi/ddsi_serdata_default.h"
+#include "dds/ddsi/ddsi_shm.h"
+#include "dds/ddsi/q_addrset.h"
 
 dds_return_t dds_write (dds_entity_t writer, const void *data)
 {
@@ -42,6 +48,24 @@ dds_return_t dds_write (dds_entity_t writer, const void *data)
   return ret;
 }
 
+dds_return_t dds_loan_sample (dds_entity_t writer, void **sample)
+{
+  dds_return_t ret;
+  dds_writer *wr;
+
+  if (sample == NULL)
+    return DDS_RETCODE_BAD_PARAMETER;
+
+  if ((ret = dds_writer_lock (writer, &wr)) != DDS_RETCODE_OK)
+    return ret;
+  if (!ddsi_sertopic_default_supports_shm_loans (wr->m_wr->topic))
+    ret = DDS_RETCODE_UNSUPPORTED;
+  else if ((*sample = ddsi_shm_chunk_alloc (&wr->m_entity.m_domain->gv)) == NULL)
+    ret = DDS_RETCODE_OUT_OF_RESOURCES;
+  dds_writer_unlock (wr);
+  return ret;
+}
+
 dds_return_t dds_writecdr (dds_entity_t writer, struct ddsi_serdata *serdata)
 {
   dds_return_t ret;
@@ -155,6 +179,106 @@ static dds_return_t deliver_locally (struct writer *wr, struct ddsi_serdata *pay
   return rc;
 }
 
+struct dds_writer_coherent_set {
+  uint32_t n, size;
+  struct ddsi_serdata **samples;
+  struct ddsi_tkmap_instance **tks;
+};
+
+static void coherent_set_add (struct dds_writer_coherent_set *cs, struct ddsi_serdata *payload, struct ddsi_tkmap_instance *tk)
+{
+  if (cs->n == cs->size)
+  {
+    cs->size = (cs->size == 0) ? 32 : 2 * cs->size;
+    cs->samples = ddsrt_realloc (cs->samples, cs->size * sizeof (*cs->samples));
+    cs->tks = ddsrt_realloc (cs->tks, cs->size * sizeof (*cs->tks));
+  }
+  cs->samples[cs->n] = ddsi_serdata_ref (payload);
+  ddsi_tkmap_instance_ref (tk);
+  cs->tks[cs->n] = tk;
+  cs->n++;
+}
+
+static dds_return_t deliver_locally_coherent_set (struct writer *wr, const struct dds_writer_coherent_set *cs)
+{
+  static const struct deliver_locally_ops deliver_locally_ops = {
+    .makesample = local_make_sample,
+    .first_reader = writer_first_in_sync_reader,
+    .next_reader = writer_next_in_sync_reader,
+    .on_failure_fastpath = local_on_delivery_failure_fastpath
+  };
+  struct local_sourceinfo *sourceinfo = ddsrt_malloc (cs->n * sizeof (*sourceinfo));
+  struct ddsi_writer_info *wrinfo = ddsrt_malloc (cs->n * sizeof (*wrinfo));
+  void **vsourceinfo = ddsrt_malloc (cs->n * sizeof (*vsourceinfo));
+  dds_return_t rc;
+  for (uint32_t i = 0; i < cs->n; i++)
+  {
+    sourceinfo[i] = (struct local_sourceinfo) {
+      .src_topic = wr->topic,
+      .src_payload = cs->samples[i],
+      .src_tk = cs->tks[i],
+      .timeout = { 0 }
+    };
+    vsourceinfo[i] = &sourceinfo[i];
+    ddsi_make_writer_info (&wrinfo[i], &wr->e, wr->xqos, cs->samples[i]->statusinfo);
+  }
+  rc = deliver_locally_allinsync_batch (wr->e.gv, &wr->e, false, &wr->rdary, cs->n, wrinfo, &deliver_locally_ops, vsourceinfo);
+  ddsrt_free (vsourceinfo);
+  ddsrt_free (wrinfo);
+  ddsrt_free (sourceinfo);
+  return rc;
+}
+
+static dds_return_t deliver_locally_durable (struct writer *wr, struct dds_durability_writer *dwr, struct dds_writer_coherent_set *cs, struct ddsi_serdata *payload, struct ddsi_tkmap_instance *tk)
+{
+  /* A new reader catching up from the durability service must see the
+     sample either in the store or delivered, never both */
+  dds_return_t rc;
+  if (cs != NULL)
+  {
+    /* stored and delivered when the coherent set ends */
+    coherent_set_add (cs, payload, tk);
+    return DDS_RETCODE_OK;
+  }
+  if (dwr == NULL)
+    return deliver_locally (wr, payload, tk);
+  dds_durability_writer_lock (dwr);
+  dds_durability_writer_store (dwr, payload, tk);
+  dds_durability_writer_unlock_delivering (dwr);
+  rc = deliver_locally (wr, payload, tk);
+  dds_durability_writer_delivered (dwr);
+  return rc;
+}
+
+static bool writer_may_send_shm_references (struct writer *wr)
+{
+  /* A reference to a sample in shared memory is only useful to readers on the
+     same host, and it must be resolved while the writer still references the
+     sample.  For reliable readers that is guaranteed because the writer holds
+     on to the sample until they have acknowledged it.  (Transient-local data
+     is excluded because it may be sent to future readers on other hosts.) */
+  if (wr->xqos->reliability.kind != DDS_RELIABILITY_RELIABLE || wr->xqos->durability.kind != DDS_DURABILITY_VOLATILE)
+    return false;
+  if (!ddsi_sertopic_default_supports_shm_loans (wr->topic))
+    return false;
+  ddsrt_mutex_lock (&wr->e.lock);
+  const bool only_shm = addrset_contains_only_kind (wr->as, NN_LOCATOR_KIND_SHM);
+  ddsrt_mutex_unlock (&wr->e.lock);
+  return only_shm;
+}
+
+static struct ddsi_serdata *serdata_from_loaned_sample (struct writer *wr, const void *data)
+{
+  /* Writing a loaned sample consumes the loan */
+  void *payload = (void *) data;
+  struct ddsi_serdata *d;
+  if (writer_may_send_shm_references (wr))
+    return ddsi_serdata_default_from_shm_chunk (wr->topic, payload);
+  d = ddsi_serdata_from_sample (wr->topic, SDK_DATA, data);
+  ddsi_shm_chunk_unref (payload);
+  return d;
+}
+
 dds_return_t dds_write_impl (dds_writer *wr, const void * data, dds_time_t tstamp, dds_write_action action)
 {
   struct thread_state1 * const ts1 = lookup_thread_state ();
@@ -168,15 +292,24 @@ dds_return_t dds_write_impl (dds_writer *wr, const void * data, dds_time_t tstam
   if (data == NULL)
     return DDS_RETCODE_BAD_PARAMETER;
 
+  const bool loaned = !writekey && ddsi_shm_chunk_is_local (&wr->m_entity.m_domain->gv, data);
+
   /* Check for topic filter */
   if (wr->m_topic->filter_fn && !writekey)
     if (! wr->m_topic->filter_fn (data, wr->m_topic->filter_ctx))
+    {
+      if (loaned)
+        ddsi_shm_chunk_unref ((void *) data);
       return DDS_RETCODE_OK;
+    }
 
   thread_state_awake (ts1, &wr->m_entity.m_domain->gv);
 
   /* Serialize and write data or key */
-  d = ddsi_serdata_from_sample (ddsi_wr->topic, writekey ? SDK_KEY : SDK_DATA, data);
+  if (loaned)
+    d = serdata_from_loaned_sample (ddsi_wr, data);
+  else
+    d = ddsi_serdata_from_sample (ddsi_wr->topic, writekey ? SDK_KEY : SDK_DATA, data);
   d->statusinfo = (((action & DDS_WR_DISPOSE_BIT) ? NN_STATUSINFO_DISPOSE : 0) |
                    ((action & DDS_WR_UNREGISTER_BIT) ? NN_STATUSINFO_UNREGISTER : 0));
   d->timestamp.v = tstamp;
@@ -185,9 +318,9 @@ dds_return_t dds_write_impl (dds_writer *wr, const void * data, dds_time_t tstam
   w_rc = write_sample_gc (ts1, wr->m_xp, ddsi_wr, d, tk);
 
   if (w_rc >= 0) {
-    /* Flush out write unless configured to batch */
-    if (!wr->whc_batch)
-      nn_xpack_send (wr->m_xp, false);
+    /* Flush out write unless configured to batch or in a coherent set */
+    if (!wr->whc_batch && wr->m_coherent == NULL)
+      dds_write_flush_after_write (wr);
     ret = DDS_RETCODE_OK;
   } else if (w_rc == DDS_RETCODE_TIMEOUT) {
     ret = DDS_RETCODE_TIMEOUT;
@@ -197,14 +330,14 @@ dds_return_t dds_write_impl (dds_writer *wr, const void * data, dds_time_t tstam
     ret = DDS_RETCODE_ERROR;
   }
   if (ret == DDS_RETCODE_OK)
-    ret = deliver_locally (ddsi_wr, d, tk);
+    ret = deliver_locally_durable (ddsi_wr, wr->m_durability, wr->m_coherent, d, tk);
   ddsi_serdata_unref (d);
   ddsi_tkmap_instance_unref (wr->m_entity.m_domain->gv.m_tkmap, tk);
   thread_state_asleep (ts1);
   return ret;
 }
 
-dds_return_t dds_writecdr_impl_lowlevel (struct writer *ddsi_wr, struct nn_xpack *xp, struct ddsi_serdata *d, bool flush)
+static dds_return_t dds_writecdr_impl_common (struct writer *ddsi_wr, struct dds_durability_writer *dwr, struct dds_writer_coherent_set *cs, struct nn_xpack *xp, struct ddsi_serdata *d, bool flush)
 {
   struct thread_state1 * const ts1 = lookup_thread_state ();
   struct ddsi_tkmap_instance * tk;
@@ -229,13 +362,18 @@ dds_return_t dds_writecdr_impl_lowlevel (struct writer *ddsi_wr, struct nn_xpack
   }
 
   if (ret == DDS_RETCODE_OK)
-    ret = deliver_locally (ddsi_wr, d, tk);
+    ret = deliver_locally_durable (ddsi_wr, dwr, cs, d, tk);
   ddsi_serdata_unref (d);
   ddsi_tkmap_instance_unref (ddsi_wr->e.gv->m_tkmap, tk);
   thread_state_asleep (ts1);
   return ret;
 }
 
+dds_return_t dds_writecdr_impl_lowlevel (struct writer *ddsi_wr, struct nn_xpack *xp, struct ddsi_serdata *d, bool flush)
+{
+  return dds_writecdr_impl_common (ddsi_wr, NULL, NULL, xp, d, flush);
+}
+
 dds_return_t dds_writecdr_impl (dds_writer *wr, struct ddsi_serdata *d, dds_time_t tstamp, dds_write_action action)
 {
   if (wr->m_topic->filter_fn)
@@ -244,7 +382,178 @@ dds_return_t dds_writecdr_impl (dds_writer *wr, struct ddsi_serdata *d, dds_time
   d->statusinfo = (((action & DDS_WR_DISPOSE_BIT) ? NN_STATUSINFO_DISPOSE : 0) |
                    ((action & DDS_WR_UNREGISTER_BIT) ? NN_STATUSINFO_UNREGISTER : 0));
   d->timestamp.v = tstamp;
-  return dds_writecdr_impl_lowlevel (wr->m_wr, wr->m_xp, d, !wr->whc_batch);
+  if (wr->m_flush_xev == NULL)
+    return dds_writecdr_impl_common (wr->m_wr, wr->m_durability, wr->m_coherent, wr->m_xp, d, !wr->whc_batch && wr->m_coherent == NULL);
+  else
+  {
+    dds_return_t ret = dds_writecdr_impl_common (wr->m_wr, wr->m_durability, wr->m_coherent, wr->m_xp, d, false);
+    if (!wr->whc_batch && wr->m_coherent == NULL)
+    {
+      thread_state_awake (lookup_thread_state (), &wr->m_entity.m_domain->gv);
+      dds_write_flush_after_write (wr);
+      thread_state_asleep (lookup_thread_state ());
+    }
+    return ret;
+  }
+}
+
+#define DDS_WRITE_BATCH_CHUNK 64
+
+static dds_return_t dds_write_batch_chunk (struct thread_state1 * const ts1, dds_writer *wr, uint32_t n, struct ddsi_serdata **ds)
+{
+  /* consumes the references to ds[0 .. n-1] */
+  struct writer *ddsi_wr = wr->m_wr;
+  struct ddsi_tkmap * const tkmap = wr->m_entity.m_domain->gv.m_tkmap;
+  struct ddsi_tkmap_instance *tk[DDS_WRITE_BATCH_CHUNK];
+  dds_return_t ret = DDS_RETCODE_OK;
+  uint32_t nwritten;
+  int w_rc;
+
+  assert (n <= DDS_WRITE_BATCH_CHUNK);
+  for (uint32_t i = 0; i < n; i++)
+  {
+    ddsi_serdata_ref (ds[i]);
+    tk[i] = ddsi_tkmap_lookup_instance_ref (tkmap, ds[i]);
+  }
+  w_rc = write_sample_gc_batch (ts1, wr->m_xp, ddsi_wr, n, ds, tk, &nwritten);
+  if (w_rc == DDS_RETCODE_TIMEOUT)
+    ret = DDS_RETCODE_TIMEOUT;
+  else if (w_rc < 0)
+    ret = DDS_RETCODE_ERROR;
+  for (uint32_t i = 0; i < nwritten; i++)
+  {
+    dds_return_t rc;
+    if ((rc = deliver_locally_durable (ddsi_wr, wr->m_durability, wr->m_coherent, ds[i], tk[i])) != DDS_RETCODE_OK && ret == DDS_RETCODE_OK)
+      ret = rc;
+  }
+  for (uint32_t i = 0; i < n; i++)
+  {
+    ddsi_serdata_unref (ds[i]);
+    ddsi_tkmap_instance_unref (tkmap, tk[i]);
+  }
+  return ret;
+}
+
+dds_return_t dds_write_batch (dds_entity_t writer, const void * const *data, uint32_t n, const dds_time_t *timestamps)
+{
+  struct thread_state1 * const ts1 = lookup_thread_state ();
+  struct ddsi_serdata *ds[DDS_WRITE_BATCH_CHUNK];
+  dds_return_t ret;
+  dds_writer *wr;
+
+  if (n > 0 && data == NULL)
+    return DDS_RETCODE_BAD_PARAMETER;
+  for (uint32_t i = 0; i < n; i++)
+    if (data[i] == NULL || (timestamps && timestamps[i] < 0))
+      return DDS_RETCODE_BAD_PARAMETER;
+
+  if ((ret = dds_writer_lock (writer, &wr)) != DDS_RETCODE_OK)
+    return ret;
+  struct ddsi_domaingv * const gv = &wr->m_entity.m_domain->gv;
+  const dds_time_t tnow = (timestamps == NULL) ? dds_time () : 0;
+  thread_state_awake (ts1, gv);
+  uint32_t i = 0;
+  while (i < n && ret == DDS_RETCODE_OK)
+  {
+    uint32_t m = 0;
+    for (; i < n && m < DDS_WRITE_BATCH_CHUNK; i++)
+    {
+      const bool loaned = ddsi_shm_chunk_is_local (gv, data[i]);
+      if (wr->m_topic->filter_fn && !wr->m_topic->filter_fn (data[i], wr->m_topic->filter_ctx))
+      {
+        if (loaned)
+          ddsi_shm_chunk_unref ((void *) data[i]);
+        continue;
+      }
+      struct ddsi_serdata *d;
+      if (loaned)
+        d = serdata_from_loaned_sample (wr->m_wr, data[i]);
+      else
+        d = ddsi_serdata_from_sample (wr->m_wr->topic, SDK_DATA, data[i]);
+      d->statusinfo = 0;
+      d->timestamp.v = (timestamps == NULL) ? tnow : timestamps[i];
+      ds[m++] = d;
+    }
+    if (m > 0)
+      ret = dds_write_batch_chunk (ts1, wr, m, ds);
+  }
+  /* Writing a loaned sample consumes the loan, also if it didn't get written */
+  for (; i < n; i++)
+    if (ddsi_shm_chunk_is_local (gv, data[i]))
+      ddsi_shm_chunk_unref ((void *) data[i]);
+  /* Flush out writes unless configured to batch or in a coherent set, also
+     when only a part of the samples got written */
+  if (!wr->whc_batch && wr->m_coherent == NULL)
+    dds_write_flush_after_write (wr);
+  thread_state_asleep (ts1);
+  dds_writer_unlock (wr);
+  return ret;
+}
+
+dds_return_t dds_writecdr_batch (dds_entity_t writer, struct ddsi_serdata **serdata, uint32_t n)
+{
+  struct thread_state1 * const ts1 = lookup_thread_state ();
+  dds_return_t ret;
+  dds_writer *wr;
+
+  if (n > 0 && serdata == NULL)
+    return DDS_RETCODE_BAD_PARAMETER;
+  for (uint32_t i = 0; i < n; i++)
+    if (serdata[i] == NULL)
+      return DDS_RETCODE_BAD_PARAMETER;
+
+  if ((ret = dds_writer_lock (writer, &wr)) != DDS_RETCODE_OK)
+    return ret;
+  if (wr->m_topic->filter_fn)
+    abort ();
+  const dds_time_t tnow = dds_time ();
+  for (uint32_t i = 0; i < n; i++)
+  {
+    serdata[i]->statusinfo = 0;
+    serdata[i]->timestamp.v = tnow;
+  }
+  thread_state_awake (ts1, &wr->m_entity.m_domain->gv);
+  uint32_t i;
+  for (i = 0; i < n && ret == DDS_RETCODE_OK; i += DDS_WRITE_BATCH_CHUNK)
+  {
+    const uint32_t m = (n - i < DDS_WRITE_BATCH_CHUNK) ? n - i : DDS_WRITE_BATCH_CHUNK;
+    ret = dds_write_batch_chunk (ts1, wr, m, serdata + i);
+  }
+  /* like dds_writecdr, the references are consumed even if not all samples
+     were written */
+  for (; i < n; i++)
+    ddsi_serdata_unref (serdata[i]);
+  if (!wr->whc_batch && wr->m_coherent == NULL)
+    dds_write_flush_after_write (wr);
+  thread_state_asleep (ts1);
+  dds_writer_unlock (wr);
+  return ret;
+}
+
+void dds_write_flush_after_write (dds_writer *wr)
+{
+  if (wr->m_flush_xev == NULL)
+    nn_xpack_send (wr->m_xp, false);
+  else
+  {
+    /* the xpack gets sent earlier if it fills up or if a heartbeat requesting
+       an ack is added to it, the timer then at worst sends the next one early;
+       the timer may also be late because it doesn't wait for the writer lock,
+       then the first write after the deadline sends it */
+    const ddsrt_mtime_t tnow = ddsrt_time_monotonic ();
+    const unsigned packetid = nn_xpack_packetid (wr->m_xp);
+    if (packetid != wr->m_flush_packetid || wr->m_flush_deadline.v == DDS_NEVER)
+    {
+      wr->m_flush_packetid = packetid;
+      wr->m_flush_deadline = ddsrt_mtime_add_duration (tnow, wr->m_flush_delay);
+      (void) resched_xevent_if_earlier (wr->m_flush_xev, wr->m_flush_deadline);
+    }
+    else if (tnow.v >= wr->m_flush_deadline.v)
+    {
+      nn_xpack_send (wr->m_xp, false);
+      wr->m_flush_deadline = DDSRT_MTIME_NEVER;
+    }
+  }
 }
 
 void dds_write_flush (dds_entity_t writer)
@@ -259,3 +568,65 @@ void dds_write_flush (dds_entity_t writer)
     dds_writer_unlock (wr);
   }
 }
+
+void dds_write_begin_coherent (dds_writer *wr)
+{
+  if (wr->m_coherent != NULL)
+    return;
+  wr->m_coherent = ddsrt_malloc (sizeof (*wr->m_coherent));
+  wr->m_coherent->n = wr->m_coherent->size = 0;
+  wr->m_coherent->samples = NULL;
+  wr->m_coherent->tks = NULL;
+  thread_state_awake (lookup_thread_state (), &wr->m_entity.m_domain->gv);
+  writer_begin_coherent_set (wr->m_wr);
+  thread_state_asleep (lookup_thread_state ());
+}
+
+dds_return_t dds_write_end_coherent (dds_writer *wr, bool deleting)
+{
+  struct thread_state1 * const ts1 = lookup_thread_state ();
+  struct dds_writer_coherent_set * const cs = wr->m_coherent;
+  struct ddsi_tkmap * const tkmap = wr->m_entity.m_domain->gv.m_tkmap;
+  dds_return_t ret = DDS_RETCODE_OK;
+  int w_rc;
+
+  if (cs == NULL)
+    return DDS_RETCODE_OK;
+  wr->m_coherent = NULL;
+  thread_state_awake (ts1, &wr->m_entity.m_domain->gv);
+  if ((w_rc = write_end_coherent_set (ts1, wr->m_xp, wr->m_wr)) == DDS_RETCODE_UNSUPPORTED || w_rc == DDS_RETCODE_TIMEOUT)
+    ret = w_rc;
+  else if (w_rc < 0)
+    ret = DDS_RETCODE_ERROR;
+  if (!wr->whc_batch)
+    nn_xpack_send (wr->m_xp, false);
+  /* the set is incomplete for remote readers if its end wasn't written, so don't
+     make it available to local readers either; but deleting the writer ends the
+     set, and the end can't be written once the deletion has started */
+  if (cs->n > 0 && (ret == DDS_RETCODE_OK || deleting))
+  {
+    dds_return_t rc;
+    if (wr->m_durability)
+    {
+      dds_durability_writer_lock (wr->m_durability);
+      for (uint32_t i = 0; i < cs->n; i++)
+        dds_durability_writer_store (wr->m_durability, cs->samples[i], cs->tks[i]);
+      dds_durability_writer_unlock_delivering (wr->m_durability);
+    }
+    rc = deliver_locally_coherent_set (wr->m_wr, cs);
+    if (wr->m_durability)
+      dds_durability_writer_delivered (wr->m_durability);
+    if (rc != DDS_RETCODE_OK && ret == DDS_RETCODE_OK)
+      ret = rc;
+  }
+  for (uint32_t i = 0; i < cs->n; i++)
+  {
+    ddsi_serdata_unref (cs->samples[i]);
+    ddsi_tkmap_instance_unref (tkmap, cs->tks[i]);
+  }
+  thread_state_asleep (ts1);
+  ddsrt_free (cs->samples);
+  ddsrt_free (cs->tks);
+  ddsrt_free (cs);
+  return ret;
+}
@@ -14,11 +14,13 @@
 #include "dds/dds.h"
 #include "dds/version.h"
 #include "dds/ddsrt/static_assert.h"
+#include "dds/ddsrt/strtol.h"
 #include "dds/ddsi/q_config.h"
 #include "dds/ddsi/ddsi_domaingv.h"
 #include "dds/ddsi/q_entity.h"
 #include "dds/ddsi/q_thread.h"
 #include "dds/ddsi/q_xmsg.h"
+#include "dds/ddsi/q_xevent.h"
 #include "dds/ddsi/ddsi_entity_index.h"
 #include "dds/ddsi/ddsi_security_omg.h"
 #include "dds__writer.h"
@@ -30,8 +32,11 @@
 #include "dds__qos.h"
 #include "dds/ddsi/ddsi_tkmap.h"
 #include "dds__whc.h"
+#include "dds__durability.h"
+#include "dds__write.h"
 #include "dds__statistics.h"
 #include "dds/ddsi/ddsi_statistics.h"
+#include "dds/ddsi/ddsi_serdata_default.h"
 
 DECL_ENTITY_LOCK_UNLOCK (extern inline, dds_writer)
 
@@ -186,6 +191,39 @@ static void dds_writer_interrupt (dds_entity *e)
   thread_state_asleep (lookup_thread_state ());
 }
 
+static void dds_writer_flush_cb (struct xevent *xev, void *varg, ddsrt_mtime_t tnow)
+{
+  struct dds_writer * const wr = varg;
+  /* the writer lock may be held for a long time by a writer blocked on a full WHC
+     while waiting for acknowledgements, which requires this thread to send heartbeats,
+     and so it mustn't block here */
+  if (!ddsrt_mutex_trylock (&wr->m_entity.m_mutex))
+    (void) resched_xevent_if_earlier (xev, ddsrt_mtime_add_duration (tnow, DDS_MSECS (1)));
+  else
+  {
+    nn_xpack_send (wr->m_xp, true);
+    wr->m_flush_deadline = DDSRT_MTIME_NEVER;
+    ddsrt_mutex_unlock (&wr->m_entity.m_mutex);
+  }
+}
+
+static dds_duration_t get_write_batch_max_delay (const struct ddsi_domaingv *gv, const dds_qos_t *wqos)
+{
+  /* Internal/WriteBatchMaxDelay can be overridden per writer through a property,
+     in microseconds, with 0 disabling adaptive write batching for the writer */
+  const char *value;
+  char *endp;
+  long long us;
+  if (!ddsi_xqos_find_prop (wqos, "cyclonedds.write_batch.max_delay_us", &value))
+    return gv->config.write_batch_max_delay;
+  if (ddsrt_strtoll (value, &endp, 10, &us) != DDS_RETCODE_OK || *endp != 0 || us < 0 || us > 1000000)
+  {
+    DDS_CWARNING (&gv->logconfig, "invalid value \"%s\" for cyclonedds.write_batch.max_delay_us, using Internal/WriteBatchMaxDelay\n", value);
+    return gv->config.write_batch_max_delay;
+  }
+  return DDS_USECS (us);
+}
+
 static void dds_writer_close (dds_entity *e) ddsrt_nonnull_all;
 
 static void dds_writer_close (dds_entity *e)
@@ -193,6 +231,15 @@ static void dds_writer_close (dds_entity *e)
   struct dds_writer * const wr = (struct dds_writer *) e;
   struct ddsi_domaingv * const gv = &e->m_domain->gv;
   struct thread_state1 * const ts1 = lookup_thread_state ();
+  /* deleting a writer ends the coherent set it is in, if any */
+  ddsrt_mutex_lock (&e->m_mutex);
+  (void) dds_write_end_coherent (wr, true);
+  ddsrt_mutex_unlock (&e->m_mutex);
+  if (wr->m_flush_xev)
+  {
+    delete_xevent_callback (wr->m_flush_xev);
+    wr->m_flush_xev = NULL;
+  }
   thread_state_awake (ts1, gv);
   nn_xpack_send (wr->m_xp, false);
   (void) delete_writer (gv, &e->m_guid);
@@ -213,6 +260,8 @@ static dds_return_t dds_writer_delete (dds_entity *e)
   thread_state_awake (lookup_thread_state (), &e->m_domain->gv);
   nn_xpack_free (wr->m_xp);
   thread_state_asleep (lookup_thread_state ());
+  if (wr->m_durability)
+    dds_durability_writer_free (wr->m_durability);
   dds_entity_drop_ref (&wr->m_topic->m_entity);
   return DDS_RETCODE_OK;
 }
@@ -254,7 +303,16 @@ static const struct dds_stat_keyvalue_descriptor dds_writer_statistics_kv[] = {
   { "rexmit_bytes", DDS_STAT_KIND_UINT64 },
   { "throttle_count", DDS_STAT_KIND_UINT32 },
   { "time_throttle", DDS_STAT_KIND_UINT64 },
-  { "time_rexmit", DDS_STAT_KIND_UINT64 }
+  { "time_rexmit", DDS_STAT_KIND_UINT64 },
+  { "cc_rate", DDS_STAT_KIND_UINT64 },
+  { "cc_rtt", DDS_STAT_KIND_UINT64 },
+  { "cc_loss", DDS_STAT_KIND_UINT32 },
+  { "serdata_allocs", DDS_STAT_KIND_UINT64 },
+  { "serdata_pool_hits", DDS_STAT_KIND_UINT64 },
+  { "serdata_reallocs", DDS_STAT_KIND_UINT64 },
+  { "heartbeats_sent", DDS_STAT_KIND_UINT32 },
+  { "acknacks_received", DDS_STAT_KIND_UINT32 },
+  { "filtered_count", DDS_STAT_KIND_UINT64 }
 };
 
 static const struct dds_stat_descriptor dds_writer_statistics_desc = {
@@ -271,7 +329,9 @@ static void dds_writer_refresh_statistics (const struct dds_entity *entity, stru
 {
   const struct dds_writer *wr = (const struct dds_writer *) entity;
   if (wr->m_wr)
-    ddsi_get_writer_stats (wr->m_wr, &stat->kv[0].u.u64, &stat->kv[1].u.u32, &stat->kv[2].u.u64, &stat->kv[3].u.u64);
+    ddsi_get_writer_stats (wr->m_wr, &stat->kv[0].u.u64, &stat->kv[1].u.u32, &stat->kv[2].u.u64, &stat->kv[3].u.u64, &stat->kv[4].u.u64, &stat->kv[5].u.u64, &stat->kv[6].u.u32, &stat->kv[10].u.u32, &stat->kv[11].u.u32, &stat->kv[12].u.u64);
+  /* these are for the topic (in this domain), not just for this writer */
+  ddsi_sertopic_default_get_serdata_stats (wr->m_topic->m_stopic, &stat->kv[7].u.u64, &stat->kv[8].u.u64, &stat->kv[9].u.u64);
 }
 
 const struct dds_entity_deriver dds_entity_deriver_writer = {
@@ -372,7 +432,7 @@ dds_entity_t dds_create_writer (dds_entity_t participant_or_publisher, dds_entit
 #endif
 
   /* Create writer */
-  ddsi_tran_conn_t conn = gv->xmit_conn;
+  ddsi_tran_conn_t conn = nn_xmit_conn_for_priority (gv, wqos->transport_priority.value);
   struct dds_writer * const wr = dds_alloc (sizeof (*wr));
   const dds_entity_t writer = dds_entity_init (&wr->m_entity, &pub->m_entity, DDS_KIND_WRITER, false, wqos, listener, DDS_WRITER_STATUS_MASK);
   wr->m_topic = tp;
@@ -382,10 +442,29 @@ dds_entity_t dds_create_writer (dds_entity_t participant_or_publisher, dds_entit
   wr->m_whc = whc_new (gv, wrinfo);
   whc_free_wrinfo (wrinfo);
   wr->whc_batch = gv->config.whc_batch;
+  /* flushing after a write may be deferred for the latency budget, but only when
+     scheduling for priority is enabled, and for adaptive write batching, whichever
+     is shorter (the latency budget can't be changed once the writer exists) */
+  wr->m_flush_delay = DDS_INFINITY;
+  if (gv->config.priority_scheduling_enable && wqos->latency_budget.duration > 0)
+    wr->m_flush_delay = wqos->latency_budget.duration;
+  const dds_duration_t write_batch_max_delay = get_write_batch_max_delay (gv, wqos);
+  if (write_batch_max_delay > 0 && write_batch_max_delay < wr->m_flush_delay)
+    wr->m_flush_delay = write_batch_max_delay;
+  wr->m_flush_deadline = DDSRT_MTIME_NEVER;
+  wr->m_flush_packetid = nn_xpack_packetid (wr->m_xp);
+  if (wr->m_flush_delay == DDS_INFINITY)
+    wr->m_flush_xev = NULL;
+  else
+    wr->m_flush_xev = qxev_callback (gv->xevents, DDSRT_MTIME_NEVER, dds_writer_flush_cb, wr);
 
   rc = new_writer (&wr->m_wr, &wr->m_entity.m_guid, NULL, pp, tp->m_stopic, wqos, wr->m_whc, dds_writer_status_cb, wr);
   assert(rc == DDS_RETCODE_OK);
+  wr->m_durability = dds_durability_writer_new (wr->m_entity.m_domain, tp, wr->m_wr);
   thread_state_asleep (lookup_thread_state ());
+  wr->m_coherent = NULL;
+  if (pub->m_coherent_depth > 0)
+    dds_write_begin_coherent (wr);
 
   wr->m_entity.m_iid = get_entity_instance_id (&wr->m_entity.m_domain->gv, &wr->m_entity.m_guid);
   dds_entity_register_child (&pub->m_entity, &wr->m_entity);
@@ -0,0 +1,342 @@
+/*
+ * Copyright(c) 2020 ADLINK Technology Limited and others
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License v. 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0, or the Eclipse Distribution License
+ * v. 1.0 which is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "dds/dds.h"
+#include "dds/ddsrt/atomics.h"
+#include "dds/ddsrt/environ.h"
+#include "dds/ddsrt/heap.h"
+#include "dds/ddsrt/io.h"
+#include "dds/ddsrt/threads.h"
+
+#include "test_common.h"
+
+#define DDS_DOMAINID_PUB 0
+#define DDS_DOMAINID_SUB 1
+#define DDS_CONFIG_EXTERNAL_DOMAINID "${CYCLONEDDS_URI}${CYCLONEDDS_URI:+,}<Discovery><ExternalDomainId>0</ExternalDomainId></Discovery>%s"
+
+static dds_entity_t g_participant, g_topic, g_publisher, g_writer, g_reader;
+static ddsrt_atomic_uint32_t g_data_available;
+
+static void data_available_cb (dds_entity_t rd, void *arg)
+{
+  (void) rd;
+  (void) arg;
+  ddsrt_atomic_inc32 (&g_data_available);
+}
+
+static dds_qos_t *create_qos (dds_presentation_access_scope_kind_t scope)
+{
+  dds_qos_t *qos = dds_create_qos ();
+  dds_qset_reliability (qos, DDS_RELIABILITY_RELIABLE, DDS_INFINITY);
+  dds_qset_history (qos, DDS_HISTORY_KEEP_ALL, 0);
+  dds_qset_presentation (qos, scope, true, false);
+  return qos;
+}
+
+static void coherent_init (void)
+{
+  char topic_name[100];
+  create_unique_topic_name ("ddsc_coherent", topic_name, sizeof (topic_name));
+  dds_qos_t *qos = create_qos (DDS_PRESENTATION_TOPIC);
+  g_participant = dds_create_participant (DDS_DOMAIN_DEFAULT, NULL, NULL);
+  CU_ASSERT_FATAL (g_participant > 0);
+  g_topic = dds_create_topic (g_participant, &Space_Type1_desc, topic_name, qos, NULL);
+  CU_ASSERT_FATAL (g_topic > 0);
+  g_publisher = dds_create_publisher (g_participant, qos, NULL);
+  CU_ASSERT_FATAL (g_publisher > 0);
+  g_writer = dds_create_writer (g_publisher, g_topic, qos, NULL);
+  CU_ASSERT_FATAL (g_writer > 0);
+  dds_listener_t *list = dds_create_listener (NULL);
+  dds_lset_data_available (list, data_available_cb);
+  ddsrt_atomic_st32 (&g_data_available, 0);
+  g_reader = dds_create_reader (g_participant, g_topic, qos, list);
+  CU_ASSERT_FATAL (g_reader > 0);
+  dds_delete_listener (list);
+  dds_delete_qos (qos);
+}
+
+static void coherent_fini (void)
+{
+  dds_delete (g_participant);
+}
+
+static void write_samples (dds_entity_t wr, int32_t first, int32_t n)
+{
+  for (int32_t i = first; i < first + n; i++)
+  {
+    Space_Type1 sample = { i, i, 0 };
+    CU_ASSERT_FATAL (dds_write (wr, &sample) == DDS_RETCODE_OK);
+  }
+}
+
+static int32_t take_all (dds_entity_t rd)
+{
+  void *raw[32] = { NULL };
+  dds_sample_info_t si[32];
+  int32_t n = dds_take (rd, raw, si, 32, 32);
+  CU_ASSERT_FATAL (n >= 0);
+  if (n > 0)
+    (void) dds_return_loan (rd, raw, n);
+  return n;
+}
+
+CU_Test(ddsc_coherent, api, .init = coherent_init, .fini = coherent_fini)
+{
+  dds_qos_t *qos;
+  dds_entity_t pub;
+
+  /* readers, writers, publishers and subscribers only */
+  CU_ASSERT (dds_begin_coherent (g_topic) == DDS_RETCODE_ILLEGAL_OPERATION);
+  CU_ASSERT (dds_end_coherent (g_participant) == DDS_RETCODE_ILLEGAL_OPERATION);
+  CU_ASSERT (dds_begin_coherent (0) == DDS_RETCODE_BAD_PARAMETER);
+
+  /* subscriber side is a no-op */
+  CU_ASSERT (dds_begin_coherent (g_reader) == DDS_RETCODE_OK);
+  CU_ASSERT (dds_end_coherent (g_reader) == DDS_RETCODE_OK);
+
+  /* ending a set requires one to have been started */
+  CU_ASSERT (dds_end_coherent (g_writer) == DDS_RETCODE_PRECONDITION_NOT_MET);
+  CU_ASSERT (dds_begin_coherent (g_writer) == DDS_RETCODE_OK);
+  CU_ASSERT (dds_end_coherent (g_publisher) == DDS_RETCODE_OK);
+  CU_ASSERT (dds_end_coherent (g_publisher) == DDS_RETCODE_PRECONDITION_NOT_MET);
+
+  /* coherent access must be enabled in the publisher and GROUP scope isn't supported */
+  pub = dds_create_publisher (g_participant, NULL, NULL);
+  CU_ASSERT_FATAL (pub > 0);
+  CU_ASSERT (dds_begin_coherent (pub) == DDS_RETCODE_PRECONDITION_NOT_MET);
+  qos = create_qos (DDS_PRESENTATION_GROUP);
+  pub = dds_create_publisher (g_participant, qos, NULL);
+  CU_ASSERT_FATAL (pub > 0);
+  CU_ASSERT (dds_begin_coherent (pub) == DDS_RETCODE_UNSUPPORTED);
+  dds_delete_qos (qos);
+}
+
+CU_Test(ddsc_coherent, local, .init = coherent_init, .fini = coherent_fini)
+{
+  CU_ASSERT_FATAL (dds_begin_coherent (g_writer) == DDS_RETCODE_OK);
+  write_samples (g_writer, 0, 5);
+  /* a writer created in the set takes part in it */
+  dds_entity_t wr2 = dds_create_writer (g_publisher, g_topic, NULL, NULL);
+  CU_ASSERT_FATAL (wr2 > 0);
+  write_samples (wr2, 5, 5);
+  CU_ASSERT (take_all (g_reader) == 0);
+  CU_ASSERT (ddsrt_atomic_ld32 (&g_data_available) == 0);
+  CU_ASSERT_FATAL (dds_end_coherent (g_writer) == DDS_RETCODE_OK);
+  /* one notification for each writer's set */
+  CU_ASSERT (ddsrt_atomic_ld32 (&g_data_available) == 2);
+  CU_ASSERT (take_all (g_reader) == 10);
+
+  /* outside a set samples are delivered immediately */
+  write_samples (g_writer, 0, 1);
+  CU_ASSERT (take_all (g_reader) == 1);
+}
+
+CU_Test(ddsc_coherent, nested, .init = coherent_init, .fini = coherent_fini)
+{
+  CU_ASSERT_FATAL (dds_begin_coherent (g_publisher) == DDS_RETCODE_OK);
+  write_samples (g_writer, 0, 2);
+  CU_ASSERT_FATAL (dds_begin_coherent (g_writer) == DDS_RETCODE_OK);
+  write_samples (g_writer, 2, 2);
+  CU_ASSERT_FATAL (dds_end_coherent (g_writer) == DDS_RETCODE_OK);
+  CU_ASSERT (take_all (g_reader) == 0);
+  CU_ASSERT_FATAL (dds_end_coherent (g_publisher) == DDS_RETCODE_OK);
+  CU_ASSERT (ddsrt_atomic_ld32 (&g_data_available) == 1);
+  CU_ASSERT (take_all (g_reader) == 4);
+}
+
+CU_Test(ddsc_coherent, delete_writer_in_set, .init = coherent_init, .fini = coherent_fini)
+{
+  /* deleting the writer ends its set */
+  CU_ASSERT_FATAL (dds_begin_coherent (g_writer) == DDS_RETCODE_OK);
+  write_samples (g_writer, 0, 3);
+  CU_ASSERT (take_all (g_reader) == 0);
+  CU_ASSERT_FATAL (dds_delete (g_writer) == DDS_RETCODE_OK);
+  CU_ASSERT (take_all (g_reader) == 3);
+  CU_ASSERT (dds_end_coherent (g_publisher) == DDS_RETCODE_OK);
+}
+
+struct slow_taker_arg {
+  dds_entity_t rd;
+  ddsrt_atomic_uint32_t ntaken;
+};
+
+static uint32_t slow_taker (void *varg)
+{
+  struct slow_taker_arg * const arg = varg;
+  const dds_time_t tend = dds_time () + DDS_SECS (5);
+  while (ddsrt_atomic_ld32 (&arg->ntaken) < 5 && dds_time () < tend)
+  {
+    dds_sleepfor (DDS_MSECS (50));
+    ddsrt_atomic_add32 (&arg->ntaken, (uint32_t) take_all (arg->rd));
+  }
+  return 0;
+}
+
+CU_Test(ddsc_coherent, local_reader_full, .init = coherent_init, .fini = coherent_fini)
+{
+  /* a reliable reader that has no room for the whole set gets the rest of it once it
+     makes room, and if it doesn't do so in time, ending the set times out */
+  dds_qos_t *qos = create_qos (DDS_PRESENTATION_TOPIC);
+  dds_qset_resource_limits (qos, 3, DDS_LENGTH_UNLIMITED, DDS_LENGTH_UNLIMITED);
+  dds_entity_t rd = dds_create_reader (g_participant, g_topic, qos, NULL);
+  CU_ASSERT_FATAL (rd > 0);
+  dds_qset_reliability (qos, DDS_RELIABILITY_RELIABLE, DDS_MSECS (200));
+  dds_entity_t wr = dds_create_writer (g_publisher, g_topic, qos, NULL);
+  CU_ASSERT_FATAL (wr > 0);
+  dds_delete_qos (qos);
+
+  CU_ASSERT_FATAL (dds_begin_coherent (wr) == DDS_RETCODE_OK);
+  write_samples (wr, 0, 5);
+  CU_ASSERT (dds_end_coherent (wr) == DDS_RETCODE_TIMEOUT);
+  CU_ASSERT (take_all (rd) == 3);
+  CU_ASSERT (take_all (g_reader) == 5);
+
+  struct slow_taker_arg arg = { .rd = rd };
+  ddsrt_threadattr_t tattr;
+  ddsrt_thread_t tid;
+  uint32_t res;
+  ddsrt_atomic_st32 (&arg.ntaken, 0);
+  ddsrt_threadattr_init (&tattr);
+  CU_ASSERT_FATAL (ddsrt_thread_create (&tid, "slow_taker", &tattr, slow_taker, &arg) == DDS_RETCODE_OK);
+  CU_ASSERT_FATAL (dds_begin_coherent (wr) == DDS_RETCODE_OK);
+  write_samples (wr, 0, 5);
+  CU_ASSERT (dds_end_coherent (wr) == DDS_RETCODE_OK);
+  CU_ASSERT_FATAL (ddsrt_thread_join (tid, &res) == DDS_RETCODE_OK);
+  CU_ASSERT (ddsrt_atomic_ld32 (&arg.ntaken) == 5);
+  CU_ASSERT (take_all (g_reader) == 5);
+}
+
+static dds_entity_t create_domain (dds_domainid_t domid, const char *extra_config)
+{
+  char *conf_fmt = ddsrt_expand_envvars (DDS_CONFIG_EXTERNAL_DOMAINID, domid), *conf;
+  (void) ddsrt_asprintf (&conf, conf_fmt, extra_config);
+  dds_entity_t dom = dds_create_domain (domid, conf);
+  CU_ASSERT_FATAL (dom > 0);
+  ddsrt_free (conf);
+  ddsrt_free (conf_fmt);
+  return dom;
+}
+
+static void setup_remote (const dds_topic_descriptor_t *desc, const char *sub_config, dds_entity_t *pub_dom, dds_entity_t *sub_dom, dds_entity_t *wr, dds_entity_t *rd)
+{
+  char topic_name[100];
+  dds_entity_t pub_par, sub_par, pub_top, sub_top, pub;
+  dds_publication_matched_status_t pm;
+  dds_subscription_matched_status_t sm;
+  dds_time_t tend;
+
+  /* two domains mapped to the same port numbers */
+  *pub_dom = create_domain (DDS_DOMAINID_PUB, "");
+  *sub_dom = create_domain (DDS_DOMAINID_SUB, sub_config);
+  dds_qos_t *qos = create_qos (DDS_PRESENTATION_TOPIC);
+  create_unique_topic_name ("ddsc_coherent_remote", topic_name, sizeof (topic_name));
+  pub_par = dds_create_participant (DDS_DOMAINID_PUB, NULL, NULL);
+  CU_ASSERT_FATAL (pub_par > 0);
+  sub_par = dds_create_participant (DDS_DOMAINID_SUB, NULL, NULL);
+  CU_ASSERT_FATAL (sub_par > 0);
+  pub_top = dds_create_topic (pub_par, desc, topic_name, qos, NULL);
+  CU_ASSERT_FATAL (pub_top > 0);
+  sub_top = dds_create_topic (sub_par, desc, topic_name, qos, NULL);
+  CU_ASSERT_FATAL (sub_top > 0);
+  pub = dds_create_publisher (pub_par, qos, NULL);
+  CU_ASSERT_FATAL (pub > 0);
+  *wr = dds_create_writer (pub, pub_top, qos, NULL);
+  CU_ASSERT_FATAL (*wr > 0);
+  *rd = dds_create_reader (sub_par, sub_top, qos, NULL);
+  CU_ASSERT_FATAL (*rd > 0);
+  dds_delete_qos (qos);
+
+  tend = dds_time () + DDS_SECS (10);
+  do {
+    CU_ASSERT_FATAL (dds_get_publication_matched_status (*wr, &pm) == DDS_RETCODE_OK);
+    CU_ASSERT_FATAL (dds_get_subscription_matched_status (*rd, &sm) == DDS_RETCODE_OK);
+    if (pm.current_count == 1 && sm.current_count == 1)
+      break;
+    dds_sleepfor (DDS_MSECS (10));
+  } while (dds_time () < tend);
+  CU_ASSERT_FATAL (pm.current_count == 1 && sm.current_count == 1);
+}
+
+CU_Test(ddsc_coherent, remote, .timeout = 30)
+{
+#define REMOTE_SAMPLES 20
+  dds_entity_t pub_dom, sub_dom, wr, rd;
+  dds_time_t tend;
+  int32_t n;
+
+  setup_remote (&Space_Type1_desc, "", &pub_dom, &sub_dom, &wr, &rd);
+
+  /* nothing arrives until the set is complete, then all of it arrives at once */
+  CU_ASSERT_FATAL (dds_begin_coherent (wr) == DDS_RETCODE_OK);
+  write_samples (wr, 0, REMOTE_SAMPLES);
+  dds_sleepfor (DDS_MSECS (100));
+  CU_ASSERT (take_all (rd) == 0);
+  CU_ASSERT_FATAL (dds_end_coherent (wr) == DDS_RETCODE_OK);
+  tend = dds_time () + DDS_SECS (10);
+  while ((n = take_all (rd)) == 0 && dds_time () < tend)
+    dds_sleepfor (DDS_MSECS (10));
+  CU_ASSERT (n == REMOTE_SAMPLES);
+
+  /* and outside a set everything arrives as before */
+  write_samples (wr, 0, 1);
+  tend = dds_time () + DDS_SECS (10);
+  while ((n = take_all (rd)) == 0 && dds_time () < tend)
+    dds_sleepfor (DDS_MSECS (10));
+  CU_ASSERT (n == 1);
+
+  dds_delete (pub_dom);
+  dds_delete (sub_dom);
+#undef REMOTE_SAMPLES
+}
+
+CU_Test(ddsc_coherent, remote_large, .timeout = 30)
+{
+  /* a set too large to retain without pinning many receive buffers is delivered
+     in parts rather than all at the end */
+#define REMOTE_SAMPLES 20
+  dds_entity_t pub_dom, sub_dom, wr, rd;
+  RoundTripModule_DataType sample;
+  dds_time_t tend;
+  int32_t n, ntotal;
+
+  /* small receive buffers so that the set spans many of them */
+  setup_remote (&RoundTripModule_DataType_desc, "<Sizing><ReceiveBufferSize>256kB</ReceiveBufferSize></Sizing>", &pub_dom, &sub_dom, &wr, &rd);
+  memset (&sample, 0, sizeof (sample));
+  sample.payload._length = sample.payload._maximum = 100000;
+  sample.payload._buffer = ddsrt_malloc (sample.payload._length);
+  memset (sample.payload._buffer, 0x55, sample.payload._length);
+
+  CU_ASSERT_FATAL (dds_begin_coherent (wr) == DDS_RETCODE_OK);
+  for (int32_t i = 0; i < REMOTE_SAMPLES; i++)
+    CU_ASSERT_FATAL (dds_write (wr, &sample) == DDS_RETCODE_OK);
+  dds_write_flush (wr);
+  tend = dds_time () + DDS_SECS (10);
+  while ((ntotal = take_all (rd)) == 0 && dds_time () < tend)
+    dds_sleepfor (DDS_MSECS (10));
+  CU_ASSERT (ntotal > 0 && ntotal < REMOTE_SAMPLES);
+  CU_ASSERT_FATAL (dds_end_coherent (wr) == DDS_RETCODE_OK);
+  tend = dds_time () + DDS_SECS (10);
+  while (ntotal < REMOTE_SAMPLES && dds_time () < tend)
+  {
+    if ((n = take_all (rd)) == 0)
+      dds_sleepfor (DDS_MSECS (10));
+    ntotal += n;
+  }
+  CU_ASSERT (ntotal == REMOTE_SAMPLES);
+
+  ddsrt_free (sample.payload._buffer);
+  dds_delete (pub_dom);
+  dds_delete (sub_dom);
+#undef REMOTE_SAMPLES
+}
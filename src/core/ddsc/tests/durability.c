@@ -0,0 +1,246 @@
+/*
+ * Copyright(c) 2020 ADLINK Technology Limited and others
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License v. 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0, or the Eclipse Distribution License
+ * v. 1.0 which is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "dds/dds.h"
+#include "dds/ddsrt/environ.h"
+#include "dds/ddsrt/filesystem.h"
+#include "dds/ddsrt/heap.h"
+#include "dds/ddsrt/io.h"
+#include "dds/ddsrt/string.h"
+
+#include "test_common.h"
+
+#if defined __linux || defined __APPLE__
+#include <sys/stat.h>
+#endif
+
+#define DDS_DOMAINID 0
+#define DDS_CONFIG_DURABILITY "${CYCLONEDDS_URI}${CYCLONEDDS_URI:+,}<Durability><Enable>true</Enable><Directory>%s</Directory></Durability>"
+
+static dds_entity_t g_domain, g_participant, g_topic;
+static char g_topic_name[100];
+
+static void create_domain (const char *directory)
+{
+  char *conf_fmt = ddsrt_expand_envvars (DDS_CONFIG_DURABILITY, DDS_DOMAINID), *conf;
+  (void) ddsrt_asprintf (&conf, conf_fmt, directory);
+  g_domain = dds_create_domain (DDS_DOMAINID, conf);
+  CU_ASSERT_FATAL (g_domain > 0);
+  ddsrt_free (conf);
+  ddsrt_free (conf_fmt);
+  g_participant = dds_create_participant (DDS_DOMAINID, NULL, NULL);
+  CU_ASSERT_FATAL (g_participant > 0);
+}
+
+static dds_entity_t create_topic (dds_history_kind_t kind, int32_t depth, int32_t max_instances)
+{
+  dds_qos_t *qos = dds_create_qos ();
+  dds_qset_reliability (qos, DDS_RELIABILITY_RELIABLE, DDS_INFINITY);
+  dds_qset_durability_service (qos, 0, kind, depth, DDS_LENGTH_UNLIMITED, max_instances, DDS_LENGTH_UNLIMITED);
+  dds_entity_t tp = dds_create_topic (g_participant, &Space_Type1_desc, g_topic_name, qos, NULL);
+  CU_ASSERT_FATAL (tp > 0);
+  dds_delete_qos (qos);
+  return tp;
+}
+
+static dds_entity_t create_endpoint (bool writer, dds_durability_kind_t kind)
+{
+  dds_qos_t *qos = dds_create_qos ();
+  dds_qset_durability (qos, kind);
+  dds_qset_history (qos, DDS_HISTORY_KEEP_ALL, 0);
+  dds_entity_t ep = writer ? dds_create_writer (g_participant, g_topic, qos, NULL) : dds_create_reader (g_participant, g_topic, qos, NULL);
+  CU_ASSERT_FATAL (ep > 0);
+  dds_delete_qos (qos);
+  return ep;
+}
+
+static void write_samples (dds_entity_t wr, int32_t ninstances, int32_t nsamples)
+{
+  for (int32_t s = 0; s < nsamples; s++)
+    for (int32_t i = 0; i < ninstances; i++)
+    {
+      Space_Type1 sample = { i, s, 0 };
+      dds_return_t ret = dds_write (wr, &sample);
+      CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+    }
+}
+
+/* Checks that the reader has exactly the samples of instances 0 .. ninstances-1 with
+   long_2 in [first,first+nsamples) and returns the instance state of the last one */
+static dds_instance_state_t check_samples (dds_entity_t rd, int32_t ninstances, int32_t first, int32_t nsamples)
+{
+  dds_instance_state_t istate = DDS_IST_ALIVE;
+  void *raw[32] = { NULL };
+  dds_sample_info_t si[32];
+  int32_t seen[8] = { 0 };
+  int32_t n = dds_take (rd, raw, si, 32, 32);
+  CU_ASSERT_FATAL (n == ninstances * nsamples);
+  for (int32_t i = 0; i < n; i++)
+  {
+    const Space_Type1 *s = raw[i];
+    CU_ASSERT_FATAL (si[i].valid_data);
+    CU_ASSERT_FATAL (s->long_1 >= 0 && s->long_1 < ninstances);
+    CU_ASSERT_FATAL (s->long_2 == first + seen[s->long_1]);
+    seen[s->long_1]++;
+    istate = si[i].instance_state;
+  }
+  (void) dds_return_loan (rd, raw, n);
+  return istate;
+}
+
+static void durability_init (void)
+{
+  create_unique_topic_name ("ddsc_durability", g_topic_name, sizeof (g_topic_name));
+  create_domain ("");
+}
+
+static void durability_fini (void)
+{
+  dds_delete (g_domain);
+}
+
+CU_Test(ddsc_durability, transient_late_joiner, .init = durability_init, .fini = durability_fini)
+{
+  g_topic = create_topic (DDS_HISTORY_KEEP_LAST, 2, DDS_LENGTH_UNLIMITED);
+  dds_entity_t wr = create_endpoint (true, DDS_DURABILITY_TRANSIENT);
+  write_samples (wr, 3, 5);
+
+  /* a late joiner gets the durability service's history while the writer exists ... */
+  dds_entity_t rd = create_endpoint (false, DDS_DURABILITY_TRANSIENT);
+  CU_ASSERT_FATAL (dds_reader_wait_for_historical_data (rd, DDS_SECS (1)) == DDS_RETCODE_OK);
+  CU_ASSERT (check_samples (rd, 3, 3, 2) == DDS_IST_ALIVE);
+
+  /* ... and after it has been deleted, with the instances in the state that
+     deleting the writer left them in (auto-dispose is the default) */
+  dds_delete (wr);
+  dds_entity_t rd2 = create_endpoint (false, DDS_DURABILITY_TRANSIENT);
+  CU_ASSERT (check_samples (rd2, 3, 3, 2) == DDS_IST_NOT_ALIVE_DISPOSED);
+
+  /* volatile readers get nothing */
+  dds_entity_t rd3 = create_endpoint (false, DDS_DURABILITY_VOLATILE);
+  CU_ASSERT (check_samples (rd3, 0, 0, 0) == DDS_IST_ALIVE);
+}
+
+CU_Test(ddsc_durability, live_and_historical, .init = durability_init, .fini = durability_fini)
+{
+  g_topic = create_topic (DDS_HISTORY_KEEP_ALL, 1, DDS_LENGTH_UNLIMITED);
+  dds_entity_t wr = create_endpoint (true, DDS_DURABILITY_TRANSIENT);
+  write_samples (wr, 2, 3);
+  dds_entity_t rd = create_endpoint (false, DDS_DURABILITY_TRANSIENT);
+  {
+    /* samples written after the reader was created arrive once, in order */
+    Space_Type1 sample = { 0, 3, 0 };
+    CU_ASSERT_FATAL (dds_write (wr, &sample) == DDS_RETCODE_OK);
+    sample.long_1 = 1;
+    CU_ASSERT_FATAL (dds_write (wr, &sample) == DDS_RETCODE_OK);
+  }
+  CU_ASSERT (check_samples (rd, 2, 0, 4) == DDS_IST_ALIVE);
+}
+
+CU_Test(ddsc_durability, resource_limits, .init = durability_init, .fini = durability_fini)
+{
+  g_topic = create_topic (DDS_HISTORY_KEEP_LAST, 1, 2);
+  dds_entity_t wr = create_endpoint (true, DDS_DURABILITY_TRANSIENT);
+  write_samples (wr, 4, 2);
+  dds_entity_t rd = create_endpoint (false, DDS_DURABILITY_TRANSIENT);
+  CU_ASSERT (check_samples (rd, 2, 1, 1) == DDS_IST_ALIVE);
+}
+
+CU_Test(ddsc_durability, dispose, .init = durability_init, .fini = durability_fini)
+{
+  g_topic = create_topic (DDS_HISTORY_KEEP_LAST, 1, DDS_LENGTH_UNLIMITED);
+  dds_entity_t wr = create_endpoint (true, DDS_DURABILITY_TRANSIENT);
+  write_samples (wr, 2, 1);
+  Space_Type1 sample = { 1, 0, 0 };
+  CU_ASSERT_FATAL (dds_dispose (wr, &sample) == DDS_RETCODE_OK);
+  /* the service cleanup delay is 0, so instance 1 is gone */
+  dds_entity_t rd = create_endpoint (false, DDS_DURABILITY_TRANSIENT);
+  CU_ASSERT (check_samples (rd, 1, 0, 1) == DDS_IST_ALIVE);
+}
+
+static void remove_logs (const char *topic_name)
+{
+  ddsrt_dir_handle_t dir;
+  struct ddsrt_dirent de;
+  const size_t len = strlen (topic_name);
+  if (ddsrt_opendir (".", &dir) != DDS_RETCODE_OK)
+    return;
+  while (ddsrt_readdir (dir, &de) == DDS_RETCODE_OK)
+    if (strncmp (de.d_name, topic_name, len) == 0 && de.d_name[len] == '.')
+      (void) remove (de.d_name);
+  (void) ddsrt_closedir (dir);
+}
+
+CU_Test(ddsc_durability, persistent_restart)
+{
+#if defined __linux || defined __APPLE__
+  create_unique_topic_name ("ddsc_durability", g_topic_name, sizeof (g_topic_name));
+  create_domain (".");
+  g_topic = create_topic (DDS_HISTORY_KEEP_LAST, 2, DDS_LENGTH_UNLIMITED);
+  dds_entity_t wr = create_endpoint (true, DDS_DURABILITY_PERSISTENT);
+  /* enough samples to make the log be compacted */
+  write_samples (wr, 2, 1000);
+  dds_delete (g_domain);
+
+  create_domain (".");
+  g_topic = create_topic (DDS_HISTORY_KEEP_LAST, 2, DDS_LENGTH_UNLIMITED);
+  dds_entity_t rd = create_endpoint (false, DDS_DURABILITY_PERSISTENT);
+  CU_ASSERT (check_samples (rd, 2, 998, 2) == DDS_IST_NOT_ALIVE_DISPOSED);
+  dds_delete (g_domain);
+  remove_logs (g_topic_name);
+#endif
+}
+
+CU_Test(ddsc_durability, persistent_corrupt)
+{
+#if defined __linux || defined __APPLE__
+  create_unique_topic_name ("ddsc_durability", g_topic_name, sizeof (g_topic_name));
+  create_domain (".");
+  g_topic = create_topic (DDS_HISTORY_KEEP_LAST, 2, DDS_LENGTH_UNLIMITED);
+  dds_entity_t wr = create_endpoint (true, DDS_DURABILITY_PERSISTENT);
+  write_samples (wr, 2, 2);
+  dds_delete (g_domain);
+
+  /* the log is private to the user and starts with a 16-byte header followed
+     by the writer record, the writer id of which is at offset 8 */
+  ddsrt_dir_handle_t dir;
+  struct ddsrt_dirent de;
+  char *path = NULL;
+  const size_t len = strlen (g_topic_name);
+  CU_ASSERT_FATAL (ddsrt_opendir (".", &dir) == DDS_RETCODE_OK);
+  while (path == NULL && ddsrt_readdir (dir, &de) == DDS_RETCODE_OK)
+    if (strncmp (de.d_name, g_topic_name, len) == 0 && de.d_name[len] == '.')
+      path = ddsrt_strdup (de.d_name);
+  (void) ddsrt_closedir (dir);
+  CU_ASSERT_FATAL (path != NULL);
+  struct stat st;
+  CU_ASSERT_FATAL (stat (path, &st) == 0);
+  CU_ASSERT ((st.st_mode & 0777) == 0600);
+  const uint32_t wrid = UINT32_MAX;
+  FILE *fp = fopen (path, "r+b");
+  CU_ASSERT_FATAL (fp != NULL);
+  CU_ASSERT_FATAL (fseek (fp, 16 + 8, SEEK_SET) == 0);
+  CU_ASSERT_FATAL (fwrite (&wrid, sizeof (wrid), 1, fp) == 1);
+  (void) fclose (fp);
+  ddsrt_free (path);
+
+  /* a bogus writer id makes the remainder of the log unusable */
+  create_domain (".");
+  g_topic = create_topic (DDS_HISTORY_KEEP_LAST, 2, DDS_LENGTH_UNLIMITED);
+  dds_entity_t rd = create_endpoint (false, DDS_DURABILITY_PERSISTENT);
+  (void) check_samples (rd, 0, 0, 0);
+  dds_delete (g_domain);
+  remove_logs (g_topic_name);
+#endif
+}
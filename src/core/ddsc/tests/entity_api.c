@@ -10,6 +10,8 @@
  * SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
  */
 #include "dds/dds.h"
+#include "dds/ddsrt/atomics.h"
+#include "dds/ddsrt/threads.h"
 #include "CUnit/Test.h"
 
 /* We are deliberately testing some bad arguments that SAL will complain about.
@@ -388,6 +390,76 @@ CU_Test(ddsc_entity, delete, .init = create_entity)
     entity = 0;
 }
 
+#define PIN_DELETE_THREADS 4
+#define PIN_DELETE_ROUNDS 5000
+
+struct pin_delete_arg {
+    dds_entity_t parent;
+    ddsrt_atomic_uint32_t stop;
+    ddsrt_atomic_uint32_t current;
+    ddsrt_atomic_uint32_t errors;
+};
+
+static uint32_t pin_delete_thread(void *varg)
+{
+    struct pin_delete_arg *arg = varg;
+    while (!ddsrt_atomic_ld32(&arg->stop)) {
+        dds_entity_t e = (dds_entity_t) ddsrt_atomic_ld32(&arg->current);
+        if (e > 0) {
+            /* the entity may be deleted at any time, but it must either be found
+               with the correct parent or not be found at all */
+            dds_entity_t parent = dds_get_parent(e);
+            if (parent != arg->parent && parent != DDS_RETCODE_BAD_PARAMETER)
+                ddsrt_atomic_inc32(&arg->errors);
+        }
+    }
+    return 0;
+}
+
+/* Entities are created and deleted while other threads concurrently look up
+   their handles, which do not involve a global lock. */
+CU_Test(ddsc_entity, pin_concurrent_delete, .init = create_entity, .fini = delete_entity)
+{
+    struct pin_delete_arg arg;
+    ddsrt_thread_t tids[PIN_DELETE_THREADS];
+    ddsrt_threadattr_t tattr;
+    dds_return_t ret;
+
+    arg.parent = entity;
+    ddsrt_atomic_st32(&arg.stop, 0);
+    ddsrt_atomic_st32(&arg.current, 0);
+    ddsrt_atomic_st32(&arg.errors, 0);
+    ddsrt_threadattr_init(&tattr);
+    for (int i = 0; i < PIN_DELETE_THREADS; i++) {
+        ret = ddsrt_thread_create(&tids[i], "pin_delete", &tattr, pin_delete_thread, &arg);
+        CU_ASSERT_EQUAL_FATAL(ret, DDS_RETCODE_OK);
+    }
+
+    dds_entity_t prev = 0;
+    for (int i = 0; i < PIN_DELETE_ROUNDS; i++) {
+        dds_entity_t gc = dds_create_guardcondition(entity);
+        CU_ASSERT_FATAL(gc > 0);
+        CU_ASSERT_FATAL(gc != prev);
+        ddsrt_atomic_st32(&arg.current, (uint32_t) gc);
+        ret = dds_set_guardcondition(gc, true);
+        CU_ASSERT_EQUAL_FATAL(ret, DDS_RETCODE_OK);
+        ret = dds_delete(gc);
+        CU_ASSERT_EQUAL_FATAL(ret, DDS_RETCODE_OK);
+        /* a handle of a deleted entity is invalid, even if its slot gets reused */
+        CU_ASSERT_EQUAL_FATAL(dds_get_parent(gc), DDS_RETCODE_BAD_PARAMETER);
+        if (prev > 0)
+            CU_ASSERT_EQUAL_FATAL(dds_get_parent(prev), DDS_RETCODE_BAD_PARAMETER);
+        prev = gc;
+    }
+
+    ddsrt_atomic_st32(&arg.stop, 1);
+    for (int i = 0; i < PIN_DELETE_THREADS; i++) {
+        ret = ddsrt_thread_join(tids[i], NULL);
+        CU_ASSERT_EQUAL_FATAL(ret, DDS_RETCODE_OK);
+    }
+    CU_ASSERT_EQUAL(ddsrt_atomic_ld32(&arg.errors), 0);
+}
+
 #ifdef _MSC_VER
 #pragma warning(pop)
 #endif
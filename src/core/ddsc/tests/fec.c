@@ -0,0 +1,80 @@
+/*
+ * Copyright(c) 2020 ADLINK Technology Limited and others
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License v. 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0, or the Eclipse Distribution License
+ * v. 1.0 which is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+ */
+#include "dds/dds.h"
+
+#include "test_common.h"
+#include "test_pubsub.h"
+
+#define DDS_CONFIG_LOSSY "<Internal><Test><XmitLossiness>100</XmitLossiness></Test></Internal>"
+#define DDS_CONFIG_DIRECT "<Internal><DefragDirectMinSize>16kB</DefragDirectMinSize></Internal>"
+
+static struct pubsub g_ps;
+
+static void fec_init (void)
+{
+  /* best-effort, with a FEC submessage following every two DATA_FRAGs and
+     the reader reassembling the samples directly */
+  dds_qos_t *qos = dds_create_qos ();
+  dds_qset_reliability (qos, DDS_RELIABILITY_BEST_EFFORT, 0);
+  dds_qset_history (qos, DDS_HISTORY_KEEP_ALL, 0);
+  dds_qset_prop (qos, "cyclonedds.fec.group_size", "2");
+  pubsub_init (&g_ps, DDS_CONFIG_LOSSY, DDS_CONFIG_DIRECT, qos);
+  dds_delete_qos (qos);
+}
+
+static void fec_fini (void)
+{
+  pubsub_fini (&g_ps);
+}
+
+CU_Test(ddsc_fec, lossy_best_effort, .init = fec_init, .fini = fec_fini, .timeout = 60)
+{
+  /* with 10% packet loss, a best-effort sample sent as two DATA_FRAGs arrives
+     81% of the time; with a FEC submessage that allows recovering either of
+     them that goes up to 97% */
+#define N_FEC 500
+  for (uint32_t i = 0; i < N_FEC; i++)
+  {
+    pubsub_write_sample (g_ps.writer, 20000, i);
+    dds_sleepfor (DDS_MSECS (1));
+  }
+
+  uint32_t count = 0;
+  dds_time_t tidle = dds_time () + DDS_SECS (1);
+  while (dds_time () < tidle)
+  {
+    void *raw[16] = { NULL };
+    dds_sample_info_t si[16];
+    int32_t m = dds_take (g_ps.reader, raw, si, 16, 16);
+    CU_ASSERT_FATAL (m >= 0);
+    for (int32_t k = 0; k < m; k++, count++)
+    {
+      const RoundTripModule_DataType *s = raw[k];
+      CU_ASSERT_FATAL (si[k].valid_data);
+      CU_ASSERT_FATAL (s->payload._length == 20000);
+      for (uint32_t j = 1; j < s->payload._length; j++)
+        CU_ASSERT_FATAL (s->payload._buffer[j] == (uint8_t) (s->payload._buffer[0] + j));
+    }
+    if (m > 0)
+    {
+      (void) dds_return_loan (g_ps.reader, raw, m);
+      tidle = dds_time () + DDS_SECS (1);
+    }
+    else
+    {
+      dds_sleepfor (DDS_MSECS (10));
+    }
+  }
+  CU_ASSERT (count <= N_FEC);
+  CU_ASSERT (count >= N_FEC * 9 / 10);
+#undef N_FEC
+}
@@ -28,8 +28,16 @@
 #include <stdlib.h>
 
 #include "dds/dds.h"
+#include "dds/ddsc/dds_statistics.h"
 #include "dds/ddsrt/misc.h"
 #include "dds/ddsrt/attributes.h"
+#include "dds/ddsrt/environ.h"
+#include "dds/ddsi/ddsi_filter.h"
+#include "dds/ddsi/ddsi_serdata.h"
+#include "dds/ddsi/ddsi_entity_index.h"
+#include "dds/ddsi/q_entity.h"
+#include "dds/ddsi/q_thread.h"
+#include "dds__entity.h"
 
 #include "test_common.h"
 
@@ -380,3 +388,318 @@ CU_Test (ddsc_filter, get)
   dds_delete (dp);
 }
 
+
+static void setup_expression_test (dds_entity_t *dp, dds_entity_t *tp, dds_entity_t *rd, dds_entity_t *wr, const dds_topic_descriptor_t *desc)
+{
+  char topicname[100];
+  create_unique_topic_name ("ddsc_filter", topicname, sizeof (topicname));
+  dds_qos_t *qos = dds_create_qos ();
+  dds_qset_reliability (qos, DDS_RELIABILITY_RELIABLE, DDS_INFINITY);
+  dds_qset_history (qos, DDS_HISTORY_KEEP_ALL, 0);
+  *dp = dds_create_participant (0, NULL, NULL);
+  CU_ASSERT_FATAL (*dp > 0);
+  // filtered topic for the reader, unfiltered one for the writer
+  tp[0] = dds_create_topic (*dp, desc, topicname, qos, NULL);
+  CU_ASSERT_FATAL (tp[0] > 0);
+  tp[1] = dds_create_topic (*dp, desc, topicname, qos, NULL);
+  CU_ASSERT_FATAL (tp[1] > 0);
+  *rd = dds_create_reader (*dp, tp[0], qos, NULL);
+  CU_ASSERT_FATAL (*rd > 0);
+  *wr = dds_create_writer (*dp, tp[1], qos, NULL);
+  CU_ASSERT_FATAL (*wr > 0);
+  dds_delete_qos (qos);
+}
+
+CU_Test (ddsc_filter, expression)
+{
+  dds_entity_t dp, tp[2], rd, wr;
+  dds_return_t ret;
+  setup_expression_test (&dp, tp, &rd, &wr, &Space_Type1_desc);
+
+  ret = dds_set_topic_filter_expression (tp[0], "long_2 = 1 OR long_1 > 2 AND NOT long_3 = 2", 0, NULL);
+  CU_ASSERT_FATAL (ret == 0);
+  const Space_Type1 xs[] = { {1,0,0}, {1,1,0}, {2,1,1}, {3,0,1}, {3,2,2}, {-1,1,-1} };
+  for (size_t i = 0; i < sizeof (xs) / sizeof (xs[0]); i++)
+  {
+    ret = dds_write (wr, &xs[i]);
+    CU_ASSERT_FATAL (ret == 0);
+  }
+  const struct exp exp = {
+    .n = 4, .xs = (const Space_Type1[]) {
+      {-1,1,-1}, {1,1,0}, {2,1,1}, {3,0,1}
+    }
+  };
+  checkdata (rd, &exp, "rd");
+  dds_delete (dp);
+}
+
+CU_Test (ddsc_filter, expression_params)
+{
+  dds_entity_t dp, tp[2], rd, wr;
+  dds_return_t ret;
+  setup_expression_test (&dp, tp, &rd, &wr, &Space_Type1_desc);
+
+  ret = dds_set_topic_filter_parameters (tp[0], 0, NULL);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_PRECONDITION_NOT_MET);
+  ret = dds_set_topic_filter_expression (tp[0], "long_1 BETWEEN %0 AND %1", 1, (const char *[]) { "1" });
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_BAD_PARAMETER);
+  ret = dds_set_topic_filter_expression (tp[0], "long_1 BETWEEN %0 AND %1", 2, (const char *[]) { "1", "2" });
+  CU_ASSERT_FATAL (ret == 0);
+  for (int32_t k = 0; k < 5; k++)
+  {
+    ret = dds_write (wr, &(Space_Type1){k,0,0});
+    CU_ASSERT_FATAL (ret == 0);
+  }
+  checkdata (rd, &(struct exp){ .n = 2, .xs = (const Space_Type1[]) { {1,0,0}, {2,0,0} } }, "rd 1..2");
+
+  // changing the parameters doesn't require recreating the reader
+  ret = dds_set_topic_filter_parameters (tp[0], 1, (const char *[]) { "3" });
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_BAD_PARAMETER);
+  ret = dds_set_topic_filter_parameters (tp[0], 2, (const char *[]) { "3", "4" });
+  CU_ASSERT_FATAL (ret == 0);
+  for (int32_t k = 0; k < 5; k++)
+  {
+    ret = dds_write (wr, &(Space_Type1){k,1,0});
+    CU_ASSERT_FATAL (ret == 0);
+  }
+  checkdata (rd, &(struct exp){ .n = 2, .xs = (const Space_Type1[]) { {3,1,0}, {4,1,0} } }, "rd 3..4");
+
+  // removing the expression accepts everything again
+  ret = dds_set_topic_filter_expression (tp[0], NULL, 0, NULL);
+  CU_ASSERT_FATAL (ret == 0);
+  ret = dds_write (wr, &(Space_Type1){0,2,0});
+  CU_ASSERT_FATAL (ret == 0);
+  checkdata (rd, &(struct exp){ .n = 1, .xs = (const Space_Type1[]) { {0,2,0} } }, "rd all");
+  dds_delete (dp);
+}
+
+CU_Test (ddsc_filter, expression_types)
+{
+  dds_entity_t dp, tp[2], rd, wr;
+  dds_return_t ret;
+  setup_expression_test (&dp, tp, &rd, &wr, &Space_simpletypes_desc);
+
+  const struct {
+    const char *expr;
+    const char *param;
+    int n; // number of matching samples of those written below
+  } tests[] = {
+    { "s = 'abc'", NULL, 1 },
+    { "s LIKE 'a%'", NULL, 2 },
+    { "s LIKE '_b_'", NULL, 1 },
+    { "s NOT LIKE %0", "'%c%'", 2 },
+    { "s = %0", "it's", 1 },
+    { "s > 'abc'", NULL, 2 },
+    { "l < 0 AND ll > 0", NULL, 1 },
+    { "ull > 9223372036854775807", NULL, 1 },
+    { "ul >= %0", "4000000000", 1 },
+    { "f > 0.25 AND d <= 1e3", NULL, 2 },
+    { "b = TRUE", NULL, 1 },
+    { "c = 65 OR o = 255", NULL, 2 },
+    { "s = 1", NULL, 0 },
+    { "NOT (us = 1 OR us = 2)", NULL, 1 }
+  };
+  const Space_simpletypes xs[] = {
+    { .l = -1, .ll = 1, .us = 1, .ul = 4000000000u, .ull = UINT64_MAX, .f = 0.5f, .d = 1000.0, .c = 'A', .b = true, .o = 0, .s = "abc" },
+    { .l = 1, .ll = -1, .us = 2, .ul = 1, .ull = 1, .f = 0.25f, .d = -1.0, .c = 'B', .b = false, .o = 255, .s = "ad" },
+    { .l = -1, .ll = -1, .us = 3, .ul = 1, .ull = 1, .f = 1.0f, .d = 2.0, .c = 'C', .b = false, .o = 1, .s = "it's" }
+  };
+  for (size_t i = 0; i < sizeof (tests) / sizeof (tests[0]); i++)
+  {
+    const char *params[] = { tests[i].param };
+    ret = dds_set_topic_filter_expression (tp[0], tests[i].expr, tests[i].param ? 1 : 0, params);
+    CU_ASSERT_FATAL (ret == 0);
+    for (size_t j = 0; j < sizeof (xs) / sizeof (xs[0]); j++)
+    {
+      ret = dds_write (wr, &xs[j]);
+      CU_ASSERT_FATAL (ret == 0);
+    }
+    void *raw[4] = { NULL };
+    dds_sample_info_t si[4];
+    ret = dds_take (rd, raw, si, 4, 4);
+    CU_ASSERT_FATAL (ret == tests[i].n);
+    ret = dds_return_loan (rd, raw, ret);
+    CU_ASSERT_FATAL (ret == 0);
+  }
+  dds_delete (dp);
+}
+
+CU_Test (ddsc_filter, expression_invalid)
+{
+  dds_entity_t dp, tp[2], rd, wr;
+  dds_return_t ret;
+  setup_expression_test (&dp, tp, &rd, &wr, &Space_Type1_desc);
+  const char *exprs[] = {
+    "", "long_1", "long_1 =", "long_4 = 1", "long_1 = 1 AND", "(long_1 = 1", "long_1 = 1)",
+    "long_1 BETWEEN 1", "long_1 NOT = 1", "long_1 = 'x", "long_1 = %100", "long_1 = 1 long_2 = 1"
+  };
+  for (size_t i = 0; i < sizeof (exprs) / sizeof (exprs[0]); i++)
+  {
+    ret = dds_set_topic_filter_expression (tp[0], exprs[i], 0, NULL);
+    CU_ASSERT_FATAL (ret == DDS_RETCODE_BAD_PARAMETER);
+  }
+  // excessive nesting is rejected rather than exhausting the stack of the parser
+  char deep[3 * 1000 + 16];
+  size_t pos = 0;
+  for (int i = 0; i < 1000; i++)
+    deep[pos++] = '(';
+  pos += (size_t) snprintf (deep + pos, sizeof (deep) - pos, "long_1 = 1");
+  for (int i = 0; i < 1000; i++)
+    deep[pos++] = ')';
+  deep[pos] = 0;
+  ret = dds_set_topic_filter_expression (tp[0], deep, 0, NULL);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_UNSUPPORTED);
+  pos = 0;
+  for (int i = 0; i < 700; i++)
+    pos += (size_t) snprintf (deep + pos, sizeof (deep) - pos, "NOT ");
+  (void) snprintf (deep + pos, sizeof (deep) - pos, "long_1 = 1");
+  ret = dds_set_topic_filter_expression (tp[0], deep, 0, NULL);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_UNSUPPORTED);
+  // a failed attempt leaves the filter as it was
+  ret = dds_set_topic_filter_expression (tp[0], "long_1 = 1", 0, NULL);
+  CU_ASSERT_FATAL (ret == 0);
+  ret = dds_set_topic_filter_expression (tp[0], "long_1 = %0", 0, NULL);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_BAD_PARAMETER);
+  ret = dds_write (wr, &(Space_Type1){0,0,0});
+  CU_ASSERT_FATAL (ret == 0);
+  ret = dds_write (wr, &(Space_Type1){1,0,0});
+  CU_ASSERT_FATAL (ret == 0);
+  checkdata (rd, &(struct exp){ .n = 1, .xs = (const Space_Type1[]) { {1,0,0} } }, "rd");
+  dds_delete (dp);
+}
+
+#define DDS_CONFIG_NO_PORT_GAIN "${CYCLONEDDS_URI}${CYCLONEDDS_URI:+,}<Discovery><ExternalDomainId>0</ExternalDomainId></Discovery>"
+
+static uint32_t get_num_filtered_readers (dds_entity_t writer)
+{
+  struct dds_entity *wr_entity;
+  struct writer *wr;
+  uint32_t n;
+  CU_ASSERT_EQUAL_FATAL (dds_entity_pin (writer, &wr_entity), 0);
+  thread_state_awake (lookup_thread_state (), &wr_entity->m_domain->gv);
+  wr = entidx_lookup_writer_guid (wr_entity->m_domain->gv.entity_index, &wr_entity->m_guid);
+  CU_ASSERT_FATAL (wr != NULL);
+  assert (wr != NULL); /* for Clang's static analyzer */
+  ddsrt_mutex_lock (&wr->e.lock);
+  n = wr->num_filtered_readers;
+  ddsrt_mutex_unlock (&wr->e.lock);
+  thread_state_asleep (lookup_thread_state ());
+  dds_entity_unpin (wr_entity);
+  return n;
+}
+
+static bool wait_num_filtered_readers (dds_entity_t writer, uint32_t n)
+{
+  dds_time_t tend = dds_time () + DDS_SECS (5);
+  while (get_num_filtered_readers (writer) != n && dds_time () < tend)
+    dds_sleepfor (DDS_MSECS (10));
+  return get_num_filtered_readers (writer) == n;
+}
+
+static bool writer_filter_accepts (dds_entity_t writer, const Space_Type1 *sample)
+{
+  struct dds_entity *wr_entity;
+  struct writer *wr;
+  bool accepts = true;
+  CU_ASSERT_EQUAL_FATAL (dds_entity_pin (writer, &wr_entity), 0);
+  thread_state_awake (lookup_thread_state (), &wr_entity->m_domain->gv);
+  wr = entidx_lookup_writer_guid (wr_entity->m_domain->gv.entity_index, &wr_entity->m_guid);
+  CU_ASSERT_FATAL (wr != NULL);
+  assert (wr != NULL); /* for Clang's static analyzer */
+  struct ddsi_serdata *sd = ddsi_serdata_from_sample (wr->topic, SDK_DATA, sample);
+  ddsrt_mutex_lock (&wr->e.lock);
+  ddsrt_avl_iter_t it;
+  for (struct wr_prd_match *m = ddsrt_avl_iter_first (&wr_readers_treedef, &wr->readers, &it); m; m = ddsrt_avl_iter_next (&it))
+    if (m->filter && !ddsi_filter_accepts (m->filter, sd))
+      accepts = false;
+  ddsrt_mutex_unlock (&wr->e.lock);
+  ddsi_serdata_unref (sd);
+  thread_state_asleep (lookup_thread_state ());
+  dds_entity_unpin (wr_entity);
+  return accepts;
+}
+
+static uint64_t get_filtered_count (struct dds_statistics *stat)
+{
+  CU_ASSERT_FATAL (dds_refresh_statistics (stat) == 0);
+  const struct dds_stat_keyvalue *kv = dds_lookup_statistic (stat, "filtered_count");
+  CU_ASSERT_FATAL (kv != NULL);
+  return kv->u.u64;
+}
+
+CU_Test (ddsc_filter, expression_remote)
+{
+  /* Two domains with different ids that map to the same port numbers, so that
+     the filter expression of the reader has to go through discovery and the
+     writer has to apply it */
+  char *conf_pub = ddsrt_expand_envvars (DDS_CONFIG_NO_PORT_GAIN, 0);
+  char *conf_sub = ddsrt_expand_envvars (DDS_CONFIG_NO_PORT_GAIN, 1);
+  const dds_entity_t dom_pub = dds_create_domain (0, conf_pub);
+  CU_ASSERT_FATAL (dom_pub > 0);
+  const dds_entity_t dom_sub = dds_create_domain (1, conf_sub);
+  CU_ASSERT_FATAL (dom_sub > 0);
+  dds_free (conf_pub);
+  dds_free (conf_sub);
+
+  char topicname[100];
+  create_unique_topic_name ("ddsc_filter", topicname, sizeof (topicname));
+  dds_qos_t *qos = dds_create_qos ();
+  dds_qset_reliability (qos, DDS_RELIABILITY_RELIABLE, DDS_INFINITY);
+  dds_qset_history (qos, DDS_HISTORY_KEEP_ALL, 0);
+  const dds_entity_t dp_pub = dds_create_participant (0, NULL, NULL);
+  CU_ASSERT_FATAL (dp_pub > 0);
+  const dds_entity_t dp_sub = dds_create_participant (1, NULL, NULL);
+  CU_ASSERT_FATAL (dp_sub > 0);
+  const dds_entity_t tp_pub = dds_create_topic (dp_pub, &Space_Type1_desc, topicname, qos, NULL);
+  CU_ASSERT_FATAL (tp_pub > 0);
+  const dds_entity_t tp_sub = dds_create_topic (dp_sub, &Space_Type1_desc, topicname, qos, NULL);
+  CU_ASSERT_FATAL (tp_sub > 0);
+  dds_return_t ret = dds_set_topic_filter_expression (tp_sub, "long_1 > %0", 1, (const char *[]) { "5" });
+  CU_ASSERT_FATAL (ret == 0);
+  const dds_entity_t wr = dds_create_writer (dp_pub, tp_pub, qos, NULL);
+  CU_ASSERT_FATAL (wr > 0);
+  const dds_entity_t rd = dds_create_reader (dp_sub, tp_sub, qos, NULL);
+  CU_ASSERT_FATAL (rd > 0);
+  dds_delete_qos (qos);
+
+  CU_ASSERT_FATAL (wait_num_filtered_readers (wr, 1));
+  struct dds_statistics *stat = dds_create_statistics (wr);
+  CU_ASSERT_FATAL (stat != NULL);
+  CU_ASSERT_FATAL (get_filtered_count (stat) == 0);
+  for (int32_t i = 0; i < 10; i++)
+  {
+    ret = dds_write (wr, &(Space_Type1){i,0,0});
+    CU_ASSERT_FATAL (ret == 0);
+  }
+  // GAPs for the filtered samples mean the reader can acknowledge everything
+  ret = dds_wait_for_acks (wr, DDS_SECS (5));
+  CU_ASSERT_FATAL (ret == 0);
+  checkdata (rd, &(struct exp){ .n = 4, .xs = (const Space_Type1[]) { {6,0,0}, {7,0,0}, {8,0,0}, {9,0,0} } }, "rd");
+  // the writer didn't send the rejected ones
+  CU_ASSERT (get_filtered_count (stat) == 6);
+
+  // changing the parameters updates the filter the writer evaluates
+  ret = dds_set_topic_filter_parameters (tp_sub, 1, (const char *[]) { "7" });
+  CU_ASSERT_FATAL (ret == 0);
+  const dds_time_t tend = dds_time () + DDS_SECS (5);
+  while (writer_filter_accepts (wr, &(Space_Type1){7,0,0}) && dds_time () < tend)
+    dds_sleepfor (DDS_MSECS (10));
+  CU_ASSERT_FATAL (!writer_filter_accepts (wr, &(Space_Type1){7,0,0}));
+  for (int32_t i = 0; i < 10; i++)
+  {
+    ret = dds_write (wr, &(Space_Type1){i,1,0});
+    CU_ASSERT_FATAL (ret == 0);
+  }
+  ret = dds_wait_for_acks (wr, DDS_SECS (5));
+  CU_ASSERT_FATAL (ret == 0);
+  checkdata (rd, &(struct exp){ .n = 2, .xs = (const Space_Type1[]) { {8,1,0}, {9,1,0} } }, "rd");
+  CU_ASSERT (get_filtered_count (stat) == 6 + 8);
+  dds_delete_statistics (stat);
+
+  ret = dds_set_topic_filter_expression (tp_sub, NULL, 0, NULL);
+  CU_ASSERT_FATAL (ret == 0);
+  CU_ASSERT_FATAL (wait_num_filtered_readers (wr, 0));
+
+  dds_delete (dom_pub);
+  dds_delete (dom_sub);
+}
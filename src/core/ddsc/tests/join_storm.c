@@ -0,0 +1,323 @@
+/*
+ * Copyright(c) 2020 ADLINK Technology Limited and others
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License v. 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0, or the Eclipse Distribution License
+ * v. 1.0 which is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+ */
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "dds/dds.h"
+#include "dds/ddsrt/environ.h"
+#include "dds/ddsrt/heap.h"
+#include "dds/ddsrt/time.h"
+#include "dds/ddsi/ddsi_domaingv.h"
+#include "dds/ddsi/ddsi_entity_index.h"
+#include "dds/ddsi/q_bswap.h"
+#include "dds/ddsi/q_ddsi_discovery.h"
+#include "dds/ddsi/q_entity.h"
+#include "dds/ddsi/q_addrset.h"
+#include "dds/ddsi/q_thread.h"
+#include "dds__entity.h"
+
+#include "test_common.h"
+
+#define DDS_DOMAINID_PUB 0
+#define DDS_DOMAINID_SUB 1
+#define DDS_CONFIG_NO_PORT_GAIN "${CYCLONEDDS_URI}${CYCLONEDDS_URI:+,}<Discovery><ExternalDomainId>0</ExternalDomainId></Discovery>"
+/* A socket per participant and no multicast for data, so that every remote
+   participant has a unicast locator of its own, like distinct hosts would */
+#define DDS_CONFIG_UNICAST_SUB DDS_CONFIG_NO_PORT_GAIN "<General><AllowMulticast>spdp</AllowMulticast></General><Compatibility><ManySocketsMode>many</ManySocketsMode></Compatibility>"
+
+#define NPARTICIPANTS 10
+#define NREADERS_PER_PARTICIPANT 50
+#define NREADERS (NPARTICIPANTS * NREADERS_PER_PARTICIPANT)
+#define MAX_LOCS 2 * NPARTICIPANTS
+
+/* Several threads for processing discovery data in both domains */
+#define DDS_CONFIG_BUILTIN_DQUEUES DDS_CONFIG_NO_PORT_GAIN "<Internal><BuiltinDeliveryQueues>4</BuiltinDeliveryQueues></Internal>"
+#define NPARTICIPANTS_PARALLEL 8
+
+static dds_entity_t g_pub_domain, g_sub_domain;
+
+static void join_storm_init (void)
+{
+  /* Domains for pub and sub use a different domain id, but the portgain setting
+     in configuration is 0, so that both domains will map to the same port number.
+     This allows to create two domains in a single test process. */
+  char *conf_pub = ddsrt_expand_envvars (DDS_CONFIG_NO_PORT_GAIN, DDS_DOMAINID_PUB);
+  char *conf_sub = ddsrt_expand_envvars (DDS_CONFIG_UNICAST_SUB, DDS_DOMAINID_SUB);
+  g_pub_domain = dds_create_domain (DDS_DOMAINID_PUB, conf_pub);
+  CU_ASSERT_FATAL (g_pub_domain > 0);
+  g_sub_domain = dds_create_domain (DDS_DOMAINID_SUB, conf_sub);
+  CU_ASSERT_FATAL (g_sub_domain > 0);
+  dds_free (conf_pub);
+  dds_free (conf_sub);
+}
+
+static void join_storm_fini (void)
+{
+  dds_delete (g_sub_domain);
+  dds_delete (g_pub_domain);
+}
+
+static void wait_for_matched_count (dds_entity_t writer, uint32_t count)
+{
+  const dds_time_t tstart = dds_time ();
+  dds_publication_matched_status_t st;
+  dds_return_t ret;
+  do {
+    ret = dds_get_publication_matched_status (writer, &st);
+    CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+    if (st.current_count != count)
+      dds_sleepfor (DDS_MSECS (1));
+  } while (st.current_count != count && dds_time () - tstart < DDS_SECS (60));
+  CU_ASSERT_FATAL (st.current_count == count);
+}
+
+static uint32_t get_incremental_addrset_updates (dds_entity_t writer)
+{
+  struct dds_entity *x;
+  uint32_t n;
+  dds_return_t ret = dds_entity_pin (writer, &x);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+  struct writer *wr = ((struct dds_writer *) x)->m_wr;
+  ddsrt_mutex_lock (&wr->e.lock);
+  n = wr->num_incremental_addrset_updates;
+  ddsrt_mutex_unlock (&wr->e.lock);
+  dds_entity_unpin (x);
+  return n;
+}
+
+struct locs {
+  int n;
+  nn_locator_t locs[MAX_LOCS];
+};
+
+static void collect_loc (const nn_locator_t *loc, void *varg)
+{
+  struct locs *arg = varg;
+  CU_ASSERT_FATAL (arg->n < MAX_LOCS);
+  arg->locs[arg->n++] = *loc;
+}
+
+static void get_writer_locs (struct writer *wr, struct locs *locs)
+{
+  locs->n = 0;
+  ddsrt_mutex_lock (&wr->e.lock);
+  addrset_forall (wr->as, collect_loc, locs);
+  ddsrt_mutex_unlock (&wr->e.lock);
+}
+
+/* Checks that the writer's address set is what it would be if it were
+   computed from scratch, which is what rebuilding all of them does */
+static void check_writer_addrset (dds_entity_t writer)
+{
+  struct dds_entity *x;
+  struct locs incr, full;
+  dds_return_t ret = dds_entity_pin (writer, &x);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+  struct writer *wr = ((struct dds_writer *) x)->m_wr;
+  get_writer_locs (wr, &incr);
+  thread_state_awake (lookup_thread_state (), wr->e.gv);
+  rebuild_or_clear_writer_addrsets (wr->e.gv, 1);
+  thread_state_asleep (lookup_thread_state ());
+  get_writer_locs (wr, &full);
+  dds_entity_unpin (x);
+  CU_ASSERT_FATAL (incr.n == full.n);
+  CU_ASSERT (memcmp (incr.locs, full.locs, (size_t) incr.n * sizeof (incr.locs[0])) == 0);
+}
+
+/* Creates many remote readers for a single writer in quick succession, and
+   then deletes all of them again, returning the time it took for the writer
+   to have matched them all and for it to have unmatched them all, as well as
+   the number of incremental address set updates once all had been matched */
+static void join_storm (int nparticipants, int nreaders_per_participant, dds_entity_t *writer, dds_duration_t *tjoin, dds_duration_t *tleave, uint32_t *nincr_join, bool check)
+{
+  char name[100];
+  dds_entity_t pub_pp, pub_tp;
+  dds_entity_t *sub_pp = ddsrt_malloc ((size_t) nparticipants * sizeof (*sub_pp));
+  dds_return_t ret;
+
+  create_unique_topic_name ("ddsc_join_storm", name, sizeof (name));
+  pub_pp = dds_create_participant (DDS_DOMAINID_PUB, NULL, NULL);
+  CU_ASSERT_FATAL (pub_pp > 0);
+  pub_tp = dds_create_topic (pub_pp, &Space_Type1_desc, name, NULL, NULL);
+  CU_ASSERT_FATAL (pub_tp > 0);
+  *writer = dds_create_writer (pub_pp, pub_tp, NULL, NULL);
+  CU_ASSERT_FATAL (*writer > 0);
+
+  dds_time_t tstart = dds_time ();
+  for (int i = 0; i < nparticipants; i++)
+  {
+    sub_pp[i] = dds_create_participant (DDS_DOMAINID_SUB, NULL, NULL);
+    CU_ASSERT_FATAL (sub_pp[i] > 0);
+    dds_entity_t sub_tp = dds_create_topic (sub_pp[i], &Space_Type1_desc, name, NULL, NULL);
+    CU_ASSERT_FATAL (sub_tp > 0);
+    for (int j = 0; j < nreaders_per_participant; j++)
+    {
+      dds_entity_t reader = dds_create_reader (sub_pp[i], sub_tp, NULL, NULL);
+      CU_ASSERT_FATAL (reader > 0);
+    }
+  }
+  wait_for_matched_count (*writer, (uint32_t) (nparticipants * nreaders_per_participant));
+  *tjoin = dds_time () - tstart;
+  *nincr_join = get_incremental_addrset_updates (*writer);
+  if (check)
+    check_writer_addrset (*writer);
+
+  tstart = dds_time ();
+  for (int i = 0; i < nparticipants; i++)
+  {
+    ret = dds_delete (sub_pp[i]);
+    CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+  }
+  wait_for_matched_count (*writer, 0);
+  *tleave = dds_time () - tstart;
+  ddsrt_free (sub_pp);
+}
+
+/* Test for a "join storm": many remote readers matching a single writer in
+   quick succession, and then all of them disappearing again.  Each of these
+   (un)matches affects the writer's address set, which used to be recomputed
+   from scratch every time, making the total cost quadratic in the number of
+   readers.  The writer must have updated it incrementally instead, but with
+   the same result. */
+CU_Test (ddsc_discovery, join_storm, .init = join_storm_init, .fini = join_storm_fini, .timeout = 90)
+{
+  dds_entity_t writer;
+  dds_duration_t tjoin, tleave;
+  uint32_t nincr_join;
+  join_storm (NPARTICIPANTS, NREADERS_PER_PARTICIPANT, &writer, &tjoin, &tleave, &nincr_join, true);
+
+  /* all but the first match (which sets up the bookkeeping) are handled
+     incrementally, even though every participant has its own locator; when
+     the readers go, for each participant the last one to go leaves a useless
+     locator in the address set, requiring it to be recomputed */
+  CU_ASSERT (nincr_join == NREADERS - 1);
+  CU_ASSERT (get_incremental_addrset_updates (writer) - nincr_join == NREADERS - NPARTICIPANTS);
+}
+
+/* Benchmark: the time it takes for a writer to match/unmatch all readers in
+   a join storm of increasing size, printed per reader, which should remain
+   roughly constant.  With many more participants leaving at the same time,
+   some of the SPDP messages announcing it may get dropped, and then the time
+   it takes for them to leave is dominated by the lease duration.  Disabled
+   by default, run it explicitly to measure. */
+CU_Test (ddsc_discovery, join_storm_benchmark, .init = join_storm_init, .fini = join_storm_fini, .timeout = 600, .disabled = true)
+{
+  static const int nparticipants[] = { 10, 20, 40 };
+  for (size_t k = 0; k < sizeof (nparticipants) / sizeof (nparticipants[0]); k++)
+  {
+    dds_entity_t writer;
+    dds_duration_t tjoin, tleave;
+    uint32_t nincr_join;
+    const int nreaders = nparticipants[k] * NREADERS_PER_PARTICIPANT;
+    join_storm (nparticipants[k], NREADERS_PER_PARTICIPANT, &writer, &tjoin, &tleave, &nincr_join, false);
+    printf ("join storm: %5d readers: join %8.3fs (%6.1fus/reader) leave %8.3fs (%6.1fus/reader), %"PRIu32" incremental address set updates on joining\n",
+            nreaders, (double) tjoin / 1e9, (double) tjoin / 1e3 / nreaders,
+            (double) tleave / 1e9, (double) tleave / 1e3 / nreaders, nincr_join);
+    CU_ASSERT_FATAL (dds_delete (dds_get_participant (writer)) == DDS_RETCODE_OK);
+  }
+}
+
+static void parallel_discovery_init (void)
+{
+  char *conf_pub = ddsrt_expand_envvars (DDS_CONFIG_BUILTIN_DQUEUES, DDS_DOMAINID_PUB);
+  char *conf_sub = ddsrt_expand_envvars (DDS_CONFIG_BUILTIN_DQUEUES, DDS_DOMAINID_SUB);
+  g_pub_domain = dds_create_domain (DDS_DOMAINID_PUB, conf_pub);
+  CU_ASSERT_FATAL (g_pub_domain > 0);
+  g_sub_domain = dds_create_domain (DDS_DOMAINID_SUB, conf_sub);
+  CU_ASSERT_FATAL (g_sub_domain > 0);
+  dds_free (conf_pub);
+  dds_free (conf_sub);
+}
+
+/* Returns the number of distinct builtin delivery queues that the discovery
+   data of the participants in ppants is handled by in the domain of "dom",
+   checking that it is handled by the one selected for the participant */
+static uint32_t count_builtins_dqueues (dds_entity_t dom, const dds_entity_t *ppants, int n)
+{
+  struct nn_dqueue *dqs[NPARTICIPANTS_PARALLEL];
+  uint32_t ndqs = 0;
+  struct dds_entity *x;
+  CU_ASSERT_FATAL (dds_entity_pin (dom, &x) == DDS_RETCODE_OK);
+  struct ddsi_domaingv * const gv = &x->m_domain->gv;
+  CU_ASSERT_FATAL (gv->n_builtins_dqueues == 4);
+  thread_state_awake (lookup_thread_state (), gv);
+  for (int i = 0; i < n; i++)
+  {
+    dds_guid_t ppguid;
+    ddsi_guid_t guid;
+    CU_ASSERT_FATAL (dds_get_guid (ppants[i], &ppguid) == DDS_RETCODE_OK);
+    memcpy (&guid, &ppguid, sizeof (guid));
+    guid = nn_ntoh_guid (guid);
+    guid.entityid.u = NN_ENTITYID_SEDP_BUILTIN_PUBLICATIONS_WRITER;
+    struct proxy_writer *pwr = entidx_lookup_proxy_writer_guid (gv->entity_index, &guid);
+    CU_ASSERT_FATAL (pwr != NULL);
+    CU_ASSERT (pwr->dqueue == builtins_dqueue_for_prefix (gv, &guid.prefix));
+    uint32_t k;
+    for (k = 0; k < ndqs && dqs[k] != pwr->dqueue; k++)
+      ;
+    if (k == ndqs)
+      dqs[ndqs++] = pwr->dqueue;
+  }
+  thread_state_asleep (lookup_thread_state ());
+  dds_entity_unpin (x);
+  return ndqs;
+}
+
+/* Discovery of many participants, each with a writer and a reader, with the
+   discovery data of different remote participants processed by different
+   threads, must still match every reader with every writer */
+CU_Test (ddsc_discovery, parallel_builtins, .init = parallel_discovery_init, .fini = join_storm_fini, .timeout = 60)
+{
+  dds_entity_t pub_ppants[NPARTICIPANTS_PARALLEL], sub_ppants[NPARTICIPANTS_PARALLEL];
+  dds_entity_t writers[2 * NPARTICIPANTS_PARALLEL], readers[2 * NPARTICIPANTS_PARALLEL];
+  char topicname[100];
+  create_unique_topic_name ("ddsc_discovery_parallel_builtins", topicname, sizeof (topicname));
+  dds_qos_t *qos = dds_create_qos ();
+  dds_qset_reliability (qos, DDS_RELIABILITY_RELIABLE, DDS_INFINITY);
+  for (int i = 0; i < 2 * NPARTICIPANTS_PARALLEL; i++)
+  {
+    const dds_domainid_t domid = (i < NPARTICIPANTS_PARALLEL) ? DDS_DOMAINID_PUB : DDS_DOMAINID_SUB;
+    const dds_entity_t pp = dds_create_participant (domid, NULL, NULL);
+    CU_ASSERT_FATAL (pp > 0);
+    if (i < NPARTICIPANTS_PARALLEL)
+      pub_ppants[i] = pp;
+    else
+      sub_ppants[i - NPARTICIPANTS_PARALLEL] = pp;
+    const dds_entity_t tp = dds_create_topic (pp, &Space_Type1_desc, topicname, NULL, NULL);
+    CU_ASSERT_FATAL (tp > 0);
+    writers[i] = dds_create_writer (pp, tp, qos, NULL);
+    CU_ASSERT_FATAL (writers[i] > 0);
+    readers[i] = dds_create_reader (pp, tp, qos, NULL);
+    CU_ASSERT_FATAL (readers[i] > 0);
+  }
+  dds_delete_qos (qos);
+
+  for (int i = 0; i < 2 * NPARTICIPANTS_PARALLEL; i++)
+  {
+    wait_for_matched_count (writers[i], 2 * NPARTICIPANTS_PARALLEL);
+    dds_subscription_matched_status_t st;
+    const dds_time_t tend = dds_time () + DDS_SECS (10);
+    do {
+      CU_ASSERT_FATAL (dds_get_subscription_matched_status (readers[i], &st) == DDS_RETCODE_OK);
+      if (st.current_count != 2 * NPARTICIPANTS_PARALLEL)
+        dds_sleepfor (DDS_MSECS (1));
+    } while (st.current_count != 2 * NPARTICIPANTS_PARALLEL && dds_time () < tend);
+    CU_ASSERT_FATAL (st.current_count == 2 * NPARTICIPANTS_PARALLEL);
+  }
+
+  /* the remote participants are spread over the queues; with 8 of them and 4
+     queues, the odds of them all ending up in the same one are negligible */
+  CU_ASSERT (count_builtins_dqueues (g_sub_domain, pub_ppants, NPARTICIPANTS_PARALLEL) > 1);
+  CU_ASSERT (count_builtins_dqueues (g_pub_domain, sub_ppants, NPARTICIPANTS_PARALLEL) > 1);
+}
@@ -0,0 +1,361 @@
+/*
+ * Copyright(c) 2020 ADLINK Technology Limited and others
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License v. 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0, or the Eclipse Distribution License
+ * v. 1.0 which is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+ */
+#include <string.h>
+
+#include "dds/dds.h"
+#include "dds/ddsc/dds_statistics.h"
+#include "dds/ddsrt/heap.h"
+#include "dds/ddsi/ddsi_domaingv.h"
+#include "dds/ddsi/ddsi_serdata_default.h"
+#include "dds__entity.h"
+#include "dds__types.h"
+
+#include "test_common.h"
+#include "test_pubsub.h"
+
+/* Large fragments so that most samples arrive in a single message, where they
+   can be referenced in the receive buffer */
+#define DDS_CONFIG_LARGE_FRAGMENTS "<General><MaxMessageSize>65000B</MaxMessageSize><FragmentSize>16000B</FragmentSize></General>"
+/* Default (small) fragments and direct reassembly of samples of 16kB and up */
+#define DDS_CONFIG_DIRECT "<Internal><DefragDirectMinSize>16kB</DefragDirectMinSize></Internal>"
+#define DDS_CONFIG_LOSSY "<Internal><Test><XmitLossiness>100</XmitLossiness></Test></Internal>"
+
+static struct pubsub g_ps;
+
+static void large_samples_init (void)
+{
+  pubsub_init (&g_ps, DDS_CONFIG_LARGE_FRAGMENTS, DDS_CONFIG_LARGE_FRAGMENTS, NULL);
+}
+
+static void large_samples_direct_init (void)
+{
+  pubsub_init (&g_ps, DDS_CONFIG_DIRECT, DDS_CONFIG_DIRECT, NULL);
+}
+
+static void large_samples_direct_lossy_init (void)
+{
+  /* only the writer drops packets, so that discovery still completes */
+  pubsub_init (&g_ps, DDS_CONFIG_DIRECT DDS_CONFIG_LOSSY, DDS_CONFIG_DIRECT, NULL);
+}
+
+static void large_samples_fini (void)
+{
+  pubsub_fini (&g_ps);
+}
+
+CU_Test(ddsc_large_samples, sizes, .init = large_samples_init, .fini = large_samples_fini, .timeout = 30)
+{
+  /* small samples get copied, medium ones referenced in the receive buffer
+     and fragmented ones copied again */
+  static const uint32_t sizes[] = { 10, 1000, 3000, 15000, 16000, 40000, 65000, 5000 };
+  const uint32_t n = (uint32_t) (sizeof (sizes) / sizeof (sizes[0]));
+  for (uint32_t i = 0; i < n; i++)
+    pubsub_write_sample (g_ps.writer, sizes[i], i);
+
+  /* everything acknowledged means everything is in the reader's cache, and
+     the referenced ones are accounted for as retained receive buffer space */
+  CU_ASSERT_FATAL (dds_wait_for_acks (g_ps.writer, DDS_SECS (10)) == DDS_RETCODE_OK);
+  struct dds_statistics *stat = dds_create_statistics (g_ps.sub_dom);
+  CU_ASSERT_FATAL (stat != NULL);
+  const struct dds_stat_keyvalue *retained = dds_lookup_statistic (stat, "rbuf_retained_bytes");
+  CU_ASSERT_FATAL (retained != NULL);
+  CU_ASSERT (retained->u.u64 >= 1000 + 3000 + 15000 + 5000);
+  dds_delete_statistics (stat);
+
+  pubsub_take_samples (g_ps.reader, n, sizes);
+  stat = dds_create_statistics (g_ps.sub_dom);
+  CU_ASSERT_FATAL (stat != NULL);
+  retained = dds_lookup_statistic (stat, "rbuf_retained_bytes");
+  CU_ASSERT_FATAL (retained != NULL);
+  CU_ASSERT (retained->u.u64 == 0);
+  dds_delete_statistics (stat);
+}
+
+CU_Test(ddsc_large_samples, retained, .init = large_samples_init, .fini = large_samples_fini, .timeout = 30)
+{
+  /* more data than the receive buffer budget for referenced samples (1MB by
+     default), so that the samples that don't get taken right away eventually
+     get copied */
+#define N_RETAINED 200
+  uint32_t *sizes = ddsrt_malloc (N_RETAINED * sizeof (*sizes));
+  for (uint32_t i = 0; i < N_RETAINED; i++)
+  {
+    sizes[i] = 12000;
+    pubsub_write_sample (g_ps.writer, sizes[i], i);
+  }
+  pubsub_take_samples (g_ps.reader, N_RETAINED, sizes);
+  ddsrt_free (sizes);
+#undef N_RETAINED
+}
+
+static bool is_kept (const void *vsample)
+{
+  /* also gets called on the (empty) key value */
+  const RoundTripModule_DataType *sample = vsample;
+  return sample->payload._length > 0 && (sample->payload._buffer[0] % 20) == 0;
+}
+
+static bool is_not_kept (const void *vsample)
+{
+  return !is_kept (vsample);
+}
+
+CU_Test(ddsc_large_samples, slow_reader, .init = large_samples_init, .fini = large_samples_fini, .timeout = 60)
+{
+  /* samples referencing the receive buffers that remain in the reader after most
+     of the data in those buffers has been taken must not keep all those buffers
+     alive: they get copied once the buffer is no longer used for receiving, so
+     the number of receive buffers remains small */
+#define N_ROUNDS 200
+#define N_PER_ROUND 100
+  dds_entity_t qc_take = dds_create_querycondition (g_ps.reader, DDS_ANY_STATE, is_not_kept);
+  CU_ASSERT_FATAL (qc_take > 0);
+  uint32_t nkept = 0;
+  for (uint32_t i = 0; i < N_ROUNDS * N_PER_ROUND; i++)
+  {
+    /* is_kept looks at the first byte of the payload, which is i mod 256 */
+    if ((i % 256) % 20 == 0)
+      nkept++;
+    pubsub_write_sample (g_ps.writer, 1100, i);
+    if ((i % N_PER_ROUND) == N_PER_ROUND - 1)
+    {
+      /* everything acknowledged means everything is in the reader's cache */
+      CU_ASSERT_FATAL (dds_wait_for_acks (g_ps.writer, DDS_SECS (10)) == DDS_RETCODE_OK);
+      void *raw[N_PER_ROUND] = { NULL };
+      dds_sample_info_t si[N_PER_ROUND];
+      int32_t n = dds_take (qc_take, raw, si, N_PER_ROUND, N_PER_ROUND);
+      CU_ASSERT_FATAL (n > 0);
+      (void) dds_return_loan (qc_take, raw, n);
+    }
+  }
+
+  struct dds_statistics *stat = dds_create_statistics (g_ps.sub_dom);
+  CU_ASSERT_FATAL (stat != NULL);
+  const struct dds_stat_keyvalue *rbuf_count = dds_lookup_statistic (stat, "rbuf_count");
+  const struct dds_stat_keyvalue *rbuf_bytes = dds_lookup_statistic (stat, "rbuf_bytes");
+  const struct dds_stat_keyvalue *retained = dds_lookup_statistic (stat, "rbuf_retained_bytes");
+  CU_ASSERT_FATAL (rbuf_count != NULL && rbuf_bytes != NULL && retained != NULL);
+  CU_ASSERT (rbuf_count->u.u32 > 0 && rbuf_bytes->u.u64 > 0 && retained->u.u64 <= rbuf_bytes->u.u64);
+  CU_ASSERT (rbuf_count->u.u32 <= 8);
+  dds_delete_statistics (stat);
+
+  /* the kept samples are all still there and intact */
+  dds_entity_t qc_kept = dds_create_querycondition (g_ps.reader, DDS_ANY_STATE, is_kept);
+  CU_ASSERT_FATAL (qc_kept > 0);
+  uint32_t ntaken = 0;
+  int32_t n;
+  do {
+    void *raw[N_PER_ROUND] = { NULL };
+    dds_sample_info_t si[N_PER_ROUND];
+    n = dds_take (qc_kept, raw, si, N_PER_ROUND, N_PER_ROUND);
+    CU_ASSERT_FATAL (n >= 0);
+    for (int32_t k = 0; k < n; k++)
+    {
+      const RoundTripModule_DataType *sample = raw[k];
+      CU_ASSERT_FATAL (sample->payload._length == 1100);
+      for (uint32_t j = 1; j < sample->payload._length; j++)
+        CU_ASSERT_FATAL (sample->payload._buffer[j] == (uint8_t) (sample->payload._buffer[0] + j));
+    }
+    if (n > 0)
+      (void) dds_return_loan (qc_kept, raw, n);
+    ntaken += (uint32_t) n;
+  } while (n > 0);
+  CU_ASSERT (ntaken == nkept);
+#undef N_PER_ROUND
+#undef N_ROUNDS
+}
+
+static void get_rbuf_stats (uint32_t *count, uint64_t *retained)
+{
+  struct dds_statistics *stat = dds_create_statistics (g_ps.sub_dom);
+  CU_ASSERT_FATAL (stat != NULL);
+  const struct dds_stat_keyvalue *rbuf_count = dds_lookup_statistic (stat, "rbuf_count");
+  const struct dds_stat_keyvalue *rbuf_retained = dds_lookup_statistic (stat, "rbuf_retained_bytes");
+  CU_ASSERT_FATAL (rbuf_count != NULL && rbuf_retained != NULL);
+  *count = rbuf_count->u.u32;
+  *retained = rbuf_retained->u.u64;
+  dds_delete_statistics (stat);
+}
+
+CU_Test(ddsc_large_samples, idle_reader, .init = large_samples_init, .fini = large_samples_fini, .timeout = 60)
+{
+  /* samples referencing a receive buffer in a reader that doesn't receive anything
+     anymore must not keep the buffer alive once data for another reader has
+     caused it to be replaced */
+#define N_IDLE 10
+#define N_OTHER 2000
+  uint32_t rbuf_count;
+  uint64_t retained;
+  for (uint32_t i = 0; i < N_IDLE; i++)
+    pubsub_write_sample (g_ps.writer, 2000, i);
+  CU_ASSERT_FATAL (dds_wait_for_acks (g_ps.writer, DDS_SECS (10)) == DDS_RETCODE_OK);
+  get_rbuf_stats (&rbuf_count, &retained);
+  CU_ASSERT_FATAL (retained >= N_IDLE * 2000);
+  /* there is a pool with one buffer for each receive thread */
+  const uint32_t rbuf_count_initial = rbuf_count;
+
+  /* traffic on another topic takes the receive thread through some buffers */
+  char topic_name[100];
+  dds_entity_t pub_top, sub_top, wr, rd;
+  dds_publication_matched_status_t pm;
+  create_unique_topic_name ("ddsc_large_samples", topic_name, sizeof (topic_name));
+  dds_qos_t *qos = dds_create_qos ();
+  dds_qset_reliability (qos, DDS_RELIABILITY_RELIABLE, DDS_INFINITY);
+  dds_qset_history (qos, DDS_HISTORY_KEEP_LAST, 1);
+  pub_top = dds_create_topic (dds_get_participant (g_ps.writer), &RoundTripModule_DataType_desc, topic_name, qos, NULL);
+  CU_ASSERT_FATAL (pub_top > 0);
+  sub_top = dds_create_topic (dds_get_participant (g_ps.reader), &RoundTripModule_DataType_desc, topic_name, qos, NULL);
+  CU_ASSERT_FATAL (sub_top > 0);
+  wr = dds_create_writer (dds_get_participant (g_ps.writer), pub_top, qos, NULL);
+  CU_ASSERT_FATAL (wr > 0);
+  rd = dds_create_reader (dds_get_participant (g_ps.reader), sub_top, qos, NULL);
+  CU_ASSERT_FATAL (rd > 0);
+  dds_delete_qos (qos);
+  dds_time_t tend = dds_time () + DDS_SECS (10);
+  do {
+    CU_ASSERT_FATAL (dds_get_publication_matched_status (wr, &pm) == DDS_RETCODE_OK);
+    if (pm.current_count == 0)
+      dds_sleepfor (DDS_MSECS (10));
+  } while (pm.current_count == 0 && dds_time () < tend);
+  CU_ASSERT_FATAL (pm.current_count == 1);
+  RoundTripModule_DataType sample;
+  sample.payload._length = sample.payload._maximum = 1100;
+  sample.payload._buffer = ddsrt_malloc (1100);
+  sample.payload._release = false;
+  memset (sample.payload._buffer, 0, 1100);
+  for (uint32_t i = 0; i < N_OTHER; i++)
+    CU_ASSERT_FATAL (dds_write (wr, &sample) == DDS_RETCODE_OK);
+  ddsrt_free (sample.payload._buffer);
+  CU_ASSERT_FATAL (dds_wait_for_acks (wr, DDS_SECS (10)) == DDS_RETCODE_OK);
+  CU_ASSERT_FATAL (dds_delete (rd) == DDS_RETCODE_OK);
+
+  /* releasing the buffer happens asynchronously */
+  tend = dds_time () + DDS_SECS (5);
+  do {
+    get_rbuf_stats (&rbuf_count, &retained);
+    if (rbuf_count > rbuf_count_initial || retained > 0)
+      dds_sleepfor (DDS_MSECS (10));
+  } while ((rbuf_count > rbuf_count_initial || retained > 0) && dds_time () < tend);
+  CU_ASSERT (rbuf_count == rbuf_count_initial);
+  CU_ASSERT (retained == 0);
+
+  /* the samples in the idle reader are intact */
+  uint32_t sizes[N_IDLE];
+  for (uint32_t i = 0; i < N_IDLE; i++)
+    sizes[i] = 2000;
+  pubsub_take_samples (g_ps.reader, N_IDLE, sizes);
+#undef N_OTHER
+#undef N_IDLE
+}
+
+CU_Test(ddsc_large_samples, direct, .init = large_samples_direct_init, .fini = large_samples_fini, .timeout = 30)
+{
+  /* samples below the threshold, or not fragmented at all, are defragmented
+     as before; those of at least 16kB are copied into place fragment by
+     fragment, including ones with a short last fragment */
+  static const uint32_t sizes[] = { 10, 5000, 16383, 16384, 20000, 100001, 1000000, 3000000, 5000, 65536 };
+  const uint32_t n = (uint32_t) (sizeof (sizes) / sizeof (sizes[0]));
+  for (uint32_t i = 0; i < n; i++)
+    pubsub_write_sample (g_ps.writer, sizes[i], i);
+  pubsub_take_samples (g_ps.reader, n, sizes);
+}
+
+CU_Test(ddsc_large_samples, direct_lossy, .init = large_samples_direct_lossy_init, .fini = large_samples_fini, .timeout = 60)
+{
+  /* lost fragments get requested based on the bitmap of received fragments,
+     and if the first one is lost the sample is defragmented as before until
+     the retransmit of the first one allows switching to direct reassembly */
+#define N_LOSSY 20
+  uint32_t sizes[N_LOSSY];
+  for (uint32_t i = 0; i < N_LOSSY; i++)
+  {
+    sizes[i] = 200000 + 1000 * i;
+    pubsub_write_sample (g_ps.writer, sizes[i], i);
+  }
+  pubsub_take_samples (g_ps.reader, N_LOSSY, sizes);
+#undef N_LOSSY
+}
+
+CU_Test(ddsc_large_samples, serdata_pool, .init = large_samples_init, .fini = large_samples_fini, .timeout = 30)
+{
+  /* once the size of the samples is known, they are serialized without having
+     to grow the serdata, and once the first ones have been acknowledged and
+     freed, into recycled ones (the pool caches freed ones per thread in
+     batches of 256, so it needs quite a few samples to see that) */
+#define N_POOL 300
+  uint32_t sizes[N_POOL];
+  for (uint32_t i = 0; i < N_POOL; i++)
+    sizes[i] = 3000;
+  for (int round = 0; round < 2; round++)
+  {
+    for (uint32_t i = 0; i < N_POOL; i++)
+      pubsub_write_sample (g_ps.writer, sizes[i], i);
+    pubsub_take_samples (g_ps.reader, N_POOL, sizes);
+    CU_ASSERT_FATAL (dds_wait_for_acks (g_ps.writer, DDS_SECS (10)) == DDS_RETCODE_OK);
+  }
+
+  struct dds_statistics *stat = dds_create_statistics (g_ps.writer);
+  CU_ASSERT_FATAL (stat != NULL);
+  const struct dds_stat_keyvalue *allocs = dds_lookup_statistic (stat, "serdata_allocs");
+  const struct dds_stat_keyvalue *pool_hits = dds_lookup_statistic (stat, "serdata_pool_hits");
+  const struct dds_stat_keyvalue *reallocs = dds_lookup_statistic (stat, "serdata_reallocs");
+  CU_ASSERT_FATAL (allocs != NULL && pool_hits != NULL && reallocs != NULL);
+  CU_ASSERT (allocs->u.u64 >= 2 * N_POOL);
+  CU_ASSERT (pool_hits->u.u64 >= N_POOL / 2);
+  CU_ASSERT (reallocs->u.u64 <= 1);
+  dds_delete_statistics (stat);
+#undef N_POOL
+}
+
+static struct ddsi_serdata_default *serialize_sample (const struct ddsi_sertopic *st, uint32_t size)
+{
+  RoundTripModule_DataType sample;
+  sample.payload._length = sample.payload._maximum = size;
+  sample.payload._buffer = ddsrt_malloc (size);
+  sample.payload._release = false;
+  memset (sample.payload._buffer, 0, size);
+  struct ddsi_serdata *sd = ddsi_serdata_from_sample (st, SDK_DATA, &sample);
+  CU_ASSERT_FATAL (sd != NULL);
+  ddsrt_free (sample.payload._buffer);
+  return (struct ddsi_serdata_default *) sd;
+}
+
+CU_Test(ddsc_large_samples, serdata_size_estimate, .init = large_samples_init, .fini = large_samples_fini, .timeout = 30)
+{
+  /* a single large sample doesn't make the serdatas for the small samples
+     following it large: those are either allocated in a small size class or
+     shrunk to it */
+  dds_entity *x;
+  CU_ASSERT_FATAL (dds_entity_pin (g_ps.writer, &x) == DDS_RETCODE_OK);
+  const struct ddsi_sertopic *st = ((struct dds_writer *) x)->m_topic->m_stopic;
+  struct ddsi_serdata_default *d = serialize_sample (st, 100000);
+  CU_ASSERT (d->size >= 100000);
+  ddsi_serdata_unref (&d->c);
+  for (uint32_t i = 0; i < 4; i++)
+  {
+    d = serialize_sample (st, 100);
+    CU_ASSERT (d->size <= 256);
+    ddsi_serdata_unref (&d->c);
+  }
+  dds_entity_unpin (x);
+
+  struct dds_statistics *stat = dds_create_statistics (g_ps.writer);
+  CU_ASSERT_FATAL (stat != NULL);
+  const struct dds_stat_keyvalue *allocs = dds_lookup_statistic (stat, "serdata_allocs");
+  const struct dds_stat_keyvalue *reallocs = dds_lookup_statistic (stat, "serdata_reallocs");
+  CU_ASSERT_FATAL (allocs != NULL && reallocs != NULL);
+  CU_ASSERT_FATAL (allocs->kind == DDS_STAT_KIND_UINT64 && reallocs->kind == DDS_STAT_KIND_UINT64);
+  CU_ASSERT (allocs->u.u64 == 5);
+  /* growing for the large one, shrinking at least the first small one */
+  CU_ASSERT (reallocs->u.u64 >= 2);
+  dds_delete_statistics (stat);
+}
@@ -265,6 +265,93 @@ CU_Theory((dds_entity_t *rdr), ddsc_querycondition_create, non_readers, .init=qu
 }
 /*************************************************************************************************/
 
+/*************************************************************************************************/
+static bool
+filter_mod3(const void * sample)
+{
+    const Space_Type1 *s = sample;
+    return (s->long_1 % 3 == 0);
+}
+
+CU_Test(ddsc_querycondition_create, many, .init=querycondition_init, .fini=querycondition_fini)
+{
+    /* Conditions using the same filter share a bit in the reader history, so the number of
+       query conditions is not limited by the width of the mask */
+    const uint32_t masks[] = {
+        DDS_ANY_SAMPLE_STATE | DDS_ANY_VIEW_STATE | DDS_ANY_INSTANCE_STATE,
+        DDS_NOT_READ_SAMPLE_STATE,
+        DDS_READ_SAMPLE_STATE | DDS_ALIVE_INSTANCE_STATE
+    };
+    const int nmasks = (int) (sizeof (masks) / sizeof (masks[0]));
+    dds_entity_t conds[200];
+    dds_return_t ret;
+
+    for (int i = 0; i < 200; i++) {
+        conds[i] = dds_create_querycondition(g_reader, masks[i % nmasks], (i % 2) ? filter_mod3 : filter_mod2);
+        CU_ASSERT_FATAL(conds[i] > 0);
+    }
+
+    /* long_1 in {0,2,4,6} resp. {0,3,6}; {3,4,5,6} are not read; {0,3,6} are alive; each read
+       marks the samples it returns as read */
+    ret = dds_read(conds[151], g_samples, g_info, MAX_SAMPLES, MAX_SAMPLES);
+    CU_ASSERT_EQUAL_FATAL(ret, 2);
+    ret = dds_read(conds[155], g_samples, g_info, MAX_SAMPLES, MAX_SAMPLES);
+    CU_ASSERT_EQUAL_FATAL(ret, 3);
+    ret = dds_read(conds[150], g_samples, g_info, MAX_SAMPLES, MAX_SAMPLES);
+    CU_ASSERT_EQUAL_FATAL(ret, 4);
+
+    /* Deleting all but one of the conditions should leave the last one intact */
+    for (int i = 0; i < 200; i++) {
+        if (i != 198) {
+            ret = dds_delete(conds[i]);
+            CU_ASSERT_EQUAL_FATAL(ret, DDS_RETCODE_OK);
+        }
+    }
+    ret = dds_read(conds[198], g_samples, g_info, MAX_SAMPLES, MAX_SAMPLES);
+    CU_ASSERT_EQUAL_FATAL(ret, 4);
+    for (int i = 0; i < ret; i++) {
+        CU_ASSERT_EQUAL(g_data[i].long_1 % 2, 0);
+    }
+    ret = dds_delete(conds[198]);
+    CU_ASSERT_EQUAL_FATAL(ret, DDS_RETCODE_OK);
+}
+/*************************************************************************************************/
+
+/*************************************************************************************************/
+CU_Test(ddsc_querycondition_create, key_only, .init=querycondition_init, .fini=querycondition_fini)
+{
+    uint32_t mask = DDS_ANY_SAMPLE_STATE | DDS_ANY_VIEW_STATE | DDS_ANY_INSTANCE_STATE;
+    dds_entity_t cond;
+    dds_return_t ret;
+
+    /* long_1 is the key field, so filter_mod2 only depends on the key */
+    cond = dds_create_querycondition_key(g_reader, mask, filter_mod2);
+    CU_ASSERT_FATAL(cond > 0);
+    ret = dds_read(cond, g_samples, g_info, MAX_SAMPLES, MAX_SAMPLES);
+    CU_ASSERT_EQUAL_FATAL(ret, 4);
+    for (int i = 0; i < ret; i++) {
+        CU_ASSERT_EQUAL(g_data[i].long_1 % 2, 0);
+    }
+
+    /* New samples in new and existing instances */
+    for (int i = 6; i < 9; i++) {
+        const Space_Type1 sample = { i, 1, 1 };
+        ret = dds_write(g_writer, &sample);
+        CU_ASSERT_EQUAL_FATAL(ret, DDS_RETCODE_OK);
+    }
+    ret = dds_take(cond, g_samples, g_info, MAX_SAMPLES, MAX_SAMPLES);
+    CU_ASSERT_EQUAL_FATAL(ret, 5);
+    for (int i = 0; i < ret; i++) {
+        CU_ASSERT_EQUAL(g_data[i].long_1 % 2, 0);
+    }
+    ret = dds_read(g_reader, g_samples, g_info, MAX_SAMPLES, MAX_SAMPLES);
+    CU_ASSERT_EQUAL_FATAL(ret, 4);
+
+    ret = dds_delete(cond);
+    CU_ASSERT_EQUAL_FATAL(ret, DDS_RETCODE_OK);
+}
+/*************************************************************************************************/
+
 
 
 
@@ -0,0 +1,239 @@
+/*
+ * Copyright(c) 2020 ADLINK Technology Limited and others
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License v. 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0, or the Eclipse Distribution License
+ * v. 1.0 which is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+ */
+#include <string.h>
+
+#include "dds/dds.h"
+#include "dds/ddsc/dds_statistics.h"
+#include "dds/ddsrt/heap.h"
+#include "dds/ddsi/q_entity.h"
+#include "dds__entity.h"
+#include "dds__types.h"
+
+#include "test_common.h"
+#include "test_pubsub.h"
+
+#define DDS_CONFIG_CC_SLOW "<Internal><CongestionControl><Enable>true</Enable><MinRate>100kB/s</MinRate><MaxRate>100kB/s</MaxRate></CongestionControl></Internal>"
+#define DDS_CONFIG_CC_LOSSY "<Internal><CongestionControl><Enable>true</Enable><MinRate>1MB/s</MinRate><MaxRate>100MB/s</MaxRate></CongestionControl><Test><XmitLossiness>100</XmitLossiness></Test></Internal>"
+#define DDS_DOMAINID_MUTE 2
+#define DDS_CONFIG_ADAPTIVE_HB "<Internal><AdaptiveHeartbeats>true</AdaptiveHeartbeats></Internal>"
+
+static struct pubsub g_ps;
+static dds_entity_t g_mute_dom;
+
+static void reliability_cc_lossy_init (void)
+{
+  pubsub_init (&g_ps, DDS_CONFIG_CC_LOSSY, "", NULL);
+}
+
+static void reliability_cc_slow_init (void)
+{
+  dds_qos_t *qos = dds_create_qos ();
+  dds_qset_reliability (qos, DDS_RELIABILITY_RELIABLE, DDS_MSECS (100));
+  dds_qset_history (qos, DDS_HISTORY_KEEP_ALL, 0);
+  pubsub_init (&g_ps, DDS_CONFIG_CC_SLOW, "", qos);
+  dds_delete_qos (qos);
+}
+
+static void create_matching_reader (dds_domainid_t domid)
+{
+  char topic_name[100];
+  dds_entity_t par, top, rd;
+  dds_qos_t *qos = dds_create_qos ();
+  CU_ASSERT_FATAL (dds_get_name (dds_get_topic (g_ps.writer), topic_name, sizeof (topic_name)) == DDS_RETCODE_OK);
+  CU_ASSERT_FATAL (dds_get_qos (g_ps.reader, qos) == DDS_RETCODE_OK);
+  par = dds_create_participant (domid, NULL, NULL);
+  CU_ASSERT_FATAL (par > 0);
+  top = dds_create_topic (par, &RoundTripModule_DataType_desc, topic_name, NULL, NULL);
+  CU_ASSERT_FATAL (top > 0);
+  rd = dds_create_reader (par, top, qos, NULL);
+  CU_ASSERT_FATAL (rd > 0);
+  dds_delete_qos (qos);
+}
+
+static void reliability_adaptive_hb_init (void)
+{
+  /* two readers in one domain and two more in another domain, which can be
+     muted so that those never acknowledge any data; two, because with just
+     one lagging reader the heartbeats get unicast to it anyway */
+  dds_publication_matched_status_t pm;
+  pubsub_init (&g_ps, DDS_CONFIG_ADAPTIVE_HB, "", NULL);
+  g_mute_dom = pubsub_create_domain (DDS_DOMAINID_MUTE, "");
+  create_matching_reader (PUBSUB_DOMAINID_SUB);
+  create_matching_reader (DDS_DOMAINID_MUTE);
+  create_matching_reader (DDS_DOMAINID_MUTE);
+  dds_time_t tend = dds_time () + DDS_SECS (10);
+  do {
+    CU_ASSERT_FATAL (dds_get_publication_matched_status (g_ps.writer, &pm) == DDS_RETCODE_OK);
+    if (pm.current_count == 4)
+      break;
+    dds_sleepfor (DDS_MSECS (10));
+  } while (dds_time () < tend);
+  CU_ASSERT_FATAL (pm.current_count == 4);
+}
+
+static void reliability_adaptive_hb_fini (void)
+{
+  dds_delete (g_mute_dom);
+  pubsub_fini (&g_ps);
+}
+
+static void reliability_fini (void)
+{
+  pubsub_fini (&g_ps);
+}
+
+CU_Test(ddsc_reliability, congestion_control, .init = reliability_cc_lossy_init, .fini = reliability_fini, .timeout = 60)
+{
+  /* retransmit requests lower the writer's rate, but never below the minimum,
+     and everything still arrives */
+#define N_CC 20
+  uint32_t sizes[N_CC];
+  for (uint32_t i = 0; i < N_CC; i++)
+  {
+    sizes[i] = 100000;
+    pubsub_write_sample (g_ps.writer, sizes[i], i);
+  }
+  pubsub_take_samples (g_ps.reader, N_CC, sizes);
+  CU_ASSERT_FATAL (dds_wait_for_acks (g_ps.writer, DDS_SECS (10)) == DDS_RETCODE_OK);
+
+  struct dds_statistics *stat = dds_create_statistics (g_ps.writer);
+  CU_ASSERT_FATAL (stat != NULL);
+  const struct dds_stat_keyvalue *cc_rate = dds_lookup_statistic (stat, "cc_rate");
+  const struct dds_stat_keyvalue *cc_rtt = dds_lookup_statistic (stat, "cc_rtt");
+  const struct dds_stat_keyvalue *cc_loss = dds_lookup_statistic (stat, "cc_loss");
+  CU_ASSERT_FATAL (cc_rate != NULL && cc_rtt != NULL && cc_loss != NULL);
+  /* rate is 0 if congestion control is disabled; the loss makes it drop
+     from the maximum to near the minimum */
+  CU_ASSERT (cc_rate->u.u64 >= 1000000 && cc_rate->u.u64 <= 50000000);
+  CU_ASSERT (cc_rtt->u.u64 > 0);
+  CU_ASSERT (cc_loss->u.u32 > 0 && cc_loss->u.u32 <= 1000);
+  dds_delete_statistics (stat);
+#undef N_CC
+}
+
+CU_Test(ddsc_reliability, congestion_control_timeout, .init = reliability_cc_slow_init, .fini = reliability_fini, .timeout = 30)
+{
+  /* at 100kB/s, a 1MB sample can't be sent within the max_blocking_time,
+     but that doesn't count against the rate so a small one still can */
+  RoundTripModule_DataType sample;
+  sample.payload._length = sample.payload._maximum = 1000000;
+  sample.payload._buffer = ddsrt_malloc (sample.payload._length);
+  sample.payload._release = false;
+  memset (sample.payload._buffer, 0, sample.payload._length);
+  const dds_time_t tstart = dds_time ();
+  CU_ASSERT (dds_write (g_ps.writer, &sample) == DDS_RETCODE_TIMEOUT);
+  CU_ASSERT (dds_time () - tstart < DDS_SECS (5));
+  ddsrt_free (sample.payload._buffer);
+
+  const uint32_t sizes[] = { 100 };
+  pubsub_write_sample (g_ps.writer, sizes[0], 0);
+  pubsub_take_samples (g_ps.reader, 1, sizes);
+}
+
+struct reader_ack_state {
+  bool caught_up;
+  ddsrt_mtime_t t_ackhb;
+  ddsrt_etime_t t_acknack_accepted;
+};
+
+/* Copies the state of the (at most 4) readers matched with g_ps.writer, returns
+   the number of readers that have replied to a heartbeat */
+static uint32_t get_reader_ack_state (struct reader_ack_state st[4], uint32_t *n_caught_up)
+{
+  struct dds_entity *x;
+  uint32_t n = 0, n_replied = 0;
+  CU_ASSERT_FATAL (dds_entity_pin (g_ps.writer, &x) == DDS_RETCODE_OK);
+  struct writer *wr = ((struct dds_writer *) x)->m_wr;
+  ddsrt_mutex_lock (&wr->e.lock);
+  *n_caught_up = 0;
+  ddsrt_avl_iter_t it;
+  for (struct wr_prd_match *m = ddsrt_avl_iter_first (&wr_readers_treedef, &wr->readers, &it); m; m = ddsrt_avl_iter_next (&it))
+  {
+    CU_ASSERT_FATAL (n < 4);
+    st[n].caught_up = (m->seq >= wr->seq);
+    st[n].t_ackhb = m->t_ackhb;
+    st[n].t_acknack_accepted = m->t_acknack_accepted;
+    if (st[n].caught_up)
+      (*n_caught_up)++;
+    if (m->has_replied_to_hb)
+      n_replied++;
+    n++;
+  }
+  ddsrt_mutex_unlock (&wr->e.lock);
+  dds_entity_unpin (x);
+  return n_replied;
+}
+
+static uint32_t get_writer_stat (const char *name)
+{
+  struct dds_statistics *stat = dds_create_statistics (g_ps.writer);
+  CU_ASSERT_FATAL (stat != NULL);
+  const struct dds_stat_keyvalue *kv = dds_lookup_statistic (stat, name);
+  CU_ASSERT_FATAL (kv != NULL);
+  const uint32_t v = kv->u.u32;
+  dds_delete_statistics (stat);
+  return v;
+}
+
+CU_Test(ddsc_reliability, adaptive_heartbeats, .init = reliability_adaptive_hb_init, .fini = reliability_adaptive_hb_fini, .timeout = 30)
+{
+  /* with two readers never acknowledging the data, heartbeats keep getting
+     unicast to those readers only, and the two readers that are caught up
+     don't get any and so don't send ACKNACKs either */
+  struct reader_ack_state st0[4], st1[4];
+  uint32_t n_caught_up;
+  dds_time_t tend = dds_time () + DDS_SECS (10);
+  while (get_reader_ack_state (st0, &n_caught_up) < 4 && dds_time () < tend)
+    dds_sleepfor (DDS_MSECS (10));
+  CU_ASSERT_FATAL (get_reader_ack_state (st0, &n_caught_up) == 4);
+  CU_ASSERT_FATAL (dds_domain_set_deafmute (g_mute_dom, false, true, DDS_INFINITY) == DDS_RETCODE_OK);
+
+  const uint32_t sizes[] = { 100, 100, 100, 100, 100 };
+  for (uint32_t i = 0; i < 5; i++)
+    pubsub_write_sample (g_ps.writer, sizes[i], i);
+  pubsub_take_samples (g_ps.reader, 5, sizes);
+  tend = dds_time () + DDS_SECS (5);
+  (void) get_reader_ack_state (st0, &n_caught_up);
+  while (n_caught_up < 2 && dds_time () < tend)
+  {
+    dds_sleepfor (DDS_MSECS (10));
+    (void) get_reader_ack_state (st0, &n_caught_up);
+  }
+  CU_ASSERT_FATAL (n_caught_up == 2);
+
+  /* let any heartbeat sent before the readers caught up be answered */
+  dds_sleepfor (DDS_MSECS (200));
+  (void) get_reader_ack_state (st0, &n_caught_up);
+  const uint32_t heartbeats_sent0 = get_writer_stat ("heartbeats_sent");
+  const uint32_t acknacks_received0 = get_writer_stat ("acknacks_received");
+  dds_sleepfor (DDS_SECS (2));
+  (void) get_reader_ack_state (st1, &n_caught_up);
+  const uint32_t heartbeats_sent1 = get_writer_stat ("heartbeats_sent");
+  const uint32_t acknacks_received1 = get_writer_stat ("acknacks_received");
+
+  CU_ASSERT_FATAL (n_caught_up == 2);
+  for (uint32_t i = 0; i < 4; i++)
+  {
+    CU_ASSERT_FATAL (st0[i].caught_up == st1[i].caught_up);
+    if (st1[i].caught_up)
+    {
+      CU_ASSERT (st1[i].t_ackhb.v == st0[i].t_ackhb.v);
+      CU_ASSERT (st1[i].t_acknack_accepted.v == st0[i].t_acknack_accepted.v);
+    }
+    else
+    {
+      CU_ASSERT (st1[i].t_ackhb.v > st0[i].t_ackhb.v);
+    }
+  }
+  CU_ASSERT (heartbeats_sent1 > heartbeats_sent0);
+  CU_ASSERT (acknacks_received1 == acknacks_received0);
+}
@@ -0,0 +1,489 @@
+/*
+ * Copyright(c) 2020 ADLINK Technology Limited and others
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License v. 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0, or the Eclipse Distribution License
+ * v. 1.0 which is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "dds/dds.h"
+#include "dds/ddsrt/atomics.h"
+#include "dds/ddsrt/environ.h"
+#include "dds/ddsrt/heap.h"
+#include "dds/ddsi/q_entity.h"
+#include "dds/ddsi/q_addrset.h"
+#include "dds/ddsi/ddsi_domaingv.h"
+#include "dds/ddsi/ddsi_tran.h"
+#include "dds__entity.h"
+
+#include "test_common.h"
+
+#define DDS_DOMAINID_PUB 0
+#define DDS_DOMAINID_SUB 1
+#define SHM_NCHUNKS 8 /* must match ChunkCount in the configuration */
+#define DDS_CONFIG_SHM "${CYCLONEDDS_URI}${CYCLONEDDS_URI:+,}<Discovery><ExternalDomainId>0</ExternalDomainId></Discovery><SharedMemory><Enable>true</Enable><ChunkCount>8</ChunkCount></SharedMemory>"
+/* A fixed participant index gives a fixed port number, hence a fixed ring name */
+#define DDS_CONFIG_SHM_FIXED_PORT "${CYCLONEDDS_URI}${CYCLONEDDS_URI:+,}<Discovery><ParticipantIndex>77</ParticipantIndex></Discovery><SharedMemory><Enable>true</Enable></SharedMemory>"
+
+static dds_entity_t g_pub_domain, g_sub_domain;
+
+static void shm_init (void)
+{
+  char *conf_pub = ddsrt_expand_envvars (DDS_CONFIG_SHM, DDS_DOMAINID_PUB);
+  char *conf_sub = ddsrt_expand_envvars (DDS_CONFIG_SHM, DDS_DOMAINID_SUB);
+  g_pub_domain = dds_create_domain (DDS_DOMAINID_PUB, conf_pub);
+  CU_ASSERT_FATAL (g_pub_domain > 0);
+  g_sub_domain = dds_create_domain (DDS_DOMAINID_SUB, conf_sub);
+  CU_ASSERT_FATAL (g_sub_domain > 0);
+  dds_free (conf_pub);
+  dds_free (conf_sub);
+}
+
+static void shm_fini (void)
+{
+  dds_delete (g_sub_domain);
+  dds_delete (g_pub_domain);
+}
+
+static void count_shm_locators (const nn_locator_t *loc, void *varg)
+{
+  int *n = varg;
+  if (loc->kind == NN_LOCATOR_KIND_SHM)
+    (*n)++;
+}
+
+static int writer_shm_locators (dds_entity_t writer)
+{
+  struct dds_entity *x;
+  int n = 0;
+  dds_return_t ret = dds_entity_pin (writer, &x);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+  struct writer *wr = ((struct dds_writer *) x)->m_wr;
+  ddsrt_mutex_lock (&wr->e.lock);
+  addrset_forall (wr->as, count_shm_locators, &n);
+  ddsrt_mutex_unlock (&wr->e.lock);
+  dds_entity_unpin (x);
+  return n;
+}
+
+static void create_matched_pair (const char *prefix, dds_entity_t *pub_pp, dds_entity_t *sub_pp, dds_entity_t *writer, dds_entity_t *reader)
+{
+  char name[100];
+  dds_entity_t pub_tp, sub_tp, ws;
+  dds_return_t ret;
+  dds_qos_t *qos;
+
+  create_unique_topic_name (prefix, name, sizeof (name));
+  *pub_pp = dds_create_participant (DDS_DOMAINID_PUB, NULL, NULL);
+  CU_ASSERT_FATAL (*pub_pp > 0);
+  *sub_pp = dds_create_participant (DDS_DOMAINID_SUB, NULL, NULL);
+  CU_ASSERT_FATAL (*sub_pp > 0);
+  pub_tp = dds_create_topic (*pub_pp, &Space_Type1_desc, name, NULL, NULL);
+  CU_ASSERT_FATAL (pub_tp > 0);
+  sub_tp = dds_create_topic (*sub_pp, &Space_Type1_desc, name, NULL, NULL);
+  CU_ASSERT_FATAL (sub_tp > 0);
+
+  qos = dds_create_qos ();
+  dds_qset_reliability (qos, DDS_RELIABILITY_RELIABLE, DDS_INFINITY);
+  dds_qset_history (qos, DDS_HISTORY_KEEP_ALL, 0);
+  *writer = dds_create_writer (*pub_pp, pub_tp, qos, NULL);
+  CU_ASSERT_FATAL (*writer > 0);
+  *reader = dds_create_reader (*sub_pp, sub_tp, qos, NULL);
+  CU_ASSERT_FATAL (*reader > 0);
+  dds_delete_qos (qos);
+
+  ret = dds_set_status_mask (*writer, DDS_PUBLICATION_MATCHED_STATUS);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+  ws = dds_create_waitset (*pub_pp);
+  CU_ASSERT_FATAL (ws > 0);
+  ret = dds_waitset_attach (ws, *writer, *writer);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+  ret = dds_waitset_wait (ws, NULL, 0, DDS_SECS (10));
+  CU_ASSERT_FATAL (ret == 1);
+  ret = dds_delete (ws);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+
+  /* the reader is in the same process, hence on the same host: the writer must address it via shared memory */
+  CU_ASSERT (writer_shm_locators (*writer) > 0);
+}
+
+CU_Test (ddsc_shm, same_host, .init = shm_init, .fini = shm_fini)
+{
+  dds_entity_t pub_pp, sub_pp, writer, reader;
+  dds_return_t ret;
+
+  create_matched_pair ("ddsc_shm", &pub_pp, &sub_pp, &writer, &reader);
+
+  for (int32_t i = 0; i < 100; i++)
+  {
+    Space_Type1 s = { i, i, i };
+    ret = dds_write (writer, &s);
+    CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+  }
+  ret = dds_wait_for_acks (writer, DDS_SECS (10));
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+
+  Space_Type1 rs[100];
+  void *ptrs[100];
+  dds_sample_info_t si[100];
+  for (int i = 0; i < 100; i++)
+    ptrs[i] = &rs[i];
+  ret = dds_take (reader, ptrs, si, 100, 100);
+  CU_ASSERT_FATAL (ret == 100);
+  for (int32_t i = 0; i < 100; i++)
+    CU_ASSERT (si[i].valid_data && rs[i].long_1 == i);
+
+  ret = dds_delete (pub_pp);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+  ret = dds_delete (sub_pp);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+}
+
+CU_Test (ddsc_shm, loan, .init = shm_init, .fini = shm_fini)
+{
+  dds_entity_t pub_pp, sub_pp, writer, reader;
+  dds_return_t ret;
+  void *sample;
+
+  create_matched_pair ("ddsc_shm_loan", &pub_pp, &sub_pp, &writer, &reader);
+
+  /* a loan that is not written can be returned */
+  ret = dds_loan_sample (writer, &sample);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+  ret = dds_return_loan (writer, &sample, 1);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+
+  for (int32_t i = 0; i < SHM_NCHUNKS; i++)
+  {
+    ret = dds_loan_sample (writer, &sample);
+    CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+    Space_Type1 *s = sample;
+    s->long_1 = i;
+    s->long_2 = 2 * i;
+    s->long_3 = 3 * i;
+    ret = dds_write (writer, sample);
+    CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+  }
+  ret = dds_wait_for_acks (writer, DDS_SECS (10));
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+
+  void *ptrs[SHM_NCHUNKS] = { NULL };
+  dds_sample_info_t si[SHM_NCHUNKS];
+  ret = dds_take (reader, ptrs, si, SHM_NCHUNKS, SHM_NCHUNKS);
+  CU_ASSERT_FATAL (ret == SHM_NCHUNKS);
+  for (int32_t i = 0; i < SHM_NCHUNKS; i++)
+  {
+    const Space_Type1 *s = ptrs[i];
+    CU_ASSERT (si[i].valid_data && s->long_1 == i && s->long_2 == 2 * i && s->long_3 == 3 * i);
+  }
+
+  /* the writer is done with the samples, but the reader's loan refers to the
+     very same chunks, so the pool is exhausted until the loan is returned */
+  ret = dds_loan_sample (writer, &sample);
+  CU_ASSERT (ret == DDS_RETCODE_OUT_OF_RESOURCES);
+  ret = dds_return_loan (reader, ptrs, SHM_NCHUNKS);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+  ret = dds_loan_sample (writer, &sample);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+  ret = dds_return_loan (writer, &sample, 1);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+
+  ret = dds_delete (pub_pp);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+  ret = dds_delete (sub_pp);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+}
+
+static void stall_receive_thread (dds_entity_t reader, void *varg)
+{
+  ddsrt_atomic_uint32_t *stalled = varg;
+  (void) reader;
+  ddsrt_atomic_st32 (stalled, 1);
+  dds_sleepfor (DDS_SECS (1));
+}
+
+CU_Test (ddsc_shm, loan_coherent, .init = shm_init, .fini = shm_fini)
+{
+  dds_entity_t pub_pp, sub_pp, pub, sub, pub_tp, sub_tp, writer, reader, writer2, reader2;
+  dds_return_t ret;
+  dds_qos_t *qos;
+  char name[100];
+
+  create_unique_topic_name ("ddsc_shm_loan_coherent", name, sizeof (name));
+  pub_pp = dds_create_participant (DDS_DOMAINID_PUB, NULL, NULL);
+  CU_ASSERT_FATAL (pub_pp > 0);
+  sub_pp = dds_create_participant (DDS_DOMAINID_SUB, NULL, NULL);
+  CU_ASSERT_FATAL (sub_pp > 0);
+  pub_tp = dds_create_topic (pub_pp, &Space_Type1_desc, name, NULL, NULL);
+  CU_ASSERT_FATAL (pub_tp > 0);
+  sub_tp = dds_create_topic (sub_pp, &Space_Type1_desc, name, NULL, NULL);
+  CU_ASSERT_FATAL (sub_tp > 0);
+
+  qos = dds_create_qos ();
+  dds_qset_reliability (qos, DDS_RELIABILITY_RELIABLE, DDS_INFINITY);
+  dds_qset_history (qos, DDS_HISTORY_KEEP_ALL, 0);
+  dds_qset_presentation (qos, DDS_PRESENTATION_TOPIC, true, false);
+  pub = dds_create_publisher (pub_pp, qos, NULL);
+  CU_ASSERT_FATAL (pub > 0);
+  sub = dds_create_subscriber (sub_pp, qos, NULL);
+  CU_ASSERT_FATAL (sub > 0);
+  writer = dds_create_writer (pub, pub_tp, qos, NULL);
+  CU_ASSERT_FATAL (writer > 0);
+  reader = dds_create_reader (sub, sub_tp, qos, NULL);
+  CU_ASSERT_FATAL (reader > 0);
+  dds_delete_qos (qos);
+
+  dds_publication_matched_status_t pm;
+  dds_time_t tend = dds_time () + DDS_SECS (10);
+  do {
+    ret = dds_get_publication_matched_status (writer, &pm);
+    CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+    if (pm.current_count == 0)
+      dds_sleepfor (DDS_MSECS (10));
+  } while (pm.current_count == 0 && dds_time () < tend);
+  CU_ASSERT_FATAL (pm.current_count == 1);
+  CU_ASSERT_FATAL (writer_shm_locators (writer) > 0);
+
+  /* a second pair outside the coherent set, the listener of which holds up the
+     receive thread of the subscribing side */
+  ddsrt_atomic_uint32_t stalled = DDSRT_ATOMIC_UINT32_INIT (0);
+  dds_listener_t *list = dds_create_listener (&stalled);
+  dds_lset_data_available (list, stall_receive_thread);
+  writer2 = dds_create_writer (pub_pp, pub_tp, NULL, NULL);
+  CU_ASSERT_FATAL (writer2 > 0);
+  reader2 = dds_create_reader (sub_pp, sub_tp, NULL, list);
+  CU_ASSERT_FATAL (reader2 > 0);
+  dds_delete_listener (list);
+  tend = dds_time () + DDS_SECS (10);
+  do {
+    ret = dds_get_publication_matched_status (writer2, &pm);
+    CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+    if (pm.current_count == 0)
+      dds_sleepfor (DDS_MSECS (10));
+  } while (pm.current_count == 0 && dds_time () < tend);
+  CU_ASSERT_FATAL (pm.current_count == 1);
+
+  /* the samples of the set are acknowledged, and so released by the writer,
+     before the set is complete: the reader must keep the chunks alive until
+     it delivers the set */
+  ret = dds_begin_coherent (writer);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+  for (int32_t i = 0; i < SHM_NCHUNKS / 2; i++)
+  {
+    void *sample;
+    ret = dds_loan_sample (writer, &sample);
+    CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+    Space_Type1 *s = sample;
+    s->long_1 = i;
+    s->long_2 = 2 * i;
+    s->long_3 = 3 * i;
+    ret = dds_write (writer, sample);
+    CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+  }
+  /* the samples of a coherent set are batched, but may be sent early */
+  dds_write_flush (writer);
+  ret = dds_wait_for_acks (writer, DDS_SECS (10));
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+
+  void *ptrs[SHM_NCHUNKS] = { NULL };
+  dds_sample_info_t si[SHM_NCHUNKS];
+  ret = dds_take (reader, ptrs, si, SHM_NCHUNKS, SHM_NCHUNKS);
+  CU_ASSERT_FATAL (ret == 0);
+
+  /* ending the set releases the writer's last references to the chunks while
+     the subscribing side is unable to process the end of the set */
+  ret = dds_write (writer2, &(Space_Type1){ 0, 0, 0 });
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+  while (!ddsrt_atomic_ld32 (&stalled))
+    dds_sleepfor (DDS_MSECS (1));
+  ret = dds_end_coherent (writer);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+  ret = dds_wait_for_acks (writer, DDS_SECS (10));
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+  ret = dds_take (reader, ptrs, si, SHM_NCHUNKS, SHM_NCHUNKS);
+  CU_ASSERT_FATAL (ret == SHM_NCHUNKS / 2);
+  for (int32_t i = 0; i < SHM_NCHUNKS / 2; i++)
+  {
+    const Space_Type1 *s = ptrs[i];
+    CU_ASSERT (si[i].valid_data && s->long_1 == i && s->long_2 == 2 * i && s->long_3 == 3 * i);
+  }
+  ret = dds_return_loan (reader, ptrs, ret);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+
+  ret = dds_delete (pub_pp);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+  ret = dds_delete (sub_pp);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+}
+
+/* Start of the ring header in ddsi_shm.c */
+struct shm_ring_prefix {
+  uint32_t magic;
+  uint32_t size;
+  ddsrt_atomic_uint32_t closed;
+  ddsrt_atomic_uint32_t lock;
+  ddsrt_atomic_uint32_t wakeup;
+  ddsrt_atomic_uint32_t waiting;
+  uint32_t owner;
+};
+
+/* Name of the receive ring of the domain of entity "e", following ddsi_shm.c,
+   returns false if the domain has no shared memory transport */
+static bool shm_ring_name_of (dds_entity_t e, char *name, size_t size)
+{
+  struct dds_entity *x;
+  dds_return_t ret = dds_entity_pin (e, &x);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+  const struct ddsi_domaingv *gv = &x->m_domain->gv;
+  const bool exists = (gv->shm_conn != NULL);
+  if (exists)
+  {
+    const unsigned char *a = gv->loc_shm.address;
+    (void) snprintf (name, size, "/cyclonedds-shm-%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x-%"PRIu32,
+                     a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], a[8], a[9], a[10], a[11], a[12], a[13], a[14], a[15], gv->loc_shm.port);
+  }
+  dds_entity_unpin (x);
+  return exists;
+}
+
+CU_Test (ddsc_shm, dead_lock_holder, .init = shm_init, .fini = shm_fini)
+{
+  dds_entity_t pub_pp, sub_pp, writer, reader;
+  struct stat st;
+  char name[64];
+  dds_return_t ret;
+  pid_t pid;
+  int fd;
+
+  create_matched_pair ("ddsc_shm_dead_lock_holder", &pub_pp, &sub_pp, &writer, &reader);
+
+  CU_ASSERT_FATAL (shm_ring_name_of (sub_pp, name, sizeof (name)));
+  fd = shm_open (name, O_RDWR, 0);
+  CU_ASSERT_FATAL (fd >= 0);
+  CU_ASSERT_FATAL (fstat (fd, &st) == 0);
+  CU_ASSERT ((st.st_mode & 0777) == 0600);
+  struct shm_ring_prefix *ring = mmap (NULL, sizeof (*ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  CU_ASSERT_FATAL (ring != MAP_FAILED);
+  close (fd);
+
+  /* make it look like a process died while holding the lock on the reader's ring */
+  pid = fork ();
+  CU_ASSERT_FATAL (pid >= 0);
+  if (pid == 0)
+    _exit (0);
+  CU_ASSERT_FATAL (waitpid (pid, NULL, 0) == pid);
+  ddsrt_atomic_st32 (&ring->lock, (uint32_t) pid);
+
+  for (int32_t i = 0; i < 10; i++)
+  {
+    Space_Type1 s = { i, i, i };
+    ret = dds_write (writer, &s);
+    CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+  }
+  ret = dds_wait_for_acks (writer, DDS_SECS (10));
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+  CU_ASSERT (ddsrt_atomic_ld32 (&ring->lock) != (uint32_t) pid);
+  munmap (ring, sizeof (*ring));
+
+  Space_Type1 rs[10];
+  void *ptrs[10];
+  dds_sample_info_t si[10];
+  for (int i = 0; i < 10; i++)
+    ptrs[i] = &rs[i];
+  ret = dds_take (reader, ptrs, si, 10, 10);
+  CU_ASSERT_FATAL (ret == 10);
+
+  ret = dds_delete (pub_pp);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+  ret = dds_delete (sub_pp);
+  CU_ASSERT_FATAL (ret == DDS_RETCODE_OK);
+}
+
+static uint32_t shm_ring_owner (const char *name)
+{
+  struct shm_ring_prefix *ring;
+  uint32_t owner;
+  int fd = shm_open (name, O_RDONLY, 0);
+  CU_ASSERT_FATAL (fd >= 0);
+  ring = mmap (NULL, sizeof (*ring), PROT_READ, MAP_SHARED, fd, 0);
+  CU_ASSERT_FATAL (ring != MAP_FAILED);
+  close (fd);
+  owner = ring->owner;
+  munmap (ring, sizeof (*ring));
+  return owner;
+}
+
+CU_Test (ddsc_shm, ring_owner)
+{
+  /* A ring that exists already is taken over only if its owner is gone: the
+     port number need not be unique (e.g., a different network namespace) */
+  char *conf = ddsrt_expand_envvars (DDS_CONFIG_SHM_FIXED_PORT, DDS_DOMAINID_PUB);
+  struct shm_ring_prefix *ring;
+  char name[64], name1[64];
+  dds_entity_t dom;
+  int fd, pfd[2];
+  pid_t pid;
+
+  dom = dds_create_domain (DDS_DOMAINID_PUB, conf);
+  CU_ASSERT_FATAL (dom > 0);
+  CU_ASSERT_FATAL (shm_ring_name_of (dom, name, sizeof (name)));
+  CU_ASSERT (shm_ring_owner (name) == (uint32_t) getpid ());
+  CU_ASSERT_FATAL (dds_delete (dom) == DDS_RETCODE_OK);
+  CU_ASSERT (shm_open (name, O_RDONLY, 0) < 0);
+
+  /* a ring with the same name, owned by a live process */
+  CU_ASSERT_FATAL (pipe (pfd) == 0);
+  pid = fork ();
+  CU_ASSERT_FATAL (pid >= 0);
+  if (pid == 0)
+  {
+    char c;
+    close (pfd[1]);
+    ssize_t r = read (pfd[0], &c, 1);
+    _exit (r == 0 ? 0 : 1);
+  }
+  close (pfd[0]);
+  fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  CU_ASSERT_FATAL (fd >= 0);
+  CU_ASSERT_FATAL (ftruncate (fd, 4096) == 0);
+  ring = mmap (NULL, sizeof (*ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  CU_ASSERT_FATAL (ring != MAP_FAILED);
+  close (fd);
+  memset (ring, 0, sizeof (*ring));
+  ring->owner = (uint32_t) pid;
+
+  /* must be left alone, and so the domain can't use shared memory */
+  dom = dds_create_domain (DDS_DOMAINID_PUB, conf);
+  CU_ASSERT_FATAL (dom > 0);
+  CU_ASSERT (!shm_ring_name_of (dom, name1, sizeof (name1)));
+  CU_ASSERT (shm_ring_owner (name) == (uint32_t) pid);
+  CU_ASSERT_FATAL (dds_delete (dom) == DDS_RETCODE_OK);
+  CU_ASSERT (shm_ring_owner (name) == (uint32_t) pid);
+
+  /* once the owner is gone, it gets replaced */
+  close (pfd[1]);
+  CU_ASSERT_FATAL (waitpid (pid, NULL, 0) == pid);
+  dom = dds_create_domain (DDS_DOMAINID_PUB, conf);
+  CU_ASSERT_FATAL (dom > 0);
+  CU_ASSERT_FATAL (shm_ring_name_of (dom, name1, sizeof (name1)));
+  CU_ASSERT (strcmp (name, name1) == 0);
+  CU_ASSERT (shm_ring_owner (name) == (uint32_t) getpid ());
+  /* the old mapping remains valid */
+  CU_ASSERT (ring->owner == (uint32_t) pid);
+  munmap (ring, sizeof (*ring));
+  CU_ASSERT_FATAL (dds_delete (dom) == DDS_RETCODE_OK);
+  CU_ASSERT (shm_open (name, O_RDONLY, 0) < 0);
+  ddsrt_free (conf);
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright(c) 2020 ADLINK Technology Limited and others
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License v. 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0, or the Eclipse Distribution License
+ * v. 1.0 which is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "dds/dds.h"
+#include "dds/ddsrt/environ.h"
+#include "dds/ddsrt/heap.h"
+#include "CUnit/Test.h"
+#include "RoundTrip.h"
+#include "test_util.h"
+#include "test_pubsub.h"
+
+dds_entity_t pubsub_create_domain (dds_domainid_t domid, const char *config)
+{
+  const size_t size = strlen (PUBSUB_CONFIG) + strlen (config) + 1;
+  char *config_full = ddsrt_malloc (size);
+  (void) snprintf (config_full, size, "%s%s", PUBSUB_CONFIG, config);
+  char *conf = ddsrt_expand_envvars (config_full, domid);
+  dds_entity_t dom = dds_create_domain (domid, conf);
+  CU_ASSERT_FATAL (dom > 0);
+  ddsrt_free (conf);
+  ddsrt_free (config_full);
+  return dom;
+}
+
+void pubsub_init (struct pubsub *ps, const char *pub_config, const char *sub_config, const dds_qos_t *qos)
+{
+  char topic_name[100];
+  dds_entity_t pub_par, sub_par, pub_top, sub_top;
+  dds_publication_matched_status_t pm;
+  dds_subscription_matched_status_t sm;
+  dds_qos_t *qos_default = NULL;
+
+  if (qos == NULL)
+  {
+    qos = qos_default = dds_create_qos ();
+    dds_qset_reliability (qos_default, DDS_RELIABILITY_RELIABLE, DDS_INFINITY);
+    dds_qset_history (qos_default, DDS_HISTORY_KEEP_ALL, 0);
+  }
+  ps->pub_dom = pubsub_create_domain (PUBSUB_DOMAINID_PUB, pub_config);
+  ps->sub_dom = pubsub_create_domain (PUBSUB_DOMAINID_SUB, sub_config);
+  create_unique_topic_name ("ddsc_pubsub", topic_name, sizeof (topic_name));
+  pub_par = dds_create_participant (PUBSUB_DOMAINID_PUB, NULL, NULL);
+  CU_ASSERT_FATAL (pub_par > 0);
+  sub_par = dds_create_participant (PUBSUB_DOMAINID_SUB, NULL, NULL);
+  CU_ASSERT_FATAL (sub_par > 0);
+  pub_top = dds_create_topic (pub_par, &RoundTripModule_DataType_desc, topic_name, qos, NULL);
+  CU_ASSERT_FATAL (pub_top > 0);
+  sub_top = dds_create_topic (sub_par, &RoundTripModule_DataType_desc, topic_name, qos, NULL);
+  CU_ASSERT_FATAL (sub_top > 0);
+  ps->writer = dds_create_writer (pub_par, pub_top, qos, NULL);
+  CU_ASSERT_FATAL (ps->writer > 0);
+  ps->reader = dds_create_reader (sub_par, sub_top, qos, NULL);
+  CU_ASSERT_FATAL (ps->reader > 0);
+  dds_delete_qos (qos_default);
+
+  dds_time_t tend = dds_time () + DDS_SECS (10);
+  do {
+    CU_ASSERT_FATAL (dds_get_publication_matched_status (ps->writer, &pm) == DDS_RETCODE_OK);
+    CU_ASSERT_FATAL (dds_get_subscription_matched_status (ps->reader, &sm) == DDS_RETCODE_OK);
+    if (pm.current_count == 1 && sm.current_count == 1)
+      break;
+    dds_sleepfor (DDS_MSECS (10));
+  } while (dds_time () < tend);
+  CU_ASSERT_FATAL (pm.current_count == 1 && sm.current_count == 1);
+}
+
+void pubsub_fini (struct pubsub *ps)
+{
+  dds_delete (ps->pub_dom);
+  dds_delete (ps->sub_dom);
+}
+
+void pubsub_write_sample (dds_entity_t writer, uint32_t size, uint32_t seed)
+{
+  RoundTripModule_DataType sample;
+  sample.payload._length = sample.payload._maximum = size;
+  sample.payload._buffer = ddsrt_malloc (size);
+  sample.payload._release = false;
+  for (uint32_t i = 0; i < size; i++)
+    sample.payload._buffer[i] = (uint8_t) (seed + i);
+  CU_ASSERT_FATAL (dds_write (writer, &sample) == DDS_RETCODE_OK);
+  ddsrt_free (sample.payload._buffer);
+}
+
+void pubsub_take_samples (dds_entity_t reader, uint32_t n, const uint32_t *sizes)
+{
+  uint32_t count = 0;
+  dds_time_t tend = dds_time () + DDS_SECS (10);
+  while (count < n && dds_time () < tend)
+  {
+    void *raw[16] = { NULL };
+    dds_sample_info_t si[16];
+    int32_t m = dds_take (reader, raw, si, 16, 16);
+    CU_ASSERT_FATAL (m >= 0);
+    for (int32_t k = 0; k < m; k++, count++)
+    {
+      const RoundTripModule_DataType *s = raw[k];
+      CU_ASSERT_FATAL (count < n);
+      CU_ASSERT_FATAL (si[k].valid_data);
+      CU_ASSERT_FATAL (s->payload._length == sizes[count]);
+      for (uint32_t i = 0; i < s->payload._length; i++)
+        CU_ASSERT_FATAL (s->payload._buffer[i] == (uint8_t) (count + i));
+    }
+    if (m > 0)
+      (void) dds_return_loan (reader, raw, m);
+    else
+      dds_sleepfor (DDS_MSECS (10));
+  }
+  CU_ASSERT_FATAL (count == n);
+}
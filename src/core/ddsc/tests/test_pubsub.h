@@ -0,0 +1,49 @@
+/*
+ * Copyright(c) 2020 ADLINK Technology Limited and others
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License v. 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0, or the Eclipse Distribution License
+ * v. 1.0 which is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+ */
+#ifndef _TEST_PUBSUB_H_
+#define _TEST_PUBSUB_H_
+
+#include <stdint.h>
+
+#include "dds/dds.h"
+
+/* Domain ids and configuration for a pair of domains that communicate with
+   each other: the external domain id maps both to the same port numbers */
+#define PUBSUB_DOMAINID_PUB 0
+#define PUBSUB_DOMAINID_SUB 1
+#define PUBSUB_CONFIG "${CYCLONEDDS_URI}${CYCLONEDDS_URI:+,}<Discovery><ExternalDomainId>0</ExternalDomainId></Discovery>"
+
+/* A writer and a reader of a RoundTripModule_DataType topic, each in its own
+   domain, matched with each other */
+struct pubsub {
+  dds_entity_t pub_dom, sub_dom;
+  dds_entity_t writer, reader;
+};
+
+/* Creates the domains using PUBSUB_CONFIG followed by pub_config and
+   sub_config (either may be an empty string), the entities, and waits for
+   them to match.  A null qos means reliable with keep-all history. */
+void pubsub_init (struct pubsub *ps, const char *pub_config, const char *sub_config, const dds_qos_t *qos);
+void pubsub_fini (struct pubsub *ps);
+
+/* Creates a domain that can communicate with those of pubsub_init */
+dds_entity_t pubsub_create_domain (dds_domainid_t domid, const char *config);
+
+/* Writes a sample with a payload of "size" bytes, the value of byte i being
+   (seed + i) mod 256 */
+void pubsub_write_sample (dds_entity_t writer, uint32_t size, uint32_t seed);
+
+/* Takes "n" samples, checking they were written by pubsub_write_sample with
+   the given sizes and seeds 0 .. n-1 */
+void pubsub_take_samples (dds_entity_t reader, uint32_t n, const uint32_t *sizes);
+
+#endif /* _TEST_PUBSUB_H_ */
@@ -10,9 +10,13 @@
  * SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
  */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "dds/dds.h"
-#include "Space.h"
-#include "CUnit/Test.h"
+#include "dds/ddsrt/environ.h"
+#include "dds/ddsrt/heap.h"
+#include "dds/ddsrt/io.h"
+#include "test_common.h"
 
 #define MAX_SAMPLES  (7)
 CU_Test(ddsc_transient_local, late_joiner)
@@ -95,3 +99,109 @@ CU_Test(ddsc_transient_local, late_joiner)
     dds_delete(par);
     dds_delete_qos(qos);
 }
+
+#define DDS_DOMAINID_PUB 0
+#define DDS_DOMAINID_SUB 1
+#define DDS_CONFIG_HISTORICAL_DATA "${CYCLONEDDS_URI}${CYCLONEDDS_URI:+,}<Discovery><ExternalDomainId>0</ExternalDomainId></Discovery><Internal><BurstSize><MaxHistoricalData>%s</MaxHistoricalData></BurstSize></Internal>"
+#define REMOTE_INSTANCES (2000)
+
+static void remote_late_joiner (const char *max_historical_data)
+{
+    char topic_name[100];
+    char *conf_fmt, *conf;
+    dds_entity_t pub_dom, sub_dom, pub_par, sub_par, pub_top, sub_top, wrt, rdr;
+    dds_qos_t *qos;
+    dds_return_t ret;
+    Space_Type1 sample = { 0, 0, 0 };
+    int32_t *seen;
+    int32_t count = 0;
+
+    /* Two domains mapped to the same port numbers, with the writer's domain
+       streaming historical data in small bursts */
+    conf_fmt = ddsrt_expand_envvars(DDS_CONFIG_HISTORICAL_DATA, DDS_DOMAINID_PUB);
+    (void) ddsrt_asprintf(&conf, conf_fmt, max_historical_data);
+    pub_dom = dds_create_domain(DDS_DOMAINID_PUB, conf);
+    CU_ASSERT_FATAL(pub_dom > 0);
+    ddsrt_free(conf);
+    ddsrt_free(conf_fmt);
+    conf_fmt = ddsrt_expand_envvars(DDS_CONFIG_HISTORICAL_DATA, DDS_DOMAINID_SUB);
+    (void) ddsrt_asprintf(&conf, conf_fmt, max_historical_data);
+    sub_dom = dds_create_domain(DDS_DOMAINID_SUB, conf);
+    CU_ASSERT_FATAL(sub_dom > 0);
+    ddsrt_free(conf);
+    ddsrt_free(conf_fmt);
+
+    qos = dds_create_qos();
+    dds_qset_durability(qos, DDS_DURABILITY_TRANSIENT_LOCAL);
+    dds_qset_reliability(qos, DDS_RELIABILITY_RELIABLE, DDS_INFINITY);
+    pub_par = dds_create_participant(DDS_DOMAINID_PUB, NULL, NULL);
+    CU_ASSERT_FATAL(pub_par > 0);
+    sub_par = dds_create_participant(DDS_DOMAINID_SUB, NULL, NULL);
+    CU_ASSERT_FATAL(sub_par > 0);
+    create_unique_topic_name("ddsc_transient_local_remote", topic_name, sizeof(topic_name));
+    pub_top = dds_create_topic(pub_par, &Space_Type1_desc, topic_name, qos, NULL);
+    CU_ASSERT_FATAL(pub_top > 0);
+    sub_top = dds_create_topic(sub_par, &Space_Type1_desc, topic_name, qos, NULL);
+    CU_ASSERT_FATAL(sub_top > 0);
+
+    /* Rewriting the even instances leaves holes in the sequence numbers retained
+       by the writer, which must be gapped */
+    wrt = dds_create_writer(pub_par, pub_top, qos, NULL);
+    CU_ASSERT_FATAL(wrt > 0);
+    for (int32_t i = 0; i < REMOTE_INSTANCES; i++) {
+        sample.long_1 = i;
+        ret = dds_write(wrt, &sample);
+        CU_ASSERT_EQUAL_FATAL(ret, DDS_RETCODE_OK);
+    }
+    sample.long_2 = 1;
+    for (int32_t i = 0; i < REMOTE_INSTANCES; i += 2) {
+        sample.long_1 = i;
+        ret = dds_write(wrt, &sample);
+        CU_ASSERT_EQUAL_FATAL(ret, DDS_RETCODE_OK);
+    }
+
+    dds_qset_history(qos, DDS_HISTORY_KEEP_ALL, 0);
+    rdr = dds_create_reader(sub_par, sub_top, qos, NULL);
+    CU_ASSERT_FATAL(rdr > 0);
+
+    seen = ddsrt_malloc(REMOTE_INSTANCES * sizeof(*seen));
+    for (int32_t i = 0; i < REMOTE_INSTANCES; i++)
+        seen[i] = -1;
+    dds_time_t tend = dds_time() + DDS_SECS(10);
+    while (count < REMOTE_INSTANCES && dds_time() < tend) {
+        void *raw[100] = { NULL };
+        dds_sample_info_t si[100];
+        int32_t n = dds_take(rdr, raw, si, 100, 100);
+        CU_ASSERT_FATAL(n >= 0);
+        for (int32_t i = 0; i < n; i++) {
+            const Space_Type1 *s = raw[i];
+            CU_ASSERT_FATAL(si[i].valid_data);
+            CU_ASSERT_FATAL(s->long_1 >= 0 && s->long_1 < REMOTE_INSTANCES);
+            CU_ASSERT_FATAL(seen[s->long_1] == -1);
+            seen[s->long_1] = s->long_2;
+            count++;
+        }
+        if (n > 0)
+            (void) dds_return_loan(rdr, raw, n);
+        else
+            dds_sleepfor(DDS_MSECS(10));
+    }
+    CU_ASSERT_EQUAL_FATAL(count, REMOTE_INSTANCES);
+    for (int32_t i = 0; i < REMOTE_INSTANCES; i++)
+        CU_ASSERT_EQUAL(seen[i], (i % 2) == 0 ? 1 : 0);
+
+    ddsrt_free(seen);
+    dds_delete_qos(qos);
+    dds_delete(pub_dom);
+    dds_delete(sub_dom);
+}
+
+CU_Test(ddsc_transient_local, remote_late_joiner_streamed, .timeout = 30)
+{
+    remote_late_joiner("4 kB");
+}
+
+CU_Test(ddsc_transient_local, remote_late_joiner_nack_driven, .timeout = 30)
+{
+    remote_late_joiner("0 B");
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright(c) 2020 ADLINK Technology Limited and others
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License v. 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0, or the Eclipse Distribution License
+ * v. 1.0 which is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+ */
+#include "dds/dds.h"
+#include "dds/ddsi/ddsi_domaingv.h"
+#include "dds/ddsi/ddsi_tran.h"
+#include "dds/ddsi/q_xmsg.h"
+#include "dds__entity.h"
+#include "dds__types.h"
+
+#include "test_common.h"
+#include "test_pubsub.h"
+
+#define DDS_CONFIG_PRIO "<Internal><SendAsync>true</SendAsync><PriorityScheduling><Enable>true</Enable><DiffServ>10:46,0:10</DiffServ></PriorityScheduling></Internal>"
+
+static struct pubsub g_ps;
+
+static void transport_priority_init (void)
+{
+  /* a high-priority writer (with its own socket) with a latency budget */
+  dds_qos_t *qos = dds_create_qos ();
+  dds_qset_reliability (qos, DDS_RELIABILITY_RELIABLE, DDS_INFINITY);
+  dds_qset_history (qos, DDS_HISTORY_KEEP_ALL, 0);
+  dds_qset_transport_priority (qos, 10);
+  dds_qset_latency_budget (qos, DDS_MSECS (500));
+  pubsub_init (&g_ps, DDS_CONFIG_PRIO, "", qos);
+  dds_delete_qos (qos);
+}
+
+static void transport_priority_fini (void)
+{
+  pubsub_fini (&g_ps);
+}
+
+CU_Test(ddsc_transport_priority, latency_budget, .init = transport_priority_init, .fini = transport_priority_fini, .timeout = 30)
+{
+  /* the first sample goes out immediately because the heartbeat that comes with
+     it requests an acknowledgement, the next ones are held back until the budget
+     has expired and then go out together */
+  static const uint32_t sizes[] = { 100, 200, 300, 400 };
+  const uint32_t n = (uint32_t) (sizeof (sizes) / sizeof (sizes[0]));
+  const dds_time_t tstart = dds_time ();
+  for (uint32_t i = 0; i < n; i++)
+    pubsub_write_sample (g_ps.writer, sizes[i], i);
+  dds_sleepfor (DDS_MSECS (200));
+  void *raw[16] = { NULL };
+  dds_sample_info_t si[16];
+  const int32_t nread = dds_read (g_ps.reader, raw, si, 16, 16);
+  CU_ASSERT_FATAL (nread == 0 || nread == 1);
+  if (nread > 0)
+    (void) dds_return_loan (g_ps.reader, raw, nread);
+  pubsub_take_samples (g_ps.reader, n, sizes);
+  CU_ASSERT (dds_time () - tstart >= DDS_MSECS (500));
+
+  /* a writer without a latency budget sends them right away (the latency
+     budget can't be changed on an existing writer) */
+  dds_qos_t *qos = dds_create_qos ();
+  CU_ASSERT_FATAL (dds_get_qos (g_ps.writer, qos) == DDS_RETCODE_OK);
+  dds_qset_latency_budget (qos, 0);
+  const dds_entity_t wr = dds_create_writer (dds_get_participant (g_ps.writer), dds_get_topic (g_ps.writer), qos, NULL);
+  CU_ASSERT_FATAL (wr > 0);
+  dds_delete_qos (qos);
+  dds_publication_matched_status_t pm;
+  dds_time_t tend = dds_time () + DDS_SECS (10);
+  while (dds_get_publication_matched_status (wr, &pm) == DDS_RETCODE_OK && pm.current_count == 0 && dds_time () < tend)
+    dds_sleepfor (DDS_MSECS (10));
+  CU_ASSERT_FATAL (pm.current_count == 1);
+  const dds_time_t tstart1 = dds_time ();
+  for (uint32_t i = 0; i < n; i++)
+    pubsub_write_sample (wr, sizes[i], i);
+  pubsub_take_samples (g_ps.reader, n, sizes);
+  CU_ASSERT (dds_time () - tstart1 < DDS_MSECS (500));
+}
+
+CU_Test(ddsc_transport_priority, diffserv, .init = transport_priority_init, .fini = transport_priority_fini, .timeout = 30)
+{
+  /* DiffServ is "10:46,0:10": a writer uses the socket of the class with the
+     highest priority not exceeding its own, and that socket has the class'
+     DSCP set */
+  dds_entity *x;
+  CU_ASSERT_FATAL (dds_entity_pin (g_ps.writer, &x) == DDS_RETCODE_OK);
+  const struct ddsi_domaingv *gv = &x->m_domain->gv;
+  CU_ASSERT_FATAL (gv->n_xmit_classes == 2);
+  CU_ASSERT (gv->xmit_classes[0].min_priority == 10 && gv->xmit_classes[0].diffserv == 46 << 2);
+  CU_ASSERT (gv->xmit_classes[1].min_priority == 0 && gv->xmit_classes[1].diffserv == 10 << 2);
+  CU_ASSERT (nn_xmit_conn_for_priority (gv, 1000) == gv->xmit_classes[0].conn);
+  CU_ASSERT (nn_xmit_conn_for_priority (gv, 10) == gv->xmit_classes[0].conn);
+  CU_ASSERT (nn_xmit_conn_for_priority (gv, 9) == gv->xmit_classes[1].conn);
+  CU_ASSERT (nn_xmit_conn_for_priority (gv, 0) == gv->xmit_classes[1].conn);
+  CU_ASSERT (nn_xmit_conn_for_priority (gv, -1) == gv->xmit_conn);
+  CU_ASSERT (gv->xmit_classes[0].conn != gv->xmit_conn && gv->xmit_classes[1].conn != gv->xmit_conn);
+  if (gv->m_factory->m_kind == NN_LOCATOR_KIND_UDPv4)
+  {
+    for (uint32_t i = 0; i < gv->n_xmit_classes; i++)
+    {
+      int tos = 0;
+      socklen_t tos_size = (socklen_t) sizeof (tos);
+      CU_ASSERT_FATAL (ddsrt_getsockopt (ddsi_conn_handle (gv->xmit_classes[i].conn), IPPROTO_IP, IP_TOS, &tos, &tos_size) == DDS_RETCODE_OK);
+      CU_ASSERT (tos == gv->xmit_classes[i].diffserv);
+    }
+  }
+  dds_entity_unpin (x);
+
+  /* and data still arrives */
+  static const uint32_t sizes[] = { 100 };
+  pubsub_write_sample (g_ps.writer, sizes[0], 0);
+  pubsub_take_samples (g_ps.reader, 1, sizes);
+}
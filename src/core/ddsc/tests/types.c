@@ -11,6 +11,8 @@
  */
 #include "CUnit/Test.h"
 #include "dds/dds.h"
+#include "dds/ddsi/ddsi_serdata.h"
+#include "dds__topic.h"
 #include "TypesArrayKey.h"
 
 
@@ -120,3 +122,67 @@ CU_Test(ddsc_types, alltypeskey)
     dds_delete(top);
     dds_delete(par);
 }
+
+struct type_key_after_bst {
+    dds_sequence_t s; /* sequence<string<8>> */
+    char a[2][9];
+    int32_t k;
+};
+
+static const dds_topic_descriptor_t type_key_after_bst_desc =
+{
+    .m_size = sizeof (struct type_key_after_bst),
+    .m_align = sizeof (void *),
+    .m_flagset = DDS_TOPIC_NO_OPTIMIZE | DDS_TOPIC_FIXED_KEY,
+    .m_nkeys = 1,
+    .m_typename = "type_key_after_bst",
+    .m_keys = (const dds_key_descriptor_t[]) { { "k", 8 } },
+    .m_nops = 4,
+    .m_ops = (const uint32_t[]) {
+        DDS_OP_ADR | DDS_OP_TYPE_SEQ | DDS_OP_SUBTYPE_BST, offsetof (struct type_key_after_bst, s), 9,
+        DDS_OP_ADR | DDS_OP_TYPE_ARR | DDS_OP_SUBTYPE_BST, offsetof (struct type_key_after_bst, a), 2, 0, 9,
+        DDS_OP_ADR | DDS_OP_TYPE_4BY | DDS_OP_FLAG_KEY, offsetof (struct type_key_after_bst, k),
+        DDS_OP_RTS
+    },
+    .m_meta = ""
+};
+
+CU_Test(ddsc_types, key_after_bounded_strings)
+{
+    /* The key of received data is extracted from the serialized form, which
+       requires skipping the preceding sequence and array of bounded strings;
+       it must match the key computed from the sample */
+    char elems[3][9] = { "a", "bc", "def" };
+    struct type_key_after_bst samples[] = {
+        { .s = { ._length = 0, ._maximum = 0, ._buffer = NULL }, .a = { "x", "yz" }, .k = 1 },
+        { .s = { ._length = 3, ._maximum = 3, ._buffer = (uint8_t *) elems }, .a = { "", "12345678" }, .k = 0x12345678 }
+    };
+    dds_entity_t par, top;
+    struct dds_topic *tp;
+    dds_return_t rc;
+
+    par = dds_create_participant(DDS_DOMAIN_DEFAULT, NULL, NULL);
+    CU_ASSERT_FATAL(par > 0);
+    top = dds_create_topic(par, &type_key_after_bst_desc, "KeyAfterBoundedStrings", NULL, NULL);
+    CU_ASSERT_FATAL(top > 0);
+    rc = dds_topic_pin(top, &tp);
+    CU_ASSERT_EQUAL_FATAL(rc, DDS_RETCODE_OK);
+    for (size_t i = 0; i < sizeof (samples) / sizeof (samples[0]); i++)
+    {
+        struct ddsi_serdata *sd, *sd_rx;
+        ddsrt_iovec_t iov;
+        sd = ddsi_serdata_from_sample(tp->m_stopic, SDK_DATA, &samples[i]);
+        CU_ASSERT_FATAL(sd != NULL);
+        iov.iov_len = ddsi_serdata_size(sd);
+        iov.iov_base = dds_alloc(iov.iov_len);
+        ddsi_serdata_to_ser(sd, 0, iov.iov_len, iov.iov_base);
+        sd_rx = ddsi_serdata_from_ser_iov(tp->m_stopic, SDK_DATA, 1, &iov, iov.iov_len);
+        CU_ASSERT_FATAL(sd_rx != NULL);
+        CU_ASSERT(ddsi_serdata_eqkey(sd, sd_rx));
+        ddsi_serdata_unref(sd_rx);
+        ddsi_serdata_unref(sd);
+        dds_free(iov.iov_base);
+    }
+    dds_topic_unpin(tp);
+    dds_delete(par);
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright(c) 2020 ADLINK Technology Limited and others
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License v. 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0, or the Eclipse Distribution License
+ * v. 1.0 which is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+ */
+#include <string.h>
+#include <sys/time.h>
+
+#include "dds/dds.h"
+#include "dds/ddsrt/environ.h"
+#include "dds/ddsrt/heap.h"
+#include "dds/ddsrt/sockets.h"
+#include "dds/ddsi/ddsi_domaingv.h"
+#include "dds/ddsi/ddsi_tran.h"
+#include "dds__entity.h"
+
+#include "test_common.h"
+
+#define DDS_DOMAINID 0
+#define DDS_CONFIG_IO_URING "${CYCLONEDDS_URI}${CYCLONEDDS_URI:+,}<Internal><UseIoUring>true</UseIoUring></Internal>"
+
+/* more destinations than fit in a single batch of io_uring requests */
+#define N_DST 40
+
+static dds_entity_t g_domain;
+
+static void udp_transport_init (void)
+{
+  char *conf = ddsrt_expand_envvars (DDS_CONFIG_IO_URING, DDS_DOMAINID);
+  g_domain = dds_create_domain (DDS_DOMAINID, conf);
+  CU_ASSERT_FATAL (g_domain > 0);
+  ddsrt_free (conf);
+}
+
+static void udp_transport_fini (void)
+{
+  dds_delete (g_domain);
+}
+
+static ddsrt_socket_t create_receiver (const nn_locator_t *ownloc, nn_locator_t *loc)
+{
+  ddsrt_socket_t sock;
+  struct sockaddr_in addr;
+  socklen_t addrlen = sizeof (addr);
+  struct timeval tv = { .tv_sec = 5, .tv_usec = 0 };
+  CU_ASSERT_FATAL (ddsrt_socket (&sock, AF_INET, SOCK_DGRAM, 0) == DDS_RETCODE_OK);
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_ANY);
+  CU_ASSERT_FATAL (ddsrt_bind (sock, (struct sockaddr *) &addr, sizeof (addr)) == DDS_RETCODE_OK);
+  CU_ASSERT_FATAL (ddsrt_getsockname (sock, (struct sockaddr *) &addr, &addrlen) == DDS_RETCODE_OK);
+  CU_ASSERT_FATAL (ddsrt_setsockopt (sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv)) == DDS_RETCODE_OK);
+  *loc = *ownloc;
+  loc->port = ntohs (addr.sin_port);
+  return sock;
+}
+
+CU_Test(ddsc_udp_transport, write_multi, .init = udp_transport_init, .fini = udp_transport_fini, .timeout = 30)
+{
+  /* a packet sent to many destinations in one go arrives at each of them
+     exactly once and intact */
+  static const unsigned char hdr[] = "header";
+  unsigned char payload[1000];
+  ddsrt_socket_t socks[N_DST];
+  nn_locator_t locs[N_DST];
+  const nn_locator_t *dst[N_DST];
+  struct dds_entity *x;
+
+  for (size_t i = 0; i < sizeof (payload); i++)
+    payload[i] = (unsigned char) i;
+  CU_ASSERT_FATAL (dds_entity_pin (g_domain, &x) == DDS_RETCODE_OK);
+  struct ddsi_domaingv * const gv = &x->m_domain->gv;
+  CU_ASSERT_FATAL (gv->ownloc.kind == NN_LOCATOR_KIND_UDPv4);
+  CU_ASSERT_FATAL (gv->xmit_conn->m_write_multi_fn != 0);
+  for (int i = 0; i < N_DST; i++)
+  {
+    socks[i] = create_receiver (&gv->ownloc, &locs[i]);
+    dst[i] = &locs[i];
+  }
+
+  const ddsrt_iovec_t iov[2] = {
+    { .iov_base = (void *) hdr, .iov_len = sizeof (hdr) },
+    { .iov_base = payload, .iov_len = sizeof (payload) }
+  };
+  const ssize_t n = ddsi_conn_write_multi (gv->xmit_conn, N_DST, dst, 2, iov, 0);
+  CU_ASSERT (n == (ssize_t) (N_DST * (sizeof (hdr) + sizeof (payload))));
+
+  for (int i = 0; i < N_DST; i++)
+  {
+    unsigned char buf[2 * sizeof (hdr) + 2 * sizeof (payload)];
+    ssize_t r;
+    CU_ASSERT_FATAL (ddsrt_recv (socks[i], buf, sizeof (buf), 0, &r) == DDS_RETCODE_OK);
+    CU_ASSERT_FATAL (r == (ssize_t) (sizeof (hdr) + sizeof (payload)));
+    CU_ASSERT (memcmp (buf, hdr, sizeof (hdr)) == 0);
+    CU_ASSERT (memcmp (buf + sizeof (hdr), payload, sizeof (payload)) == 0);
+    /* no duplicates */
+    CU_ASSERT (ddsrt_recv (socks[i], buf, sizeof (buf), MSG_DONTWAIT, &r) == DDS_RETCODE_TRY_AGAIN);
+    ddsrt_close (socks[i]);
+  }
+  dds_entity_unpin (x);
+}
@@ -11,6 +11,9 @@
  */
 #include <assert.h>
 #include <limits.h>
+#ifndef _WIN32
+#include <poll.h>
+#endif
 
 #include "dds/dds.h"
 #include "dds/ddsrt/cdtors.h"
@@ -1108,6 +1111,199 @@ CU_Test(ddsc_waitset_triggering, on_readcondition, .init=ddsc_waitset_attached_i
 
 
 
+/**************************************************************************************************
+ *
+ * These will check that a waitset with many attached entities only returns the ones that actually
+ * triggered, that entities drop off the ready list when they stop triggering or get detached, and
+ * the edge-triggered mode.
+ *
+ *************************************************************************************************/
+/*************************************************************************************************/
+#define MANY_ATTACHMENTS 5000
+
+static dds_entity_t many_gconds[MANY_ATTACHMENTS];
+
+static void
+ddsc_waitset_many_init(void)
+{
+    ddsc_waitset_basic_init();
+    for (int i = 0; i < MANY_ATTACHMENTS; i++) {
+        many_gconds[i] = dds_create_guardcondition(participant);
+        CU_ASSERT_FATAL(many_gconds[i] > 0);
+        dds_return_t ret = dds_waitset_attach(waitset, many_gconds[i], (dds_attach_t)i);
+        CU_ASSERT_EQUAL_FATAL(ret, DDS_RETCODE_OK);
+    }
+}
+
+static void
+ddsc_waitset_many_fini(void)
+{
+    /* deleting the participant also deletes the guard conditions */
+    ddsc_waitset_basic_fini();
+}
+
+static int
+cmp_attach(const void *va, const void *vb)
+{
+    const dds_attach_t *a = va, *b = vb;
+    return (*a == *b) ? 0 : (*a < *b) ? -1 : 1;
+}
+
+CU_Test(ddsc_waitset_triggering, many_attachments, .init=ddsc_waitset_many_init, .fini=ddsc_waitset_many_fini)
+{
+    dds_attach_t triggered[4];
+    dds_return_t ret;
+
+    ret = dds_waitset_wait(waitset, triggered, 4, 0);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+
+    dds_set_guardcondition(many_gconds[10], true);
+    dds_set_guardcondition(many_gconds[2000], true);
+    dds_set_guardcondition(many_gconds[4999], true);
+    ret = dds_waitset_wait(waitset, triggered, 4, DDS_SECS(1));
+    CU_ASSERT_EQUAL_FATAL(ret, 3);
+    qsort(triggered, 3, sizeof(triggered[0]), cmp_attach);
+    CU_ASSERT_EQUAL(triggered[0], 10);
+    CU_ASSERT_EQUAL(triggered[1], 2000);
+    CU_ASSERT_EQUAL(triggered[2], 4999);
+
+    /* a guard condition that is reset is no longer returned */
+    dds_set_guardcondition(many_gconds[2000], false);
+    ret = dds_waitset_wait(waitset, triggered, 4, DDS_SECS(1));
+    CU_ASSERT_EQUAL_FATAL(ret, 2);
+    qsort(triggered, 2, sizeof(triggered[0]), cmp_attach);
+    CU_ASSERT_EQUAL(triggered[0], 10);
+    CU_ASSERT_EQUAL(triggered[1], 4999);
+
+    /* nor is a triggered one that is detached or deleted */
+    ret = dds_waitset_detach(waitset, many_gconds[10]);
+    CU_ASSERT_EQUAL_FATAL(ret, DDS_RETCODE_OK);
+    ret = dds_waitset_wait(waitset, triggered, 4, DDS_SECS(1));
+    CU_ASSERT_EQUAL_FATAL(ret, 1);
+    CU_ASSERT_EQUAL(triggered[0], 4999);
+    ret = dds_delete(many_gconds[4999]);
+    CU_ASSERT_EQUAL_FATAL(ret, DDS_RETCODE_OK);
+    ret = dds_waitset_wait(waitset, triggered, 4, 0);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = dds_waitset_get_entities(waitset, NULL, 0);
+    CU_ASSERT_EQUAL_FATAL(ret, MANY_ATTACHMENTS - 2);
+}
+
+CU_Test(ddsc_waitset_triggering, edge_triggered, .init=ddsc_waitset_many_init, .fini=ddsc_waitset_many_fini)
+{
+    dds_attach_t triggered[5];
+    dds_return_t ret;
+
+    ret = dds_waitset_set_edge_triggered(waitset, true);
+    CU_ASSERT_EQUAL_FATAL(ret, DDS_RETCODE_OK);
+    for (int i = 0; i < 5; i++)
+        dds_set_guardcondition(many_gconds[1000 * i], true);
+
+    /* an empty list only counts */
+    ret = dds_waitset_wait(waitset, NULL, 0, 0);
+    CU_ASSERT_EQUAL_FATAL(ret, 5);
+
+    /* each event is reported once, those that don't fit on the next call */
+    ret = dds_waitset_wait(waitset, triggered, 2, DDS_SECS(1));
+    CU_ASSERT_EQUAL_FATAL(ret, 2);
+    ret = dds_waitset_wait(waitset, triggered + 2, 2, DDS_SECS(1));
+    CU_ASSERT_EQUAL_FATAL(ret, 2);
+    ret = dds_waitset_wait(waitset, triggered + 4, 2, DDS_SECS(1));
+    CU_ASSERT_EQUAL_FATAL(ret, 1);
+    qsort(triggered, 5, sizeof(triggered[0]), cmp_attach);
+    for (int i = 0; i < 5; i++)
+        CU_ASSERT_EQUAL(triggered[i], 1000 * i);
+
+    /* still triggered, but no new events */
+    ret = dds_waitset_wait(waitset, triggered, 5, DDS_MSECS(10));
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    ret = dds_triggered(many_gconds[0]);
+    CU_ASSERT_FATAL(ret > 0);
+
+    /* a new trigger is a new event */
+    dds_set_guardcondition(many_gconds[3000], false);
+    dds_set_guardcondition(many_gconds[3000], true);
+    ret = dds_waitset_wait(waitset, triggered, 5, DDS_SECS(1));
+    CU_ASSERT_EQUAL_FATAL(ret, 1);
+    CU_ASSERT_EQUAL(triggered[0], 3000);
+
+    /* switching back to level-triggered returns all triggered ones */
+    ret = dds_waitset_set_edge_triggered(waitset, false);
+    CU_ASSERT_EQUAL_FATAL(ret, DDS_RETCODE_OK);
+    ret = dds_waitset_wait(waitset, triggered, 5, DDS_SECS(1));
+    CU_ASSERT_EQUAL_FATAL(ret, 5);
+}
+/*************************************************************************************************/
+
+
+
+
+/**************************************************************************************************
+ *
+ * This will check that the file descriptor of a waitset becomes readable when an attached entity
+ * triggers and is reset by a wait that finds nothing triggered anymore.
+ *
+ *************************************************************************************************/
+/*************************************************************************************************/
+#ifndef _WIN32
+static bool
+fd_readable(int fd)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN, .revents = 0 };
+    int n = poll(&pfd, 1, 0);
+    CU_ASSERT_FATAL(n >= 0);
+    return n > 0 && (pfd.revents & POLLIN);
+}
+
+CU_Test(ddsc_waitset_triggering, pollfd, .init=ddsc_waitset_many_init, .fini=ddsc_waitset_many_fini)
+{
+    dds_attach_t triggered;
+    dds_return_t ret;
+    int fd;
+
+    ret = dds_waitset_get_fd(waitset, NULL);
+    CU_ASSERT_EQUAL_FATAL(ret, DDS_RETCODE_BAD_PARAMETER);
+    ret = dds_waitset_get_fd(participant, &fd);
+    CU_ASSERT_EQUAL_FATAL(ret, DDS_RETCODE_ILLEGAL_OPERATION);
+    ret = dds_waitset_get_fd(waitset, &fd);
+    CU_ASSERT_EQUAL_FATAL(ret, DDS_RETCODE_OK);
+    CU_ASSERT_FATAL(!fd_readable(fd));
+
+    /* level-triggered: readable until a wait finds nothing triggered */
+    dds_set_guardcondition(many_gconds[1], true);
+    dds_set_guardcondition(many_gconds[2], true);
+    CU_ASSERT_FATAL(fd_readable(fd));
+    ret = dds_waitset_wait(waitset, NULL, 0, 0);
+    CU_ASSERT_EQUAL_FATAL(ret, 2);
+    CU_ASSERT_FATAL(fd_readable(fd));
+    dds_set_guardcondition(many_gconds[1], false);
+    dds_set_guardcondition(many_gconds[2], false);
+    ret = dds_waitset_wait(waitset, NULL, 0, 0);
+    CU_ASSERT_EQUAL_FATAL(ret, 0);
+    CU_ASSERT_FATAL(!fd_readable(fd));
+
+    /* edge-triggered: reset as soon as all events have been reported */
+    ret = dds_waitset_set_edge_triggered(waitset, true);
+    CU_ASSERT_EQUAL_FATAL(ret, DDS_RETCODE_OK);
+    dds_set_guardcondition(many_gconds[3], true);
+    CU_ASSERT_FATAL(fd_readable(fd));
+    ret = dds_waitset_wait(waitset, &triggered, 1, 0);
+    CU_ASSERT_EQUAL_FATAL(ret, 1);
+    CU_ASSERT_EQUAL(triggered, 3);
+    CU_ASSERT_FATAL(!fd_readable(fd));
+
+    /* the same descriptor is returned every time */
+    int fd1;
+    ret = dds_waitset_get_fd(waitset, &fd1);
+    CU_ASSERT_EQUAL_FATAL(ret, DDS_RETCODE_OK);
+    CU_ASSERT_EQUAL(fd, fd1);
+}
+#endif
+/*************************************************************************************************/
+
+
+
+
 
 #endif
 
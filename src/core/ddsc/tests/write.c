@@ -10,15 +10,24 @@
  * SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
  */
 #include <stdio.h>
+#include <string.h>
 
 #include "CUnit/Theory.h"
 #include "dds/dds.h"
 #include "RoundTrip.h"
 #include "Space.h"
 #include "dds/ddsrt/misc.h"
+#include "dds/ddsrt/environ.h"
+#include "dds/ddsrt/heap.h"
+#include "dds/ddsi/q_entity.h"
+#include "dds/ddsi/ddsi_serdata.h"
+#include "dds__entity.h"
+#include "test_util.h"
+#include "test_pubsub.h"
 
 /* Tests in this file only concern themselves with very basic api tests of
-   dds_write and dds_write_ts */
+   dds_write, dds_write_ts and their batched variants, and with the writer
+   batching small samples into messages */
 
 static const uint32_t payloadSize = 32;
 static RoundTripModule_DataType data;
@@ -158,3 +167,298 @@ CU_Test(ddsc_write, simpletypes)
     dds_delete(top);
     dds_delete(par);
 }
+
+CU_Test(ddsc_write_batch, bad_params, .init = setup, .fini = teardown)
+{
+    dds_return_t status;
+    const void *ptrs[2] = { &data, NULL };
+    const dds_time_t ts[2] = { 1, -1 };
+
+    status = dds_write_batch(writer, ptrs, 1, NULL);
+    CU_ASSERT_EQUAL_FATAL(status, DDS_RETCODE_OK);
+    status = dds_write_batch(writer, NULL, 0, NULL);
+    CU_ASSERT_EQUAL_FATAL(status, DDS_RETCODE_OK);
+    status = dds_write_batch(writer, NULL, 1, NULL);
+    CU_ASSERT_EQUAL_FATAL(status, DDS_RETCODE_BAD_PARAMETER);
+    status = dds_write_batch(writer, ptrs, 2, NULL);
+    CU_ASSERT_EQUAL_FATAL(status, DDS_RETCODE_BAD_PARAMETER);
+    ptrs[1] = &data;
+    status = dds_write_batch(writer, ptrs, 2, ts);
+    CU_ASSERT_EQUAL_FATAL(status, DDS_RETCODE_BAD_PARAMETER);
+    status = dds_write_batch(topic, ptrs, 2, NULL);
+    CU_ASSERT_EQUAL_FATAL(status, DDS_RETCODE_ILLEGAL_OPERATION);
+    status = dds_writecdr_batch(writer, NULL, 1);
+    CU_ASSERT_EQUAL_FATAL(status, DDS_RETCODE_BAD_PARAMETER);
+}
+
+#define BATCH_NSAMPLES 200
+#define BATCH_CONFIG "${CYCLONEDDS_URI}${CYCLONEDDS_URI:+,}<Discovery><ExternalDomainId>0</ExternalDomainId></Discovery>"
+
+static void batch_check_received (dds_entity_t rd, int32_t key, const dds_time_t *ts)
+{
+    Space_Type1 rs[BATCH_NSAMPLES];
+    void *ptrs[BATCH_NSAMPLES];
+    dds_sample_info_t si[BATCH_NSAMPLES];
+    dds_return_t n = 0, ret;
+    const dds_time_t tend = dds_time() + DDS_SECS(10);
+    for (int i = 0; i < BATCH_NSAMPLES; i++)
+        ptrs[i] = &rs[i];
+    /* the writer has received all acks, but the remote reader may not yet
+       have delivered the samples to the reader history */
+    while (n < BATCH_NSAMPLES && dds_time() < tend)
+    {
+        CU_ASSERT_FATAL((ret = dds_take(rd, ptrs + n, si + n, (size_t) (BATCH_NSAMPLES - n), (uint32_t) (BATCH_NSAMPLES - n))) >= 0);
+        if ((n += ret) < BATCH_NSAMPLES)
+            dds_sleepfor(DDS_MSECS(10));
+    }
+    CU_ASSERT_FATAL(n == BATCH_NSAMPLES);
+    for (int32_t i = 0; i < BATCH_NSAMPLES; i++)
+    {
+        CU_ASSERT(si[i].valid_data && rs[i].long_1 == key && rs[i].long_2 == i);
+        if (ts)
+            CU_ASSERT(si[i].source_timestamp == ts[i]);
+    }
+}
+
+CU_Test(ddsc_write_batch, delivery)
+{
+    char name[100], *conf;
+    dds_entity_t dom_pub, dom_sub, pp_pub, pp_sub, tp_pub, tp_sub, wr, rd_local, rd_remote;
+    dds_qos_t *qos;
+    dds_return_t ret;
+
+    /* a reader in a second domain (sharing the port numbers) makes the samples
+       go through the network path as well as through local delivery */
+    conf = ddsrt_expand_envvars(BATCH_CONFIG, 0);
+    dom_pub = dds_create_domain(0, conf);
+    CU_ASSERT_FATAL(dom_pub > 0);
+    dds_free(conf);
+    conf = ddsrt_expand_envvars(BATCH_CONFIG, 1);
+    dom_sub = dds_create_domain(1, conf);
+    CU_ASSERT_FATAL(dom_sub > 0);
+    dds_free(conf);
+
+    create_unique_topic_name("ddsc_write_batch", name, sizeof(name));
+    pp_pub = dds_create_participant(0, NULL, NULL);
+    CU_ASSERT_FATAL(pp_pub > 0);
+    pp_sub = dds_create_participant(1, NULL, NULL);
+    CU_ASSERT_FATAL(pp_sub > 0);
+    tp_pub = dds_create_topic(pp_pub, &Space_Type1_desc, name, NULL, NULL);
+    CU_ASSERT_FATAL(tp_pub > 0);
+    tp_sub = dds_create_topic(pp_sub, &Space_Type1_desc, name, NULL, NULL);
+    CU_ASSERT_FATAL(tp_sub > 0);
+    qos = dds_create_qos();
+    dds_qset_reliability(qos, DDS_RELIABILITY_RELIABLE, DDS_INFINITY);
+    dds_qset_history(qos, DDS_HISTORY_KEEP_ALL, 0);
+    wr = dds_create_writer(pp_pub, tp_pub, qos, NULL);
+    CU_ASSERT_FATAL(wr > 0);
+    rd_local = dds_create_reader(pp_pub, tp_pub, qos, NULL);
+    CU_ASSERT_FATAL(rd_local > 0);
+    rd_remote = dds_create_reader(pp_sub, tp_sub, qos, NULL);
+    CU_ASSERT_FATAL(rd_remote > 0);
+    dds_delete_qos(qos);
+
+    dds_publication_matched_status_t st;
+    const dds_time_t tend = dds_time() + DDS_SECS(10);
+    do {
+        ret = dds_get_publication_matched_status(wr, &st);
+        CU_ASSERT_FATAL(ret == DDS_RETCODE_OK);
+        if (st.current_count < 2)
+            dds_sleepfor(DDS_MSECS(10));
+    } while (st.current_count < 2 && dds_time() < tend);
+    CU_ASSERT_FATAL(st.current_count == 2);
+
+    /* a single instance, so that the order in which they are read is the order
+       in which they were written */
+    Space_Type1 samples[BATCH_NSAMPLES];
+    const void *ptrs[BATCH_NSAMPLES];
+    dds_time_t ts[BATCH_NSAMPLES];
+    const dds_time_t t0 = dds_time();
+    for (int32_t i = 0; i < BATCH_NSAMPLES; i++)
+    {
+        samples[i] = (Space_Type1) { 0, i, 0 };
+        ptrs[i] = &samples[i];
+        ts[i] = t0 + i;
+    }
+    ret = dds_write_batch(wr, ptrs, BATCH_NSAMPLES, ts);
+    CU_ASSERT_FATAL(ret == DDS_RETCODE_OK);
+    ret = dds_wait_for_acks(wr, DDS_SECS(10));
+    CU_ASSERT_FATAL(ret == DDS_RETCODE_OK);
+    batch_check_received(rd_local, 0, ts);
+    batch_check_received(rd_remote, 0, ts);
+
+    /* same, with pre-serialized samples */
+    struct ddsi_serdata *sd[BATCH_NSAMPLES];
+    struct dds_entity *x;
+    ret = dds_entity_pin(wr, &x);
+    CU_ASSERT_FATAL(ret == DDS_RETCODE_OK);
+    const struct ddsi_sertopic *sertopic = ((struct dds_writer *) x)->m_wr->topic;
+    for (int32_t i = 0; i < BATCH_NSAMPLES; i++)
+    {
+        samples[i] = (Space_Type1) { 1, i, 0 };
+        sd[i] = ddsi_serdata_from_sample(sertopic, SDK_DATA, &samples[i]);
+        CU_ASSERT_FATAL(sd[i] != NULL);
+    }
+    dds_entity_unpin(x);
+    ret = dds_writecdr_batch(wr, sd, BATCH_NSAMPLES);
+    CU_ASSERT_FATAL(ret == DDS_RETCODE_OK);
+    ret = dds_wait_for_acks(wr, DDS_SECS(10));
+    CU_ASSERT_FATAL(ret == DDS_RETCODE_OK);
+    batch_check_received(rd_local, 1, NULL);
+    batch_check_received(rd_remote, 1, NULL);
+
+    dds_delete(dom_sub);
+    dds_delete(dom_pub);
+}
+
+CU_Test(ddsc_write_batch, oversize)
+{
+    char *conf;
+    dds_entity_t dom, pp, tp, wr, rd;
+    dds_qos_t *qos;
+    dds_return_t ret;
+
+    conf = ddsrt_expand_envvars("${CYCLONEDDS_URI}${CYCLONEDDS_URI:+,}<Internal><MaxSampleSize>1kB</MaxSampleSize></Internal>", 0);
+    dom = dds_create_domain(0, conf);
+    CU_ASSERT_FATAL(dom > 0);
+    dds_free(conf);
+    pp = dds_create_participant(0, NULL, NULL);
+    CU_ASSERT_FATAL(pp > 0);
+    tp = dds_create_topic(pp, &RoundTripModule_DataType_desc, "RoundTrip", NULL, NULL);
+    CU_ASSERT_FATAL(tp > 0);
+    qos = dds_create_qos();
+    dds_qset_reliability(qos, DDS_RELIABILITY_RELIABLE, DDS_INFINITY);
+    dds_qset_history(qos, DDS_HISTORY_KEEP_ALL, 0);
+    wr = dds_create_writer(pp, tp, qos, NULL);
+    CU_ASSERT_FATAL(wr > 0);
+    rd = dds_create_reader(pp, tp, qos, NULL);
+    CU_ASSERT_FATAL(rd > 0);
+    dds_delete_qos(qos);
+
+    /* the samples preceding the oversize one are written, the others are not */
+    unsigned char small[32], large[2000];
+    memset(small, 's', sizeof(small));
+    memset(large, 'l', sizeof(large));
+    RoundTripModule_DataType samples[4];
+    const void *ptrs[4];
+    for (int i = 0; i < 4; i++)
+    {
+        memset(&samples[i], 0, sizeof(samples[i]));
+        samples[i].payload._length = (i == 2) ? (uint32_t) sizeof(large) : (uint32_t) sizeof(small);
+        samples[i].payload._buffer = (i == 2) ? large : small;
+        ptrs[i] = &samples[i];
+    }
+    ret = dds_write_batch(wr, ptrs, 4, NULL);
+    CU_ASSERT(ret == DDS_RETCODE_ERROR);
+
+    RoundTripModule_DataType rs[4];
+    void *rptrs[4];
+    dds_sample_info_t si[4];
+    memset(rs, 0, sizeof(rs));
+    for (int i = 0; i < 4; i++)
+        rptrs[i] = &rs[i];
+    ret = dds_take(rd, rptrs, si, 4, 4);
+    CU_ASSERT(ret == 2);
+    for (int i = 0; i < ret; i++)
+        CU_ASSERT(si[i].valid_data && rs[i].payload._length == sizeof(small));
+    for (int i = 0; i < 4; i++)
+        RoundTripModule_DataType_free(&rs[i], DDS_FREE_CONTENTS);
+
+    dds_delete(dom);
+}
+
+#define BATCH_DELAY_CONFIG "<Internal><WriteBatchMaxDelay>300ms</WriteBatchMaxDelay></Internal>"
+
+static struct pubsub batch_ps;
+
+static void batch_delay_init(void)
+{
+    pubsub_init(&batch_ps, BATCH_DELAY_CONFIG, "", NULL);
+}
+
+static void batch_delay_prop_init(void)
+{
+    /* adaptive write batching enabled for the writer only */
+    dds_qos_t *qos = dds_create_qos();
+    dds_qset_reliability(qos, DDS_RELIABILITY_RELIABLE, DDS_INFINITY);
+    dds_qset_history(qos, DDS_HISTORY_KEEP_ALL, 0);
+    dds_qset_prop(qos, "cyclonedds.write_batch.max_delay_us", "300000");
+    pubsub_init(&batch_ps, "", "", qos);
+    dds_delete_qos(qos);
+}
+
+static void batch_delay_fini(void)
+{
+    pubsub_fini(&batch_ps);
+}
+
+CU_Test(ddsc_write_batch, max_delay, .init = batch_delay_init, .fini = batch_delay_fini, .timeout = 30)
+{
+    /* small samples wait for the maximum delay (except for the first, which
+       comes with a heartbeat requesting an ack), but full messages go out
+       immediately */
+#define N_BATCH 16 /* no more than pubsub_take_samples takes at a time */
+    uint32_t sizes[N_BATCH];
+    void *raw[N_BATCH] = { NULL };
+    dds_sample_info_t si[N_BATCH];
+    int32_t nread;
+    for (uint32_t i = 0; i < N_BATCH; i++)
+        sizes[i] = (i < 4) ? 100 : 2000;
+    dds_time_t tstart = dds_time();
+    for (uint32_t i = 0; i < 4; i++)
+        pubsub_write_sample(batch_ps.writer, sizes[i], i);
+    dds_sleepfor(DDS_MSECS(100));
+    nread = dds_read(batch_ps.reader, raw, si, N_BATCH, N_BATCH);
+    CU_ASSERT_FATAL(nread == 0 || nread == 1);
+    if (nread > 0)
+        (void) dds_return_loan(batch_ps.reader, raw, nread);
+    pubsub_take_samples(batch_ps.reader, 4, sizes);
+    CU_ASSERT(dds_time() - tstart >= DDS_MSECS(300));
+
+    tstart = dds_time();
+    for (uint32_t i = 0; i < N_BATCH; i++)
+        pubsub_write_sample(batch_ps.writer, sizes[i], i);
+    dds_sleepfor(DDS_MSECS(100));
+    nread = dds_read(batch_ps.reader, raw, si, N_BATCH, N_BATCH);
+    CU_ASSERT_FATAL(nread > 1 && nread < N_BATCH);
+    (void) dds_return_loan(batch_ps.reader, raw, nread);
+    pubsub_take_samples(batch_ps.reader, N_BATCH, sizes);
+    CU_ASSERT(dds_time() - tstart >= DDS_MSECS(300));
+
+    /* a writer can disable it */
+    dds_qos_t *qos = dds_create_qos();
+    CU_ASSERT_FATAL(dds_get_qos(batch_ps.writer, qos) == DDS_RETCODE_OK);
+    dds_qset_prop(qos, "cyclonedds.write_batch.max_delay_us", "0");
+    const dds_entity_t wr = dds_create_writer(dds_get_participant(batch_ps.writer), dds_get_topic(batch_ps.writer), qos, NULL);
+    CU_ASSERT_FATAL(wr > 0);
+    dds_delete_qos(qos);
+    dds_publication_matched_status_t pm;
+    const dds_time_t tend = dds_time() + DDS_SECS(10);
+    while (dds_get_publication_matched_status(wr, &pm) == DDS_RETCODE_OK && pm.current_count == 0 && dds_time() < tend)
+        dds_sleepfor(DDS_MSECS(10));
+    CU_ASSERT_FATAL(pm.current_count == 1);
+    tstart = dds_time();
+    for (uint32_t i = 0; i < 4; i++)
+        pubsub_write_sample(wr, sizes[i], i);
+    pubsub_take_samples(batch_ps.reader, 4, sizes);
+    CU_ASSERT(dds_time() - tstart < DDS_MSECS(300));
+#undef N_BATCH
+}
+
+CU_Test(ddsc_write_batch, max_delay_property, .init = batch_delay_prop_init, .fini = batch_delay_fini, .timeout = 30)
+{
+    /* same as with the configuration setting, but enabled through the writer QoS */
+    static const uint32_t sizes[] = { 100, 100, 100, 100 };
+    void *raw[4] = { NULL };
+    dds_sample_info_t si[4];
+    const dds_time_t tstart = dds_time();
+    for (uint32_t i = 0; i < 4; i++)
+        pubsub_write_sample(batch_ps.writer, sizes[i], i);
+    dds_sleepfor(DDS_MSECS(100));
+    const int32_t nread = dds_read(batch_ps.reader, raw, si, 4, 4);
+    CU_ASSERT_FATAL(nread == 0 || nread == 1);
+    if (nread > 0)
+        (void) dds_return_loan(batch_ps.reader, raw, nread);
+    pubsub_take_samples(batch_ps.reader, 4, sizes);
+    CU_ASSERT(dds_time() - tstart >= DDS_MSECS(300));
+}
@@ -29,6 +29,7 @@ typedef struct dds_ostream {
   unsigned char *m_buffer;
   uint32_t m_size;      /* Buffer size */
   uint32_t m_index;     /* Read/write offset from start of buffer */
+  uint32_t m_reallocs;  /* Number of times the buffer was grown */
 } dds_ostream_t;
 
 typedef struct dds_ostreamBE {
@@ -47,6 +48,8 @@ void dds_stream_read_sample (dds_istream_t * __restrict is, void * __restrict da
 void dds_stream_free_sample (void *data, const uint32_t * ops);
 
 uint32_t dds_stream_countops (const uint32_t * __restrict ops);
+/* Returns the largest alignment required by a primitive in the CDR representation (4 or 8) */
+uint32_t dds_stream_max_align (const uint32_t * __restrict ops);
 size_t dds_stream_check_optimize (const struct ddsi_sertopic_default_desc * __restrict desc);
 void dds_istream_from_serdata_default (dds_istream_t * __restrict s, const struct ddsi_serdata_default * __restrict d);
 void dds_ostream_from_serdata_default (dds_ostream_t * __restrict s, struct ddsi_serdata_default * __restrict d);
@@ -66,6 +69,17 @@ size_t dds_stream_print_key (dds_istream_t * __restrict is, const struct ddsi_se
 
 size_t dds_stream_print_sample (dds_istream_t * __restrict is, const struct ddsi_sertopic_default * __restrict topic, char * __restrict buf, size_t size);
 
+/* Lists the instruction offsets of the top-level fields (nested structs are flattened) in
+   ops, storing at most maxfields of them in insns; returns the number of fields or UINT32_MAX
+   if the instructions can't be handled */
+uint32_t dds_stream_list_fields (const uint32_t * __restrict ops, uint32_t * __restrict insns, uint32_t maxfields);
+
+/* Locates the values of the nfields top-level fields at the instruction offsets in insns
+   (in increasing order) in a normalized stream, setting fields[i] to the address of the
+   value, or to the length preceding the characters in case of a string.  Only fields of
+   primitive types and strings can be extracted. */
+void dds_stream_extract_fields (dds_istream_t * __restrict is, const uint32_t * __restrict ops, uint32_t nfields, const uint32_t * __restrict insns, const unsigned char ** __restrict fields);
+
 /* For marshalling op code handling */
 
 #define DDS_OP_MASK 0xff000000
@@ -866,7 +866,91 @@ static struct cfgelem internal_watermarks_cfgelems[] = {
   END_MARKER
 };
 
+static struct cfgelem internal_congestion_control_cfgelems[] = {
+  BOOL("Enable", NULL, 1, "false",
+    MEMBER(congestion_control_enable),
+    FUNCTIONS(0, uf_boolean, 0, pf_boolean),
+    DESCRIPTION(
+      "<p>This element enables a per-writer rate controller for reliable "
+      "application writers. Each writer starts transmitting at "
+      "Internal/CongestionControl/MaxRate, halves its rate when a reader "
+      "requests a retransmit of data it has already sent and increases it "
+      "linearly again for every round-trip time without such requests, "
+      "never going below Internal/CongestionControl/MinRate. The current "
+      "rate, round-trip time estimate and loss rate are available as writer "
+      "statistics.</p>"
+    )),
+  STRING("MaxRate", NULL, 1, "1 Gb/s",
+    MEMBER(congestion_max_rate),
+    FUNCTIONS(0, uf_bandwidth, 0, pf_bandwidth),
+    DESCRIPTION(
+      "<p>This element specifies the initial and maximum transmit rate of a "
+      "writer when congestion control is enabled.</p>"),
+    UNIT("bandwidth")),
+  STRING("MinRate", NULL, 1, "1 MB/s",
+    MEMBER(congestion_min_rate),
+    FUNCTIONS(0, uf_bandwidth, 0, pf_bandwidth),
+    DESCRIPTION(
+      "<p>This element specifies the minimum transmit rate of a writer when "
+      "congestion control is enabled.</p>"),
+    UNIT("bandwidth")),
+  END_MARKER
+};
+
+static struct cfgelem internal_priority_scheduling_cfgelems[] = {
+  BOOL("Enable", NULL, 1, "false",
+    MEMBER(priority_scheduling_enable),
+    FUNCTIONS(0, uf_boolean, 0, pf_boolean),
+    DESCRIPTION(
+      "<p>This element enables the scheduling of outgoing data based on the "
+      "TRANSPORT_PRIORITY and LATENCY_BUDGET QoS of the writers. Packets "
+      "queued for the asynchronous send thread (see Internal/SendAsync) "
+      "are sent in order of decreasing transport priority of the data they "
+      "contain, so that data of high-priority writers overtakes queued data "
+      "of low-priority writers. A writer with a finite, non-zero latency "
+      "budget does not send its data out immediately on writing, but lets "
+      "it accumulate for at most the latency budget so that it can be "
+      "combined with subsequent samples in a single packet.</p>"
+    )),
+  STRING("DiffServ", NULL, 1, "",
+    MEMBER(priority_scheduling_diffserv),
+    FUNCTIONS(0, uf_string, ff_free, pf_string),
+    DESCRIPTION(
+      "<p>This element specifies a comma-separated list of transmit classes "
+      "of the form <i>P:D</i>, where <i>P</i> is a transport priority and "
+      "<i>D</i> a DSCP value in the range 0 .. 63. Each class gets its own "
+      "transmit socket with the DSCP value set in the IP header of the "
+      "packets sent over it, and the data of a writer is sent over the "
+      "socket of the class with the highest <i>P</i> not exceeding the "
+      "transport priority the writer had at creation. Writers with a "
+      "lower transport priority than that of all classes use the default "
+      "transmit socket. Only supported for UDP.</p>"
+    )),
+  END_MARKER
+};
+
 static struct cfgelem internal_burstsize_cfgelems[] = {
+  STRING("HistoricalDataInterval", NULL, 1, "10 ms",
+    MEMBER(historical_data_burst_interval),
+    FUNCTIONS(0, uf_duration_ms_1hr, 0, pf_duration),
+    DESCRIPTION(
+      "<p>This element specifies the interval between the bursts of "
+      "historical data sent to a late-joining remote reader, see "
+      "Internal/BurstSize/MaxHistoricalData.</p>"),
+    UNIT("duration")),
+  STRING("MaxHistoricalData", NULL, 1, "128 kB",
+    MEMBER(max_historical_data_burst_size),
+    FUNCTIONS(0, uf_memsize, 0, pf_memsize),
+    DESCRIPTION(
+      "<p>This element specifies the amount of historical data sent in one "
+      "burst to a reliable, late-joining remote reader of a transient-local "
+      "writer. The contents of the writer history cache are streamed to the "
+      "reader directly after it has been discovered, in packed messages, in "
+      "bursts of at most this size separated by "
+      "Internal/BurstSize/HistoricalDataInterval, rather than waiting for the "
+      "reader to request them. The value 0 disables this and leaves it to "
+      "the regular retransmit mechanism.</p>"),
+    UNIT("memsize")),
   STRING("MaxRexmit", NULL, 1, "1 MiB",
     MEMBER(max_rexmit_burst_size),
     FUNCTIONS(0, uf_memsize, 0, pf_memsize),
@@ -1006,6 +1090,18 @@ static struct cfgelem internal_cfgelems[] = {
       "expressed in samples. Once a delivery queue is full, incoming samples "
       "destined for that queue are dropped until space becomes available "
       "again.</p>")),
+  INT("BuiltinDeliveryQueues", NULL, 1, "1",
+    MEMBER(builtin_delivery_queues),
+    FUNCTIONS(0, uf_uint, 0, pf_uint),
+    DESCRIPTION(
+      "<p>This element sets the number of delivery queues (each with its own "
+      "thread) used for processing discovery data. All discovery data "
+      "originating from a single remote participant is handled by the same "
+      "queue, preserving the order in which it is processed, but data from "
+      "different participants can be processed in parallel. Increasing this "
+      "speeds up discovery in large systems, in particular when many "
+      "processes start simultaneously.</p>"),
+    RANGE("1;64")),
   INT("PrimaryReorderMaxSamples", NULL, 1, "128",
     MEMBER(primary_reorder_maxsamples),
     FUNCTIONS(0, uf_uint, 0, pf_uint),
@@ -1037,6 +1133,18 @@ static struct cfgelem internal_cfgelems[] = {
       "defragmented simultaneously for a reliable writer. This has to be "
       "large enough to handle retransmissions of historical data in addition "
       "to new samples.</p>")),
+  STRING("DefragDirectMinSize", NULL, 1, "1 MiB",
+    MEMBER(defrag_direct_min_size),
+    FUNCTIONS(0, uf_memsize, 0, pf_memsize),
+    DESCRIPTION(
+      "<p>This element sets the minimum size of a fragmented sample for "
+      "copying the fragments into a buffer allocated for the entire sample "
+      "as they arrive, instead of retaining the receive buffers containing "
+      "the fragments until the sample is complete. The fragments received "
+      "until then are copied once the first fragment and at least an eighth "
+      "of the sample have arrived, so that the memory allocated is "
+      "proportional to the data received. The value 0 disables it.</p>"),
+    UNIT("memsize")),
   ENUM("BuiltinEndpointSet", NULL, 1, "writers",
     MEMBER(besmode),
     FUNCTIONS(0, uf_besmode, 0, pf_besmode),
@@ -1140,6 +1248,22 @@ static struct cfgelem internal_cfgelems[] = {
       "<p>This element allows configuring the base interval for sending "
       "writer heartbeats and the bounds within which it can vary.</p>"),
     UNIT("duration_inf")),
+  BOOL("AdaptiveHeartbeats", NULL, 1, "false",
+    MEMBER(adaptive_heartbeats),
+    FUNCTIONS(0, uf_boolean, 0, pf_boolean),
+    DESCRIPTION(
+      "<p>This element enables adaptive heartbeat scheduling for reliable "
+      "writers. When only a few readers (at most 8) have not yet acknowledged "
+      "all data, the periodic heartbeats are unicast to just those readers "
+      "instead of being multicast to all of them, so that readers that are "
+      "up-to-date need not respond. A writer learns the heartbeat-to-"
+      "acknowledgement latency of each reader and doesn't send a heartbeat "
+      "to a reader while its response to the previous one can still be "
+      "expected. Periodic heartbeats are scheduled on a grid of "
+      "Internal/HeartbeatInterval[@minsched] with a per-participant offset, "
+      "so that the heartbeats of the writers of a participant go out "
+      "together in a single message. The number of heartbeats sent and "
+      "acknowledgements received are available as writer statistics.</p>")),
   STRING("MaxQueuedRexmitBytes", NULL, 1, "512 kB",
     MEMBER(max_queued_rexmit_bytes),
     FUNCTIONS(0, uf_memsize, 0, pf_memsize),
@@ -1319,6 +1443,24 @@ static struct cfgelem internal_cfgelems[] = {
       "the application may have to use the dds_write_flush function to "
       "ensure that all samples are written.</p>"
     )),
+  STRING("WriteBatchMaxDelay", NULL, 1, "0 s",
+    MEMBER(write_batch_max_delay),
+    FUNCTIONS(0, uf_duration_us_1s, 0, pf_duration),
+    DESCRIPTION(
+      "<p>This element enables adaptive batching of write operations when "
+      "set to a non-zero value and WriteBatch is disabled. The samples "
+      "written are then accumulated in a single message, which is sent "
+      "when it reaches the maximum message size or when the first sample "
+      "in it has waited for the specified amount of time, whichever comes "
+      "first. This gives nearly the throughput of WriteBatch while keeping "
+      "the added latency bounded and without requiring the application to "
+      "call dds_write_flush.</p>\n"
+      "<p>A writer can override this setting with the "
+      "\"cyclonedds.write_batch.max_delay_us\" property in its QoS, giving "
+      "the maximum delay in microseconds (0 .. 1000000), where 0 disables "
+      "adaptive write batching for that writer.</p>"),
+    UNIT("duration"),
+    RANGE("0;1s")),
   BOOL("LivelinessMonitoring", liveliness_monitoring_attrs, 1, "false",
     MEMBER(liveliness_monitoring),
     FUNCTIONS(0, uf_boolean, 0, pf_boolean),
@@ -1366,6 +1508,19 @@ static struct cfgelem internal_cfgelems[] = {
       "on the same thread that prepares them, or is done asynchronously by "
       "another thread.</p>"
     )),
+  BOOL("UseIoUring", NULL, 1, "false",
+    MEMBER(use_io_uring),
+    FUNCTIONS(0, uf_boolean, 0, pf_boolean),
+    DESCRIPTION(
+      "<p>This element controls whether the UDP transport uses io_uring "
+      "(Linux only) instead of a system call per packet. When enabled, a "
+      "packet addressed to multiple destinations is sent to all of them "
+      "using a single system call, and sockets served by a dedicated "
+      "receive thread (see MultipleReceiveThreads) receive packets in "
+      "batches using a multishot receive operation. If the kernel does "
+      "not support the required io_uring features, the regular socket "
+      "calls are used instead.</p>"
+    )),
   STRING("RediscoveryBlacklistDuration", rediscovery_blacklist_duration_attrs, 1, "0s",
     MEMBER(prune_deleted_ppant.delay),
     FUNCTIONS(0, uf_duration_inf, 0, pf_duration),
@@ -1413,6 +1568,14 @@ static struct cfgelem internal_cfgelems[] = {
     NOMEMBER,
     NOFUNCTIONS,
     DESCRIPTION("<p>Setting for controlling the size of transmit bursts.</p>")),
+  GROUP("CongestionControl", internal_congestion_control_cfgelems, NULL, 1,
+    NOMEMBER,
+    NOFUNCTIONS,
+    DESCRIPTION("<p>Settings for the adaptive rate control of reliable writers.</p>")),
+  GROUP("PriorityScheduling", internal_priority_scheduling_cfgelems, NULL, 1,
+    NOMEMBER,
+    NOFUNCTIONS,
+    DESCRIPTION("<p>Settings for the transport priority and latency budget aware scheduling of outgoing data.</p>")),
   LIST("EnableExpensiveChecks", NULL, 1, "",
     MEMBER(enabled_xchecks),
     FUNCTIONS(0, uf_xcheck, 0, pf_xcheck),
@@ -1559,6 +1722,76 @@ static struct cfgelem tcp_cfgelems[] = {
   END_MARKER
 };
 
+static struct cfgelem shm_cfgelems[] = {
+  BOOL("Enable", NULL, 1, "false",
+    MEMBER(shm_enable),
+    FUNCTIONS(0, uf_boolean, 0, pf_boolean),
+    DESCRIPTION(
+      "<p>This element enables the shared memory transport for communicating "
+      "with other Cyclone DDS instances on the same host. It is only used "
+      "in combination with UDP, each domain instance then additionally "
+      "advertises a shared memory locator and peers on the same host send "
+      "their traffic through that instead of through the loopback "
+      "interface.</p>"
+    )),
+  STRING("RingSize", NULL, 1, "4 MiB",
+    MEMBER(shm_ring_size),
+    FUNCTIONS(0, uf_memsize, 0, pf_memsize),
+    DESCRIPTION(
+      "<p>This element specifies the size of the shared memory ring in which "
+      "this domain instance receives messages from its peers on the same "
+      "host. It is rounded up to a power of two. Messages that do not fit "
+      "because the ring is full are dropped, just like UDP datagrams are "
+      "dropped when a socket receive buffer is full.</p>"),
+    UNIT("memsize")),
+  STRING("ChunkSize", NULL, 1, "64 KiB",
+    MEMBER(shm_chunk_size),
+    FUNCTIONS(0, uf_memsize, 0, pf_memsize),
+    DESCRIPTION(
+      "<p>This element specifies the size of the chunks in the shared memory "
+      "pool from which writers borrow samples using <code>dds_loan_sample"
+      "</code>. Only types of at most this size can be exchanged without "
+      "copying.</p>"),
+    UNIT("memsize")),
+  INT("ChunkCount", NULL, 1, "256",
+    MEMBER(shm_chunk_count),
+    FUNCTIONS(0, uf_uint, 0, pf_uint),
+    DESCRIPTION(
+      "<p>This element specifies the number of chunks in the shared memory "
+      "pool of this domain instance. A chunk remains in use until the "
+      "writer and all readers on the same host are done with it; when all "
+      "chunks are in use, loaning a sample fails. A value of 0 disables "
+      "zero-copy exchange.</p>")),
+  END_MARKER
+};
+
+static struct cfgelem durability_cfgelems[] = {
+  BOOL("Enable", NULL, 1, "false",
+    MEMBER(durability_enable),
+    FUNCTIONS(0, uf_boolean, 0, pf_boolean),
+    DESCRIPTION(
+      "<p>This element enables the built-in durability service that stores "
+      "the data published by writers in this domain instance with a "
+      "TRANSIENT or PERSISTENT durability QoS, within the limits set by "
+      "their durability service QoS. Late-joining readers with such a "
+      "durability QoS in this domain instance receive the stored data, even "
+      "when the writers no longer exist. When disabled, TRANSIENT and "
+      "PERSISTENT data is not retained at all.</p>"
+    )),
+  STRING("Directory", NULL, 1, "",
+    MEMBER(durability_directory),
+    FUNCTIONS(0, uf_string, ff_free, pf_string),
+    DESCRIPTION(
+      "<p>This element specifies the directory in which the durability "
+      "service keeps one append-only log file per topic, memory-mapped for "
+      "reading. Data published with a PERSISTENT durability QoS is reloaded "
+      "from these files when the topic is first used after a restart. If "
+      "empty, the logs are kept in memory only and PERSISTENT data is "
+      "treated as TRANSIENT.</p>"
+    )),
+  END_MARKER
+};
+
 #ifdef DDSI_INCLUDE_SSL
 static struct cfgelem ssl_cfgelems[] = {
   BOOL("Enable", NULL, 1, "false",
@@ -1949,6 +2182,14 @@ static struct cfgelem domain_cfgelems[] = {
       "<p>The Discovery element allows specifying various parameters related "
       "to the discovery of peers.</p>"
     )),
+  GROUP("Durability", durability_cfgelems, NULL, 1,
+    NOMEMBER,
+    NOFUNCTIONS,
+    DESCRIPTION(
+      "<p>The Durability element allows specifying various parameters "
+      "related to the built-in durability service for TRANSIENT and "
+      "PERSISTENT data.</p>"
+    )),
   GROUP("Tracing", tracing_cfgelems, NULL, 1,
     NOMEMBER,
     NOFUNCTIONS,
@@ -1975,6 +2216,14 @@ static struct cfgelem domain_cfgelems[] = {
       "<p>The TCP element allows specifying various parameters related to "
       "running DDSI over TCP.</p>"
     )),
+  GROUP("SharedMemory", shm_cfgelems, NULL, 1,
+    NOMEMBER,
+    NOFUNCTIONS,
+    DESCRIPTION(
+      "<p>The SharedMemory element allows specifying various parameters "
+      "related to the shared memory transport between processes on the "
+      "same host.</p>"
+    )),
   GROUP("ThreadPool", tp_cfgelems, NULL, 1,
     NOMEMBER,
     NOFUNCTIONS,
@@ -0,0 +1,72 @@
+/*
+ * Copyright(c) 2020 ADLINK Technology Limited and others
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License v. 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0, or the Eclipse Distribution License
+ * v. 1.0 which is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+ */
+#ifndef DDSI_CONGESTION_H
+#define DDSI_CONGESTION_H
+
+#include <stdint.h>
+
+#include "dds/ddsrt/time.h"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+struct config;
+
+/* Pacing debt below which a writer is not made to wait, smaller debts
+   are carried over to the next sample */
+#define DDSI_CONGESTION_MIN_DELAY DDS_MSECS (1)
+
+/* Per-writer AIMD rate controller for reliable writers.  The transmit
+   rate starts at the configured maximum, is halved (at most once per
+   round) when a reader requests a retransmit of data that has already
+   been sent and increases linearly in every round without retransmit
+   requests.  A round lasts one smoothed HB->ACK round-trip time, but
+   at least 10ms.  The write path asks how long to wait before sending
+   a sample of a given size; protected by the writer lock. */
+struct ddsi_congestion {
+  uint32_t rate; /* current rate in bytes/s */
+  uint32_t min_rate, max_rate; /* bounds in bytes/s */
+  int64_t balance; /* transmit time owed in ns, negative means credit */
+  ddsrt_mtime_t t_last; /* time balance was last updated */
+  ddsrt_mtime_t t_round_start; /* start of current round */
+  int64_t srtt; /* smoothed HB->ACK round-trip time in ns, 0 if unknown */
+  uint64_t round_bytes; /* bytes paced in current round */
+  uint64_t round_rexmit_bytes; /* bytes requested for retransmit in current round */
+  uint32_t loss; /* smoothed fraction of retransmitted bytes, permille */
+  unsigned decreased_in_round: 1; /* iff 1, rate was already decreased in current round */
+};
+
+void ddsi_congestion_init (struct ddsi_congestion *cc, const struct config *config, ddsrt_mtime_t tnow);
+
+/* Accounts for "size" bytes to be sent at "tnow" and returns the number
+   of ns the caller should wait before sending them to stay within the
+   current rate; values < DDSI_CONGESTION_MIN_DELAY should be ignored */
+int64_t ddsi_congestion_pace (struct ddsi_congestion *cc, uint32_t size, ddsrt_mtime_t tnow);
+
+/* Undoes the accounting of ddsi_congestion_pace for a sample of "size"
+   bytes that ended up not being sent */
+void ddsi_congestion_cancel (struct ddsi_congestion *cc, uint32_t size);
+
+/* Notes an ACKNACK requesting retransmission of "rexmit_bytes" bytes of
+   already transmitted data, lowering the rate if it is the first one
+   in the current round */
+void ddsi_congestion_note_nack (struct ddsi_congestion *cc, uint32_t rexmit_bytes, ddsrt_mtime_t tnow);
+
+/* Notes a HB->ACK round-trip time sample */
+void ddsi_congestion_note_rtt (struct ddsi_congestion *cc, int64_t rtt);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif /* DDSI_CONGESTION_H */
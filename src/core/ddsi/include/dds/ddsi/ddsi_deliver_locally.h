@@ -55,6 +55,13 @@ dds_return_t deliver_locally_one (struct ddsi_domaingv *gv, struct entity_common
 
 dds_return_t deliver_locally_allinsync (struct ddsi_domaingv *gv, struct entity_common *source_entity, bool source_entity_locked, struct local_reader_ary *fastpath_rdary, const struct ddsi_writer_info *wrinfo, const struct deliver_locally_ops * __restrict ops, void *vsourceinfo);
 
+/* Delivers n samples (sample i described by wrinfo[i] and vsourceinfo[i]) to all in-sync
+   readers, storing them in each reader history cache as a single batch, i.e., under one
+   lock and with one notification (see ddsi_rhc_store_batch).  Samples rejected by a reader
+   are retried like they are by deliver_locally_allinsync, with on_failure_fastpath called
+   with vsourceinfo[0], but a sample is never delivered to the same reader twice. */
+dds_return_t deliver_locally_allinsync_batch (struct ddsi_domaingv *gv, struct entity_common *source_entity, bool source_entity_locked, struct local_reader_ary *fastpath_rdary, uint32_t n, const struct ddsi_writer_info *wrinfo, const struct deliver_locally_ops * __restrict ops, void * const *vsourceinfo);
+
 #if defined (__cplusplus)
 }
 #endif
@@ -83,6 +83,12 @@ struct recv_thread_arg {
   } u;
 };
 
+struct ddsi_xmit_class {
+  int32_t min_priority;
+  int diffserv; /* DSCP value shifted into the TOS/traffic class byte */
+  struct ddsi_tran_conn *conn;
+};
+
 struct deleted_participants_admin;
 
 struct ddsi_domaingv {
@@ -148,6 +154,17 @@ struct ddsi_domaingv {
      but it seems the only way to get the users what they expect. */
   struct ddsi_tran_conn * xmit_conn;
 
+  /* Transmit connections with a DSCP value set for the transmit classes
+     of Internal/PriorityScheduling/DiffServ, in order of decreasing
+     minimum transport priority; writers below all of them use xmit_conn */
+  uint32_t n_xmit_classes;
+  struct ddsi_xmit_class *xmit_classes;
+
+  /* Shared memory receive ring (also used for transmitting to peers on the
+     same host), NULL if shared memory is disabled; and its locator */
+  struct ddsi_tran_conn * shm_conn;
+  nn_locator_t loc_shm;
+
   /* TCP listener */
   struct ddsi_tran_listener * listener;
 
@@ -227,7 +244,7 @@ struct ddsi_domaingv {
      trigger socket.) Receive buffer pool is per receive thread,
      it is only a global variable because it needs to be freed way later
      than the receive thread itself terminates */
-#define MAX_RECV_THREADS 3
+#define MAX_RECV_THREADS 4
   uint32_t n_recv_threads;
   struct recv_thread {
     const char *name;
@@ -276,9 +293,11 @@ struct ddsi_domaingv {
   struct nn_defrag *spdp_defrag;
   struct nn_reorder *spdp_reorder;
 
-  /* Built-in stuff other than SPDP gets funneled through the builtins
-     delivery queue; currently just SEDP and PMD */
-  struct nn_dqueue *builtins_dqueue;
+  /* Built-in stuff gets funneled through the builtins delivery queues,
+     where all data from a single remote participant always goes through
+     the same queue (see builtins_dqueue_for_prefix) */
+  struct nn_dqueue **builtins_dqueues;
+  uint32_t n_builtins_dqueues;
 
   struct debug_monitor *debmon;
 
@@ -0,0 +1,94 @@
+/*
+ * Copyright(c) 2020 ADLINK Technology Limited and others
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License v. 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0, or the Eclipse Distribution License
+ * v. 1.0 which is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+ */
+#ifndef DDSI_FILTER_H
+#define DDSI_FILTER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "dds/export.h"
+#include "dds/ddsrt/retcode.h"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+struct ddsi_sertopic;
+struct ddsi_serdata;
+struct ddsi_filter;
+struct nn_content_filter_property;
+
+/* Filter class name advertised in discovery for these expressions */
+#define DDSI_FILTER_CLASS_NAME "DDSSQL"
+
+/* Content filters are expressions in the SQL subset of the DDS specification:
+
+     expr    ::= term { OR term }
+     term    ::= factor { AND factor }
+     factor  ::= NOT factor | '(' expr ')' | cond
+     cond    ::= operand relop operand
+               | operand [NOT] BETWEEN operand AND operand
+               | operand [NOT] LIKE operand
+     relop   ::= '=' | '<>' | '!=' | '<' | '<=' | '>' | '>='
+     operand ::= field | %n | integer | float | 'string' | TRUE | FALSE
+
+   where "field" is the name of a (possibly nested, using '.') member of the
+   topic type of a primitive or string type.  The expression is compiled into
+   a program that is evaluated directly on the serialized form of a sample
+   (only for topics using the default sertopic and providing a type
+   description), so samples can be dropped before they are deserialized.
+
+   Parameters (%0 .. %99) are strings interpreted as literals; they can be
+   changed at any time, also while the filter is being evaluated by other
+   threads. */
+
+/* Allocates a filter for sertopic "tp" that accepts all samples */
+DDS_EXPORT struct ddsi_filter *ddsi_filter_new (const struct ddsi_sertopic *tp);
+DDS_EXPORT void ddsi_filter_free (struct ddsi_filter *filter);
+
+/* Compiles "expression" and installs it with the given parameters, or
+   reverts to accepting all samples if expression is NULL.  Returns
+   BAD_PARAMETER for syntax errors, unknown fields and missing parameters,
+   and UNSUPPORTED if the topic doesn't allow content filter expressions.
+   The filter is unchanged on failure. */
+DDS_EXPORT dds_return_t ddsi_filter_set_expression (struct ddsi_filter *filter, const char *expression, uint32_t nparams, const char * const *params);
+
+/* Replaces the parameters of the current expression; there must be at
+   least as many parameters as the expression references */
+DDS_EXPORT dds_return_t ddsi_filter_set_parameters (struct ddsi_filter *filter, uint32_t nparams, const char * const *params);
+
+/* Returns true if the filter has an expression, false if it accepts all samples */
+DDS_EXPORT bool ddsi_filter_has_expression (struct ddsi_filter *filter);
+
+/* Evaluates the filter on a sample (serdata with data, of the sertopic
+   the filter was created for) */
+DDS_EXPORT bool ddsi_filter_accepts (struct ddsi_filter *filter, const struct ddsi_serdata *sample);
+
+/* Returns a newly allocated content filter property describing the current
+   expression and parameters, for advertising a reader's filter in SEDP, or
+   NULL if the filter accepts all samples */
+DDS_EXPORT struct nn_content_filter_property *ddsi_filter_get_property (struct ddsi_filter *filter);
+
+/* Creates a filter for "tp" from a content filter property received in
+   discovery; returns NULL if the property refers to a different topic or
+   filter class or if the expression can't be evaluated for "tp" */
+DDS_EXPORT struct ddsi_filter *ddsi_filter_new_from_property (const struct ddsi_sertopic *tp, const struct nn_content_filter_property *cfp);
+
+DDS_EXPORT struct nn_content_filter_property *ddsi_content_filter_property_dup (const struct nn_content_filter_property *cfp);
+DDS_EXPORT bool ddsi_content_filter_property_equal (const struct nn_content_filter_property *a, const struct nn_content_filter_property *b);
+DDS_EXPORT void ddsi_content_filter_property_free (struct nn_content_filter_property *cfp);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif
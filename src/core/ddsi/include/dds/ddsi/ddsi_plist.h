@@ -180,6 +180,14 @@ typedef struct nn_adlink_participant_version_info
   char *internals;
 } nn_adlink_participant_version_info_t;
 
+typedef struct nn_content_filter_property {
+  char *content_filtered_topic_name;
+  char *related_topic_name;
+  char *filter_class_name;
+  char *filter_expression;
+  ddsi_stringseq_t expression_parameters;
+} nn_content_filter_property_t;
+
 typedef struct ddsi_plist {
   uint64_t present;
   uint64_t aliased;
@@ -199,7 +207,7 @@ typedef struct ddsi_plist {
   nn_count_t participant_manual_liveliness_count;
   uint32_t participant_builtin_endpoints;
   dds_duration_t participant_lease_duration;
-  /* nn_content_filter_property_t content_filter_property; */
+  nn_content_filter_property_t content_filter_property;
   ddsi_guid_t participant_guid;
   ddsi_guid_t endpoint_guid;
   ddsi_guid_t group_guid;
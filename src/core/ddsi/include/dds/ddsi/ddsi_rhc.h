@@ -44,14 +44,23 @@ struct ddsi_writer_info
 #endif
 };
 
+/* One sample of a batch (historical data, a coherent set), see ddsi_rhc_store_batch */
+struct ddsi_rhc_batch_sample {
+  struct ddsi_writer_info wrinfo;
+  struct ddsi_serdata *sample;
+  struct ddsi_tkmap_instance *tk;
+};
+
 typedef void (*ddsi_rhc_free_t) (struct ddsi_rhc *rhc);
 typedef bool (*ddsi_rhc_store_t) (struct ddsi_rhc * __restrict rhc, const struct ddsi_writer_info * __restrict wrinfo, struct ddsi_serdata * __restrict sample, struct ddsi_tkmap_instance * __restrict tk);
+typedef uint32_t (*ddsi_rhc_store_batch_t) (struct ddsi_rhc * __restrict rhc, uint32_t n, const struct ddsi_rhc_batch_sample * __restrict samples);
 typedef void (*ddsi_rhc_unregister_wr_t) (struct ddsi_rhc * __restrict rhc, const struct ddsi_writer_info * __restrict wrinfo);
 typedef void (*ddsi_rhc_relinquish_ownership_t) (struct ddsi_rhc * __restrict rhc, const uint64_t wr_iid);
 typedef void (*ddsi_rhc_set_qos_t) (struct ddsi_rhc *rhc, const struct dds_qos *qos);
 
 struct ddsi_rhc_ops {
   ddsi_rhc_store_t store;
+  ddsi_rhc_store_batch_t store_batch; /* optional, may be a null pointer */
   ddsi_rhc_unregister_wr_t unregister_wr;
   ddsi_rhc_relinquish_ownership_t relinquish_ownership;
   ddsi_rhc_set_qos_t set_qos;
@@ -65,6 +74,21 @@ struct ddsi_rhc {
 DDS_EXPORT inline bool ddsi_rhc_store (struct ddsi_rhc * __restrict rhc, const struct ddsi_writer_info * __restrict wrinfo, struct ddsi_serdata * __restrict sample, struct ddsi_tkmap_instance * __restrict tk) {
   return rhc->ops->store (rhc, wrinfo, sample, tk);
 }
+/* Stores a batch of samples, as if by calling store for each one of them in turn, but
+   with the locking and the notifications amortized over the batch where the rhc
+   supports it.  Stops at the first sample that store would have rejected and returns
+   the number of samples stored, i.e., n if all were accepted */
+DDS_EXPORT inline uint32_t ddsi_rhc_store_batch (struct ddsi_rhc * __restrict rhc, uint32_t n, const struct ddsi_rhc_batch_sample * __restrict samples) {
+  if (rhc->ops->store_batch)
+    return rhc->ops->store_batch (rhc, n, samples);
+  else {
+    uint32_t i;
+    for (i = 0; i < n; i++)
+      if (!rhc->ops->store (rhc, &samples[i].wrinfo, samples[i].sample, samples[i].tk))
+        break;
+    return i;
+  }
+}
 DDS_EXPORT inline void ddsi_rhc_unregister_wr (struct ddsi_rhc * __restrict rhc, const struct ddsi_writer_info * __restrict wrinfo) {
   rhc->ops->unregister_wr (rhc, wrinfo);
 }
@@ -19,6 +19,7 @@
 #include "dds/ddsi/ddsi_serdata.h"
 #include "dds/ddsi/ddsi_sertopic.h"
 #include "dds/ddsi/ddsi_plist_generic.h"
+#include "dds/ddsi/q_radmin.h"
 
 #include "dds/dds.h"
 
@@ -34,13 +35,25 @@ extern "C" {
 #define CDR_LE 0x0001
 #endif
 
+/* Not an encoding but a vendor-specific identifier indicating the payload is
+   a reference to the sample in shared memory (struct ddsi_shm_chunk_desc),
+   only ever sent to readers on the same host */
+#if DDSRT_ENDIAN == DDSRT_LITTLE_ENDIAN
+#define CDR_SHM 0x0180
+#else
+#define CDR_SHM 0x8001
+#endif
+
 struct CDRHeader {
   unsigned short identifier;
   unsigned short options;
 };
 
+/* Number of size classes in the serdata pool, see ddsi_serdata_default.c */
+#define SERDATAPOOL_NCLASSES 4
+
 struct serdatapool {
-  struct nn_freelist freelist;
+  struct nn_freelist freelist[SERDATAPOOL_NCLASSES]; /* one per size class, smallest first */
 };
 
 typedef struct dds_keyhash {
@@ -61,7 +74,18 @@ typedef struct dds_keyhash {
 /* There is an alignment requirement on the raw data (it must be at
    offset mod 8 for the conversion to/from a dds_stream to work).
    So we define two types: one without any additional padding, and
-   one where the appropriate amount of padding is inserted */
+   one where the appropriate amount of padding is inserted.
+
+   If hdr.identifier is CDR_SHM, data holds a struct ddsi_shm_chunk_desc,
+   shm_payload points to the (native-endian) sample in shared memory and
+   shm_size is its size.
+
+   If rmsg_payload is not NULL, the serialized data following the CDR header
+   are not in data but at rmsg_payload, and pos is their size.  Initially that
+   is in the received message rmsg.rmsg, which the serdata retains (see
+   nn_rmsg_retain), but if the receive buffer is short of space they get moved
+   to a separate allocation.  Either way the CDR header precedes them in memory
+   as well as being copied into hdr. */
 #define DDSI_SERDATA_DEFAULT_PREPAD   \
   struct ddsi_serdata c;              \
   uint32_t pos;                       \
@@ -69,6 +93,11 @@ typedef struct dds_keyhash {
   DDSI_SERDATA_DEFAULT_DEBUG_FIELDS   \
   dds_keyhash_t keyhash;              \
   struct serdatapool *serpool;        \
+  void *shm_payload;                  \
+  uint32_t shm_size;                  \
+  struct nn_rmsg_retainer rmsg;       \
+  const char *rmsg_payload;           \
+  bool rmsg_unpinned;                 \
   struct ddsi_serdata_default *next /* in pool->freelist */
 #define DDSI_SERDATA_DEFAULT_POSTPAD  \
   struct CDRHeader hdr;               \
@@ -118,6 +147,12 @@ struct ddsi_sertopic_default {
   struct serdatapool *serpool;
   struct ddsi_sertopic_default_desc type;
   size_t opt_size;
+  uint32_t cdr_align; /* alignment needed for the CDR representation (4 or 8), 0 if unknown */
+  char *type_description; /* XML type description for resolving field names in content filters, or NULL */
+  ddsrt_atomic_uint32_t size_estimate; /* moving estimate of the size of a serialized sample, for sizing new serdatas */
+  ddsrt_atomic_uint64_t serdata_allocs; /* number of serdatas allocated ... */
+  ddsrt_atomic_uint64_t serdata_pool_hits; /* ... of which taken from the pool */
+  ddsrt_atomic_uint64_t serdata_reallocs; /* number of times a serdata was reallocated (grown or shrunk) */
 };
 
 struct ddsi_plist_sample {
@@ -138,6 +173,31 @@ extern DDS_EXPORT const struct ddsi_sertopic_ops ddsi_sertopic_ops_default;
 extern DDS_EXPORT const struct ddsi_serdata_ops ddsi_serdata_ops_cdr;
 extern DDS_EXPORT const struct ddsi_serdata_ops ddsi_serdata_ops_cdr_nokey;
 
+/* Returns true iff samples of the topic can be exchanged via shared memory
+   chunks: shared memory must be enabled and the type must be "memcpy-able"
+   and fit in a chunk */
+DDS_EXPORT bool ddsi_sertopic_default_supports_shm_loans (const struct ddsi_sertopic *tpcmn);
+
+/* Constructs a serdata for a sample of a "memcpy-able" type that the
+   application wrote directly into a shared memory chunk, taking over the
+   reference the caller holds.  The sample is serialized as a reference to
+   the chunk, so this must only be used if all readers are on the same host. */
+DDS_EXPORT struct ddsi_serdata *ddsi_serdata_default_from_shm_chunk (const struct ddsi_sertopic *tpcmn, void *payload);
+
+/* Returns the address of the sample in shared memory if the serdata refers
+   to one, NULL otherwise */
+DDS_EXPORT const void *ddsi_serdata_default_shm_payload (const struct ddsi_serdata *dcmn);
+
+/* Ensures the serdata keeps referencing the received message if it references
+   one, rather than moving its data elsewhere when the receive buffer runs out
+   of space; needed when it is handed to code that may access its data without
+   being covered by the garbage collector (e.g., the application) */
+DDS_EXPORT void ddsi_serdata_default_keep_rmsg (struct ddsi_serdata *dcmn);
+
+/* Returns the serdata allocation statistics of a topic using the default
+   serdata implementation, all 0 for other topics */
+DDS_EXPORT void ddsi_sertopic_default_get_serdata_stats (const struct ddsi_sertopic *tpcmn, uint64_t *allocs, uint64_t *pool_hits, uint64_t *reallocs);
+
 struct serdatapool * ddsi_serdatapool_new (void);
 void ddsi_serdatapool_free (struct serdatapool * pool);
 
@@ -0,0 +1,75 @@
+/*
+ * Copyright(c) 2020 ADLINK Technology Limited and others
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License v. 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0, or the Eclipse Distribution License
+ * v. 1.0 which is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+ */
+#ifndef DDSI_SHM_H
+#define DDSI_SHM_H
+
+#include "dds/ddsi/q_protocol.h"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+struct ddsi_domaingv;
+
+/* Registers the "shm" transport factory if shared memory is enabled in the
+   configuration and supported on the platform.  It is never the primary
+   factory: it is used next to UDP to reach peers on the same host. */
+int ddsi_shm_init (struct ddsi_domaingv *gv);
+
+/* Returns true iff the locator is a shared memory locator of a peer on this
+   host with a receive ring that can be opened. */
+bool ddsi_shm_locator_reachable (const struct ddsi_domaingv *gv, const nn_locator_t *loc);
+
+/* Reference to the contents of a chunk in the shared memory pool of some
+   domain instance on this host.  It is what gets sent instead of the sample
+   itself to readers that can map that pool, and as it never leaves the host
+   it is in native byte order. */
+struct ddsi_shm_chunk_desc {
+  unsigned char hostid[16];
+  uint32_t port;      /* identifies the pool: unicast data port of the owner */
+  uint32_t pool_id;   /* distinguishes successive pools using the same port */
+  uint32_t index;
+  uint32_t gen;       /* incremented each time the chunk is allocated */
+  uint32_t size;      /* number of bytes in use */
+};
+
+/* Size of the payload of a chunk in the pool of this domain instance, 0 if
+   there is no pool */
+uint32_t ddsi_shm_chunk_size (const struct ddsi_domaingv *gv);
+
+/* Allocates a chunk from the pool of this domain instance, returning a
+   pointer to its (64-byte aligned) payload with a reference count of 1, or
+   NULL if no chunk is available */
+void *ddsi_shm_chunk_alloc (struct ddsi_domaingv *gv);
+
+/* Returns true iff payload points to an allocated chunk in the pool of this
+   domain instance */
+bool ddsi_shm_chunk_is_local (const struct ddsi_domaingv *gv, const void *payload);
+
+/* Reference counting works for any chunk that is mapped in this process,
+   regardless of the pool it belongs to */
+void ddsi_shm_chunk_ref (void *payload);
+void ddsi_shm_chunk_unref (void *payload);
+
+/* Fills in a descriptor for "size" bytes of a local chunk */
+void ddsi_shm_chunk_describe (const struct ddsi_domaingv *gv, const void *payload, uint32_t size, struct ddsi_shm_chunk_desc *desc);
+
+/* Maps the chunk described by desc, returning a pointer to its payload and
+   a new reference to it; returns NULL if the chunk can't be mapped or has
+   been recycled in the meantime */
+void *ddsi_shm_chunk_resolve (struct ddsi_domaingv *gv, const struct ddsi_shm_chunk_desc *desc);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif
@@ -20,9 +20,11 @@ extern "C" {
 
 struct reader;
 struct writer;
+struct ddsi_domaingv;
 
-void ddsi_get_writer_stats (struct writer *wr, uint64_t * __restrict rexmit_bytes, uint32_t * __restrict throttle_count, uint64_t * __restrict time_throttled, uint64_t * __restrict time_retransmit);
+void ddsi_get_writer_stats (struct writer *wr, uint64_t * __restrict rexmit_bytes, uint32_t * __restrict throttle_count, uint64_t * __restrict time_throttled, uint64_t * __restrict time_retransmit, uint64_t * __restrict cc_rate, uint64_t * __restrict cc_rtt, uint32_t * __restrict cc_loss, uint32_t * __restrict heartbeats_sent, uint32_t * __restrict acknacks_received, uint64_t * __restrict filtered_count);
 void ddsi_get_reader_stats (struct reader *rd, uint64_t * __restrict discarded_bytes);
+void ddsi_get_rbuf_stats (struct ddsi_domaingv *gv, uint32_t * __restrict rbuf_count, uint64_t * __restrict rbuf_bytes, uint64_t * __restrict retained_bytes);
 
 #if defined (__cplusplus)
 }
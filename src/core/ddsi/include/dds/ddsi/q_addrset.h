@@ -62,7 +62,7 @@ void addrset_any_uc_else_mc_nofail (const struct addrset *as, nn_locator_t *dst)
 
 /* Keeps AS locked */
 int addrset_forone (struct addrset *as, addrset_forone_fun_t f, void *arg);
-void addrset_forall (struct addrset *as, addrset_forall_fun_t f, void *arg);
+DDS_EXPORT void addrset_forall (struct addrset *as, addrset_forall_fun_t f, void *arg);
 size_t addrset_forall_count (struct addrset *as, addrset_forall_fun_t f, void *arg);
 void nn_log_addrset (struct ddsi_domaingv *gv, uint32_t tf, const char *prefix, const struct addrset *as);
 
@@ -70,6 +70,11 @@ void nn_log_addrset (struct ddsi_domaingv *gv, uint32_t tf, const char *prefix,
    trylock B fails */
 int addrset_eq_onesidederr (const struct addrset *a, const struct addrset *b);
 
+/* Returns true iff the set contains a locator of the given kind, resp. contains
+   no locators of any other kind (which is also true for an empty set) */
+int addrset_contains_kind (const struct addrset *as, int32_t kind);
+int addrset_contains_only_kind (const struct addrset *as, int32_t kind);
+
 int is_unspec_locator (const nn_locator_t *loc);
 void set_unspec_locator (nn_locator_t *loc);
 
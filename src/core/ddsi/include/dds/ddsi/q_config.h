@@ -254,6 +254,7 @@ struct config
   int64_t liveliness_monitoring_interval;
   int prioritize_retransmit;
   int xpack_send_async;
+  int use_io_uring;
   enum boolean_default multiple_recv_threads;
   unsigned recv_thread_stop_maxretries;
 
@@ -261,12 +262,15 @@ struct config
   unsigned secondary_reorder_maxsamples;
 
   unsigned delivery_queue_maxsamples;
+  unsigned builtin_delivery_queues;
 
   uint16_t fragment_size;
   uint32_t max_msg_size;
   uint32_t max_rexmit_msg_size;
   uint32_t init_transmit_extra_pct;
   uint32_t max_rexmit_burst_size;
+  uint32_t max_historical_data_burst_size;
+  int64_t historical_data_burst_interval;
 
   int publish_uc_locators; /* Publish discovery unicast locators */
   int enable_uc_locators; /* If false, don't even try to create a unicast socket */
@@ -291,6 +295,16 @@ struct config
   struct ssl_min_version ssl_min_version;
 #endif
 
+  /* Shared memory transport configuration */
+  int shm_enable;
+  uint32_t shm_ring_size;
+  uint32_t shm_chunk_size;
+  uint32_t shm_chunk_count;
+
+  /* Durability service configuration */
+  int durability_enable;
+  char *durability_directory;
+
   /* Thread pool configuration */
   int tp_enable;
   uint32_t tp_threads;
@@ -323,13 +337,24 @@ struct config
   /* Write cache */
 
   int whc_batch;
+  int64_t write_batch_max_delay;
   uint32_t whc_lowwater_mark;
   uint32_t whc_highwater_mark;
   struct config_maybe_uint32 whc_init_highwater_mark;
   int whc_adaptive;
 
+  int congestion_control_enable;
+  uint32_t congestion_min_rate; /* bytes/second */
+  uint32_t congestion_max_rate; /* bytes/second, 0 = inf */
+
+  int adaptive_heartbeats;
+
+  int priority_scheduling_enable;
+  char *priority_scheduling_diffserv;
+
   unsigned defrag_unreliable_maxsamples;
   unsigned defrag_reliable_maxsamples;
+  uint32_t defrag_direct_min_size;
   unsigned accelerate_rexmit_block_size;
   int64_t responsiveness_timeout;
   uint32_t max_participants;
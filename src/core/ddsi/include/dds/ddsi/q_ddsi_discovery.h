@@ -27,6 +27,7 @@ struct ddsi_plist;
 
 struct participant_builtin_topic_data_locators {
   struct nn_locators_one def_uni_loc_one, def_multi_loc_one, meta_uni_loc_one, meta_multi_loc_one;
+  struct nn_locators_one def_uni_loc_shm, meta_uni_loc_shm;
 };
 
 void get_participant_builtin_topic_data (const struct participant *pp, ddsi_plist_t *dst, struct participant_builtin_topic_data_locators *locs);
@@ -40,6 +41,7 @@ int sedp_dispose_unregister_writer (struct writer *wr);
 int sedp_dispose_unregister_reader (struct reader *rd);
 
 int builtins_dqueue_handler (const struct nn_rsample_info *sampleinfo, const struct nn_rdata *fragchain, const ddsi_guid_t *rdguid, void *qarg);
+struct nn_dqueue *builtins_dqueue_for_prefix (const struct ddsi_domaingv *gv, const ddsi_guid_prefix_t *prefix);
 
 #if defined (__cplusplus)
 }
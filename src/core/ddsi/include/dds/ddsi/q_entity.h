@@ -22,6 +22,7 @@
 #include "dds/ddsi/q_protocol.h"
 #include "dds/ddsi/q_lat_estim.h"
 #include "dds/ddsi/q_hbcontrol.h"
+#include "dds/ddsi/ddsi_congestion.h"
 #include "dds/ddsi/q_feature_check.h"
 #include "dds/ddsi/q_inverse_uint32_set.h"
 #include "dds/ddsi/ddsi_serdata_default.h"
@@ -37,10 +38,12 @@ struct xevent;
 struct nn_reorder;
 struct nn_defrag;
 struct nn_dqueue;
+struct coherent_set_buffer;
 struct nn_rsample_info;
 struct nn_rdata;
 struct addrset;
 struct ddsi_sertopic;
+struct ddsi_filter;
 struct whc;
 struct dds_qos;
 struct ddsi_plist;
@@ -125,10 +128,12 @@ struct wr_prd_match {
   unsigned has_replied_to_hb: 1; /* we must keep sending HBs until all readers have this set */
   unsigned all_have_replied_to_hb: 1; /* true iff 'has_replied_to_hb' for all readers in subtree */
   unsigned is_reliable: 1; /* true iff reliable proxy reader */
+  unsigned in_cover_locs: 1; /* true iff the locators of the proxy reader are counted in the writer's "cover_locs" */
   seqno_t min_seq; /* smallest ack'd seq nr in subtree */
   seqno_t max_seq; /* sort-of highest ack'd seq nr in subtree (see augment function) */
   seqno_t seq; /* highest acknowledged seq nr */
   seqno_t last_seq; /* highest seq send to this reader used when filter is applied */
+  struct ddsi_filter *filter; /* content filter advertised by the reader, evaluated by the writer (or NULL) */
   uint32_t num_reliable_readers_where_seq_equals_max;
   ddsi_guid_t arbitrary_unacked_reader;
   nn_count_t prev_acknack; /* latest accepted acknack sequence number */
@@ -137,8 +142,14 @@ struct wr_prd_match {
   ddsrt_etime_t t_nackfrag_accepted; /* (local) time a nackfrag was last accepted */
   struct nn_lat_estim hb_to_ack_latency;
   ddsrt_wctime_t hb_to_ack_latency_tlastlog;
+  ddsrt_mtime_t t_ackhb; /* time an ack-requesting heartbeat was last unicast to this reader (adaptive heartbeats) */
+  ddsrt_mtime_t t_ack; /* time an acknack was last accepted (adaptive heartbeats) */
+  int64_t ack_latency; /* smoothed heartbeat-to-acknack latency in ns, 0 if unknown (adaptive heartbeats) */
   uint32_t non_responsive_count;
   uint32_t rexmit_requests;
+  struct xevent *hist_xevent; /* event streaming historical data to this reader, NULL if not (or no longer) doing so */
+  seqno_t hist_seq; /* next seq nr to be streamed by hist_xevent */
+  seqno_t hist_maxseq; /* last seq nr to be streamed, later ones are sent as usual */
 #ifdef DDSI_INCLUDE_SECURITY
   int64_t crypto_handle;
 #endif
@@ -285,7 +296,7 @@ struct writer
   void * status_cb_entity;
   ddsrt_cond_t throttle_cond; /* used to trigger a transmit thread blocked in throttle_writer() or wait_for_acks() */
   seqno_t seq; /* last sequence number (transmitted seqs are 1 ... seq) */
-  seqno_t cs_seq; /* 1st seq in coherent set (or 0) */
+  seqno_t cs_seq; /* 1st seq in coherent set (or 0 if not in a coherent set or nothing written in it yet) */
   seq_xmit_t seq_xmit; /* last sequence number actually transmitted */
   seqno_t min_local_readers_reject_seq; /* mimum of local_readers->last_deliv_seq */
   nn_count_t hbcount; /* last hb seq number */
@@ -299,11 +310,14 @@ struct writer
   unsigned include_keyhash: 1; /* iff 1, this writer includes a keyhash; keyless topics => include_keyhash = 0 */
   unsigned force_md5_keyhash: 1; /* iff 1, when keyhash has to be hashed, no matter the size */
   unsigned retransmitting: 1; /* iff 1, this writer is currently retransmitting */
+  unsigned in_coherent_set: 1; /* iff 1, samples written are part of a coherent set, see writer_begin_coherent_set */
   unsigned alive: 1; /* iff 1, the writer is alive (lease for this writer is not expired); field may be modified only when holding both wr->e.lock and wr->c.pp->e.lock */
   unsigned test_ignore_acknack : 1; /* iff 1, the writer ignores all arriving ACKNACK messages */
   unsigned test_suppress_retransmit : 1; /* iff 1, the writer does not respond to retransmit requests */
   unsigned test_suppress_heartbeat : 1; /* iff 1, the writer suppresses all periodic heartbeats */
   unsigned test_drop_outgoing_data : 1; /* iff 1, the writer drops outgoing data, forcing the readers to request a retransmit */
+  unsigned congestion_control: 1; /* iff 1, transmit rate is paced by "cc" */
+  unsigned adaptive_heartbeat: 1; /* iff 1, heartbeats are aligned per participant and unicast to lagging readers */
 #ifdef DDSI_INCLUDE_SSM
   unsigned supports_ssm: 1;
   struct addrset *ssm_as;
@@ -323,20 +337,30 @@ struct writer
   uint32_t rexmit_burst_size_limit; /* derived from reader's receive_buffer_size */
   uint32_t num_readers; /* total number of matching PROXY readers */
   uint32_t num_reliable_readers; /* number of matching reliable PROXY readers */
+  uint32_t num_filtered_readers; /* number of matching PROXY readers with a content filter */
   ddsrt_avl_tree_t readers; /* all matching PROXY readers, see struct wr_prd_match */
   ddsrt_avl_tree_t local_readers; /* all matching LOCAL readers, see struct wr_rd_match */
+  ddsrt_avl_tree_t cover_locs; /* locators of matching PROXY readers with reference counts, for incrementally updating "as" */
+  unsigned cover_incremental: 1; /* iff 1, "as" can be updated incrementally using cover_locs */
+  uint32_t min_receive_buffer_size; /* smallest receive buffer size of matching PROXY readers */
+  uint32_t min_receive_buffer_size_count; /* number of matching PROXY readers with that receive buffer size */
+  uint32_t num_incremental_addrset_updates; /* cum matches/unmatches handled without recomputing "as" */
 #ifdef DDSI_INCLUDE_NETWORK_PARTITIONS
   uint32_t partition_id;
 #endif
   uint32_t num_acks_received; /* cum received ACKNACKs with no request for retransmission */
   uint32_t num_nacks_received; /* cum received ACKNACKs that did request retransmission */
+  uint32_t num_heartbeats_sent; /* cum HEARTBEATs sent, including piggybacked ones */
   uint32_t throttle_count; /* cum times transmitting was throttled (whc hitting high-level mark) */
   uint32_t throttle_tracing;
   uint32_t rexmit_count; /* cum samples retransmitted (counting events; 1 sample can be counted many times) */
   uint32_t rexmit_lost_count; /* cum samples lost but retransmit requested (also counting events) */
   uint64_t rexmit_bytes; /* cum bytes queued for retransmit */
+  uint64_t filtered_count; /* cum samples not sent to a reader because its content filter rejected them */
   uint64_t time_throttled; /* cum time in throttled state */
   uint64_t time_retransmit; /* cum time in retransmitting state */
+  struct ddsi_congestion cc; /* rate controller, only used if "congestion_control" set */
+  uint32_t fec_group_size; /* number of DATA_FRAG submessages covered by one FEC submessage, 0 if FEC is disabled */
   struct xeventq *evq; /* timed event queue to be used by this writer */
   struct local_reader_ary rdary; /* LOCAL readers for fast-pathing; if not fast-pathed, fall back to scanning local_readers */
   struct lease *lease; /* for liveliness administration (writer can only become inactive when using manual liveliness) */
@@ -375,6 +399,7 @@ struct reader
   struct addrset *as;
 #endif
   const struct ddsi_sertopic * topic; /* topic */
+  nn_content_filter_property_t *content_filter; /* content filter advertised in discovery (or NULL) */
   uint32_t num_writers; /* total number of matching PROXY writers */
   ddsrt_avl_tree_t writers; /* all matching PROXY writers, see struct rd_pwr_match */
   ddsrt_avl_tree_t local_writers; /* all matching LOCAL writers, see struct rd_wr_match */
@@ -476,6 +501,7 @@ struct proxy_writer {
   struct nn_dqueue *dqueue; /* delivery queue for asynchronous delivery (historical data is always delivered asynchronously) */
   struct xeventq *evq; /* timed event queue to be used for ACK generation */
   struct local_reader_ary rdary; /* LOCAL readers for fast-pathing; if not fast-pathed, fall back to scanning local_readers */
+  struct coherent_set_buffer *coherent_set; /* samples of the coherent set being received, delivered once complete; only used by in-sync delivery */
   ddsi2direct_directread_cb_t ddsi2direct_cb;
   void *ddsi2direct_cbarg;
   struct lease *lease;
@@ -495,6 +521,7 @@ struct proxy_reader {
   ddsrt_avl_tree_t writers; /* matching LOCAL writers */
   uint32_t receive_buffer_size; /* assumed receive buffer size inherited from proxypp */
   filter_fn_t filter;
+  nn_content_filter_property_t *content_filter; /* content filter from discovery (or NULL), protected by e.lock */
 };
 
 DDS_EXPORT extern const ddsrt_avl_treedef_t wr_readers_treedef;
@@ -671,6 +698,9 @@ dds_return_t new_writer (struct writer **wr_out, struct ddsi_guid *wrguid, const
 dds_return_t new_reader (struct reader **rd_out, struct ddsi_guid *rdguid, const struct ddsi_guid *group_guid, struct participant *pp, const struct ddsi_sertopic *topic, const struct dds_qos *xqos, struct ddsi_rhc * rhc, status_cb_t status_cb, void *status_cb_arg);
 
 void update_reader_qos (struct reader *rd, const struct dds_qos *xqos);
+/* Sets the content filter advertised in discovery (NULL: none), so matched
+   remote writers can avoid sending samples the reader would discard */
+DDS_EXPORT void update_reader_content_filter (struct reader *rd, const nn_content_filter_property_t *content_filter);
 void update_writer_qos (struct writer *wr, const struct dds_qos *xqos);
 
 struct whc_node;
@@ -747,7 +777,7 @@ int new_proxy_reader (struct ddsi_domaingv *gv, const struct ddsi_guid *ppguid,
 int delete_proxy_writer (struct ddsi_domaingv *gv, const struct ddsi_guid *guid, ddsrt_wctime_t timestamp, int isimplicit);
 int delete_proxy_reader (struct ddsi_domaingv *gv, const struct ddsi_guid *guid, ddsrt_wctime_t timestamp, int isimplicit);
 
-void update_proxy_reader (struct proxy_reader *prd, seqno_t seq, struct addrset *as, const struct dds_qos *xqos, ddsrt_wctime_t timestamp);
+void update_proxy_reader (struct proxy_reader *prd, seqno_t seq, struct addrset *as, const struct dds_qos *xqos, const nn_content_filter_property_t *content_filter, ddsrt_wctime_t timestamp);
 void update_proxy_writer (struct proxy_writer *pwr, seqno_t seq, struct addrset *as, const struct dds_qos *xqos, ddsrt_wctime_t timestamp);
 
 void proxy_writer_set_alive_may_unlock (struct proxy_writer *pwr, bool notify);
@@ -760,7 +790,7 @@ void delete_proxy_group (struct entity_index *entidx, const struct ddsi_guid *gu
 
 /* Call this to empty all address sets of all writers to stop all outgoing traffic, or to
    rebuild them all (which only makes sense after previously having emptied them all). */
-void rebuild_or_clear_writer_addrsets(struct ddsi_domaingv *gv, int rebuild);
+DDS_EXPORT void rebuild_or_clear_writer_addrsets(struct ddsi_domaingv *gv, int rebuild);
 
 void local_reader_ary_setfastpath_ok (struct local_reader_ary *x, bool fastpath_ok);
 
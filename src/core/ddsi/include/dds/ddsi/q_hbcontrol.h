@@ -19,11 +19,17 @@ extern "C" {
 struct writer;
 struct whc_state;
 struct proxy_reader;
+struct wr_prd_match;
+
+/* Adaptive heartbeats are unicast to the readers that haven't acknowledged
+   all data if there are at most this many, else they are multicast */
+#define WRITER_HBCONTROL_MAX_UNICAST 8
 
 struct hbcontrol {
   ddsrt_mtime_t t_of_last_write;
   ddsrt_mtime_t t_of_last_hb;
   ddsrt_mtime_t t_of_last_ackhb;
+  ddsrt_mtime_t t_of_last_multicast_ackhb; /* time of last ack-requesting heartbeat that went to all readers */
   ddsrt_mtime_t tsched;
   uint32_t hbs_since_last_write;
   uint32_t last_packetid;
@@ -36,6 +42,12 @@ int writer_hbcontrol_ack_required (const struct writer *wr, const struct whc_sta
 struct nn_xmsg *writer_hbcontrol_piggyback (struct writer *wr, const struct whc_state *whcst, ddsrt_mtime_t tnow, uint32_t packetid, int *hbansreq);
 int writer_hbcontrol_must_send (const struct writer *wr, const struct whc_state *whcst, ddsrt_mtime_t tnow);
 struct nn_xmsg *writer_hbcontrol_create_heartbeat (struct writer *wr, const struct whc_state *whcst, ddsrt_mtime_t tnow, int hbansreq, int issync);
+void writer_hbcontrol_note_hb (struct writer *wr, ddsrt_mtime_t tnow, int ansreq);
+ddsrt_mtime_t writer_hbcontrol_align (const struct writer *wr, ddsrt_mtime_t t);
+uint32_t writer_hbcontrol_num_lagging_readers (const struct writer *wr);
+int writer_hbcontrol_ack_pending (const struct writer *wr, const struct wr_prd_match *m, ddsrt_mtime_t tnow);
+void writer_hbcontrol_note_ack (const struct writer *wr, struct wr_prd_match *m, ddsrt_mtime_t tnow);
+struct nn_xmsg *writer_hbcontrol_create_unicast_heartbeat (struct writer *wr, const struct whc_state *whcst, int hbansreq, struct proxy_reader *prd, int issync);
 
 #ifdef DDSI_INCLUDE_SECURITY
 struct nn_xmsg *writer_hbcontrol_p2p(struct writer *wr, const struct whc_state *whcst, int hbansreq, struct proxy_reader *prd);
@@ -110,6 +110,7 @@ typedef struct {
 #define NN_LOCATOR_KIND_TCPv4 4
 #define NN_LOCATOR_KIND_TCPv6 8
 #define NN_LOCATOR_KIND_RAWETH 0x8000 /* proposed vendor-specific */
+#define NN_LOCATOR_KIND_SHM 0x8001 /* vendor-specific: same-host shared memory ring */
 #define NN_LOCATOR_KIND_UDPv4MCGEN 0x4fff0000
 #define NN_LOCATOR_PORT_INVALID 0
 
@@ -163,7 +164,8 @@ typedef enum SubmessageKind {
   SMID_SRTPS_POSTFIX = 0x34,
   /* vendor-specific sub messages (0x80 .. 0xff) */
   SMID_ADLINK_MSG_LEN = 0x81,
-  SMID_ADLINK_ENTITY_ID = 0x82
+  SMID_ADLINK_ENTITY_ID = 0x82,
+  SMID_ADLINK_FEC = 0x83
 } SubmessageKind_t;
 
 typedef struct InfoTimestamp {
@@ -230,6 +232,13 @@ typedef struct DataFrag {
 #define DATAFRAG_FLAG_INLINE_QOS 0x02u
 #define DATAFRAG_FLAG_KEYFLAG 0x04u
 
+/* ADLINK_FEC uses the DataFrag layout and flags to carry the XOR parity of
+   a group of "units" of a sample: fragmentsInSubmessage fragments each,
+   starting at fragmentStartingNum, with the number of units in the group
+   in extraFlags.  The payload is as long as the first unit and each unit
+   is zero-padded to that length.  Inline QoS is present iff the group
+   contains the first fragment. */
+
 typedef struct MsgLen {
   SubmessageHeader_t smhdr;
   uint32_t length;
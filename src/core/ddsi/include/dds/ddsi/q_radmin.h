@@ -207,19 +207,61 @@ typedef void (*nn_dqueue_callback_t) (void *arg);
 struct nn_rbufpool *nn_rbufpool_new (const struct ddsrt_log_cfg *logcfg, uint32_t rbuf_size, uint32_t max_rmsg_size);
 void nn_rbufpool_setowner (struct nn_rbufpool *rbp, ddsrt_thread_t tid);
 void nn_rbufpool_free (struct nn_rbufpool *rbp);
+/* Number of rbufs currently allocated (including those no longer used for
+   receiving but still referenced), their size and the number of payload bytes
+   retained by nn_rmsg_retain */
+void nn_rbufpool_stats (struct nn_rbufpool *rbp, uint32_t *n_rbufs, uint32_t *rbuf_size, uint32_t *retained);
 
 struct nn_rmsg *nn_rmsg_new (struct nn_rbufpool *rbufpool);
 void nn_rmsg_setsize (struct nn_rmsg *rmsg, uint32_t size);
 void nn_rmsg_commit (struct nn_rmsg *rmsg);
 void nn_rmsg_free (struct nn_rmsg *rmsg);
 void *nn_rmsg_alloc (struct nn_rmsg *rmsg, uint32_t size);
+/* Maximum number of rbufs of a pool that retained payload may keep alive */
+#define NN_RBUFPOOL_MAX_PINNED 4
+
+/* Retained data in a received message (see nn_rmsg_retain), typically
+   embedded in whatever references the data.  If the rbuf it is in is no longer
+   used for receiving and the retained data only use a small part of it, unpin
+   (if not NULL) gets called with the pool locked to ask the retainer to stop
+   referencing it, so that the rbuf can be freed.  If it returns true, the
+   retainer takes over the rmsg's reference, which it must drop using
+   nn_rmsg_release_unpinned once it no longer accesses the data, and
+   nn_rmsg_release becomes a no-op.  If it returns false, the data remains
+   retained. */
+struct nn_rmsg_retainer {
+  struct nn_rmsg_retainer *prev, *next;
+  struct nn_rbufpool *rbufpool; /* non-NULL iff unpin may be called */
+  struct nn_rmsg *rmsg;
+  uint32_t size;
+  bool (*unpin) (struct nn_rmsg_retainer *r);
+};
+
+/* Adds a reference to a received message for retaining "size" bytes of its
+   payload (e.g., a serdata referencing the sample in it) beyond its delivery,
+   provided the pool's budget for retained data allows it and doing so doesn't
+   pin more than NN_RBUFPOOL_MAX_PINNED rbufs; returns false otherwise.  The
+   caller sets r->unpin, the other fields of r are initialized by this function.
+   nn_rmsg_release drops the reference and the size again. */
+bool nn_rmsg_retain (struct nn_rmsg *rmsg, uint32_t size, struct nn_rmsg_retainer *r);
+void nn_rmsg_release (struct nn_rmsg_retainer *r);
+void nn_rmsg_release_unpinned (struct nn_rmsg *rmsg);
+/* Prevents any further calls to r->unpin */
+void nn_rmsg_retainer_keep (struct nn_rmsg_retainer *r);
 
 struct nn_rdata *nn_rdata_new (struct nn_rmsg *rmsg, uint32_t start, uint32_t endp1, uint32_t submsg_offset, uint32_t payload_offset);
 struct nn_rdata *nn_rdata_newgap (struct nn_rmsg *rmsg);
 void nn_fragchain_adjust_refcount (struct nn_rdata *frag, int adjust);
 void nn_fragchain_unref (struct nn_rdata *frag);
-
-struct nn_defrag *nn_defrag_new (const struct ddsrt_log_cfg *logcfg, enum nn_defrag_drop_mode drop_mode, uint32_t max_samples);
+/* Adds a reference to a fragchain the caller already holds a reference to, e.g.,
+   to retain one passed to a dqueue handler beyond the call; undone by nn_fragchain_unref */
+void nn_fragchain_ref (struct nn_rdata *frag);
+
+/* Fragmented samples of at least direct_min_size bytes are reassembled by
+   copying the fragments into a buffer allocated for the entire sample as they
+   arrive, rather than by keeping all fragments until the sample is complete;
+   0 disables this */
+struct nn_defrag *nn_defrag_new (const struct ddsrt_log_cfg *logcfg, enum nn_defrag_drop_mode drop_mode, uint32_t max_samples, uint32_t direct_min_size);
 void nn_defrag_free (struct nn_defrag *defrag);
 struct nn_rsample *nn_defrag_rsample (struct nn_defrag *defrag, struct nn_rdata *rdata, const struct nn_rsample_info *sampleinfo);
 void nn_defrag_notegap (struct nn_defrag *defrag, seqno_t min, seqno_t maxp1);
@@ -232,6 +274,13 @@ enum nn_defrag_nackmap_result {
 
 enum nn_defrag_nackmap_result nn_defrag_nackmap (struct nn_defrag *defrag, seqno_t seq, uint32_t maxfragnum, struct nn_fragment_number_set_header *map, uint32_t *mapbits, uint32_t maxsz);
 
+/* Forward error correction: "parity" is the XOR of the units of unitsize bytes
+   that make up bytes [min,maxp1) of sample seq of size bytes, each zero-padded
+   to unitsize bytes.  If exactly one of those units is missing, the others are
+   XOR'd into parity, turning it into the missing unit, and its index is
+   returned; else returns UINT32_MAX and the contents of parity are undefined */
+uint32_t nn_defrag_fec_recover (struct nn_defrag *defrag, seqno_t seq, uint32_t size, uint32_t min, uint32_t maxp1, uint32_t unitsize, unsigned char *parity);
+
 void nn_defrag_prune (struct nn_defrag *defrag, ddsi_guid_prefix_t *dst, seqno_t min);
 
 struct nn_reorder *nn_reorder_new (const struct ddsrt_log_cfg *logcfg, enum nn_reorder_mode mode, uint32_t max_samples, bool late_ack_mode);
@@ -23,6 +23,7 @@ struct ddsi_tran_listener;
 struct recv_thread_arg;
 struct writer;
 struct proxy_reader;
+struct coherent_set_buffer;
 
 struct nn_gap_info {
   int64_t gapstart;
@@ -39,6 +40,8 @@ void trigger_recv_threads (const struct ddsi_domaingv *gv);
 uint32_t recv_thread (void *vrecv_thread_arg);
 uint32_t listen_thread (struct ddsi_tran_listener * listener);
 int user_dqueue_handler (const struct nn_rsample_info *sampleinfo, const struct nn_rdata *fragchain, const ddsi_guid_t *rdguid, void *qarg);
+/* Frees a proxy writer's buffered incomplete coherent set (if any) without delivering it */
+void coherent_set_buffer_free (struct coherent_set_buffer *cs);
 int add_Gap (struct nn_xmsg *msg, struct writer *wr, struct proxy_reader *prd, seqno_t start, seqno_t base, uint32_t numbits, const uint32_t *bits);
 
 #if defined (__cplusplus)
@@ -39,6 +39,23 @@ int write_sample_nogc (struct thread_state1 * const ts1, struct nn_xpack *xp, st
 int write_sample_gc_notk (struct thread_state1 * const ts1, struct nn_xpack *xp, struct writer *wr, struct ddsi_serdata *serdata);
 int write_sample_nogc_notk (struct thread_state1 * const ts1, struct nn_xpack *xp, struct writer *wr, struct ddsi_serdata *serdata);
 
+/* Writing n new samples in one go, equivalent to n calls to write_sample_gc
+   but taking the writer lock only once.  All serdata are unref'd; on failure,
+   the first *nwritten samples have been written and the others dropped.  xp
+   must not be NULL. */
+int write_sample_gc_batch (struct thread_state1 * const ts1, struct nn_xpack *xp, struct writer *wr, uint32_t n, struct ddsi_serdata **serdata, struct ddsi_tkmap_instance **tk, uint32_t *nwritten);
+
+/* Coherent sets: all samples written between writer_begin_coherent_set and
+   write_end_coherent_set carry the sequence number of the first one in their
+   inline QoS, and the set is terminated by an "end of coherent set" message:
+   a DATA without payload carrying the same coherent set sequence number, so
+   that readers can deliver the set as a whole.  Ending a set in which nothing
+   was written doesn't send anything.  write_end_coherent_set returns the same
+   as write_sample_gc and UNSUPPORTED if the topic can't represent an empty
+   sample. */
+void writer_begin_coherent_set (struct writer *wr);
+int write_end_coherent_set (struct thread_state1 * const ts1, struct nn_xpack *xp, struct writer *wr);
+
 /* When calling the following functions, wr->lock must be held */
 dds_return_t create_fragment_message (struct writer *wr, seqno_t seq, const struct ddsi_plist *plist, struct ddsi_serdata *serdata, uint32_t fragnum, uint16_t nfrags, struct proxy_reader *prd,struct nn_xmsg **msg, int isnew, uint32_t advertised_fragnum);
 int enqueue_sample_wrlock_held (struct writer *wr, seqno_t seq, const struct ddsi_plist *plist, struct ddsi_serdata *serdata, struct proxy_reader *prd, int isnew);
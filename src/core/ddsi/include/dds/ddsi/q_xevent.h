@@ -69,6 +69,9 @@ DDS_EXPORT struct xevent *qxev_acknack (struct xeventq *evq, ddsrt_mtime_t tsche
 DDS_EXPORT struct xevent *qxev_spdp (struct xeventq *evq, ddsrt_mtime_t tsched, const ddsi_guid_t *pp_guid, const ddsi_guid_t *proxypp_guid);
 DDS_EXPORT struct xevent *qxev_pmd_update (struct xeventq *evq, ddsrt_mtime_t tsched, const ddsi_guid_t *pp_guid);
 DDS_EXPORT struct xevent *qxev_delete_writer (struct xeventq *evq, ddsrt_mtime_t tsched, const ddsi_guid_t *guid);
+/* Streams the historical data of writer wr_guid to proxy reader prd_guid, the event
+   deletes itself once done or once it no longer is the match's hist_xevent */
+DDS_EXPORT struct xevent *qxev_historical_data (struct xeventq *evq, ddsrt_mtime_t tsched, const ddsi_guid_t *wr_guid, const ddsi_guid_t *prd_guid);
 
 /* cb will be called with now = NEVER if the event is still enqueued when when xeventq_free starts cleaning up */
 DDS_EXPORT struct xevent *qxev_callback (struct xeventq *evq, ddsrt_mtime_t tsched, void (*cb) (struct xevent *xev, void *arg, ddsrt_mtime_t now), void *arg);
@@ -75,6 +75,11 @@ void nn_xmsg_setdstN (struct nn_xmsg *msg, struct addrset *as, struct addrset *a
 
 int nn_xmsg_setmaxdelay (struct nn_xmsg *msg, int64_t maxdelay);
 
+/* Sets the priority used for ordering the packets in the queue of the
+   asynchronous send thread if Internal/PriorityScheduling is enabled,
+   0 by default */
+void nn_xmsg_setpriority (struct nn_xmsg *msg, int32_t priority);
+
 #ifdef DDSI_INCLUDE_NETWORK_PARTITIONS
 int nn_xmsg_setencoderid (struct nn_xmsg *msg, uint32_t encoderid);
 #endif
@@ -152,6 +157,10 @@ void nn_xpack_sendq_start (struct ddsi_domaingv *gv);
 void nn_xpack_sendq_stop (struct ddsi_domaingv *gv);
 void nn_xpack_sendq_fini (struct ddsi_domaingv *gv);
 
+/* Returns the transmit connection for data of a writer with the given
+   transport priority: that of the matching transmit class or gv->xmit_conn */
+ddsi_tran_conn_t nn_xmit_conn_for_priority (const struct ddsi_domaingv *gv, int32_t priority);
+
 #if defined (__cplusplus)
 }
 #endif
@@ -41,6 +41,7 @@ static void dds_ostream_grow (dds_ostream_t * __restrict st, uint32_t size)
 
   st->m_buffer = ddsrt_realloc (old, newSize);
   st->m_size = newSize;
+  st->m_reallocs++;
 }
 
 static void dds_cdr_resize (dds_ostream_t * __restrict s, uint32_t l)
@@ -256,9 +257,17 @@ size_t dds_stream_check_optimize (const struct ddsi_sertopic_default_desc * __re
   return dds_stream_check_optimize1 (desc);
 }
 
-static void dds_stream_countops1 (const uint32_t * __restrict ops, const uint32_t **ops_end);
+static void dds_stream_countops1 (const uint32_t * __restrict ops, const uint32_t **ops_end, uint32_t *align);
 
-static const uint32_t *dds_stream_countops_seq (const uint32_t * __restrict ops, uint32_t insn, const uint32_t **ops_end)
+static void countops_align (enum dds_stream_typecode type, uint32_t *align)
+{
+  /* anything that isn't an 8-byte primitive (including lengths of strings and
+     sequences) requires at most 4-byte alignment */
+  if (type == DDS_OP_VAL_8BY)
+    *align = 8;
+}
+
+static const uint32_t *dds_stream_countops_seq (const uint32_t * __restrict ops, uint32_t insn, const uint32_t **ops_end, uint32_t *align)
 {
   const enum dds_stream_typecode subtype = DDS_OP_SUBTYPE (insn);
   switch (subtype)
@@ -275,7 +284,7 @@ static const uint32_t *dds_stream_countops_seq (const uint32_t * __restrict ops,
       uint32_t const * const jsr_ops = ops + DDS_OP_ADR_JSR (ops[3]);
       if (ops + 4 > *ops_end)
         *ops_end = ops + 4;
-      dds_stream_countops1 (jsr_ops, ops_end);
+      dds_stream_countops1 (jsr_ops, ops_end, align);
       ops += (jmp ? jmp : 4); /* FIXME: why would jmp be 0? */
     }
   }
@@ -284,7 +293,7 @@ static const uint32_t *dds_stream_countops_seq (const uint32_t * __restrict ops,
   return ops;
 }
 
-static const uint32_t *dds_stream_countops_arr (const uint32_t * __restrict ops, uint32_t insn, const uint32_t **ops_end)
+static const uint32_t *dds_stream_countops_arr (const uint32_t * __restrict ops, uint32_t insn, const uint32_t **ops_end, uint32_t *align)
 {
   const enum dds_stream_typecode subtype = DDS_OP_SUBTYPE (insn);
   switch (subtype)
@@ -301,7 +310,7 @@ static const uint32_t *dds_stream_countops_arr (const uint32_t * __restrict ops,
       const uint32_t *jsr_ops = ops + DDS_OP_ADR_JSR (ops[3]);
       if (ops + 5 > *ops_end)
         *ops_end = ops + 5;
-      dds_stream_countops1 (jsr_ops, ops_end);
+      dds_stream_countops1 (jsr_ops, ops_end, align);
       ops += (jmp ? jmp : 5);
       break;
     }
@@ -311,13 +320,14 @@ static const uint32_t *dds_stream_countops_arr (const uint32_t * __restrict ops,
   return ops;
 }
 
-static const uint32_t *dds_stream_countops_uni (const uint32_t * __restrict ops, const uint32_t **ops_end)
+static const uint32_t *dds_stream_countops_uni (const uint32_t * __restrict ops, const uint32_t **ops_end, uint32_t *align)
 {
   const uint32_t numcases = ops[2];
   const uint32_t *jeq_op = ops + DDS_OP_ADR_JSR (ops[3]);
   for (uint32_t i = 0; i < numcases; i++)
   {
     const enum dds_stream_typecode valtype = DDS_JEQ_TYPE (jeq_op[0]);
+    countops_align (valtype, align);
     switch (valtype)
     {
       case DDS_OP_VAL_1BY:
@@ -327,7 +337,7 @@ static const uint32_t *dds_stream_countops_uni (const uint32_t * __restrict ops,
       case DDS_OP_VAL_STR:
         break;
       case DDS_OP_VAL_BST: case DDS_OP_VAL_SEQ: case DDS_OP_VAL_ARR: case DDS_OP_VAL_UNI: case DDS_OP_VAL_STU:
-        dds_stream_countops1 (jeq_op + DDS_OP_ADR_JSR (jeq_op[0]), ops_end);
+        dds_stream_countops1 (jeq_op + DDS_OP_ADR_JSR (jeq_op[0]), ops_end, align);
         break;
     }
     jeq_op += 3;
@@ -340,7 +350,7 @@ static const uint32_t *dds_stream_countops_uni (const uint32_t * __restrict ops,
   return ops;
 }
 
-static void dds_stream_countops1 (const uint32_t * __restrict ops, const uint32_t **ops_end)
+static void dds_stream_countops1 (const uint32_t * __restrict ops, const uint32_t **ops_end, uint32_t *align)
 {
   uint32_t insn;
   while ((insn = *ops) != DDS_OP_RTS)
@@ -348,6 +358,8 @@ static void dds_stream_countops1 (const uint32_t * __restrict ops, const uint32_
     switch (DDS_OP (insn))
     {
       case DDS_OP_ADR: {
+        countops_align (DDS_OP_TYPE (insn), align);
+        countops_align (DDS_OP_SUBTYPE (insn), align);
         switch (DDS_OP_TYPE (insn))
         {
           case DDS_OP_VAL_1BY: case DDS_OP_VAL_2BY: case DDS_OP_VAL_4BY: case DDS_OP_VAL_8BY: case DDS_OP_VAL_STR:
@@ -356,16 +368,16 @@ static void dds_stream_countops1 (const uint32_t * __restrict ops, const uint32_
           case DDS_OP_VAL_BST:
             ops += 3;
             break;
-          case DDS_OP_VAL_SEQ: ops = dds_stream_countops_seq (ops, insn, ops_end); break;
-          case DDS_OP_VAL_ARR: ops = dds_stream_countops_arr (ops, insn, ops_end); break;
-          case DDS_OP_VAL_UNI: ops = dds_stream_countops_uni (ops, ops_end); break;
+          case DDS_OP_VAL_SEQ: ops = dds_stream_countops_seq (ops, insn, ops_end, align); break;
+          case DDS_OP_VAL_ARR: ops = dds_stream_countops_arr (ops, insn, ops_end, align); break;
+          case DDS_OP_VAL_UNI: ops = dds_stream_countops_uni (ops, ops_end, align); break;
           case DDS_OP_VAL_STU: abort (); break;
         }
         break;
       }
       case DDS_OP_JSR: {
         if (DDS_OP_JUMP (insn) > 0)
-          dds_stream_countops1 (ops + DDS_OP_JUMP (insn), ops_end);
+          dds_stream_countops1 (ops + DDS_OP_JUMP (insn), ops_end, align);
         ops++;
         break;
       }
@@ -383,10 +395,19 @@ static void dds_stream_countops1 (const uint32_t * __restrict ops, const uint32_
 uint32_t dds_stream_countops (const uint32_t * __restrict ops)
 {
   const uint32_t *ops_end = ops;
-  dds_stream_countops1 (ops, &ops_end);
+  uint32_t align = 4;
+  dds_stream_countops1 (ops, &ops_end, &align);
   return (uint32_t) (ops_end - ops);
 }
 
+uint32_t dds_stream_max_align (const uint32_t * __restrict ops)
+{
+  const uint32_t *ops_end = ops;
+  uint32_t align = 4;
+  dds_stream_countops1 (ops, &ops_end, &align);
+  return align;
+}
+
 static void dds_stream_reuse_string_bound (dds_istream_t * __restrict is, char * __restrict str, const uint32_t bound)
 {
   const uint32_t length = dds_is_get4 (is);
@@ -1741,19 +1762,18 @@ static const uint32_t *dds_stream_extract_key_from_data_skip_array (dds_istream_
   else
   {
     dds_stream_extract_key_from_data_skip_subtype (is, num, subtype, NULL);
-    return ops + 3;
+    return ops + (subtype == DDS_OP_VAL_BST ? 5 : 3);
   }
 }
 
 static const uint32_t *dds_stream_extract_key_from_data_skip_sequence (dds_istream_t * __restrict is, const uint32_t * __restrict ops)
 {
   const uint32_t op = *ops;
-  const enum dds_stream_typecode type = DDS_OP_TYPE (op);
-  assert (type == DDS_OP_VAL_SEQ);
+  assert (DDS_OP_TYPE (op) == DDS_OP_VAL_SEQ);
   const uint32_t subtype = DDS_OP_SUBTYPE (op);
   const uint32_t num = dds_is_get4 (is);
   if (num == 0)
-    return ops + 2 + (type == DDS_OP_VAL_BST || type == DDS_OP_VAL_ARR);
+    return skip_sequence_insns (ops, op);
   else if (subtype > DDS_OP_VAL_BST)
   {
     const uint32_t * jsr_ops = ops + DDS_OP_ADR_JSR (ops[3]);
@@ -1764,7 +1784,7 @@ static const uint32_t *dds_stream_extract_key_from_data_skip_sequence (dds_istre
   else
   {
     dds_stream_extract_key_from_data_skip_subtype (is, num, subtype, NULL);
-    return ops + 2 + (type == DDS_OP_VAL_BST || type == DDS_OP_VAL_ARR);
+    return skip_sequence_insns (ops, op);
   }
 }
 
@@ -1946,6 +1966,109 @@ void dds_stream_extract_keyhash (dds_istream_t * __restrict is, dds_keyhash_t *
   }
 }
 
+/*******************************************************************************************
+ **
+ **  Field extraction (for content filters)
+ **
+ *******************************************************************************************/
+
+uint32_t dds_stream_list_fields (const uint32_t * __restrict ops, uint32_t * __restrict insns, uint32_t maxfields)
+{
+  const uint32_t * const ops0 = ops;
+  uint32_t op, n = 0;
+  while ((op = *ops) != DDS_OP_RTS)
+  {
+    if (DDS_OP (op) != DDS_OP_ADR)
+      return UINT32_MAX;
+    if (n < maxfields)
+      insns[n] = (uint32_t) (ops - ops0);
+    n++;
+    switch (DDS_OP_TYPE (op))
+    {
+      case DDS_OP_VAL_1BY: case DDS_OP_VAL_2BY: case DDS_OP_VAL_4BY: case DDS_OP_VAL_8BY: case DDS_OP_VAL_STR:
+        ops += 2;
+        break;
+      case DDS_OP_VAL_BST:
+        ops += 3;
+        break;
+      case DDS_OP_VAL_SEQ:
+        ops = skip_sequence_insns (ops, op);
+        break;
+      case DDS_OP_VAL_ARR:
+        switch (DDS_OP_SUBTYPE (op))
+        {
+          case DDS_OP_VAL_1BY: case DDS_OP_VAL_2BY: case DDS_OP_VAL_4BY: case DDS_OP_VAL_8BY: case DDS_OP_VAL_STR:
+            ops += 3;
+            break;
+          case DDS_OP_VAL_BST:
+            ops += 5;
+            break;
+          default: {
+            const uint32_t jmp = DDS_OP_ADR_JMP (ops[3]);
+            ops += (jmp ? jmp : 5);
+            break;
+          }
+        }
+        break;
+      case DDS_OP_VAL_UNI:
+        ops += DDS_OP_ADR_JMP (ops[3]);
+        break;
+      case DDS_OP_VAL_STU:
+        return UINT32_MAX;
+    }
+  }
+  return n;
+}
+
+void dds_stream_extract_fields (dds_istream_t * __restrict is, const uint32_t * __restrict ops, uint32_t nfields, const uint32_t * __restrict insns, const unsigned char ** __restrict fields)
+{
+  const uint32_t * const ops0 = ops;
+  uint32_t op, k = 0;
+  while (k < nfields && (op = *ops) != DDS_OP_RTS)
+  {
+    assert (DDS_OP (op) == DDS_OP_ADR);
+    const enum dds_stream_typecode type = DDS_OP_TYPE (op);
+    const bool wanted = ((uint32_t) (ops - ops0) == insns[k]);
+    switch (type)
+    {
+      case DDS_OP_VAL_1BY: case DDS_OP_VAL_2BY: case DDS_OP_VAL_4BY: case DDS_OP_VAL_8BY: {
+        const uint32_t elem_size = get_type_size (type);
+        dds_cdr_alignto (is, elem_size);
+        if (wanted)
+          fields[k++] = is->m_buffer + is->m_index;
+        is->m_index += elem_size;
+        ops += 2;
+        break;
+      }
+      case DDS_OP_VAL_STR: case DDS_OP_VAL_BST: {
+        /* strings are returned as a pointer to the length */
+        dds_cdr_alignto (is, 4);
+        if (wanted)
+          fields[k++] = is->m_buffer + is->m_index;
+        is->m_index += dds_is_get4 (is);
+        ops += (type == DDS_OP_VAL_STR) ? 2 : 3;
+        break;
+      }
+      case DDS_OP_VAL_SEQ:
+        assert (!wanted);
+        ops = dds_stream_extract_key_from_data_skip_sequence (is, ops);
+        break;
+      case DDS_OP_VAL_ARR:
+        assert (!wanted);
+        ops = dds_stream_extract_key_from_data_skip_array (is, ops);
+        break;
+      case DDS_OP_VAL_UNI:
+        assert (!wanted);
+        ops = dds_stream_extract_key_from_data_skip_union (is, ops);
+        break;
+      case DDS_OP_VAL_STU:
+        abort ();
+        break;
+    }
+  }
+  assert (k == nfields);
+}
+
 /*******************************************************************************************
  **
  **  Pretty-printing
@@ -2270,6 +2393,24 @@ DDSRT_STATIC_ASSERT ((offsetof (struct ddsi_serdata_default, data) % 8) == 0);
 
 void dds_istream_from_serdata_default (dds_istream_t * __restrict s, const struct ddsi_serdata_default * __restrict d)
 {
+  if (d->hdr.identifier == CDR_SHM)
+  {
+    /* CDR alignment is relative to the start of the payload, which is also
+       what it is for the serdata itself because data is 8-byte aligned */
+    s->m_buffer = d->shm_payload;
+    s->m_index = 0;
+    s->m_size = d->shm_size;
+    return;
+  }
+  if (d->rmsg_payload)
+  {
+    /* alignment is relative to the start of the payload here, too, the
+       address satisfies the type's alignment requirement (see from_ser) */
+    s->m_buffer = (const unsigned char *) d->rmsg_payload;
+    s->m_index = 0;
+    s->m_size = d->pos;
+    return;
+  }
   s->m_buffer = (const unsigned char *) d;
   s->m_index = (uint32_t) offsetof (struct ddsi_serdata_default, data);
   s->m_size = d->size + s->m_index;
@@ -2287,6 +2428,7 @@ void dds_ostream_from_serdata_default (dds_ostream_t * __restrict s, struct ddsi
   s->m_buffer = (unsigned char *) d;
   s->m_index = (uint32_t) offsetof (struct ddsi_serdata_default, data);
   s->m_size = d->size + s->m_index;
+  s->m_reallocs = 0;
 #if DDSRT_ENDIAN == DDSRT_LITTLE_ENDIAN
   assert (d->hdr.identifier == CDR_LE);
 #elif DDSRT_ENDIAN == DDSRT_BIG_ENDIAN
@@ -2316,6 +2458,7 @@ void dds_ostreamBE_from_serdata_default (dds_ostreamBE_t * __restrict s, struct
   s->x.m_buffer = (unsigned char *) d;
   s->x.m_index = (uint32_t) offsetof (struct ddsi_serdata_default, data);
   s->x.m_size = d->size + s->x.m_index;
+  s->x.m_reallocs = 0;
   assert (d->hdr.identifier == CDR_BE);
 }
 
@@ -0,0 +1,116 @@
+/*
+ * Copyright(c) 2020 ADLINK Technology Limited and others
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License v. 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0, or the Eclipse Distribution License
+ * v. 1.0 which is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+ */
+#include "dds/ddsi/ddsi_congestion.h"
+#include "dds/ddsi/q_config.h"
+
+/* Shortest round, so that a tiny RTT on a local network doesn't make
+   the rate swing wildly */
+#define MIN_ROUND_LENGTH DDS_MSECS (10)
+
+/* Number of lossless rounds needed to go from the minimum rate to the
+   maximum rate */
+#define INCREASE_STEPS 64
+
+void ddsi_congestion_init (struct ddsi_congestion *cc, const struct config *config, ddsrt_mtime_t tnow)
+{
+  /* a maximum of 0 means "inf", a minimum of 0 is treated as 1 B/s to
+     keep the pacing computation well-defined */
+  cc->max_rate = (config->congestion_max_rate == 0) ? UINT32_MAX : config->congestion_max_rate;
+  cc->min_rate = (config->congestion_min_rate == 0) ? 1 : config->congestion_min_rate;
+  if (cc->min_rate > cc->max_rate)
+    cc->min_rate = cc->max_rate;
+  cc->rate = cc->max_rate;
+  cc->balance = 0;
+  cc->t_last = tnow;
+  cc->t_round_start = tnow;
+  cc->srtt = 0;
+  cc->round_bytes = 0;
+  cc->round_rexmit_bytes = 0;
+  cc->loss = 0;
+  cc->decreased_in_round = 0;
+}
+
+static void maybe_end_round (struct ddsi_congestion *cc, ddsrt_mtime_t tnow)
+{
+  const int64_t round_length = (cc->srtt > MIN_ROUND_LENGTH) ? cc->srtt : MIN_ROUND_LENGTH;
+  if (tnow.v < cc->t_round_start.v + round_length)
+    return;
+
+  /* an idle round provides no information on the state of the network:
+     leave rate and loss estimate alone */
+  if (cc->round_bytes > 0 || cc->round_rexmit_bytes > 0)
+  {
+    uint32_t loss;
+    if (cc->round_rexmit_bytes >= cc->round_bytes)
+      loss = 1000;
+    else
+      loss = (uint32_t) (1000 * cc->round_rexmit_bytes / cc->round_bytes);
+    cc->loss = (3 * cc->loss + loss) / 4;
+    if (!cc->decreased_in_round && cc->round_bytes > 0 && cc->rate < cc->max_rate)
+    {
+      uint32_t step = (cc->max_rate - cc->min_rate) / INCREASE_STEPS;
+      if (step == 0)
+        step = 1;
+      cc->rate = (cc->max_rate - cc->rate < step) ? cc->max_rate : cc->rate + step;
+    }
+  }
+  cc->t_round_start = tnow;
+  cc->round_bytes = 0;
+  cc->round_rexmit_bytes = 0;
+  cc->decreased_in_round = 0;
+}
+
+int64_t ddsi_congestion_pace (struct ddsi_congestion *cc, uint32_t size, ddsrt_mtime_t tnow)
+{
+  maybe_end_round (cc, tnow);
+  /* tnow may have been sampled by another thread before it got the writer
+     lock and so lie slightly in the past */
+  if (tnow.v > cc->t_last.v)
+  {
+    cc->balance -= tnow.v - cc->t_last.v;
+    cc->t_last = tnow;
+  }
+  /* credit from an idle period is limited to what can be sent without
+     waiting anyway, else the rate limit is meaningless for bursty
+     writers */
+  if (cc->balance < -DDSI_CONGESTION_MIN_DELAY)
+    cc->balance = -DDSI_CONGESTION_MIN_DELAY;
+  cc->balance += (int64_t) size * DDS_NSECS_IN_SEC / cc->rate;
+  cc->round_bytes += size;
+  return cc->balance;
+}
+
+void ddsi_congestion_cancel (struct ddsi_congestion *cc, uint32_t size)
+{
+  /* the rate may have been lowered since the sample was paced, refunding
+     at the current rate then errs on the side of caution */
+  cc->balance -= (int64_t) size * DDS_NSECS_IN_SEC / cc->rate;
+  cc->round_bytes = (cc->round_bytes < size) ? 0 : cc->round_bytes - size;
+}
+
+void ddsi_congestion_note_nack (struct ddsi_congestion *cc, uint32_t rexmit_bytes, ddsrt_mtime_t tnow)
+{
+  maybe_end_round (cc, tnow);
+  cc->round_rexmit_bytes += rexmit_bytes;
+  if (!cc->decreased_in_round)
+  {
+    cc->rate = (cc->rate / 2 < cc->min_rate) ? cc->min_rate : cc->rate / 2;
+    cc->decreased_in_round = 1;
+  }
+}
+
+void ddsi_congestion_note_rtt (struct ddsi_congestion *cc, int64_t rtt)
+{
+  if (rtt <= 0)
+    return;
+  cc->srtt = (cc->srtt == 0) ? rtt : (7 * cc->srtt + rtt) / 8;
+}
@@ -24,6 +24,7 @@
 #include "dds/ddsi/ddsi_entity_index.h"
 #include "dds/ddsi/ddsi_domaingv.h"
 #include "dds/ddsi/q_entity.h"
+#include "dds/ddsi/q_misc.h"
 
 #define TOPIC_SAMPLE_CACHE_SIZE 4
 
@@ -267,3 +268,134 @@ dds_return_t deliver_locally_allinsync (struct ddsi_domaingv *gv, struct entity_
   } while (rc == DDS_RETCODE_TRY_AGAIN);
   return rc;
 }
+
+static uint32_t make_batch (struct ddsi_rhc_batch_sample *batch, struct ddsi_domaingv *gv, struct ddsi_sertopic const * const topic, uint32_t n, const struct ddsi_writer_info *wrinfo, const struct deliver_locally_ops * __restrict ops, void * const *vsourceinfo)
+{
+  uint32_t k = 0;
+  for (uint32_t i = 0; i < n; i++)
+  {
+    /* skip samples that fail to deserialize */
+    if ((batch[k].sample = ops->makesample (&batch[k].tk, gv, topic, vsourceinfo[i])) != NULL)
+      batch[k++].wrinfo = wrinfo[i];
+  }
+  return k;
+}
+
+static void free_batch (struct ddsi_domaingv *gv, struct ddsi_rhc_batch_sample *batch, uint32_t k)
+{
+  for (uint32_t i = 0; i < k; i++)
+    free_sample_after_store (gv, batch[i].sample, batch[i].tk);
+}
+
+/* Number of samples of the batch already stored in each reader, so that a retry after
+   the fast path had to be abandoned doesn't deliver any sample twice */
+struct batch_progress {
+  uint32_t n, size;
+  struct batch_progress_entry {
+    ddsi_guid_t rdguid;
+    uint32_t nstored;
+  } *entries;
+};
+
+static uint32_t batch_progress_get (const struct batch_progress *bp, const ddsi_guid_t *rdguid)
+{
+  for (uint32_t i = 0; i < bp->n; i++)
+    if (guid_eq (&bp->entries[i].rdguid, rdguid))
+      return bp->entries[i].nstored;
+  return 0;
+}
+
+static void batch_progress_set (struct batch_progress *bp, const ddsi_guid_t *rdguid, uint32_t nstored)
+{
+  uint32_t i;
+  for (i = 0; i < bp->n; i++)
+    if (guid_eq (&bp->entries[i].rdguid, rdguid))
+      break;
+  if (i == bp->n)
+  {
+    if (bp->n == bp->size)
+    {
+      bp->size = (bp->size == 0) ? 8 : 2 * bp->size;
+      bp->entries = ddsrt_realloc (bp->entries, bp->size * sizeof (*bp->entries));
+    }
+    bp->entries[bp->n++].rdguid = *rdguid;
+  }
+  bp->entries[i].nstored = nstored;
+}
+
+static dds_return_t deliver_locally_batch_fastpath (struct ddsi_domaingv *gv, struct entity_common *source_entity, bool source_entity_locked, struct local_reader_ary *fastpath_rdary, uint32_t n, const struct ddsi_writer_info *wrinfo, const struct deliver_locally_ops * __restrict ops, void * const *vsourceinfo, struct ddsi_rhc_batch_sample *batch, struct batch_progress *bp)
+{
+  struct reader ** const rdary = fastpath_rdary->rdary;
+  uint32_t i = 0;
+  while (rdary[i])
+  {
+    struct ddsi_sertopic const * const topic = rdary[i]->topic;
+    const uint32_t k = make_batch (batch, gv, topic, n, wrinfo, ops, vsourceinfo);
+    do {
+      const ddsi_guid_t rdguid = rdary[i]->e.guid;
+      uint32_t nstored = batch_progress_get (bp, &rdguid);
+      while (nstored < k)
+      {
+        dds_return_t rc;
+        if ((nstored += ddsi_rhc_store_batch (rdary[i]->rhc, k - nstored, batch + nstored)) < k &&
+            (rc = ops->on_failure_fastpath (source_entity, source_entity_locked, fastpath_rdary, vsourceinfo[0])) != DDS_RETCODE_OK)
+        {
+          batch_progress_set (bp, &rdguid, nstored);
+          free_batch (gv, batch, k);
+          return rc;
+        }
+      }
+      batch_progress_set (bp, &rdguid, k);
+    } while (rdary[++i] && rdary[i]->topic == topic);
+    free_batch (gv, batch, k);
+  }
+  return DDS_RETCODE_OK;
+}
+
+static void deliver_locally_batch_slowpath (struct ddsi_domaingv *gv, struct entity_common *source_entity, bool source_entity_locked, uint32_t n, const struct ddsi_writer_info *wrinfo, const struct deliver_locally_ops * __restrict ops, void * const *vsourceinfo, struct ddsi_rhc_batch_sample *batch, const struct batch_progress *bp)
+{
+  /* like deliver_locally_slowpath, rejected samples are discarded */
+  ddsrt_avl_iter_t it;
+  struct reader *rd;
+  if (!source_entity_locked)
+    ddsrt_mutex_lock (&source_entity->lock);
+  for (rd = ops->first_reader (gv->entity_index, source_entity, &it); rd != NULL; rd = ops->next_reader (gv->entity_index, &it))
+  {
+    const uint32_t k = make_batch (batch, gv, rd->topic, n, wrinfo, ops, vsourceinfo);
+    const uint32_t nstored = batch_progress_get (bp, &rd->e.guid);
+    EETRACE (source_entity, " => "PGUIDFMT" (batch of %"PRIu32")\n", PGUID (rd->e.guid), k);
+    if (nstored < k)
+      (void) ddsi_rhc_store_batch (rd->rhc, k - nstored, batch + nstored);
+    free_batch (gv, batch, k);
+  }
+  if (!source_entity_locked)
+    ddsrt_mutex_unlock (&source_entity->lock);
+}
+
+dds_return_t deliver_locally_allinsync_batch (struct ddsi_domaingv *gv, struct entity_common *source_entity, bool source_entity_locked, struct local_reader_ary *fastpath_rdary, uint32_t n, const struct ddsi_writer_info *wrinfo, const struct deliver_locally_ops * __restrict ops, void * const *vsourceinfo)
+{
+  struct batch_progress bp = { .n = 0, .size = 0, .entries = NULL };
+  struct ddsi_rhc_batch_sample *batch;
+  dds_return_t rc;
+  if (n == 0)
+    return DDS_RETCODE_OK;
+  batch = ddsrt_malloc (n * sizeof (*batch));
+  do {
+    ddsrt_mutex_lock (&fastpath_rdary->rdary_lock);
+    if (fastpath_rdary->fastpath_ok)
+    {
+      EETRACE (source_entity, " => EVERYONE (batch of %"PRIu32")\n", n);
+      rc = deliver_locally_batch_fastpath (gv, source_entity, source_entity_locked, fastpath_rdary, n, wrinfo, ops, vsourceinfo, batch, &bp);
+      ddsrt_mutex_unlock (&fastpath_rdary->rdary_lock);
+    }
+    else
+    {
+      ddsrt_mutex_unlock (&fastpath_rdary->rdary_lock);
+      deliver_locally_batch_slowpath (gv, source_entity, source_entity_locked, n, wrinfo, ops, vsourceinfo, batch, &bp);
+      rc = DDS_RETCODE_OK;
+    }
+  } while (rc == DDS_RETCODE_TRY_AGAIN);
+  ddsrt_free (bp.entries);
+  ddsrt_free (batch);
+  return rc;
+}
@@ -0,0 +1,1284 @@
+/*
+ * Copyright(c) 2020 ADLINK Technology Limited and others
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License v. 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0, or the Eclipse Distribution License
+ * v. 1.0 which is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+ */
+#include <assert.h>
+#include <string.h>
+
+#include "dds/ddsrt/heap.h"
+#include "dds/ddsrt/io.h"
+#include "dds/ddsrt/string.h"
+#include "dds/ddsrt/strtol.h"
+#include "dds/ddsrt/strtod.h"
+#include "dds/ddsrt/sync.h"
+#include "dds/ddsrt/xmlparser.h"
+#include "dds/ddsi/ddsi_sertopic.h"
+#include "dds/ddsi/ddsi_serdata_default.h"
+#include "dds/ddsi/ddsi_cdrstream.h"
+#include "dds/ddsi/ddsi_plist.h"
+#include "dds/ddsi/ddsi_filter.h"
+
+/* Limits chosen such that evaluating a filter never requires memory
+   allocation: the field values and the evaluation stack live on the
+   stack of the evaluating thread */
+#define MAX_FIELDS 32
+#define MAX_STACK 32
+#define MAX_PARAMS 100
+
+/* Limit on the nesting of parentheses and NOTs, the parser is recursive
+   descent and the expression may come from a remote reader */
+#define MAX_NESTING 64
+
+enum value_kind {
+  VK_INT,
+  VK_UINT,
+  VK_DOUBLE,
+  VK_STRING
+};
+
+struct value {
+  enum value_kind kind;
+  union {
+    int64_t i;
+    uint64_t u;
+    double d;
+    struct { const char *p; uint32_t n; } s;
+  } u;
+};
+
+/* Stack machine instructions: OP_FIELD, OP_PARAM and OP_CONST push a value,
+   the comparisons replace the top two values by a boolean (represented as a
+   VK_INT 0/1), OP_NOT negates the boolean on top of the stack.  OP_JF/OP_JT
+   jump to "arg" leaving the boolean on the stack if it is false/true, and
+   pop it otherwise; this implements short-circuit AND/OR. */
+enum opcode {
+  OP_FIELD,
+  OP_PARAM,
+  OP_CONST,
+  OP_EQ,
+  OP_NE,
+  OP_LT,
+  OP_LE,
+  OP_GT,
+  OP_GE,
+  OP_LIKE,
+  OP_NOT,
+  OP_JF,
+  OP_JT
+};
+
+struct insn {
+  uint16_t op;
+  uint16_t arg;
+};
+
+struct params {
+  uint32_t n;
+  char **strs;          /* copies of the parameters as passed in */
+  struct value *values; /* strings are owned by the values */
+};
+
+struct prog {
+  char *expression;
+  uint32_t ninsns;
+  struct insn *insns;
+  uint32_t nconsts;
+  struct value *consts; /* strings are owned by the values */
+  uint32_t nfields;
+  uint32_t *field_insns; /* offsets of field ADR instructions in m_ops, ascending */
+  uint32_t nparams;      /* number of parameters required */
+};
+
+struct ddsi_filter {
+  ddsrt_rwlock_t lock;
+  struct ddsi_sertopic *tp;
+  struct prog *prog; /* NULL: accept all */
+  struct params params;
+};
+
+/*******************************************************************************************
+ **
+ **  Values
+ **
+ *******************************************************************************************/
+
+static void value_fini (struct value *v)
+{
+  if (v->kind == VK_STRING)
+    ddsrt_free ((char *) v->u.s.p);
+}
+
+/* SQL string literal: '' represents a single quote */
+static void make_string (struct value *v, const char *s, size_t len)
+{
+  char *p = ddsrt_malloc (len + 1);
+  size_t i, n;
+  for (i = 0, n = 0; i < len; i++)
+  {
+    p[n++] = s[i];
+    if (s[i] == '\'' && i + 1 < len && s[i+1] == '\'')
+      i++;
+  }
+  p[n] = 0;
+  v->kind = VK_STRING;
+  v->u.s.p = p;
+  v->u.s.n = (uint32_t) n;
+}
+
+static bool make_number (struct value *v, const char *s, size_t len)
+{
+  char buf[64], *endp;
+  bool isfloat = false;
+  if (len == 0 || len >= sizeof (buf))
+    return false;
+  memcpy (buf, s, len);
+  buf[len] = 0;
+  for (size_t i = 0; i < len; i++)
+    if (buf[i] == '.' || buf[i] == 'e' || buf[i] == 'E')
+      isfloat = true;
+  if (isfloat)
+  {
+    v->kind = VK_DOUBLE;
+    return ddsrt_strtod (buf, &endp, &v->u.d) == DDS_RETCODE_OK && *endp == 0;
+  }
+  else
+  {
+    long long ll;
+    unsigned long long ull;
+    dds_return_t ret;
+    if ((ret = ddsrt_strtoll (buf, &endp, 10, &ll)) == DDS_RETCODE_OK && *endp == 0)
+    {
+      v->kind = VK_INT;
+      v->u.i = (int64_t) ll;
+      return true;
+    }
+    else if (ret == DDS_RETCODE_OUT_OF_RANGE && buf[0] != '-' && ddsrt_strtoull (buf, &endp, 10, &ull) == DDS_RETCODE_OK && *endp == 0)
+    {
+      v->kind = VK_UINT;
+      v->u.u = (uint64_t) ull;
+      return true;
+    }
+    return false;
+  }
+}
+
+/* Parameters are interpreted as literals, with the exception that a string
+   need not be quoted */
+static void make_param (struct value *v, const char *str)
+{
+  const size_t len = strlen (str);
+  if (len >= 2 && str[0] == '\'' && str[len-1] == '\'')
+    make_string (v, str + 1, len - 2);
+  else if (make_number (v, str, len))
+    ;
+  else if (ddsrt_strcasecmp (str, "TRUE") == 0 || ddsrt_strcasecmp (str, "FALSE") == 0)
+  {
+    v->kind = VK_INT;
+    v->u.i = (str[0] == 't' || str[0] == 'T');
+  }
+  else
+  {
+    v->kind = VK_STRING;
+    v->u.s.p = ddsrt_strdup (str);
+    v->u.s.n = (uint32_t) len;
+  }
+}
+
+static void load_field (struct value *v, uint32_t op, const unsigned char *p)
+{
+  const bool sgn = (op & DDS_OP_FLAG_SGN) != 0;
+  switch (DDS_OP_TYPE (op))
+  {
+    case DDS_OP_VAL_1BY: {
+      uint8_t x; memcpy (&x, p, sizeof (x));
+      if (sgn) { v->kind = VK_INT; v->u.i = (int8_t) x; } else { v->kind = VK_UINT; v->u.u = x; }
+      break;
+    }
+    case DDS_OP_VAL_2BY: {
+      uint16_t x; memcpy (&x, p, sizeof (x));
+      if (sgn) { v->kind = VK_INT; v->u.i = (int16_t) x; } else { v->kind = VK_UINT; v->u.u = x; }
+      break;
+    }
+    case DDS_OP_VAL_4BY: {
+      if (op & DDS_OP_FLAG_FP) {
+        float x; memcpy (&x, p, sizeof (x));
+        v->kind = VK_DOUBLE; v->u.d = x;
+      } else {
+        uint32_t x; memcpy (&x, p, sizeof (x));
+        if (sgn) { v->kind = VK_INT; v->u.i = (int32_t) x; } else { v->kind = VK_UINT; v->u.u = x; }
+      }
+      break;
+    }
+    case DDS_OP_VAL_8BY: {
+      if (op & DDS_OP_FLAG_FP) {
+        double x; memcpy (&x, p, sizeof (x));
+        v->kind = VK_DOUBLE; v->u.d = x;
+      } else {
+        uint64_t x; memcpy (&x, p, sizeof (x));
+        if (sgn) { v->kind = VK_INT; v->u.i = (int64_t) x; } else { v->kind = VK_UINT; v->u.u = x; }
+      }
+      break;
+    }
+    case DDS_OP_VAL_STR: case DDS_OP_VAL_BST: {
+      /* length includes the terminating 0, which we don't want to compare */
+      uint32_t len; memcpy (&len, p, sizeof (len));
+      v->kind = VK_STRING;
+      v->u.s.p = (const char *) p + 4;
+      v->u.s.n = (len > 0) ? len - 1 : 0;
+      break;
+    }
+    default: {
+      assert (0);
+    }
+  }
+}
+
+static double value_as_double (const struct value *v)
+{
+  switch (v->kind)
+  {
+    case VK_INT: return (double) v->u.i;
+    case VK_UINT: return (double) v->u.u;
+    case VK_DOUBLE: return v->u.d;
+    case VK_STRING: break;
+  }
+  assert (0);
+  return 0.0;
+}
+
+/* Returns -1, 0, 1 for less, equal, greater; 2 if the values can't be compared */
+static int value_compare (const struct value *a, const struct value *b)
+{
+  if (a->kind == VK_STRING || b->kind == VK_STRING)
+  {
+    if (a->kind != b->kind)
+      return 2;
+    const uint32_t n = (a->u.s.n < b->u.s.n) ? a->u.s.n : b->u.s.n;
+    const int c = memcmp (a->u.s.p, b->u.s.p, n);
+    if (c != 0)
+      return (c < 0) ? -1 : 1;
+    return (a->u.s.n == b->u.s.n) ? 0 : (a->u.s.n < b->u.s.n) ? -1 : 1;
+  }
+  else if (a->kind == VK_DOUBLE || b->kind == VK_DOUBLE)
+  {
+    const double x = value_as_double (a), y = value_as_double (b);
+    return (x < y) ? -1 : (x > y) ? 1 : (x == y) ? 0 : 2;
+  }
+  else if (a->kind == VK_INT && b->kind == VK_INT)
+    return (a->u.i < b->u.i) ? -1 : (a->u.i > b->u.i);
+  else if (a->kind == VK_UINT && b->kind == VK_UINT)
+    return (a->u.u < b->u.u) ? -1 : (a->u.u > b->u.u);
+  else if (a->kind == VK_INT)
+    return (a->u.i < 0 || (uint64_t) a->u.i < b->u.u) ? -1 : ((uint64_t) a->u.i > b->u.u);
+  else
+    return (b->u.i < 0 || a->u.u > (uint64_t) b->u.i) ? 1 : -(a->u.u < (uint64_t) b->u.i);
+}
+
+/* LIKE pattern matching: '%' matches any sequence of characters, '_' any single character */
+static bool like_match (const char *s, uint32_t n, const char *p, uint32_t m)
+{
+  uint32_t i = 0, j = 0, star_i = 0, star_j = UINT32_MAX;
+  while (i < n)
+  {
+    if (j < m && p[j] == '%')
+    {
+      star_j = j++;
+      star_i = i;
+    }
+    else if (j < m && (p[j] == '_' || p[j] == s[i]))
+    {
+      i++;
+      j++;
+    }
+    else if (star_j != UINT32_MAX)
+    {
+      j = star_j + 1;
+      i = ++star_i;
+    }
+    else
+    {
+      return false;
+    }
+  }
+  while (j < m && p[j] == '%')
+    j++;
+  return j == m;
+}
+
+/*******************************************************************************************
+ **
+ **  Field names from the XML type description
+ **
+ *******************************************************************************************/
+
+struct meta_node {
+  char *tag;
+  char *name;
+  struct meta_node *parent, *first, *last, *next;
+};
+
+static int meta_elem_open (void *varg, uintptr_t parentinfo, uintptr_t *eleminfo, const char *name, int line)
+{
+  struct meta_node **root = varg;
+  struct meta_node *parent = (struct meta_node *) parentinfo;
+  struct meta_node *n;
+  (void) line;
+  if (parent == NULL && *root != NULL)
+    return -1;
+  n = ddsrt_malloc (sizeof (*n));
+  n->tag = ddsrt_strdup (name);
+  n->name = NULL;
+  n->parent = parent;
+  n->first = n->last = n->next = NULL;
+  if (parent == NULL)
+    *root = n;
+  else
+  {
+    if (parent->last)
+      parent->last->next = n;
+    else
+      parent->first = n;
+    parent->last = n;
+  }
+  *eleminfo = (uintptr_t) n;
+  return 0;
+}
+
+static int meta_attr (void *varg, uintptr_t eleminfo, const char *name, const char *value, int line)
+{
+  struct meta_node *n = (struct meta_node *) eleminfo;
+  (void) varg; (void) line;
+  if (strcmp (name, "name") == 0 && n->name == NULL)
+    n->name = ddsrt_strdup (value);
+  return 0;
+}
+
+static int meta_elem_data (void *varg, uintptr_t eleminfo, const char *data, int line)
+{
+  (void) varg; (void) eleminfo; (void) data; (void) line;
+  return 0;
+}
+
+static int meta_elem_close (void *varg, uintptr_t eleminfo, int line)
+{
+  (void) varg; (void) eleminfo; (void) line;
+  return 0;
+}
+
+static void meta_error (void *varg, const char *msg, int line)
+{
+  (void) varg; (void) msg; (void) line;
+}
+
+static void meta_free (struct meta_node *n)
+{
+  while (n)
+  {
+    struct meta_node *next = n->next;
+    meta_free (n->first);
+    ddsrt_free (n->tag);
+    ddsrt_free (n->name);
+    ddsrt_free (n);
+    n = next;
+  }
+}
+
+static struct meta_node *meta_parse (const char *xml)
+{
+  struct ddsrt_xmlp_callbacks cb = {
+    .elem_open = meta_elem_open,
+    .attr = meta_attr,
+    .elem_data = meta_elem_data,
+    .elem_close = meta_elem_close,
+    .error = meta_error
+  };
+  struct meta_node *root = NULL;
+  struct ddsrt_xmlp_state *st = ddsrt_xmlp_new_string (xml, &root, &cb);
+  const int res = ddsrt_xmlp_parse (st);
+  ddsrt_xmlp_free (st);
+  if (res < 0)
+  {
+    meta_free (root);
+    root = NULL;
+  }
+  return root;
+}
+
+static bool meta_is_scope (const struct meta_node *n)
+{
+  return strcmp (n->tag, "Module") == 0 || strcmp (n->tag, "Struct") == 0 || strcmp (n->tag, "Union") == 0;
+}
+
+/* Looks up a scoped name ("A::B") starting from scope */
+static const struct meta_node *meta_lookup_path (const struct meta_node *scope, const char *path)
+{
+  while (scope)
+  {
+    const char *sep = strstr (path, "::");
+    const size_t len = sep ? (size_t) (sep - path) : strlen (path);
+    const struct meta_node *n;
+    for (n = scope->first; n; n = n->next)
+      if (n->name && strlen (n->name) == len && memcmp (n->name, path, len) == 0 && strcmp (n->tag, "Member") != 0)
+        break;
+    if (n == NULL || sep == NULL)
+      return n;
+    if (!meta_is_scope (n))
+      return NULL;
+    scope = n;
+    path = sep + 2;
+  }
+  return NULL;
+}
+
+/* Resolves a type name as referenced from within scope using the IDL scoping rules */
+static const struct meta_node *meta_lookup (const struct meta_node *root, const struct meta_node *scope, const char *name)
+{
+  if (strncmp (name, "::", 2) == 0)
+    return meta_lookup_path (root, name + 2);
+  for (; scope; scope = scope->parent)
+  {
+    const struct meta_node *n;
+    if ((n = meta_lookup_path (scope, name)) != NULL)
+      return n;
+  }
+  return NULL;
+}
+
+struct fieldnames {
+  uint32_t n, size;
+  char **names;
+};
+
+static bool meta_flatten_struct (const struct meta_node *root, const struct meta_node *st, const char *prefix, struct fieldnames *fns, int depth);
+
+static bool meta_flatten_member (const struct meta_node *root, const struct meta_node *scope, const struct meta_node *type, const char *name, struct fieldnames *fns, int depth)
+{
+  if (type == NULL || depth > 32)
+    return false;
+  if (strcmp (type->tag, "Struct") == 0)
+    return meta_flatten_struct (root, type, name, fns, depth + 1);
+  if (strcmp (type->tag, "Type") == 0)
+  {
+    const struct meta_node *def;
+    if (type->name == NULL || (def = meta_lookup (root, scope, type->name)) == NULL)
+      return false;
+    if (strcmp (def->tag, "Struct") == 0)
+      return meta_flatten_struct (root, def, name, fns, depth + 1);
+    if (strcmp (def->tag, "TypeDef") == 0)
+      return meta_flatten_member (root, def->parent, def->first, name, fns, depth + 1);
+  }
+  if (fns->n == fns->size)
+  {
+    fns->size = fns->size ? 2 * fns->size : 8;
+    fns->names = ddsrt_realloc (fns->names, fns->size * sizeof (*fns->names));
+  }
+  fns->names[fns->n++] = ddsrt_strdup (name);
+  return true;
+}
+
+static bool meta_flatten_struct (const struct meta_node *root, const struct meta_node *st, const char *prefix, struct fieldnames *fns, int depth)
+{
+  for (const struct meta_node *m = st->first; m; m = m->next)
+  {
+    char *name;
+    bool ok;
+    if (strcmp (m->tag, "Member") != 0)
+      continue;
+    if (m->name == NULL)
+      return false;
+    if (prefix)
+      (void) ddsrt_asprintf (&name, "%s.%s", prefix, m->name);
+    else
+      name = ddsrt_strdup (m->name);
+    ok = meta_flatten_member (root, st, m->first, name, fns, depth);
+    ddsrt_free (name);
+    if (!ok)
+      return false;
+  }
+  return true;
+}
+
+static void fieldnames_fini (struct fieldnames *fns)
+{
+  for (uint32_t i = 0; i < fns->n; i++)
+    ddsrt_free (fns->names[i]);
+  ddsrt_free (fns->names);
+}
+
+/* Derives the names of the fields in the order in which they appear in the
+   ops from the type description, and checks they match the ops */
+static dds_return_t get_fieldnames (const struct ddsi_sertopic_default *tp, struct fieldnames *fns, uint32_t **insns)
+{
+  struct meta_node *root;
+  const struct meta_node *st;
+  uint32_t nfields;
+  fns->n = fns->size = 0;
+  fns->names = NULL;
+  if (tp->type_description == NULL || tp->type.m_ops == NULL)
+    return DDS_RETCODE_UNSUPPORTED;
+  if ((nfields = dds_stream_list_fields (tp->type.m_ops, NULL, 0)) == UINT32_MAX)
+    return DDS_RETCODE_UNSUPPORTED;
+  if ((root = meta_parse (tp->type_description)) == NULL)
+    return DDS_RETCODE_UNSUPPORTED;
+  if ((st = meta_lookup_path (root, tp->c.type_name)) == NULL || strcmp (st->tag, "Struct") != 0 ||
+      !meta_flatten_struct (root, st, NULL, fns, 0) || fns->n != nfields)
+  {
+    meta_free (root);
+    fieldnames_fini (fns);
+    return DDS_RETCODE_UNSUPPORTED;
+  }
+  meta_free (root);
+  *insns = ddsrt_malloc ((nfields ? nfields : 1) * sizeof (**insns));
+  (void) dds_stream_list_fields (tp->type.m_ops, *insns, nfields);
+  return DDS_RETCODE_OK;
+}
+
+/*******************************************************************************************
+ **
+ **  Parsing & code generation
+ **
+ *******************************************************************************************/
+
+enum tokkind {
+  TK_END, TK_ERROR,
+  TK_IDENT, TK_PARAM, TK_NUMBER, TK_STRING,
+  TK_LPAREN, TK_RPAREN,
+  TK_EQ, TK_NE, TK_LT, TK_LE, TK_GT, TK_GE,
+  TK_AND, TK_OR, TK_NOT, TK_BETWEEN, TK_LIKE, TK_TRUE, TK_FALSE
+};
+
+struct token {
+  enum tokkind kind;
+  const char *s;
+  size_t len;
+};
+
+struct pstate {
+  const char *pos;
+  struct token tok;
+  const uint32_t *ops;
+  const struct fieldnames *fns;
+  const uint32_t *fns_insns;
+  uint32_t ninsns, insns_size;
+  struct insn *insns;
+  uint32_t nconsts, consts_size;
+  struct value *consts;
+  uint32_t nfields;
+  uint32_t fields[MAX_FIELDS]; /* index in fns of field in slot */
+  uint32_t depth, maxdepth;
+  uint32_t nesting;
+  uint32_t nparams;
+  dds_return_t ret;
+};
+
+static bool isalpha_ (char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
+static bool isdigit_ (char c) { return c >= '0' && c <= '9'; }
+
+static void next_token (struct pstate *ps)
+{
+  static const struct { const char *kw; enum tokkind kind; } keywords[] = {
+    { "AND", TK_AND }, { "OR", TK_OR }, { "NOT", TK_NOT }, { "BETWEEN", TK_BETWEEN },
+    { "LIKE", TK_LIKE }, { "TRUE", TK_TRUE }, { "FALSE", TK_FALSE }
+  };
+  const char *p = ps->pos;
+  while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+    p++;
+  ps->tok.s = p;
+  if (*p == 0)
+    ps->tok.kind = TK_END;
+  else if (isalpha_ (*p))
+  {
+    while (isalpha_ (*p) || isdigit_ (*p) || *p == '.')
+      p++;
+    ps->tok.kind = TK_IDENT;
+    for (size_t i = 0; i < sizeof (keywords) / sizeof (keywords[0]); i++)
+      if (strlen (keywords[i].kw) == (size_t) (p - ps->tok.s) && ddsrt_strncasecmp (keywords[i].kw, ps->tok.s, (size_t) (p - ps->tok.s)) == 0)
+        ps->tok.kind = keywords[i].kind;
+  }
+  else if (*p == '%')
+  {
+    p++;
+    ps->tok.kind = isdigit_ (*p) ? TK_PARAM : TK_ERROR;
+    while (isdigit_ (*p))
+      p++;
+  }
+  else if (isdigit_ (*p) || ((*p == '-' || *p == '+' || *p == '.') && (isdigit_ (p[1]) || (p[1] == '.' && isdigit_ (p[2])))))
+  {
+    if (*p == '-' || *p == '+')
+      p++;
+    while (isdigit_ (*p) || *p == '.')
+      p++;
+    if ((*p == 'e' || *p == 'E') && (isdigit_ (p[1]) || ((p[1] == '-' || p[1] == '+') && isdigit_ (p[2]))))
+    {
+      p += 2;
+      while (isdigit_ (*p))
+        p++;
+    }
+    ps->tok.kind = TK_NUMBER;
+  }
+  else if (*p == '\'')
+  {
+    p++;
+    ps->tok.kind = TK_ERROR;
+    while (*p)
+    {
+      if (*p++ == '\'')
+      {
+        if (*p != '\'') { ps->tok.kind = TK_STRING; break; }
+        p++;
+      }
+    }
+  }
+  else
+  {
+    switch (*p++)
+    {
+      case '(': ps->tok.kind = TK_LPAREN; break;
+      case ')': ps->tok.kind = TK_RPAREN; break;
+      case '=': ps->tok.kind = TK_EQ; break;
+      case '<':
+        if (*p == '=') { p++; ps->tok.kind = TK_LE; }
+        else if (*p == '>') { p++; ps->tok.kind = TK_NE; }
+        else ps->tok.kind = TK_LT;
+        break;
+      case '>':
+        if (*p == '=') { p++; ps->tok.kind = TK_GE; }
+        else ps->tok.kind = TK_GT;
+        break;
+      case '!':
+        if (*p == '=') { p++; ps->tok.kind = TK_NE; }
+        else ps->tok.kind = TK_ERROR;
+        break;
+      default:
+        ps->tok.kind = TK_ERROR;
+        break;
+    }
+  }
+  ps->tok.len = (size_t) (p - ps->tok.s);
+  ps->pos = p;
+}
+
+static uint32_t emit (struct pstate *ps, enum opcode op, uint32_t arg)
+{
+  if (ps->ninsns == ps->insns_size)
+  {
+    ps->insns_size = ps->insns_size ? 2 * ps->insns_size : 16;
+    ps->insns = ddsrt_realloc (ps->insns, ps->insns_size * sizeof (*ps->insns));
+  }
+  assert (arg <= UINT16_MAX);
+  ps->insns[ps->ninsns].op = (uint16_t) op;
+  ps->insns[ps->ninsns].arg = (uint16_t) arg;
+  switch (op)
+  {
+    case OP_FIELD: case OP_PARAM: case OP_CONST:
+      if (++ps->depth > ps->maxdepth)
+        ps->maxdepth = ps->depth;
+      break;
+    case OP_EQ: case OP_NE: case OP_LT: case OP_LE: case OP_GT: case OP_GE: case OP_LIKE:
+    case OP_JF: case OP_JT:
+      /* for the jumps: the depth on the fall-through path, the other path
+         ends up with the same depth at the target */
+      ps->depth--;
+      break;
+    case OP_NOT:
+      break;
+  }
+  return ps->ninsns++;
+}
+
+static bool add_const (struct pstate *ps, struct insn *opnd, const struct value *v)
+{
+  if (ps->nconsts > UINT16_MAX)
+  {
+    value_fini ((struct value *) v);
+    ps->ret = DDS_RETCODE_UNSUPPORTED;
+    return false;
+  }
+  if (ps->nconsts == ps->consts_size)
+  {
+    ps->consts_size = ps->consts_size ? 2 * ps->consts_size : 8;
+    ps->consts = ddsrt_realloc (ps->consts, ps->consts_size * sizeof (*ps->consts));
+  }
+  ps->consts[ps->nconsts] = *v;
+  opnd->op = OP_CONST;
+  opnd->arg = (uint16_t) ps->nconsts++;
+  return true;
+}
+
+static bool lookup_field (struct pstate *ps, struct insn *opnd)
+{
+  uint32_t idx, slot;
+  for (idx = 0; idx < ps->fns->n; idx++)
+    if (strlen (ps->fns->names[idx]) == ps->tok.len && memcmp (ps->fns->names[idx], ps->tok.s, ps->tok.len) == 0)
+      break;
+  if (idx == ps->fns->n)
+    return false;
+  switch (DDS_OP_TYPE (ps->ops[ps->fns_insns[idx]]))
+  {
+    case DDS_OP_VAL_1BY: case DDS_OP_VAL_2BY: case DDS_OP_VAL_4BY: case DDS_OP_VAL_8BY:
+    case DDS_OP_VAL_STR: case DDS_OP_VAL_BST:
+      break;
+    default:
+      return false;
+  }
+  for (slot = 0; slot < ps->nfields; slot++)
+    if (ps->fields[slot] == idx)
+      break;
+  if (slot == ps->nfields)
+  {
+    if (ps->nfields == MAX_FIELDS)
+    {
+      ps->ret = DDS_RETCODE_UNSUPPORTED;
+      return false;
+    }
+    ps->fields[ps->nfields++] = idx;
+  }
+  opnd->op = OP_FIELD;
+  opnd->arg = (uint16_t) slot;
+  return true;
+}
+
+/* Parses an operand, returning the instruction that pushes it */
+static bool parse_operand (struct pstate *ps, struct insn *opnd)
+{
+  struct value v;
+  switch (ps->tok.kind)
+  {
+    case TK_IDENT:
+      if (!lookup_field (ps, opnd))
+        return false;
+      break;
+    case TK_PARAM: {
+      uint32_t idx = 0;
+      for (size_t i = 1; i < ps->tok.len && idx < MAX_PARAMS; i++)
+        idx = 10 * idx + (uint32_t) (ps->tok.s[i] - '0');
+      if (idx >= MAX_PARAMS)
+        return false;
+      if (idx >= ps->nparams)
+        ps->nparams = idx + 1;
+      opnd->op = OP_PARAM;
+      opnd->arg = (uint16_t) idx;
+      break;
+    }
+    case TK_NUMBER:
+      if (!make_number (&v, ps->tok.s, ps->tok.len) || !add_const (ps, opnd, &v))
+        return false;
+      break;
+    case TK_STRING:
+      make_string (&v, ps->tok.s + 1, ps->tok.len - 2);
+      if (!add_const (ps, opnd, &v))
+        return false;
+      break;
+    case TK_TRUE: case TK_FALSE:
+      v.kind = VK_INT;
+      v.u.i = (ps->tok.kind == TK_TRUE);
+      if (!add_const (ps, opnd, &v))
+        return false;
+      break;
+    default:
+      return false;
+  }
+  next_token (ps);
+  return true;
+}
+
+static bool parse_cond (struct pstate *ps)
+{
+  struct insn a, b, c;
+  bool neg = false;
+  if (!parse_operand (ps, &a))
+    return false;
+  if (ps->tok.kind == TK_NOT)
+  {
+    neg = true;
+    next_token (ps);
+    if (ps->tok.kind != TK_BETWEEN && ps->tok.kind != TK_LIKE)
+      return false;
+  }
+  switch (ps->tok.kind)
+  {
+    case TK_BETWEEN: {
+      uint32_t jf;
+      next_token (ps);
+      if (!parse_operand (ps, &b))
+        return false;
+      if (ps->tok.kind != TK_AND)
+        return false;
+      next_token (ps);
+      if (!parse_operand (ps, &c))
+        return false;
+      emit (ps, a.op, a.arg);
+      emit (ps, b.op, b.arg);
+      emit (ps, OP_GE, 0);
+      jf = emit (ps, OP_JF, 0);
+      emit (ps, a.op, a.arg);
+      emit (ps, c.op, c.arg);
+      emit (ps, OP_LE, 0);
+      ps->insns[jf].arg = (uint16_t) ps->ninsns;
+      break;
+    }
+    case TK_LIKE:
+      next_token (ps);
+      if (!parse_operand (ps, &b))
+        return false;
+      emit (ps, a.op, a.arg);
+      emit (ps, b.op, b.arg);
+      emit (ps, OP_LIKE, 0);
+      break;
+    case TK_EQ: case TK_NE: case TK_LT: case TK_LE: case TK_GT: case TK_GE: {
+      const enum opcode op = (enum opcode) ((int) OP_EQ + (int) (ps->tok.kind - TK_EQ));
+      next_token (ps);
+      if (!parse_operand (ps, &b))
+        return false;
+      emit (ps, a.op, a.arg);
+      emit (ps, b.op, b.arg);
+      emit (ps, op, 0);
+      break;
+    }
+    default:
+      return false;
+  }
+  if (neg)
+    emit (ps, OP_NOT, 0);
+  return true;
+}
+
+static bool parse_expr (struct pstate *ps);
+
+static bool parse_factor (struct pstate *ps)
+{
+  bool ok;
+  if (ps->tok.kind != TK_NOT && ps->tok.kind != TK_LPAREN)
+    return parse_cond (ps);
+  if (++ps->nesting > MAX_NESTING)
+  {
+    ps->ret = DDS_RETCODE_UNSUPPORTED;
+    return false;
+  }
+  if (ps->tok.kind == TK_NOT)
+  {
+    next_token (ps);
+    if ((ok = parse_factor (ps)))
+      emit (ps, OP_NOT, 0);
+  }
+  else
+  {
+    next_token (ps);
+    if ((ok = (parse_expr (ps) && ps->tok.kind == TK_RPAREN)))
+      next_token (ps);
+  }
+  ps->nesting--;
+  return ok;
+}
+
+static bool parse_term (struct pstate *ps)
+{
+  if (!parse_factor (ps))
+    return false;
+  while (ps->tok.kind == TK_AND)
+  {
+    const uint32_t jf = emit (ps, OP_JF, 0);
+    next_token (ps);
+    if (!parse_factor (ps))
+      return false;
+    ps->insns[jf].arg = (uint16_t) ps->ninsns;
+  }
+  return true;
+}
+
+static bool parse_expr (struct pstate *ps)
+{
+  if (!parse_term (ps))
+    return false;
+  while (ps->tok.kind == TK_OR)
+  {
+    const uint32_t jt = emit (ps, OP_JT, 0);
+    next_token (ps);
+    if (!parse_term (ps))
+      return false;
+    ps->insns[jt].arg = (uint16_t) ps->ninsns;
+  }
+  return true;
+}
+
+static void prog_free (struct prog *prog)
+{
+  if (prog == NULL)
+    return;
+  for (uint32_t i = 0; i < prog->nconsts; i++)
+    value_fini (&prog->consts[i]);
+  ddsrt_free (prog->consts);
+  ddsrt_free (prog->insns);
+  ddsrt_free (prog->field_insns);
+  ddsrt_free (prog->expression);
+  ddsrt_free (prog);
+}
+
+static dds_return_t compile (const struct ddsi_sertopic_default *tp, const char *expression, struct prog **prog)
+{
+  struct fieldnames fns;
+  uint32_t *fns_insns;
+  struct pstate ps;
+  dds_return_t ret;
+
+  if ((ret = get_fieldnames (tp, &fns, &fns_insns)) != DDS_RETCODE_OK)
+    return ret;
+
+  memset (&ps, 0, sizeof (ps));
+  ps.pos = expression;
+  ps.ops = tp->type.m_ops;
+  ps.fns = &fns;
+  ps.fns_insns = fns_insns;
+  ps.ret = DDS_RETCODE_BAD_PARAMETER;
+  next_token (&ps);
+  if (!parse_expr (&ps) || ps.tok.kind != TK_END)
+    ret = ps.ret;
+  else if (ps.maxdepth > MAX_STACK || ps.ninsns > UINT16_MAX)
+    ret = DDS_RETCODE_UNSUPPORTED;
+  else
+  {
+    /* field values are extracted in a single pass over the data, that requires
+       the slots to be ordered by position in the ops */
+    uint32_t order[MAX_FIELDS], slot_map[MAX_FIELDS];
+    for (uint32_t i = 0; i < ps.nfields; i++)
+    {
+      uint32_t j = i;
+      for (; j > 0 && fns_insns[ps.fields[order[j-1]]] > fns_insns[ps.fields[i]]; j--)
+        order[j] = order[j-1];
+      order[j] = i;
+    }
+    for (uint32_t i = 0; i < ps.nfields; i++)
+      slot_map[order[i]] = i;
+    for (uint32_t i = 0; i < ps.ninsns; i++)
+      if (ps.insns[i].op == OP_FIELD)
+        ps.insns[i].arg = (uint16_t) slot_map[ps.insns[i].arg];
+
+    struct prog *p = ddsrt_malloc (sizeof (*p));
+    p->expression = ddsrt_strdup (expression);
+    p->ninsns = ps.ninsns;
+    p->insns = ps.insns;
+    p->nconsts = ps.nconsts;
+    p->consts = ps.consts;
+    p->nfields = ps.nfields;
+    p->field_insns = ddsrt_malloc ((ps.nfields ? ps.nfields : 1) * sizeof (*p->field_insns));
+    for (uint32_t i = 0; i < ps.nfields; i++)
+      p->field_insns[i] = fns_insns[ps.fields[order[i]]];
+    p->nparams = ps.nparams;
+    *prog = p;
+    ps.insns = NULL;
+    ps.consts = NULL;
+    ps.nconsts = 0;
+    ret = DDS_RETCODE_OK;
+  }
+
+  for (uint32_t i = 0; i < ps.nconsts; i++)
+    value_fini (&ps.consts[i]);
+  ddsrt_free (ps.consts);
+  ddsrt_free (ps.insns);
+  ddsrt_free (fns_insns);
+  fieldnames_fini (&fns);
+  return ret;
+}
+
+/*******************************************************************************************
+ **
+ **  Evaluation
+ **
+ *******************************************************************************************/
+
+static bool eval (const struct prog *prog, const struct value *fields, const struct value *params)
+{
+  struct value stack[MAX_STACK];
+  uint32_t sp = 0;
+  for (uint32_t pc = 0; pc < prog->ninsns; pc++)
+  {
+    const struct insn in = prog->insns[pc];
+    switch ((enum opcode) in.op)
+    {
+      case OP_FIELD: stack[sp++] = fields[in.arg]; break;
+      case OP_PARAM: stack[sp++] = params[in.arg]; break;
+      case OP_CONST: stack[sp++] = prog->consts[in.arg]; break;
+      case OP_EQ: case OP_NE: case OP_LT: case OP_LE: case OP_GT: case OP_GE: {
+        const int c = value_compare (&stack[sp-2], &stack[sp-1]);
+        bool r = false;
+        if (c != 2)
+        {
+          switch ((enum opcode) in.op)
+          {
+            case OP_EQ: r = (c == 0); break;
+            case OP_NE: r = (c != 0); break;
+            case OP_LT: r = (c < 0); break;
+            case OP_LE: r = (c <= 0); break;
+            case OP_GT: r = (c > 0); break;
+            case OP_GE: r = (c >= 0); break;
+            default: assert (0);
+          }
+        }
+        sp--;
+        stack[sp-1].kind = VK_INT;
+        stack[sp-1].u.i = r;
+        break;
+      }
+      case OP_LIKE: {
+        const struct value *s = &stack[sp-2], *p = &stack[sp-1];
+        const bool r = (s->kind == VK_STRING && p->kind == VK_STRING && like_match (s->u.s.p, s->u.s.n, p->u.s.p, p->u.s.n));
+        sp--;
+        stack[sp-1].kind = VK_INT;
+        stack[sp-1].u.i = r;
+        break;
+      }
+      case OP_NOT:
+        stack[sp-1].u.i = !stack[sp-1].u.i;
+        break;
+      case OP_JF:
+        if (!stack[sp-1].u.i)
+          pc = (uint32_t) in.arg - 1;
+        else
+          sp--;
+        break;
+      case OP_JT:
+        if (stack[sp-1].u.i)
+          pc = (uint32_t) in.arg - 1;
+        else
+          sp--;
+        break;
+    }
+  }
+  assert (sp == 1);
+  return stack[0].u.i != 0;
+}
+
+/*******************************************************************************************
+ **
+ **  Interface
+ **
+ *******************************************************************************************/
+
+static void params_fini (struct params *ps)
+{
+  for (uint32_t i = 0; i < ps->n; i++)
+  {
+    ddsrt_free (ps->strs[i]);
+    value_fini (&ps->values[i]);
+  }
+  ddsrt_free (ps->strs);
+  ddsrt_free (ps->values);
+}
+
+static void params_init (struct params *ps, uint32_t nparams, const char * const *params)
+{
+  ps->n = nparams;
+  ps->strs = ddsrt_malloc ((nparams ? nparams : 1) * sizeof (*ps->strs));
+  ps->values = ddsrt_malloc ((nparams ? nparams : 1) * sizeof (*ps->values));
+  for (uint32_t i = 0; i < nparams; i++)
+  {
+    ps->strs[i] = ddsrt_strdup (params[i]);
+    make_param (&ps->values[i], params[i]);
+  }
+}
+
+static bool check_params (uint32_t nparams, const char * const *params)
+{
+  if (nparams > MAX_PARAMS || (nparams > 0 && params == NULL))
+    return false;
+  for (uint32_t i = 0; i < nparams; i++)
+    if (params[i] == NULL)
+      return false;
+  return true;
+}
+
+struct ddsi_filter *ddsi_filter_new (const struct ddsi_sertopic *tp)
+{
+  struct ddsi_filter *filter = ddsrt_malloc (sizeof (*filter));
+  ddsrt_rwlock_init (&filter->lock);
+  filter->tp = ddsi_sertopic_ref (tp);
+  filter->prog = NULL;
+  params_init (&filter->params, 0, NULL);
+  return filter;
+}
+
+void ddsi_filter_free (struct ddsi_filter *filter)
+{
+  prog_free (filter->prog);
+  params_fini (&filter->params);
+  ddsi_sertopic_unref (filter->tp);
+  ddsrt_rwlock_destroy (&filter->lock);
+  ddsrt_free (filter);
+}
+
+dds_return_t ddsi_filter_set_expression (struct ddsi_filter *filter, const char *expression, uint32_t nparams, const char * const *params)
+{
+  struct prog *prog = NULL, *oldprog;
+  struct params newparams, oldparams;
+  dds_return_t ret;
+  if (!check_params (nparams, params))
+    return DDS_RETCODE_BAD_PARAMETER;
+  if (expression != NULL)
+  {
+    if (filter->tp->ops != &ddsi_sertopic_ops_default)
+      return DDS_RETCODE_UNSUPPORTED;
+    if ((ret = compile ((const struct ddsi_sertopic_default *) filter->tp, expression, &prog)) != DDS_RETCODE_OK)
+      return ret;
+    if (prog->nparams > nparams)
+    {
+      prog_free (prog);
+      return DDS_RETCODE_BAD_PARAMETER;
+    }
+  }
+  params_init (&newparams, nparams, params);
+  ddsrt_rwlock_write (&filter->lock);
+  oldprog = filter->prog;
+  oldparams = filter->params;
+  filter->prog = prog;
+  filter->params = newparams;
+  ddsrt_rwlock_unlock (&filter->lock);
+  prog_free (oldprog);
+  params_fini (&oldparams);
+  return DDS_RETCODE_OK;
+}
+
+dds_return_t ddsi_filter_set_parameters (struct ddsi_filter *filter, uint32_t nparams, const char * const *params)
+{
+  struct params newparams, oldparams;
+  if (!check_params (nparams, params))
+    return DDS_RETCODE_BAD_PARAMETER;
+  params_init (&newparams, nparams, params);
+  ddsrt_rwlock_write (&filter->lock);
+  if (filter->prog && filter->prog->nparams > nparams)
+  {
+    ddsrt_rwlock_unlock (&filter->lock);
+    params_fini (&newparams);
+    return DDS_RETCODE_BAD_PARAMETER;
+  }
+  oldparams = filter->params;
+  filter->params = newparams;
+  ddsrt_rwlock_unlock (&filter->lock);
+  params_fini (&oldparams);
+  return DDS_RETCODE_OK;
+}
+
+bool ddsi_filter_has_expression (struct ddsi_filter *filter)
+{
+  bool res;
+  ddsrt_rwlock_read (&filter->lock);
+  res = (filter->prog != NULL);
+  ddsrt_rwlock_unlock (&filter->lock);
+  return res;
+}
+
+bool ddsi_filter_accepts (struct ddsi_filter *filter, const struct ddsi_serdata *sample)
+{
+  const struct ddsi_sertopic_default *tp = (const struct ddsi_sertopic_default *) filter->tp;
+  const struct prog *prog;
+  bool res;
+  assert (sample->topic == filter->tp);
+  if (sample->kind != SDK_DATA)
+    return true;
+  ddsrt_rwlock_read (&filter->lock);
+  if ((prog = filter->prog) == NULL)
+    res = true;
+  else
+  {
+    const unsigned char *ptrs[MAX_FIELDS];
+    struct value fields[MAX_FIELDS];
+    dds_istream_t is;
+    dds_istream_from_serdata_default (&is, (const struct ddsi_serdata_default *) sample);
+    dds_stream_extract_fields (&is, tp->type.m_ops, prog->nfields, prog->field_insns, ptrs);
+    for (uint32_t i = 0; i < prog->nfields; i++)
+      load_field (&fields[i], tp->type.m_ops[prog->field_insns[i]], ptrs[i]);
+    res = eval (prog, fields, filter->params.values);
+  }
+  ddsrt_rwlock_unlock (&filter->lock);
+  return res;
+}
+
+/*******************************************************************************************
+ **
+ **  Discovery
+ **
+ *******************************************************************************************/
+
+struct nn_content_filter_property *ddsi_filter_get_property (struct ddsi_filter *filter)
+{
+  nn_content_filter_property_t *cfp = NULL;
+  ddsrt_rwlock_read (&filter->lock);
+  if (filter->prog != NULL)
+  {
+    cfp = ddsrt_malloc (sizeof (*cfp));
+    cfp->content_filtered_topic_name = ddsrt_strdup (filter->tp->name);
+    cfp->related_topic_name = ddsrt_strdup (filter->tp->name);
+    cfp->filter_class_name = ddsrt_strdup (DDSI_FILTER_CLASS_NAME);
+    cfp->filter_expression = ddsrt_strdup (filter->prog->expression);
+    cfp->expression_parameters.n = filter->params.n;
+    cfp->expression_parameters.strs = ddsrt_malloc ((filter->params.n ? filter->params.n : 1) * sizeof (*cfp->expression_parameters.strs));
+    for (uint32_t i = 0; i < filter->params.n; i++)
+      cfp->expression_parameters.strs[i] = ddsrt_strdup (filter->params.strs[i]);
+  }
+  ddsrt_rwlock_unlock (&filter->lock);
+  return cfp;
+}
+
+struct ddsi_filter *ddsi_filter_new_from_property (const struct ddsi_sertopic *tp, const struct nn_content_filter_property *cfp)
+{
+  struct ddsi_filter *filter;
+  if (strcmp (cfp->filter_class_name, DDSI_FILTER_CLASS_NAME) != 0 || strcmp (cfp->related_topic_name, tp->name) != 0)
+    return NULL;
+  filter = ddsi_filter_new (tp);
+  if (ddsi_filter_set_expression (filter, cfp->filter_expression, cfp->expression_parameters.n, (const char * const *) cfp->expression_parameters.strs) != DDS_RETCODE_OK)
+  {
+    ddsi_filter_free (filter);
+    return NULL;
+  }
+  return filter;
+}
+
+struct nn_content_filter_property *ddsi_content_filter_property_dup (const struct nn_content_filter_property *cfp)
+{
+  nn_content_filter_property_t *x = ddsrt_malloc (sizeof (*x));
+  x->content_filtered_topic_name = ddsrt_strdup (cfp->content_filtered_topic_name);
+  x->related_topic_name = ddsrt_strdup (cfp->related_topic_name);
+  x->filter_class_name = ddsrt_strdup (cfp->filter_class_name);
+  x->filter_expression = ddsrt_strdup (cfp->filter_expression);
+  x->expression_parameters.n = cfp->expression_parameters.n;
+  x->expression_parameters.strs = ddsrt_malloc ((cfp->expression_parameters.n ? cfp->expression_parameters.n : 1) * sizeof (*x->expression_parameters.strs));
+  for (uint32_t i = 0; i < cfp->expression_parameters.n; i++)
+    x->expression_parameters.strs[i] = ddsrt_strdup (cfp->expression_parameters.strs[i]);
+  return x;
+}
+
+bool ddsi_content_filter_property_equal (const struct nn_content_filter_property *a, const struct nn_content_filter_property *b)
+{
+  if (a == NULL || b == NULL)
+    return a == b;
+  if (strcmp (a->content_filtered_topic_name, b->content_filtered_topic_name) != 0 ||
+      strcmp (a->related_topic_name, b->related_topic_name) != 0 ||
+      strcmp (a->filter_class_name, b->filter_class_name) != 0 ||
+      strcmp (a->filter_expression, b->filter_expression) != 0 ||
+      a->expression_parameters.n != b->expression_parameters.n)
+    return false;
+  for (uint32_t i = 0; i < a->expression_parameters.n; i++)
+    if (strcmp (a->expression_parameters.strs[i], b->expression_parameters.strs[i]) != 0)
+      return false;
+  return true;
+}
+
+void ddsi_content_filter_property_free (struct nn_content_filter_property *cfp)
+{
+  if (cfp == NULL)
+    return;
+  ddsrt_free (cfp->content_filtered_topic_name);
+  ddsrt_free (cfp->related_topic_name);
+  ddsrt_free (cfp->filter_class_name);
+  ddsrt_free (cfp->filter_expression);
+  for (uint32_t i = 0; i < cfp->expression_parameters.n; i++)
+    ddsrt_free (cfp->expression_parameters.strs[i]);
+  ddsrt_free (cfp->expression_parameters.strs);
+  ddsrt_free (cfp);
+}
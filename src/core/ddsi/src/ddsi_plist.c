@@ -1582,6 +1582,7 @@ static const struct piddesc piddesc_omg[] = {
   PPV (PARTICIPANT_GUID,                    participant_guid, XG),
   PPV (GROUP_GUID,                          group_guid, XG),
   PP  (BUILTIN_ENDPOINT_SET,                builtin_endpoint_set, Xu),
+  PP  (CONTENT_FILTER_PROPERTY,             content_filter_property, XS, XS, XS, XS, XQ, XS, XSTOP),
   PP  (ENTITY_NAME,                         entity_name, XS),
   PP  (KEYHASH,                             keyhash, XK),
   PPV (ENDPOINT_GUID,                       endpoint_guid, XG),
@@ -1598,6 +1599,7 @@ static const struct piddesc piddesc_omg[] = {
 #endif
   PP  (DOMAIN_ID,                           domain_id, Xu),
   PP  (DOMAIN_TAG,                          domain_tag, XS),
+  PP  (COHERENT_SET,                        coherent_set_seqno, Xi, Xu),
   { PID_STATUSINFO, PDF_FUNCTION, PP_STATUSINFO, "STATUSINFO",
     offsetof (struct ddsi_plist, statusinfo), membersize (struct ddsi_plist, statusinfo),
     { .f = { .deser = deser_statusinfo, .ser = ser_statusinfo, .print = print_statusinfo } }, 0 },
@@ -1746,8 +1748,8 @@ static const struct piddesc_index piddesc_vendor_index[] = {
 /* List of entries that require unalias, fini processing;
    initialized by ddsi_plist_init_tables; will assert when
    table too small or too large */
-static const struct piddesc *piddesc_unalias[18 + SECURITY_PROC_ARRAY_SIZE];
-static const struct piddesc *piddesc_fini[18 + SECURITY_PROC_ARRAY_SIZE];
+static const struct piddesc *piddesc_unalias[19 + SECURITY_PROC_ARRAY_SIZE];
+static const struct piddesc *piddesc_fini[19 + SECURITY_PROC_ARRAY_SIZE];
 static uint64_t plist_fini_mask, qos_fini_mask;
 static ddsrt_once_t table_init_control = DDSRT_ONCE_INIT;
 
@@ -2421,6 +2423,14 @@ static enum do_locator_result do_locator (nn_locators_t *ls, uint64_t present, u
           return DOLOC_INVALID;
       }
       break;
+    case NN_LOCATOR_KIND_SHM:
+      /* shared memory locators are interpreted by discovery: the address is a
+         host id and the factory is the (secondary) shared memory one */
+      if (!vendor_is_eclipse (dd->vendorid))
+        return DOLOC_IGNORED;
+      if (loc.port == 0 || loc.port > 65535)
+        return DOLOC_INVALID;
+      break;
     default:
       return DOLOC_IGNORED;
   }
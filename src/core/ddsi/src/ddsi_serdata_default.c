@@ -24,7 +24,9 @@
 #include "dds/ddsi/ddsi_tkmap.h"
 #include "dds/ddsi/ddsi_cdrstream.h"
 #include "dds/ddsi/q_radmin.h"
+#include "dds/ddsi/q_gc.h"
 #include "dds/ddsi/ddsi_domaingv.h"
+#include "dds/ddsi/ddsi_shm.h"
 #include "dds/ddsi/ddsi_serdata_default.h"
 
 #if DDSRT_ENDIAN == DDSRT_LITTLE_ENDIAN
@@ -40,12 +42,28 @@
 /* 8k entries in the freelist seems to be roughly the amount needed to send
    minimum-size (well, 4 bytes) samples as fast as possible over loopback
    while using large messages -- actually, it stands to reason that this would
-   be the same as the WHC node pool size */
+   be the same as the WHC node pool size.  Larger size classes get fewer
+   entries, so that each class holds at most 2MB (plus what is cached in the
+   per-thread magazines of the freelist). */
 #define MAX_POOL_SIZE 8192
-#define MAX_SIZE_FOR_POOL 256
 #define DEFAULT_NEW_SIZE 128
 #define CHUNK_SIZE 128
 
+/* Size classes of the serdata pool: a serdata of at least class_size[i]
+   bytes (but not larger than the largest class) goes into freelist[i] when
+   freed, and an allocation of at most class_size[i] bytes is taken from it */
+static const uint32_t serdatapool_class_size[SERDATAPOOL_NCLASSES] = { 256, 1024, 4096, 8192 };
+#define MAX_SIZE_FOR_POOL 8192
+
+/* Received samples at least this large that need no byte swapping may be
+   referenced in the receive buffer instead of copied (see from_ser) */
+#define MIN_SIZE_FOR_RMSG_REF 1024
+
+/* Offset of the payload of a serdata from the start of the allocation when it
+   has been moved out of the receive buffer, leaving room for the CDR header
+   while keeping the payload 8-byte aligned */
+#define UNPINNED_PAYLOAD_OFF 8
+
 #ifndef NDEBUG
 static int ispowerof2_size (size_t x)
 {
@@ -59,7 +77,8 @@ struct serdatapool * ddsi_serdatapool_new (void)
 {
   struct serdatapool * pool;
   pool = ddsrt_malloc (sizeof (*pool));
-  nn_freelist_init (&pool->freelist, MAX_POOL_SIZE, offsetof (struct ddsi_serdata_default, next));
+  for (int i = 0; i < SERDATAPOOL_NCLASSES; i++)
+    nn_freelist_init (&pool->freelist[i], MAX_POOL_SIZE * serdatapool_class_size[0] / serdatapool_class_size[i], offsetof (struct ddsi_serdata_default, next));
   return pool;
 }
 
@@ -74,7 +93,8 @@ static void serdata_free_wrap (void *elem)
 
 void ddsi_serdatapool_free (struct serdatapool * pool)
 {
-  nn_freelist_fini (&pool->freelist, serdata_free_wrap);
+  for (int i = 0; i < SERDATAPOOL_NCLASSES; i++)
+    nn_freelist_fini (&pool->freelist[i], serdata_free_wrap);
   ddsrt_free (pool);
 }
 
@@ -90,9 +110,11 @@ static void *serdata_default_append (struct ddsi_serdata_default **d, size_t n)
   char *p;
   if ((*d)->pos + n > (*d)->size)
   {
+    struct ddsi_sertopic_default *tp = (struct ddsi_sertopic_default *) (*d)->c.topic;
     size_t size1 = alignup_size ((*d)->pos + n, CHUNK_SIZE);
     *d = ddsrt_realloc (*d, offsetof (struct ddsi_serdata_default, data) + size1);
     (*d)->size = (uint32_t)size1;
+    ddsrt_atomic_inc64 (&tp->serdata_reallocs);
   }
   assert ((*d)->pos + n <= (*d)->size);
   p = (*d)->data + (*d)->pos;
@@ -167,8 +189,30 @@ static void serdata_default_free(struct ddsi_serdata *dcmn)
 {
   struct ddsi_serdata_default *d = (struct ddsi_serdata_default *)dcmn;
   assert(ddsrt_atomic_ld32(&d->c.refc) == 0);
-  if (d->size > MAX_SIZE_FOR_POOL || !nn_freelist_push (&d->serpool->freelist, d))
+  if (d->shm_payload)
+  {
+    ddsi_shm_chunk_unref (d->shm_payload);
+    d->shm_payload = NULL;
+  }
+  if (d->rmsg_payload)
+  {
+    /* releasing synchronizes with unpinning, so rmsg_unpinned can only be
+       inspected afterward */
+    nn_rmsg_release (&d->rmsg);
+    if (d->rmsg_unpinned)
+      ddsrt_free ((char *) d->rmsg_payload - UNPINNED_PAYLOAD_OFF);
+    d->rmsg_payload = NULL;
+  }
+  if (d->size < serdatapool_class_size[0] || d->size > MAX_SIZE_FOR_POOL)
     dds_free (d);
+  else
+  {
+    int i = SERDATAPOOL_NCLASSES - 1;
+    while (d->size < serdatapool_class_size[i])
+      i--;
+    if (!nn_freelist_push (&d->serpool->freelist[i], d))
+      dds_free (d);
+  }
 }
 
 static void serdata_default_init(struct ddsi_serdata_default *d, const struct ddsi_sertopic_default *tp, enum ddsi_serdata_kind kind)
@@ -180,6 +224,10 @@ static void serdata_default_init(struct ddsi_serdata_default *d, const struct dd
 #endif
   d->hdr.identifier = tp->native_encoding_identifier;
   d->hdr.options = 0;
+  d->shm_payload = NULL;
+  d->shm_size = 0;
+  d->rmsg_payload = NULL;
+  d->rmsg_unpinned = false;
   memset (d->keyhash.m_hash, 0, sizeof (d->keyhash.m_hash));
   d->keyhash.m_set = 0;
   d->keyhash.m_iskey = 0;
@@ -196,10 +244,25 @@ static struct ddsi_serdata_default *serdata_default_allocnew (struct serdatapool
 
 static struct ddsi_serdata_default *serdata_default_new_size (const struct ddsi_sertopic_default *tp, enum ddsi_serdata_kind kind, uint32_t size)
 {
-  struct ddsi_serdata_default *d;
-  if (size <= MAX_SIZE_FOR_POOL && (d = nn_freelist_pop (&tp->serpool->freelist)) != NULL)
-    ddsrt_atomic_st32 (&d->c.refc, 1);
-  else if ((d = serdata_default_allocnew (tp->serpool, size)) == NULL)
+  /* the counters are statistics only, the topic is otherwise not modified */
+  struct ddsi_sertopic_default * const tp_stats = (struct ddsi_sertopic_default *) tp;
+  struct ddsi_serdata_default *d = NULL;
+  ddsrt_atomic_inc64 (&tp_stats->serdata_allocs);
+  if (size <= MAX_SIZE_FOR_POOL)
+  {
+    /* new ones are allocated with the size of the class, so that they fit in
+       the same class when freed */
+    int i = 0;
+    while (size > serdatapool_class_size[i])
+      i++;
+    size = serdatapool_class_size[i];
+    if ((d = nn_freelist_pop (&tp->serpool->freelist[i])) != NULL)
+    {
+      ddsrt_atomic_st32 (&d->c.refc, 1);
+      ddsrt_atomic_inc64 (&tp_stats->serdata_pool_hits);
+    }
+  }
+  if (d == NULL && (d = serdata_default_allocnew (tp->serpool, size)) == NULL)
     return NULL;
   serdata_default_init (d, tp, kind);
   return d;
@@ -210,10 +273,133 @@ static struct ddsi_serdata_default *serdata_default_new (const struct ddsi_serto
   return serdata_default_new_size (tp, kind, DEFAULT_NEW_SIZE);
 }
 
+/* Complete a serdata received from a peer on the same host that contains a
+   reference to the sample in shared memory rather than the sample itself */
+static struct ddsi_serdata_default *serdata_default_from_shm_desc (const struct ddsi_sertopic_default *tp, struct ddsi_serdata_default *d, enum ddsi_serdata_kind kind)
+{
+  struct ddsi_shm_chunk_desc desc;
+  dds_istream_t is;
+  if (kind != SDK_DATA || d->pos < sizeof (desc) || tp->c.gv == NULL)
+    goto fail;
+  memcpy (&desc, d->data, sizeof (desc));
+  if ((d->shm_payload = ddsi_shm_chunk_resolve (tp->c.gv, &desc)) == NULL)
+    goto fail;
+  d->shm_size = desc.size;
+  /* same host, so same byte order, but it still needs to be validated */
+  if (!dds_stream_normalize (d->shm_payload, d->shm_size, false, tp, false))
+    goto fail;
+  dds_istream_from_serdata_default (&is, d);
+  dds_stream_extract_keyhash (&is, &d->keyhash, tp, false);
+  return d;
+fail:
+  ddsi_serdata_unref (&d->c);
+  return NULL;
+}
+
+/* Normalize the payload of a serdata constructed from received data and
+   extract the key hash */
+static struct ddsi_serdata_default *serdata_default_from_ser_finish (const struct ddsi_sertopic_default *tp, struct ddsi_serdata_default *d, enum ddsi_serdata_kind kind)
+{
+  char * const payload = d->rmsg_payload ? (char *) d->rmsg_payload : d->data;
+  if (d->hdr.identifier == CDR_SHM)
+    return serdata_default_from_shm_desc (tp, d, kind);
+  const bool needs_bswap = (d->hdr.identifier != NATIVE_ENCODING);
+  d->hdr.identifier = NATIVE_ENCODING;
+  const uint32_t pad = ddsrt_fromBE2u (d->hdr.options) & 2;
+  if (d->pos < pad)
+  {
+    ddsi_serdata_unref (&d->c);
+    return NULL;
+  }
+  else if (!dds_stream_normalize (payload, d->pos - pad, needs_bswap, tp, kind == SDK_KEY))
+  {
+    ddsi_serdata_unref (&d->c);
+    return NULL;
+  }
+  else
+  {
+    dds_istream_t is;
+    dds_istream_from_serdata_default (&is, d);
+    dds_stream_extract_keyhash (&is, &d->keyhash, tp, kind == SDK_KEY);
+    return d;
+  }
+}
+
+static void serdata_default_release_unpinned (struct gcreq *gcreq)
+{
+  nn_rmsg_release_unpinned (gcreq->arg);
+  gcreq_free (gcreq);
+}
+
+static bool serdata_default_unpin (struct nn_rmsg_retainer *r)
+{
+  /* Called with the receive buffer pool locked, the serdata may be in the process
+     of being freed, but that will wait for the lock.  Any thread may still be
+     reading the data at the old address, but all such threads are awake, and so
+     the rmsg is released only after they have all made progress. */
+  struct ddsi_serdata_default * const d = (struct ddsi_serdata_default *) ((char *) r - offsetof (struct ddsi_serdata_default, rmsg));
+  struct gcreq *gcreq;
+  char *copy;
+  assert (d->rmsg_payload != NULL && !d->rmsg_unpinned);
+  if ((copy = ddsrt_malloc_s (UNPINNED_PAYLOAD_OFF + d->pos)) == NULL)
+    return false;
+  memcpy (copy + UNPINNED_PAYLOAD_OFF - sizeof (d->hdr), &d->hdr, sizeof (d->hdr));
+  memcpy (copy + UNPINNED_PAYLOAD_OFF, d->rmsg_payload, d->pos);
+  gcreq = gcreq_new (d->c.topic->gv->gcreq_queue, serdata_default_release_unpinned);
+  gcreq->arg = r->rmsg;
+  d->rmsg_payload = copy + UNPINNED_PAYLOAD_OFF;
+  d->rmsg_unpinned = true;
+  gcreq_enqueue (gcreq);
+  return true;
+}
+
+void ddsi_serdata_default_keep_rmsg (struct ddsi_serdata *dcmn)
+{
+  struct ddsi_serdata_default *d = (struct ddsi_serdata_default *)dcmn;
+  if (dcmn->ops != &ddsi_serdata_ops_cdr && dcmn->ops != &ddsi_serdata_ops_cdr_nokey)
+    return;
+  if (d->rmsg_payload)
+    nn_rmsg_retainer_keep (&d->rmsg);
+}
+
+/* Construct a serdata referencing a sample in the receive buffer instead of
+   copying it, if the sample is contiguous, native-endian, large enough for it
+   to be worth it and suitably aligned.  A referenced sample keeps its receive
+   buffer alive, so it must also account for most of the message it is in and
+   the amount of data retained this way is limited.  Returns NULL if the sample
+   must be copied. */
+static struct ddsi_serdata_default *serdata_default_from_ser_ref (const struct ddsi_sertopic_default *tp, enum ddsi_serdata_kind kind, const struct nn_rdata *fragchain, size_t size)
+{
+  struct ddsi_serdata_default *d;
+  struct CDRHeader hdr;
+  if (kind != SDK_DATA || tp->cdr_align == 0 || size < MIN_SIZE_FOR_RMSG_REF || fragchain->maxp1 < size)
+    return NULL;
+  const unsigned char *ser = NN_RMSG_PAYLOADOFF (fragchain->rmsg, NN_RDATA_PAYLOAD_OFF (fragchain));
+  memcpy (&hdr, ser, sizeof (hdr));
+  if (hdr.identifier != NATIVE_ENCODING || ((uintptr_t) (ser + sizeof (hdr)) % tp->cdr_align) != 0)
+    return NULL;
+  if (2 * size < fragchain->rmsg->chunk.u.size)
+    return NULL;
+  const uint32_t payload_size = (uint32_t) size - (uint32_t) sizeof (hdr);
+  if ((d = serdata_default_new (tp, kind)) == NULL)
+    return NULL;
+  d->rmsg.unpin = serdata_default_unpin;
+  if (!nn_rmsg_retain (fragchain->rmsg, payload_size, &d->rmsg))
+  {
+    ddsi_serdata_unref (&d->c);
+    return NULL;
+  }
+  d->hdr = hdr;
+  d->rmsg_payload = (const char *) ser + sizeof (hdr);
+  d->pos = payload_size;
+  return d;
+}
+
 /* Construct a serdata from a fragchain received over the network */
 static struct ddsi_serdata_default *serdata_default_from_ser_common (const struct ddsi_sertopic *tpcmn, enum ddsi_serdata_kind kind, const struct nn_rdata *fragchain, size_t size)
 {
   const struct ddsi_sertopic_default *tp = (const struct ddsi_sertopic_default *)tpcmn;
+  struct ddsi_serdata_default *d;
 
   /* FIXME: check whether this really is the correct maximum: offsets are relative
      to the CDR header, but there are also some places that use a serdata as-if it
@@ -221,17 +407,18 @@ static struct ddsi_serdata_default *serdata_default_from_ser_common (const struc
      serdata */
   if (size > UINT32_MAX - offsetof (struct ddsi_serdata_default, hdr))
     return NULL;
-  struct ddsi_serdata_default *d = serdata_default_new_size (tp, kind, (uint32_t) size);
-  if (d == NULL)
+  assert (fragchain->min == 0);
+  if ((d = serdata_default_from_ser_ref (tp, kind, fragchain, size)) != NULL)
+    return serdata_default_from_ser_finish (tp, d, kind);
+  if ((d = serdata_default_new_size (tp, kind, (uint32_t) size)) == NULL)
     return NULL;
 
   uint32_t off = 4; /* must skip the CDR header */
 
-  assert (fragchain->min == 0);
   assert (fragchain->maxp1 >= off); /* CDR header must be in first fragment */
 
   memcpy (&d->hdr, NN_RMSG_PAYLOADOFF (fragchain->rmsg, NN_RDATA_PAYLOAD_OFF (fragchain)), sizeof (d->hdr));
-  assert (d->hdr.identifier == CDR_LE || d->hdr.identifier == CDR_BE);
+  assert (d->hdr.identifier == CDR_LE || d->hdr.identifier == CDR_BE || d->hdr.identifier == CDR_SHM);
 
   while (fragchain)
   {
@@ -246,27 +433,7 @@ static struct ddsi_serdata_default *serdata_default_from_ser_common (const struc
     }
     fragchain = fragchain->nextfrag;
   }
-
-  const bool needs_bswap = (d->hdr.identifier != NATIVE_ENCODING);
-  d->hdr.identifier = NATIVE_ENCODING;
-  const uint32_t pad = ddsrt_fromBE2u (d->hdr.options) & 2;
-  if (d->pos < pad)
-  {
-    ddsi_serdata_unref (&d->c);
-    return NULL;
-  }
-  else if (!dds_stream_normalize (d->data, d->pos - pad, needs_bswap, tp, kind == SDK_KEY))
-  {
-    ddsi_serdata_unref (&d->c);
-    return NULL;
-  }
-  else
-  {
-    dds_istream_t is;
-    dds_istream_from_serdata_default (&is, d);
-    dds_stream_extract_keyhash (&is, &d->keyhash, tp, kind == SDK_KEY);
-    return d;
-  }
+  return serdata_default_from_ser_finish (tp, d, kind);
 }
 
 static struct ddsi_serdata_default *serdata_default_from_ser_iov_common (const struct ddsi_sertopic *tpcmn, enum ddsi_serdata_kind kind, ddsrt_msg_iovlen_t niov, const ddsrt_iovec_t *iov, size_t size)
@@ -287,31 +454,11 @@ static struct ddsi_serdata_default *serdata_default_from_ser_iov_common (const s
     return NULL;
 
   memcpy (&d->hdr, iov[0].iov_base, sizeof (d->hdr));
-  assert (d->hdr.identifier == CDR_LE || d->hdr.identifier == CDR_BE);
+  assert (d->hdr.identifier == CDR_LE || d->hdr.identifier == CDR_BE || d->hdr.identifier == CDR_SHM);
   serdata_default_append_blob (&d, 1, iov[0].iov_len - 4, (const char *) iov[0].iov_base + 4);
   for (ddsrt_msg_iovlen_t i = 1; i < niov; i++)
     serdata_default_append_blob (&d, 1, iov[i].iov_len, iov[i].iov_base);
-
-  const bool needs_bswap = (d->hdr.identifier != NATIVE_ENCODING);
-  d->hdr.identifier = NATIVE_ENCODING;
-  const uint32_t pad = ddsrt_fromBE2u (d->hdr.options) & 2;
-  if (d->pos < pad)
-  {
-    ddsi_serdata_unref (&d->c);
-    return NULL;
-  }
-  else if (!dds_stream_normalize (d->data, d->pos - pad, needs_bswap, tp, kind == SDK_KEY))
-  {
-    ddsi_serdata_unref (&d->c);
-    return NULL;
-  }
-  else
-  {
-    dds_istream_t is;
-    dds_istream_from_serdata_default (&is, d);
-    dds_stream_extract_keyhash (&is, &d->keyhash, tp, kind == SDK_KEY);
-    return d;
-  }
+  return serdata_default_from_ser_finish (tp, d, kind);
 }
 
 static struct ddsi_serdata *serdata_default_from_ser (const struct ddsi_sertopic *tpcmn, enum ddsi_serdata_kind kind, const struct nn_rdata *fragchain, size_t size)
@@ -421,14 +568,63 @@ static void gen_keyhash_from_sample (const struct ddsi_sertopic_default *topic,
   }
 }
 
+/* Samples of variable-size types are serialized into a serdata sized for the
+   typical sample of the topic, which is estimated as a moving average that
+   follows increases immediately and decreases more slowly, to avoid having to
+   grow the serdata while serializing.  The estimate is capped at the largest
+   pooled size: larger samples aren't pooled anyway, and it prevents a single
+   large sample from making the following ones needlessly large. */
+static uint32_t serdata_default_size_estimate (const struct ddsi_sertopic_default *tp)
+{
+  const uint32_t est = ddsrt_atomic_ld32 (&tp->size_estimate);
+  return (est < DEFAULT_NEW_SIZE) ? DEFAULT_NEW_SIZE : est;
+}
+
+static void serdata_default_update_size_estimate (const struct ddsi_sertopic_default *tp, uint32_t size)
+{
+  /* races are harmless, an update may get lost but it is only an estimate */
+  struct ddsi_sertopic_default * const tp_stats = (struct ddsi_sertopic_default *) tp;
+  const uint32_t est = ddsrt_atomic_ld32 (&tp->size_estimate);
+  if (size > MAX_SIZE_FOR_POOL)
+    size = MAX_SIZE_FOR_POOL;
+  if (size > est)
+    ddsrt_atomic_st32 (&tp_stats->size_estimate, size);
+  else if (size < est)
+    ddsrt_atomic_st32 (&tp_stats->size_estimate, est - (est - size + 3) / 4);
+}
+
+static struct ddsi_serdata_default *serdata_default_shrink (const struct ddsi_sertopic_default *tp, struct ddsi_serdata_default *d)
+{
+  /* A pooled serdata that turned out to be much larger than needed because of
+     the estimate is shrunk to the smallest size class that fits, because it may
+     well be kept in the WHC for a long time; larger ones were grown while
+     serializing and so are at most one growth step too large */
+  if (d->size > MAX_SIZE_FOR_POOL || d->pos > d->size / 4)
+    return d;
+  int i = 0;
+  while (d->pos > serdatapool_class_size[i])
+    i++;
+  if (serdatapool_class_size[i] >= d->size)
+    return d;
+  struct ddsi_serdata_default *d1;
+  if ((d1 = ddsrt_realloc_s (d, offsetof (struct ddsi_serdata_default, data) + serdatapool_class_size[i])) == NULL)
+    return d;
+  d1->size = serdatapool_class_size[i];
+  struct ddsi_sertopic_default * const tp_stats = (struct ddsi_sertopic_default *) tp;
+  ddsrt_atomic_inc64 (&tp_stats->serdata_reallocs);
+  return d1;
+}
+
 static struct ddsi_serdata_default *serdata_default_from_sample_cdr_common (const struct ddsi_sertopic *tpcmn, enum ddsi_serdata_kind kind, const void *sample)
 {
   const struct ddsi_sertopic_default *tp = (const struct ddsi_sertopic_default *)tpcmn;
-  struct ddsi_serdata_default *d = serdata_default_new(tp, kind);
+  struct ddsi_serdata_default *d = serdata_default_new_size (tp, kind, (kind == SDK_DATA) ? serdata_default_size_estimate (tp) : DEFAULT_NEW_SIZE);
   if (d == NULL)
     return NULL;
   dds_ostream_t os;
-  gen_keyhash_from_sample (tp, &d->keyhash, sample);
+  /* an empty sample (e.g., the end of a coherent set) has no key and needs no sample */
+  if (kind != SDK_EMPTY)
+    gen_keyhash_from_sample (tp, &d->keyhash, sample);
   dds_ostream_from_serdata_default (&os, d);
   switch (kind)
   {
@@ -442,9 +638,32 @@ static struct ddsi_serdata_default *serdata_default_from_sample_cdr_common (cons
       break;
   }
   dds_ostream_add_to_serdata_default (&os, &d);
+  if (os.m_reallocs > 0)
+  {
+    struct ddsi_sertopic_default * const tp_stats = (struct ddsi_sertopic_default *) tp;
+    ddsrt_atomic_add64 (&tp_stats->serdata_reallocs, os.m_reallocs);
+  }
+  if (kind == SDK_DATA)
+  {
+    serdata_default_update_size_estimate (tp, d->pos);
+    d = serdata_default_shrink (tp, d);
+  }
   return d;
 }
 
+void ddsi_sertopic_default_get_serdata_stats (const struct ddsi_sertopic *tpcmn, uint64_t *allocs, uint64_t *pool_hits, uint64_t *reallocs)
+{
+  if (tpcmn->ops != &ddsi_sertopic_ops_default)
+    *allocs = *pool_hits = *reallocs = 0;
+  else
+  {
+    const struct ddsi_sertopic_default *tp = (const struct ddsi_sertopic_default *) tpcmn;
+    *allocs = ddsrt_atomic_ld64 (&tp->serdata_allocs);
+    *pool_hits = ddsrt_atomic_ld64 (&tp->serdata_pool_hits);
+    *reallocs = ddsrt_atomic_ld64 (&tp->serdata_reallocs);
+  }
+}
+
 static struct ddsi_serdata *serdata_default_from_sample_cdr (const struct ddsi_sertopic *tpcmn, enum ddsi_serdata_kind kind, const void *sample)
 {
   struct ddsi_serdata_default *d;
@@ -461,11 +680,51 @@ static struct ddsi_serdata *serdata_default_from_sample_cdr_nokey (const struct
   return fix_serdata_default_nokey (d, tpcmn->serdata_basehash);
 }
 
+bool ddsi_sertopic_default_supports_shm_loans (const struct ddsi_sertopic *tpcmn)
+{
+  const struct ddsi_sertopic_default *tp = (const struct ddsi_sertopic_default *)tpcmn;
+  if (tpcmn->gv == NULL || (tpcmn->serdata_ops != &ddsi_serdata_ops_cdr && tpcmn->serdata_ops != &ddsi_serdata_ops_cdr_nokey))
+    return false;
+  return tp->opt_size > 0 && tp->type.m_size <= ddsi_shm_chunk_size (tpcmn->gv);
+}
+
+struct ddsi_serdata *ddsi_serdata_default_from_shm_chunk (const struct ddsi_sertopic *tpcmn, void *payload)
+{
+  const struct ddsi_sertopic_default *tp = (const struct ddsi_sertopic_default *)tpcmn;
+  struct ddsi_shm_chunk_desc desc;
+  struct ddsi_serdata_default *d;
+  assert (tp->opt_size > 0 && tp->opt_size <= ddsi_shm_chunk_size (tp->c.gv));
+  if ((d = serdata_default_new (tp, SDK_DATA)) == NULL)
+  {
+    ddsi_shm_chunk_unref (payload);
+    return NULL;
+  }
+  /* for these types the in-memory representation is the CDR representation */
+  ddsi_shm_chunk_describe (tp->c.gv, payload, (uint32_t) tp->opt_size, &desc);
+  d->hdr.identifier = CDR_SHM;
+  serdata_default_append_blob (&d, 1, sizeof (desc), &desc);
+  d->shm_payload = payload;
+  d->shm_size = (uint32_t) tp->opt_size;
+  gen_keyhash_from_sample (tp, &d->keyhash, payload);
+  if (tpcmn->serdata_ops == &ddsi_serdata_ops_cdr_nokey)
+    return fix_serdata_default_nokey (d, tpcmn->serdata_basehash);
+  else
+    return fix_serdata_default (d, tpcmn->serdata_basehash);
+}
+
+const void *ddsi_serdata_default_shm_payload (const struct ddsi_serdata *dcmn)
+{
+  const struct ddsi_serdata_default *d = (const struct ddsi_serdata_default *)dcmn;
+  if (dcmn->ops != &ddsi_serdata_ops_cdr && dcmn->ops != &ddsi_serdata_ops_cdr_nokey)
+    return NULL;
+  return d->shm_payload;
+}
+
 static struct ddsi_serdata *serdata_default_to_topicless (const struct ddsi_serdata *serdata_common)
 {
   const struct ddsi_serdata_default *d = (const struct ddsi_serdata_default *)serdata_common;
   const struct ddsi_sertopic_default *tp = (const struct ddsi_sertopic_default *)d->c.topic;
-  assert (d->hdr.identifier == NATIVE_ENCODING || d->hdr.identifier == NATIVE_ENCODING_PL);
+  assert (d->hdr.identifier == NATIVE_ENCODING || d->hdr.identifier == NATIVE_ENCODING_PL || d->hdr.identifier == CDR_SHM);
   struct ddsi_serdata_default *d_tl = serdata_default_new(tp, SDK_KEY);
   if (d_tl == NULL)
     return NULL;
@@ -478,9 +737,12 @@ static struct ddsi_serdata *serdata_default_to_topicless (const struct ddsi_serd
      the payload is of interest. */
   if (d->c.ops == &ddsi_serdata_ops_cdr)
   {
-    assert (d->hdr.identifier == NATIVE_ENCODING);
+    assert (d->hdr.identifier == NATIVE_ENCODING || d->hdr.identifier == CDR_SHM);
     if (d->c.kind == SDK_KEY)
+    {
+      assert (d->rmsg_payload == NULL);
       serdata_default_append_blob (&d_tl, 1, d->pos, d->data);
+    }
     else if (d->keyhash.m_iskey)
     {
       serdata_default_append_blob (&d_tl, 1, sizeof (d->keyhash.m_hash), d->keyhash.m_hash);
@@ -509,12 +771,18 @@ static struct ddsi_serdata *serdata_default_to_topicless (const struct ddsi_serd
 }
 
 /* Fill buffer with 'size' bytes of serialised data, starting from 'off'; 0 <= off < off+sz <= alignup4(size(d)) */
+static const char *serdata_default_ser (const struct ddsi_serdata_default *d)
+{
+  /* the CDR header precedes the payload in the received message, too */
+  return d->rmsg_payload ? d->rmsg_payload - sizeof (struct CDRHeader) : (const char *) &d->hdr;
+}
+
 static void serdata_default_to_ser (const struct ddsi_serdata *serdata_common, size_t off, size_t sz, void *buf)
 {
   const struct ddsi_serdata_default *d = (const struct ddsi_serdata_default *)serdata_common;
   assert (off < d->pos + sizeof(struct CDRHeader));
   assert (sz <= alignup_size (d->pos + sizeof(struct CDRHeader), 4) - off);
-  memcpy (buf, (char *)&d->hdr + off, sz);
+  memcpy (buf, serdata_default_ser (d) + off, sz);
 }
 
 static struct ddsi_serdata *serdata_default_to_ser_ref (const struct ddsi_serdata *serdata_common, size_t off, size_t sz, ddsrt_iovec_t *ref)
@@ -522,7 +790,7 @@ static struct ddsi_serdata *serdata_default_to_ser_ref (const struct ddsi_serdat
   const struct ddsi_serdata_default *d = (const struct ddsi_serdata_default *)serdata_common;
   assert (off < d->pos + sizeof(struct CDRHeader));
   assert (sz <= alignup_size (d->pos + sizeof(struct CDRHeader), 4) - off);
-  ref->iov_base = (char *)&d->hdr + off;
+  ref->iov_base = (char *) serdata_default_ser (d) + off;
   ref->iov_len = (ddsrt_iov_len_t)sz;
   return ddsi_serdata_ref(serdata_common);
 }
@@ -539,7 +807,7 @@ static bool serdata_default_to_sample_cdr (const struct ddsi_serdata *serdata_co
   const struct ddsi_sertopic_default *tp = (const struct ddsi_sertopic_default *) d->c.topic;
   dds_istream_t is;
   if (bufptr) abort(); else { (void)buflim; } /* FIXME: haven't implemented that bit yet! */
-  assert (d->hdr.identifier == NATIVE_ENCODING);
+  assert (d->hdr.identifier == NATIVE_ENCODING || d->hdr.identifier == CDR_SHM);
   dds_istream_from_serdata_default(&is, d);
   if (d->c.kind == SDK_KEY)
     dds_stream_read_key (&is, sample, tp);
@@ -70,6 +70,7 @@ static void sertopic_default_free (struct ddsi_sertopic *tpcmn)
   struct ddsi_sertopic_default *tp = (struct ddsi_sertopic_default *) tpcmn;
   ddsrt_free (tp->type.m_keys);
   ddsrt_free (tp->type.m_ops);
+  ddsrt_free (tp->type_description);
   ddsi_sertopic_fini (&tp->c);
   ddsrt_free (tp);
 }
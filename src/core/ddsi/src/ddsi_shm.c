@@ -0,0 +1,987 @@
+/*
+ * Copyright(c) 2020 ADLINK Technology Limited and others
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License v. 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0, or the Eclipse Distribution License
+ * v. 1.0 which is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+ */
+#include "dds/ddsi/ddsi_tran.h"
+#include "dds/ddsi/ddsi_shm.h"
+#include "dds/ddsi/q_config.h"
+#include "dds/ddsi/q_log.h"
+#include "dds/ddsi/ddsi_domaingv.h"
+#include "dds/ddsrt/atomics.h"
+#include "dds/ddsrt/avl.h"
+#include "dds/ddsrt/heap.h"
+#include "dds/ddsrt/md5.h"
+#include "dds/ddsrt/random.h"
+#include "dds/ddsrt/sync.h"
+#include "dds/ddsrt/time.h"
+
+#if defined(__linux) && !LWIP_SOCKET && DDSRT_HAVE_ATOMIC64
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/* Each domain instance that has shared memory enabled creates a single
+   receive ring in /dev/shm, named after the host id and its unicast data
+   port.  The port is unique only for a given transport in a given network
+   namespace, and so those are included in the host id.  A ring or pool that
+   already exists is removed only if the process that created it no longer
+   exists, as happens when it crashed.  Any number of processes of the same user may write
+   into it (MPSC): producers serialize on a spinlock in the ring header, the
+   consumer is the receive thread of the owner, which sleeps on a futex when
+   the ring is empty.  Semantics are those of UDP: if the ring is full, the
+   message is dropped and the reliability protocol takes care of the rest.
+
+   The lock word holds the process id of the holder, so that a lock held by
+   a process that died can be taken over.  That is safe because the head is
+   advanced only once a message has been written completely.  A producer
+   that can't get the lock from a live holder for a long time (e.g., because
+   it is stopped in a debugger) drops the message.
+
+   The consumer doesn't trust the message headers: a message that extends
+   beyond the data written by the producers causes the contents of the ring
+   to be discarded.
+
+   Messages are stored as an 8-byte header followed by the payload, padded
+   to a multiple of 8 bytes; a header with length SHM_WRAP indicates the
+   remainder of the data area is unused and the next message starts at
+   offset 0.
+
+   Next to the ring, each domain instance may have a pool of fixed-size
+   chunks in which writers construct samples that are then exchanged by
+   reference with readers on the same host.  Only the owner allocates chunks
+   (a reference count going from 0 to 1), but any process that has mapped
+   the pool may take and drop references.  The generation number guards
+   against a reader resolving a descriptor for a chunk that got recycled in
+   the meantime. */
+
+#define SHM_MAGIC 0x53484d31u /* "SHM1" */
+#define SHM_POOL_MAGIC 0x53485031u /* "SHP1" */
+#define SHM_WRAP UINT32_MAX
+#define SHM_LOCK_CHECK_INTERVAL DDS_MSECS (10)
+#define SHM_LOCK_TIMEOUT DDS_SECS (1)
+#define SHM_READ_TIMEOUT_SEC 1
+#define SHM_NAME_SIZE 64
+
+struct shm_ring {
+  uint32_t magic;
+  uint32_t size;                    /* size of data area, power of 2 */
+  ddsrt_atomic_uint32_t closed;     /* set by owner when it goes away */
+  ddsrt_atomic_uint32_t lock;       /* producer lock: 0 or pid of holder */
+  ddsrt_atomic_uint32_t wakeup;     /* futex word, incremented after each publish */
+  ddsrt_atomic_uint32_t waiting;    /* consumer is (about to go) sleeping on wakeup */
+  uint32_t owner;                   /* pid of consumer */
+  char pad0[64 - 7 * sizeof (uint32_t)];
+  ddsrt_atomic_uint64_t head;       /* written by producers, holding the lock */
+  char pad1[64 - sizeof (uint64_t)];
+  ddsrt_atomic_uint64_t tail;       /* written by consumer */
+  char pad2[64 - sizeof (uint64_t)];
+  unsigned char data[];
+};
+
+struct shm_msghdr {
+  uint32_t len;
+  uint32_t srcport;
+};
+
+struct shm_pool {
+  uint32_t magic;
+  uint32_t pool_id;
+  uint32_t nchunks;
+  uint32_t chunksize;               /* payload size, multiple of 64 */
+  uint32_t owner;                   /* pid of process allocating from it */
+  char pad[64 - 5 * sizeof (uint32_t)];
+  unsigned char chunks[];
+};
+
+/* Reference count of a chunk that is being allocated and whose generation
+   may not have been updated yet */
+#define SHM_CHUNK_CLAIMED 0x80000000u
+
+struct shm_chunkhdr {
+  ddsrt_atomic_uint32_t refc;
+  uint32_t gen;
+  uint32_t index;
+  char pad[64 - 3 * sizeof (uint32_t)];
+};
+
+struct shm_mapping {
+  struct shm_mapping *next;
+  void *addr;
+  size_t size;
+};
+
+struct shm_peer {
+  ddsrt_avl_node_t avlnode;
+  uint32_t port;
+  struct shm_ring *ring;
+  size_t mapsize;
+  struct shm_pool *pool;
+  size_t pool_mapsize;
+};
+
+typedef struct ddsi_shm_conn {
+  struct ddsi_tran_conn m_base;
+  uint32_t m_pid;
+  struct shm_ring *m_ring;
+  size_t m_mapsize;
+  struct shm_pool *m_pool;
+  size_t m_pool_mapsize;
+  ddsrt_mutex_t m_pool_lock;
+  uint32_t m_pool_cursor;
+  ddsrt_mutex_t m_peers_lock;
+  ddsrt_avl_tree_t m_peers;
+  /* Pools of peers that have gone away may still contain chunks referenced
+     by samples in reader history caches, those are unmapped only when the
+     connection is released */
+  struct shm_mapping *m_stale_pools;
+} *ddsi_shm_conn_t;
+
+typedef struct ddsi_shm_tran_factory {
+  struct ddsi_tran_factory fact;
+  unsigned char hostid[16];
+} *ddsi_shm_tran_factory_t;
+
+static int compare_port (const void *va, const void *vb)
+{
+  const uint32_t *a = va, *b = vb;
+  return (*a == *b) ? 0 : (*a < *b) ? -1 : 1;
+}
+
+static const ddsrt_avl_treedef_t shm_peers_treedef =
+  DDSRT_AVL_TREEDEF_INITIALIZER (offsetof (struct shm_peer, avlnode), offsetof (struct shm_peer, port), compare_port, 0);
+
+static void shm_segment_name (char *dst, size_t size, const char *kind, const unsigned char hostid[16], uint32_t port)
+{
+  int n = snprintf (dst, size, "/cyclonedds-%s-", kind);
+  for (int i = 0; i < 16 && n > 0 && (size_t) n < size; i++)
+    n += snprintf (dst + n, size - (size_t) n, "%02x", hostid[i]);
+  if (n > 0 && (size_t) n < size)
+    (void) snprintf (dst + n, size - (size_t) n, "-%"PRIu32, port);
+}
+
+static void shm_ring_name (char *dst, size_t size, const unsigned char hostid[16], uint32_t port)
+{
+  shm_segment_name (dst, size, "shm", hostid, port);
+}
+
+static void shm_pool_name (char *dst, size_t size, const unsigned char hostid[16], uint32_t port)
+{
+  shm_segment_name (dst, size, "shmpool", hostid, port);
+}
+
+static const unsigned char *shm_hostid (const ddsi_shm_conn_t uc)
+{
+  return ((const struct ddsi_shm_tran_factory *) uc->m_base.m_factory)->hostid;
+}
+
+static bool shm_pid_alive (uint32_t pid)
+{
+  return kill ((pid_t) pid, 0) == 0 || errno != ESRCH;
+}
+
+/* True iff the segment exists and its owner (at offset owner_off in the
+   header) is still around.  A segment of which the owner is not yet set
+   can only be one of which the creator crashed: one that is being created
+   would be for the same transport, network namespace and port number */
+static bool shm_segment_owner_alive (const char *name, size_t owner_off)
+{
+  struct stat st;
+  uint32_t owner = 0;
+  void *hdr;
+  int fd;
+  if ((fd = shm_open (name, O_RDONLY, 0600)) < 0)
+    return false;
+  if (fstat (fd, &st) < 0 || (size_t) st.st_size < owner_off + sizeof (owner))
+  {
+    close (fd);
+    return false;
+  }
+  hdr = mmap (NULL, owner_off + sizeof (owner), PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (hdr == MAP_FAILED)
+    return false;
+  memcpy (&owner, (const char *) hdr + owner_off, sizeof (owner));
+  munmap (hdr, owner_off + sizeof (owner));
+  return owner != 0 && shm_pid_alive (owner);
+}
+
+static size_t shm_align8 (size_t x)
+{
+  return (x + 7) & ~(size_t) 7;
+}
+
+static void shm_futex_wake (ddsrt_atomic_uint32_t *w)
+{
+  (void) syscall (SYS_futex, &w->v, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static void shm_futex_wait (ddsrt_atomic_uint32_t *w, uint32_t val)
+{
+  const struct timespec ts = { SHM_READ_TIMEOUT_SEC, 0 };
+  (void) syscall (SYS_futex, &w->v, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+static struct shm_ring *shm_ring_map (const char *name, int oflag, size_t *mapsize)
+{
+  struct shm_ring *ring;
+  struct stat st;
+  int fd;
+  if ((fd = shm_open (name, oflag, 0600)) < 0)
+    return NULL;
+  if (fstat (fd, &st) < 0 || (size_t) st.st_size <= sizeof (*ring))
+  {
+    close (fd);
+    return NULL;
+  }
+  ring = mmap (NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+  if (ring == MAP_FAILED)
+    return NULL;
+  if (ring->magic != SHM_MAGIC || sizeof (*ring) + ring->size != (size_t) st.st_size)
+  {
+    munmap (ring, (size_t) st.st_size);
+    return NULL;
+  }
+  *mapsize = (size_t) st.st_size;
+  return ring;
+}
+
+static struct shm_ring *shm_ring_create (const char *name, uint32_t size, uint32_t self, size_t *mapsize)
+{
+  struct shm_ring *ring;
+  int fd;
+  /* A ring left behind by a process that used the same port number before
+     (and crashed) may still be mapped by others: unlink it rather than
+     truncating it so that those mappings stay valid */
+  if (shm_segment_owner_alive (name, offsetof (struct shm_ring, owner)))
+  {
+    errno = EADDRINUSE;
+    return NULL;
+  }
+  (void) shm_unlink (name);
+  if ((fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0)
+    return NULL;
+  *mapsize = sizeof (*ring) + size;
+  if (ftruncate (fd, (off_t) *mapsize) < 0)
+  {
+    close (fd);
+    (void) shm_unlink (name);
+    return NULL;
+  }
+  ring = mmap (NULL, *mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+  if (ring == MAP_FAILED)
+  {
+    (void) shm_unlink (name);
+    return NULL;
+  }
+  ring->size = size;
+  ddsrt_atomic_st32 (&ring->closed, 0);
+  ddsrt_atomic_st32 (&ring->lock, 0);
+  ddsrt_atomic_st32 (&ring->wakeup, 0);
+  ddsrt_atomic_st32 (&ring->waiting, 0);
+  ring->owner = self;
+  ddsrt_atomic_st64 (&ring->head, 0);
+  ddsrt_atomic_st64 (&ring->tail, 0);
+  ddsrt_atomic_fence ();
+  ring->magic = SHM_MAGIC;
+  return ring;
+}
+
+static size_t shm_pool_chunk_stride (uint32_t chunksize)
+{
+  return sizeof (struct shm_chunkhdr) + chunksize;
+}
+
+static struct shm_chunkhdr *shm_pool_chunk (struct shm_pool *pool, uint32_t index)
+{
+  return (struct shm_chunkhdr *) (pool->chunks + index * shm_pool_chunk_stride (pool->chunksize));
+}
+
+static struct shm_pool *shm_pool_map (const char *name, size_t *mapsize)
+{
+  struct shm_pool *pool;
+  struct stat st;
+  int fd;
+  if ((fd = shm_open (name, O_RDWR, 0600)) < 0)
+    return NULL;
+  if (fstat (fd, &st) < 0 || (size_t) st.st_size <= sizeof (*pool))
+  {
+    close (fd);
+    return NULL;
+  }
+  pool = mmap (NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+  if (pool == MAP_FAILED)
+    return NULL;
+  if (pool->magic != SHM_POOL_MAGIC || sizeof (*pool) + pool->nchunks * shm_pool_chunk_stride (pool->chunksize) != (size_t) st.st_size)
+  {
+    munmap (pool, (size_t) st.st_size);
+    return NULL;
+  }
+  *mapsize = (size_t) st.st_size;
+  return pool;
+}
+
+static struct shm_pool *shm_pool_create (const char *name, uint32_t nchunks, uint32_t chunksize, uint32_t self, size_t *mapsize)
+{
+  struct shm_pool *pool;
+  int fd;
+  if (shm_segment_owner_alive (name, offsetof (struct shm_pool, owner)))
+  {
+    errno = EADDRINUSE;
+    return NULL;
+  }
+  (void) shm_unlink (name);
+  if ((fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0)
+    return NULL;
+  /* the file is sparse, so only chunks that actually get used cost memory */
+  *mapsize = sizeof (*pool) + nchunks * shm_pool_chunk_stride (chunksize);
+  if (ftruncate (fd, (off_t) *mapsize) < 0)
+  {
+    close (fd);
+    (void) shm_unlink (name);
+    return NULL;
+  }
+  pool = mmap (NULL, *mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+  if (pool == MAP_FAILED)
+  {
+    (void) shm_unlink (name);
+    return NULL;
+  }
+  pool->pool_id = ddsrt_random ();
+  pool->nchunks = nchunks;
+  pool->chunksize = chunksize;
+  pool->owner = self;
+  for (uint32_t i = 0; i < nchunks; i++)
+  {
+    struct shm_chunkhdr *c = shm_pool_chunk (pool, i);
+    ddsrt_atomic_st32 (&c->refc, 0);
+    c->gen = 0;
+    c->index = i;
+  }
+  ddsrt_atomic_fence ();
+  pool->magic = SHM_POOL_MAGIC;
+  return pool;
+}
+
+static bool shm_ring_lock (struct shm_ring *ring, uint32_t self)
+{
+  ddsrt_mtime_t tcheck = { 0 }, tlimit = { 0 };
+  uint32_t spins = 0, holder;
+  while ((holder = ddsrt_atomic_ld32 (&ring->lock)) != 0 || !ddsrt_atomic_cas32 (&ring->lock, 0, self))
+  {
+    if (++spins < 100)
+      continue;
+    const ddsrt_mtime_t tnow = ddsrt_time_monotonic ();
+    if (tlimit.v == 0)
+    {
+      tcheck = ddsrt_mtime_add_duration (tnow, SHM_LOCK_CHECK_INTERVAL);
+      tlimit = ddsrt_mtime_add_duration (tnow, SHM_LOCK_TIMEOUT);
+    }
+    else if (holder != 0 && tnow.v >= tcheck.v)
+    {
+      if (!shm_pid_alive (holder) && ddsrt_atomic_cas32 (&ring->lock, holder, self))
+        break;
+      tcheck = ddsrt_mtime_add_duration (tnow, SHM_LOCK_CHECK_INTERVAL);
+    }
+    if (tnow.v > tlimit.v)
+      return false;
+    sched_yield ();
+  }
+  ddsrt_atomic_fence_acq ();
+  return true;
+}
+
+static void shm_ring_unlock (struct shm_ring *ring)
+{
+  ddsrt_atomic_fence_rel ();
+  ddsrt_atomic_st32 (&ring->lock, 0);
+}
+
+static ssize_t shm_ring_put (struct shm_ring *ring, uint32_t self, uint32_t srcport, size_t niov, const ddsrt_iovec_t *iov)
+{
+  const uint64_t mask = ring->size - 1;
+  size_t len = 0;
+  for (size_t i = 0; i < niov; i++)
+    len += (size_t) iov[i].iov_len;
+  const uint64_t need = sizeof (struct shm_msghdr) + shm_align8 (len);
+  if (need > ring->size / 2 || ddsrt_atomic_ld32 (&ring->closed))
+    return -1;
+  if (!shm_ring_lock (ring, self))
+    return -1;
+
+  uint64_t head = ddsrt_atomic_ld64 (&ring->head);
+  const uint64_t tail = ddsrt_atomic_ld64 (&ring->tail);
+  uint64_t off = head & mask;
+  const uint64_t skip = (ring->size - off < need) ? ring->size - off : 0;
+  if (head + skip + need - tail > ring->size)
+  {
+    shm_ring_unlock (ring);
+    return -1;
+  }
+  if (skip)
+  {
+    struct shm_msghdr *wrap = (struct shm_msghdr *) (ring->data + off);
+    wrap->len = SHM_WRAP;
+    head += skip;
+    off = 0;
+  }
+  struct shm_msghdr *hdr = (struct shm_msghdr *) (ring->data + off);
+  unsigned char *dst = (unsigned char *) (hdr + 1);
+  hdr->len = (uint32_t) len;
+  hdr->srcport = srcport;
+  for (size_t i = 0; i < niov; i++)
+  {
+    memcpy (dst, iov[i].iov_base, (size_t) iov[i].iov_len);
+    dst += iov[i].iov_len;
+  }
+  ddsrt_atomic_fence_rel ();
+  ddsrt_atomic_st64 (&ring->head, head + need);
+  shm_ring_unlock (ring);
+
+  ddsrt_atomic_inc32 (&ring->wakeup);
+  if (ddsrt_atomic_ld32 (&ring->waiting))
+    shm_futex_wake (&ring->wakeup);
+  return (ssize_t) len;
+}
+
+static char *ddsi_shm_to_string (char *dst, size_t sizeof_dst, const nn_locator_t *loc, int with_port)
+{
+  const unsigned char * const x = loc->address;
+  if (with_port)
+    (void) snprintf (dst, sizeof_dst, "[%02x%02x%02x%02x%02x%02x%02x%02x]:%"PRIu32, x[0], x[1], x[2], x[3], x[4], x[5], x[6], x[7], loc->port);
+  else
+    (void) snprintf (dst, sizeof_dst, "[%02x%02x%02x%02x%02x%02x%02x%02x]", x[0], x[1], x[2], x[3], x[4], x[5], x[6], x[7]);
+  return dst;
+}
+
+static ssize_t ddsi_shm_conn_read (ddsi_tran_conn_t conn, unsigned char * buf, size_t len, bool allow_spurious, nn_locator_t *srcloc)
+{
+  ddsi_shm_conn_t uc = (ddsi_shm_conn_t) conn;
+  const ddsi_shm_tran_factory_t fact = (ddsi_shm_tran_factory_t) conn->m_factory;
+  struct shm_ring * const ring = uc->m_ring;
+  const uint64_t mask = ring->size - 1;
+  bool waited = false;
+  for (;;)
+  {
+    const uint64_t tail = ddsrt_atomic_ld64 (&ring->tail);
+    const uint64_t head = ddsrt_atomic_ld64 (&ring->head);
+    if (tail != head)
+    {
+      ddsrt_atomic_fence_acq ();
+      const uint64_t off = tail & mask;
+      const struct shm_msghdr *hdr = (const struct shm_msghdr *) (ring->data + off);
+      const uint32_t hdrlen = hdr->len;
+      const uint64_t need = (hdrlen == SHM_WRAP) ? ring->size - off : sizeof (*hdr) + shm_align8 (hdrlen);
+      if (need > head - tail || need > ring->size - off)
+      {
+        DDS_CWARNING (&conn->m_base.gv->logconfig, "shm ring corrupt: message of %"PRIu32" bytes at offset %"PRIu64" exceeds the available data, discarding ring contents\n", hdrlen, off);
+        ddsrt_atomic_st64 (&ring->tail, head);
+        continue;
+      }
+      if (hdrlen == SHM_WRAP)
+      {
+        ddsrt_atomic_st64 (&ring->tail, tail + need);
+        continue;
+      }
+      const size_t msglen = hdrlen;
+      const size_t n = (msglen < len) ? msglen : len;
+      memcpy (buf, hdr + 1, n);
+      if (srcloc)
+      {
+        srcloc->tran = conn->m_factory;
+        srcloc->kind = NN_LOCATOR_KIND_SHM;
+        srcloc->port = hdr->srcport;
+        memcpy (srcloc->address, fact->hostid, sizeof (srcloc->address));
+      }
+      ddsrt_atomic_fence_rel ();
+      ddsrt_atomic_st64 (&ring->tail, tail + need);
+      if (msglen > len)
+        DDS_CWARNING (&conn->m_base.gv->logconfig, "shm message of %d bytes truncated to %d\n", (int) msglen, (int) len);
+      return (ssize_t) n;
+    }
+    else if (waited && allow_spurious)
+    {
+      return 0;
+    }
+
+    /* Announce intent to sleep before sampling the futex word, a producer
+       increments the futex word after publishing and then checks "waiting" */
+    ddsrt_atomic_st32 (&ring->waiting, 1);
+    ddsrt_atomic_fence ();
+    const uint32_t w = ddsrt_atomic_ld32 (&ring->wakeup);
+    if (ddsrt_atomic_ld64 (&ring->head) == tail)
+      shm_futex_wait (&ring->wakeup, w);
+    ddsrt_atomic_st32 (&ring->waiting, 0);
+    waited = true;
+  }
+}
+
+static void shm_retire_pool (ddsi_shm_conn_t uc, struct shm_pool *pool, size_t mapsize)
+{
+  struct shm_mapping *m = ddsrt_malloc (sizeof (*m));
+  m->addr = pool;
+  m->size = mapsize;
+  m->next = uc->m_stale_pools;
+  uc->m_stale_pools = m;
+}
+
+static struct shm_peer *shm_lookup_peer (ddsi_shm_conn_t uc, uint32_t port)
+{
+  struct shm_peer *peer;
+  ddsrt_avl_ipath_t path;
+  assert (port != uc->m_base.m_base.m_port);
+  if ((peer = ddsrt_avl_lookup_ipath (&shm_peers_treedef, &uc->m_peers, &port, &path)) != NULL)
+  {
+    if (!ddsrt_atomic_ld32 (&peer->ring->closed))
+      return peer;
+    /* owner went away, a new one may have taken its place */
+    ddsrt_avl_delete (&shm_peers_treedef, &uc->m_peers, peer);
+    munmap (peer->ring, peer->mapsize);
+    if (peer->pool)
+      shm_retire_pool (uc, peer->pool, peer->pool_mapsize);
+    ddsrt_free (peer);
+    (void) ddsrt_avl_lookup_ipath (&shm_peers_treedef, &uc->m_peers, &port, &path);
+  }
+  char name[SHM_NAME_SIZE];
+  struct shm_ring *ring;
+  size_t mapsize;
+  shm_ring_name (name, sizeof (name), shm_hostid (uc), port);
+  if ((ring = shm_ring_map (name, O_RDWR, &mapsize)) == NULL)
+    return NULL;
+  peer = ddsrt_malloc (sizeof (*peer));
+  peer->port = port;
+  peer->ring = ring;
+  peer->mapsize = mapsize;
+  peer->pool = NULL;
+  peer->pool_mapsize = 0;
+  ddsrt_avl_insert_ipath (&shm_peers_treedef, &uc->m_peers, peer, &path);
+  return peer;
+}
+
+static ssize_t ddsi_shm_conn_write (ddsi_tran_conn_t conn, const nn_locator_t *dst, size_t niov, const ddsrt_iovec_t *iov, uint32_t flags)
+{
+  ddsi_shm_conn_t uc = (ddsi_shm_conn_t) conn;
+  struct shm_peer *peer;
+  ssize_t ret = -1;
+  (void) flags;
+  assert (dst->kind == NN_LOCATOR_KIND_SHM);
+  if (dst->port == uc->m_base.m_base.m_port)
+    return shm_ring_put (uc->m_ring, uc->m_pid, uc->m_base.m_base.m_port, niov, iov);
+  ddsrt_mutex_lock (&uc->m_peers_lock);
+  if ((peer = shm_lookup_peer (uc, dst->port)) != NULL)
+    ret = shm_ring_put (peer->ring, uc->m_pid, uc->m_base.m_base.m_port, niov, iov);
+  ddsrt_mutex_unlock (&uc->m_peers_lock);
+  return ret;
+}
+
+static ddsrt_socket_t ddsi_shm_conn_handle (ddsi_tran_base_t base)
+{
+  (void) base;
+  return DDSRT_INVALID_SOCKET;
+}
+
+static bool ddsi_shm_supports (const struct ddsi_tran_factory *fact, int32_t kind)
+{
+  (void) fact;
+  return (kind == NN_LOCATOR_KIND_SHM);
+}
+
+static int ddsi_shm_conn_locator (ddsi_tran_factory_t fact_cmn, ddsi_tran_base_t base, nn_locator_t *loc)
+{
+  const ddsi_shm_tran_factory_t fact = (ddsi_shm_tran_factory_t) fact_cmn;
+  loc->tran = fact_cmn;
+  loc->kind = NN_LOCATOR_KIND_SHM;
+  loc->port = base->m_port;
+  memcpy (loc->address, fact->hostid, sizeof (loc->address));
+  return 0;
+}
+
+static dds_return_t ddsi_shm_create_conn (ddsi_tran_conn_t *conn_out, ddsi_tran_factory_t fact, uint32_t port, const struct ddsi_tran_qos *qos)
+{
+  struct ddsi_domaingv const * const gv = fact->gv;
+  const ddsi_shm_tran_factory_t shm_fact = (ddsi_shm_tran_factory_t) fact;
+  ddsi_shm_conn_t uc;
+  char name[SHM_NAME_SIZE];
+  uint32_t size = 4096;
+
+  if (qos->m_purpose != DDSI_TRAN_QOS_RECV_UC)
+  {
+    GVERROR ("ddsi_shm_create_conn: only unicast receive connections are supported\n");
+    return DDS_RETCODE_BAD_PARAMETER;
+  }
+  while (size < gv->config.shm_ring_size && size < (UINT32_C (1) << 30))
+    size <<= 1;
+
+  uc = ddsrt_malloc (sizeof (*uc));
+  memset (uc, 0, sizeof (*uc));
+  uc->m_pid = (uint32_t) getpid ();
+  shm_ring_name (name, sizeof (name), shm_fact->hostid, port);
+  if ((uc->m_ring = shm_ring_create (name, size, uc->m_pid, &uc->m_mapsize)) == NULL)
+  {
+    GVERROR ("ddsi_shm_create_conn: failed to create shared memory ring %s: %s\n", name, strerror (errno));
+    ddsrt_free (uc);
+    return DDS_RETCODE_ERROR;
+  }
+  ddsrt_mutex_init (&uc->m_peers_lock);
+  ddsrt_avl_init (&shm_peers_treedef, &uc->m_peers);
+  ddsrt_mutex_init (&uc->m_pool_lock);
+  if (gv->config.shm_chunk_count > 0)
+  {
+    const uint32_t chunksize = (gv->config.shm_chunk_size + 63) & ~(uint32_t) 63;
+    shm_pool_name (name, sizeof (name), shm_fact->hostid, port);
+    if ((uc->m_pool = shm_pool_create (name, gv->config.shm_chunk_count, chunksize, uc->m_pid, &uc->m_pool_mapsize)) == NULL)
+      GVWARNING ("ddsi_shm_create_conn: failed to create shared memory pool %s: %s\n", name, strerror (errno));
+    else
+      GVLOG (DDS_LC_CONFIG, "ddsi_shm_create_conn: pool %s %"PRIu32" chunks of %"PRIu32" bytes\n", name, uc->m_pool->nchunks, uc->m_pool->chunksize);
+    shm_ring_name (name, sizeof (name), shm_fact->hostid, port);
+  }
+
+  ddsi_factory_conn_init (fact, &uc->m_base);
+  uc->m_base.m_base.m_port = port;
+  uc->m_base.m_base.m_trantype = DDSI_TRAN_CONN;
+  uc->m_base.m_base.m_multicast = false;
+  uc->m_base.m_base.m_handle_fn = ddsi_shm_conn_handle;
+  uc->m_base.m_locator_fn = ddsi_shm_conn_locator;
+  uc->m_base.m_read_fn = ddsi_shm_conn_read;
+  uc->m_base.m_write_fn = ddsi_shm_conn_write;
+  uc->m_base.m_disable_multiplexing_fn = 0;
+
+  GVLOG (DDS_LC_CONFIG, "ddsi_shm_create_conn: ring %s size %"PRIu32"\n", name, size);
+  *conn_out = &uc->m_base;
+  return DDS_RETCODE_OK;
+}
+
+static void shm_free_peer (void *vpeer)
+{
+  struct shm_peer *peer = vpeer;
+  munmap (peer->ring, peer->mapsize);
+  if (peer->pool)
+    munmap (peer->pool, peer->pool_mapsize);
+  ddsrt_free (peer);
+}
+
+static void ddsi_shm_close_conn (ddsi_tran_conn_t conn)
+{
+  ddsi_shm_conn_t uc = (ddsi_shm_conn_t) conn;
+  char name[SHM_NAME_SIZE];
+  shm_ring_name (name, sizeof (name), shm_hostid (uc), uc->m_base.m_base.m_port);
+  ddsrt_atomic_st32 (&uc->m_ring->closed, 1);
+  (void) shm_unlink (name);
+  if (uc->m_pool)
+  {
+    shm_pool_name (name, sizeof (name), shm_hostid (uc), uc->m_base.m_base.m_port);
+    (void) shm_unlink (name);
+  }
+}
+
+static void ddsi_shm_release_conn (ddsi_tran_conn_t conn)
+{
+  ddsi_shm_conn_t uc = (ddsi_shm_conn_t) conn;
+  DDS_CTRACE (&conn->m_base.gv->logconfig, "ddsi_shm_release_conn port %"PRIu32"\n", uc->m_base.m_base.m_port);
+  ddsrt_avl_free (&shm_peers_treedef, &uc->m_peers, shm_free_peer);
+  while (uc->m_stale_pools)
+  {
+    struct shm_mapping *m = uc->m_stale_pools;
+    uc->m_stale_pools = m->next;
+    munmap (m->addr, m->size);
+    ddsrt_free (m);
+  }
+  ddsrt_mutex_destroy (&uc->m_peers_lock);
+  ddsrt_mutex_destroy (&uc->m_pool_lock);
+  munmap (uc->m_ring, uc->m_mapsize);
+  if (uc->m_pool)
+    munmap (uc->m_pool, uc->m_pool_mapsize);
+  ddsrt_free (conn);
+}
+
+static int ddsi_shm_is_mcaddr (const struct ddsi_tran_factory *tran, const nn_locator_t *loc)
+{
+  (void) tran;
+  (void) loc;
+  return 0;
+}
+
+static enum ddsi_nearby_address_result ddsi_shm_is_nearby_address (const nn_locator_t *loc, const nn_locator_t *ownloc, size_t ninterf, const struct nn_interface interf[])
+{
+  (void) ninterf;
+  (void) interf;
+  return (memcmp (loc->address, ownloc->address, sizeof (loc->address)) == 0) ? DNAR_SAME : DNAR_DISTANT;
+}
+
+static enum ddsi_locator_from_string_result ddsi_shm_address_from_string (const struct ddsi_tran_factory *tran, nn_locator_t *loc, const char *str)
+{
+  /* shared memory locators are only ever learnt through discovery */
+  (void) tran;
+  (void) loc;
+  (void) str;
+  return AFSR_INVALID;
+}
+
+static int ddsi_shm_enumerate_interfaces (ddsi_tran_factory_t fact, enum transport_selector transport_selector, ddsrt_ifaddrs_t **ifs)
+{
+  (void) fact;
+  (void) transport_selector;
+  *ifs = NULL;
+  return 0;
+}
+
+static int ddsi_shm_is_valid_port (const struct ddsi_tran_factory *fact, uint32_t port)
+{
+  (void) fact;
+  return (port >= 1 && port <= 65535);
+}
+
+static uint32_t ddsi_shm_receive_buffer_size (const struct ddsi_tran_factory *fact)
+{
+  return fact->gv->config.shm_ring_size;
+}
+
+static void ddsi_shm_deinit (ddsi_tran_factory_t fact)
+{
+  DDS_CLOG (DDS_LC_CONFIG, &fact->gv->logconfig, "shm de-initialized\n");
+  ddsrt_free (fact);
+}
+
+static void ddsi_shm_compute_hostid (unsigned char hostid[16], int32_t kind)
+{
+  /* Hostname plus boot id: different hosts (or containers with their own
+     UTS namespace) end up with different ids, and so do successive boots.
+     The network namespace and the transport kind are included because the
+     ring names are based on the port numbers, which are unique only for a
+     given combination of those */
+  ddsrt_md5_state_t md5st;
+  char buf[256];
+  ssize_t n;
+  FILE *fp;
+  ddsrt_md5_init (&md5st);
+  ddsrt_md5_append (&md5st, (const ddsrt_md5_byte_t *) &kind, (unsigned) sizeof (kind));
+  if ((n = readlink ("/proc/self/ns/net", buf, sizeof (buf))) > 0)
+    ddsrt_md5_append (&md5st, (const ddsrt_md5_byte_t *) buf, (unsigned) n);
+  if (gethostname (buf, sizeof (buf)) == 0)
+  {
+    buf[sizeof (buf) - 1] = 0;
+    ddsrt_md5_append (&md5st, (const ddsrt_md5_byte_t *) buf, (unsigned) strlen (buf));
+  }
+  if ((fp = fopen ("/proc/sys/kernel/random/boot_id", "r")) != NULL)
+  {
+    size_t nread = fread (buf, 1, sizeof (buf), fp);
+    ddsrt_md5_append (&md5st, (const ddsrt_md5_byte_t *) buf, (unsigned) nread);
+    fclose (fp);
+  }
+  ddsrt_md5_finish (&md5st, (ddsrt_md5_byte_t *) hostid);
+}
+
+bool ddsi_shm_locator_reachable (const struct ddsi_domaingv *gv, const nn_locator_t *loc)
+{
+  const ddsi_shm_conn_t uc = (ddsi_shm_conn_t) gv->shm_conn;
+  bool ok;
+  if (loc->kind != NN_LOCATOR_KIND_SHM || uc == NULL)
+    return false;
+  if (memcmp (loc->address, ((ddsi_shm_tran_factory_t) uc->m_base.m_factory)->hostid, sizeof (loc->address)) != 0)
+    return false;
+  if (loc->port == uc->m_base.m_base.m_port)
+    return true;
+  /* Same host id is not quite the same thing as sharing /dev/shm, and the
+     ring may belong to a different user: only if it can actually be mapped
+     is it used, otherwise the caller falls back to the other locators */
+  ddsrt_mutex_lock (&uc->m_peers_lock);
+  ok = (shm_lookup_peer (uc, loc->port) != NULL);
+  ddsrt_mutex_unlock (&uc->m_peers_lock);
+  return ok;
+}
+
+uint32_t ddsi_shm_chunk_size (const struct ddsi_domaingv *gv)
+{
+  const ddsi_shm_conn_t uc = (ddsi_shm_conn_t) gv->shm_conn;
+  return (uc && uc->m_pool) ? uc->m_pool->chunksize : 0;
+}
+
+void *ddsi_shm_chunk_alloc (struct ddsi_domaingv *gv)
+{
+  const ddsi_shm_conn_t uc = (ddsi_shm_conn_t) gv->shm_conn;
+  struct shm_pool *pool;
+  void *payload = NULL;
+  if (uc == NULL || (pool = uc->m_pool) == NULL)
+    return NULL;
+  ddsrt_mutex_lock (&uc->m_pool_lock);
+  for (uint32_t i = 0; i < pool->nchunks && payload == NULL; i++)
+  {
+    const uint32_t idx = (uc->m_pool_cursor + i) % pool->nchunks;
+    struct shm_chunkhdr *c = shm_pool_chunk (pool, idx);
+    if (ddsrt_atomic_ld32 (&c->refc) == 0 && ddsrt_atomic_cas32 (&c->refc, 0, SHM_CHUNK_CLAIMED))
+    {
+      /* The generation must be updated before the chunk can be referenced
+         again: a reader holding a stale descriptor could otherwise take a
+         reference after the claim but before the update, and so accept the
+         new contents as the old sample */
+      c->gen++;
+      ddsrt_atomic_fence_rel ();
+      ddsrt_atomic_st32 (&c->refc, 1);
+      uc->m_pool_cursor = (idx + 1) % pool->nchunks;
+      payload = c + 1;
+    }
+  }
+  ddsrt_mutex_unlock (&uc->m_pool_lock);
+  return payload;
+}
+
+bool ddsi_shm_chunk_is_local (const struct ddsi_domaingv *gv, const void *payload)
+{
+  const ddsi_shm_conn_t uc = (ddsi_shm_conn_t) gv->shm_conn;
+  struct shm_pool *pool;
+  if (uc == NULL || (pool = uc->m_pool) == NULL)
+    return false;
+  const uintptr_t p = (uintptr_t) payload, base = (uintptr_t) pool->chunks;
+  const size_t stride = shm_pool_chunk_stride (pool->chunksize);
+  if (p < base + sizeof (struct shm_chunkhdr) || p >= base + pool->nchunks * stride)
+    return false;
+  if ((p - base) % stride != sizeof (struct shm_chunkhdr))
+    return false;
+  const struct shm_chunkhdr *c = (const struct shm_chunkhdr *) payload - 1;
+  return ddsrt_atomic_ld32 (&c->refc) > 0;
+}
+
+void ddsi_shm_chunk_ref (void *payload)
+{
+  struct shm_chunkhdr *c = (struct shm_chunkhdr *) payload - 1;
+  ddsrt_atomic_inc32 (&c->refc);
+}
+
+void ddsi_shm_chunk_unref (void *payload)
+{
+  struct shm_chunkhdr *c = (struct shm_chunkhdr *) payload - 1;
+  ddsrt_atomic_fence_rel ();
+  ddsrt_atomic_dec32 (&c->refc);
+}
+
+void ddsi_shm_chunk_describe (const struct ddsi_domaingv *gv, const void *payload, uint32_t size, struct ddsi_shm_chunk_desc *desc)
+{
+  const ddsi_shm_conn_t uc = (ddsi_shm_conn_t) gv->shm_conn;
+  const ddsi_shm_tran_factory_t fact = (ddsi_shm_tran_factory_t) uc->m_base.m_factory;
+  const struct shm_chunkhdr *c = (const struct shm_chunkhdr *) payload - 1;
+  assert (ddsi_shm_chunk_is_local (gv, payload));
+  assert (size <= uc->m_pool->chunksize);
+  memcpy (desc->hostid, fact->hostid, sizeof (desc->hostid));
+  desc->port = uc->m_base.m_base.m_port;
+  desc->pool_id = uc->m_pool->pool_id;
+  desc->index = c->index;
+  desc->gen = c->gen;
+  desc->size = size;
+}
+
+static struct shm_pool *shm_lookup_pool (ddsi_shm_conn_t uc, uint32_t port, uint32_t pool_id)
+{
+  struct shm_peer *peer;
+  if (port == uc->m_base.m_base.m_port)
+    return (uc->m_pool && uc->m_pool->pool_id == pool_id) ? uc->m_pool : NULL;
+  if ((peer = shm_lookup_peer (uc, port)) == NULL)
+    return NULL;
+  if (peer->pool == NULL || peer->pool->pool_id != pool_id)
+  {
+    char name[SHM_NAME_SIZE];
+    struct shm_pool *pool;
+    size_t mapsize;
+    shm_pool_name (name, sizeof (name), shm_hostid (uc), port);
+    if ((pool = shm_pool_map (name, &mapsize)) == NULL)
+      return NULL;
+    if (peer->pool)
+      shm_retire_pool (uc, peer->pool, peer->pool_mapsize);
+    peer->pool = pool;
+    peer->pool_mapsize = mapsize;
+  }
+  return (peer->pool->pool_id == pool_id) ? peer->pool : NULL;
+}
+
+void *ddsi_shm_chunk_resolve (struct ddsi_domaingv *gv, const struct ddsi_shm_chunk_desc *desc)
+{
+  const ddsi_shm_conn_t uc = (ddsi_shm_conn_t) gv->shm_conn;
+  struct shm_pool *pool;
+  struct shm_chunkhdr *c = NULL;
+  if (uc == NULL || memcmp (desc->hostid, ((ddsi_shm_tran_factory_t) uc->m_base.m_factory)->hostid, sizeof (desc->hostid)) != 0)
+    return NULL;
+  ddsrt_mutex_lock (&uc->m_peers_lock);
+  if ((pool = shm_lookup_pool (uc, desc->port, desc->pool_id)) != NULL && desc->index < pool->nchunks && desc->size <= pool->chunksize)
+    c = shm_pool_chunk (pool, desc->index);
+  ddsrt_mutex_unlock (&uc->m_peers_lock);
+  if (c == NULL)
+    return NULL;
+
+  /* Only take a reference if the chunk is still in use: if it was freed, the
+     owner may be filling it with new data */
+  uint32_t refc;
+  do {
+    if ((refc = ddsrt_atomic_ld32 (&c->refc)) == 0 || (refc & SHM_CHUNK_CLAIMED))
+      return NULL;
+  } while (!ddsrt_atomic_cas32 (&c->refc, refc, refc + 1));
+  ddsrt_atomic_fence_acq ();
+  if (c->gen != desc->gen)
+  {
+    ddsi_shm_chunk_unref (c + 1);
+    return NULL;
+  }
+  return c + 1;
+}
+
+int ddsi_shm_init (struct ddsi_domaingv *gv)
+{
+  struct ddsi_shm_tran_factory *fact;
+  if (!gv->config.shm_enable)
+    return 0;
+  fact = ddsrt_malloc (sizeof (*fact));
+  memset (fact, 0, sizeof (*fact));
+  fact->fact.gv = gv;
+  fact->fact.m_free_fn = ddsi_shm_deinit;
+  fact->fact.m_kind = NN_LOCATOR_KIND_SHM;
+  fact->fact.m_typename = "shm";
+  fact->fact.m_default_spdp_address = NULL;
+  fact->fact.m_connless = true;
+  fact->fact.m_supports_fn = ddsi_shm_supports;
+  fact->fact.m_create_conn_fn = ddsi_shm_create_conn;
+  fact->fact.m_close_conn_fn = ddsi_shm_close_conn;
+  fact->fact.m_release_conn_fn = ddsi_shm_release_conn;
+  fact->fact.m_is_mcaddr_fn = ddsi_shm_is_mcaddr;
+  fact->fact.m_is_nearby_address_fn = ddsi_shm_is_nearby_address;
+  fact->fact.m_locator_from_string_fn = ddsi_shm_address_from_string;
+  fact->fact.m_locator_to_string_fn = ddsi_shm_to_string;
+  fact->fact.m_enumerate_interfaces_fn = ddsi_shm_enumerate_interfaces;
+  fact->fact.m_is_valid_port_fn = ddsi_shm_is_valid_port;
+  fact->fact.m_receive_buffer_size_fn = ddsi_shm_receive_buffer_size;
+  ddsi_shm_compute_hostid (fact->hostid, gv->m_factory->m_kind);
+  ddsi_factory_add (gv, &fact->fact);
+  GVLOG (DDS_LC_CONFIG, "shm initialized\n");
+  return 0;
+}
+
+#else
+
+int ddsi_shm_init (struct ddsi_domaingv *gv) { (void) gv; return 0; }
+bool ddsi_shm_locator_reachable (const struct ddsi_domaingv *gv, const nn_locator_t *loc) { (void) gv; (void) loc; return false; }
+uint32_t ddsi_shm_chunk_size (const struct ddsi_domaingv *gv) { (void) gv; return 0; }
+void *ddsi_shm_chunk_alloc (struct ddsi_domaingv *gv) { (void) gv; return NULL; }
+bool ddsi_shm_chunk_is_local (const struct ddsi_domaingv *gv, const void *payload) { (void) gv; (void) payload; return false; }
+void ddsi_shm_chunk_ref (void *payload) { (void) payload; }
+void ddsi_shm_chunk_unref (void *payload) { (void) payload; }
+void ddsi_shm_chunk_describe (const struct ddsi_domaingv *gv, const void *payload, uint32_t size, struct ddsi_shm_chunk_desc *desc) { (void) gv; (void) payload; (void) size; (void) desc; }
+void *ddsi_shm_chunk_resolve (struct ddsi_domaingv *gv, const struct ddsi_shm_chunk_desc *desc) { (void) gv; (void) desc; return NULL; }
+
+#endif
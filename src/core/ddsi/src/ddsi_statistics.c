@@ -17,13 +17,28 @@
 #include "dds/ddsi/q_entity.h"
 #include "dds/ddsi/q_radmin.h"
 
-void ddsi_get_writer_stats (struct writer *wr, uint64_t * __restrict rexmit_bytes, uint32_t * __restrict throttle_count, uint64_t * __restrict time_throttled, uint64_t * __restrict time_retransmit)
+void ddsi_get_writer_stats (struct writer *wr, uint64_t * __restrict rexmit_bytes, uint32_t * __restrict throttle_count, uint64_t * __restrict time_throttled, uint64_t * __restrict time_retransmit, uint64_t * __restrict cc_rate, uint64_t * __restrict cc_rtt, uint32_t * __restrict cc_loss, uint32_t * __restrict heartbeats_sent, uint32_t * __restrict acknacks_received, uint64_t * __restrict filtered_count)
 {
   ddsrt_mutex_lock (&wr->e.lock);
   *rexmit_bytes = wr->rexmit_bytes;
   *throttle_count = wr->throttle_count;
   *time_throttled = wr->time_throttled;
   *time_retransmit = wr->time_retransmit;
+  if (wr->congestion_control)
+  {
+    *cc_rate = wr->cc.rate;
+    *cc_rtt = (uint64_t) wr->cc.srtt;
+    *cc_loss = wr->cc.loss;
+  }
+  else
+  {
+    *cc_rate = 0;
+    *cc_rtt = 0;
+    *cc_loss = 0;
+  }
+  *heartbeats_sent = wr->num_heartbeats_sent;
+  *acknacks_received = wr->num_acks_received;
+  *filtered_count = wr->filtered_count;
   ddsrt_mutex_unlock (&wr->e.lock);
 }
 
@@ -63,3 +78,20 @@ void ddsi_get_reader_stats (struct reader *rd, uint64_t * __restrict discarded_b
   }
   ddsrt_mutex_unlock (&rd->e.lock);
 }
+
+void ddsi_get_rbuf_stats (struct ddsi_domaingv *gv, uint32_t * __restrict rbuf_count, uint64_t * __restrict rbuf_bytes, uint64_t * __restrict retained_bytes)
+{
+  *rbuf_count = 0;
+  *rbuf_bytes = 0;
+  *retained_bytes = 0;
+  for (uint32_t i = 0; i < gv->n_recv_threads; i++)
+  {
+    uint32_t n, size, retained;
+    if (gv->recv_threads[i].arg.rbpool == NULL)
+      continue;
+    nn_rbufpool_stats (gv->recv_threads[i].arg.rbpool, &n, &size, &retained);
+    *rbuf_count += n;
+    *rbuf_bytes += (uint64_t) n * size;
+    *retained_bytes += retained;
+  }
+}
@@ -37,6 +37,7 @@ extern inline int ddsi_listener_listen (ddsi_tran_listener_t listener);
 extern inline ddsi_tran_conn_t ddsi_listener_accept (ddsi_tran_listener_t listener);
 extern inline ssize_t ddsi_conn_read (ddsi_tran_conn_t conn, unsigned char * buf, size_t len, bool allow_spurious, nn_locator_t *srcloc);
 extern inline ssize_t ddsi_conn_write (ddsi_tran_conn_t conn, const nn_locator_t *dst, size_t niov, const ddsrt_iovec_t *iov, uint32_t flags);
+extern inline ssize_t ddsi_conn_write_multi (ddsi_tran_conn_t conn, size_t ndst, const nn_locator_t * const *dst, size_t niov, const ddsrt_iovec_t *iov, uint32_t flags);
 
 void ddsi_factory_add (struct ddsi_domaingv *gv, ddsi_tran_factory_t factory)
 {
@@ -146,10 +147,7 @@ void ddsi_conn_free (ddsi_tran_conn_t conn)
         (conn->m_factory->m_close_conn_fn) (conn);
       }
     }
-    if (ddsrt_atomic_dec32_ov (&conn->m_count) == 1)
-    {
-      (conn->m_factory->m_release_conn_fn) (conn);
-    }
+    ddsi_conn_unref (conn);
   }
 }
 
@@ -158,6 +156,14 @@ void ddsi_conn_add_ref (ddsi_tran_conn_t conn)
   ddsrt_atomic_inc32 (&conn->m_count);
 }
 
+void ddsi_conn_unref (ddsi_tran_conn_t conn)
+{
+  if (ddsrt_atomic_dec32_ov (&conn->m_count) == 1)
+  {
+    (conn->m_factory->m_release_conn_fn) (conn);
+  }
+}
+
 void ddsi_factory_conn_init (const struct ddsi_tran_factory *factory, ddsi_tran_conn_t conn)
 {
   ddsrt_atomic_st32 (&conn->m_count, 1);
@@ -165,6 +171,7 @@ void ddsi_factory_conn_init (const struct ddsi_tran_factory *factory, ddsi_tran_
   conn->m_stream = factory->m_stream;
   conn->m_factory = (struct ddsi_tran_factory *) factory;
   conn->m_base.gv = factory->gv;
+  conn->m_write_multi_fn = 0;
 }
 
 void ddsi_conn_disable_multiplexing (ddsi_tran_conn_t conn)
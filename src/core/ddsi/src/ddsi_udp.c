@@ -17,7 +17,10 @@
 #include "dds/ddsrt/misc.h"
 #include "dds/ddsrt/sockets.h"
 #include "dds/ddsrt/string.h"
+#include "dds/ddsrt/sync.h"
+#include "dds/ddsrt/time.h"
 #include "ddsi_eth.h"
+#include "ddsi_uring.h"
 #include "dds/ddsi/ddsi_tran.h"
 #include "dds/ddsi/ddsi_udp.h"
 #include "dds/ddsi/ddsi_ipaddr.h"
@@ -36,6 +39,36 @@ union addr {
 #endif
 };
 
+#if DDSI_HAVE_IO_URING
+#include <errno.h>
+
+/* Sending a packet to multiple destinations queues a sendmsg request for each
+   of them, these are submitted in batches of at most this many */
+#define UDP_URING_TX_BATCH 32u
+
+/* User data of the request cancelling pending transmit requests, distinct
+   from the indices in the batch used for the transmit requests themselves */
+#define UDP_URING_TX_CANCEL UINT64_MAX
+
+/* Multishot receive needs buffers large enough for the largest datagram; the
+   buffers are mapped on demand, so the memory is only committed once used */
+#define UDP_URING_RX_NBUFS 32u
+#define UDP_URING_RX_BUFSIZE ((uint32_t) (sizeof (struct io_uring_recvmsg_out) + sizeof (union addr) + 65536))
+
+struct ddsi_udp_uring_tx {
+  struct ddsi_uring ring;
+  union addr dstaddr[UDP_URING_TX_BATCH];
+  ddsrt_msghdr_t msg[UDP_URING_TX_BATCH];
+};
+
+struct ddsi_udp_uring_rx {
+  struct ddsi_uring ring;
+  struct ddsi_uring_bufring bufs;
+  ddsrt_msghdr_t msghdr;
+  bool armed;
+};
+#endif
+
 typedef struct ddsi_udp_conn {
   struct ddsi_tran_conn m_base;
   ddsrt_socket_t m_sock;
@@ -43,6 +76,14 @@ typedef struct ddsi_udp_conn {
   WSAEVENT m_sockEvent;
 #endif
   int m_diffserv;
+#if DDSI_HAVE_IO_URING
+  /* transmit ring is created on first use and shared by all writing threads,
+     the receive ring only exists if a dedicated thread reads from the socket */
+  ddsrt_mutex_t m_uring_tx_lock;
+  struct ddsi_udp_uring_tx *m_uring_tx;
+  bool m_uring_tx_failed;
+  struct ddsi_udp_uring_rx *m_uring_rx;
+#endif
 } *ddsi_udp_conn_t;
 
 typedef struct ddsi_udp_tran_factory {
@@ -58,6 +99,129 @@ static void addr_to_loc (const struct ddsi_tran_factory *tran, nn_locator_t *dst
   ddsi_ipaddr_to_loc (tran, dst, &src->a, (src->a.sa_family == AF_INET) ? NN_LOCATOR_KIND_UDPv4 : NN_LOCATOR_KIND_UDPv6);
 }
 
+#if DDSI_HAVE_IO_URING
+static void udp_uring_rx_free (struct ddsi_udp_uring_rx *rx)
+{
+  ddsi_uring_bufring_fini (&rx->ring, &rx->bufs);
+  ddsi_uring_fini (&rx->ring);
+  ddsrt_free (rx);
+}
+
+static struct ddsi_udp_uring_rx *udp_uring_rx_new (ddsi_udp_conn_t conn)
+{
+  struct ddsi_domaingv * const gv = conn->m_base.m_base.gv;
+  struct ddsi_udp_uring_rx *rx = ddsrt_malloc (sizeof (*rx));
+  if (ddsi_uring_init (&rx->ring, 4) != DDS_RETCODE_OK)
+    goto err_ring;
+  if (ddsi_uring_bufring_init (&rx->ring, &rx->bufs, 0, UDP_URING_RX_NBUFS, UDP_URING_RX_BUFSIZE) != DDS_RETCODE_OK)
+    goto err_bufring;
+  /* for multishot receive, the message header only specifies how much space
+     to reserve for the source address in each buffer */
+  memset (&rx->msghdr, 0, sizeof (rx->msghdr));
+  rx->msghdr.msg_namelen = (socklen_t) sizeof (union addr);
+  rx->armed = false;
+  GVLOG (DDS_LC_CONFIG, "ddsi_udp: socket %"PRIdSOCK" receives via io_uring\n", conn->m_sock);
+  return rx;
+
+err_bufring:
+  ddsi_uring_fini (&rx->ring);
+err_ring:
+  GVLOG (DDS_LC_CONFIG, "ddsi_udp: io_uring multishot receive not available, socket %"PRIdSOCK" uses recvmsg\n", conn->m_sock);
+  ddsrt_free (rx);
+  return NULL;
+}
+
+static ssize_t ddsi_udp_conn_read_uring (ddsi_udp_conn_t conn, unsigned char *buf, size_t len, nn_locator_t *srcloc, bool *unsupported)
+{
+  struct ddsi_domaingv * const gv = conn->m_base.m_base.gv;
+  struct ddsi_udp_uring_rx * const rx = conn->m_uring_rx;
+  struct io_uring_cqe *cqe;
+  int rc;
+  *unsupported = false;
+  while (1)
+  {
+    if (!rx->armed)
+    {
+      /* at most one request is ever outstanding, so there is always space */
+      struct io_uring_sqe *sqe = ddsi_uring_get_sqe (&rx->ring);
+      assert (sqe != NULL);
+      sqe->opcode = IORING_OP_RECVMSG;
+      sqe->fd = conn->m_sock;
+      sqe->addr = (uint64_t) (uintptr_t) &rx->msghdr;
+      sqe->len = 1;
+      sqe->ioprio = IORING_RECV_MULTISHOT;
+      sqe->flags = IOSQE_BUFFER_SELECT;
+      sqe->buf_group = rx->bufs.bgid;
+      rx->armed = true;
+    }
+    if ((cqe = ddsi_uring_peek_cqe (&rx->ring)) == NULL)
+    {
+      if ((rc = ddsi_uring_submit_and_wait (&rx->ring, 1)) < 0)
+      {
+        GVERROR ("ddsi_udp_conn_read: io_uring_enter sock %d failed: %d\n", (int) conn->m_sock, rc);
+        return -1;
+      }
+      continue;
+    }
+
+    const int32_t res = cqe->res;
+    const uint32_t flags = cqe->flags;
+    ddsi_uring_cqe_seen (&rx->ring);
+    if (!(flags & IORING_CQE_F_MORE))
+      rx->armed = false;
+    if (res == -ENOBUFS)
+    {
+      /* all buffers were in use, the request gets rearmed now some have been returned */
+      continue;
+    }
+    else if (res == -EINVAL || res == -EOPNOTSUPP)
+    {
+      /* kernel supports io_uring but not multishot recvmsg */
+      *unsupported = true;
+      return 0;
+    }
+    else if (res < 0)
+    {
+      if (res != -ECONNREFUSED && res != -EHOSTUNREACH && res != -ENETUNREACH)
+      {
+        GVERROR ("UDP io_uring recvmsg sock %d: ret %d\n", (int) conn->m_sock, (int) res);
+        return -1;
+      }
+      return 0;
+    }
+    else if (!(flags & IORING_CQE_F_BUFFER))
+    {
+      continue;
+    }
+
+    const uint16_t bid = (uint16_t) (flags >> IORING_CQE_BUFFER_SHIFT);
+    const unsigned char *rbuf = ddsi_uring_bufring_get (&rx->bufs, bid);
+    struct io_uring_recvmsg_out out;
+    union addr src;
+    memcpy (&out, rbuf, sizeof (out));
+    memset (&src, 0, sizeof (src));
+    memcpy (&src, rbuf + sizeof (out), out.namelen < sizeof (src) ? out.namelen : sizeof (src));
+    const size_t hdrsize = sizeof (out) + rx->msghdr.msg_namelen + rx->msghdr.msg_controllen;
+    const size_t avail = ((size_t) res > hdrsize) ? (size_t) res - hdrsize : 0;
+    const size_t sz = (avail < len) ? avail : len;
+    memcpy (buf, rbuf + hdrsize, sz);
+    ddsi_uring_bufring_recycle (&rx->bufs, bid);
+
+    if (srcloc)
+      addr_to_loc (conn->m_base.m_factory, srcloc, &src);
+    if (out.payloadlen > sz || (out.flags & MSG_TRUNC))
+    {
+      char addrbuf[DDSI_LOCSTRLEN];
+      nn_locator_t tmp;
+      addr_to_loc (conn->m_base.m_factory, &tmp, &src);
+      ddsi_locator_to_string (addrbuf, sizeof (addrbuf), &tmp);
+      GVWARNING ("%s => %d truncated to %d\n", addrbuf, (int) out.payloadlen, (int) sz);
+    }
+    return (ssize_t) sz;
+  }
+}
+#endif
+
 static ssize_t ddsi_udp_conn_read (ddsi_tran_conn_t conn_cmn, unsigned char * buf, size_t len, bool allow_spurious, nn_locator_t *srcloc)
 {
   ddsi_udp_conn_t conn = (ddsi_udp_conn_t) conn_cmn;
@@ -70,6 +234,18 @@ static ssize_t ddsi_udp_conn_read (ddsi_tran_conn_t conn_cmn, unsigned char * bu
   socklen_t srclen = (socklen_t) sizeof (src);
   (void) allow_spurious;
 
+#if DDSI_HAVE_IO_URING
+  if (conn->m_uring_rx)
+  {
+    bool unsupported;
+    if ((ret = ddsi_udp_conn_read_uring (conn, buf, len, srcloc, &unsupported)) != 0 || !unsupported)
+      return ret;
+    GVLOG (DDS_LC_CONFIG, "ddsi_udp: io_uring multishot receive not supported, socket %"PRIdSOCK" reverts to recvmsg\n", conn->m_sock);
+    udp_uring_rx_free (conn->m_uring_rx);
+    conn->m_uring_rx = NULL;
+  }
+#endif
+
   msg_iov.iov_base = (void *) buf;
   msg_iov.iov_len = (ddsrt_iov_len_t) len; /* Windows uses unsigned, POSIX (except Linux) int */
 
@@ -189,15 +365,183 @@ static ssize_t ddsi_udp_conn_write (ddsi_tran_conn_t conn_cmn, const nn_locator_
   return (rc == DDS_RETCODE_OK) ? ret : -1;
 }
 
+#if DDSI_HAVE_IO_URING
+static ssize_t ddsi_udp_conn_write_multi_sync (ddsi_tran_conn_t conn_cmn, size_t ndst, const nn_locator_t * const *dst, size_t niov, const ddsrt_iovec_t *iov, uint32_t flags)
+{
+  ssize_t ret = -1;
+  for (size_t i = 0; i < ndst; i++)
+  {
+    const ssize_t n = ddsi_udp_conn_write (conn_cmn, dst[i], niov, iov, flags);
+    if (n > 0)
+      ret = (ret < 0) ? n : ret + n;
+  }
+  return ret;
+}
+
+static struct ddsi_udp_uring_tx *udp_uring_tx (ddsi_udp_conn_t conn)
+{
+  struct ddsi_domaingv * const gv = conn->m_base.m_base.gv;
+  if (conn->m_uring_tx == NULL && !conn->m_uring_tx_failed)
+  {
+    struct ddsi_udp_uring_tx *tx = ddsrt_malloc (sizeof (*tx));
+    if (ddsi_uring_init (&tx->ring, UDP_URING_TX_BATCH) == DDS_RETCODE_OK)
+    {
+      GVLOG (DDS_LC_CONFIG, "ddsi_udp: socket %"PRIdSOCK" transmits via io_uring\n", conn->m_sock);
+      conn->m_uring_tx = tx;
+    }
+    else
+    {
+      GVLOG (DDS_LC_CONFIG, "ddsi_udp: io_uring not available, socket %"PRIdSOCK" uses sendmsg\n", conn->m_sock);
+      conn->m_uring_tx_failed = true;
+      ddsrt_free (tx);
+    }
+  }
+  return conn->m_uring_tx_failed ? NULL : conn->m_uring_tx;
+}
+
+static void udp_uring_tx_cancel (ddsi_udp_conn_t conn, struct ddsi_udp_uring_tx *tx)
+{
+  /* Cancels whatever requests are still pending; the completions of the
+     cancelled requests report ECANCELED */
+  struct io_uring_sqe *sqe;
+  if ((sqe = ddsi_uring_get_sqe (&tx->ring)) == NULL)
+    return;
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = conn->m_sock;
+  sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+  sqe->user_data = UDP_URING_TX_CANCEL;
+  if (ddsi_uring_submit_and_wait (&tx->ring, 0) < 0)
+    (void) ddsi_uring_unsubmit (&tx->ring);
+}
+
+static void udp_uring_tx_reap (ddsi_udp_conn_t conn, struct ddsi_udp_uring_tx *tx, uint32_t n, bool *retry, ssize_t *ret)
+{
+  /* The requests reference the messages and addresses in "tx" as well as the
+     caller's data, so all of them must have completed before returning, even
+     if waiting for them fails */
+  struct ddsi_domaingv * const gv = conn->m_base.m_base.gv;
+  bool cancelled = false;
+  uint32_t k = 0;
+  while (k < n)
+  {
+    struct io_uring_cqe *cqe;
+    int rc;
+    if ((cqe = ddsi_uring_peek_cqe (&tx->ring)) != NULL)
+    {
+      if (cqe->user_data != UDP_URING_TX_CANCEL)
+      {
+        assert (cqe->user_data < n);
+        if (cqe->res > 0)
+        {
+          retry[cqe->user_data] = false;
+          *ret = (*ret < 0) ? cqe->res : *ret + cqe->res;
+        }
+        k++;
+      }
+      ddsi_uring_cqe_seen (&tx->ring);
+    }
+    else if ((rc = ddsi_uring_wait (&tx->ring, 1)) < 0)
+    {
+      if (cancelled)
+        dds_sleepfor (DDS_MSECS (1));
+      else
+      {
+        if (!conn->m_uring_tx_failed)
+          GVWARNING ("ddsi_udp_conn_write_multi: io_uring_enter failed (%d), reverting to sendmsg\n", rc);
+        conn->m_uring_tx_failed = true;
+        udp_uring_tx_cancel (conn, tx);
+        cancelled = true;
+      }
+    }
+  }
+}
+
+static ssize_t ddsi_udp_conn_write_multi (ddsi_tran_conn_t conn_cmn, size_t ndst, const nn_locator_t * const *dst, size_t niov, const ddsrt_iovec_t *iov, uint32_t flags)
+{
+  ddsi_udp_conn_t conn = (ddsi_udp_conn_t) conn_cmn;
+  struct ddsi_domaingv * const gv = conn->m_base.m_base.gv;
+  struct ddsi_udp_uring_tx *tx;
+  bool retry[UDP_URING_TX_BATCH];
+  ssize_t ret = -1;
+  size_t i = 0;
+
+  if (gv->pcap_fp)
+    return ddsi_udp_conn_write_multi_sync (conn_cmn, ndst, dst, niov, iov, flags);
+
+  ddsrt_mutex_lock (&conn->m_uring_tx_lock);
+  while (i < ndst && (tx = udp_uring_tx (conn)) != NULL)
+  {
+    uint32_t n = 0, nsubmitted;
+    while (n < UDP_URING_TX_BATCH && i + n < ndst)
+    {
+      struct io_uring_sqe *sqe;
+      if ((sqe = ddsi_uring_get_sqe (&tx->ring)) == NULL)
+        break;
+      ddsi_ipaddr_from_loc (&tx->dstaddr[n].x, dst[i + n]);
+      memset (&tx->msg[n], 0, sizeof (tx->msg[n]));
+      set_msghdr_iov (&tx->msg[n], iov, niov);
+      tx->msg[n].msg_name = &tx->dstaddr[n].x;
+      tx->msg[n].msg_namelen = (socklen_t) ddsrt_sockaddr_get_size (&tx->dstaddr[n].a);
+      sqe->opcode = IORING_OP_SENDMSG;
+      sqe->fd = conn->m_sock;
+      sqe->addr = (uint64_t) (uintptr_t) &tx->msg[n];
+      sqe->len = 1;
+      sqe->msg_flags = MSG_NOSIGNAL;
+      sqe->user_data = n;
+      retry[n] = true;
+      n++;
+    }
+
+    /* the kernel takes care of waiting for socket buffer space if needed;
+       if submitting fails, the requests the kernel didn't pick up are
+       withdrawn so that they can be sent using sendmsg instead */
+    int rc;
+    nsubmitted = n;
+    if ((rc = ddsi_uring_submit_and_wait (&tx->ring, n)) < 0)
+    {
+      GVWARNING ("ddsi_udp_conn_write_multi: io_uring_enter failed (%d), reverting to sendmsg\n", rc);
+      conn->m_uring_tx_failed = true;
+      nsubmitted -= ddsi_uring_unsubmit (&tx->ring);
+    }
+    udp_uring_tx_reap (conn, tx, nsubmitted, retry, &ret);
+
+    /* sends that failed or never got submitted are retried using sendmsg,
+       which also takes care of any error reporting */
+    for (uint32_t k = 0; k < n; k++)
+    {
+      ssize_t r;
+      if (retry[k] && (r = ddsi_udp_conn_write (conn_cmn, dst[i + k], niov, iov, flags)) > 0)
+        ret = (ret < 0) ? r : ret + r;
+    }
+    i += n;
+  }
+  ddsrt_mutex_unlock (&conn->m_uring_tx_lock);
+
+  if (i < ndst)
+  {
+    const ssize_t r = ddsi_udp_conn_write_multi_sync (conn_cmn, ndst - i, dst + i, niov, iov, flags);
+    if (r > 0)
+      ret = (ret < 0) ? r : ret + r;
+  }
+  return ret;
+}
+#endif
+
 static void ddsi_udp_disable_multiplexing (ddsi_tran_conn_t conn_cmn)
 {
-#if defined _WIN32 && !defined WINCE
   ddsi_udp_conn_t conn = (ddsi_udp_conn_t) conn_cmn;
+#if defined _WIN32 && !defined WINCE
   uint32_t zero = 0, dummy;
   WSAEventSelect (conn->m_sock, 0, 0);
   WSAIoctl (conn->m_sock, FIONBIO, &zero,sizeof(zero), NULL,0, &dummy, NULL,NULL);
+#elif DDSI_HAVE_IO_URING
+  /* a dedicated thread reads from the socket, so nothing else needs to
+     observe its readiness and the receive ring can take over */
+  struct ddsi_domaingv * const gv = conn->m_base.m_base.gv;
+  if (gv->config.use_io_uring && gv->pcap_fp == NULL && conn->m_uring_rx == NULL)
+    conn->m_uring_rx = udp_uring_rx_new (conn);
 #else
-  (void) conn_cmn;
+  (void) conn;
 #endif
 }
 
@@ -550,16 +894,20 @@ static dds_return_t ddsi_udp_create_conn (ddsi_tran_conn_t *conn_out, ddsi_tran_
   if (rc != DDS_RETCODE_OK)
     goto fail_w_socket;
 
-#ifdef DDSI_INCLUDE_NETWORK_CHANNELS
-  if (qos->m_diffserv != 0 && fact->m_kind == NN_LOCATOR_KIND_UDPv4)
+  if (qos->m_diffserv != 0)
   {
-    if ((rc = ddsrt_setsockopt (sock, IPPROTO_IP, IP_TOS, &qos->m_diffserv, sizeof (qos->m_diffserv))) != DDS_RETCODE_OK)
+    if (!ipv6)
+      rc = ddsrt_setsockopt (sock, IPPROTO_IP, IP_TOS, &qos->m_diffserv, sizeof (qos->m_diffserv));
+#if DDSRT_HAVE_IPV6 && defined IPV6_TCLASS
+    else
+      rc = ddsrt_setsockopt (sock, IPPROTO_IPV6, IPV6_TCLASS, &qos->m_diffserv, sizeof (qos->m_diffserv));
+#endif
+    if (rc != DDS_RETCODE_OK)
     {
       GVERROR ("ddsi_udp_create_conn: set diffserv retcode %"PRId32"\n", rc);
       goto fail_w_socket;
     }
   }
-#endif
 
   ddsi_udp_conn_t conn = ddsrt_malloc (sizeof (*conn));
   memset (conn, 0, sizeof (*conn));
@@ -579,6 +927,11 @@ static dds_return_t ddsi_udp_create_conn (ddsi_tran_conn_t *conn_out, ddsi_tran_
 
   conn->m_base.m_read_fn = ddsi_udp_conn_read;
   conn->m_base.m_write_fn = ddsi_udp_conn_write;
+#if DDSI_HAVE_IO_URING
+  ddsrt_mutex_init (&conn->m_uring_tx_lock);
+  if (gv->config.use_io_uring)
+    conn->m_base.m_write_multi_fn = ddsi_udp_conn_write_multi;
+#endif
   conn->m_base.m_disable_multiplexing_fn = ddsi_udp_disable_multiplexing;
   conn->m_base.m_locator_fn = ddsi_udp_conn_locator;
 
@@ -689,6 +1042,16 @@ static void ddsi_udp_release_conn (ddsi_tran_conn_t conn_cmn)
   GVTRACE ("ddsi_udp_release_conn %s socket %"PRIdSOCK" port %"PRIu32"\n",
            conn_cmn->m_base.m_multicast ? "multicast" : "unicast",
            conn->m_sock, conn->m_base.m_base.m_port);
+#if DDSI_HAVE_IO_URING
+  if (conn->m_uring_rx)
+    udp_uring_rx_free (conn->m_uring_rx);
+  if (conn->m_uring_tx)
+  {
+    ddsi_uring_fini (&conn->m_uring_tx->ring);
+    ddsrt_free (conn->m_uring_tx);
+  }
+  ddsrt_mutex_destroy (&conn->m_uring_tx_lock);
+#endif
   ddsrt_close (conn->m_sock);
 #if defined _WIN32 && !defined WINCE
   WSACloseEvent (conn->m_sockEvent);
@@ -883,6 +1246,10 @@ int ddsi_udp_init (struct ddsi_domaingv*gv)
   }
 #endif
   ddsrt_atomic_st32 (&fact->receive_buf_size, UINT32_MAX);
+#if !DDSI_HAVE_IO_URING
+  if (gv->config.use_io_uring)
+    GVLOG (DDS_LC_CONFIG, "udp: io_uring not supported on this platform\n");
+#endif
 
   ddsi_factory_add (gv, &fact->fact);
   GVLOG (DDS_LC_CONFIG, "udp initialized\n");
@@ -0,0 +1,247 @@
+/*
+ * Copyright(c) 2020 ADLINK Technology Limited and others
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License v. 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0, or the Eclipse Distribution License
+ * v. 1.0 which is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+ */
+#include "ddsi_uring.h"
+
+#if DDSI_HAVE_IO_URING
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static int sys_io_uring_setup (uint32_t entries, struct io_uring_params *p)
+{
+  return (int) syscall (__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter (int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags)
+{
+  return (int) syscall (__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, (size_t) 0);
+}
+
+static int sys_io_uring_register (int fd, uint32_t opcode, const void *arg, uint32_t nr_args)
+{
+  return (int) syscall (__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void *map_ring (int fd, size_t size, off_t offset)
+{
+  void *p = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+  return (p == MAP_FAILED) ? NULL : p;
+}
+
+dds_return_t ddsi_uring_init (struct ddsi_uring *ring, uint32_t entries)
+{
+  struct io_uring_params p;
+  memset (ring, 0, sizeof (*ring));
+  memset (&p, 0, sizeof (p));
+  /* io_uring_setup fails with ENOSYS on old kernels and with EPERM if it is
+     disabled by the administrator or a seccomp filter */
+  if ((ring->fd = sys_io_uring_setup (entries, &p)) < 0)
+    return DDS_RETCODE_UNSUPPORTED;
+
+  ring->sq_mapsize = p.sq_off.array + p.sq_entries * sizeof (uint32_t);
+  ring->cq_mapsize = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    if (ring->cq_mapsize > ring->sq_mapsize)
+      ring->sq_mapsize = ring->cq_mapsize;
+    ring->cq_mapsize = 0;
+  }
+  if ((ring->sq_map = map_ring (ring->fd, ring->sq_mapsize, IORING_OFF_SQ_RING)) == NULL)
+    goto err_sq_map;
+  if (ring->cq_mapsize == 0)
+    ring->cq_map = ring->sq_map;
+  else if ((ring->cq_map = map_ring (ring->fd, ring->cq_mapsize, IORING_OFF_CQ_RING)) == NULL)
+    goto err_cq_map;
+  ring->sqes_mapsize = p.sq_entries * sizeof (struct io_uring_sqe);
+  if ((ring->sqes = map_ring (ring->fd, ring->sqes_mapsize, IORING_OFF_SQES)) == NULL)
+    goto err_sqes_map;
+
+  unsigned char * const sq = ring->sq_map;
+  unsigned char * const cq = ring->cq_map;
+  ring->sq_entries = p.sq_entries;
+  ring->sq_mask = *(uint32_t *) (sq + p.sq_off.ring_mask);
+  ring->sq_head = (ddsrt_atomic_uint32_t *) (sq + p.sq_off.head);
+  ring->sq_tail = (ddsrt_atomic_uint32_t *) (sq + p.sq_off.tail);
+  ring->sqe_tail = ddsrt_atomic_ld32 (ring->sq_tail);
+  ring->cq_mask = *(uint32_t *) (cq + p.cq_off.ring_mask);
+  ring->cq_head = (ddsrt_atomic_uint32_t *) (cq + p.cq_off.head);
+  ring->cq_tail = (ddsrt_atomic_uint32_t *) (cq + p.cq_off.tail);
+  ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+  /* Submission queue entries are always used in order, so the indirection
+     array can be initialized to the identity once and for all */
+  uint32_t * const array = (uint32_t *) (sq + p.sq_off.array);
+  for (uint32_t i = 0; i < ring->sq_entries; i++)
+    array[i] = i;
+  return DDS_RETCODE_OK;
+
+err_sqes_map:
+  if (ring->cq_map != ring->sq_map)
+    munmap (ring->cq_map, ring->cq_mapsize);
+err_cq_map:
+  munmap (ring->sq_map, ring->sq_mapsize);
+err_sq_map:
+  close (ring->fd);
+  return DDS_RETCODE_OUT_OF_RESOURCES;
+}
+
+void ddsi_uring_fini (struct ddsi_uring *ring)
+{
+  /* closing the file descriptor cancels all outstanding requests */
+  close (ring->fd);
+  munmap (ring->sqes, ring->sqes_mapsize);
+  if (ring->cq_map != ring->sq_map)
+    munmap (ring->cq_map, ring->cq_mapsize);
+  munmap (ring->sq_map, ring->sq_mapsize);
+}
+
+struct io_uring_sqe *ddsi_uring_get_sqe (struct ddsi_uring *ring)
+{
+  const uint32_t head = ddsrt_atomic_ld32 (ring->sq_head);
+  ddsrt_atomic_fence_acq ();
+  if (ring->sqe_tail - head >= ring->sq_entries)
+    return NULL;
+  struct io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+  ring->sqe_tail++;
+  memset (sqe, 0, sizeof (*sqe));
+  return sqe;
+}
+
+int ddsi_uring_submit_and_wait (struct ddsi_uring *ring, uint32_t wait_nr)
+{
+  const uint32_t flags = (wait_nr > 0) ? IORING_ENTER_GETEVENTS : 0;
+  ddsrt_atomic_fence_rel ();
+  ddsrt_atomic_st32 (ring->sq_tail, ring->sqe_tail);
+  while (1)
+  {
+    /* without SQPOLL, the kernel only consumes entries in io_uring_enter, so
+       whatever lies between its head and our tail is still to be submitted,
+       also after an interrupted call */
+    const uint32_t to_submit = ring->sqe_tail - ddsrt_atomic_ld32 (ring->sq_head);
+    if (sys_io_uring_enter (ring->fd, to_submit, wait_nr, flags) >= 0)
+      return 0;
+    else if (errno != EINTR)
+      return -errno;
+  }
+}
+
+int ddsi_uring_wait (struct ddsi_uring *ring, uint32_t wait_nr)
+{
+  while (1)
+  {
+    if (sys_io_uring_enter (ring->fd, 0, wait_nr, IORING_ENTER_GETEVENTS) >= 0)
+      return 0;
+    else if (errno != EINTR)
+      return -errno;
+  }
+}
+
+uint32_t ddsi_uring_unsubmit (struct ddsi_uring *ring)
+{
+  /* without SQPOLL, the kernel only looks at the tail in io_uring_enter, and
+     that never runs concurrently with this */
+  const uint32_t head = ddsrt_atomic_ld32 (ring->sq_head);
+  const uint32_t n = ring->sqe_tail - head;
+  ring->sqe_tail = head;
+  ddsrt_atomic_st32 (ring->sq_tail, head);
+  return n;
+}
+
+struct io_uring_cqe *ddsi_uring_peek_cqe (struct ddsi_uring *ring)
+{
+  const uint32_t head = ddsrt_atomic_ld32 (ring->cq_head);
+  const uint32_t tail = ddsrt_atomic_ld32 (ring->cq_tail);
+  ddsrt_atomic_fence_acq ();
+  return (head == tail) ? NULL : &ring->cqes[head & ring->cq_mask];
+}
+
+void ddsi_uring_cqe_seen (struct ddsi_uring *ring)
+{
+  ddsrt_atomic_fence_rel ();
+  ddsrt_atomic_st32 (ring->cq_head, ddsrt_atomic_ld32 (ring->cq_head) + 1);
+}
+
+static void bufring_add (struct ddsi_uring_bufring *bufring, uint16_t bid, uint16_t offset)
+{
+  struct io_uring_buf *buf = &bufring->br->bufs[(uint16_t) (bufring->tail + offset) & (bufring->nbufs - 1)];
+  buf->addr = (uint64_t) (uintptr_t) (bufring->bufs + (size_t) bid * bufring->bufsize);
+  buf->len = bufring->bufsize;
+  buf->bid = bid;
+}
+
+static void bufring_publish (struct ddsi_uring_bufring *bufring, uint16_t count)
+{
+  bufring->tail = (uint16_t) (bufring->tail + count);
+  ddsrt_atomic_fence_rel ();
+  *((volatile uint16_t *) &bufring->br->tail) = bufring->tail;
+}
+
+dds_return_t ddsi_uring_bufring_init (struct ddsi_uring *ring, struct ddsi_uring_bufring *bufring, uint16_t bgid, uint32_t nbufs, uint32_t bufsize)
+{
+  struct io_uring_buf_reg reg;
+  assert (nbufs > 0 && nbufs <= 32768 && (nbufs & (nbufs - 1)) == 0);
+  memset (bufring, 0, sizeof (*bufring));
+  bufring->nbufs = nbufs;
+  bufring->bufsize = bufsize;
+  bufring->bgid = bgid;
+  bufring->br_mapsize = nbufs * sizeof (struct io_uring_buf);
+  if ((bufring->br = mmap (NULL, bufring->br_mapsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+    return DDS_RETCODE_OUT_OF_RESOURCES;
+  /* the buffers themselves are only backed by memory once they are used */
+  bufring->bufs_mapsize = (size_t) nbufs * bufsize;
+  if ((bufring->bufs = mmap (NULL, bufring->bufs_mapsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+  {
+    munmap (bufring->br, bufring->br_mapsize);
+    return DDS_RETCODE_OUT_OF_RESOURCES;
+  }
+
+  memset (&reg, 0, sizeof (reg));
+  reg.ring_addr = (uint64_t) (uintptr_t) bufring->br;
+  reg.ring_entries = nbufs;
+  reg.bgid = bgid;
+  if (sys_io_uring_register (ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+  {
+    munmap (bufring->bufs, bufring->bufs_mapsize);
+    munmap (bufring->br, bufring->br_mapsize);
+    return DDS_RETCODE_UNSUPPORTED;
+  }
+  for (uint32_t i = 0; i < nbufs; i++)
+    bufring_add (bufring, (uint16_t) i, (uint16_t) i);
+  bufring_publish (bufring, (uint16_t) nbufs);
+  return DDS_RETCODE_OK;
+}
+
+void ddsi_uring_bufring_fini (struct ddsi_uring *ring, struct ddsi_uring_bufring *bufring)
+{
+  struct io_uring_buf_reg reg;
+  memset (&reg, 0, sizeof (reg));
+  reg.bgid = bufring->bgid;
+  (void) sys_io_uring_register (ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+  munmap (bufring->bufs, bufring->bufs_mapsize);
+  munmap (bufring->br, bufring->br_mapsize);
+}
+
+void *ddsi_uring_bufring_get (const struct ddsi_uring_bufring *bufring, uint16_t bid)
+{
+  assert (bid < bufring->nbufs);
+  return bufring->bufs + (size_t) bid * bufring->bufsize;
+}
+
+void ddsi_uring_bufring_recycle (struct ddsi_uring_bufring *bufring, uint16_t bid)
+{
+  bufring_add (bufring, bid, 0);
+  bufring_publish (bufring, 1);
+}
+
+#endif /* DDSI_HAVE_IO_URING */
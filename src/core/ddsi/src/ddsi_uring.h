@@ -0,0 +1,116 @@
+/*
+ * Copyright(c) 2020 ADLINK Technology Limited and others
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License v. 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0, or the Eclipse Distribution License
+ * v. 1.0 which is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+ */
+#ifndef DDSI_URING_H
+#define DDSI_URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "dds/ddsrt/atomics.h"
+#include "dds/ddsrt/retcode.h"
+
+/* Minimal io_uring support using the raw system calls, so that there is no
+   dependency on liburing.  It only covers what the UDP transport needs:
+   submitting sendmsg requests in batches and multishot recvmsg with buffers
+   provided by the application.  Multishot receive requires Linux 6.0, so
+   that is what the header needs to know about at compile time; whether the
+   running kernel supports it (and whether io_uring is allowed at all) is
+   determined at run-time. */
+#if defined(__linux) && !LWIP_SOCKET && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+#define DDSI_HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+#ifndef DDSI_HAVE_IO_URING
+#define DDSI_HAVE_IO_URING 0
+#endif
+
+#if DDSI_HAVE_IO_URING
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+struct ddsi_uring {
+  int fd;
+  uint32_t sq_entries;
+  uint32_t sq_mask;
+  uint32_t sqe_tail;
+  ddsrt_atomic_uint32_t *sq_head;
+  ddsrt_atomic_uint32_t *sq_tail;
+  struct io_uring_sqe *sqes;
+  uint32_t cq_mask;
+  ddsrt_atomic_uint32_t *cq_head;
+  ddsrt_atomic_uint32_t *cq_tail;
+  struct io_uring_cqe *cqes;
+  void *sq_map;
+  size_t sq_mapsize;
+  void *cq_map;
+  size_t cq_mapsize;
+  size_t sqes_mapsize;
+};
+
+/* Ring of equally sized buffers registered with the kernel as buffer group
+   "bgid", from which multishot receive operations pick their buffers */
+struct ddsi_uring_bufring {
+  struct io_uring_buf_ring *br;
+  size_t br_mapsize;
+  unsigned char *bufs;
+  size_t bufs_mapsize;
+  uint32_t nbufs;
+  uint32_t bufsize;
+  uint16_t bgid;
+  uint16_t tail;
+};
+
+dds_return_t ddsi_uring_init (struct ddsi_uring *ring, uint32_t entries);
+void ddsi_uring_fini (struct ddsi_uring *ring);
+
+/* Returns a zero-initialized submission queue entry, or NULL if the
+   submission queue is full */
+struct io_uring_sqe *ddsi_uring_get_sqe (struct ddsi_uring *ring);
+
+/* Submits all entries obtained from ddsi_uring_get_sqe that have not yet
+   been consumed by the kernel and waits for at least "wait_nr" completions
+   to be available, returning 0 or a negated errno value */
+int ddsi_uring_submit_and_wait (struct ddsi_uring *ring, uint32_t wait_nr);
+
+/* Waits for at least "wait_nr" completions to be available without
+   submitting anything, returning 0 or a negated errno value */
+int ddsi_uring_wait (struct ddsi_uring *ring, uint32_t wait_nr);
+
+/* Withdraws the entries obtained from ddsi_uring_get_sqe that the kernel
+   has not consumed yet (e.g., because ddsi_uring_submit_and_wait failed),
+   returning how many were withdrawn; these are always the most recent ones */
+uint32_t ddsi_uring_unsubmit (struct ddsi_uring *ring);
+
+/* Returns the oldest completion or NULL if there are none, it remains
+   valid until ddsi_uring_cqe_seen is called */
+struct io_uring_cqe *ddsi_uring_peek_cqe (struct ddsi_uring *ring);
+void ddsi_uring_cqe_seen (struct ddsi_uring *ring);
+
+dds_return_t ddsi_uring_bufring_init (struct ddsi_uring *ring, struct ddsi_uring_bufring *bufring, uint16_t bgid, uint32_t nbufs, uint32_t bufsize);
+void ddsi_uring_bufring_fini (struct ddsi_uring *ring, struct ddsi_uring_bufring *bufring);
+void *ddsi_uring_bufring_get (const struct ddsi_uring_bufring *bufring, uint16_t bid);
+void ddsi_uring_bufring_recycle (struct ddsi_uring_bufring *bufring, uint16_t bid);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif /* DDSI_HAVE_IO_URING */
+
+#endif /* DDSI_URING_H */
@@ -198,6 +198,34 @@ int is_unspec_locator (const nn_locator_t *loc)
           memcmp (&zloc.address, loc->address, sizeof (zloc.address)) == 0);
 }
 
+static int addrset_tree_has_kind (const ddsrt_avl_ctree_t *tree, int32_t kind, bool match)
+{
+  struct addrset_node *n;
+  ddsrt_avl_citer_t it;
+  for (n = ddsrt_avl_citer_first (&addrset_treedef, tree, &it); n; n = ddsrt_avl_citer_next (&it))
+    if ((n->loc.kind == kind) == match)
+      return 1;
+  return 0;
+}
+
+int addrset_contains_kind (const struct addrset *as, int32_t kind)
+{
+  int ret;
+  LOCK (as);
+  ret = addrset_tree_has_kind (&as->ucaddrs, kind, true) || addrset_tree_has_kind (&as->mcaddrs, kind, true);
+  UNLOCK (as);
+  return ret;
+}
+
+int addrset_contains_only_kind (const struct addrset *as, int32_t kind)
+{
+  int ret;
+  LOCK (as);
+  ret = !addrset_tree_has_kind (&as->ucaddrs, kind, false) && !addrset_tree_has_kind (&as->mcaddrs, kind, false);
+  UNLOCK (as);
+  return ret;
+}
+
 #ifdef DDSI_INCLUDE_SSM
 int addrset_contains_ssm (const struct ddsi_domaingv *gv, const struct addrset *as)
 {
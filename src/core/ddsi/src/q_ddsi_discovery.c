@@ -46,6 +46,8 @@
 #include "dds/ddsi/q_feature_check.h"
 #include "dds/ddsi/ddsi_security_omg.h"
 #include "dds/ddsi/ddsi_pmd.h"
+#include "dds/ddsi/ddsi_filter.h"
+#include "dds/ddsi/ddsi_shm.h"
 #ifdef DDSI_INCLUDE_SECURITY
 #include "dds/ddsi/ddsi_security_exchange.h"
 #endif
@@ -58,6 +60,20 @@ static int get_locator (const struct ddsi_domaingv *gv, nn_locator_t *loc, const
   memset (&first, 0, sizeof (first));
   memset (&samenet, 0, sizeof (samenet));
 
+  /* Shared memory trumps everything else, but only if the peer is on the same host */
+  if (gv->shm_conn)
+  {
+    for (l = locs->first; l != NULL; l = l->next)
+    {
+      if (l->loc.kind == NN_LOCATOR_KIND_SHM && ddsi_shm_locator_reachable (gv, &l->loc))
+      {
+        *loc = l->loc;
+        loc->tran = gv->shm_conn->m_factory;
+        return 1;
+      }
+    }
+  }
+
   /* Special case UDPv4 MC address generators - there is a bit of an type mismatch between an address generator (i.e., a set of addresses) and an address ... Whoever uses them is supposed to know that that is what he wants, so we simply given them priority. */
   if (ddsi_factory_supports (gv->m_factory, NN_LOCATOR_KIND_UDPv4))
   {
@@ -223,6 +239,22 @@ void get_participant_builtin_topic_data (const struct participant *pp, ddsi_plis
     locs->meta_uni_loc_one.loc = pp->e.gv->loc_meta_uc;
   }
 
+  /* Shared memory locator goes after the UDP one: other implementations ignore it,
+     peers on the same host prefer it */
+  if (pp->e.gv->shm_conn)
+  {
+    locs->def_uni_loc_shm.next = NULL;
+    locs->def_uni_loc_shm.loc = pp->e.gv->loc_shm;
+    locs->meta_uni_loc_shm.next = NULL;
+    locs->meta_uni_loc_shm.loc = pp->e.gv->loc_shm;
+    locs->def_uni_loc_one.next = &locs->def_uni_loc_shm;
+    locs->meta_uni_loc_one.next = &locs->meta_uni_loc_shm;
+    dst->default_unicast_locators.last = &locs->def_uni_loc_shm;
+    dst->metatraffic_unicast_locators.last = &locs->meta_uni_loc_shm;
+    dst->default_unicast_locators.n++;
+    dst->metatraffic_unicast_locators.n++;
+  }
+
   if (pp->e.gv->config.publish_uc_locators)
   {
     dst->present |= PP_DEFAULT_UNICAST_LOCATOR | PP_METATRAFFIC_UNICAST_LOCATOR;
@@ -889,7 +921,8 @@ static int sedp_write_endpoint
 (
    struct writer *wr, int alive, const ddsi_guid_t *epguid,
    const struct entity_common *common, const struct endpoint_common *epcommon,
-   const dds_qos_t *xqos, struct addrset *as, nn_security_info_t *security)
+   const dds_qos_t *xqos, struct addrset *as, nn_security_info_t *security,
+   const nn_content_filter_property_t *content_filter)
 {
   struct ddsi_domaingv * const gv = wr->e.gv;
   const dds_qos_t *defqos = is_writer_entityid (epguid->entityid) ? &gv->default_xqos_wr : &gv->default_xqos_rd;
@@ -939,6 +972,15 @@ static int sedp_write_endpoint
       ps.group_guid = epcommon->group_guid;
     }
 
+    if (content_filter)
+    {
+      /* not aliased: freeing the plist always frees the parameter sequence */
+      nn_content_filter_property_t *cfp = ddsi_content_filter_property_dup (content_filter);
+      ps.present |= PP_CONTENT_FILTER_PROPERTY;
+      ps.content_filter_property = *cfp;
+      ddsrt_free (cfp);
+    }
+
 #ifdef DDSI_INCLUDE_SSM
     /* A bit of a hack -- the easy alternative would be to make it yet
      another parameter.  We only set "reader favours SSM" if we
@@ -1001,7 +1043,7 @@ int sedp_write_writer (struct writer *wr)
       security = &tmp;
     }
 #endif
-    return sedp_write_endpoint (sedp_wr, 1, &wr->e.guid, &wr->e, &wr->c, wr->xqos, as, security);
+    return sedp_write_endpoint (sedp_wr, 1, &wr->e.guid, &wr->e, &wr->c, wr->xqos, as, security, NULL);
   }
   return 0;
 }
@@ -1025,7 +1067,7 @@ int sedp_write_reader (struct reader *rd)
       security = &tmp;
     }
 #endif
-    return sedp_write_endpoint (sedp_wr, 1, &rd->e.guid, &rd->e, &rd->c, rd->xqos, as, security);
+    return sedp_write_endpoint (sedp_wr, 1, &rd->e.guid, &rd->e, &rd->c, rd->xqos, as, security, rd->content_filter);
   }
   return 0;
 }
@@ -1036,7 +1078,7 @@ int sedp_dispose_unregister_writer (struct writer *wr)
   {
     unsigned entityid = determine_publication_writer(wr);
     struct writer *sedp_wr = get_sedp_writer (wr->c.pp, entityid);
-    return sedp_write_endpoint (sedp_wr, 0, &wr->e.guid, NULL, NULL, NULL, NULL, NULL);
+    return sedp_write_endpoint (sedp_wr, 0, &wr->e.guid, NULL, NULL, NULL, NULL, NULL, NULL);
   }
   return 0;
 }
@@ -1047,7 +1089,7 @@ int sedp_dispose_unregister_reader (struct reader *rd)
   {
     unsigned entityid = determine_subscription_writer(rd);
     struct writer *sedp_wr = get_sedp_writer (rd->c.pp, entityid);
-    return sedp_write_endpoint (sedp_wr, 0, &rd->e.guid, NULL, NULL, NULL, NULL, NULL);
+    return sedp_write_endpoint (sedp_wr, 0, &rd->e.guid, NULL, NULL, NULL, NULL, NULL, NULL);
   }
   return 0;
 }
@@ -1322,7 +1364,9 @@ static void handle_SEDP_alive (const struct receiver_state *rst, seqno_t seq, dd
     {
       if (prd)
       {
-        update_proxy_reader (prd, seq, as, xqos, timestamp);
+        const nn_content_filter_property_t *content_filter =
+          (datap->present & PP_CONTENT_FILTER_PROPERTY) ? &datap->content_filter_property : NULL;
+        update_proxy_reader (prd, seq, as, xqos, content_filter, timestamp);
       }
       else
       {
@@ -1381,6 +1425,20 @@ static void handle_SEDP (const struct receiver_state *rst, seqno_t seq, struct d
 /******************************************************************************
  *****************************************************************************/
 
+struct nn_dqueue *builtins_dqueue_for_prefix (const struct ddsi_domaingv *gv, const ddsi_guid_prefix_t *prefix)
+{
+  /* Discovery data is processed in order per proxy writer, and SPDP must be
+     processed before the SEDP data of that same participant, so pick the
+     queue based on the GUID prefix only */
+  if (gv->n_builtins_dqueues == 1)
+    return gv->builtins_dqueues[0];
+  else
+  {
+    const uint32_t h = (prefix->u[0] ^ prefix->u[1] ^ prefix->u[2]) * UINT32_C (0x9e3779b1);
+    return gv->builtins_dqueues[(uint32_t) (((uint64_t) h * gv->n_builtins_dqueues) >> 32)];
+  }
+}
+
 int builtins_dqueue_handler (const struct nn_rsample_info *sampleinfo, const struct nn_rdata *fragchain, UNUSED_ARG (const ddsi_guid_t *rdguid), UNUSED_ARG (void *qarg))
 {
   struct ddsi_domaingv * const gv = sampleinfo->rst->gv;
@@ -206,6 +206,7 @@ static int print_participants (struct thread_state1 * const ts1, struct ddsi_dom
           x += cpf (conn, "    max-drop-seq %"PRId64"\n", writer_max_drop_seq (w));
         }
         x += print_addrset_if_notempty (conn, "    as", w->as, "\n");
+        x += cpf (conn, "    #incr-as %"PRIu32"%s\n", w->num_incremental_addrset_updates, w->cover_incremental ? "" : " (full)");
         for (m = ddsrt_avl_iter_first (&wr_readers_treedef, &w->readers, &rdit); m; m = ddsrt_avl_iter_next (&rdit))
         {
           char wr_prd_flags[4];
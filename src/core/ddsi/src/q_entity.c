@@ -18,6 +18,7 @@
 #include "dds/ddsrt/log.h"
 #include "dds/ddsrt/sockets.h"
 #include "dds/ddsrt/string.h"
+#include "dds/ddsrt/strtol.h"
 #include "dds/ddsrt/sync.h"
 #include "dds/ddsrt/misc.h"
 
@@ -49,6 +50,7 @@
 #include "dds__whc.h"
 #include "dds/ddsi/ddsi_iid.h"
 #include "dds/ddsi/ddsi_tkmap.h"
+#include "dds/ddsi/ddsi_filter.h"
 #include "dds/ddsi/ddsi_security_omg.h"
 
 #ifdef DDSI_INCLUDE_SECURITY
@@ -1712,19 +1714,8 @@ static void rebuild_writer_addrset_setcover(struct addrset *newas, struct writer
   ddsrt_free(covered);
 }
 
-static void rebuild_writer_addrset (struct writer *wr)
+static void writer_set_burst_size_limits (struct writer *wr, uint32_t min_receive_buffer_size)
 {
-  /* FIXME way too inefficient in this form */
-  struct addrset *newas = new_addrset ();
-  struct addrset *oldas = wr->as;
-  uint32_t min_receive_buffer_size = UINT32_MAX;
-
-  /* only one operation at a time */
-  ASSERT_MUTEX_HELD (&wr->e.lock);
-
-  /* compute new addrset */
-  rebuild_writer_addrset_setcover(newas, wr, &min_receive_buffer_size);
-
   /* Modifying burst size limit here is a bit of a hack; but anyway ...
      try to limit bursts of retransmits to 67% of the smallest receive
      buffer, and those of initial transmissions to that + overshoot%.
@@ -1750,17 +1741,247 @@ static void rebuild_writer_addrset (struct writer *wr)
     wr->init_burst_size_limit = wr->rexmit_burst_size_limit;
   else
     wr->init_burst_size_limit = (uint32_t) limit64;
+}
+
+/* Incremental maintenance of the writer's address set: "cover_locs" tracks, for
+   each locator advertised by one or more matching proxy readers, how many readers
+   advertise it and whether it is part of the writer's current address set ("as").
+   Adding a reader that is already reached via "as" then only costs a few lookups,
+   as does adding a reader none of whose locators is advertised by another reader
+   (the typical case in a join storm: a new participant with its own unicast
+   locator), and removing a reader that doesn't leave a now useless locator in
+   "as".  All other cases fall back to recomputing the set cover from scratch,
+   which also resets the bookkeeping. */
+
+struct wr_cover_loc {
+  ddsrt_avl_node_t avlnode;
+  nn_locator_t loc;
+  uint32_t nreaders; /* number of matching proxy readers advertising this locator */
+  bool in_cover; /* iff true, locator is in writer's address set */
+};
+
+static int compare_locators_vwrap (const void *va, const void *vb)
+{
+  return compare_locators (va, vb);
+}
+
+static const ddsrt_avl_treedef_t wr_cover_locs_treedef =
+  DDSRT_AVL_TREEDEF_INITIALIZER (offsetof (struct wr_cover_loc, avlnode), offsetof (struct wr_cover_loc, loc), compare_locators_vwrap, 0);
+
+struct writer_cover_update_arg {
+  struct writer *wr;
+  bool covered; /* set if one of the locators is in the address set */
+  bool shared; /* set if one of the locators is also advertised by another reader */
+  bool need_rebuild; /* set if incremental update isn't possible */
+};
+
+static void writer_cover_add_loc (const nn_locator_t *loc, void *varg)
+{
+  struct writer_cover_update_arg * const arg = varg;
+  struct writer * const wr = arg->wr;
+  struct wr_cover_loc *cl;
+  ddsrt_avl_ipath_t path;
+  /* MC gens are merged into a single address dependent on the set of readers covered */
+  if (loc->kind == NN_LOCATOR_KIND_UDPv4MCGEN)
+    arg->need_rebuild = true;
+  if ((cl = ddsrt_avl_lookup_ipath (&wr_cover_locs_treedef, &wr->cover_locs, loc, &path)) == NULL)
+  {
+    cl = ddsrt_malloc (sizeof (*cl));
+    cl->loc = *loc;
+    cl->nreaders = 0;
+    cl->in_cover = false;
+    ddsrt_avl_insert_ipath (&wr_cover_locs_treedef, &wr->cover_locs, cl, &path);
+  }
+  cl->nreaders++;
+  if (cl->in_cover)
+    arg->covered = true;
+  if (cl->nreaders > 1)
+    arg->shared = true;
+}
+
+static void writer_cover_remove_loc (const nn_locator_t *loc, void *varg)
+{
+  struct writer_cover_update_arg * const arg = varg;
+  struct writer * const wr = arg->wr;
+  struct wr_cover_loc *cl;
+  ddsrt_avl_dpath_t path;
+  if ((cl = ddsrt_avl_lookup_dpath (&wr_cover_locs_treedef, &wr->cover_locs, loc, &path)) == NULL || cl->nreaders == 0)
+  {
+    /* address set of the proxy reader changed since it was matched */
+    arg->need_rebuild = true;
+    return;
+  }
+  cl->nreaders--;
+  if (!cl->in_cover)
+  {
+    if (cl->nreaders == 0)
+    {
+      ddsrt_avl_delete_dpath (&wr_cover_locs_treedef, &wr->cover_locs, cl, &path);
+      ddsrt_free (cl);
+    }
+  }
+  else if (cl->nreaders == 0 || (cl->nreaders == 1 && ddsi_is_mcaddr (wr->e.gv, &cl->loc)))
+  {
+    /* either useless or a multicast address that now reaches a single
+       reader, for which the set cover algorithm would prefer unicast */
+    arg->need_rebuild = true;
+  }
+}
+
+static void writer_cover_mark_loc (const nn_locator_t *loc, void *varg)
+{
+  struct writer_cover_update_arg * const arg = varg;
+  struct wr_cover_loc *cl;
+  if ((cl = ddsrt_avl_lookup (&wr_cover_locs_treedef, &arg->wr->cover_locs, loc)) != NULL)
+    cl->in_cover = true;
+  else
+    arg->need_rebuild = true; /* e.g., a merged MC gen address */
+}
+
+static void writer_cover_rebuild (struct writer *wr)
+{
+  struct writer_cover_update_arg arg = { .wr = wr, .covered = false, .shared = false, .need_rebuild = false };
+  struct entity_index *gh = wr->e.gv->entity_index;
+  struct wr_prd_match *m;
+  ddsrt_avl_iter_t it;
+  ddsrt_avl_free (&wr_cover_locs_treedef, &wr->cover_locs, ddsrt_free);
+  wr->min_receive_buffer_size = UINT32_MAX;
+  wr->min_receive_buffer_size_count = 0;
+  for (m = ddsrt_avl_iter_first (&wr_readers_treedef, &wr->readers, &it); m; m = ddsrt_avl_iter_next (&it))
+  {
+    struct proxy_reader *prd;
+    /* a proxy reader that is being deleted is no longer taken into account
+       by the set cover either, and so mustn't be subtracted when it goes */
+    m->in_cover_locs = 0;
+    if ((prd = entidx_lookup_proxy_reader_guid (gh, &m->prd_guid)) == NULL)
+      continue;
+    m->in_cover_locs = 1;
+    if (prd->receive_buffer_size < wr->min_receive_buffer_size)
+    {
+      wr->min_receive_buffer_size = prd->receive_buffer_size;
+      wr->min_receive_buffer_size_count = 0;
+    }
+    if (prd->receive_buffer_size == wr->min_receive_buffer_size)
+      wr->min_receive_buffer_size_count++;
+    addrset_forall (prd->c.as, writer_cover_add_loc, &arg);
+  }
+  addrset_forall (wr->as, writer_cover_mark_loc, &arg);
+#ifdef DDSI_INCLUDE_SSM
+  if (wr->supports_ssm && wr->ssm_as)
+    arg.need_rebuild = true;
+#endif
+  wr->cover_incremental = !arg.need_rebuild;
+}
+
+static void rebuild_writer_addrset (struct writer *wr)
+{
+  struct addrset *newas = new_addrset ();
+  struct addrset *oldas = wr->as;
+  uint32_t min_receive_buffer_size = UINT32_MAX;
+
+  /* only one operation at a time */
+  ASSERT_MUTEX_HELD (&wr->e.lock);
+
+  /* compute new addrset */
+  rebuild_writer_addrset_setcover(newas, wr, &min_receive_buffer_size);
+  writer_set_burst_size_limits (wr, min_receive_buffer_size);
 
   /* swap in new address set; this simple procedure is ok as long as
      wr->as is never accessed without the wr->e.lock held */
   wr->as = newas;
   unref_addrset (oldas);
+  writer_cover_rebuild (wr);
 
   ELOGDISC (wr, "rebuild_writer_addrset("PGUIDFMT"):", PGUID (wr->e.guid));
   nn_log_addrset(wr->e.gv, DDS_LC_DISCOVERY, "", wr->as);
   ELOGDISC (wr, " (burst size %"PRIu32" rexmit %"PRIu32")\n", wr->init_burst_size_limit, wr->rexmit_burst_size_limit);
 }
 
+static void writer_addrset_add_exclusive (struct writer *wr, const struct proxy_reader *prd)
+{
+  /* None of the locators of the reader is advertised by another reader, so
+     the set cover computed from scratch would be the current one plus one of
+     these, selected in the same way as here */
+  struct ddsi_domaingv * const gv = wr->e.gv;
+  struct wr_cover_loc *cl;
+  nn_locator_t *locs;
+  int *locs_nrds;
+  int nlocs, best;
+  char str[DDSI_LOCATORSTRLEN];
+  rebuild_make_locs (&gv->logconfig, &nlocs, &locs, prd->c.as);
+  locs_nrds = ddsrt_malloc ((size_t) nlocs * sizeof (*locs_nrds));
+  for (int i = 0; i < nlocs; i++)
+    locs_nrds[i] = 1;
+  best = rebuild_select (gv, nlocs, locs, locs_nrds, gv->config.prefer_multicast);
+  assert (best >= 0);
+  add_to_addrset (gv, wr->as, &locs[best]);
+  cl = ddsrt_avl_lookup (&wr_cover_locs_treedef, &wr->cover_locs, &locs[best]);
+  assert (cl != NULL && cl->nreaders == 1);
+  cl->in_cover = true;
+  ELOGDISC (wr, "writer_addrset_add_reader("PGUIDFMT" prd "PGUIDFMT"): added %s\n", PGUID (wr->e.guid), PGUID (prd->e.guid),
+            ddsi_locator_to_string (str, sizeof (str), &locs[best]));
+  ddsrt_free (locs_nrds);
+  ddsrt_free (locs);
+}
+
+static void writer_addrset_add_reader (struct writer *wr, struct wr_prd_match *m, const struct proxy_reader *prd)
+{
+  struct writer_cover_update_arg arg = { .wr = wr, .covered = false, .shared = false, .need_rebuild = false };
+  ASSERT_MUTEX_HELD (&wr->e.lock);
+  if (!wr->cover_incremental)
+  {
+    rebuild_writer_addrset (wr);
+    return;
+  }
+  addrset_forall (prd->c.as, writer_cover_add_loc, &arg);
+  if (arg.need_rebuild || (!arg.covered && arg.shared))
+  {
+    rebuild_writer_addrset (wr);
+    return;
+  }
+  m->in_cover_locs = 1;
+  if (!arg.covered && !addrset_empty (prd->c.as))
+    writer_addrset_add_exclusive (wr, prd);
+  else
+    ELOGDISC (wr, "writer_addrset_add_reader("PGUIDFMT" prd "PGUIDFMT"): already covered\n", PGUID (wr->e.guid), PGUID (prd->e.guid));
+  if (prd->receive_buffer_size < wr->min_receive_buffer_size)
+  {
+    wr->min_receive_buffer_size = prd->receive_buffer_size;
+    wr->min_receive_buffer_size_count = 1;
+    writer_set_burst_size_limits (wr, wr->min_receive_buffer_size);
+  }
+  else if (prd->receive_buffer_size == wr->min_receive_buffer_size)
+  {
+    wr->min_receive_buffer_size_count++;
+  }
+  wr->num_incremental_addrset_updates++;
+}
+
+static void writer_addrset_remove_reader (struct writer *wr, const struct wr_prd_match *m, const struct proxy_reader *prd)
+{
+  struct writer_cover_update_arg arg = { .wr = wr, .covered = false, .shared = false, .need_rebuild = false };
+  ASSERT_MUTEX_HELD (&wr->e.lock);
+  if (!wr->cover_incremental)
+  {
+    rebuild_writer_addrset (wr);
+    return;
+  }
+  if (!m->in_cover_locs)
+  {
+    wr->num_incremental_addrset_updates++;
+    ELOGDISC (wr, "writer_addrset_remove_reader("PGUIDFMT" prd "PGUIDFMT"): not in cover\n", PGUID (wr->e.guid), PGUID (prd->e.guid));
+    return;
+  }
+  addrset_forall (prd->c.as, writer_cover_remove_loc, &arg);
+  if (arg.need_rebuild || (prd->receive_buffer_size == wr->min_receive_buffer_size && --wr->min_receive_buffer_size_count == 0))
+  {
+    rebuild_writer_addrset (wr);
+    return;
+  }
+  wr->num_incremental_addrset_updates++;
+  ELOGDISC (wr, "writer_addrset_remove_reader("PGUIDFMT" prd "PGUIDFMT"): address set unchanged\n", PGUID (wr->e.guid), PGUID (prd->e.guid));
+}
+
 void rebuild_or_clear_writer_addrsets (struct ddsi_domaingv *gv, int rebuild)
 {
   struct entidx_enum_writer est;
@@ -1776,7 +1997,10 @@ void rebuild_or_clear_writer_addrsets (struct ddsi_domaingv *gv, int rebuild)
       if (rebuild)
         rebuild_writer_addrset(wr);
       else
+      {
         addrset_purge(wr->as);
+        wr->cover_incremental = 0;
+      }
     }
     else
     {
@@ -1807,6 +2031,8 @@ static void free_wr_prd_match (const struct ddsi_domaingv *gv, const ddsi_guid_t
     (void) wr_guid;
 #endif
     nn_lat_estim_fini (&m->hb_to_ack_latency);
+    if (m->filter)
+      ddsi_filter_free (m->filter);
     ddsrt_free (m);
   }
 }
@@ -1900,10 +2126,11 @@ static void writer_drop_connection (const struct ddsi_guid *wr_guid, const struc
     {
       struct whc_state whcst;
       ddsrt_avl_delete (&wr_readers_treedef, &wr->readers, m);
-      rebuild_writer_addrset (wr);
+      writer_addrset_remove_reader (wr, m, prd);
       remove_acked_messages (wr, &whcst, &deferred_free_list);
       wr->num_readers--;
       wr->num_reliable_readers -= m->is_reliable;
+      wr->num_filtered_readers -= (m->filter != NULL);
     }
 
     ddsrt_mutex_unlock (&wr->e.lock);
@@ -2201,6 +2428,29 @@ static void proxy_reader_drop_connection (const struct ddsi_guid *prd_guid, stru
   }
 }
 
+static void writer_start_historical_data (struct writer *wr, const struct proxy_reader *prd, struct wr_prd_match *m)
+{
+  /* A reliable late joiner of a transient-local writer gets the contents of the WHC
+     streamed to it (see handle_xevk_historical_data) rather than having to NACK its
+     way through it; samples beyond what has been transmitted already will reach it
+     in the normal way.  Built-in writers are left to the regular mechanism. */
+  struct ddsi_domaingv * const gv = wr->e.gv;
+  struct whc_state whcst;
+  const seqno_t seq_xmit = writer_read_seq_xmit (wr);
+  ASSERT_MUTEX_HELD (&wr->e.lock);
+  if (!m->is_reliable || m->seq == MAX_SEQ_NUMBER || prd->c.xqos->durability.kind == DDS_DURABILITY_VOLATILE ||
+      gv->config.max_historical_data_burst_size == 0 || is_builtin_entityid (wr->e.guid.entityid, NN_VENDORID_ECLIPSE))
+    return;
+  whc_get_state (wr->whc, &whcst);
+  if (WHCST_ISEMPTY (&whcst) || whcst.min_seq > seq_xmit)
+    return;
+  m->hist_seq = whcst.min_seq;
+  m->hist_maxseq = seq_xmit;
+  m->hist_xevent = qxev_historical_data (wr->evq, ddsrt_time_monotonic (), &wr->e.guid, &prd->e.guid);
+  ELOGDISC (wr, "  writer_start_historical_data(wr "PGUIDFMT" prd "PGUIDFMT") %"PRId64"..%"PRId64"\n",
+            PGUID (wr->e.guid), PGUID (prd->e.guid), m->hist_seq, m->hist_maxseq);
+}
+
 static void writer_add_connection (struct writer *wr, struct proxy_reader *prd, int64_t crypto_handle)
 {
   struct wr_prd_match *m = ddsrt_malloc (sizeof (*m));
@@ -2208,11 +2458,15 @@ static void writer_add_connection (struct writer *wr, struct proxy_reader *prd,
   int pretend_everything_acked;
   m->prd_guid = prd->e.guid;
   m->is_reliable = (prd->c.xqos->reliability.kind > DDS_RELIABILITY_BEST_EFFORT);
+  m->in_cover_locs = 0;
   m->assumed_in_sync = (wr->e.gv->config.retransmit_merging == REXMIT_MERGE_ALWAYS);
   m->has_replied_to_hb = !m->is_reliable;
   m->all_have_replied_to_hb = 0;
   m->non_responsive_count = 0;
   m->rexmit_requests = 0;
+  m->filter = NULL;
+  m->hist_xevent = NULL;
+  m->hist_seq = m->hist_maxseq = 0;
 #ifdef DDSI_INCLUDE_SECURITY
   m->crypto_handle = crypto_handle;
 #else
@@ -2236,11 +2490,16 @@ static void writer_add_connection (struct writer *wr, struct proxy_reader *prd,
   {
     pretend_everything_acked = 0;
   }
+  if (prd->content_filter && !prd->deleting)
+    m->filter = ddsi_filter_new_from_property (wr->topic, prd->content_filter);
   ddsrt_mutex_unlock (&prd->e.lock);
   m->prev_acknack = 0;
   m->prev_nackfrag = 0;
   nn_lat_estim_init (&m->hb_to_ack_latency);
   m->hb_to_ack_latency_tlastlog = ddsrt_time_wallclock ();
+  m->t_ackhb.v = 0;
+  m->t_ack.v = 0;
+  m->ack_latency = 0;
   m->t_acknack_accepted.v = 0;
   m->t_nackfrag_accepted.v = 0;
 
@@ -2256,6 +2515,8 @@ static void writer_add_connection (struct writer *wr, struct proxy_reader *prd,
               PGUID (wr->e.guid), PGUID (prd->e.guid));
     ddsrt_mutex_unlock (&wr->e.lock);
     nn_lat_estim_fini (&m->hb_to_ack_latency);
+    if (m->filter)
+      ddsi_filter_free (m->filter);
     ddsrt_free (m);
   }
   else
@@ -2263,9 +2524,11 @@ static void writer_add_connection (struct writer *wr, struct proxy_reader *prd,
     ELOGDISC (wr, "  writer_add_connection(wr "PGUIDFMT" prd "PGUIDFMT") - ack seq %"PRId64"\n",
               PGUID (wr->e.guid), PGUID (prd->e.guid), m->seq);
     ddsrt_avl_insert_ipath (&wr_readers_treedef, &wr->readers, m, &path);
-    rebuild_writer_addrset (wr);
+    writer_addrset_add_reader (wr, m, prd);
     wr->num_readers++;
     wr->num_reliable_readers += m->is_reliable;
+    wr->num_filtered_readers += (m->filter != NULL);
+    writer_start_historical_data (wr, prd, m);
     ddsrt_mutex_unlock (&wr->e.lock);
 
     if (wr->status_cb)
@@ -2310,6 +2573,11 @@ static void deliver_historical_data (const struct writer *wr, const struct reade
   struct ddsi_tkmap * const tkmap = gv->m_tkmap;
   struct whc_sample_iter it;
   struct whc_borrowed_sample sample;
+  struct ddsi_rhc_batch_sample *batch = NULL;
+  uint32_t n = 0, size = 0;
+  /* Convert all samples first, then insert them in one go so that the reader history
+     cache lock is taken only once and the reader gets a single data available
+     notification, rather than one per sample */
   /* FIXME: should limit ourselves to what it is available because of durability history, not writer history */
   whc_sample_iter_init (wr->whc, &it);
   while (whc_sample_iter_borrow_next (&it, &sample))
@@ -2322,14 +2590,27 @@ static void deliver_historical_data (const struct writer *wr, const struct reade
     }
     else
     {
-      struct ddsi_writer_info wrinfo;
-      struct ddsi_tkmap_instance *tk = ddsi_tkmap_lookup_instance_ref (tkmap, payload);
-      ddsi_make_writer_info (&wrinfo, &wr->e, wr->xqos, payload->statusinfo);
-      (void) ddsi_rhc_store (rd->rhc, &wrinfo, payload, tk);
-      ddsi_tkmap_instance_unref (tkmap, tk);
-      ddsi_serdata_unref (payload);
+      if (n == size)
+      {
+        size = (size == 0) ? 64 : 2 * size;
+        batch = ddsrt_realloc (batch, size * sizeof (*batch));
+      }
+      ddsi_make_writer_info (&batch[n].wrinfo, &wr->e, wr->xqos, payload->statusinfo);
+      batch[n].sample = payload;
+      batch[n].tk = ddsi_tkmap_lookup_instance_ref (tkmap, payload);
+      n++;
     }
   }
+  if (n > 0)
+  {
+    (void) ddsi_rhc_store_batch (rd->rhc, n, batch);
+    for (uint32_t i = 0; i < n; i++)
+    {
+      ddsi_tkmap_instance_unref (tkmap, batch[i].tk);
+      ddsi_serdata_unref (batch[i].sample);
+    }
+  }
+  ddsrt_free (batch);
 }
 
 static void writer_add_local_connection (struct writer *wr, struct reader *rd)
@@ -3613,11 +3894,30 @@ int writer_set_notalive (struct writer *wr, bool notify)
   return ret;
 }
 
+static uint32_t writer_fec_group_size (const struct writer *wr)
+{
+  /* Forward error correction of fragmented samples is opt-in through a
+     property and only used for best-effort writers */
+  struct ddsi_domaingv * const gv = wr->e.gv;
+  const char *value;
+  char *endp;
+  long long n;
+  if (wr->reliable || !ddsi_xqos_find_prop (wr->xqos, "cyclonedds.fec.group_size", &value))
+    return 0;
+  if (ddsrt_strtoll (value, &endp, 10, &n) != DDS_RETCODE_OK || *endp != 0 || n < 0 || n > UINT16_MAX)
+  {
+    GVWARNING ("writer "PGUIDFMT": invalid value \"%s\" for cyclonedds.fec.group_size, forward error correction disabled\n", PGUID (wr->e.guid), value);
+    return 0;
+  }
+  return (uint32_t) n;
+}
+
 static void new_writer_guid_common_init (struct writer *wr, const struct ddsi_sertopic *topic, const struct dds_qos *xqos, struct whc *whc, status_cb_t status_cb, void * status_entity)
 {
   ddsrt_cond_init (&wr->throttle_cond);
   wr->seq = 0;
   wr->cs_seq = 0;
+  wr->in_coherent_set = 0;
   ddsrt_atomic_st64 (&wr->seq_xmit, (uint64_t) 0);
   wr->hbcount = 1;
   wr->state = WRST_OPERATIONAL;
@@ -3630,13 +3930,16 @@ static void new_writer_guid_common_init (struct writer *wr, const struct ddsi_se
   wr->t_whc_high_upd.v = 0;
   wr->num_readers = 0;
   wr->num_reliable_readers = 0;
+  wr->num_filtered_readers = 0;
   wr->num_acks_received = 0;
   wr->num_nacks_received = 0;
+  wr->num_heartbeats_sent = 0;
   wr->throttle_count = 0;
   wr->throttle_tracing = 0;
   wr->rexmit_count = 0;
   wr->rexmit_lost_count = 0;
   wr->rexmit_bytes = 0;
+  wr->filtered_count = 0;
   wr->time_throttled = 0;
   wr->time_retransmit = 0;
   wr->force_md5_keyhash = 0;
@@ -3678,6 +3981,10 @@ static void new_writer_guid_common_init (struct writer *wr, const struct ddsi_se
             (wr->e.guid.entityid.u == NN_ENTITYID_P2P_BUILTIN_PARTICIPANT_STATELESS_MESSAGE_WRITER));
   }
   wr->handle_as_transient_local = (wr->xqos->durability.kind == DDS_DURABILITY_TRANSIENT_LOCAL);
+  wr->congestion_control = (wr->reliable && wr->e.gv->config.congestion_control_enable && !is_builtin_entityid (wr->e.guid.entityid, NN_VENDORID_ECLIPSE));
+  wr->adaptive_heartbeat = (wr->reliable && wr->e.gv->config.adaptive_heartbeats);
+  ddsi_congestion_init (&wr->cc, &wr->e.gv->config, ddsrt_time_monotonic ());
+  wr->fec_group_size = writer_fec_group_size (wr);
   wr->include_keyhash =
     wr->e.gv->config.generate_keyhash &&
     ((wr->e.guid.entityid.u & NN_ENTITYID_KIND_MASK) == NN_ENTITYID_KIND_WRITER_WITH_KEY);
@@ -3789,6 +4096,11 @@ static void new_writer_guid_common_init (struct writer *wr, const struct ddsi_se
   /* Connection admin */
   ddsrt_avl_init (&wr_readers_treedef, &wr->readers);
   ddsrt_avl_init (&wr_local_readers_treedef, &wr->local_readers);
+  ddsrt_avl_init (&wr_cover_locs_treedef, &wr->cover_locs);
+  wr->cover_incremental = 0;
+  wr->min_receive_buffer_size = UINT32_MAX;
+  wr->min_receive_buffer_size_count = 0;
+  wr->num_incremental_addrset_updates = 0;
 
   local_reader_ary_init (&wr->rdary);
 }
@@ -3953,6 +4265,7 @@ static void gc_delete_writer (struct gcreq *gcreq)
     reader_drop_local_connection (&m->rd_guid, wr);
     free_wr_rd_match (m);
   }
+  ddsrt_avl_free (&wr_cover_locs_treedef, &wr->cover_locs, ddsrt_free);
   if (wr->lease_duration != NULL)
   {
     assert (wr->lease_duration->ldur == DDS_DURATION_INVALID);
@@ -4337,6 +4650,7 @@ static dds_return_t new_reader_guid
   rd->handle_as_transient_local = (rd->xqos->durability.kind == DDS_DURABILITY_TRANSIENT_LOCAL) ||
                                   (rd->e.guid.entityid.u == NN_ENTITYID_P2P_BUILTIN_PARTICIPANT_VOLATILE_SECURE_READER);
   rd->topic = ddsi_sertopic_ref (topic);
+  rd->content_filter = NULL;
   rd->ddsi2direct_cb = 0;
   rd->ddsi2direct_cbarg = 0;
   rd->init_acknack_count = 1;
@@ -4501,6 +4815,7 @@ static void gc_delete_reader (struct gcreq *gcreq)
     (rd->status_cb) (rd->status_cb_entity, NULL);
   }
   ddsi_sertopic_unref ((struct ddsi_sertopic *) rd->topic);
+  ddsi_content_filter_property_free (rd->content_filter);
 
   ddsi_xqos_fini (rd->xqos);
   ddsrt_free (rd->xqos);
@@ -4536,6 +4851,22 @@ void update_reader_qos (struct reader *rd, const dds_qos_t *xqos)
   ddsrt_mutex_unlock (&rd->e.lock);
 }
 
+void update_reader_content_filter (struct reader *rd, const nn_content_filter_property_t *content_filter)
+{
+  nn_content_filter_property_t *old;
+  ddsrt_mutex_lock (&rd->e.lock);
+  if (ddsi_content_filter_property_equal (rd->content_filter, content_filter))
+    old = NULL;
+  else
+  {
+    old = rd->content_filter;
+    rd->content_filter = content_filter ? ddsi_content_filter_property_dup (content_filter) : NULL;
+    sedp_write_reader (rd);
+  }
+  ddsrt_mutex_unlock (&rd->e.lock);
+  ddsi_content_filter_property_free (old);
+}
+
 /* PROXY-PARTICIPANT ------------------------------------------------ */
 static void proxy_participant_replace_minl (struct proxy_participant *proxypp, bool manbypp, struct lease *lnew)
 {
@@ -4634,7 +4965,7 @@ static void create_proxy_builtin_endpoints(
       assert (is_builtin_entityid (guid1.entityid, proxypp->vendor));
       if (is_writer_entityid (guid1.entityid))
       {
-        new_proxy_writer (gv, ppguid, &guid1, proxypp->as_meta, &plist_wr, gv->builtins_dqueue, gv->xevents, timestamp, 0);
+        new_proxy_writer (gv, ppguid, &guid1, proxypp->as_meta, &plist_wr, builtins_dqueue_for_prefix (gv, &ppguid->prefix), gv->xevents, timestamp, 0);
       }
       else
       {
@@ -5512,6 +5843,11 @@ int new_proxy_writer (struct ddsi_domaingv *gv, const struct ddsi_guid *ppguid,
        and a sufficiently high transport_priority deliver
        synchronously */
     pwr->deliver_synchronously = 1;
+  } else if (addrset_contains_kind (as, NN_LOCATOR_KIND_SHM)) {
+    /* Samples from a writer on the same host may be references to shared
+       memory, which must be resolved before they are acknowledged, for after
+       that the writer may release the memory */
+    pwr->deliver_synchronously = 1;
   } else {
     pwr->deliver_synchronously = 0;
   }
@@ -5546,11 +5882,11 @@ int new_proxy_writer (struct ddsi_domaingv *gv, const struct ddsi_guid *ppguid,
 
   if (isreliable)
   {
-    pwr->defrag = nn_defrag_new (&gv->logconfig, NN_DEFRAG_DROP_LATEST, gv->config.defrag_reliable_maxsamples);
+    pwr->defrag = nn_defrag_new (&gv->logconfig, NN_DEFRAG_DROP_LATEST, gv->config.defrag_reliable_maxsamples, gv->config.defrag_direct_min_size);
   }
   else
   {
-    pwr->defrag = nn_defrag_new (&gv->logconfig, NN_DEFRAG_DROP_OLDEST, gv->config.defrag_unreliable_maxsamples);
+    pwr->defrag = nn_defrag_new (&gv->logconfig, NN_DEFRAG_DROP_OLDEST, gv->config.defrag_unreliable_maxsamples, gv->config.defrag_direct_min_size);
   }
   reorder_mode = get_proxy_writer_reorder_mode(pwr->e.guid.entityid, isreliable);
   pwr->reorder = nn_reorder_new (&gv->logconfig, reorder_mode, gv->config.primary_reorder_maxsamples, gv->config.late_ack_mode);
@@ -5569,6 +5905,7 @@ int new_proxy_writer (struct ddsi_domaingv *gv, const struct ddsi_guid *ppguid,
 
   pwr->dqueue = dqueue;
   pwr->evq = evq;
+  pwr->coherent_set = NULL;
   pwr->ddsi2direct_cb = 0;
   pwr->ddsi2direct_cbarg = 0;
 
@@ -5626,7 +5963,62 @@ void update_proxy_writer (struct proxy_writer *pwr, seqno_t seq, struct addrset
   ddsrt_mutex_unlock (&pwr->e.lock);
 }
 
-void update_proxy_reader (struct proxy_reader *prd, seqno_t seq, struct addrset *as, const struct dds_qos *xqos, ddsrt_wctime_t timestamp)
+static void writer_set_reader_filter (struct writer *wr, const ddsi_guid_t *prd_guid, struct ddsi_filter *filter)
+{
+  /* the filters of the matched proxy readers are only evaluated while holding
+     wr->e.lock, so the old one can be freed once it has been replaced */
+  struct wr_prd_match *m;
+  ddsrt_mutex_lock (&wr->e.lock);
+  if ((m = ddsrt_avl_lookup (&wr_readers_treedef, &wr->readers, prd_guid)) != NULL)
+  {
+    struct ddsi_filter * const old = m->filter;
+    wr->num_filtered_readers -= (old != NULL);
+    wr->num_filtered_readers += (filter != NULL);
+    m->filter = filter;
+    filter = old;
+  }
+  ddsrt_mutex_unlock (&wr->e.lock);
+  if (filter)
+    ddsi_filter_free (filter);
+}
+
+static void proxy_reader_update_content_filter (struct proxy_reader *prd, const nn_content_filter_property_t *content_filter)
+{
+  /* on entry: prd->e.lock held; on exit: also held but released in between */
+  struct prd_wr_match *m;
+  ddsi_guid_t wrguid;
+  nn_content_filter_property_t *old = prd->content_filter;
+  prd->content_filter = content_filter ? ddsi_content_filter_property_dup (content_filter) : NULL;
+
+  memset (&wrguid, 0, sizeof (wrguid));
+  while ((m = ddsrt_avl_lookup_succ_eq (&prd_writers_treedef, &prd->writers, &wrguid)) != NULL)
+  {
+    struct prd_wr_match *next;
+    ddsi_guid_t guid_next;
+    struct writer *wr;
+
+    wrguid = m->wr_guid;
+    if ((next = ddsrt_avl_find_succ (&prd_writers_treedef, &prd->writers, m)) != NULL)
+      guid_next = next->wr_guid;
+    else
+    {
+      memset (&guid_next, 0xff, sizeof (guid_next));
+      guid_next.entityid.u = (guid_next.entityid.u & ~(unsigned)0xff) | NN_ENTITYID_KIND_WRITER_NO_KEY;
+    }
+
+    ddsrt_mutex_unlock (&prd->e.lock);
+    if ((wr = entidx_lookup_writer_guid (prd->e.gv->entity_index, &wrguid)) != NULL)
+    {
+      struct ddsi_filter *filter = content_filter ? ddsi_filter_new_from_property (wr->topic, content_filter) : NULL;
+      writer_set_reader_filter (wr, &prd->e.guid, filter);
+    }
+    wrguid = guid_next;
+    ddsrt_mutex_lock (&prd->e.lock);
+  }
+  ddsi_content_filter_property_free (old);
+}
+
+void update_proxy_reader (struct proxy_reader *prd, seqno_t seq, struct addrset *as, const struct dds_qos *xqos, const nn_content_filter_property_t *content_filter, ddsrt_wctime_t timestamp)
 {
   struct prd_wr_match * m;
   ddsi_guid_t wrguid;
@@ -5679,6 +6071,9 @@ void update_proxy_reader (struct proxy_reader *prd, seqno_t seq, struct addrset
       }
     }
 
+    if (!ddsi_content_filter_property_equal (prd->content_filter, content_filter))
+      proxy_reader_update_content_filter (prd, content_filter);
+
     (void) update_qos_locked (&prd->e, prd->c.xqos, xqos, timestamp);
   }
   ddsrt_mutex_unlock (&prd->e.lock);
@@ -5706,6 +6101,7 @@ static void gc_delete_proxy_writer (struct gcreq *gcreq)
   proxy_endpoint_common_fini (&pwr->e, &pwr->c);
   nn_defrag_free (pwr->defrag);
   nn_reorder_free (pwr->reorder);
+  coherent_set_buffer_free (pwr->coherent_set);
   ddsrt_free (pwr);
 }
 
@@ -5852,6 +6248,10 @@ int new_proxy_reader (struct ddsi_domaingv *gv, const struct ddsi_guid *ppguid,
 #endif
   prd->is_fict_trans_reader = 0;
   prd->receive_buffer_size = proxypp->receive_buffer_size;
+  if (plist->present & PP_CONTENT_FILTER_PROPERTY)
+    prd->content_filter = ddsi_content_filter_property_dup (&plist->content_filter_property);
+  else
+    prd->content_filter = NULL;
 
   ddsrt_avl_init (&prd_writers_treedef, &prd->writers);
 
@@ -5938,6 +6338,7 @@ static void gc_delete_proxy_reader (struct gcreq *gcreq)
 #ifdef DDSI_INCLUDE_SECURITY
   q_omg_security_deregister_remote_reader(prd);
 #endif
+  ddsi_content_filter_property_free (prd->content_filter);
   proxy_endpoint_common_fini (&prd->e, &prd->c);
   ddsrt_free (prd);
 }
@@ -56,6 +56,7 @@
 #include "dds/ddsi/ddsi_udp.h"
 #include "dds/ddsi/ddsi_tcp.h"
 #include "dds/ddsi/ddsi_raweth.h"
+#include "dds/ddsi/ddsi_shm.h"
 #include "dds/ddsi/ddsi_mcgroup.h"
 #include "dds/ddsi/ddsi_serdata_default.h"
 #include "dds/ddsi/ddsi_serdata_pserop.h"
@@ -934,6 +935,14 @@ static int setup_and_start_recv_threads (struct ddsi_domaingv *gv)
       gv->n_recv_threads++;
     }
   }
+  if (gv->shm_conn)
+  {
+    gv->recv_threads[gv->n_recv_threads].name = "recvSHM";
+    gv->recv_threads[gv->n_recv_threads].arg.mode = RTM_SINGLE;
+    gv->recv_threads[gv->n_recv_threads].arg.u.single.conn = gv->shm_conn;
+    gv->recv_threads[gv->n_recv_threads].arg.u.single.loc = &gv->loc_shm;
+    gv->n_recv_threads++;
+  }
   assert (gv->n_recv_threads <= MAX_RECV_THREADS);
 
   /* For each thread, create rbufpool and waitset if needed, then start it */
@@ -1010,11 +1019,73 @@ void ddsi_set_deafmute (struct ddsi_domaingv *gv, bool deaf, bool mute, int64_t
   GVLOGDISC ("\n");
 }
 
+static int create_xmit_classes (struct ddsi_domaingv *gv)
+{
+  const char *spec = gv->config.priority_scheduling_diffserv;
+  gv->n_xmit_classes = 0;
+  gv->xmit_classes = NULL;
+  if (spec == NULL || *spec == 0)
+    return 0;
+  if (!gv->m_factory->m_connless)
+  {
+    GVWARNING ("Internal/PriorityScheduling/DiffServ: not supported for %s, ignored\n", gv->m_factory->m_typename);
+    return 0;
+  }
+
+  char *copy = ddsrt_strdup (spec), *cursor = copy, *tok;
+  while ((tok = ddsrt_strsep (&cursor, ",")) != NULL)
+  {
+    int32_t prio;
+    int dscp, pos;
+    if (sscanf (tok, "%"SCNd32":%d%n", &prio, &dscp, &pos) != 2 || dscp < 0 || dscp > 63)
+      goto err_invalid;
+    while (isspace ((unsigned char) tok[pos]))
+      pos++;
+    if (tok[pos] != 0)
+      goto err_invalid;
+
+    /* keep them sorted by decreasing priority so the lookup can stop at the first match */
+    uint32_t i;
+    for (i = 0; i < gv->n_xmit_classes && gv->xmit_classes[i].min_priority > prio; i++)
+      ;
+    if (i < gv->n_xmit_classes && gv->xmit_classes[i].min_priority == prio)
+      goto err_invalid;
+    gv->xmit_classes = ddsrt_realloc (gv->xmit_classes, (gv->n_xmit_classes + 1) * sizeof (*gv->xmit_classes));
+    memmove (&gv->xmit_classes[i + 1], &gv->xmit_classes[i], (gv->n_xmit_classes - i) * sizeof (*gv->xmit_classes));
+    struct ddsi_xmit_class * const xc = &gv->xmit_classes[i];
+    const ddsi_tran_qos_t qos = { .m_purpose = DDSI_TRAN_QOS_XMIT, .m_diffserv = dscp << 2 };
+    xc->min_priority = prio;
+    xc->diffserv = qos.m_diffserv;
+    if (ddsi_factory_create_conn (&xc->conn, gv->m_factory, 0, &qos) != DDS_RETCODE_OK)
+    {
+      GVERROR ("Internal/PriorityScheduling/DiffServ: failed to create transmit socket for class '%s'\n", tok);
+      memmove (&gv->xmit_classes[i], &gv->xmit_classes[i + 1], (gv->n_xmit_classes - i) * sizeof (*gv->xmit_classes));
+      goto err;
+    }
+    gv->n_xmit_classes++;
+    GVLOG (DDS_LC_CONFIG, "transmit class priority >= %"PRId32": DSCP %d port %"PRIu32"\n", prio, dscp, ddsi_conn_port (xc->conn));
+  }
+  ddsrt_free (copy);
+  return 0;
+
+err_invalid:
+  GVERROR ("Internal/PriorityScheduling/DiffServ: invalid or duplicate transmit class '%s'\n", tok);
+err:
+  ddsrt_free (copy);
+  return -1;
+}
+
 static void free_conns (struct ddsi_domaingv *gv)
 {
+  for (uint32_t i = 0; i < gv->n_xmit_classes; i++)
+    ddsi_conn_free (gv->xmit_classes[i].conn);
+  ddsrt_free (gv->xmit_classes);
+  gv->n_xmit_classes = 0;
+  gv->xmit_classes = NULL;
+
   // Depending on settings, various "conn"s can alias others, this makes sure we free each one only once
   // FIXME: perhaps store them in a table instead?
-  ddsi_tran_conn_t cs[] = { gv->xmit_conn, gv->disc_conn_mc, gv->data_conn_mc, gv->disc_conn_uc, gv->data_conn_uc };
+  ddsi_tran_conn_t cs[] = { gv->xmit_conn, gv->disc_conn_mc, gv->data_conn_mc, gv->disc_conn_uc, gv->data_conn_uc, gv->shm_conn };
   for (size_t i = 0; i < sizeof (cs) / sizeof (cs[0]); i++)
   {
     if (cs[i] == NULL)
@@ -1042,6 +1113,10 @@ int rtps_init (struct ddsi_domaingv *gv)
   gv->disc_conn_mc = NULL;
   gv->data_conn_mc = NULL;
   gv->xmit_conn = NULL;
+  gv->n_xmit_classes = 0;
+  gv->xmit_classes = NULL;
+  gv->shm_conn = NULL;
+  set_unspec_locator (&gv->loc_shm);
   gv->listener = NULL;
   gv->thread_pool = NULL;
   gv->debmon = NULL;
@@ -1082,6 +1157,8 @@ int rtps_init (struct ddsi_domaingv *gv)
       if (ddsi_udp_init (gv) < 0)
         goto err_udp_tcp_init;
       gv->m_factory = ddsi_factory_find (gv, gv->config.transport_selector == TRANS_UDP ? "udp" : "udp6");
+      if (ddsi_shm_init (gv) < 0)
+        goto err_udp_tcp_init;
       break;
     case TRANS_TCP:
     case TRANS_TCP6:
@@ -1268,7 +1345,7 @@ int rtps_init (struct ddsi_domaingv *gv)
 
   ddsrt_mutex_init (&gv->lock);
   ddsrt_mutex_init (&gv->spdp_lock);
-  gv->spdp_defrag = nn_defrag_new (&gv->logconfig, NN_DEFRAG_DROP_OLDEST, gv->config.defrag_unreliable_maxsamples);
+  gv->spdp_defrag = nn_defrag_new (&gv->logconfig, NN_DEFRAG_DROP_OLDEST, gv->config.defrag_unreliable_maxsamples, 0);
   gv->spdp_reorder = nn_reorder_new (&gv->logconfig, NN_REORDER_MODE_ALWAYS_DELIVER, gv->config.primary_reorder_maxsamples, false);
 
   gv->m_tkmap = ddsi_tkmap_new (gv);
@@ -1417,6 +1494,28 @@ int rtps_init (struct ddsi_domaingv *gv)
     if (rc != DDS_RETCODE_OK)
       goto err_mc_conn;
   }
+  if (create_xmit_classes (gv) < 0)
+    goto err_mc_conn;
+
+  /* Shared memory receive ring for peers on the same host, named after the unicast
+     data port because that one is guaranteed to be unique for this transport and
+     network namespace; failure to create it is not fatal, UDP over the loopback
+     interface works just as well */
+  {
+    ddsi_tran_factory_t shm_factory;
+    if ((shm_factory = ddsi_factory_find (gv, "shm")) != NULL && gv->config.many_sockets_mode != MSM_NO_UNICAST)
+    {
+      const ddsi_tran_qos_t qos = { .m_purpose = DDSI_TRAN_QOS_RECV_UC, .m_diffserv = 0 };
+      if (ddsi_factory_create_conn (&gv->shm_conn, shm_factory, ddsi_conn_port (gv->data_conn_uc), &qos) != DDS_RETCODE_OK)
+        GVWARNING ("failed to create shared memory transport, falling back to UDP\n");
+      else
+      {
+        char buf[DDSI_LOCSTRLEN];
+        ddsi_conn_locator (gv->shm_conn, &gv->loc_shm);
+        GVLOG (DDS_LC_CONFIG, "shared memory locator: %s\n", ddsi_locator_to_string (buf, sizeof (buf), &gv->loc_shm));
+      }
+    }
+  }
 
 #ifdef DDSI_INCLUDE_NETWORK_CHANNELS
   {
@@ -1532,7 +1631,15 @@ int rtps_init (struct ddsi_domaingv *gv)
     nn_xpack_sendq_start (gv);
   }
 
-  gv->builtins_dqueue = nn_dqueue_new ("builtins", gv, gv->config.delivery_queue_maxsamples, builtins_dqueue_handler, NULL);
+  gv->n_builtins_dqueues = (gv->config.builtin_delivery_queues > 0) ? gv->config.builtin_delivery_queues : 1;
+  gv->builtins_dqueues = ddsrt_malloc (gv->n_builtins_dqueues * sizeof (*gv->builtins_dqueues));
+  gv->builtins_dqueues[0] = nn_dqueue_new ("builtins", gv, gv->config.delivery_queue_maxsamples, builtins_dqueue_handler, NULL);
+  for (uint32_t i = 1; i < gv->n_builtins_dqueues; i++)
+  {
+    char name[24];
+    (void) snprintf (name, sizeof (name), "builtins%"PRIu32, i);
+    gv->builtins_dqueues[i] = nn_dqueue_new (name, gv, gv->config.delivery_queue_maxsamples, builtins_dqueue_handler, NULL);
+  }
 #ifdef DDSI_INCLUDE_NETWORK_CHANNELS
   for (struct config_channel_listelem *chptr = gv->config.channels; chptr; chptr = chptr->next)
     chptr->dqueue = nn_dqueue_new (chptr->name, &gv->config, gv->config.delivery_queue_maxsamples, user_dqueue_handler, NULL);
@@ -1731,15 +1838,16 @@ void rtps_stop (struct ddsi_domaingv *gv)
   }
 #endif /* DDSI_INCLUDE_NETWORK_CHANNELS */
 
-  /* Send a bubble through the delivery queue for built-ins, so that any
+  /* Send a bubble through the delivery queues for built-ins, so that any
      pending proxy participant discovery is finished before we start
      deleting them */
+  for (uint32_t i = 0; i < gv->n_builtins_dqueues; i++)
   {
     struct dq_builtins_ready_arg arg;
     ddsrt_mutex_init (&arg.lock);
     ddsrt_cond_init (&arg.cond);
     arg.ready = 0;
-    nn_dqueue_enqueue_callback(gv->builtins_dqueue, builtins_dqueue_ready_cb, &arg);
+    nn_dqueue_enqueue_callback(gv->builtins_dqueues[i], builtins_dqueue_ready_cb, &arg);
     ddsrt_mutex_lock (&arg.lock);
     while (!arg.ready)
       ddsrt_cond_wait (&arg.cond, &arg.lock);
@@ -1842,7 +1950,9 @@ void rtps_fini (struct ddsi_domaingv *gv)
   /* No new data gets added to any admin, all synchronous processing
      has ended, so now we can drain the delivery queues to end up with
      the expected reference counts all over the radmin thingummies. */
-  nn_dqueue_free (gv->builtins_dqueue);
+  for (uint32_t i = 0; i < gv->n_builtins_dqueues; i++)
+    nn_dqueue_free (gv->builtins_dqueues[i]);
+  ddsrt_free (gv->builtins_dqueues);
 
 #ifdef DDSI_INCLUDE_NETWORK_CHANNELS
   chptr = gv->config.channels;
@@ -14,6 +14,7 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <string.h>
 
 #if HAVE_VALGRIND && ! defined (NDEBUG)
 #include <memcheck.h>
@@ -240,7 +241,10 @@
    alternative would blow up nearly instantaneously.  Maybe not if you
    drop samples halfway through defragmenting aggressively, but then
    you can't get anything through anymore if there are multiple
-   writers.
+   writers.  For very large samples, however, holding on to all
+   those receive buffers is worse, and so that alternative is used
+   for samples above a configurable size (see DEFRAG), relying on the
+   limit on the number of samples in the defragmenter.
 
    Gaps and Heartbeats prune the defragmenting index and are (when
    needed) stored as intervals of specially marked rdatas in the
@@ -286,6 +290,12 @@ struct nn_rbufpool {
   uint32_t max_rmsg_size;
   const struct ddsrt_log_cfg *logcfg;
   bool trace;
+  /* Number of payload bytes retained beyond delivery by nn_rmsg_retain */
+  ddsrt_atomic_uint32_t retained;
+  /* Number of rbufs kept alive by retained payload, see nn_rmsg_retain */
+  ddsrt_atomic_uint32_t pinned;
+  /* Number of rbufs allocated and not yet freed, for statistics */
+  ddsrt_atomic_uint32_t n_rbufs;
 #ifndef NDEBUG
   /* Thread that owns this pool, so we can check that no other thread
      is calling functions only the owner may use. */
@@ -295,6 +305,7 @@ struct nn_rbufpool {
 
 static struct nn_rbuf *nn_rbuf_alloc_new (struct nn_rbufpool *rbp);
 static void nn_rbuf_release (struct nn_rbuf *rbuf);
+static void nn_rbuf_unpin_retainers (struct nn_rbuf *rbuf);
 
 #define TRACE_CFG(obj, logcfg, ...) ((obj)->trace ? (void) DDS_CLOG (DDS_LC_RADMIN, (logcfg), __VA_ARGS__) : (void) 0)
 #define TRACE(obj, ...)             TRACE_CFG ((obj), (obj)->logcfg, __VA_ARGS__)
@@ -361,6 +372,9 @@ struct nn_rbufpool *nn_rbufpool_new (const struct ddsrt_log_cfg *logcfg, uint32_
   rbp->max_rmsg_size = max_rmsg_size;
   rbp->logcfg = logcfg;
   rbp->trace = (logcfg->c.mask & DDS_LC_RADMIN) != 0;
+  ddsrt_atomic_st32 (&rbp->retained, 0);
+  ddsrt_atomic_st32 (&rbp->pinned, 0);
+  ddsrt_atomic_st32 (&rbp->n_rbufs, 0);
 
 #if USE_VALGRIND
   VALGRIND_CREATE_MEMPOOL (rbp, 0, 0);
@@ -404,14 +418,33 @@ void nn_rbufpool_free (struct nn_rbufpool *rbp)
   ddsrt_free (rbp);
 }
 
+void nn_rbufpool_stats (struct nn_rbufpool *rbp, uint32_t *n_rbufs, uint32_t *rbuf_size, uint32_t *retained)
+{
+  *n_rbufs = ddsrt_atomic_ld32 (&rbp->n_rbufs);
+  *rbuf_size = rbp->rbuf_size;
+  *retained = ddsrt_atomic_ld32 (&rbp->retained);
+}
+
 /* RBUF ---------------------------------------------------------------- */
 
 struct nn_rbuf {
   ddsrt_atomic_uint32_t n_live_rmsg_chunks;
+  /* Payload bytes in this rbuf retained by nn_rmsg_retain, and the number of
+     times it has been retained */
+  ddsrt_atomic_uint32_t retained;
+  ddsrt_atomic_uint32_t nretained;
+  /* Set once it is no longer the current rbuf of the pool */
+  ddsrt_atomic_uint32_t retired;
+  /* Retainers of data in this rbuf that may be asked to unpin it, protected
+     by the pool's lock */
+  struct nn_rmsg_retainer *retainers;
   uint32_t size;
   uint32_t max_rmsg_size;
   struct nn_rbufpool *rbufpool;
   bool trace;
+  /* Set for an rbuf holding just the one rmsg it was allocated for, rather
+     than being carved up by the pool (see nn_rmsg_new_standalone) */
+  bool standalone;
 
   /* Allocating sequentially, releasing in random order, not bothering
      to reuse memory as soon as it becomes available again. I think
@@ -443,10 +476,16 @@ static struct nn_rbuf *nn_rbuf_alloc_new (struct nn_rbufpool *rbp)
 
   rb->rbufpool = rbp;
   ddsrt_atomic_st32 (&rb->n_live_rmsg_chunks, 1);
+  ddsrt_atomic_st32 (&rb->retained, 0);
+  ddsrt_atomic_st32 (&rb->nretained, 0);
+  ddsrt_atomic_st32 (&rb->retired, 0);
+  rb->retainers = NULL;
+  ddsrt_atomic_inc32 (&rbp->n_rbufs);
   rb->size = rbp->rbuf_size;
   rb->max_rmsg_size = rbp->max_rmsg_size;
   rb->freeptr = rb->raw;
   rb->trace = rbp->trace;
+  rb->standalone = false;
   RBPTRACE ("rbuf_alloc_new(%p) = %p\n", (void *) rbp, (void *) rb);
   return rb;
 }
@@ -458,7 +497,11 @@ static struct nn_rbuf *nn_rbuf_new (struct nn_rbufpool *rbp)
   ASSERT_RBUFPOOL_OWNER (rbp);
   if ((rb = nn_rbuf_alloc_new (rbp)) != NULL)
   {
+    /* The old one will be freed once the last rmsg in it is, which may take
+       arbitrarily long if a sample retained by a slow reader is in it */
+    ddsrt_atomic_st32 (&rbp->current->retired, 1);
     ddsrt_mutex_lock (&rbp->lock);
+    nn_rbuf_unpin_retainers (rbp->current);
     nn_rbuf_release (rbp->current);
     rbp->current = rb;
     ddsrt_mutex_unlock (&rbp->lock);
@@ -473,6 +516,8 @@ static void nn_rbuf_release (struct nn_rbuf *rbuf)
   if (ddsrt_atomic_dec32_ov (&rbuf->n_live_rmsg_chunks) == 1)
   {
     RBPTRACE ("rbuf_release(%p) free\n", (void *) rbuf);
+    if (!rbuf->standalone)
+      ddsrt_atomic_dec32 (&rbp->n_rbufs);
     ddsrt_free (rbuf);
   }
 }
@@ -553,6 +598,53 @@ struct nn_rmsg *nn_rmsg_new (struct nn_rbufpool *rbp)
   return rmsg;
 }
 
+static struct nn_rmsg *nn_rmsg_new_standalone (struct nn_rbufpool *rbp, uint32_t size)
+{
+  /* An rmsg in an rbuf of its own with room for allocating "size" bytes from
+     it, for data that is assembled rather than received as a single packet.
+     It follows the rules of an rmsg of the pool (and in particular must be
+     created and committed by the thread owning the pool), but the rbuf is
+     freed as soon as the rmsg is. */
+  struct nn_rbuf *rb;
+  struct nn_rmsg *rmsg;
+  RBPTRACE ("rmsg_new_standalone(%p, %"PRIu32")\n", (void *) rbp, size);
+  ASSERT_RBUFPOOL_OWNER (rbp);
+  /* size may be large and is determined by the sender */
+  if ((rb = ddsrt_malloc_s (sizeof (struct nn_rbuf) + sizeof (struct nn_rmsg) + size)) == NULL)
+    return NULL;
+  rb->rbufpool = rbp;
+  ddsrt_atomic_st32 (&rb->n_live_rmsg_chunks, 0);
+  ddsrt_atomic_st32 (&rb->retained, 0);
+  ddsrt_atomic_st32 (&rb->retired, 0);
+  rb->size = (uint32_t) sizeof (struct nn_rmsg) + size;
+  rb->max_rmsg_size = size;
+  rb->trace = rbp->trace;
+  rb->standalone = true;
+  rmsg = (struct nn_rmsg *) rb->raw;
+  rb->freeptr = (unsigned char *) rmsg + rb->size;
+#if USE_VALGRIND
+  VALGRIND_MEMPOOL_ALLOC (rbp, rmsg, sizeof (struct nn_rmsg));
+#endif
+  ddsrt_atomic_st32 (&rmsg->refcount, RMSG_REFCOUNT_UNCOMMITTED_BIAS);
+  init_rmsg_chunk (&rmsg->chunk, rb);
+  rmsg->trace = rbp->trace;
+  rmsg->lastchunk = &rmsg->chunk;
+  RBPTRACE ("rmsg_new_standalone(%p, %"PRIu32") = %p\n", (void *) rbp, size, (void *) rmsg);
+  return rmsg;
+}
+
+static void nn_rmsg_commit_standalone (struct nn_rmsg *rmsg)
+{
+  /* There is no freeptr to advance in a standalone rbuf */
+  RMSGTRACE ("rmsg_commit_standalone(%p) refcount 0x%"PRIx32"\n", (void *) rmsg, rmsg->refcount.v);
+  ASSERT_RBUFPOOL_OWNER (rmsg->chunk.rbuf->rbufpool);
+  ASSERT_RMSG_UNCOMMITTED (rmsg);
+  assert (rmsg->chunk.rbuf->standalone);
+  assert (rmsg->lastchunk == &rmsg->chunk);
+  if (ddsrt_atomic_sub32_nv (&rmsg->refcount, RMSG_REFCOUNT_UNCOMMITTED_BIAS) == 0)
+    nn_rmsg_free (rmsg);
+}
+
 void nn_rmsg_setsize (struct nn_rmsg *rmsg, uint32_t size)
 {
   uint32_t size8P = align_rmsg (size);
@@ -675,6 +767,168 @@ static void nn_rmsg_unref (struct nn_rmsg *rmsg)
     nn_rmsg_free (rmsg);
 }
 
+static bool nn_rbuf_pin (struct nn_rbuf *rbuf)
+{
+  /* The first retained sample in an rbuf pins it, which is only allowed if the
+     pool has fewer than NN_RBUFPOOL_MAX_PINNED pinned rbufs */
+  struct nn_rbufpool * const rbp = rbuf->rbufpool;
+  uint32_t n, pinned;
+  while (true)
+  {
+    if ((n = ddsrt_atomic_ld32 (&rbuf->nretained)) > 0)
+    {
+      if (ddsrt_atomic_cas32 (&rbuf->nretained, n, n + 1))
+        return true;
+      continue;
+    }
+    do {
+      pinned = ddsrt_atomic_ld32 (&rbp->pinned);
+      if (pinned >= NN_RBUFPOOL_MAX_PINNED)
+        return false;
+    } while (!ddsrt_atomic_cas32 (&rbp->pinned, pinned, pinned + 1));
+    if (ddsrt_atomic_cas32 (&rbuf->nretained, 0, 1))
+      return true;
+    ddsrt_atomic_dec32 (&rbp->pinned);
+  }
+}
+
+static void nn_rbuf_unpin (struct nn_rbuf *rbuf)
+{
+  assert (ddsrt_atomic_ld32 (&rbuf->nretained) > 0);
+  if (ddsrt_atomic_dec32_ov (&rbuf->nretained) == 1)
+    ddsrt_atomic_dec32 (&rbuf->rbufpool->pinned);
+}
+
+static void nn_rmsg_release_accounting (struct nn_rmsg *rmsg, uint32_t size)
+{
+  struct nn_rbufpool * const rbp = rmsg->chunk.rbuf->rbufpool;
+  assert (ddsrt_atomic_ld32 (&rbp->retained) >= size);
+  assert (ddsrt_atomic_ld32 (&rmsg->chunk.rbuf->retained) >= size);
+  ddsrt_atomic_sub32 (&rbp->retained, size);
+  ddsrt_atomic_sub32 (&rmsg->chunk.rbuf->retained, size);
+  nn_rbuf_unpin (rmsg->chunk.rbuf);
+}
+
+static void nn_rbuf_unlink_retainer (struct nn_rbuf *rbuf, struct nn_rmsg_retainer *r)
+{
+  if (r->prev)
+    r->prev->next = r->next;
+  else
+    rbuf->retainers = r->next;
+  if (r->next)
+    r->next->prev = r->prev;
+}
+
+static void nn_rbuf_unpin_retainers (struct nn_rbuf *rbuf)
+{
+  /* Copying the retained samples out of an rbuf no longer used for receiving
+     frees it, and is worth it if they only use a small part of it.  The number
+     of pinned rbufs is limited, so that bounds the memory that stays in use
+     anyway.  Called with the pool locked, which is what the retainers rely on
+     when releasing concurrently. */
+  struct nn_rmsg_retainer *r, *rnext;
+  if (ddsrt_atomic_ld32 (&rbuf->retained) == 0 || ddsrt_atomic_ld32 (&rbuf->retained) > rbuf->size / 4)
+    return;
+  for (r = rbuf->retainers; r; r = rnext)
+  {
+    rnext = r->next;
+    if (r->unpin (r))
+    {
+      struct nn_rmsg * const rmsg = r->rmsg;
+      RBUFTRACE ("rbuf_unpin_retainers(%p) rmsg %p size %"PRIu32"\n", (void *) rbuf, (void *) rmsg, r->size);
+      nn_rbuf_unlink_retainer (rbuf, r);
+      r->rmsg = NULL;
+      nn_rmsg_release_accounting (rmsg, r->size);
+    }
+  }
+}
+
+bool nn_rmsg_retain (struct nn_rmsg *rmsg, uint32_t size, struct nn_rmsg_retainer *r)
+{
+  /* Any thread holding a reference may retain it, but a retained rmsg keeps the
+     entire rbuf it is in alive, so both the total number of bytes retained
+     (an rbuf's worth) and the number of rbufs pinned by them are limited.
+     A standalone rmsg holds little besides the data retained, so those are
+     exempt. */
+  struct nn_rbuf * const rbuf = rmsg->chunk.rbuf;
+  struct nn_rbufpool * const rbp = rbuf->rbufpool;
+  uint32_t retained;
+  r->rmsg = rmsg;
+  r->size = size;
+  r->prev = r->next = NULL;
+  r->rbufpool = NULL;
+  if (rbuf->standalone)
+  {
+    RMSGTRACE ("rmsg_retain(%p, %"PRIu32") standalone\n", (void *) rmsg, size);
+    ddsrt_atomic_inc32 (&rmsg->refcount);
+    return true;
+  }
+  if (!nn_rbuf_pin (rbuf))
+    return false;
+  do {
+    retained = ddsrt_atomic_ld32 (&rbp->retained);
+    if (size > rbp->rbuf_size - retained)
+    {
+      nn_rbuf_unpin (rbuf);
+      return false;
+    }
+  } while (!ddsrt_atomic_cas32 (&rbp->retained, retained, retained + size));
+  RMSGTRACE ("rmsg_retain(%p, %"PRIu32")\n", (void *) rmsg, size);
+  ddsrt_atomic_add32 (&rbuf->retained, size);
+  ddsrt_atomic_inc32 (&rmsg->refcount);
+  if (r->unpin)
+  {
+    r->rbufpool = rbp;
+    ddsrt_mutex_lock (&rbp->lock);
+    if ((r->next = rbuf->retainers) != NULL)
+      r->next->prev = r;
+    rbuf->retainers = r;
+    ddsrt_mutex_unlock (&rbp->lock);
+  }
+  return true;
+}
+
+void nn_rmsg_release (struct nn_rmsg_retainer *r)
+{
+  struct nn_rmsg *rmsg;
+  if (r->rbufpool == NULL)
+    rmsg = r->rmsg;
+  else
+  {
+    /* may have been unpinned, the pool's lock protects against that happening
+       concurrently */
+    ddsrt_mutex_lock (&r->rbufpool->lock);
+    if ((rmsg = r->rmsg) != NULL)
+      nn_rbuf_unlink_retainer (rmsg->chunk.rbuf, r);
+    ddsrt_mutex_unlock (&r->rbufpool->lock);
+  }
+  if (rmsg == NULL)
+    return;
+  RMSGTRACE ("rmsg_release(%p, %"PRIu32")\n", (void *) rmsg, r->size);
+  r->rmsg = NULL;
+  if (!rmsg->chunk.rbuf->standalone)
+    nn_rmsg_release_accounting (rmsg, r->size);
+  nn_rmsg_unref (rmsg);
+}
+
+void nn_rmsg_retainer_keep (struct nn_rmsg_retainer *r)
+{
+  struct nn_rbufpool * const rbp = r->rbufpool;
+  if (rbp == NULL)
+    return;
+  ddsrt_mutex_lock (&rbp->lock);
+  if (r->rbufpool != NULL && r->rmsg != NULL)
+    nn_rbuf_unlink_retainer (r->rmsg->chunk.rbuf, r);
+  r->rbufpool = NULL;
+  ddsrt_mutex_unlock (&rbp->lock);
+}
+
+void nn_rmsg_release_unpinned (struct nn_rmsg *rmsg)
+{
+  RMSGTRACE ("rmsg_release_unpinned(%p)\n", (void *) rmsg);
+  nn_rmsg_unref (rmsg);
+}
+
 void *nn_rmsg_alloc (struct nn_rmsg *rmsg, uint32_t size)
 {
   struct nn_rmsg_chunk *chunk = rmsg->lastchunk;
@@ -824,6 +1078,22 @@ static void nn_rdata_unref (struct nn_rdata *rdata)
    fragmented message will have at least one interval allocated to it
    and thus have sufficient space for the chain node.
 
+   Samples of at least direct_min_size bytes are instead reassembled
+   directly once the first fragment and at least 1/DEFRAG_DIRECT_FRACTION
+   of the sample have been received: a standalone rmsg is allocated
+   that can hold the entire sample, preceded by a copy of the
+   submessage header and inline QoS of the first fragment, the
+   fragments received so far are copied into it and every subsequent
+   fragment is copied into place on arrival.  (Waiting for part of the
+   data bounds the memory a sender can cause to be allocated by
+   announcing a large sample.)  Which fragments
+   have been received is tracked in a bitmap, and the rdatas of the
+   fragments are not retained.  A completed sample then consists of
+   a single rdata that looks just like an unfragmented sample.  This
+   avoids keeping all the receive buffers containing fragments alive
+   until the sample is complete and makes the sample contiguous, so
+   that it needn't be copied again when converting it to a serdata.
+
    FIXME: These AVL trees are overkill.  Either switch to parent-less
    red-black trees (they have better performance anyway and only need
    a single bit of state) or to splay trees (must have a parent
@@ -838,6 +1108,18 @@ struct nn_defrag_iv {
   struct nn_rdata *last;
 };
 
+struct nn_defrag_direct {
+  uint32_t fragsize;
+  uint32_t nfrags;
+  uint32_t nmissing;
+  uint32_t first_missing;
+  uint32_t bits[];              /* set for each received fragment */
+};
+
+/* Direct reassembly starts once at least 1/DEFRAG_DIRECT_FRACTION of the
+   sample has been received */
+#define DEFRAG_DIRECT_FRACTION 8
+
 struct nn_rsample {
   union {
     struct nn_rsample_defrag {
@@ -845,6 +1127,12 @@ struct nn_rsample {
       ddsrt_avl_tree_t fragtree;
       struct nn_defrag_iv *lastfrag;
       struct nn_rsample_info *sampleinfo;
+      /* non-NULL if reassembled directly, then the fragtree has a single
+         interval with the rdata for the complete sample */
+      struct nn_defrag_direct *direct;
+      /* approximate number of bytes received so far, overlapping fragments
+         may be counted more than once */
+      uint32_t nbytes;
       seqno_t seq;
     } defrag;
     struct nn_rsample_reorder {
@@ -862,6 +1150,7 @@ struct nn_defrag {
   uint32_t n_samples;
   uint32_t max_samples;
   enum nn_defrag_drop_mode drop_mode;
+  uint32_t direct_min_size;
   uint64_t discarded_bytes;
   const struct ddsrt_log_cfg *logcfg;
   bool trace;
@@ -887,7 +1176,7 @@ static int compare_seqno (const void *va, const void *vb)
   return (a == b) ? 0 : (a < b) ? -1 : 1;
 }
 
-struct nn_defrag *nn_defrag_new (const struct ddsrt_log_cfg *logcfg, enum nn_defrag_drop_mode drop_mode, uint32_t max_samples)
+struct nn_defrag *nn_defrag_new (const struct ddsrt_log_cfg *logcfg, enum nn_defrag_drop_mode drop_mode, uint32_t max_samples, uint32_t direct_min_size)
 {
   struct nn_defrag *d;
   assert (max_samples >= 1);
@@ -896,6 +1185,7 @@ struct nn_defrag *nn_defrag_new (const struct ddsrt_log_cfg *logcfg, enum nn_def
   ddsrt_avl_init (&defrag_sampletree_treedef, &d->sampletree);
   d->drop_mode = drop_mode;
   d->max_samples = max_samples;
+  d->direct_min_size = direct_min_size;
   d->n_samples = 0;
   d->max_sample = NULL;
   d->discarded_bytes = 0;
@@ -940,6 +1230,12 @@ static void defrag_rsample_drop (struct nn_defrag *defrag, struct nn_rsample *rs
   ddsrt_avl_delete (&defrag_sampletree_treedef, &defrag->sampletree, rsample);
   assert (defrag->n_samples > 0);
   defrag->n_samples--;
+  if (rsample->u.defrag.direct)
+  {
+    /* rsample is stored in the rmsg of the one and only rdata */
+    nn_fragchain_rmbias (rsample->u.defrag.lastfrag->first);
+    return;
+  }
   for (iv = ddsrt_avl_iter_first (&rsample_defrag_fragtree_treedef, &rsample->u.defrag.fragtree, &iter); iv; iv = ddsrt_avl_iter_next (&iter))
   {
     if (iv->first)
@@ -1051,6 +1347,8 @@ static struct nn_rsample *defrag_rsample_new (struct nn_rdata *rdata, const stru
   rsample_init_common (rsample, rdata, sampleinfo);
   dfsample = &rsample->u.defrag;
   dfsample->lastfrag = NULL;
+  dfsample->direct = NULL;
+  dfsample->nbytes = rdata->maxp1 - rdata->min;
   dfsample->seq = sampleinfo->seq;
   if ((dfsample->sampleinfo = nn_rmsg_alloc (rdata->rmsg, sizeof (*dfsample->sampleinfo))) == NULL)
     return NULL;
@@ -1076,6 +1374,199 @@ static struct nn_rsample *defrag_rsample_new (struct nn_rdata *rdata, const stru
   return rsample;
 }
 
+static int defrag_direct_add_fragment (struct nn_defrag *defrag, struct nn_rsample_defrag *dfsample, struct nn_rdata *rdata)
+{
+  /* Copies the data in rdata into place and returns whether that completed
+     the sample.  Only fragments entirely covered by rdata are marked as
+     received, which is always the case unless the sender changes the
+     fragment size while sending a sample. */
+  struct nn_defrag_direct * const direct = dfsample->direct;
+  struct nn_rdata * const d = dfsample->lastfrag->first;
+  const uint32_t size = dfsample->sampleinfo->size;
+  const uint32_t fragsize = direct->fragsize;
+  uint32_t i, first, lastp1, nnew = 0;
+  if (rdata->maxp1 > size)
+  {
+    TRACE (defrag, "  data beyond end of sample\n");
+    defrag->discarded_bytes += rdata->maxp1 - rdata->min;
+    return 0;
+  }
+  first = (rdata->min + fragsize - 1) / fragsize;
+  lastp1 = (rdata->maxp1 == size) ? direct->nfrags : rdata->maxp1 / fragsize;
+  for (i = first; i < lastp1; i++)
+  {
+    if (!nn_bitset_isset (direct->nfrags, direct->bits, i))
+    {
+      nn_bitset_set (direct->nfrags, direct->bits, i);
+      nnew++;
+    }
+  }
+  if (nnew == 0)
+  {
+    TRACE (defrag, "  no new fragments\n");
+    defrag->discarded_bytes += rdata->maxp1 - rdata->min;
+    return 0;
+  }
+  TRACE (defrag, "  direct: copy [%"PRIu32"..%"PRIu32") %"PRIu32" new fragments\n", rdata->min, rdata->maxp1, nnew);
+  memcpy (NN_RMSG_PAYLOADOFF (d->rmsg, NN_RDATA_PAYLOAD_OFF (d)) + rdata->min,
+          NN_RMSG_PAYLOADOFF (rdata->rmsg, NN_RDATA_PAYLOAD_OFF (rdata)),
+          rdata->maxp1 - rdata->min);
+  while (direct->first_missing < direct->nfrags && nn_bitset_isset (direct->nfrags, direct->bits, direct->first_missing))
+    direct->first_missing++;
+  direct->nmissing -= nnew;
+  if (direct->nmissing > 0)
+    return 0;
+  /* The fragment completing the sample is retained even though it adds
+     nothing: the caller may allocate from the rmsg being processed (see
+     nn_reorder_rsample_dup_first), and that is only safe if the sample
+     references it */
+  d->nextfrag = rdata;
+  rdata->nextfrag = NULL;
+  nn_rdata_addbias (rdata);
+  dfsample->lastfrag->last = rdata;
+  dfsample->lastfrag->maxp1 = size;
+  return 1;
+}
+
+static struct nn_rsample *defrag_rsample_new_direct (struct nn_defrag *defrag, struct nn_rbufpool *rbp, struct nn_rdata *rdata, const struct nn_rsample_info *sampleinfo)
+{
+  /* The standalone rmsg holds, in this order: the rsample with its sample
+     info and receiver state, the interval and the rdata, the fragment bitmap,
+     and finally the submessage header and inline QoS of the first fragment
+     followed by the sample.  The payload must be at 4 mod 8 for the data
+     following the CDR header to be 8-byte aligned.  rdata is the first
+     fragment, rbp the pool owned by the calling thread. */
+  const uint32_t submsg_size = NN_RDATA_PAYLOAD_OFF (rdata) - NN_RDATA_SUBMSG_OFF (rdata);
+  const uint32_t nfrags = (sampleinfo->size + sampleinfo->fragsize - 1) / sampleinfo->fragsize;
+  const uint32_t direct_size = (uint32_t) offsetof (struct nn_defrag_direct, bits) + 4 * ((nfrags + 31) / 32);
+  const uint32_t pad = (submsg_size % 8) == 0 ? 4 : 0;
+  const uint32_t meta_size =
+    align_rmsg ((uint32_t) sizeof (struct nn_rsample)) +
+    align_rmsg ((uint32_t) sizeof (struct nn_rsample_info)) +
+    align_rmsg ((uint32_t) sizeof (struct receiver_state)) +
+    align_rmsg ((uint32_t) sizeof (struct nn_defrag_iv)) +
+    align_rmsg ((uint32_t) sizeof (struct nn_rdata)) +
+    align_rmsg (direct_size);
+  const uint32_t submsg_offset = meta_size + pad;
+  const uint32_t payload_offset = submsg_offset + submsg_size;
+  struct nn_rmsg *rmsg;
+  struct nn_rsample *rsample;
+  struct nn_rsample_defrag *dfsample;
+  struct receiver_state *rst;
+  struct nn_defrag_iv *iv;
+  struct nn_rdata *d;
+  ddsrt_avl_ipath_t ivpath;
+
+  /* offsets must fit in an rdata; this also limits the number of fragments */
+  if (payload_offset >= 65536 || sampleinfo->size > UINT32_MAX - 65536 - ALIGNOF_RMSG)
+    return NULL;
+  if ((rmsg = nn_rmsg_new_standalone (rbp, meta_size + align_rmsg (pad + submsg_size + sampleinfo->size))) == NULL)
+    return NULL;
+  TRACE (defrag, "  direct: rmsg %p for %"PRIu32" bytes in %"PRIu32" fragments\n", (void *) rmsg, sampleinfo->size, nfrags);
+
+  /* can't fail: the rmsg was sized for precisely these allocations */
+  rsample = nn_rmsg_alloc (rmsg, sizeof (*rsample));
+  rsample_init_common (rsample, rdata, sampleinfo);
+  dfsample = &rsample->u.defrag;
+  dfsample->seq = sampleinfo->seq;
+  dfsample->sampleinfo = nn_rmsg_alloc (rmsg, sizeof (*dfsample->sampleinfo));
+  rst = nn_rmsg_alloc (rmsg, sizeof (*rst));
+  *rst = *sampleinfo->rst;
+  *dfsample->sampleinfo = *sampleinfo;
+  dfsample->sampleinfo->rst = rst;
+  iv = nn_rmsg_alloc (rmsg, sizeof (*iv));
+  d = nn_rdata_new (rmsg, 0, sampleinfo->size, submsg_offset, payload_offset);
+  dfsample->direct = nn_rmsg_alloc (rmsg, direct_size);
+  dfsample->direct->fragsize = sampleinfo->fragsize;
+  dfsample->direct->nfrags = nfrags;
+  dfsample->direct->nmissing = nfrags;
+  dfsample->direct->first_missing = 0;
+  dfsample->nbytes = sampleinfo->size;
+  nn_bitset_zero (nfrags, dfsample->direct->bits);
+  (void) nn_rmsg_alloc (rmsg, pad + submsg_size + sampleinfo->size);
+  assert (rmsg->chunk.u.size == rmsg->chunk.rbuf->max_rmsg_size);
+  memcpy (NN_RMSG_PAYLOADOFF (rmsg, submsg_offset), NN_RMSG_PAYLOADOFF (rdata->rmsg, NN_RDATA_SUBMSG_OFF (rdata)), submsg_size);
+
+  iv->min = iv->maxp1 = 0;
+  iv->first = iv->last = d;
+  ddsrt_avl_init (&rsample_defrag_fragtree_treedef, &dfsample->fragtree);
+  ddsrt_avl_lookup_ipath (&rsample_defrag_fragtree_treedef, &dfsample->fragtree, &iv->min, &ivpath);
+  ddsrt_avl_insert_ipath (&rsample_defrag_fragtree_treedef, &dfsample->fragtree, iv, &ivpath);
+  dfsample->lastfrag = iv;
+  nn_rdata_addbias (d);
+  nn_rmsg_commit_standalone (rmsg);
+
+  /* a fragment by definition doesn't complete the sample */
+  (void) defrag_direct_add_fragment (defrag, dfsample, rdata);
+  return rsample;
+}
+
+static bool defrag_direct_eligible (const struct nn_defrag *defrag, const struct nn_rsample_info *sampleinfo, uint32_t nbytes)
+{
+  return (defrag->direct_min_size > 0 && sampleinfo->size >= defrag->direct_min_size && sampleinfo->fragsize > 0 &&
+          nbytes >= sampleinfo->size / DEFRAG_DIRECT_FRACTION);
+}
+
+static struct nn_rsample *defrag_rsample_new_any (struct nn_defrag *defrag, struct nn_rdata *rdata, const struct nn_rsample_info *sampleinfo)
+{
+  /* Direct reassembly requires the first fragment for the submessage header
+     and inline QoS, falling back to the interval tree if it isn't the first
+     to arrive or if it doesn't contain enough of the sample; likewise if the
+     memory for the sample can't be allocated */
+  struct nn_rsample *rsample;
+  if (rdata->min == 0 && defrag_direct_eligible (defrag, sampleinfo, rdata->maxp1))
+  {
+    if ((rsample = defrag_rsample_new_direct (defrag, rdata->rmsg->chunk.rbuf->rbufpool, rdata, sampleinfo)) != NULL)
+      return rsample;
+  }
+  return defrag_rsample_new (rdata, sampleinfo);
+}
+
+static struct nn_rsample *defrag_rsample_try_direct (struct nn_defrag *defrag, struct nn_rsample *sample, struct nn_rdata *rdata)
+{
+  /* Switches an incomplete sample from the interval tree to direct reassembly
+     once enough of it has been received, copying the fragments received so
+     far.  rdata is the fragment just added, it lives in the pool owned by the
+     calling thread.  Returns the sample as it is now in the sample tree. */
+  struct nn_rsample_defrag * const dfsample = &sample->u.defrag;
+  struct nn_defrag_iv *iv;
+  ddsrt_avl_iter_t iter;
+  struct nn_rsample *dsample;
+  ddsrt_avl_ipath_t path;
+  if (dfsample->direct || !defrag_direct_eligible (defrag, dfsample->sampleinfo, dfsample->nbytes))
+    return sample;
+  /* the first interval is a sentinel if the first fragment hasn't been received yet */
+  iv = ddsrt_avl_find_min (&rsample_defrag_fragtree_treedef, &dfsample->fragtree);
+  if (iv->first == NULL)
+    return sample;
+  assert (iv->min == 0);
+  if ((dsample = defrag_rsample_new_direct (defrag, rdata->rmsg->chunk.rbuf->rbufpool, iv->first, dfsample->sampleinfo)) == NULL)
+    return sample;
+  TRACE (defrag, "  switching to direct reassembly at %"PRIu32" bytes\n", dfsample->nbytes);
+  /* all of it has been counted already, and none of it completes the sample */
+  const uint64_t discarded_bytes = defrag->discarded_bytes;
+  for (iv = ddsrt_avl_iter_first (&rsample_defrag_fragtree_treedef, &dfsample->fragtree, &iter); iv; iv = ddsrt_avl_iter_next (&iter))
+  {
+    for (struct nn_rdata *frag = iv->first; frag; frag = (frag == iv->last) ? NULL : frag->nextfrag)
+    {
+      int complete = defrag_direct_add_fragment (defrag, &dsample->u.defrag, frag);
+      assert (!complete);
+      (void) complete;
+    }
+  }
+  defrag->discarded_bytes = discarded_bytes;
+  /* dropping the old one releases the fragments and the memory it occupies */
+  const bool is_max = (defrag->max_sample == sample);
+  defrag_rsample_drop (defrag, sample);
+  if (ddsrt_avl_lookup_ipath (&defrag_sampletree_treedef, &defrag->sampletree, &dsample->u.defrag.seq, &path))
+    assert (0);
+  ddsrt_avl_insert_ipath (&defrag_sampletree_treedef, &defrag->sampletree, dsample, &path);
+  defrag->n_samples++;
+  if (is_max)
+    defrag->max_sample = dsample;
+  return dsample;
+}
+
 static struct nn_rsample *reorder_rsample_new (struct nn_rdata *rdata, const struct nn_rsample_info *sampleinfo)
 {
   /* Implements:
@@ -1183,6 +1674,9 @@ static struct nn_rsample *defrag_add_fragment (struct nn_defrag *defrag, struct
 
   TRACE (defrag, "  lastfrag %p [%"PRIu32"..%"PRIu32")\n", (void *) dfsample->lastfrag, dfsample->lastfrag->min, dfsample->lastfrag->maxp1);
 
+  if (dfsample->direct)
+    return defrag_direct_add_fragment (defrag, dfsample, rdata) ? sample : NULL;
+
   /* Interval tree is sorted on min offset; each key is unique:
      otherwise one would be wholly contained in another. */
   if (min >= dfsample->lastfrag->min)
@@ -1218,6 +1712,7 @@ static struct nn_rsample *defrag_add_fragment (struct nn_defrag *defrag, struct
        end); this may close the gap to the successor of predeq; predeq
        need not have a fragment chain yet (it may be the sentinel) */
     TRACE (defrag, "  grow predeq with new\n");
+    dfsample->nbytes += maxp1 - min;
     nn_rdata_addbias (rdata);
     rdata->nextfrag = NULL;
     if (predeq->first)
@@ -1246,6 +1741,7 @@ static struct nn_rsample *defrag_add_fragment (struct nn_defrag *defrag, struct
        predeq so the tree structure doesn't change even though the key
        does change */
     TRACE (defrag, "  extending succ %p [%"PRIu32"..%"PRIu32") at head\n", (void *) succ, succ->min, succ->maxp1);
+    dfsample->nbytes += maxp1 - min;
     nn_rdata_addbias (rdata);
     rdata->nextfrag = succ->first;
     succ->first = rdata;
@@ -1271,6 +1767,7 @@ static struct nn_rsample *defrag_add_fragment (struct nn_defrag *defrag, struct
     TRACE (defrag, "  new interval\n");
     if (ddsrt_avl_lookup_ipath (&rsample_defrag_fragtree_treedef, &dfsample->fragtree, &min, &path))
       assert (0);
+    dfsample->nbytes += maxp1 - min;
     defrag_rsample_addiv (dfsample, rdata, &path);
     return NULL;
   }
@@ -1375,7 +1872,8 @@ struct nn_rsample *nn_defrag_rsample (struct nn_defrag *defrag, struct nn_rdata
   if (sampleinfo->seq == max_seq)
   {
     TRACE (defrag, "  add fragment to max_sample\n");
-    result = defrag_add_fragment (defrag, defrag->max_sample, rdata, sampleinfo);
+    if ((result = defrag_add_fragment (defrag, defrag->max_sample, rdata, sampleinfo)) == NULL)
+      (void) defrag_rsample_try_direct (defrag, defrag->max_sample, rdata);
   }
   else if (!defrag_limit_samples (defrag, sampleinfo->seq, &max_seq))
   {
@@ -1389,7 +1887,7 @@ struct nn_rsample *nn_defrag_rsample (struct nn_defrag *defrag, struct nn_rdata
     /* FIXME: MERGE THIS ONE WITH THE NEXT */
     TRACE (defrag, "  new max sample\n");
     ddsrt_avl_lookup_ipath (&defrag_sampletree_treedef, &defrag->sampletree, &sampleinfo->seq, &path);
-    if ((sample = defrag_rsample_new (rdata, sampleinfo)) == NULL)
+    if ((sample = defrag_rsample_new_any (defrag, rdata, sampleinfo)) == NULL)
       return NULL;
     ddsrt_avl_insert_ipath (&defrag_sampletree_treedef, &defrag->sampletree, sample, &path);
     defrag->max_sample = sample;
@@ -1401,7 +1899,7 @@ struct nn_rsample *nn_defrag_rsample (struct nn_defrag *defrag, struct nn_rdata
     /* a new sequence number, but smaller than the maximum */
     TRACE (defrag, "  new sample less than max\n");
     assert (sampleinfo->seq < max_seq);
-    if ((sample = defrag_rsample_new (rdata, sampleinfo)) == NULL)
+    if ((sample = defrag_rsample_new_any (defrag, rdata, sampleinfo)) == NULL)
       return NULL;
     ddsrt_avl_insert_ipath (&defrag_sampletree_treedef, &defrag->sampletree, sample, &path);
     defrag->n_samples++;
@@ -1411,7 +1909,8 @@ struct nn_rsample *nn_defrag_rsample (struct nn_defrag *defrag, struct nn_rdata
   {
     /* adds (or, as the case may be, doesn't add) to a known message */
     TRACE (defrag, "  add fragment to %p\n", (void *) sample);
-    result = defrag_add_fragment (defrag, sample, rdata, sampleinfo);
+    if ((result = defrag_add_fragment (defrag, sample, rdata, sampleinfo)) == NULL)
+      (void) defrag_rsample_try_direct (defrag, sample, rdata);
   }
 
   if (result != NULL)
@@ -1451,6 +1950,29 @@ void nn_defrag_notegap (struct nn_defrag *defrag, seqno_t min, seqno_t maxp1)
   defrag->max_sample = ddsrt_avl_find_max (&defrag_sampletree_treedef, &defrag->sampletree);
 }
 
+static enum nn_defrag_nackmap_result defrag_direct_nackmap (const struct nn_defrag_direct *direct, uint32_t maxfragnum, struct nn_fragment_number_set_header *map, uint32_t *mapbits, uint32_t maxsz)
+{
+  /* Bitmap runs from the first missing fragment to the last missing one
+     that has been published so far */
+  uint32_t i, map_end;
+  if (direct->first_missing > maxfragnum)
+    return DEFRAG_NACKMAP_ALL_ADVERTISED_FRAGMENTS_KNOWN;
+  map->bitmap_base = direct->first_missing;
+  map_end = maxfragnum;
+  while (nn_bitset_isset (direct->nfrags, direct->bits, map_end))
+    map_end--;
+  map->numbits = map_end - map->bitmap_base + 1;
+  if (map->numbits > maxsz)
+    map->numbits = maxsz;
+  nn_bitset_zero (map->numbits, mapbits);
+  for (i = 0; i < map->numbits; i++)
+  {
+    if (!nn_bitset_isset (direct->nfrags, direct->bits, map->bitmap_base + i))
+      nn_bitset_set (map->numbits, mapbits, i);
+  }
+  return DEFRAG_NACKMAP_FRAGMENTS_MISSING;
+}
+
 enum nn_defrag_nackmap_result nn_defrag_nackmap (struct nn_defrag *defrag, seqno_t seq, uint32_t maxfragnum, struct nn_fragment_number_set_header *map, uint32_t *mapbits, uint32_t maxsz)
 {
   struct nn_rsample *s;
@@ -1488,6 +2010,9 @@ enum nn_defrag_nackmap_result nn_defrag_nackmap (struct nn_defrag *defrag, seqno
   if (maxfragnum >= nfrags)
     maxfragnum = nfrags - 1;
 
+  if (s->u.defrag.direct)
+    return defrag_direct_nackmap (s->u.defrag.direct, maxfragnum, map, mapbits, maxsz);
+
   /* Determine bitmap start & size */
   {
     /* We always have an interval starting at 0, which is empty if we
@@ -1557,6 +2082,113 @@ enum nn_defrag_nackmap_result nn_defrag_nackmap (struct nn_defrag *defrag, seqno
   return DEFRAG_NACKMAP_FRAGMENTS_MISSING;
 }
 
+static bool defrag_direct_has_range (const struct nn_defrag_direct *direct, uint32_t size, uint32_t min, uint32_t maxp1)
+{
+  const uint32_t lastp1 = (maxp1 == size) ? direct->nfrags : maxp1 / direct->fragsize;
+  for (uint32_t i = min / direct->fragsize; i < lastp1; i++)
+    if (!nn_bitset_isset (direct->nfrags, direct->bits, i))
+      return false;
+  return true;
+}
+
+static bool defrag_has_range (const struct nn_rsample_defrag *dfsample, uint32_t min, uint32_t maxp1)
+{
+  /* intervals never touch, so the range is present iff a single interval covers it */
+  if (dfsample->direct)
+    return defrag_direct_has_range (dfsample->direct, dfsample->sampleinfo->size, min, maxp1);
+  const struct nn_defrag_iv *iv = ddsrt_avl_lookup_pred_eq (&rsample_defrag_fragtree_treedef, &dfsample->fragtree, &min);
+  return iv != NULL && iv->maxp1 >= maxp1;
+}
+
+static void xor_bytes (unsigned char *dst, const unsigned char *src, uint32_t n)
+{
+  for (uint32_t i = 0; i < n; i++)
+    dst[i] ^= src[i];
+}
+
+static bool defrag_xor_range (const struct nn_rsample_defrag *dfsample, unsigned char *dst, uint32_t min, uint32_t maxp1)
+{
+  /* XORs bytes [min,maxp1) of the sample, which must be present, into dst;
+     fragments may overlap and so each byte is taken from the first
+     fragment in the chain that contains it */
+  const struct nn_defrag_iv *iv;
+  const struct nn_rdata *rd;
+  uint32_t pos = min;
+  if (dfsample->direct)
+  {
+    rd = dfsample->lastfrag->first;
+    xor_bytes (dst, NN_RMSG_PAYLOADOFF (rd->rmsg, NN_RDATA_PAYLOAD_OFF (rd)) + min, maxp1 - min);
+    return true;
+  }
+  iv = ddsrt_avl_lookup_pred_eq (&rsample_defrag_fragtree_treedef, &dfsample->fragtree, &min);
+  assert (iv != NULL && iv->maxp1 >= maxp1);
+  while (pos < maxp1)
+  {
+    const uint32_t pos0 = pos;
+    for (rd = iv->first; rd != NULL && pos < maxp1; rd = rd->nextfrag)
+    {
+      if (rd->min <= pos && pos < rd->maxp1)
+      {
+        const uint32_t endp1 = (rd->maxp1 < maxp1) ? rd->maxp1 : maxp1;
+        xor_bytes (dst + (pos - min), NN_RMSG_PAYLOADOFF (rd->rmsg, NN_RDATA_PAYLOAD_OFF (rd)) + (pos - rd->min), endp1 - pos);
+        pos = endp1;
+      }
+    }
+    if (pos == pos0)
+      return false;
+  }
+  return true;
+}
+
+uint32_t nn_defrag_fec_recover (struct nn_defrag *defrag, seqno_t seq, uint32_t size, uint32_t min, uint32_t maxp1, uint32_t unitsize, unsigned char *parity)
+{
+  const uint32_t nunits = (maxp1 - min + unitsize - 1) / unitsize;
+  struct nn_rsample *s;
+  uint32_t k, missing = UINT32_MAX;
+  assert (min < maxp1 && maxp1 <= size && unitsize > 0);
+  TRACE (defrag, "defrag_fec_recover(%p #%"PRId64" [%"PRIu32"..%"PRIu32") %"PRIu32" units)\n", (void *) defrag, seq, min, maxp1, nunits);
+  if ((s = ddsrt_avl_lookup (&defrag_sampletree_treedef, &defrag->sampletree, &seq)) == NULL)
+  {
+    /* the parity of a single unit is a copy of it */
+    if (nunits > 1)
+      return UINT32_MAX;
+    TRACE (defrag, "  unknown sample, recovered unit 0\n");
+    return 0;
+  }
+  if (s->u.defrag.sampleinfo->size != size)
+    return UINT32_MAX;
+  if (s->u.defrag.direct && (min % s->u.defrag.direct->fragsize != 0 || unitsize % s->u.defrag.direct->fragsize != 0))
+    return UINT32_MAX;
+  for (k = 0; k < nunits; k++)
+  {
+    const uint32_t umin = min + k * unitsize;
+    const uint32_t umaxp1 = (maxp1 - umin < unitsize) ? maxp1 : umin + unitsize;
+    if (!defrag_has_range (&s->u.defrag, umin, umaxp1))
+    {
+      if (missing != UINT32_MAX)
+      {
+        TRACE (defrag, "  more than one unit missing\n");
+        return UINT32_MAX;
+      }
+      missing = k;
+    }
+  }
+  if (missing == UINT32_MAX)
+  {
+    TRACE (defrag, "  nothing missing\n");
+    return UINT32_MAX;
+  }
+  for (k = 0; k < nunits; k++)
+  {
+    const uint32_t umin = min + k * unitsize;
+    const uint32_t umaxp1 = (maxp1 - umin < unitsize) ? maxp1 : umin + unitsize;
+    if (k != missing && !defrag_xor_range (&s->u.defrag, parity, umin, umaxp1))
+      return UINT32_MAX;
+  }
+  TRACE (defrag, "  recovered unit %"PRIu32"\n", missing);
+  return missing;
+}
+
 /* There is only one defrag per proxy writer. However for the Volatile Secure writer a filter
  * is applied to filter on the destination participant. Note that there will be one
  * builtin Volatile Secure reader for each local participant. When this local participant
@@ -1653,7 +2285,36 @@ void nn_defrag_prune (struct nn_defrag *defrag, ddsi_guid_prefix_t *dst, seqno_t
    admins that accepted it, less BIAS for the initial reference.  We
    can't use the original sample because of [CASE I], so we adjust
    based on the fragment chain instead of the sample.  Example code is
-   in the overview comment at the top of this file. */
+   in the overview comment at the top of this file.
+
+   At high rates, nearly all out-of-order samples are just ahead of
+   next_seq (a single lost packet causes everything after it to be
+   stored until the retransmit arrives).  A reorder admin in NORMAL
+   mode therefore has a sliding window covering sequence numbers
+   [next_seq, next_seq + REORDER_WINDOW), with a slot for a sample
+   chain element per sequence number (indexed by seq modulo the window
+   size) and a bitmap of the sequence numbers that are known, either
+   because a sample was received or because a gap covered it.  Storing
+   a sample in the window, checking whether one is wanted and
+   delivering consecutive samples are all O(1) per sample, and the
+   NACK bitmap is mostly a copy of the window's bitmap.
+
+   The interval tree is retained for sequence numbers beyond the
+   window, with the invariant that everything in the window precedes
+   everything in the tree: the end of the window is min(next_seq +
+   REORDER_WINDOW, lowest sequence number in the tree).  Entries are
+   never moved from the tree into the window, instead, the window can
+   only be consumed up to the lowest interval in the tree, and that
+   interval then gets delivered as a whole, just like before.  Gaps in
+   the window are tracked in the bitmap only, and so, unlike gaps in
+   the tree, do not hold a reference to the rdata nor count towards
+   max_samples. */
+
+/* Size of the window in a NORMAL mode reorder admin: a power of two,
+   and equal to the largest possible NACK bitmap so that a NACK for
+   a window with nothing beyond it can always be constructed */
+#define REORDER_WINDOW NN_SEQUENCE_NUMBER_SET_MAX_BITS
+#define REORDER_WINDOW_WORDS (REORDER_WINDOW / 32)
 
 struct nn_reorder {
   ddsrt_avl_tree_t sampleivtree;
@@ -1666,6 +2327,10 @@ struct nn_reorder {
   const struct ddsrt_log_cfg *logcfg;
   bool late_ack_mode;
   bool trace;
+  bool window; /* iff set, win and win_bits exist */
+  seqno_t win_maxp1; /* 1 + highest sequence number known in window, window empty iff <= next_seq */
+  uint32_t win_bits[REORDER_WINDOW_WORDS]; /* seq known iff bit (seq % REORDER_WINDOW) set */
+  struct nn_rsample_chain_elem *win[]; /* sample for seq (if any) in win[seq % REORDER_WINDOW] */
 };
 
 static const ddsrt_avl_treedef_t reorder_sampleivtree_treedef =
@@ -1674,7 +2339,9 @@ static const ddsrt_avl_treedef_t reorder_sampleivtree_treedef =
 struct nn_reorder *nn_reorder_new (const struct ddsrt_log_cfg *logcfg, enum nn_reorder_mode mode, uint32_t max_samples, bool late_ack_mode)
 {
   struct nn_reorder *r;
-  if ((r = ddsrt_malloc (sizeof (*r))) == NULL)
+  const bool window = (mode == NN_REORDER_MODE_NORMAL);
+  const size_t size = sizeof (*r) + (window ? REORDER_WINDOW * sizeof (r->win[0]) : 0);
+  if ((r = ddsrt_malloc (size)) == NULL)
     return NULL;
   ddsrt_avl_init (&reorder_sampleivtree_treedef, &r->sampleivtree);
   r->max_sampleiv = NULL;
@@ -1686,6 +2353,11 @@ struct nn_reorder *nn_reorder_new (const struct ddsrt_log_cfg *logcfg, enum nn_r
   r->late_ack_mode = late_ack_mode;
   r->logcfg = logcfg;
   r->trace = (logcfg->c.mask & DDS_LC_RADMIN) != 0;
+  r->window = window;
+  r->win_maxp1 = r->next_seq;
+  memset (r->win_bits, 0, sizeof (r->win_bits));
+  if (window)
+    memset (r->win, 0, REORDER_WINDOW * sizeof (r->win[0]));
   return r;
 }
 
@@ -1694,6 +2366,19 @@ void nn_reorder_stats (struct nn_reorder *reorder, uint64_t *discarded_bytes)
   *discarded_bytes = reorder->discarded_bytes;
 }
 
+void nn_fragchain_ref (struct nn_rdata *frag)
+{
+  /* every rdata in the chain holds one reference to its rmsg, and the caller's
+     reference guarantees the rmsg can't be freed concurrently */
+  while (frag)
+  {
+    struct nn_rmsg * const rmsg = frag->rmsg;
+    RMSGTRACE ("fragchain_ref(%p)\n", (void *) frag);
+    ddsrt_atomic_inc32 (&rmsg->refcount);
+    frag = frag->nextfrag;
+  }
+}
+
 void nn_fragchain_unref (struct nn_rdata *frag)
 {
   struct nn_rdata *frag1;
@@ -1723,6 +2408,12 @@ void nn_reorder_free (struct nn_reorder *r)
     }
     iv = ddsrt_avl_find_min (&reorder_sampleivtree_treedef, &r->sampleivtree);
   }
+  if (r->window)
+  {
+    for (uint32_t i = 0; i < REORDER_WINDOW; i++)
+      if (r->win[i])
+        nn_fragchain_unref (r->win[i]->fragchain);
+  }
   ddsrt_free (r);
 }
 
@@ -1859,13 +2550,15 @@ static void delete_last_sample (struct nn_reorder *reorder)
     /* Last sample is in an interval of its own - delete it, and
        recalc max_sampleiv. */
     TRACE (reorder, "  delete_last_sample: in singleton interval\n");
-    reorder->discarded_bytes += last->sc.first->sampleinfo->size;
+    if (last->sc.first->sampleinfo) /* gaps have no sampleinfo */
+      reorder->discarded_bytes += last->sc.first->sampleinfo->size;
     fragchain = last->sc.first->fragchain;
     ddsrt_avl_delete (&reorder_sampleivtree_treedef, &reorder->sampleivtree, reorder->max_sampleiv);
     reorder->max_sampleiv = ddsrt_avl_find_max (&reorder_sampleivtree_treedef, &reorder->sampleivtree);
     /* No harm done if it the sampleivtree is empty, except that we
-       chose not to allow it */
-    assert (reorder->max_sampleiv != NULL);
+       chose not to allow it unless there is a window, as the window
+       may then contain the remaining samples */
+    assert (reorder->max_sampleiv != NULL || reorder->window);
   }
   else
   {
@@ -1883,10 +2576,11 @@ static void delete_last_sample (struct nn_reorder *reorder)
       pe = e;
       e = e->next;
     } while (e != last->sc.last);
-    reorder->discarded_bytes += e->sampleinfo->size;
+    if (e->sampleinfo)
+      reorder->discarded_bytes += e->sampleinfo->size;
     fragchain = e->fragchain;
     pe->next = NULL;
-    assert (pe->sampleinfo->seq + 1 < last->maxp1);
+    assert (pe->sampleinfo == NULL || pe->sampleinfo->seq + 1 < last->maxp1);
     last->sc.last = pe;
     last->maxp1--;
     last->n_samples--;
@@ -1895,6 +2589,183 @@ static void delete_last_sample (struct nn_reorder *reorder)
   nn_fragchain_unref (fragchain);
 }
 
+static uint32_t reorder_window_index (seqno_t seq)
+{
+  return (uint32_t) ((uint64_t) seq % REORDER_WINDOW);
+}
+
+static bool reorder_window_isset (const struct nn_reorder *reorder, seqno_t seq)
+{
+  return nn_bitset_isset (REORDER_WINDOW, reorder->win_bits, reorder_window_index (seq));
+}
+
+static seqno_t reorder_window_limit (const struct nn_reorder *reorder)
+{
+  /* Window covers [next_seq, limit): REORDER_WINDOW sequence numbers,
+     but never overlapping with the tree */
+  const seqno_t limit = (reorder->next_seq > MAX_SEQ_NUMBER - REORDER_WINDOW) ? MAX_SEQ_NUMBER : reorder->next_seq + REORDER_WINDOW;
+  if (reorder->max_sampleiv == NULL)
+    return limit;
+  else
+  {
+    const struct nn_rsample *min = ddsrt_avl_find_min (&reorder_sampleivtree_treedef, &reorder->sampleivtree);
+    return (min->u.reorder.min < limit) ? min->u.reorder.min : limit;
+  }
+}
+
+static void reorder_chain_append (struct nn_rsample_chain *sc, struct nn_rsample_chain_elem *first, struct nn_rsample_chain_elem *last)
+{
+  if (sc->first == NULL)
+    sc->first = first;
+  else
+    sc->last->next = first;
+  sc->last = last;
+}
+
+static uint32_t reorder_window_take (struct nn_reorder *reorder, struct nn_rsample_chain *sc, seqno_t maxp1)
+{
+  /* Removes all knowledge of [next_seq, maxp1) from the window,
+     appending the samples to sc and returning the number of them;
+     doesn't update next_seq */
+  const seqno_t end = (maxp1 < reorder->win_maxp1) ? maxp1 : reorder->win_maxp1;
+  uint32_t n = 0;
+  for (seqno_t seq = reorder->next_seq; seq < end; seq++)
+  {
+    const uint32_t idx = reorder_window_index (seq);
+    nn_bitset_clear (REORDER_WINDOW, reorder->win_bits, idx);
+    if (reorder->win[idx])
+    {
+      reorder_chain_append (sc, reorder->win[idx], reorder->win[idx]);
+      reorder->win[idx] = NULL;
+      n++;
+    }
+  }
+  return n;
+}
+
+static uint32_t reorder_deliver_stored (struct nn_reorder *reorder, struct nn_rsample_chain *sc)
+{
+  /* Appends whatever is stored consecutively from next_seq on to sc,
+     advancing next_seq and returning the number of chain elements
+     appended.  Everything in the window precedes everything in the
+     tree, so the lowest interval in the tree can only follow on if
+     the window is consumed entirely. */
+  uint32_t n = 0;
+  if (reorder->window)
+  {
+    seqno_t maxp1 = reorder->next_seq;
+    while (maxp1 < reorder->win_maxp1 && reorder_window_isset (reorder, maxp1))
+      maxp1++;
+    if (maxp1 > reorder->next_seq)
+    {
+      TRACE (reorder, "  delivering [%"PRId64",%"PRId64") from window\n", reorder->next_seq, maxp1);
+      n += reorder_window_take (reorder, sc, maxp1);
+      reorder->next_seq = maxp1;
+    }
+  }
+  if (reorder->max_sampleiv != NULL)
+  {
+    struct nn_rsample *min = ddsrt_avl_find_min (&reorder_sampleivtree_treedef, &reorder->sampleivtree);
+    if (min->u.reorder.min == reorder->next_seq)
+    {
+      TRACE (reorder, "  delivering [%"PRId64",%"PRId64") from tree\n", min->u.reorder.min, min->u.reorder.maxp1);
+      ddsrt_avl_delete (&reorder_sampleivtree_treedef, &reorder->sampleivtree, min);
+      reorder_chain_append (sc, min->u.reorder.sc.first, min->u.reorder.sc.last);
+      reorder->next_seq = min->u.reorder.maxp1;
+      n += min->u.reorder.n_samples;
+      if (min == reorder->max_sampleiv)
+        reorder->max_sampleiv = NULL;
+    }
+  }
+  return n;
+}
+
+static bool reorder_window_delete_last_above (struct nn_reorder *reorder, seqno_t seq)
+{
+  /* Deletes the last sample if its sequence number is above seq, much
+     like delete_last_sample, which it uses if the tree is not empty
+     as that has the highest sequence numbers. */
+  if (reorder->max_sampleiv != NULL)
+  {
+    delete_last_sample (reorder);
+    return true;
+  }
+  for (seqno_t last = reorder->win_maxp1 - 1; last > seq; last--)
+  {
+    const uint32_t idx = reorder_window_index (last);
+    if (reorder->win[idx] == NULL)
+      continue;
+    TRACE (reorder, "  delete_last_sample: %"PRId64" in window\n", last);
+    reorder->discarded_bytes += reorder->win[idx]->sampleinfo->size;
+    nn_fragchain_unref (reorder->win[idx]->fragchain);
+    reorder->win[idx] = NULL;
+    nn_bitset_clear (REORDER_WINDOW, reorder->win_bits, idx);
+    if (last + 1 == reorder->win_maxp1)
+    {
+      while (last > reorder->next_seq && !reorder_window_isset (reorder, last - 1))
+        last--;
+      reorder->win_maxp1 = last;
+    }
+    return true;
+  }
+  return false;
+}
+
+static nn_reorder_result_t reorder_window_insert (struct nn_reorder *reorder, struct nn_rsample *rsampleiv, int *refcount_adjust, int delivery_queue_full_p)
+{
+  /* Stores rsampleiv, with next_seq < s->min < reorder_window_limit(),
+     using the same policy as for the tree */
+  struct nn_rsample_reorder *s = &rsampleiv->u.reorder;
+  const uint32_t idx = reorder_window_index (s->min);
+  if (reorder_window_isset (reorder, s->min))
+  {
+    TRACE (reorder, "  discard: known in window\n");
+    reorder->discarded_bytes += s->sc.first->sampleinfo->size;
+    return NN_REORDER_REJECT;
+  }
+  if (s->min >= reorder->win_maxp1 && reorder->max_sampleiv == NULL)
+  {
+    if (reorder->win_maxp1 > reorder->next_seq && delivery_queue_full_p)
+    {
+      /* same as adding a new interval at the end of the tree */
+      TRACE (reorder, "  discarding sample: only accepting delayed samples due to backlog in delivery queue\n");
+      reorder->discarded_bytes += s->sc.first->sampleinfo->size;
+      return NN_REORDER_REJECT;
+    }
+    if (reorder->n_samples >= reorder->max_samples)
+    {
+      TRACE (reorder, "  discarding sample: max_samples reached and sample at end\n");
+      reorder->discarded_bytes += s->sc.first->sampleinfo->size;
+      return NN_REORDER_REJECT;
+    }
+    reorder->n_samples++;
+  }
+  else
+  {
+    if (reorder->late_ack_mode && delivery_queue_full_p)
+    {
+      TRACE (reorder, "  discarding sample: delivery queue full\n");
+      reorder->discarded_bytes += s->sc.first->sampleinfo->size;
+      return NN_REORDER_REJECT;
+    }
+    if (reorder->n_samples < reorder->max_samples)
+      reorder->n_samples++;
+    else if (!reorder_window_delete_last_above (reorder, s->min))
+    {
+      TRACE (reorder, "  discarding sample: max_samples reached and nothing later stored\n");
+      reorder->discarded_bytes += s->sc.first->sampleinfo->size;
+      return NN_REORDER_REJECT;
+    }
+  }
+  TRACE (reorder, "  storing in window\n");
+  reorder->win[idx] = s->sc.first;
+  nn_bitset_set (REORDER_WINDOW, reorder->win_bits, idx);
+  if (s->min >= reorder->win_maxp1)
+    reorder->win_maxp1 = s->min + 1;
+  (*refcount_adjust)++;
+  return NN_REORDER_ACCEPT;
+}
+
 nn_reorder_result_t nn_reorder_rsample (struct nn_rsample_chain *sc, struct nn_reorder *reorder, struct nn_rsample *rsampleiv, int *refcount_adjust, int delivery_queue_full_p)
 {
   /* Adds an rsample (represented as an interval) to the reorder admin
@@ -1923,6 +2794,8 @@ nn_reorder_result_t nn_reorder_rsample (struct nn_rsample_chain *sc, struct nn_r
     assert (min == NULL || reorder->next_seq < min->u.reorder.min);
     assert ((reorder->max_sampleiv == NULL && min == NULL) ||
             (reorder->max_sampleiv != NULL && min != NULL));
+    assert (!reorder->window || !reorder_window_isset (reorder, reorder->next_seq));
+    assert (!reorder->window || min == NULL || reorder->win_maxp1 <= min->u.reorder.min);
   }
 #endif
   assert ((!!ddsrt_avl_is_empty (&reorder->sampleivtree)) == (reorder->max_sampleiv == NULL));
@@ -1950,28 +2823,22 @@ nn_reorder_result_t nn_reorder_rsample (struct nn_rsample_chain *sc, struct nn_r
     }
 
     /* 's' is next sample to be delivered; maybe we can append the
-       first interval in the tree to it.  We can avoid all processing
-       if the index is empty, which is the normal case.  Unreliable
-       out-of-order either ends up here or in discard.)  */
-    if (reorder->max_sampleiv != NULL)
-    {
-      struct nn_rsample *min = ddsrt_avl_find_min (&reorder_sampleivtree_treedef, &reorder->sampleivtree);
-      TRACE (reorder, "  try append_and_discard\n");
-      if (reorder_try_append_and_discard (reorder, rsampleiv, min))
-        reorder->max_sampleiv = NULL;
-    }
+       samples following it in the window and the first interval in
+       the tree to it.  We can avoid all processing if nothing is
+       stored, which is the normal case.  Unreliable out-of-order
+       either ends up here or in discard.)  */
+    uint32_t n;
+    assert (s->n_samples == 1);
     reorder->next_seq = s->maxp1;
     *sc = rsampleiv->u.reorder.sc;
+    n = reorder_deliver_stored (reorder, sc);
     (*refcount_adjust)++;
-    TRACE (reorder, "  return [%"PRId64",%"PRId64")\n", s->min, s->maxp1);
+    TRACE (reorder, "  return [%"PRId64",%"PRId64")\n", s->min, reorder->next_seq);
 
-    /* Adjust reorder->n_samples, new sample is not counted yet */
-    assert (s->maxp1 - s->min >= 1);
-    assert (s->maxp1 - s->min <= (int) INT32_MAX);
-    assert (s->min + s->n_samples <= s->maxp1);
-    assert (reorder->n_samples >= s->n_samples - 1);
-    reorder->n_samples -= s->n_samples - 1;
-    return (nn_reorder_result_t) s->n_samples;
+    /* Adjust reorder->n_samples, new sample is not counted */
+    assert (reorder->n_samples >= n);
+    reorder->n_samples -= n;
+    return (nn_reorder_result_t) (n + 1);
   }
   else if (s->min < reorder->next_seq)
   {
@@ -1981,19 +2848,30 @@ nn_reorder_result_t nn_reorder_rsample (struct nn_rsample_chain *sc, struct nn_r
     reorder->discarded_bytes += s->sc.first->sampleinfo->size;
     return NN_REORDER_TOO_OLD; /* don't want refcount increment */
   }
+  else if (reorder->window && s->min < reorder_window_limit (reorder))
+  {
+    return reorder_window_insert (reorder, rsampleiv, refcount_adjust, delivery_queue_full_p);
+  }
   else if (ddsrt_avl_is_empty (&reorder->sampleivtree))
   {
     /* else, if nothing's stored simply add this one, max_samples = 0
        is technically allowed, and potentially useful, so check for
-       it */
-    assert (reorder->n_samples == 0);
+       it; if the window is in use, the tree may be empty while the
+       window is not, then it is just a new interval at the end */
+    assert (reorder->n_samples == 0 || reorder->window);
     TRACE (reorder, "  adding to empty store\n");
-    if (reorder->max_samples == 0)
+    if (reorder->n_samples >= reorder->max_samples)
     {
       TRACE (reorder, "  NOT - max_samples hit\n");
       reorder->discarded_bytes += s->sc.first->sampleinfo->size;
       return NN_REORDER_REJECT;
     }
+    else if (reorder->window && reorder->win_maxp1 > reorder->next_seq && delivery_queue_full_p)
+    {
+      TRACE (reorder, "  discarding sample: only accepting delayed samples due to backlog in delivery queue\n");
+      reorder->discarded_bytes += s->sc.first->sampleinfo->size;
+      return NN_REORDER_REJECT;
+    }
     else
     {
       reorder_add_rsampleiv (reorder, rsampleiv);
@@ -2224,6 +3102,54 @@ static int reorder_insert_gap (struct nn_reorder *reorder, struct nn_rdata *rdat
   return 1;
 }
 
+static nn_reorder_result_t reorder_tree_gap (struct nn_reorder *reorder, struct nn_rdata *rdata, seqno_t min, seqno_t maxp1, int *refcount_adjust)
+{
+  /* Case III of nn_reorder_gap for the tree: coalesce all intervals
+     [m,n) with n >= min or m <= maxp1 */
+  struct nn_rsample *coalesced;
+  int valuable;
+  nn_reorder_result_t res;
+  assert (min > reorder->next_seq);
+  if ((coalesced = coalesce_intervals_touching_range (reorder, min, maxp1, &valuable)) == NULL)
+  {
+    TRACE (reorder, "  coalesced = null\n");
+    if (reorder->n_samples == reorder->max_samples &&
+        (reorder->max_sampleiv == NULL || min > reorder->max_sampleiv->u.reorder.maxp1))
+    {
+      /* n_samples = max_samples => (max_sampleiv = NULL <=> max_samples = 0 or all in window) */
+      TRACE (reorder, "  discarding gap: max_samples reached and gap at end\n");
+      res = NN_REORDER_REJECT;
+    }
+    else if (!reorder_insert_gap (reorder, rdata, min, maxp1))
+    {
+      TRACE (reorder, "  store gap failed: no memory\n");
+      res = NN_REORDER_REJECT;
+    }
+    else
+    {
+      TRACE (reorder, "  storing gap\n");
+      res = NN_REORDER_ACCEPT;
+      /* do not let radmin grow beyond max_samples; there is a small
+         possibility that we insert it & delete it immediately
+         afterward. */
+      reorder->max_sampleiv = ddsrt_avl_find_max (&reorder_sampleivtree_treedef, &reorder->sampleivtree);
+      if (reorder->n_samples < reorder->max_samples)
+        reorder->n_samples++;
+      else
+        delete_last_sample (reorder);
+      (*refcount_adjust)++;
+    }
+  }
+  else
+  {
+    TRACE (reorder, "  coalesced = [%"PRId64",%"PRId64") @ %p - that is all\n",
+           coalesced->u.reorder.min, coalesced->u.reorder.maxp1, (void *) coalesced);
+    res = valuable ? NN_REORDER_ACCEPT : NN_REORDER_REJECT;
+  }
+  reorder->max_sampleiv = ddsrt_avl_find_max (&reorder_sampleivtree_treedef, &reorder->sampleivtree);
+  return res;
+}
+
 nn_reorder_result_t nn_reorder_gap (struct nn_rsample_chain *sc, struct nn_reorder *reorder, struct nn_rdata *rdata, seqno_t min, seqno_t maxp1, int *refcount_adjust)
 {
   /* All sequence numbers in [min,maxp1) are unavailable so any
@@ -2241,19 +3167,17 @@ nn_reorder_result_t nn_reorder_gap (struct nn_rsample_chain *sc, struct nn_reord
 
      Else:
 
-       Case III: Causes coalescing of intervals overlapping with
-         [min,maxp1) or consecutive to it, possibly extending
-         intervals to min on the lower bound or maxp1 on the upper
-         one, or if there are no such intervals, the creation of a
-         [min,maxp1) interval without any samples.
+       Case III: Marks the part of [min,maxp1) in the window as known
+         and causes coalescing of intervals overlapping with the
+         remainder of [min,maxp1) or consecutive to it, possibly
+         extending intervals to min on the lower bound or maxp1 on the
+         upper one, or if there are no such intervals, the creation
+         of a [min,maxp1) interval without any samples.
 
      NOTE: must not store anything (i.e. modify rdata,
      refcount_adjust) if gap causes data to be delivered: altnerative
      path for out-of-order delivery if all readers of a reliable
      proxy-writer are unrelibale depends on it. */
-  struct nn_rsample *coalesced;
-  int valuable;
-
   TRACE (reorder, "reorder_gap(%p %c, [%"PRId64",%"PRId64") data %p) expecting %"PRId64":\n",
          (void *) reorder, reorder_mode_as_char (reorder),
          min, maxp1, (void *) rdata, reorder->next_seq);
@@ -2269,70 +3193,70 @@ nn_reorder_result_t nn_reorder_gap (struct nn_rsample_chain *sc, struct nn_reord
     return NN_REORDER_REJECT;
   }
 
-  /* Coalesce all intervals [m,n) with n >= min or m <= maxp1 */
-  if ((coalesced = coalesce_intervals_touching_range (reorder, min, maxp1, &valuable)) == NULL)
+  if (min <= reorder->next_seq)
   {
-    nn_reorder_result_t res;
-    TRACE (reorder, "  coalesced = null\n");
-    if (min <= reorder->next_seq)
+    /* Case II: take whatever the window has below maxp1, then coalesce
+       all intervals [m,n) with n >= min or m <= maxp1, and then append
+       anything stored that follows on consecutively */
+    struct nn_rsample *coalesced;
+    int valuable;
+    uint32_t n;
+    sc->first = sc->last = NULL;
+    n = reorder->window ? reorder_window_take (reorder, sc, maxp1) : 0;
+    if ((coalesced = coalesce_intervals_touching_range (reorder, min, maxp1, &valuable)) == NULL)
     {
-      TRACE (reorder, "  next expected: %"PRId64"\n", maxp1);
+      TRACE (reorder, "  coalesced = null\n");
       reorder->next_seq = maxp1;
-      res = NN_REORDER_ACCEPT;
-    }
-    else if (reorder->n_samples == reorder->max_samples &&
-             (reorder->max_sampleiv == NULL || min > reorder->max_sampleiv->u.reorder.maxp1))
-    {
-      /* n_samples = max_samples => (max_sampleiv = NULL <=> max_samples = 0) */
-      TRACE (reorder, "  discarding gap: max_samples reached and gap at end\n");
-      res = NN_REORDER_REJECT;
-    }
-    else if (!reorder_insert_gap (reorder, rdata, min, maxp1))
-    {
-      TRACE (reorder, "  store gap failed: no memory\n");
-      res = NN_REORDER_REJECT;
     }
     else
     {
-      TRACE (reorder, "  storing gap\n");
-      res = NN_REORDER_ACCEPT;
-      /* do not let radmin grow beyond max_samples; there is a small
-         possibility that we insert it & delete it immediately
-         afterward. */
-      if (reorder->n_samples < reorder->max_samples)
-        reorder->n_samples++;
-      else
-        delete_last_sample (reorder);
-      (*refcount_adjust)++;
+      TRACE (reorder, "  coalesced = [%"PRId64",%"PRId64") @ %p containing %"PRId32" samples\n",
+             coalesced->u.reorder.min, coalesced->u.reorder.maxp1,
+             (void *) coalesced, coalesced->u.reorder.n_samples);
+      assert (coalesced->u.reorder.min + coalesced->u.reorder.n_samples <= coalesced->u.reorder.maxp1);
+      ddsrt_avl_delete (&reorder_sampleivtree_treedef, &reorder->sampleivtree, coalesced);
+      reorder_chain_append (sc, coalesced->u.reorder.sc.first, coalesced->u.reorder.sc.last);
+      reorder->next_seq = coalesced->u.reorder.maxp1;
+      n += coalesced->u.reorder.n_samples;
     }
     reorder->max_sampleiv = ddsrt_avl_find_max (&reorder_sampleivtree_treedef, &reorder->sampleivtree);
-    return res;
-  }
-  else if (coalesced->u.reorder.min <= reorder->next_seq)
-  {
-    TRACE (reorder, "  coalesced = [%"PRId64",%"PRId64") @ %p containing %"PRId32" samples\n",
-           coalesced->u.reorder.min, coalesced->u.reorder.maxp1,
-           (void *) coalesced, coalesced->u.reorder.n_samples);
-    ddsrt_avl_delete (&reorder_sampleivtree_treedef, &reorder->sampleivtree, coalesced);
-    if (coalesced->u.reorder.min <= reorder->next_seq)
-      assert (min <= reorder->next_seq);
-    reorder->next_seq = coalesced->u.reorder.maxp1;
-    reorder->max_sampleiv = ddsrt_avl_find_max (&reorder_sampleivtree_treedef, &reorder->sampleivtree);
+    n += reorder_deliver_stored (reorder, sc);
     TRACE (reorder, "  next expected: %"PRId64"\n", reorder->next_seq);
-    *sc = coalesced->u.reorder.sc;
 
     /* Adjust n_samples */
-    assert (coalesced->u.reorder.min + coalesced->u.reorder.n_samples <= coalesced->u.reorder.maxp1);
-    assert (reorder->n_samples >= coalesced->u.reorder.n_samples);
-    reorder->n_samples -= coalesced->u.reorder.n_samples;
-    return (nn_reorder_result_t) coalesced->u.reorder.n_samples;
+    assert (reorder->n_samples >= n);
+    reorder->n_samples -= n;
+    return (n > 0) ? (nn_reorder_result_t) n : NN_REORDER_ACCEPT;
   }
   else
   {
-    TRACE (reorder, "  coalesced = [%"PRId64",%"PRId64") @ %p - that is all\n",
-           coalesced->u.reorder.min, coalesced->u.reorder.maxp1, (void *) coalesced);
-    reorder->max_sampleiv = ddsrt_avl_find_max (&reorder_sampleivtree_treedef, &reorder->sampleivtree);
-    return valuable ? NN_REORDER_ACCEPT : NN_REORDER_REJECT;
+    /* Case III: the part of the gap in the window is recorded in the
+       bitmap, the remainder goes into the tree */
+    nn_reorder_result_t res = NN_REORDER_REJECT;
+    if (reorder->window)
+    {
+      const seqno_t limit = reorder_window_limit (reorder);
+      if (min < limit)
+      {
+        const seqno_t end = (maxp1 < limit) ? maxp1 : limit;
+        TRACE (reorder, "  gap [%"PRId64",%"PRId64") in window\n", min, end);
+        for (seqno_t seq = min; seq < end; seq++)
+        {
+          const uint32_t idx = reorder_window_index (seq);
+          if (!nn_bitset_isset (REORDER_WINDOW, reorder->win_bits, idx))
+          {
+            nn_bitset_set (REORDER_WINDOW, reorder->win_bits, idx);
+            res = NN_REORDER_ACCEPT;
+          }
+        }
+        if (end > reorder->win_maxp1)
+          reorder->win_maxp1 = end;
+        min = end;
+      }
+    }
+    if (min < maxp1 && reorder_tree_gap (reorder, rdata, min, maxp1, refcount_adjust) == NN_REORDER_ACCEPT)
+      res = NN_REORDER_ACCEPT;
+    return res;
   }
 }
 
@@ -2342,12 +3266,25 @@ int nn_reorder_wantsample (const struct nn_reorder *reorder, seqno_t seq)
   if (seq < reorder->next_seq)
     /* trivially not interesting */
     return 0;
+  if (reorder->window && seq < reorder_window_limit (reorder))
+    return !reorder_window_isset (reorder, seq);
   /* Find interval that contains seq, if we know seq.  We are
      interested if seq is outside this interval (if any). */
   s = ddsrt_avl_lookup_pred_eq (&reorder_sampleivtree_treedef, &reorder->sampleivtree, &seq);
   return (s == NULL || s->u.reorder.maxp1 <= seq);
 }
 
+static uint32_t reorder_window_word (const struct nn_reorder *reorder, seqno_t seq)
+{
+  /* Returns the 32 bits of the window bitmap starting at seq, wrapping
+     around at the end, most significant bit first like nn_bitset */
+  const uint32_t idx = reorder_window_index (seq), w = idx / 32, off = idx % 32;
+  if (off == 0)
+    return reorder->win_bits[w];
+  else
+    return (reorder->win_bits[w] << off) | (reorder->win_bits[(w + 1) % REORDER_WINDOW_WORDS] >> (32 - off));
+}
+
 unsigned nn_reorder_nackmap (const struct nn_reorder *reorder, seqno_t base, seqno_t maxseq, struct nn_sequence_number_set_header *map, uint32_t *mapbits, uint32_t maxsz, int notail)
 {
   struct nn_rsample *iv;
@@ -2390,6 +3327,26 @@ unsigned nn_reorder_nackmap (const struct nn_reorder *reorder, seqno_t base, seq
   if ((iv = ddsrt_avl_find_min (&reorder_sampleivtree_treedef, &reorder->sampleivtree)) != NULL)
     assert (iv->u.reorder.min > base);
   i = base;
+  if (reorder->window && reorder->win_maxp1 > reorder->next_seq)
+  {
+    /* everything below next_seq is missing, the window's bitmap has
+       the known ones in [next_seq,win_maxp1), so copy the complement
+       a word at a time */
+    const seqno_t end = (reorder->win_maxp1 < base + map->numbits) ? reorder->win_maxp1 : base + map->numbits;
+    for (; i < end && i < reorder->next_seq; i++)
+      nn_bitset_set (map->numbits, mapbits, (uint32_t) (i - base));
+    while (i < end)
+    {
+      const uint32_t x = (uint32_t) (i - base), xoff = x % 32;
+      const uint32_t nbits = (end - i < 32) ? (uint32_t) (end - i) : 32;
+      const uint32_t missing = ~reorder_window_word (reorder, i) & (0xffffffffu << (32 - nbits));
+      mapbits[x / 32] |= missing >> xoff;
+      if (xoff > 0 && nbits > 32 - xoff)
+        mapbits[x / 32 + 1] |= missing << (32 - xoff);
+      i += nbits;
+    }
+    i = reorder->win_maxp1;
+  }
   while (iv && i < base + map->numbits)
   {
     for (; i < base + map->numbits && i < iv->u.reorder.min; i++)
@@ -2420,7 +3377,9 @@ seqno_t nn_reorder_next_seq (const struct nn_reorder *reorder)
 
 void nn_reorder_set_next_seq (struct nn_reorder *reorder, seqno_t seq)
 {
+  assert (!reorder->window || reorder->win_maxp1 <= reorder->next_seq);
   reorder->next_seq = seq;
+  reorder->win_maxp1 = seq;
 }
 
 /* DQUEUE -------------------------------------------------------------- */
@@ -56,6 +56,8 @@
 #include "dds/ddsi/ddsi_serdata_default.h" /* FIXME: get rid of this */
 #include "dds/ddsi/ddsi_security_omg.h"
 #include "dds/ddsi/ddsi_acknack.h"
+#include "dds/ddsi/ddsi_filter.h"
+#include "dds/ddsi/ddsi_shm.h"
 
 #include "dds/ddsi/sysdeps.h"
 #include "dds__whc.h"
@@ -304,6 +306,12 @@ static int set_sampleinfo_bswap (struct nn_rsample_info *sampleinfo, struct CDRH
         sampleinfo->bswap = (DDSRT_ENDIAN == DDSRT_LITTLE_ENDIAN) ? 0 : 1;
         break;
       }
+      case CDR_SHM:
+      {
+        /* reference to a sample in shared memory, always in native byte order */
+        sampleinfo->bswap = 0;
+        break;
+      }
       default:
       {
         return 0;
@@ -733,6 +741,7 @@ static int handle_AckNack (struct receiver_state *rst, ddsrt_etime_t tnow, const
   int enqueued;
   unsigned numbits;
   uint32_t msgs_sent, msgs_lost;
+  uint64_t rexmit_bytes_before;
   seqno_t max_seq_in_reply;
   struct whc_node *deferred_free_list = NULL;
   struct whc_state whcst;
@@ -817,6 +826,8 @@ static int handle_AckNack (struct receiver_state *rst, ddsrt_etime_t tnow, const
     goto out;
   }
   RSTTRACE (" "PGUIDFMT" -> "PGUIDFMT"", PGUID (src), PGUID (dst));
+  if (wr->adaptive_heartbeat)
+    writer_hbcontrol_note_ack (wr, rn, ddsrt_time_monotonic ());
 
   /* Update latency estimates if we have a timestamp -- won't actually
      work so well if the timestamp can be a left over from some other
@@ -849,6 +860,11 @@ static int handle_AckNack (struct receiver_state *rst, ddsrt_etime_t tnow, const
     ddsrt_avl_augment_update (&wr_readers_treedef, rn);
     n = remove_acked_messages (wr, &whcst, &deferred_free_list);
     RSTTRACE (" ACK%"PRId64" RM%u", n_ack, n);
+    /* An ACK advancing the reader's state is taken to be a response to
+       the most recent heartbeat requesting one, which gives an estimate
+       of the round-trip time for congestion control */
+    if (wr->congestion_control && wr->hbcontrol.t_of_last_ackhb.v != 0)
+      ddsi_congestion_note_rtt (&wr->cc, ddsrt_time_monotonic ().v - wr->hbcontrol.t_of_last_ackhb.v);
   }
   else
   {
@@ -955,7 +971,14 @@ static int handle_AckNack (struct receiver_state *rst, ddsrt_etime_t tnow, const
     RSTTRACE (" test_suppress_retransmit");
     numbits = 0;
   }
+  if (rn->hist_xevent && seqbase + numbits > rn->hist_seq)
+  {
+    /* historical data is still being streamed, what hasn't been sent yet is on its way */
+    RSTTRACE (" hist-in-progress:%"PRId64, rn->hist_seq);
+    numbits = (rn->hist_seq > seqbase) ? (uint32_t) (rn->hist_seq - seqbase) : 0;
+  }
   enqueued = 1;
+  rexmit_bytes_before = wr->rexmit_bytes;
   seq_xmit = writer_read_seq_xmit (wr);
   nn_gap_info_init(&gi);
   const bool gap_for_already_acked = vendor_is_eclipse (rst->vendor) && prd->c.xqos->durability.kind == DDS_DURABILITY_VOLATILE && seqbase <= rn->seq;
@@ -976,7 +999,7 @@ static int handle_AckNack (struct receiver_state *rst, ddsrt_etime_t tnow, const
         if (!wr->retransmitting && sample.unacked)
           writer_set_retransmitting (wr);
 
-        if (rst->gv->config.retransmit_merging != REXMIT_MERGE_NEVER && rn->assumed_in_sync && !prd->filter)
+        if (rst->gv->config.retransmit_merging != REXMIT_MERGE_NEVER && rn->assumed_in_sync && !prd->filter && !rn->filter)
         {
           /* send retransmit to all receivers, but skip if recently done */
           ddsrt_mtime_t tstamp = ddsrt_time_monotonic ();
@@ -1006,9 +1029,10 @@ static int handle_AckNack (struct receiver_state *rst, ddsrt_etime_t tnow, const
         }
         else
         {
-          /* Is this a volatile reader with a filter?
+          /* Is this a volatile reader with a filter or a reader with a content filter?
            * If so, call the filter to see if we should re-arrange the sequence gap when needed. */
-          if (prd->filter && !prd->filter (wr, prd, sample.serdata))
+          if ((prd->filter && !prd->filter (wr, prd, sample.serdata)) ||
+              (rn->filter && !ddsi_filter_accepts (rn->filter, sample.serdata)))
             nn_gap_info_update (rst->gv, &gi, seqbase + i);
           else
           {
@@ -1064,6 +1088,13 @@ static int handle_AckNack (struct receiver_state *rst, ddsrt_etime_t tnow, const
 
   wr->rexmit_count += msgs_sent;
   wr->rexmit_lost_count += msgs_lost;
+  /* Requests from readers still catching up are not a sign of congestion,
+     requests for data that was sent but apparently lost are */
+  if (wr->congestion_control && rn->assumed_in_sync && !is_preemptive_ack && wr->rexmit_bytes > rexmit_bytes_before)
+  {
+    ddsi_congestion_note_nack (&wr->cc, (uint32_t) (wr->rexmit_bytes - rexmit_bytes_before), ddsrt_time_monotonic ());
+    RSTTRACE (" cc-rate:%"PRIu32, wr->cc.rate);
+  }
   if (msgs_sent)
   {
     RSTTRACE (" rexmit#%"PRIu32" maxseq:%"PRId64"<%"PRId64"<=%"PRId64"", msgs_sent, max_seq_in_reply, seq_xmit, wr->seq);
@@ -1603,6 +1634,7 @@ static int handle_NackFrag (struct receiver_state *rst, ddsrt_etime_t tnow, cons
     const uint32_t base = msg->fragmentNumberState.bitmap_base - 1;
     assert (wr->rexmit_burst_size_limit <= UINT32_MAX - UINT16_MAX);
     uint32_t nfrags_lim = (wr->rexmit_burst_size_limit + wr->e.gv->config.fragment_size - 1) / wr->e.gv->config.fragment_size;
+    const uint64_t rexmit_bytes_before = wr->rexmit_bytes;
     bool sent = false;
     RSTTRACE (" scheduling requested frags ...\n");
     for (uint32_t i = 0; i < msg->fragmentNumberState.numbits && nfrags_lim > 0; i++)
@@ -1627,6 +1659,9 @@ static int handle_NackFrag (struct receiver_state *rst, ddsrt_etime_t tnow, cons
       if (!wr->retransmitting)
         writer_set_retransmitting (wr);
     }
+    /* Lost fragments of data sent before, same as in handle_AckNack */
+    if (sent && wr->congestion_control && rn->assumed_in_sync)
+      ddsi_congestion_note_nack (&wr->cc, (uint32_t) (wr->rexmit_bytes - rexmit_bytes_before), ddsrt_time_monotonic ());
     whc_return_sample (wr->whc, &sample, false);
   }
   else
@@ -2107,14 +2142,161 @@ static dds_return_t remote_on_delivery_failure_fastpath (struct entity_common *s
   return DDS_RETCODE_TRY_AGAIN;
 }
 
+static const struct deliver_locally_ops deliver_locally_ops = {
+  .makesample = remote_make_sample,
+  .first_reader = proxy_writer_first_in_sync_reader,
+  .next_reader = proxy_writer_next_in_sync_reader,
+  .on_failure_fastpath = remote_on_delivery_failure_fastpath
+};
+
+/* Samples of a coherent set are retained (by holding a reference to the fragchain)
+   until the end of the set is reached, then they are all delivered as one batch.  The
+   inline QoS is copied because it is not part of the retained data.  A sample that
+   refers to a chunk in shared memory also holds a reference to that chunk, because
+   the sample may be acknowledged long before the set is complete, and the writer may
+   release the chunk once it has been.
+
+   Retaining the fragchains pins the receive buffers they are in, so the number of
+   receive buffers a set may pin is limited: a set that would exceed it is delivered
+   in parts, sacrificing coherence for bounded memory use. */
+#define COHERENT_SET_MAX_RBUFS 8
+
+struct coherent_set_sample {
+  struct remote_sourceinfo si;
+  ddsi_plist_t qos;
+  void *shm_payload;
+};
+
+struct coherent_set_buffer {
+  seqno_t cs_seq;
+  uint32_t n, size;
+  struct coherent_set_sample *samples;
+  struct ddsi_writer_info *wrinfo;
+  uint32_t nrbufs;
+  const struct nn_rbuf *rbufs[COHERENT_SET_MAX_RBUFS];
+};
+
+static void coherent_set_buffer_clear (struct coherent_set_buffer *cs)
+{
+  for (uint32_t i = 0; i < cs->n; i++)
+  {
+    ddsi_plist_fini (&cs->samples[i].qos);
+    if (cs->samples[i].shm_payload)
+      ddsi_shm_chunk_unref (cs->samples[i].shm_payload);
+    nn_fragchain_unref ((struct nn_rdata *) cs->samples[i].si.fragchain);
+  }
+  cs->n = 0;
+  cs->cs_seq = 0;
+  cs->nrbufs = 0;
+}
+
+void coherent_set_buffer_free (struct coherent_set_buffer *cs)
+{
+  if (cs == NULL)
+    return;
+  coherent_set_buffer_clear (cs);
+  ddsrt_free (cs->samples);
+  ddsrt_free (cs->wrinfo);
+  ddsrt_free (cs);
+}
+
+static void *coherent_set_sample_pin_shm (struct ddsi_domaingv *gv, const struct remote_sourceinfo *si)
+{
+  /* a reference to shared memory is tiny and therefore never fragmented */
+  const struct nn_rdata *fragchain = si->fragchain;
+  struct CDRHeader hdr;
+  struct ddsi_shm_chunk_desc desc;
+  if (fragchain->min != 0 || fragchain->maxp1 < sizeof (hdr) + sizeof (desc))
+    return NULL;
+  const unsigned char *payload = NN_RMSG_PAYLOADOFF (fragchain->rmsg, NN_RDATA_PAYLOAD_OFF (fragchain));
+  memcpy (&hdr, payload, sizeof (hdr));
+  if (hdr.identifier != CDR_SHM)
+    return NULL;
+  memcpy (&desc, payload + sizeof (hdr), sizeof (desc));
+  return ddsi_shm_chunk_resolve (gv, &desc);
+}
+
+static bool coherent_set_buffer_pin_rbufs (struct coherent_set_buffer *cs, const struct nn_rdata *fragchain)
+{
+  /* Returns false if retaining fragchain would pin too many receive buffers, not
+     updating the set of pinned receive buffers in that case */
+  const struct nn_rbuf *rbufs[COHERENT_SET_MAX_RBUFS];
+  uint32_t nrbufs = cs->nrbufs;
+  memcpy (rbufs, cs->rbufs, nrbufs * sizeof (*rbufs));
+  for (const struct nn_rdata *frag = fragchain; frag; frag = frag->nextfrag)
+  {
+    const struct nn_rbuf *rbuf = frag->rmsg->chunk.rbuf;
+    uint32_t i;
+    for (i = 0; i < nrbufs && rbufs[i] != rbuf; i++)
+      ;
+    if (i == nrbufs)
+    {
+      if (nrbufs == COHERENT_SET_MAX_RBUFS)
+        return false;
+      rbufs[nrbufs++] = rbuf;
+    }
+  }
+  memcpy (cs->rbufs, rbufs, nrbufs * sizeof (*rbufs));
+  cs->nrbufs = nrbufs;
+  return true;
+}
+
+static void deliver_coherent_set (struct proxy_writer *pwr, int pwr_locked);
+
+static void coherent_set_buffer_add (struct proxy_writer *pwr, int pwr_locked, seqno_t cs_seq, const struct remote_sourceinfo *si, const struct ddsi_writer_info *wrinfo)
+{
+  struct coherent_set_buffer *cs;
+  if ((cs = pwr->coherent_set) == NULL)
+  {
+    cs = pwr->coherent_set = ddsrt_malloc (sizeof (*cs));
+    cs->n = cs->size = 0;
+    cs->samples = NULL;
+    cs->wrinfo = NULL;
+    cs->nrbufs = 0;
+  }
+  if (!coherent_set_buffer_pin_rbufs (cs, si->fragchain) && cs->n > 0)
+  {
+    struct ddsi_domaingv * const gv = pwr->e.gv;
+    GVWARNING ("coherent set %"PRId64" of writer "PGUIDFMT" pins too many receive buffers, delivering the first %"PRIu32" samples early\n",
+               cs_seq, PGUID (pwr->e.guid), cs->n);
+    deliver_coherent_set (pwr, pwr_locked);
+    (void) coherent_set_buffer_pin_rbufs (cs, si->fragchain);
+  }
+  if (cs->n == cs->size)
+  {
+    cs->size = (cs->size == 0) ? 32 : 2 * cs->size;
+    cs->samples = ddsrt_realloc (cs->samples, cs->size * sizeof (*cs->samples));
+    cs->wrinfo = ddsrt_realloc (cs->wrinfo, cs->size * sizeof (*cs->wrinfo));
+  }
+  cs->cs_seq = cs_seq;
+  cs->samples[cs->n].si = *si;
+  ddsi_plist_copy (&cs->samples[cs->n].qos, si->qos);
+  cs->samples[cs->n].shm_payload = coherent_set_sample_pin_shm (pwr->e.gv, si);
+  nn_fragchain_ref ((struct nn_rdata *) si->fragchain);
+  cs->wrinfo[cs->n] = *wrinfo;
+  cs->n++;
+}
+
+static void deliver_coherent_set (struct proxy_writer *pwr, int pwr_locked)
+{
+  struct coherent_set_buffer * const cs = pwr->coherent_set;
+  void **vsourceinfo;
+  if (cs == NULL || cs->n == 0)
+    return;
+  EETRACE (&pwr->e, " coherent set %"PRId64": %"PRIu32" samples", cs->cs_seq, cs->n);
+  vsourceinfo = ddsrt_malloc (cs->n * sizeof (*vsourceinfo));
+  for (uint32_t i = 0; i < cs->n; i++)
+  {
+    cs->samples[i].si.qos = &cs->samples[i].qos;
+    vsourceinfo[i] = &cs->samples[i].si;
+  }
+  (void) deliver_locally_allinsync_batch (pwr->e.gv, &pwr->e, pwr_locked != 0, &pwr->rdary, cs->n, cs->wrinfo, &deliver_locally_ops, vsourceinfo);
+  ddsrt_free (vsourceinfo);
+  coherent_set_buffer_clear (cs);
+}
+
 static int deliver_user_data (const struct nn_rsample_info *sampleinfo, const struct nn_rdata *fragchain, const ddsi_guid_t *rdguid, int pwr_locked)
 {
-  static const struct deliver_locally_ops deliver_locally_ops = {
-    .makesample = remote_make_sample,
-    .first_reader = proxy_writer_first_in_sync_reader,
-    .next_reader = proxy_writer_next_in_sync_reader,
-    .on_failure_fastpath = remote_on_delivery_failure_fastpath
-  };
   struct receiver_state const * const rst = sampleinfo->rst;
   struct ddsi_domaingv * const gv = rst->gv;
   struct proxy_writer * const pwr = sampleinfo->pwr;
@@ -2197,10 +2379,30 @@ static int deliver_user_data (const struct nn_rsample_info *sampleinfo, const st
     .tstamp = tstamp
   };
   if (rdguid)
+  {
+    /* historical data is delivered as it arrives, coherent sets or not: the WHC of
+       the writer doesn't keep the end-of-set markers */
     (void) deliver_locally_one (gv, &pwr->e, pwr_locked != 0, rdguid, &wrinfo, &deliver_locally_ops, &sourceinfo);
+  }
   else
   {
-    (void) deliver_locally_allinsync (gv, &pwr->e, pwr_locked != 0, &pwr->rdary, &wrinfo, &deliver_locally_ops, &sourceinfo);
+    if (!(qos.present & PP_COHERENT_SET))
+    {
+      /* a sample outside a coherent set ends any set in progress (normally the end
+         of a set is marked explicitly, but that marker may be lost if unreliable) */
+      deliver_coherent_set (pwr, pwr_locked);
+      (void) deliver_locally_allinsync (gv, &pwr->e, pwr_locked != 0, &pwr->rdary, &wrinfo, &deliver_locally_ops, &sourceinfo);
+    }
+    else
+    {
+      const seqno_t cs_seq = fromSN (qos.coherent_set_seqno);
+      if (pwr->coherent_set && pwr->coherent_set->n > 0 && pwr->coherent_set->cs_seq != cs_seq)
+        deliver_coherent_set (pwr, pwr_locked);
+      if (sampleinfo->size == 0 && !(data_smhdr_flags & (DATA_FLAG_KEYFLAG | DATA_FLAG_DATAFLAG)))
+        deliver_coherent_set (pwr, pwr_locked); /* end of coherent set */
+      else
+        coherent_set_buffer_add (pwr, pwr_locked, cs_seq, &sourceinfo, &wrinfo);
+    }
     ddsrt_atomic_st32 (&pwr->next_deliv_seq_lowword, (uint32_t) (sampleinfo->seq + 1));
   }
 
@@ -2493,8 +2695,9 @@ static int handle_SPDP (const struct nn_rsample_info *sampleinfo, struct nn_rdat
   ddsrt_mutex_lock (&gv->spdp_lock);
   rsample = nn_defrag_rsample (gv->spdp_defrag, rdata, sampleinfo);
   fragchain = nn_rsample_fragchain (rsample);
-  if ((rres = nn_reorder_rsample (&sc, gv->spdp_reorder, rsample, &refc_adjust, nn_dqueue_is_full (gv->builtins_dqueue))) > 0)
-    nn_dqueue_enqueue (gv->builtins_dqueue, &sc, rres);
+  struct nn_dqueue * const dqueue = builtins_dqueue_for_prefix (gv, &sampleinfo->rst->src_guid_prefix);
+  if ((rres = nn_reorder_rsample (&sc, gv->spdp_reorder, rsample, &refc_adjust, nn_dqueue_is_full (dqueue))) > 0)
+    nn_dqueue_enqueue (dqueue, &sc, rres);
   nn_fragchain_adjust_refcount (fragchain, refc_adjust);
   ddsrt_mutex_unlock (&gv->spdp_lock);
   return 0;
@@ -2706,6 +2909,60 @@ static int handle_DataFrag (struct receiver_state *rst, ddsrt_etime_t tnow, stru
   return 1;
 }
 
+static int handle_Fec (struct receiver_state *rst, ddsrt_etime_t tnow, struct nn_rmsg *rmsg, DataFrag_t *msg, size_t size, struct nn_rsample_info *sampleinfo, unsigned char *datap, struct nn_dqueue **deferred_wakeup, SubmessageKind_t prev_smid)
+{
+  /* The parity covers nunits units of fragmentsInSubmessage fragments each;
+     if the missing unit can be recovered, the FEC submessage is turned into
+     the DATA_FRAG that was lost and processed as such */
+  struct proxy_writer * const pwr = sampleinfo->pwr;
+  const uint32_t nunits = msg->x.extraFlags;
+  const uint32_t unitsize = (uint32_t) msg->fragmentsInSubmessage * msg->fragmentSize;
+  const uint32_t min = (msg->fragmentStartingNum - 1) * msg->fragmentSize;
+  uint32_t maxp1, k;
+  RSTTRACE ("FEC("PGUIDFMT" -> "PGUIDFMT" #%"PRId64"/[%u..%u] %u units",
+            PGUIDPREFIX (rst->src_guid_prefix), msg->x.writerId.u,
+            PGUIDPREFIX (rst->dst_guid_prefix), msg->x.readerId.u,
+            fromSN (msg->x.writerSN),
+            msg->fragmentStartingNum, msg->fragmentStartingNum + msg->fragmentsInSubmessage - 1, nunits);
+  if (!rst->forme)
+  {
+    RSTTRACE (" not-for-me)");
+    return 1;
+  }
+  if (pwr == NULL || nunits == 0 || sampleinfo->size > rst->gv->config.max_sample_size)
+  {
+    RSTTRACE (" ignored)");
+    return 1;
+  }
+  if (!validate_msg_decoding (&pwr->e, &pwr->c, pwr->c.proxypp, rst, prev_smid))
+  {
+    RSTTRACE (" clear submsg from protected src "PGUIDFMT")", PGUID (pwr->e.guid));
+    return 1;
+  }
+
+  /* valid_DataFrag guarantees min < size and that the payload covers the first unit */
+  if ((uint64_t) nunits * unitsize >= sampleinfo->size - min)
+    maxp1 = sampleinfo->size;
+  else
+    maxp1 = min + nunits * unitsize;
+  ddsrt_mutex_lock (&pwr->e.lock);
+  k = nn_defrag_fec_recover (pwr->defrag, sampleinfo->seq, sampleinfo->size, min, maxp1, unitsize, datap);
+  ddsrt_mutex_unlock (&pwr->e.lock);
+  if (k == UINT32_MAX)
+  {
+    RSTTRACE (" no recovery)");
+    return 1;
+  }
+  RSTTRACE (" recovered unit %"PRIu32") ", k);
+
+  msg->x.smhdr.submessageId = SMID_DATA_FRAG;
+  msg->x.extraFlags = 0;
+  msg->fragmentStartingNum += k * msg->fragmentsInSubmessage;
+  if (msg->fragmentStartingNum == 1 && !set_sampleinfo_bswap (sampleinfo, (struct CDRHeader *) datap))
+    return 1;
+  return handle_DataFrag (rst, tnow, rmsg, msg, size, sampleinfo, datap, deferred_wakeup, prev_smid);
+}
+
 static void malformed_packet_received_nosubmsg (const struct ddsi_domaingv *gv, const unsigned char * msg, ssize_t len, const char *state, nn_vendorid_t vendorid
 )
 {
@@ -3084,6 +3341,27 @@ static int handle_submsg_sequence
         GVTRACE ("ENTITY_ID");
         break;
       }
+      case SMID_ADLINK_FEC:
+        state = "parse:fec";
+        if (!vendor_is_eclipse (rst->vendor))
+        {
+          /* Ignore other vendors' private submessages */
+          GVTRACE ("UNDEFINED(%x)", sm->smhdr.submessageId);
+        }
+        else
+        {
+          struct nn_rsample_info sampleinfo;
+          uint32_t datasz = 0;
+          unsigned char *datap;
+          if (!valid_DataFrag (rst, &sm->datafrag, submsg_size, byteswap, &sampleinfo, &datap, &datasz))
+            goto malformed;
+          sampleinfo.timestamp = timestamp;
+          sampleinfo.reception_timestamp = tnowWC;
+          handle_Fec (rst, tnowE, rmsg, &sm->datafrag, submsg_size, &sampleinfo, datap, &deferred_wakeup, prev_smid);
+          rst_live = 1;
+        }
+        ts_for_latmeas = 0;
+        break;
       case SMID_SEC_PREFIX:
         state = "parse:sec_prefix";
         {
@@ -3356,8 +3634,17 @@ static void local_participant_set_init (struct local_participant_set *lps, ddsrt
   lps->gen = ddsrt_atomic_ld32 (ppset_generation) - 1;
 }
 
+static void local_participant_set_unref_conns (struct local_participant_set *lps)
+{
+  for (uint32_t i = 0; i < lps->nps; i++)
+    if (lps->ps[i].m_conn)
+      ddsi_conn_unref (lps->ps[i].m_conn);
+  lps->nps = 0;
+}
+
 static void local_participant_set_fini (struct local_participant_set *lps)
 {
+  local_participant_set_unref_conns (lps);
   ddsrt_free (lps->ps);
 }
 
@@ -3367,6 +3654,10 @@ static void rebuild_local_participant_set (struct thread_state1 * const ts1, str
   struct participant *pp;
   unsigned nps_alloc;
   GVTRACE ("pp set gen changed: local %"PRIu32" global %"PRIu32"\n", lps->gen, ddsrt_atomic_ld32 (&gv->participant_set_generation));
+  /* The waitset still holds the connections of the old set, which are about
+     to be purged from it; the references to them were only kept to prevent
+     their freeing while they might be in use by the receive thread. */
+  local_participant_set_unref_conns (lps);
   thread_state_awake_fixed_domain (ts1);
  restart:
   lps->gen = ddsrt_atomic_ld32 (&gv->participant_set_generation);
@@ -3412,7 +3703,6 @@ static void rebuild_local_participant_set (struct thread_state1 * const ts1, str
     GVTRACE ("  set changed - restarting\n");
     goto restart;
   }
-  thread_state_asleep (ts1);
 
   /* The definition of the hash enumeration allows visiting one
      participant multiple times, so guard against that, too.  Note
@@ -3424,6 +3714,16 @@ static void rebuild_local_participant_set (struct thread_state1 * const ts1, str
     qsort (lps->ps, lps->nps, sizeof (*lps->ps), local_participant_cmp);
     lps->nps = (unsigned) dedup_sorted_array (lps->ps, lps->nps, sizeof (*lps->ps), local_participant_cmp);
   }
+
+  /* Deleting a participant closes and frees its connection, but the receive
+     thread may at that time still be processing an event on it.  Holding a
+     reference until the next rebuild defers the freeing until after it has
+     been removed from the waitset.  Participants (and thus their connections)
+     can't be freed while we're awake. */
+  for (uint32_t i = 0; i < lps->nps; i++)
+    if (lps->ps[i].m_conn)
+      ddsi_conn_add_ref (lps->ps[i].m_conn);
+  thread_state_asleep (ts1);
   GVTRACE ("  nparticipants %u\n", lps->nps);
 }
 
@@ -3476,7 +3776,7 @@ void trigger_recv_threads (const struct ddsi_domaingv *gv)
         iov.iov_base = &dummy;
         iov.iov_len = 1;
         GVTRACE ("trigger_recv_threads: %d single %s\n", i, ddsi_locator_to_string (buf, sizeof (buf), dst));
-        ddsi_conn_write (gv->xmit_conn, dst, 1, &iov, 0);
+        ddsi_conn_write ((dst->kind == NN_LOCATOR_KIND_SHM) ? gv->shm_conn : gv->xmit_conn, dst, 1, &iov, 0);
         break;
       }
       case RTM_MANY: {
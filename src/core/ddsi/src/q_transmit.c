@@ -38,6 +38,7 @@
 #include "dds/ddsi/ddsi_serdata.h"
 #include "dds/ddsi/ddsi_sertopic.h"
 #include "dds/ddsi/ddsi_security_omg.h"
+#include "dds/ddsi/ddsi_filter.h"
 
 #include "dds/ddsi/sysdeps.h"
 #include "dds__whc.h"
@@ -60,12 +61,13 @@ void writer_hbcontrol_init (struct hbcontrol *hbc)
   hbc->t_of_last_write.v = 0;
   hbc->t_of_last_hb.v = 0;
   hbc->t_of_last_ackhb.v = 0;
+  hbc->t_of_last_multicast_ackhb.v = 0;
   hbc->tsched = DDSRT_MTIME_NEVER;
   hbc->hbs_since_last_write = 0;
   hbc->last_packetid = 0;
 }
 
-static void writer_hbcontrol_note_hb (struct writer *wr, ddsrt_mtime_t tnow, int ansreq)
+void writer_hbcontrol_note_hb (struct writer *wr, ddsrt_mtime_t tnow, int ansreq)
 {
   struct hbcontrol * const hbc = &wr->hbcontrol;
 
@@ -118,6 +120,7 @@ void writer_hbcontrol_note_asyncwrite (struct writer *wr, ddsrt_mtime_t tnow)
   /* We know this is new data, so we want a heartbeat event after one
      base interval */
   tnext.v = tnow.v + gv->config.const_hb_intv_sched;
+  tnext = writer_hbcontrol_align (wr, tnext);
   if (tnext.v < hbc->tsched.v)
   {
     /* Insertion of a message with WHC locked => must now have at
@@ -147,6 +150,7 @@ struct nn_xmsg *writer_hbcontrol_create_heartbeat (struct writer *wr, const stru
   if ((msg = nn_xmsg_new (gv->xmsgpool, &wr->e.guid, wr->c.pp, sizeof (InfoTS_t) + sizeof (Heartbeat_t), NN_XMSG_KIND_CONTROL)) == NULL)
     /* out of memory at worst slows down traffic */
     return NULL;
+  nn_xmsg_setpriority (msg, wr->xqos->transport_priority.value);
 
   if (ddsrt_avl_is_empty (&wr->readers) || wr->num_reliable_readers == 0)
   {
@@ -225,11 +229,80 @@ struct nn_xmsg *writer_hbcontrol_create_heartbeat (struct writer *wr, const stru
     nn_xmsg_free (msg);
     msg = NULL;
   }
+  else
+  {
+    wr->num_heartbeats_sent++;
+    if (prd_guid == NULL && hbansreq)
+      wr->hbcontrol.t_of_last_multicast_ackhb = tnow;
+  }
 
   writer_hbcontrol_note_hb (wr, tnow, hbansreq);
   return msg;
 }
 
+ddsrt_mtime_t writer_hbcontrol_align (const struct writer *wr, ddsrt_mtime_t t)
+{
+  /* Adaptive heartbeats are scheduled on a grid with a per-participant offset,
+     so that the heartbeats of the writers of a participant tend to become due
+     at the same time and get packed into a single message by the event thread */
+  const int64_t grid = wr->e.gv->config.const_hb_intv_sched_min;
+  if (!wr->adaptive_heartbeat || grid <= 0 || t.v >= DDS_NEVER - grid)
+    return t;
+  const ddsi_guid_prefix_t *prefix = &wr->c.pp->e.guid.prefix;
+  const int64_t offset = (int64_t) ((prefix->u[0] ^ prefix->u[1] ^ prefix->u[2]) % (uint64_t) grid);
+  if (t.v > offset)
+    t.v = offset + ((t.v - offset + grid - 1) / grid) * grid;
+  return t;
+}
+
+uint32_t writer_hbcontrol_num_lagging_readers (const struct writer *wr)
+{
+  /* Number of reliable readers that haven't acknowledged all data, UINT32_MAX if
+     that can't be derived from the summary in the root of the readers tree,
+     which is the case when some reader hasn't replied to a heartbeat yet */
+  const struct wr_prd_match *root;
+  if (ddsrt_avl_is_empty (&wr->readers) || wr->num_reliable_readers == 0)
+    return UINT32_MAX;
+  root = root_rdmatch (wr);
+  if (!root->all_have_replied_to_hb)
+    return UINT32_MAX;
+  else if (root->max_seq < wr->seq)
+    return wr->num_reliable_readers;
+  else
+    return wr->num_reliable_readers - root->num_reliable_readers_where_seq_equals_max;
+}
+
+static ddsrt_mtime_t writer_hbcontrol_t_last_ackhb (const struct writer *wr, const struct wr_prd_match *m)
+{
+  const ddsrt_mtime_t tmc = wr->hbcontrol.t_of_last_multicast_ackhb;
+  return (m->t_ackhb.v > tmc.v) ? m->t_ackhb : tmc;
+}
+
+int writer_hbcontrol_ack_pending (const struct writer *wr, const struct wr_prd_match *m, ddsrt_mtime_t tnow)
+{
+  /* A reader that hasn't yet responded to the latest heartbeat requesting an
+     ACK that it was sent is assumed to still do so until twice its usual
+     response time has passed */
+  const ddsrt_mtime_t thb = writer_hbcontrol_t_last_ackhb (wr, m);
+  return (thb.v > m->t_ack.v && tnow.v < thb.v + 2 * m->ack_latency);
+}
+
+void writer_hbcontrol_note_ack (const struct writer *wr, struct wr_prd_match *m, ddsrt_mtime_t tnow)
+{
+  /* The first ACKNACK following a heartbeat requesting one is taken to be the
+     response to it; samples are limited to the base heartbeat interval so
+     that a single late response can't suppress heartbeats for long */
+  const ddsrt_mtime_t thb = writer_hbcontrol_t_last_ackhb (wr, m);
+  if (thb.v > m->t_ack.v && tnow.v > thb.v)
+  {
+    int64_t lat = tnow.v - thb.v;
+    if (lat > wr->e.gv->config.const_hb_intv_sched)
+      lat = wr->e.gv->config.const_hb_intv_sched;
+    m->ack_latency = (m->ack_latency == 0) ? lat : (7 * m->ack_latency + lat) / 8;
+  }
+  m->t_ack = tnow;
+}
+
 static int writer_hbcontrol_ack_required_generic (const struct writer *wr, const struct whc_state *whcst, ddsrt_mtime_t tlast, ddsrt_mtime_t tnow, int piggyback)
 {
   struct ddsi_domaingv const * const gv = wr->e.gv;
@@ -302,6 +375,9 @@ struct nn_xmsg *writer_hbcontrol_piggyback (struct writer *wr, const struct whc_
        this is just to ensure a regular flow of ACKs for cleaning up
        the WHC & for allowing readers to NACK missing samples. */
     msg = writer_hbcontrol_create_heartbeat (wr, whcst, tnow, *hbansreq, 1);
+    /* It may as well be delayed as long as the data it accompanies */
+    if (msg)
+      nn_xmsg_setmaxdelay (msg, wr->xqos->latency_budget.duration);
   } else {
     *hbansreq = 0;
     msg = NULL;
@@ -321,8 +397,7 @@ struct nn_xmsg *writer_hbcontrol_piggyback (struct writer *wr, const struct whc_
   return msg;
 }
 
-#ifdef DDSI_INCLUDE_SECURITY
-struct nn_xmsg *writer_hbcontrol_p2p(struct writer *wr, const struct whc_state *whcst, int hbansreq, struct proxy_reader *prd)
+struct nn_xmsg *writer_hbcontrol_create_unicast_heartbeat (struct writer *wr, const struct whc_state *whcst, int hbansreq, struct proxy_reader *prd, int issync)
 {
   struct ddsi_domaingv const * const gv = wr->e.gv;
   struct nn_xmsg *msg;
@@ -333,7 +408,7 @@ struct nn_xmsg *writer_hbcontrol_p2p(struct writer *wr, const struct whc_state *
   if ((msg = nn_xmsg_new (gv->xmsgpool, &wr->e.guid, wr->c.pp, sizeof (InfoTS_t) + sizeof (Heartbeat_t), NN_XMSG_KIND_CONTROL)) == NULL)
     return NULL;
 
-  ETRACE (wr, "writer_hbcontrol_p2p: wr "PGUIDFMT" unicasting to prd "PGUIDFMT" ", PGUID (wr->e.guid), PGUID (prd->e.guid));
+  ETRACE (wr, "writer_hbcontrol: wr "PGUIDFMT" unicasting to prd "PGUIDFMT" ", PGUID (wr->e.guid), PGUID (prd->e.guid));
   ETRACE (wr, "(rel-prd %d seq-eq-max %d seq %"PRId64" maxseq %"PRId64")\n",
       wr->num_reliable_readers,
       ddsrt_avl_is_empty (&wr->readers) ? -1 : (int32_t) root_rdmatch (wr)->num_reliable_readers_where_seq_equals_max,
@@ -346,16 +421,26 @@ struct nn_xmsg *writer_hbcontrol_p2p(struct writer *wr, const struct whc_state *
 #ifdef DDSI_INCLUDE_NETWORK_PARTITIONS
   nn_xmsg_setencoderid (msg, wr->partition_id);
 #endif
-  add_Heartbeat (msg, wr, whcst, hbansreq, 0, prd->e.guid.entityid, 1);
+  add_Heartbeat (msg, wr, whcst, hbansreq, 0, prd->e.guid.entityid, issync);
 
   if (nn_xmsg_size(msg) == 0)
   {
     nn_xmsg_free (msg);
     msg = NULL;
   }
+  else
+  {
+    wr->num_heartbeats_sent++;
+  }
 
   return msg;
 }
+
+#ifdef DDSI_INCLUDE_SECURITY
+struct nn_xmsg *writer_hbcontrol_p2p(struct writer *wr, const struct whc_state *whcst, int hbansreq, struct proxy_reader *prd)
+{
+  return writer_hbcontrol_create_unicast_heartbeat (wr, whcst, hbansreq, prd, 1);
+}
 #endif
 
 void add_Heartbeat (struct nn_xmsg *msg, struct writer *wr, const struct whc_state *whcst, int hbansreq, int hbliveliness, ddsi_entityid_t dst, int issync)
@@ -470,6 +555,7 @@ static dds_return_t create_fragment_message_simple (struct writer *wr, seqno_t s
 
   nn_xmsg_setdstN (*pmsg, wr->as, wr->as_group);
   nn_xmsg_setmaxdelay (*pmsg, wr->xqos->latency_budget.duration);
+  nn_xmsg_setpriority (*pmsg, wr->xqos->transport_priority.value);
   nn_xmsg_add_timestamp (*pmsg, serdata->timestamp);
   data = nn_xmsg_append (*pmsg, &sm_marker, sizeof (Data_t));
 
@@ -530,7 +616,6 @@ dds_return_t create_fragment_message (struct writer *wr, seqno_t seq, const stru
   enum nn_xmsg_kind xmsg_kind = isnew ? NN_XMSG_KIND_DATA : NN_XMSG_KIND_DATA_REXMIT;
   const uint32_t size = ddsi_serdata_size (serdata);
   dds_return_t ret = 0;
-  (void)plist;
 
   ASSERT_MUTEX_HELD (&wr->e.lock);
 
@@ -564,6 +649,7 @@ dds_return_t create_fragment_message (struct writer *wr, seqno_t seq, const stru
     nn_xmsg_setdstN (*pmsg, wr->as, wr->as_group);
     nn_xmsg_setmaxdelay (*pmsg, wr->xqos->latency_budget.duration);
   }
+  nn_xmsg_setpriority (*pmsg, wr->xqos->transport_priority.value);
 
   /* Timestamp only needed once, for the first fragment */
   if (fragnum == 0)
@@ -639,7 +725,7 @@ dds_return_t create_fragment_message (struct writer *wr, seqno_t seq, const stru
   {
     int rc;
     /* Adding parameters means potential reallocing, so sm, ddcmn now likely become invalid */
-    if (wr->include_keyhash)
+    if (wr->include_keyhash && serdata->kind != SDK_EMPTY)
     {
       nn_xmsg_addpar_keyhash (*pmsg, serdata, wr->force_md5_keyhash);
     }
@@ -647,6 +733,11 @@ dds_return_t create_fragment_message (struct writer *wr, seqno_t seq, const stru
     {
       nn_xmsg_addpar_statusinfo (*pmsg, serdata->statusinfo);
     }
+    if (plist != NULL && (plist->present & PP_COHERENT_SET))
+    {
+      nn_sequence_number_t *p = nn_xmsg_addpar (*pmsg, PID_COHERENT_SET, sizeof (*p));
+      *p = plist->coherent_set_seqno;
+    }
     rc = nn_xmsg_addpar_sentinel_ifparam (*pmsg);
     if (rc > 0)
     {
@@ -675,6 +766,80 @@ dds_return_t create_fragment_message (struct writer *wr, seqno_t seq, const stru
   return ret;
 }
 
+static void create_fec_message (struct writer *wr, seqno_t seq, const struct ddsi_plist *plist, struct ddsi_serdata *serdata, uint32_t fragnum, uint16_t nf_in_unit, uint16_t nunits, struct nn_xmsg **pmsg)
+{
+  /* Parity of nunits DATA_FRAGs of nf_in_unit fragments each, starting at
+     fragment fragnum, see SMID_ADLINK_FEC.  Ignores out-of-memory errors:
+     FEC is only an attempt at avoiding the loss of a sample anyway. */
+  const size_t expected_inline_qos_size = /* statusinfo */ 8 + /* keyhash */ 20 + /* coherent set */ 12 + /* sentinel */ 4;
+  struct ddsi_domaingv const * const gv = wr->e.gv;
+  const uint32_t size = ddsi_serdata_size (serdata);
+  const uint32_t unitsize = (uint32_t) nf_in_unit * gv->config.fragment_size;
+  const uint32_t start = fragnum * (uint32_t) gv->config.fragment_size;
+  const uint32_t paritylen = (size - start < unitsize) ? size - start : unitsize;
+  struct nn_xmsg_marker sm_marker;
+  DataFrag_t *fec;
+  unsigned char *parity;
+
+  ASSERT_MUTEX_HELD (&wr->e.lock);
+  assert (serdata->kind != SDK_EMPTY && start < size);
+  if ((*pmsg = nn_xmsg_new (gv->xmsgpool, &wr->e.guid, wr->c.pp, sizeof (InfoTimestamp_t) + sizeof (DataFrag_t) + expected_inline_qos_size + paritylen, NN_XMSG_KIND_DATA)) == NULL)
+    return;
+#ifdef DDSI_INCLUDE_NETWORK_PARTITIONS
+  nn_xmsg_setencoderid (*pmsg, wr->partition_id);
+#endif
+  nn_xmsg_setdstN (*pmsg, wr->as, wr->as_group);
+  nn_xmsg_setmaxdelay (*pmsg, wr->xqos->latency_budget.duration);
+  nn_xmsg_setpriority (*pmsg, wr->xqos->transport_priority.value);
+
+  /* recovering the first fragment requires the timestamp and inline QoS */
+  if (fragnum == 0)
+    nn_xmsg_add_timestamp (*pmsg, serdata->timestamp);
+  fec = nn_xmsg_append (*pmsg, &sm_marker, sizeof (DataFrag_t));
+  nn_xmsg_submsg_init (*pmsg, sm_marker, SMID_ADLINK_FEC);
+  fec->x.smhdr.flags = (unsigned char) (fec->x.smhdr.flags | (serdata->kind == SDK_KEY ? DATAFRAG_FLAG_KEYFLAG : 0));
+  fec->x.extraFlags = nunits;
+  fec->x.readerId = to_entityid (NN_ENTITYID_UNKNOWN);
+  fec->x.writerId = nn_hton_entityid (wr->e.guid.entityid);
+  fec->x.writerSN = toSN (seq);
+  fec->x.octetsToInlineQos = (unsigned short) ((char*) (fec+1) - ((char*) &fec->x.octetsToInlineQos + 2));
+  fec->fragmentStartingNum = fragnum + 1;
+  fec->fragmentsInSubmessage = nf_in_unit;
+  fec->fragmentSize = gv->config.fragment_size;
+  fec->sampleSize = size;
+  if (fragnum == 0)
+  {
+    if (wr->include_keyhash)
+      nn_xmsg_addpar_keyhash (*pmsg, serdata, wr->force_md5_keyhash);
+    if (serdata->statusinfo)
+      nn_xmsg_addpar_statusinfo (*pmsg, serdata->statusinfo);
+    if (plist != NULL && (plist->present & PP_COHERENT_SET))
+    {
+      nn_sequence_number_t *p = nn_xmsg_addpar (*pmsg, PID_COHERENT_SET, sizeof (*p));
+      *p = plist->coherent_set_seqno;
+    }
+    if (nn_xmsg_addpar_sentinel_ifparam (*pmsg) > 0)
+    {
+      fec = nn_xmsg_submsg_from_marker (*pmsg, sm_marker);
+      fec->x.smhdr.flags |= DATAFRAG_FLAG_INLINE_QOS;
+    }
+  }
+
+  parity = nn_xmsg_append (*pmsg, NULL, (paritylen + 3) & ~(size_t) 3);
+  memset (parity, 0, (paritylen + 3) & ~(size_t) 3);
+  for (uint32_t off = start, k = 0; k < nunits && off < size; off += unitsize, k++)
+  {
+    const uint32_t len = (size - off < unitsize) ? size - off : unitsize;
+    ddsrt_iovec_t iov;
+    struct ddsi_serdata *ref = ddsi_serdata_to_ser_ref (serdata, off, len, &iov);
+    const unsigned char *src = iov.iov_base;
+    for (uint32_t i = 0; i < len; i++)
+      parity[i] ^= src[i];
+    ddsi_serdata_to_ser_unref (ref, &iov);
+  }
+  nn_xmsg_submsg_setnext (*pmsg, sm_marker);
+}
+
 static void create_HeartbeatFrag (struct writer *wr, seqno_t seq, unsigned fragnum, struct proxy_reader *prd, struct nn_xmsg **pmsg)
 {
   struct ddsi_domaingv const * const gv = wr->e.gv;
@@ -782,10 +947,19 @@ static void transmit_sample_lgmsg_unlocks_wr (struct nn_xpack *xp, struct writer
     nf_in_submsg = 1;
   else if (nf_in_submsg > UINT16_MAX)
     nf_in_submsg = UINT16_MAX;
-  for (uint32_t i = 0; i < nfrags_lim; i += nf_in_submsg)
+  /* Best-effort data is lost if a single fragment is lost, unless the
+     missing DATA_FRAG can be recovered from a FEC submessage following
+     each group of fec_group_size DATA_FRAGs.  Not for retransmits, not
+     for data protected by DDS Security */
+  const uint32_t nf_in_unit = nf_in_submsg;
+  const uint32_t fec_group_size =
+    (isnew && prd == NULL && nfrags_lim == nfrags && serdata->kind != SDK_EMPTY &&
+     !q_omg_writer_is_submessage_protected (wr) && !q_omg_writer_is_payload_protected (wr)) ? wr->fec_group_size : 0;
+  for (uint32_t i = 0, unit = 0; i < nfrags_lim; i += nf_in_submsg, unit++)
   {
     struct nn_xmsg *fmsg = NULL;
     struct nn_xmsg *hmsg = NULL;
+    struct nn_xmsg *fecmsg = NULL;
     int ret;
 #if 0
     if (must_skip_frag (frags_to_skip, i))
@@ -805,15 +979,78 @@ static void transmit_sample_lgmsg_unlocks_wr (struct nn_xpack *xp, struct writer
       // more fragment messages to come
       create_HeartbeatFrag (wr, seq, i + nf_in_submsg - 1, prd, &hmsg);
     }
+    if (fec_group_size > 0 && ((unit + 1) % fec_group_size == 0 || i + nf_in_submsg == nfrags_lim))
+    {
+      const uint32_t nunits = unit % fec_group_size + 1;
+      create_fec_message (wr, seq, plist, serdata, (unit + 1 - nunits) * nf_in_unit, (uint16_t) nf_in_unit, (uint16_t) nunits, &fecmsg);
+    }
     ddsrt_mutex_unlock (&wr->e.lock);
 
     if(fmsg) nn_xpack_addmsg (xp, fmsg, 0);
     if(hmsg) nn_xpack_addmsg (xp, hmsg, 0);
+    if(fecmsg) nn_xpack_addmsg (xp, fecmsg, 0);
 
     ddsrt_mutex_lock (&wr->e.lock);
   }
 }
 
+static bool transmit_sample_filtered_wrlock_held (struct nn_xpack *xp, struct writer *wr, seqno_t seq, const struct ddsi_plist *plist, struct ddsi_serdata *serdata)
+{
+  /* If some matched proxy readers advertised a content filter that rejects
+     this sample, send it only to those readers that accept it and a GAP to
+     the reliable ones that don't, instead of sending it to the writer's
+     address set.  Returns false (having done nothing) if the sample must
+     be sent the usual way.  Large samples are always sent the usual way:
+     fragmenting them separately for each reader would cost more than the
+     filter saves. */
+  struct ddsi_domaingv * const gv = wr->e.gv;
+  struct wr_prd_match *m;
+  ddsrt_avl_iter_t it;
+  bool all_accept = true;
+
+  if (serdata->kind != SDK_DATA || ddsi_serdata_size (serdata) > gv->config.fragment_size)
+    return false;
+  for (m = ddsrt_avl_iter_first (&wr_readers_treedef, &wr->readers, &it); m && all_accept; m = ddsrt_avl_iter_next (&it))
+  {
+    if (m->filter && !ddsi_filter_accepts (m->filter, serdata))
+      all_accept = false;
+  }
+  if (all_accept)
+    return false;
+
+  ETRACE (wr, "transmit_sample_filtered("PGUIDFMT" #%"PRId64"):", PGUID (wr->e.guid), seq);
+  for (m = ddsrt_avl_iter_first (&wr_readers_treedef, &wr->readers, &it); m; m = ddsrt_avl_iter_next (&it))
+  {
+    struct proxy_reader *prd;
+    struct nn_xmsg *msg = NULL;
+    if ((prd = entidx_lookup_proxy_reader_guid (gv->entity_index, &m->prd_guid)) == NULL)
+      continue;
+    if (m->filter == NULL || ddsi_filter_accepts (m->filter, serdata))
+    {
+      ETRACE (wr, " "PGUIDFMT, PGUID (m->prd_guid));
+      if (create_fragment_message (wr, seq, plist, serdata, 0, 1, prd, &msg, 1, UINT32_MAX) >= 0 && msg)
+        nn_xpack_addmsg (xp, msg, 0);
+    }
+    else
+    {
+      wr->filtered_count++;
+      if (m->is_reliable)
+      {
+        struct nn_gap_info gi;
+        nn_gap_info_init (&gi);
+        nn_gap_info_update (gv, &gi, seq);
+        if ((msg = nn_gap_info_create_gap (wr, prd, &gi)) != NULL)
+          nn_xpack_addmsg (xp, msg, 0);
+      }
+    }
+  }
+  ETRACE (wr, "\n");
+
+  /* "transmitted" even if every reader rejected it */
+  writer_update_seq_xmit (wr, seq);
+  return true;
+}
+
 static void transmit_sample_unlocks_wr (struct nn_xpack *xp, struct writer *wr, const struct whc_state *whcst, seqno_t seq, const struct ddsi_plist *plist, struct ddsi_serdata *serdata, struct proxy_reader *prd, int isnew)
 {
   /* on entry: &wr->e.lock held; on exit: lock no longer held */
@@ -825,7 +1062,11 @@ static void transmit_sample_unlocks_wr (struct nn_xpack *xp, struct writer *wr,
   assert((wr->heartbeat_xevent != NULL) == (whcst != NULL));
 
   sz = ddsi_serdata_size (serdata);
-  if (sz > gv->config.fragment_size || !isnew || plist != NULL || prd != NULL || q_omg_writer_is_submessage_protected(wr))
+  if (isnew && prd == NULL && wr->num_filtered_readers > 0 && transmit_sample_filtered_wrlock_held (xp, wr, seq, plist, serdata))
+  {
+    /* sent to the readers whose content filters accept it */
+  }
+  else if (sz > gv->config.fragment_size || !isnew || plist != NULL || prd != NULL || q_omg_writer_is_submessage_protected(wr))
   {
     assert (wr->init_burst_size_limit <= UINT32_MAX - UINT16_MAX);
     assert (wr->rexmit_burst_size_limit <= UINT32_MAX - UINT16_MAX);
@@ -1104,6 +1345,54 @@ static dds_return_t throttle_writer (struct thread_state1 * const ts1, struct nn
   return result;
 }
 
+static dds_return_t pace_writer (struct thread_state1 * const ts1, struct nn_xpack *xp, struct writer *wr, int64_t delay)
+{
+  /* Wait until the congestion controller allows the next sample to go
+     out, after pushing out whatever is queued in xp so the rate applies
+     to what is actually transmitted.  Same reasoning as in
+     throttle_writer regarding the lifetime of the writer, and it counts
+     as throttling so that deleting the writer waits for it.  Like
+     throttle_writer, it blocks for at most max_blocking_time and
+     returns TIMEOUT if the sample may not be sent by then. */
+  struct ddsi_domaingv const * const gv = wr->e.gv;
+  dds_return_t result = DDS_RETCODE_OK;
+  const ddsrt_mtime_t tstart = ddsrt_time_monotonic ();
+  const ddsrt_mtime_t tend = ddsrt_mtime_add_duration (tstart, delay);
+  const ddsrt_mtime_t abstimeout = ddsrt_mtime_add_duration (tstart, wr->xqos->reliability.max_blocking_time);
+  ddsrt_mtime_t tnow;
+
+  ASSERT_MUTEX_HELD (&wr->e.lock);
+  assert (wr->throttling == 0);
+  assert (wr->congestion_control);
+  GVLOG (DDS_LC_THROTTLE, "writer "PGUIDFMT" pacing %"PRId64"ns (rate %"PRIu32" B/s)\n", PGUID (wr->e.guid), delay, wr->cc.rate);
+  wr->throttling++;
+  if (xp)
+  {
+    ddsrt_mutex_unlock (&wr->e.lock);
+    nn_xpack_send (xp, true);
+    ddsrt_mutex_lock (&wr->e.lock);
+  }
+  while (ddsrt_atomic_ld32 (&gv->rtps_keepgoing) && wr->state == WRST_OPERATIONAL && (tnow = ddsrt_time_monotonic ()).v < tend.v)
+  {
+    if (tnow.v >= abstimeout.v)
+    {
+      GVLOG (DDS_LC_THROTTLE, "writer "PGUIDFMT" pacing timed out\n", PGUID (wr->e.guid));
+      result = DDS_RETCODE_TIMEOUT;
+      break;
+    }
+    thread_state_asleep (ts1);
+    (void) ddsrt_cond_waitfor (&wr->throttle_cond, &wr->e.lock, ((tend.v < abstimeout.v) ? tend.v : abstimeout.v) - tnow.v);
+    thread_state_awake_domain_ok (ts1);
+  }
+  wr->throttling--;
+  if (wr->state != WRST_OPERATIONAL)
+  {
+    /* gc_delete_writer may be waiting */
+    ddsrt_cond_broadcast (&wr->throttle_cond);
+  }
+  return result;
+}
+
 static int maybe_grow_whc (struct writer *wr)
 {
   struct ddsi_domaingv const * const gv = wr->e.gv;
@@ -1226,11 +1515,6 @@ static int write_sample_eot (struct thread_state1 * const ts1, struct nn_xpack *
   if (!wr->alive)
     writer_set_alive_may_unlock (wr, true);
 
-  if (end_of_txn)
-  {
-    wr->cs_seq = 0;
-  }
-
   /* If WHC overfull, block. */
   {
     struct whc_state whcst;
@@ -1258,6 +1542,19 @@ static int write_sample_eot (struct thread_state1 * const ts1, struct nn_xpack *
     }
   }
 
+  if (wr->congestion_control)
+  {
+    const uint32_t size = ddsi_serdata_size (serdata);
+    const int64_t delay = ddsi_congestion_pace (&wr->cc, size, ddsrt_time_monotonic ());
+    if (delay >= DDSI_CONGESTION_MIN_DELAY && pace_writer (ts1, xp, wr, delay) == DDS_RETCODE_TIMEOUT)
+    {
+      ddsi_congestion_cancel (&wr->cc, size);
+      ddsrt_mutex_unlock (&wr->e.lock);
+      r = DDS_RETCODE_TIMEOUT;
+      goto drop;
+    }
+  }
+
   if (wr->state != WRST_OPERATIONAL)
   {
     r = DDS_RETCODE_PRECONDITION_NOT_MET;
@@ -1270,6 +1567,8 @@ static int write_sample_eot (struct thread_state1 * const ts1, struct nn_xpack *
   serdata->twrite = tnow;
 
   seq = ++wr->seq;
+  if (wr->in_coherent_set && wr->cs_seq == 0)
+    wr->cs_seq = seq;
   if (wr->cs_seq != 0)
   {
     if (plist == NULL)
@@ -1281,6 +1580,11 @@ static int write_sample_eot (struct thread_state1 * const ts1, struct nn_xpack *
     plist->present |= PP_COHERENT_SET;
     plist->coherent_set_seqno = toSN (wr->cs_seq);
   }
+  if (end_of_txn)
+  {
+    wr->cs_seq = 0;
+    wr->in_coherent_set = 0;
+  }
 
   if ((r = insert_sample_in_whc (wr, seq, plist, serdata, tk)) < 0)
   {
@@ -1375,6 +1679,208 @@ drop:
   return r;
 }
 
+#define WRITE_SAMPLE_BATCH_MAXPENDING 32
+
+static void write_sample_batch_addpending (struct nn_xpack *xp, struct writer *wr, struct nn_xmsg **pending, uint32_t *npending)
+{
+  /* on entry and on exit: &wr->e.lock held */
+  if (*npending == 0)
+    return;
+  ddsrt_mutex_unlock (&wr->e.lock);
+  for (uint32_t i = 0; i < *npending; i++)
+    nn_xpack_addmsg (xp, pending[i], 0);
+  *npending = 0;
+  ddsrt_mutex_lock (&wr->e.lock);
+}
+
+int write_sample_gc_batch (struct thread_state1 * const ts1, struct nn_xpack *xp, struct writer *wr, uint32_t n, struct ddsi_serdata **serdata, struct ddsi_tkmap_instance **tk, uint32_t *nwritten)
+{
+  /* Equivalent to calling write_sample_gc for each of the samples in turn,
+     but without releasing the writer lock in between except when the writer
+     must be throttled or the sample needs to be fragmented.  Small samples
+     are packed with the lock held and handed to xp afterwards, followed by
+     at most one piggy-backed heartbeat for the whole batch. */
+  struct ddsi_domaingv const * const gv = wr->e.gv;
+  struct nn_xmsg *pending[WRITE_SAMPLE_BATCH_MAXPENDING];
+  uint32_t npending = 0, i;
+  struct nn_xmsg *hmsg = NULL;
+  int hbansreq = 0;
+  struct lease *lease;
+  ddsrt_mtime_t tnow = { 0 };
+  uint32_t nvalid;
+  int r = 0;
+
+  assert (xp != NULL);
+  /* Samples preceding an oversize one are written, the remainder is dropped */
+  for (nvalid = 0; nvalid < n; nvalid++)
+    if (ddsi_serdata_size (serdata[nvalid]) > gv->config.max_sample_size)
+      break;
+  if (nvalid == 0)
+  {
+    i = 0;
+    goto oversize;
+  }
+
+  if (wr->xqos->liveliness.kind == DDS_LIVELINESS_MANUAL_BY_PARTICIPANT && ((lease = ddsrt_atomic_ldvoidp (&wr->c.pp->minl_man)) != NULL))
+    lease_renew (lease, ddsrt_time_elapsed());
+  else if (wr->xqos->liveliness.kind == DDS_LIVELINESS_MANUAL_BY_TOPIC && wr->lease != NULL)
+    lease_renew (wr->lease, ddsrt_time_elapsed());
+
+  ddsrt_mutex_lock (&wr->e.lock);
+
+  if (!wr->alive)
+    writer_set_alive_may_unlock (wr, true);
+
+  for (i = 0; i < nvalid; i++)
+  {
+    struct ddsi_serdata * const sd = serdata[i];
+    struct ddsi_plist *plist = NULL;
+    seqno_t seq;
+
+    /* If WHC overfull, block; the pending messages must be in xp for
+       throttle_writer to push them out or the readers can't ack them */
+    struct whc_state whcst;
+    whc_get_state (wr->whc, &whcst);
+    if (whcst.unacked_bytes > wr->whc_high)
+    {
+      bool throttle = true;
+      if (!(gv->config.prioritize_retransmit && wr->retransmitting))
+      {
+        maybe_grow_whc (wr);
+        throttle = (whcst.unacked_bytes > wr->whc_high);
+      }
+      if (throttle)
+      {
+        write_sample_batch_addpending (xp, wr, pending, &npending);
+        if (throttle_writer (ts1, xp, wr) == DDS_RETCODE_TIMEOUT)
+        {
+          r = DDS_RETCODE_TIMEOUT;
+          break;
+        }
+      }
+    }
+
+    if (wr->congestion_control)
+    {
+      const uint32_t size = ddsi_serdata_size (sd);
+      const int64_t delay = ddsi_congestion_pace (&wr->cc, size, ddsrt_time_monotonic ());
+      if (delay >= DDSI_CONGESTION_MIN_DELAY)
+      {
+        write_sample_batch_addpending (xp, wr, pending, &npending);
+        if (pace_writer (ts1, xp, wr, delay) == DDS_RETCODE_TIMEOUT)
+        {
+          ddsi_congestion_cancel (&wr->cc, size);
+          r = DDS_RETCODE_TIMEOUT;
+          break;
+        }
+      }
+    }
+
+    if (wr->state != WRST_OPERATIONAL)
+    {
+      r = DDS_RETCODE_PRECONDITION_NOT_MET;
+      break;
+    }
+
+    tnow = ddsrt_time_monotonic ();
+    sd->twrite = tnow;
+
+    seq = ++wr->seq;
+    if (wr->in_coherent_set && wr->cs_seq == 0)
+      wr->cs_seq = seq;
+    if (wr->cs_seq != 0)
+    {
+      plist = ddsrt_malloc (sizeof (*plist));
+      ddsi_plist_init_empty (plist);
+      plist->present |= PP_COHERENT_SET;
+      plist->coherent_set_seqno = toSN (wr->cs_seq);
+    }
+
+    if ((r = insert_sample_in_whc (wr, seq, plist, sd, tk[i])) < 0)
+    {
+      if (plist != NULL)
+      {
+        ddsi_plist_fini (plist);
+        ddsrt_free (plist);
+      }
+      break;
+    }
+    else if (wr->test_drop_outgoing_data || (addrset_empty (wr->as) && (wr->as_group == NULL || addrset_empty (wr->as_group))))
+    {
+      writer_update_seq_xmit (wr, seq);
+    }
+    else if (plist == NULL && wr->num_filtered_readers == 0 && ddsi_serdata_size (sd) <= gv->config.fragment_size && !q_omg_writer_is_submessage_protected (wr))
+    {
+      struct nn_xmsg *fmsg;
+      if (create_fragment_message_simple (wr, seq, sd, &fmsg) >= 0)
+      {
+        pending[npending++] = fmsg;
+        if (npending == WRITE_SAMPLE_BATCH_MAXPENDING)
+          write_sample_batch_addpending (xp, wr, pending, &npending);
+      }
+    }
+    else
+    {
+      ddsi_plist_t plist_stk, *plist_copy;
+      struct whc_state *whcstptr;
+      write_sample_batch_addpending (xp, wr, pending, &npending);
+      if (plist == NULL)
+        plist_copy = NULL;
+      else
+      {
+        plist_copy = &plist_stk;
+        ddsi_plist_copy (plist_copy, plist);
+      }
+      if (wr->heartbeat_xevent == NULL)
+        whcstptr = NULL;
+      else
+      {
+        whc_get_state (wr->whc, &whcst);
+        whcstptr = &whcst;
+      }
+      transmit_sample_unlocks_wr (xp, wr, whcstptr, seq, plist_copy, sd, NULL, 1);
+      if (plist_copy)
+        ddsi_plist_fini (plist_copy);
+      ddsrt_mutex_lock (&wr->e.lock);
+    }
+
+    /* If not actually inserted, WHC didn't take ownership of plist */
+    if (r == 0 && plist != NULL)
+    {
+      ddsi_plist_fini (plist);
+      ddsrt_free (plist);
+    }
+  }
+
+  if (npending > 0 && wr->heartbeat_xevent)
+  {
+    struct whc_state whcst;
+    whc_get_state (wr->whc, &whcst);
+    hmsg = writer_hbcontrol_piggyback (wr, &whcst, tnow, nn_xpack_packetid (xp), &hbansreq);
+  }
+  ddsrt_mutex_unlock (&wr->e.lock);
+
+  for (uint32_t j = 0; j < npending; j++)
+    nn_xpack_addmsg (xp, pending[j], 0);
+  if (hmsg)
+    nn_xpack_addmsg (xp, hmsg, 0);
+  if (hbansreq >= 2)
+    nn_xpack_send (xp, true);
+
+oversize:
+  if (r >= 0 && nvalid < n)
+  {
+    GVWARNING ("dropping oversize (%"PRIu32" > %"PRIu32") sample %"PRIu32" and the %"PRIu32" samples following it in a batch from local writer "PGUIDFMT" %s/%s\n",
+               ddsi_serdata_size (serdata[nvalid]), gv->config.max_sample_size, nvalid, n - nvalid - 1,
+               PGUID (wr->e.guid), wr->topic->name, wr->topic->type_name);
+    r = DDS_RETCODE_BAD_PARAMETER;
+  }
+  *nwritten = (r < 0) ? i : n;
+  for (i = 0; i < n; i++)
+    ddsi_serdata_unref (serdata[i]);
+  return (r < 0) ? r : 0;
+}
+
 int write_sample_gc (struct thread_state1 * const ts1, struct nn_xpack *xp, struct writer *wr, struct ddsi_serdata *serdata, struct ddsi_tkmap_instance *tk)
 {
   return write_sample_eot (ts1, xp, wr, NULL, serdata, tk, 0, 1);
@@ -1406,3 +1912,43 @@ int write_sample_nogc_notk (struct thread_state1 * const ts1, struct nn_xpack *x
   ddsi_tkmap_instance_unref (wr->e.gv->m_tkmap, tk);
   return res;
 }
+
+void writer_begin_coherent_set (struct writer *wr)
+{
+  ddsrt_mutex_lock (&wr->e.lock);
+  wr->in_coherent_set = 1;
+  ddsrt_mutex_unlock (&wr->e.lock);
+}
+
+static void writer_abort_coherent_set (struct writer *wr)
+{
+  ddsrt_mutex_lock (&wr->e.lock);
+  wr->cs_seq = 0;
+  wr->in_coherent_set = 0;
+  ddsrt_mutex_unlock (&wr->e.lock);
+}
+
+int write_end_coherent_set (struct thread_state1 * const ts1, struct nn_xpack *xp, struct writer *wr)
+{
+  struct ddsi_serdata *serdata;
+  bool empty_set;
+  int res;
+  ddsrt_mutex_lock (&wr->e.lock);
+  empty_set = (wr->cs_seq == 0);
+  if (empty_set)
+    wr->in_coherent_set = 0;
+  ddsrt_mutex_unlock (&wr->e.lock);
+  if (empty_set)
+    return 0;
+  if ((serdata = ddsi_serdata_from_sample (wr->topic, SDK_EMPTY, NULL)) == NULL)
+  {
+    writer_abort_coherent_set (wr);
+    return DDS_RETCODE_UNSUPPORTED;
+  }
+  serdata->timestamp = ddsrt_time_wallclock ();
+  /* a failure can occur before the end of the set has been recorded, but the
+     writer mustn't stay in the set in any case */
+  if ((res = write_sample_eot (ts1, xp, wr, NULL, serdata, NULL, 1, 1)) < 0)
+    writer_abort_coherent_set (wr);
+  return res;
+}
@@ -43,6 +43,8 @@
 #include "dds/ddsi/ddsi_tkmap.h"
 #include "dds/ddsi/ddsi_pmd.h"
 #include "dds/ddsi/ddsi_acknack.h"
+#include "dds/ddsi/ddsi_filter.h"
+#include "dds/ddsi/q_receive.h"
 #include "dds__whc.h"
 
 #include "dds/ddsi/sysdeps.h"
@@ -60,6 +62,7 @@ enum xeventkind
   XEVK_SPDP,
   XEVK_PMD_UPDATE,
   XEVK_DELETE_WRITER,
+  XEVK_HISTORICAL_DATA,
   XEVK_CALLBACK
 };
 
@@ -92,6 +95,10 @@ struct xevent
     struct {
       ddsi_guid_t guid;
     } delete_writer;
+    struct {
+      ddsi_guid_t wr_guid;
+      ddsi_guid_t prd_guid;
+    } historical_data;
     struct {
       void (*cb) (struct xevent *ev, void *arg, ddsrt_mtime_t tnow);
       void *arg;
@@ -327,6 +334,7 @@ static void free_xevent (struct xeventq *evq, struct xevent *ev)
       case XEVK_SPDP:
       case XEVK_PMD_UPDATE:
       case XEVK_DELETE_WRITER:
+      case XEVK_HISTORICAL_DATA:
       case XEVK_CALLBACK:
         break;
     }
@@ -714,6 +722,63 @@ static void send_heartbeat_to_all_readers (struct nn_xpack *xp, struct xevent *e
 
 #endif
 
+static void send_heartbeat_to_lagging_readers (struct nn_xpack *xp, struct xevent *ev, struct writer *wr, const struct whc_state *whcst, int hbansreq, ddsrt_mtime_t tnow)
+{
+  /* Called with the writer locked, unlocks it.  Only the readers that haven't
+     acknowledged all data need a heartbeat, and of those only the ones that
+     aren't expected to respond to the previous one anyway. */
+  struct ddsi_domaingv const * const gv = wr->e.gv;
+  struct wr_prd_match *m;
+  ddsi_guid_t last_guid = { .prefix = {.u = {0,0,0}}, .entityid = {0} };
+  ddsrt_mtime_t t_next;
+  uint32_t count = 0, pending = 0;
+
+  ASSERT_MUTEX_HELD (&wr->e.lock);
+  while ((m = ddsrt_avl_lookup_succ (&wr_readers_treedef, &wr->readers, &last_guid)) != NULL)
+  {
+    struct proxy_reader *prd;
+    struct nn_xmsg *msg;
+    last_guid = m->prd_guid;
+    if (!m->is_reliable || m->seq >= wr->seq)
+      continue;
+    if (writer_hbcontrol_ack_pending (wr, m, tnow))
+    {
+      pending++;
+      continue;
+    }
+    if ((prd = entidx_lookup_proxy_reader_guid (gv->entity_index, &m->prd_guid)) == NULL)
+      continue;
+    if ((msg = writer_hbcontrol_create_unicast_heartbeat (wr, whcst, hbansreq, prd, 0)) == NULL)
+      continue;
+    if (hbansreq)
+      m->t_ackhb = tnow;
+    count++;
+    if (wr->test_suppress_heartbeat)
+    {
+      GVTRACE ("test_suppress_heartbeat\n");
+      nn_xmsg_free (msg);
+    }
+    else
+    {
+      /* see handle_xevk_heartbeat for why the lock must be released */
+      ddsrt_mutex_unlock (&wr->e.lock);
+      nn_xpack_addmsg (xp, msg, 0);
+      ddsrt_mutex_lock (&wr->e.lock);
+    }
+  }
+  if (count > 0)
+    writer_hbcontrol_note_hb (wr, tnow, hbansreq);
+
+  t_next.v = tnow.v + writer_hbcontrol_intv (wr, whcst, tnow);
+  t_next = writer_hbcontrol_align (wr, t_next);
+  GVTRACE ("heartbeat(wr "PGUIDFMT"%s) sent to %"PRIu32" lagging readers (%"PRIu32" pending), resched in %g s\n",
+           PGUID (wr->e.guid), hbansreq ? "" : " final", count, pending,
+           (t_next.v == DDS_NEVER) ? INFINITY : (double)(t_next.v - tnow.v) / 1e9);
+  (void) resched_xevent_if_earlier (ev, t_next);
+  wr->hbcontrol.tsched = t_next;
+  ddsrt_mutex_unlock (&wr->e.lock);
+}
+
 static void handle_xevk_heartbeat (struct nn_xpack *xp, struct xevent *ev, ddsrt_mtime_t tnow)
 {
   struct ddsi_domaingv const * const gv = ev->evq->gv;
@@ -755,9 +820,22 @@ static void handle_xevk_heartbeat (struct nn_xpack *xp, struct xevent *ev, ddsrt
   else
   {
     hbansreq = writer_hbcontrol_ack_required (wr, &whcst, tnow);
+    if (wr->adaptive_heartbeat)
+    {
+      /* unicasting only saves something if there are readers that needn't
+         get the heartbeat at all, or if there is just the one reader */
+      const uint32_t n_lagging = writer_hbcontrol_num_lagging_readers (wr);
+      if (n_lagging > 0 && n_lagging <= WRITER_HBCONTROL_MAX_UNICAST &&
+          (n_lagging < wr->num_reliable_readers || wr->num_reliable_readers == 1))
+      {
+        send_heartbeat_to_lagging_readers (xp, ev, wr, &whcst, hbansreq, tnow);
+        return;
+      }
+    }
     msg = writer_hbcontrol_create_heartbeat (wr, &whcst, tnow, hbansreq, 0);
     t_next.v = tnow.v + writer_hbcontrol_intv (wr, &whcst, tnow);
   }
+  t_next = writer_hbcontrol_align (wr, t_next);
 
   GVTRACE ("heartbeat(wr "PGUIDFMT"%s) %s, resched in %g s (min-ack %"PRId64"%s, avail-seq %"PRId64", xmit %"PRId64")\n",
            PGUID (wr->e.guid),
@@ -1091,6 +1169,152 @@ static void handle_xevk_delete_writer (UNUSED_ARG (struct nn_xpack *xp), struct
   delete_xevent (ev);
 }
 
+static void flush_historical_data_gap (struct nn_xpack *xp, struct writer *wr, struct proxy_reader *prd, struct nn_gap_info *gi)
+{
+  struct nn_xmsg *msg;
+  if ((msg = nn_gap_info_create_gap (wr, prd, gi)) != NULL)
+    nn_xpack_addmsg (xp, msg, 0);
+  nn_gap_info_init (gi);
+}
+
+static void add_historical_data_gap (struct nn_xpack *xp, struct writer *wr, struct proxy_reader *prd, struct nn_gap_info *gi, seqno_t start, seqno_t end)
+{
+  /* Adds [start,end) to the pending GAP, extending the range or setting bits in the
+     bitmap while that is possible, so that a burst generates few GAP submessages */
+  if (start >= end)
+    return;
+  if (gi->gapstart > 0 && !(gi->gapnumbits == 0 && start == gi->gapend) && end - gi->gapend > 256)
+    flush_historical_data_gap (xp, wr, prd, gi);
+  if (gi->gapstart <= 0)
+  {
+    gi->gapstart = start;
+    gi->gapend = end;
+  }
+  else if (gi->gapnumbits == 0 && start == gi->gapend)
+  {
+    gi->gapend = end;
+  }
+  else
+  {
+    for (seqno_t s = start; s < end; s++)
+      nn_bitset_set (256, gi->gapbits, (uint32_t) (s - gi->gapend));
+    gi->gapnumbits = (uint32_t) (end - gi->gapend);
+  }
+}
+
+static void add_historical_data_heartbeat (struct nn_xpack *xp, struct writer *wr, struct proxy_reader *prd, int hbansreq)
+{
+  struct whc_state whcst;
+  struct nn_xmsg *msg;
+  msg = nn_xmsg_new (wr->e.gv->xmsgpool, &wr->e.guid, wr->c.pp, 0, NN_XMSG_KIND_CONTROL);
+#ifdef DDSI_INCLUDE_NETWORK_PARTITIONS
+  nn_xmsg_setencoderid (msg, wr->partition_id);
+#endif
+  nn_xmsg_setdstPRD (msg, prd);
+  whc_get_state (wr->whc, &whcst);
+  add_Heartbeat (msg, wr, &whcst, hbansreq, 0, prd->e.guid.entityid, 0);
+  nn_xpack_addmsg (xp, msg, 0);
+}
+
+static void handle_xevk_historical_data (struct nn_xpack *xp, struct xevent *ev, ddsrt_mtime_t tnow)
+{
+  /* Streams the writer history cache contents to a late-joining reader in sequence
+     number order, packing as many samples as fit in a message and gapping the
+     sequence numbers that are not available, in bursts limited in size and
+     spaced in time.  The reader's NACKs for sequence numbers that have not been
+     streamed yet are ignored (see handle_AckNack), so this replaces the usual
+     heartbeat-acknack-retransmit cycles, only what gets lost is left to those. */
+  struct ddsi_domaingv * const gv = ev->evq->gv;
+  struct writer *wr;
+  struct proxy_reader *prd;
+  struct wr_prd_match *m;
+  uint32_t budget = gv->config.max_historical_data_burst_size;
+  uint32_t nsamples = 0;
+  struct nn_gap_info gi;
+  seqno_t seq, gapstart;
+
+  if ((wr = entidx_lookup_writer_guid (gv->entity_index, &ev->u.historical_data.wr_guid)) == NULL)
+  {
+    GVTRACE ("historical_data(wr "PGUIDFMT") writer gone\n", PGUID (ev->u.historical_data.wr_guid));
+    delete_xevent (ev);
+    return;
+  }
+  ddsrt_mutex_lock (&wr->e.lock);
+  if ((m = ddsrt_avl_lookup (&wr_readers_treedef, &wr->readers, &ev->u.historical_data.prd_guid)) == NULL || m->hist_xevent != ev)
+  {
+    GVTRACE ("historical_data(wr "PGUIDFMT" prd "PGUIDFMT") not connected\n", PGUID (wr->e.guid), PGUID (ev->u.historical_data.prd_guid));
+    ddsrt_mutex_unlock (&wr->e.lock);
+    delete_xevent (ev);
+    return;
+  }
+  if ((prd = entidx_lookup_proxy_reader_guid (gv->entity_index, &m->prd_guid)) == NULL)
+  {
+    GVTRACE ("historical_data(wr "PGUIDFMT" prd "PGUIDFMT") proxy reader gone\n", PGUID (wr->e.guid), PGUID (m->prd_guid));
+    m->hist_xevent = NULL;
+    ddsrt_mutex_unlock (&wr->e.lock);
+    delete_xevent (ev);
+    return;
+  }
+
+  GVTRACE ("historical_data(wr "PGUIDFMT" prd "PGUIDFMT") %"PRId64"..%"PRId64, PGUID (wr->e.guid), PGUID (prd->e.guid), m->hist_seq, m->hist_maxseq);
+  /* A reader ignores data from a writer until it has received a heartbeat from
+     it, so precede each burst by one that doesn't request a response */
+  add_historical_data_heartbeat (xp, wr, prd, 0);
+  nn_gap_info_init (&gi);
+  gapstart = seq = m->hist_seq;
+  while (budget > 0 && (seq = whc_next_seq (wr->whc, seq - 1)) <= m->hist_maxseq)
+  {
+    struct whc_borrowed_sample sample;
+    if (!whc_borrow_sample (wr->whc, seq, &sample))
+      break;
+    if ((prd->filter && !prd->filter (wr, prd, sample.serdata)) ||
+        (m->filter && !ddsi_filter_accepts (m->filter, sample.serdata)))
+    {
+      /* gapped together with what precedes and follows it */
+    }
+    else
+    {
+      const uint32_t size = ddsi_serdata_size (sample.serdata);
+      const uint32_t nfrags = (size == 0) ? 1 : (size + gv->config.fragment_size - 1) / gv->config.fragment_size;
+      add_historical_data_gap (xp, wr, prd, &gi, gapstart, seq);
+      for (uint32_t i = 0; i < nfrags; i++)
+      {
+        struct nn_xmsg *fmsg;
+        if (create_fragment_message (wr, seq, sample.plist, sample.serdata, i, 1, prd, &fmsg, 0, UINT32_MAX) >= 0)
+          nn_xpack_addmsg (xp, fmsg, 0);
+      }
+      budget = (size >= budget) ? 0 : budget - size;
+      wr->rexmit_bytes += size;
+      nsamples++;
+      gapstart = seq + 1;
+    }
+    whc_return_sample (wr->whc, &sample, false);
+    seq++;
+  }
+
+  if (seq <= m->hist_maxseq)
+  {
+    const ddsrt_mtime_t tnext = ddsrt_mtime_add_duration (tnow, gv->config.historical_data_burst_interval);
+    add_historical_data_gap (xp, wr, prd, &gi, gapstart, seq);
+    flush_historical_data_gap (xp, wr, prd, &gi);
+    m->hist_seq = seq;
+    GVTRACE (" sent %"PRIu32" next %"PRId64"\n", nsamples, seq);
+    (void) resched_xevent_if_earlier (ev, tnext);
+  }
+  else
+  {
+    /* Done: gap whatever follows the last sample and request an acknowledgement so
+       that anything lost gets retransmitted without delay */
+    add_historical_data_gap (xp, wr, prd, &gi, gapstart, m->hist_maxseq + 1);
+    flush_historical_data_gap (xp, wr, prd, &gi);
+    add_historical_data_heartbeat (xp, wr, prd, 1);
+    GVTRACE (" sent %"PRIu32" done\n", nsamples);
+    m->hist_xevent = NULL;
+    delete_xevent (ev);
+  }
+  ddsrt_mutex_unlock (&wr->e.lock);
+}
+
 static void handle_individual_xevent (struct thread_state1 * const ts1, struct xevent *xev, struct nn_xpack *xp, ddsrt_mtime_t tnow)
 {
   struct xeventq *xevq = xev->evq;
@@ -1126,6 +1350,9 @@ static void handle_individual_xevent (struct thread_state1 * const ts1, struct x
       case XEVK_DELETE_WRITER:
         handle_xevk_delete_writer (xp, xev, tnow);
         break;
+      case XEVK_HISTORICAL_DATA:
+        handle_xevk_historical_data (xp, xev, tnow);
+        break;
       case XEVK_CALLBACK:
         assert (0);
         break;
@@ -1479,6 +1706,18 @@ struct xevent *qxev_delete_writer (struct xeventq *evq, ddsrt_mtime_t tsched, co
   return ev;
 }
 
+struct xevent *qxev_historical_data (struct xeventq *evq, ddsrt_mtime_t tsched, const ddsi_guid_t *wr_guid, const ddsi_guid_t *prd_guid)
+{
+  struct xevent *ev;
+  ddsrt_mutex_lock (&evq->lock);
+  ev = qxev_common (evq, tsched, XEVK_HISTORICAL_DATA);
+  ev->u.historical_data.wr_guid = *wr_guid;
+  ev->u.historical_data.prd_guid = *prd_guid;
+  qxev_insert (ev);
+  ddsrt_mutex_unlock (&evq->lock);
+  return ev;
+}
+
 struct xevent *qxev_callback (struct xeventq *evq, ddsrt_mtime_t tsched, void (*cb) (struct xevent *ev, void *arg, ddsrt_mtime_t tnow), void *arg)
 {
   struct xevent *ev;
@@ -79,6 +79,7 @@ struct nn_xmsg {
   nn_msg_sec_info_t sec_info;
 #endif
   int64_t maxdelay;
+  int32_t priority;
 #ifdef DDSI_INCLUDE_NETWORK_PARTITIONS
   uint32_t encoderid;
 #endif
@@ -200,6 +201,7 @@ struct nn_xpack
   ddsi_guid_prefix_t *last_src;
   InfoDST_t *last_dst;
   int64_t maxdelay;
+  int32_t priority; /* highest priority of the messages in it, for ordering the sendq */
   unsigned packetid;
   ddsrt_atomic_uint32_t calls;
   uint32_t call_flags;
@@ -293,6 +295,7 @@ static void nn_xmsg_reinit (struct nn_xmsg *m, enum nn_xmsg_kind kind)
   m->dstmode = NN_XMSG_DST_UNSET;
   m->kind = kind;
   m->maxdelay = 0;
+  m->priority = 0;
 #ifdef DDSI_INCLUDE_SECURITY
   m->refd_payload_encoded = NULL;
   m->sec_info.use_rtps_encoding = 0;
@@ -415,7 +418,7 @@ static int submsg_is_compatible (const struct nn_xmsg *msg, SubmessageKind_t smk
         case SMID_ADLINK_ENTITY_ID:
           /* normal control stuff is ok */
           return 1;
-        case SMID_DATA: case SMID_DATA_FRAG:
+        case SMID_DATA: case SMID_DATA_FRAG: case SMID_ADLINK_FEC:
           /* but data is strictly verboten */
           return 0;
         case SMID_SEC_BODY:
@@ -440,7 +443,7 @@ static int submsg_is_compatible (const struct nn_xmsg *msg, SubmessageKind_t smk
         case SMID_INFO_DST: case SMID_INFO_REPLY:
           /* we never generate these directly */
           return 0;
-        case SMID_INFO_TS: case SMID_DATA: case SMID_DATA_FRAG:
+        case SMID_INFO_TS: case SMID_DATA: case SMID_DATA_FRAG: case SMID_ADLINK_FEC:
           /* Timestamp only preceding data; data may be present just
              once for rexmits.  The readerId offset can be used to
              ensure rexmits have only one data submessages -- the test
@@ -905,6 +908,11 @@ int nn_xmsg_setmaxdelay (struct nn_xmsg *msg, int64_t maxdelay)
   return 0;
 }
 
+void nn_xmsg_setpriority (struct nn_xmsg *msg, int32_t priority)
+{
+  msg->priority = priority;
+}
+
 #ifdef DDSI_INCLUDE_NETWORK_PARTITIONS
 int nn_xmsg_setencoderid (struct nn_xmsg *msg, uint32_t encoderid)
 {
@@ -1138,6 +1146,7 @@ static void nn_xpack_reinit (struct nn_xpack *xp)
   xp->includes_rexmit = false;
   xp->included_msgs.latest = NULL;
   xp->maxdelay = DDS_INFINITY;
+  xp->priority = INT32_MIN;
 #ifdef DDSI_INCLUDE_SECURITY
   xp->sec_info.use_rtps_encoding = 0;
 #endif
@@ -1203,6 +1212,9 @@ void nn_xpack_free (struct nn_xpack *xp)
 static ssize_t nn_xpack_send_rtps(struct nn_xpack * xp, const nn_locator_t *loc)
 {
   ssize_t ret = -1;
+  /* Peers on the same host may be reached via shared memory, everything else goes out
+     over the connection the xpack was created for */
+  ddsi_tran_conn_t conn = (loc->kind == NN_LOCATOR_KIND_SHM && xp->gv->shm_conn) ? xp->gv->shm_conn : xp->conn;
 
 #ifdef DDSI_INCLUDE_SECURITY
   /* Only encode when needed. */
@@ -1210,7 +1222,7 @@ static ssize_t nn_xpack_send_rtps(struct nn_xpack * xp, const nn_locator_t *loc)
   {
     ret = secure_conn_write(
                       xp->gv,
-                      xp->conn,
+                      conn,
                       loc,
                       xp->niov,
                       xp->iov,
@@ -1223,7 +1235,7 @@ static ssize_t nn_xpack_send_rtps(struct nn_xpack * xp, const nn_locator_t *loc)
   else
 #endif /* DDSI_INCLUDE_SECURITY */
   {
-    ret = ddsi_conn_write (xp->conn, loc, xp->niov, xp->iov, xp->call_flags);
+    ret = ddsi_conn_write (conn, loc, xp->niov, xp->iov, xp->call_flags);
   }
 
   return ret;
@@ -1294,6 +1306,85 @@ static void nn_xpack_send1v (const nn_locator_t *loc, void * varg)
   (void) nn_xpack_send1 (loc, varg);
 }
 
+/* Destinations are handed to the transport in groups of at most this many if it
+   supports sending a single message to multiple destinations */
+#define NN_XPACK_SENDMULTI_MAX 32
+
+struct nn_xpack_sendmulti_arg {
+  struct nn_xpack *xp;
+  size_t calls;
+  size_t ndst;
+  /* copies, because address sets may be updated in place once unlocked */
+  nn_locator_t loc[NN_XPACK_SENDMULTI_MAX];
+  const nn_locator_t *dst[NN_XPACK_SENDMULTI_MAX];
+};
+
+static void nn_xpack_sendmulti_flush (struct nn_xpack_sendmulti_arg *arg)
+{
+  struct nn_xpack * const xp = arg->xp;
+  if (arg->ndst == 0)
+    return;
+  const ssize_t nbytes = ddsi_conn_write_multi (xp->conn, arg->ndst, arg->dst, xp->niov, xp->iov, xp->call_flags);
+  xp->call_flags = 0;
+  arg->ndst = 0;
+#ifdef DDSI_INCLUDE_BANDWIDTH_LIMITING
+  if (nbytes > 0)
+  {
+    nn_bw_limit_sleep_if_needed (xp->gv, &xp->limiter, nbytes);
+  }
+#else
+  (void) nbytes;
+#endif
+}
+
+static void nn_xpack_sendmulti1 (const nn_locator_t *loc, void * varg)
+{
+  struct nn_xpack_sendmulti_arg * const arg = varg;
+  struct ddsi_domaingv const * const gv = arg->xp->gv;
+  arg->calls++;
+  if (loc->kind == NN_LOCATOR_KIND_SHM && gv->shm_conn)
+  {
+    /* goes out over a different connection */
+    (void) nn_xpack_send1 (loc, arg->xp);
+    return;
+  }
+  if (gv->logconfig.c.mask & DDS_LC_TRACE)
+  {
+    char buf[DDSI_LOCSTRLEN];
+    GVTRACE (" %s", ddsi_locator_to_string (buf, sizeof(buf), loc));
+  }
+  arg->loc[arg->ndst] = *loc;
+  arg->dst[arg->ndst] = &arg->loc[arg->ndst];
+  arg->ndst++;
+  if (arg->ndst == NN_XPACK_SENDMULTI_MAX)
+    nn_xpack_sendmulti_flush (arg);
+}
+
+static bool nn_xpack_can_sendmulti (const struct nn_xpack *xp)
+{
+  /* Simulated packet loss, muting and encoding of the entire message are all
+     handled per destination in nn_xpack_send1 */
+  struct ddsi_domaingv const * const gv = xp->gv;
+  if (xp->conn->m_write_multi_fn == 0 || gv->mute || gv->config.xmit_lossiness > 0)
+    return false;
+#ifdef DDSI_INCLUDE_SECURITY
+  if (xp->sec_info.use_rtps_encoding)
+    return false;
+#endif
+  return true;
+}
+
+static size_t nn_xpack_sendmulti (struct nn_xpack *xp, struct addrset *as)
+{
+  struct nn_xpack_sendmulti_arg arg;
+  arg.xp = xp;
+  arg.calls = 0;
+  arg.ndst = 0;
+  addrset_forall (as, nn_xpack_sendmulti1, &arg);
+  nn_xpack_sendmulti_flush (&arg);
+  return arg.calls;
+}
+
 typedef struct nn_xpack_send1_thread_arg {
   const nn_locator_t *loc;
   struct nn_xpack *xp;
@@ -1357,7 +1448,11 @@ static void nn_xpack_send_real (struct nn_xpack *xp)
     calls = 0;
     if (xp->dstaddr.all.as)
     {
-      if (xp->gv->thread_pool == NULL)
+      if (xp->gv->thread_pool == NULL && nn_xpack_can_sendmulti (xp))
+      {
+        calls = nn_xpack_sendmulti (xp, xp->dstaddr.all.as);
+      }
+      else if (xp->gv->thread_pool == NULL)
       {
         calls = addrset_forall_count (xp->dstaddr.all.as, nn_xpack_send1v, xp);
       }
@@ -1399,9 +1494,16 @@ static void nn_xpack_send_real (struct nn_xpack *xp)
 #define SENDQ_HW 10
 #define SENDQ_LW 0
 
+/* With priority scheduling, a packet that overtakes queued packets of a
+   lower priority is only made to wait for the queue to drain once the
+   queue is this long, so that high-priority data doesn't get stuck behind
+   bulk data */
+#define SENDQ_PREEMPT_MAX (2 * SENDQ_MAX)
+
 static uint32_t nn_xpack_sendq_thread (void *vgv)
 {
   struct ddsi_domaingv *gv = vgv;
+  struct thread_state1 * const ts1 = lookup_thread_state ();
   ddsrt_mutex_lock (&gv->sendq_lock);
   while (!(gv->sendq_stop && gv->sendq_head == NULL))
   {
@@ -1416,8 +1518,11 @@ static uint32_t nn_xpack_sendq_thread (void *vgv)
       if (--gv->sendq_length == SENDQ_LW)
         ddsrt_cond_broadcast (&gv->sendq_cond);
       ddsrt_mutex_unlock (&gv->sendq_lock);
+      /* releasing the messages updates the writers' transmit sequence numbers */
+      thread_state_awake (ts1, gv);
       nn_xpack_send_real (xp);
       nn_xpack_free (xp);
+      thread_state_asleep (ts1);
       ddsrt_mutex_lock (&gv->sendq_lock);
     }
   }
@@ -1437,7 +1542,7 @@ void nn_xpack_sendq_init (struct ddsi_domaingv *gv)
 
 void nn_xpack_sendq_start (struct ddsi_domaingv *gv)
 {
-  if (create_thread (&gv->sendq_ts, gv, "sendq", nn_xpack_sendq_thread, NULL) != DDS_RETCODE_OK)
+  if (create_thread (&gv->sendq_ts, gv, "sendq", nn_xpack_sendq_thread, gv) != DDS_RETCODE_OK)
     GVERROR ("nn_xpack_sendq_start: can't create nn_xpack_sendq_thread\n");
 }
 
@@ -1457,34 +1562,70 @@ void nn_xpack_sendq_fini (struct ddsi_domaingv *gv)
   ddsrt_mutex_destroy (&gv->sendq_lock);
 }
 
+ddsi_tran_conn_t nn_xmit_conn_for_priority (const struct ddsi_domaingv *gv, int32_t priority)
+{
+  for (uint32_t i = 0; i < gv->n_xmit_classes; i++)
+    if (priority >= gv->xmit_classes[i].min_priority)
+      return gv->xmit_classes[i].conn;
+  return gv->xmit_conn;
+}
+
 void nn_xpack_send (struct nn_xpack *xp, bool immediately)
 {
   if (!xp->async_mode)
   {
     nn_xpack_send_real (xp);
   }
-  else
+  else if (xp->niov > 0)
   {
     struct ddsi_domaingv * const gv = xp->gv;
     struct nn_xpack *xp1 = ddsrt_malloc (sizeof (*xp));
     memcpy (xp1, xp, sizeof (*xp1));
+    /* the copy takes over the iovecs, which refer to the RTPS header and the
+       MSG_LEN submessage in the xpack itself and must follow them; the next
+       message added to xp allocates new ones */
+    for (size_t i = 0; i < xp1->niov && i < 2; i++)
+    {
+      if (xp1->iov[i].iov_base == (void *) &xp->hdr)
+        xp1->iov[i].iov_base = (void *) &xp1->hdr;
+      else if (xp1->iov[i].iov_base == (void *) &xp->msg_len)
+        xp1->iov[i].iov_base = (void *) &xp1->msg_len;
+    }
+    if (gv->thread_pool)
+      ddsi_sem_init (&xp1->sem, 0);
+    xp->iov = NULL;
     nn_xpack_reinit (xp);
     xp1->sendq_next = NULL;
     ddsrt_mutex_lock (&gv->sendq_lock);
     if (immediately || gv->sendq_length == SENDQ_HW)
       ddsrt_cond_broadcast (&gv->sendq_cond);
-    if (gv->sendq_length >= SENDQ_MAX)
+    const bool preempt = (gv->config.priority_scheduling_enable && gv->sendq_head && xp1->priority > gv->sendq_tail->priority);
+    if (gv->sendq_length >= (preempt ? SENDQ_PREEMPT_MAX : SENDQ_MAX))
     {
       while (gv->sendq_length > SENDQ_LW)
         ddsrt_cond_wait (&gv->sendq_cond, &gv->sendq_lock);
     }
-    if (gv->sendq_head)
+    if (gv->sendq_head == NULL)
+    {
+      gv->sendq_head = gv->sendq_tail = xp1;
+    }
+    else if (!gv->config.priority_scheduling_enable || xp1->priority <= gv->sendq_tail->priority)
+    {
       gv->sendq_tail->sendq_next = xp1;
+      gv->sendq_tail = xp1;
+    }
     else
     {
-      gv->sendq_head = xp1;
+      /* insert after the last packet of at least the same priority, the queue
+         may have drained while waiting so it can't be done any earlier */
+      struct nn_xpack **prev = &gv->sendq_head;
+      while (*prev && (*prev)->priority >= xp1->priority)
+        prev = &(*prev)->sendq_next;
+      xp1->sendq_next = *prev;
+      *prev = xp1;
+      if (xp1->sendq_next == NULL)
+        gv->sendq_tail = xp1;
     }
-    gv->sendq_tail = xp1;
     gv->sendq_length++;
     ddsrt_mutex_unlock (&gv->sendq_lock);
   }
@@ -1610,9 +1751,6 @@ int nn_xpack_addmsg (struct nn_xpack *xp, struct nn_xmsg *m, const uint32_t flag
   assert ((m->sz % 4) == 0);
   assert (m->refd_payload == NULL || (m->refd_payload_iov.iov_len % 4) == 0);
 
-  if (xp->iov == NULL)
-    xp->iov = ddsrt_malloc (NN_XMSG_MAX_MESSAGE_IOVECS * sizeof (*xp->iov));
-
   if (!nn_xpack_mayaddmsg (xp, m, flags))
   {
     assert (xp->niov > 0);
@@ -1621,6 +1759,10 @@ int nn_xpack_addmsg (struct nn_xpack *xp, struct nn_xmsg *m, const uint32_t flag
     result = 1;
   }
 
+  /* sending it asynchronously hands the iovecs over to the send thread */
+  if (xp->iov == NULL)
+    xp->iov = ddsrt_malloc (NN_XMSG_MAX_MESSAGE_IOVECS * sizeof (*xp->iov));
+
   niov = xp->niov;
   sz = xp->msg_len.length;
 
@@ -1703,6 +1845,8 @@ int nn_xpack_addmsg (struct nn_xpack *xp, struct nn_xmsg *m, const uint32_t flag
   /* Adding this message may shorten the time this xpack may linger */
   if (m->maxdelay < xp->maxdelay)
     xp->maxdelay = m->maxdelay;
+  if (m->priority > xp->priority)
+    xp->priority = m->priority;
 
   /* If m's dst differs from that of the dst currently set in the
      packed message, add an InfoDST note. Note that neither has to
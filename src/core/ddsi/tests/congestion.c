@@ -0,0 +1,111 @@
+/*
+ * Copyright(c) 2020 ADLINK Technology Limited and others
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License v. 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0, or the Eclipse Distribution License
+ * v. 1.0 which is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+ */
+#include <string.h>
+
+#include "CUnit/Test.h"
+#include "dds/ddsi/q_config.h"
+#include "dds/ddsi/ddsi_congestion.h"
+
+#define MIN_RATE 1000000u
+#define MAX_RATE 65000000u
+
+static ddsrt_mtime_t t_at (int64_t ms)
+{
+  ddsrt_mtime_t t = { DDS_SECS (1) + DDS_MSECS (ms) };
+  return t;
+}
+
+static void init_cc (struct ddsi_congestion *cc)
+{
+  struct config config;
+  memset (&config, 0, sizeof (config));
+  config.congestion_control_enable = 1;
+  config.congestion_min_rate = MIN_RATE;
+  config.congestion_max_rate = MAX_RATE;
+  ddsi_congestion_init (cc, &config, t_at (0));
+}
+
+CU_Test(ddsi_congestion_control, pace)
+{
+  /* the delay is the transmit time of what was paced minus the time that
+     passed since, with the credit from an idle period capped */
+  struct ddsi_congestion cc;
+  init_cc (&cc);
+  CU_ASSERT (cc.rate == MAX_RATE);
+  CU_ASSERT (ddsi_congestion_pace (&cc, MAX_RATE / 100, t_at (0)) == DDS_MSECS (10));
+  CU_ASSERT (ddsi_congestion_pace (&cc, MAX_RATE / 100, t_at (5)) == DDS_MSECS (15));
+  CU_ASSERT (ddsi_congestion_pace (&cc, MAX_RATE / 1000, t_at (1000)) == DDS_MSECS (1) - DDSI_CONGESTION_MIN_DELAY);
+}
+
+CU_Test(ddsi_congestion_control, cancel)
+{
+  /* a sample that was paced but not sent doesn't count */
+  struct ddsi_congestion cc;
+  init_cc (&cc);
+  (void) ddsi_congestion_pace (&cc, MAX_RATE / 100, t_at (0));
+  (void) ddsi_congestion_pace (&cc, MAX_RATE / 10, t_at (0));
+  ddsi_congestion_cancel (&cc, MAX_RATE / 10);
+  CU_ASSERT (cc.balance == DDS_MSECS (10));
+  CU_ASSERT (cc.round_bytes == MAX_RATE / 100);
+}
+
+CU_Test(ddsi_congestion_control, decrease)
+{
+  /* halved at most once per round, but never below the minimum */
+  struct ddsi_congestion cc;
+  init_cc (&cc);
+  ddsi_congestion_note_nack (&cc, 1000, t_at (0));
+  CU_ASSERT (cc.rate == MAX_RATE / 2);
+  ddsi_congestion_note_nack (&cc, 1000, t_at (5));
+  CU_ASSERT (cc.rate == MAX_RATE / 2);
+  for (int64_t t = 10; t <= 100; t += 10)
+    ddsi_congestion_note_nack (&cc, 1000, t_at (t));
+  CU_ASSERT (cc.rate == MIN_RATE);
+}
+
+CU_Test(ddsi_congestion_control, increase)
+{
+  /* a round with data and without retransmit requests increases the rate
+     linearly, an idle round doesn't */
+  const uint32_t step = (MAX_RATE - MIN_RATE) / 64;
+  struct ddsi_congestion cc;
+  init_cc (&cc);
+  ddsi_congestion_note_nack (&cc, 1000, t_at (0));
+  CU_ASSERT_FATAL (cc.rate == MAX_RATE / 2);
+  (void) ddsi_congestion_pace (&cc, 1000, t_at (10));
+  CU_ASSERT (cc.rate == MAX_RATE / 2);
+  (void) ddsi_congestion_pace (&cc, 1000, t_at (20));
+  CU_ASSERT (cc.rate == MAX_RATE / 2 + step);
+  (void) ddsi_congestion_pace (&cc, 1000, t_at (1000));
+  CU_ASSERT (cc.rate == MAX_RATE / 2 + 2 * step);
+  ddsi_congestion_note_rtt (&cc, DDS_MSECS (50));
+  (void) ddsi_congestion_pace (&cc, 1000, t_at (1040));
+  CU_ASSERT (cc.rate == MAX_RATE / 2 + 2 * step);
+  for (int64_t t = 1050; t <= 1050 + 64 * 50; t += 50)
+    (void) ddsi_congestion_pace (&cc, 1000, t_at (t));
+  CU_ASSERT (cc.rate == MAX_RATE);
+}
+
+CU_Test(ddsi_congestion_control, loss)
+{
+  /* loss is the smoothed fraction of retransmitted bytes per round */
+  struct ddsi_congestion cc;
+  init_cc (&cc);
+  (void) ddsi_congestion_pace (&cc, 4000, t_at (0));
+  ddsi_congestion_note_nack (&cc, 2000, t_at (5));
+  CU_ASSERT (cc.loss == 0);
+  (void) ddsi_congestion_pace (&cc, 4000, t_at (10));
+  CU_ASSERT (cc.loss == 500 / 4);
+  ddsi_congestion_note_nack (&cc, 8000, t_at (15));
+  (void) ddsi_congestion_pace (&cc, 4000, t_at (20));
+  CU_ASSERT (cc.loss == (3 * (500 / 4) + 1000) / 4);
+}
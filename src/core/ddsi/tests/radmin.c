@@ -0,0 +1,623 @@
+/*
+ * Copyright(c) 2020 ADLINK Technology Limited and others
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License v. 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0, or the Eclipse Distribution License
+ * v. 1.0 which is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+ */
+#include <string.h>
+
+#include "CUnit/Test.h"
+#include "dds/ddsrt/heap.h"
+#include "dds/ddsrt/log.h"
+#include "dds/ddsi/q_bitset.h"
+#include "dds/ddsi/q_radmin.h"
+
+static struct ddsrt_log_cfg logcfg;
+static struct nn_rbufpool *rbpool;
+
+static void radmin_init (void)
+{
+  dds_log_cfg_init (&logcfg, 0, 0, NULL, NULL);
+  rbpool = nn_rbufpool_new (&logcfg, 1048576, 65536);
+  CU_ASSERT_FATAL (rbpool != NULL);
+}
+
+static void radmin_fini (void)
+{
+  nn_rbufpool_free (rbpool);
+}
+
+static void free_chain (struct nn_rsample_chain *sc)
+{
+  /* same as what the delivery path does once it is done with the samples */
+  while (sc->first)
+  {
+    struct nn_rsample_chain_elem *e = sc->first;
+    sc->first = e->next;
+    nn_fragchain_unref (e->fragchain);
+  }
+}
+
+static nn_reorder_result_t store_sample (struct nn_defrag *defrag, struct nn_reorder *reorder, seqno_t seq, struct nn_rsample_chain *sc)
+{
+  struct nn_rsample_info si;
+  struct nn_rmsg *rmsg;
+  struct nn_rdata *rdata, *fragchain;
+  struct nn_rsample *rsample;
+  nn_reorder_result_t res;
+  int refc_adjust = 0;
+  memset (&si, 0, sizeof (si));
+  si.seq = seq;
+  si.size = 4;
+  rmsg = nn_rmsg_new (rbpool);
+  CU_ASSERT_FATAL (rmsg != NULL);
+  nn_rmsg_setsize (rmsg, 16);
+  rdata = nn_rdata_new (rmsg, 0, 4, 0, 0);
+  CU_ASSERT_FATAL (rdata != NULL);
+  rsample = nn_defrag_rsample (defrag, rdata, &si);
+  CU_ASSERT_FATAL (rsample != NULL);
+  fragchain = nn_rsample_fragchain (rsample);
+  res = nn_reorder_rsample (sc, reorder, rsample, &refc_adjust, 0);
+  nn_fragchain_adjust_refcount (fragchain, refc_adjust);
+  nn_rmsg_commit (rmsg);
+  return res;
+}
+
+static nn_reorder_result_t store_gap (struct nn_reorder *reorder, seqno_t min, seqno_t maxp1, struct nn_rsample_chain *sc)
+{
+  struct nn_rmsg *rmsg;
+  struct nn_rdata *gap;
+  nn_reorder_result_t res;
+  int refc_adjust = 0;
+  rmsg = nn_rmsg_new (rbpool);
+  CU_ASSERT_FATAL (rmsg != NULL);
+  nn_rmsg_setsize (rmsg, 16);
+  gap = nn_rdata_newgap (rmsg);
+  CU_ASSERT_FATAL (gap != NULL);
+  res = nn_reorder_gap (sc, reorder, gap, min, maxp1, &refc_adjust);
+  nn_fragchain_adjust_refcount (gap, refc_adjust);
+  nn_rmsg_commit (rmsg);
+  return res;
+}
+
+CU_Test (ddsi_radmin, reorder_evict_gap, .init = radmin_init, .fini = radmin_fini)
+{
+  /* A full reorder admin drops the highest sequence number to make room,
+     which may well be part of a gap. The sequence numbers are far ahead
+     of the next expected one so that everything ends up in the interval
+     tree. */
+  struct nn_defrag *defrag = nn_defrag_new (&logcfg, NN_DEFRAG_DROP_LATEST, 4, 0);
+  struct nn_reorder *reorder = nn_reorder_new (&logcfg, NN_REORDER_MODE_NORMAL, 3, false);
+  struct nn_rsample_chain sc;
+
+  /* gap in an interval of its own: [1000] [1004,1005] */
+  CU_ASSERT_FATAL (store_sample (defrag, reorder, 1000, &sc) == NN_REORDER_ACCEPT);
+  CU_ASSERT_FATAL (store_gap (reorder, 1004, 1006, &sc) == NN_REORDER_ACCEPT);
+  CU_ASSERT (!nn_reorder_wantsample (reorder, 1004));
+  /* gap followed by a sample: [1000] [1004,1005,1006] */
+  CU_ASSERT_FATAL (store_sample (defrag, reorder, 1006, &sc) == NN_REORDER_ACCEPT);
+  /* full: storing 1002 evicts 1006 from [1004,1006], then the gap */
+  CU_ASSERT_FATAL (store_sample (defrag, reorder, 1002, &sc) == NN_REORDER_ACCEPT);
+  CU_ASSERT (nn_reorder_wantsample (reorder, 1006));
+  CU_ASSERT (!nn_reorder_wantsample (reorder, 1004));
+  CU_ASSERT_FATAL (store_sample (defrag, reorder, 1001, &sc) == NN_REORDER_ACCEPT);
+  CU_ASSERT (nn_reorder_wantsample (reorder, 1004));
+  CU_ASSERT (!nn_reorder_wantsample (reorder, 1002));
+
+  /* everything up to 1003 can now be delivered */
+  CU_ASSERT_FATAL (store_gap (reorder, 1, 1000, &sc) == 3);
+  CU_ASSERT (sc.first->sampleinfo->seq == 1000);
+  CU_ASSERT (sc.last->sampleinfo->seq == 1002);
+  free_chain (&sc);
+  CU_ASSERT (nn_reorder_next_seq (reorder) == 1003);
+
+  nn_reorder_free (reorder);
+  nn_defrag_free (defrag);
+}
+
+static uint32_t chain_check_and_free (struct nn_rsample_chain *sc, seqno_t first)
+{
+  /* checks the chain holds consecutive sequence numbers starting at
+     "first", returns the length */
+  uint32_t n = 0;
+  for (const struct nn_rsample_chain_elem *e = sc->first; e; e = e->next)
+    CU_ASSERT (e->sampleinfo->seq == first + n++);
+  free_chain (sc);
+  return n;
+}
+
+CU_Test (ddsi_radmin, reorder_window_wrap, .init = radmin_init, .fini = radmin_fini)
+{
+  /* Blocks of samples arriving in reverse order, going around the
+     window's ring a couple of times, with a block straddling the end of
+     the ring every now and then */
+  struct nn_defrag *defrag = nn_defrag_new (&logcfg, NN_DEFRAG_DROP_LATEST, 4, 0);
+  struct nn_reorder *reorder = nn_reorder_new (&logcfg, NN_REORDER_MODE_NORMAL, 1000, false);
+  struct nn_rsample_chain sc;
+  const seqno_t block = 100;
+  for (seqno_t base = 1; base < 1200; base += block)
+  {
+    for (seqno_t seq = base + block - 1; seq > base; seq--)
+    {
+      CU_ASSERT_FATAL (store_sample (defrag, reorder, seq, &sc) == NN_REORDER_ACCEPT);
+      CU_ASSERT (!nn_reorder_wantsample (reorder, seq));
+      CU_ASSERT (nn_reorder_wantsample (reorder, seq - 1));
+    }
+    /* a duplicate is rejected */
+    CU_ASSERT (store_sample (defrag, reorder, base + 1, &sc) == NN_REORDER_REJECT);
+    CU_ASSERT_FATAL (store_sample (defrag, reorder, base, &sc) == block);
+    CU_ASSERT (chain_check_and_free (&sc, base) == block);
+    CU_ASSERT (nn_reorder_next_seq (reorder) == base + block);
+    CU_ASSERT (store_sample (defrag, reorder, base, &sc) == NN_REORDER_TOO_OLD);
+  }
+  nn_reorder_free (reorder);
+  nn_defrag_free (defrag);
+}
+
+CU_Test (ddsi_radmin, reorder_window_gaps, .init = radmin_init, .fini = radmin_fini)
+{
+  /* Gaps in the window, for which the NACK bitmap must only contain the
+     sequence numbers that are neither received nor covered by a gap */
+  struct nn_defrag *defrag = nn_defrag_new (&logcfg, NN_DEFRAG_DROP_LATEST, 4, 0);
+  struct nn_reorder *reorder = nn_reorder_new (&logcfg, NN_REORDER_MODE_NORMAL, 1000, false);
+  struct nn_rsample_chain sc;
+  struct nn_sequence_number_set_header map;
+  uint32_t mapbits[8];
+
+  CU_ASSERT_FATAL (store_gap (reorder, 5, 40, &sc) == NN_REORDER_ACCEPT);
+  CU_ASSERT_FATAL (store_sample (defrag, reorder, 40, &sc) == NN_REORDER_ACCEPT);
+  CU_ASSERT_FATAL (store_sample (defrag, reorder, 3, &sc) == NN_REORDER_ACCEPT);
+  CU_ASSERT (!nn_reorder_wantsample (reorder, 7));
+  CU_ASSERT (!nn_reorder_wantsample (reorder, 3));
+  CU_ASSERT (nn_reorder_wantsample (reorder, 4));
+  CU_ASSERT (nn_reorder_wantsample (reorder, 41));
+  CU_ASSERT (store_sample (defrag, reorder, 20, &sc) == NN_REORDER_REJECT);
+
+  /* 1, 2, 4 missing and 41 .. 45 */
+  CU_ASSERT_FATAL (nn_reorder_nackmap (reorder, 1, 45, &map, mapbits, 256, 0) == 45);
+  for (uint32_t i = 0; i < 45; i++)
+  {
+    const seqno_t seq = 1 + i;
+    CU_ASSERT (nn_bitset_isset (map.numbits, mapbits, i) == (seq == 1 || seq == 2 || seq == 4 || seq > 40));
+  }
+  /* without the tail, the bitmap ends with the last missing one before
+     the highest known sequence number */
+  CU_ASSERT_FATAL (nn_reorder_nackmap (reorder, 1, 45, &map, mapbits, 256, 1) == 40);
+
+  CU_ASSERT_FATAL (store_sample (defrag, reorder, 1, &sc) == 1);
+  CU_ASSERT (chain_check_and_free (&sc, 1) == 1);
+  CU_ASSERT_FATAL (store_sample (defrag, reorder, 2, &sc) == 2);
+  CU_ASSERT (chain_check_and_free (&sc, 2) == 2);
+  /* 4 followed by the gap followed by 40 */
+  CU_ASSERT_FATAL (store_sample (defrag, reorder, 4, &sc) == 2);
+  CU_ASSERT (sc.first->sampleinfo->seq == 4 && sc.last->sampleinfo->seq == 40);
+  free_chain (&sc);
+  CU_ASSERT (nn_reorder_next_seq (reorder) == 41);
+
+  /* a gap at next_seq delivers what follows it */
+  CU_ASSERT_FATAL (store_sample (defrag, reorder, 43, &sc) == NN_REORDER_ACCEPT);
+  CU_ASSERT_FATAL (store_gap (reorder, 41, 43, &sc) == 1);
+  CU_ASSERT (chain_check_and_free (&sc, 43) == 1);
+  CU_ASSERT (nn_reorder_next_seq (reorder) == 44);
+
+  nn_reorder_free (reorder);
+  nn_defrag_free (defrag);
+}
+
+CU_Test (ddsi_radmin, reorder_window_and_tree, .init = radmin_init, .fini = radmin_fini)
+{
+  /* Sequence numbers beyond the window end up in the tree, and the
+     window must stop at the first one in the tree */
+  struct nn_defrag *defrag = nn_defrag_new (&logcfg, NN_DEFRAG_DROP_LATEST, 4, 0);
+  struct nn_reorder *reorder = nn_reorder_new (&logcfg, NN_REORDER_MODE_NORMAL, 1000, false);
+  struct nn_rsample_chain sc;
+  struct nn_sequence_number_set_header map;
+  uint32_t mapbits[8];
+
+  CU_ASSERT_FATAL (store_sample (defrag, reorder, 1000, &sc) == NN_REORDER_ACCEPT);
+  CU_ASSERT_FATAL (store_sample (defrag, reorder, 300, &sc) == NN_REORDER_ACCEPT);
+  CU_ASSERT_FATAL (store_sample (defrag, reorder, 200, &sc) == NN_REORDER_ACCEPT);
+  CU_ASSERT_FATAL (store_sample (defrag, reorder, 2, &sc) == NN_REORDER_ACCEPT);
+  CU_ASSERT (store_sample (defrag, reorder, 300, &sc) == NN_REORDER_REJECT);
+  CU_ASSERT (store_sample (defrag, reorder, 200, &sc) == NN_REORDER_REJECT);
+  CU_ASSERT (nn_reorder_wantsample (reorder, 299));
+  CU_ASSERT (!nn_reorder_wantsample (reorder, 1000));
+
+  /* bitmap covers window and tree */
+  CU_ASSERT_FATAL (nn_reorder_nackmap (reorder, 1, 1000, &map, mapbits, 256, 0) == 256);
+  for (uint32_t i = 0; i < 256; i++)
+  {
+    const seqno_t seq = 1 + i;
+    CU_ASSERT (nn_bitset_isset (map.numbits, mapbits, i) == (seq != 2 && seq != 200));
+  }
+  CU_ASSERT_FATAL (nn_reorder_nackmap (reorder, 1, 1000, &map, mapbits, 256, 1) == 256);
+
+  /* moving next_seq beyond the window doesn't lose the ones in the tree */
+  CU_ASSERT_FATAL (store_gap (reorder, 1, 2, &sc) == 1);
+  CU_ASSERT (chain_check_and_free (&sc, 2) == 1);
+  CU_ASSERT_FATAL (store_gap (reorder, 3, 200, &sc) == 1);
+  CU_ASSERT (chain_check_and_free (&sc, 200) == 1);
+  CU_ASSERT_FATAL (store_sample (defrag, reorder, 500, &sc) == NN_REORDER_ACCEPT);
+  CU_ASSERT_FATAL (store_gap (reorder, 201, 300, &sc) == 1);
+  CU_ASSERT (chain_check_and_free (&sc, 300) == 1);
+  CU_ASSERT (nn_reorder_next_seq (reorder) == 301);
+  CU_ASSERT (!nn_reorder_wantsample (reorder, 500));
+  CU_ASSERT_FATAL (store_sample (defrag, reorder, 400, &sc) == NN_REORDER_ACCEPT);
+  CU_ASSERT_FATAL (store_gap (reorder, 301, 400, &sc) == 1);
+  CU_ASSERT (chain_check_and_free (&sc, 400) == 1);
+  CU_ASSERT_FATAL (store_gap (reorder, 401, 1000, &sc) == 2);
+  CU_ASSERT (sc.first->sampleinfo->seq == 500 && sc.last->sampleinfo->seq == 1000);
+  free_chain (&sc);
+  CU_ASSERT (nn_reorder_next_seq (reorder) == 1001);
+
+  nn_reorder_free (reorder);
+  nn_defrag_free (defrag);
+}
+
+static uint32_t reorder_random (uint32_t *state)
+{
+  /* reproducible, which is what matters here */
+  *state = *state * 1103515245u + 12345u;
+  return *state >> 16;
+}
+
+CU_Test (ddsi_radmin, reorder_random, .init = radmin_init, .fini = radmin_fini)
+{
+  /* Random samples and gaps, mostly just ahead of next_seq but also far
+     beyond the window and before next_seq, compared against a trivial
+     model: a flag per sequence number whether it is known */
+#define N_SEQ 4000
+  struct nn_defrag *defrag = nn_defrag_new (&logcfg, NN_DEFRAG_DROP_LATEST, 4, 0);
+  struct nn_reorder *reorder = nn_reorder_new (&logcfg, NN_REORDER_MODE_NORMAL, N_SEQ, false);
+  struct nn_rsample_chain sc;
+  struct nn_sequence_number_set_header map;
+  uint32_t mapbits[8];
+  bool *known = ddsrt_calloc (N_SEQ + 1000, sizeof (*known));
+  bool *gap = ddsrt_calloc (N_SEQ + 1000, sizeof (*gap));
+  seqno_t next_seq = 1;
+  uint32_t state = 1;
+  while (next_seq < N_SEQ)
+  {
+    const uint32_t r = reorder_random (&state);
+    seqno_t seq = next_seq + (seqno_t) (r % 48) - 2;
+    if (r % 23 == 0)
+      seq += 250 + (seqno_t) (r % 300);
+    if (seq < 1)
+      seq = 1;
+
+    nn_reorder_result_t res;
+    seqno_t maxp1 = seq + 1;
+    if (r % 7 != 0)
+    {
+      res = store_sample (defrag, reorder, seq, &sc);
+      if (seq < next_seq)
+        CU_ASSERT_FATAL (res == NN_REORDER_TOO_OLD);
+      else if (known[seq])
+        CU_ASSERT_FATAL (res == NN_REORDER_REJECT);
+      else
+        known[seq] = true;
+    }
+    else
+    {
+      maxp1 = seq + 1 + (seqno_t) (r % 5);
+      res = store_gap (reorder, seq, maxp1, &sc);
+      for (seqno_t i = seq; i < maxp1; i++)
+      {
+        if (i >= next_seq && !known[i])
+          known[i] = gap[i] = true;
+      }
+    }
+
+    seqno_t expected = next_seq;
+    while (known[next_seq])
+      next_seq++;
+    CU_ASSERT_FATAL (nn_reorder_next_seq (reorder) == next_seq);
+    if (res > 0)
+    {
+      /* gaps stored in the tree are delivered as elements without
+         sampleinfo, which the delivery queue skips */
+      const struct nn_rsample_chain_elem *e = sc.first;
+      for (; expected < next_seq; expected++)
+      {
+        if (gap[expected])
+          continue;
+        while (e != NULL && e->sampleinfo == NULL)
+          e = e->next;
+        CU_ASSERT_FATAL (e != NULL && e->sampleinfo->seq == expected);
+        e = e->next;
+      }
+      while (e != NULL && e->sampleinfo == NULL)
+        e = e->next;
+      CU_ASSERT_FATAL (e == NULL);
+      free_chain (&sc);
+    }
+    else
+    {
+      for (; expected < next_seq; expected++)
+        CU_ASSERT_FATAL (gap[expected]);
+    }
+
+    /* a base below next_seq means the bitmap isn't aligned with the
+       window, and everything below next_seq is considered missing */
+    const seqno_t base = (next_seq > (seqno_t) (r % 8)) ? next_seq - (seqno_t) (r % 8) : 1;
+    const uint32_t numbits = nn_reorder_nackmap (reorder, base, base + 255, &map, mapbits, 256, 0);
+    CU_ASSERT_FATAL (numbits == 256);
+    for (uint32_t i = 0; i < numbits; i++)
+      CU_ASSERT_FATAL (nn_bitset_isset (numbits, mapbits, i) == (base + i < next_seq || !known[base + i]));
+    CU_ASSERT_FATAL (nn_reorder_wantsample (reorder, maxp1) == !known[maxp1]);
+  }
+  ddsrt_free (known);
+  ddsrt_free (gap);
+  nn_reorder_free (reorder);
+  nn_defrag_free (defrag);
+#undef N_SEQ
+}
+
+CU_Test (ddsi_radmin, retain_pinned_rbufs)
+{
+  /* Small samples retained in many rbufs would keep all those rbufs alive
+     while staying well within the budget for retained bytes, so retaining
+     fails once NN_RBUFPOOL_MAX_PINNED rbufs are pinned.  Every message fills
+     an rbuf of the smallest possible size. */
+  struct nn_rmsg *rmsgs[NN_RBUFPOOL_MAX_PINNED + 2];
+  struct nn_rmsg_retainer rs[NN_RBUFPOOL_MAX_PINNED + 2], r0;
+  struct nn_rbufpool *rbp;
+  uint32_t n_rbufs, rbuf_size, retained;
+  dds_log_cfg_init (&logcfg, 0, 0, NULL, NULL);
+  rbp = nn_rbufpool_new (&logcfg, 0, 1024);
+  CU_ASSERT_FATAL (rbp != NULL);
+  for (uint32_t i = 0; i < NN_RBUFPOOL_MAX_PINNED + 2; i++)
+  {
+    rmsgs[i] = nn_rmsg_new (rbp);
+    CU_ASSERT_FATAL (rmsgs[i] != NULL);
+    nn_rmsg_setsize (rmsgs[i], 1024);
+    rs[i].unpin = NULL;
+    /* the last one is used further on */
+    if (i < NN_RBUFPOOL_MAX_PINNED + 1)
+    {
+      CU_ASSERT_FATAL (nn_rmsg_retain (rmsgs[i], 8, &rs[i]) == (i < NN_RBUFPOOL_MAX_PINNED));
+      nn_rmsg_commit (rmsgs[i]);
+    }
+  }
+  nn_rbufpool_stats (rbp, &n_rbufs, &rbuf_size, &retained);
+  CU_ASSERT (n_rbufs == NN_RBUFPOOL_MAX_PINNED + 1);
+  CU_ASSERT (retained == 8 * NN_RBUFPOOL_MAX_PINNED);
+
+  /* a pinned rbuf can be retained again, another one once one is no longer pinned */
+  struct nn_rmsg * const last = rmsgs[NN_RBUFPOOL_MAX_PINNED + 1];
+  r0.unpin = NULL;
+  CU_ASSERT (nn_rmsg_retain (rmsgs[0], 8, &r0));
+  nn_rmsg_release (&r0);
+  CU_ASSERT (!nn_rmsg_retain (last, 8, &rs[NN_RBUFPOOL_MAX_PINNED + 1]));
+  nn_rmsg_release (&rs[1]);
+  CU_ASSERT_FATAL (nn_rmsg_retain (last, 8, &rs[NN_RBUFPOOL_MAX_PINNED + 1]));
+  nn_rmsg_commit (last);
+
+  for (uint32_t i = 0; i < NN_RBUFPOOL_MAX_PINNED + 2; i++)
+    if (i != 1 && i != NN_RBUFPOOL_MAX_PINNED)
+      nn_rmsg_release (&rs[i]);
+  nn_rbufpool_stats (rbp, &n_rbufs, &rbuf_size, &retained);
+  CU_ASSERT (n_rbufs == 1);
+  CU_ASSERT (retained == 0);
+  nn_rbufpool_free (rbp);
+}
+
+struct unpin_retainer {
+  struct nn_rmsg_retainer r;
+  bool accept;
+  struct nn_rmsg *unpinned;
+};
+
+static bool unpin_retainer (struct nn_rmsg_retainer *r)
+{
+  struct unpin_retainer * const ur = (struct unpin_retainer *) r;
+  if (!ur->accept)
+    return false;
+  ur->unpinned = r->rmsg;
+  return true;
+}
+
+CU_Test (ddsi_radmin, unpin_retained)
+{
+  /* Retainers of data in an rbuf get asked to unpin it when the pool moves on
+     to a new one, those that accept it no longer count as retaining data and
+     the rbuf is freed once they release the rmsg */
+  struct unpin_retainer urs[3];
+  struct nn_rbufpool *rbp;
+  struct nn_rmsg *rmsg;
+  uint32_t n_rbufs, rbuf_size, retained;
+  dds_log_cfg_init (&logcfg, 0, 0, NULL, NULL);
+  rbp = nn_rbufpool_new (&logcfg, 0, 1024);
+  CU_ASSERT_FATAL (rbp != NULL);
+  rmsg = nn_rmsg_new (rbp);
+  CU_ASSERT_FATAL (rmsg != NULL);
+  nn_rmsg_setsize (rmsg, 1024);
+  for (int i = 0; i < 3; i++)
+  {
+    urs[i].r.unpin = unpin_retainer;
+    urs[i].accept = (i != 1);
+    urs[i].unpinned = NULL;
+    CU_ASSERT_FATAL (nn_rmsg_retain (rmsg, 8, &urs[i].r));
+  }
+  nn_rmsg_commit (rmsg);
+
+  /* the next message requires a new rbuf */
+  rmsg = nn_rmsg_new (rbp);
+  CU_ASSERT_FATAL (rmsg != NULL);
+  nn_rmsg_commit (rmsg);
+  CU_ASSERT (urs[0].unpinned != NULL && urs[1].unpinned == NULL && urs[2].unpinned != NULL);
+  nn_rbufpool_stats (rbp, &n_rbufs, &rbuf_size, &retained);
+  CU_ASSERT (n_rbufs == 2);
+  CU_ASSERT (retained == 8);
+
+  /* releasing an unpinned one is a no-op, the rbuf stays until the last reference is gone */
+  nn_rmsg_release (&urs[0].r);
+  nn_rmsg_release_unpinned (urs[0].unpinned);
+  nn_rmsg_release (&urs[1].r);
+  nn_rbufpool_stats (rbp, &n_rbufs, &rbuf_size, &retained);
+  CU_ASSERT (n_rbufs == 2);
+  CU_ASSERT (retained == 0);
+  nn_rmsg_release_unpinned (urs[2].unpinned);
+  nn_rmsg_release (&urs[2].r);
+  nn_rbufpool_stats (rbp, &n_rbufs, &rbuf_size, &retained);
+  CU_ASSERT (n_rbufs == 1);
+  nn_rbufpool_free (rbp);
+}
+
+static struct nn_rsample *add_fragment (struct nn_rbufpool *rbp, struct nn_defrag *defrag, const struct nn_rsample_info *si, uint32_t fragnum)
+{
+  /* a message with an 8-byte "submessage header" followed by the fragment, the
+     value of each byte is its offset in the sample mod 256 */
+  struct nn_rmsg *rmsg;
+  struct nn_rdata *rdata;
+  struct nn_rsample *rsample;
+  const uint32_t min = fragnum * si->fragsize;
+  const uint32_t maxp1 = (min + si->fragsize < si->size) ? min + si->fragsize : si->size;
+  rmsg = nn_rmsg_new (rbp);
+  CU_ASSERT_FATAL (rmsg != NULL);
+  memset (NN_RMSG_PAYLOAD (rmsg), 0, 8);
+  for (uint32_t i = min; i < maxp1; i++)
+    NN_RMSG_PAYLOADOFF (rmsg, 8)[i - min] = (unsigned char) i;
+  nn_rmsg_setsize (rmsg, 8 + maxp1 - min);
+  rdata = nn_rdata_new (rmsg, min, maxp1, 0, 8);
+  CU_ASSERT_FATAL (rdata != NULL);
+  rsample = nn_defrag_rsample (defrag, rdata, si);
+  nn_rmsg_commit (rmsg);
+  return rsample;
+}
+
+CU_Test (ddsi_radmin, defrag_direct_after_fraction)
+{
+  /* Direct reassembly allocates memory for the entire sample, which it only
+     does once an eighth of it has been received, copying what has been received
+     so far.  Every message takes an rbuf of its own, so the number of rbufs
+     shows whether the fragments are still referenced. */
+#define NFRAGS 32
+  struct nn_rbufpool *rbp;
+  struct nn_defrag *defrag;
+  struct nn_rsample_info si;
+  struct receiver_state rst;
+  struct nn_rsample *rsample;
+  uint32_t n_rbufs, rbuf_size, retained;
+  dds_log_cfg_init (&logcfg, 0, 0, NULL, NULL);
+  rbp = nn_rbufpool_new (&logcfg, 0, 1024);
+  CU_ASSERT_FATAL (rbp != NULL);
+  defrag = nn_defrag_new (&logcfg, NN_DEFRAG_DROP_LATEST, 4, 1024);
+  CU_ASSERT_FATAL (defrag != NULL);
+  memset (&si, 0, sizeof (si));
+  memset (&rst, 0, sizeof (rst));
+  si.seq = 1;
+  si.fragsize = 128;
+  si.size = NFRAGS * si.fragsize - 3;
+  si.rst = &rst;
+
+  for (uint32_t i = 0; i < 3; i++)
+    CU_ASSERT_FATAL (add_fragment (rbp, defrag, &si, i) == NULL);
+  nn_rbufpool_stats (rbp, &n_rbufs, &rbuf_size, &retained);
+  CU_ASSERT (n_rbufs == 3);
+  CU_ASSERT_FATAL (add_fragment (rbp, defrag, &si, NFRAGS / 2) == NULL);
+  nn_rbufpool_stats (rbp, &n_rbufs, &rbuf_size, &retained);
+  CU_ASSERT (n_rbufs == 1);
+
+  /* duplicates and the remaining fragments in reverse order */
+  CU_ASSERT_FATAL (add_fragment (rbp, defrag, &si, 1) == NULL);
+  rsample = NULL;
+  for (uint32_t i = NFRAGS - 1; i >= 3; i--)
+  {
+    if (i == NFRAGS / 2)
+      continue;
+    rsample = add_fragment (rbp, defrag, &si, i);
+    CU_ASSERT_FATAL ((rsample != NULL) == (i == 3));
+  }
+  nn_rbufpool_stats (rbp, &n_rbufs, &rbuf_size, &retained);
+  CU_ASSERT (n_rbufs == 1);
+
+  /* a single contiguous rdata */
+  struct nn_rdata *fragchain = nn_rsample_fragchain (rsample);
+  CU_ASSERT_FATAL (fragchain->min == 0 && fragchain->maxp1 == si.size);
+  const unsigned char *payload = NN_RMSG_PAYLOADOFF (fragchain->rmsg, NN_RDATA_PAYLOAD_OFF (fragchain));
+  for (uint32_t i = 0; i < si.size; i++)
+    CU_ASSERT_FATAL (payload[i] == (unsigned char) i);
+  nn_fragchain_adjust_refcount (fragchain, 0);
+  nn_defrag_free (defrag);
+  nn_rbufpool_free (rbp);
+#undef NFRAGS
+}
+
+static void fec_parity (unsigned char *parity, uint32_t min, uint32_t maxp1, uint32_t unitsize)
+{
+  /* parity of bytes [min,maxp1) of a sample generated by add_fragment */
+  memset (parity, 0, unitsize);
+  for (uint32_t i = min; i < maxp1; i++)
+    parity[(i - min) % unitsize] ^= (unsigned char) i;
+}
+
+static void defrag_fec_recover (uint32_t direct_min_size)
+{
+  /* A sample of 4 fragments, the last one short, protected in groups of two
+     units of one fragment each: [0,200) and [200,370), of which fragment 2
+     is lost */
+  struct nn_rbufpool *rbp;
+  struct nn_defrag *defrag;
+  struct nn_rsample_info si;
+  struct receiver_state rst;
+  uint32_t n_rbufs, rbuf_size, retained;
+  unsigned char parity[100];
+  dds_log_cfg_init (&logcfg, 0, 0, NULL, NULL);
+  rbp = nn_rbufpool_new (&logcfg, 0, 1024);
+  CU_ASSERT_FATAL (rbp != NULL);
+  defrag = nn_defrag_new (&logcfg, NN_DEFRAG_DROP_LATEST, 4, direct_min_size);
+  CU_ASSERT_FATAL (defrag != NULL);
+  memset (&si, 0, sizeof (si));
+  memset (&rst, 0, sizeof (rst));
+  si.seq = 1;
+  si.fragsize = 100;
+  si.size = 370;
+  si.rst = &rst;
+  CU_ASSERT_FATAL (add_fragment (rbp, defrag, &si, 0) == NULL);
+  CU_ASSERT_FATAL (add_fragment (rbp, defrag, &si, 1) == NULL);
+  CU_ASSERT_FATAL (add_fragment (rbp, defrag, &si, 3) == NULL);
+  nn_rbufpool_stats (rbp, &n_rbufs, &rbuf_size, &retained);
+  CU_ASSERT (n_rbufs == (direct_min_size ? 1 : 3));
+
+  /* nothing missing, or a mismatch in the sample size */
+  fec_parity (parity, 0, 200, 100);
+  CU_ASSERT (nn_defrag_fec_recover (defrag, 1, 370, 0, 200, 100, parity) == UINT32_MAX);
+  fec_parity (parity, 200, 370, 100);
+  CU_ASSERT (nn_defrag_fec_recover (defrag, 1, 371, 200, 370, 100, parity) == UINT32_MAX);
+
+  /* one missing: the parity turns into the missing fragment */
+  fec_parity (parity, 200, 370, 100);
+  CU_ASSERT_FATAL (nn_defrag_fec_recover (defrag, 1, 370, 200, 370, 100, parity) == 0);
+  for (uint32_t i = 0; i < 100; i++)
+    CU_ASSERT_FATAL (parity[i] == (unsigned char) (200 + i));
+
+  /* two missing: fragments 1 and 2 of a sample of which only 0 arrived */
+  si.seq = 2;
+  CU_ASSERT_FATAL (add_fragment (rbp, defrag, &si, 0) == NULL);
+  fec_parity (parity, 100, 300, 100);
+  CU_ASSERT (nn_defrag_fec_recover (defrag, 2, 370, 100, 300, 100, parity) == UINT32_MAX);
+
+  /* an unknown sample can only be recovered if it consists of a single unit */
+  fec_parity (parity, 0, 100, 100);
+  CU_ASSERT (nn_defrag_fec_recover (defrag, 3, 100, 0, 100, 100, parity) == 0);
+  CU_ASSERT (nn_defrag_fec_recover (defrag, 3, 370, 0, 200, 100, parity) == UINT32_MAX);
+
+  nn_defrag_free (defrag);
+  nn_rbufpool_free (rbp);
+}
+
+CU_Test (ddsi_radmin, defrag_fec_recover)
+{
+  defrag_fec_recover (0);
+}
+
+CU_Test (ddsi_radmin, defrag_fec_recover_direct)
+{
+  defrag_fec_recover (256);
+}